@@ -360,6 +360,9 @@ void exitAll() {
     if (send_buffer)
         free(send_buffer);
     if (jtag_handler) {
+        // stops the handler's threads, if it has any
+        if (handlers_initialized)
+            JTAG_deinitialize(jtag_handler);
         free(jtag_handler);
         jtag_handler = NULL;
     }
@@ -687,6 +690,14 @@ STATUS determine_shift_end_state(ScanType scan_type, struct packet_data *packet,
     return status;
 }
 
+// Commands that only drive the JTAG handler and may be queued by it
+static bool is_jtag_command(uint8_t cmd) {
+    return cmd == WAIT_CYCLES_TCK_DISABLE || cmd == WAIT_CYCLES_TCK_ENABLE ||
+           cmd == TAP_RESET ||
+           (cmd >= TAP_STATE_MIN && cmd <= TAP_STATE_MAX) ||
+           cmd >= WRITE_SCAN_MIN;
+}
+
 STATUS process_jtag_message(struct spi_message *s_message) {
     int response_cnt = 0;
     JtagStates end_state;
@@ -721,6 +732,15 @@ STATUS process_jtag_message(struct spi_message *s_message) {
         }
 
         cmd = *data_ptr;
+        // pins and configuration must see the JTAG traffic before them
+        if (!is_jtag_command(cmd)) {
+            status = JTAG_flush(jtag_handler);
+            if(status != ST_OK) {
+                ASD_log(LogType_Error, "JTAG_flush failed");
+                break;
+            }
+        }
+
         if (cmd == WRITE_EVENT_CONFIG) {
             data_ptr = get_packet_data(&packet, 1);
             if (data_ptr == NULL) {
@@ -948,6 +968,12 @@ STATUS process_jtag_message(struct spi_message *s_message) {
         }
     }
 
+    // collect TDO of the scans still in flight before replying
+    if (JTAG_flush(jtag_handler) != ST_OK) {
+        ASD_log(LogType_Error, "JTAG_flush failed");
+        status = ST_ERR;
+    }
+
     if (status == ST_OK) {
         memcpy(&out_msg.header, &s_message->header, sizeof(struct message_header));
 
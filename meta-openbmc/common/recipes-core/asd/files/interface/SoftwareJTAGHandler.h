@@ -121,6 +121,10 @@ STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
 STATUS JTAG_wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles);
 STATUS JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck);
 STATUS JTAG_set_active_chain(JTAG_Handler* state, scanChain chain);
+// Wait until all queued JTAG operations reached the target and their
+// TDO data was stored. Handlers that do not queue need not define it,
+// the default in jtag_flush.c returns immediately.
+STATUS JTAG_flush(JTAG_Handler* state);
 
 #ifdef __cplusplus
 }
@@ -190,6 +190,10 @@ int main (int argc, char **argv) {
         printQ(qFlag,"Unable to read idcode!\n");
         goto error;
     }
+    if (JTAG_flush(handle) != ST_OK) {
+        printQ(qFlag,"Unable to read idcode!\n");
+        goto error;
+    }
 
     // this assumes that IDCODE is byte aligned since the JTAG spec says they're 32bits each.
     for (i = 0; i < (shiftSize/8); i++) {
@@ -297,6 +301,10 @@ int main (int argc, char **argv) {
             printQ(qFlag,"Unable to read shift data!\n");
             goto error;
         }
+        if (JTAG_flush(handle) != ST_OK) {
+            printQ(qFlag,"Unable to read shift data!\n");
+            goto error;
+        }
 
         memset(compareData, 0x00, sizeof(compareData));     // fill compareData with zeros
         memcpy(compareData, idcode, 4*numUncores); // copy the idcode from tap reset and shiftdr into compareData
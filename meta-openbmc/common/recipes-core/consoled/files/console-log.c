@@ -0,0 +1,478 @@
+/*
+ * consoled ring log
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "console-log.h"
+
+#define DATA_OFFSET       (2 * CONSOLE_LOG_HDR_SIZE)
+/* Most data held in memory between commits */
+#define BUFFER_SIZE       (64 * 1024)
+#define SCAN_CHUNK        4096
+/* How far past the bytes it must drop the tail looks for a line start */
+#define LINE_ALIGN_MAX    512
+/* Copies of a log consoled keeps wrapping over before a dump gives up */
+#define DUMP_RETRIES      10
+
+struct console_log {
+  int fd;
+  /* What the file holds, as of the last commit */
+  console_log_hdr_t hdr;
+  uint32_t max_lines;
+  int sync_ms;
+  /* Pending data, logically at [hdr.head, hdr.head + len) */
+  char *buf;
+  size_t len;
+  size_t buf_size;
+  size_t commit_bytes;
+  uint32_t buf_lines;
+  struct timespec first;
+};
+
+static uint32_t
+crc32(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint32_t crc = 0xFFFFFFFF;
+  int i;
+
+  while (len--) {
+    crc ^= *p++;
+    for (i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t
+count_lines(const char *p, size_t len)
+{
+  const char *end = p + len;
+  uint32_t n = 0;
+
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    n++;
+    p++;
+  }
+  return n;
+}
+
+static uint32_t
+hdr_crc(const console_log_hdr_t *hdr)
+{
+  return crc32(hdr, offsetof(console_log_hdr_t, crc));
+}
+
+static bool
+hdr_valid(const console_log_hdr_t *hdr, uint32_t capacity)
+{
+  return hdr->magic == CONSOLE_LOG_MAGIC &&
+         hdr->version == CONSOLE_LOG_VERSION &&
+         hdr->hdr_size == CONSOLE_LOG_HDR_SIZE &&
+         hdr->capacity == capacity &&
+         hdr->tail <= hdr->head &&
+         hdr->head - hdr->tail <= capacity &&
+         hdr->crc == hdr_crc(hdr);
+}
+
+/* The newest of the two header slots which is intact, -1 if none */
+static int
+load_hdr(int fd, uint32_t capacity, console_log_hdr_t *hdr)
+{
+  console_log_hdr_t slot[2];
+  int i, best = -1;
+
+  for (i = 0; i < 2; i++) {
+    if (pread(fd, &slot[i], sizeof(slot[i]), i * CONSOLE_LOG_HDR_SIZE) !=
+        sizeof(slot[i]) || !hdr_valid(&slot[i], capacity)) {
+      continue;
+    }
+    if (best < 0 || (int32_t)(slot[i].seq - slot[best].seq) > 0) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return -1;
+  }
+  *hdr = slot[best];
+  return 0;
+}
+
+/* Write hdr to the slot the current header is not in */
+static int
+store_hdr(console_log_t *log, console_log_hdr_t *hdr)
+{
+  hdr->seq = log->hdr.seq + 1;
+  hdr->crc = hdr_crc(hdr);
+  if (pwrite(log->fd, hdr, sizeof(*hdr),
+             (hdr->seq & 1) * CONSOLE_LOG_HDR_SIZE) != sizeof(*hdr)) {
+    return -1;
+  }
+  if (fdatasync(log->fd)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Read or write the logical range [pos, pos + len) of the data area,
+ * wrapping around its end */
+static int
+data_io(int fd, uint32_t capacity, uint64_t pos, char *buf, size_t len,
+        bool write)
+{
+  while (len) {
+    size_t off = pos % capacity;
+    size_t n = len < capacity - off ? len : capacity - off;
+    ssize_t ret = write ? pwrite(fd, buf, n, DATA_OFFSET + off) :
+                          pread(fd, buf, n, DATA_OFFSET + off);
+    if (ret <= 0) {
+      return -1;
+    }
+    pos += ret;
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/*
+ * Count the lines in [from, to), committed or pending, stopping right
+ * after the want-th line if want is not 0. *end is where it stopped.
+ */
+static uint32_t
+scan_lines(console_log_t *log, uint64_t from, uint64_t to, uint32_t want,
+           uint64_t *end)
+{
+  char chunk[SCAN_CHUNK];
+  uint32_t lines = 0;
+
+  while (from < to) {
+    size_t n = to - from < SCAN_CHUNK ? to - from : SCAN_CHUNK;
+    const char *p, *nl;
+
+    if (from >= log->hdr.head) {
+      p = log->buf + (from - log->hdr.head);
+    } else {
+      if (n > log->hdr.head - from) {
+        n = log->hdr.head - from;
+      }
+      if (data_io(log->fd, log->hdr.capacity, from, chunk, n, false)) {
+        break;
+      }
+      p = chunk;
+    }
+    if (!want) {
+      lines += count_lines(p, n);
+      from += n;
+      continue;
+    }
+    for (nl = p; (nl = memchr(nl, '\n', p + n - nl)) != NULL; nl++) {
+      if (++lines == want) {
+        from += nl + 1 - p;
+        goto out;
+      }
+    }
+    from += n;
+  }
+out:
+  if (end) {
+    *end = from;
+  }
+  return lines;
+}
+
+static void
+init_hdr(console_log_hdr_t *hdr, uint32_t capacity)
+{
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = CONSOLE_LOG_MAGIC;
+  hdr->version = CONSOLE_LOG_VERSION;
+  hdr->hdr_size = CONSOLE_LOG_HDR_SIZE;
+  hdr->capacity = capacity;
+}
+
+console_log_t *
+console_log_open(const char *path, size_t size, uint32_t max_lines,
+                 int sync_ms)
+{
+  console_log_t *log;
+  struct stat st;
+  uint32_t capacity;
+
+  if (size <= DATA_OFFSET + LINE_ALIGN_MAX * 4) {
+    return NULL;
+  }
+  capacity = size - DATA_OFFSET;
+
+  log = calloc(1, sizeof(*log));
+  if (!log) {
+    return NULL;
+  }
+  log->max_lines = max_lines;
+  log->sync_ms = sync_ms;
+  log->buf_size = capacity / 4 < BUFFER_SIZE ? capacity / 4 : BUFFER_SIZE;
+  log->commit_bytes = log->buf_size / 2;
+  log->buf = malloc(log->buf_size);
+  log->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (!log->buf || log->fd < 0) {
+    syslog(LOG_WARNING, "Cannot open the file %s", path);
+    goto bail;
+  }
+
+  if (fstat(log->fd, &st) == 0 && st.st_size == size &&
+      load_hdr(log->fd, capacity, &log->hdr) == 0) {
+    return log;
+  }
+
+  /* Not a log of this size: start a fresh one, all of it allocated now */
+  init_hdr(&log->hdr, capacity);
+  if (ftruncate(log->fd, 0) || posix_fallocate(log->fd, 0, size) ||
+      store_hdr(log, &log->hdr)) {
+    syslog(LOG_WARNING, "Cannot set up the file %s", path);
+    goto bail;
+  }
+  return log;
+bail:
+  if (log->fd >= 0) {
+    close(log->fd);
+  }
+  free(log->buf);
+  free(log);
+  return NULL;
+}
+
+int
+console_log_commit(console_log_t *log)
+{
+  console_log_hdr_t hdr = log->hdr;
+  uint64_t head = hdr.head + log->len;
+  uint64_t need, end;
+  uint32_t capacity = hdr.capacity;
+  uint32_t lines = hdr.lines + log->buf_lines;
+  uint64_t tail = hdr.tail;
+  int ret = -1;
+
+  if (!log->len) {
+    return 0;
+  }
+
+  /*
+   * The data is about to overwrite the oldest bytes: drop them first,
+   * in a header committed before the data goes over them. A bit more
+   * than needed is dropped so that the next commits find room.
+   */
+  need = head > capacity ? head - capacity : 0;
+  if (need > tail) {
+    uint64_t target = need + capacity / 16;
+    if (target > hdr.head) {
+      target = hdr.head;
+    }
+    if (target < need) {
+      target = need;
+    }
+    lines -= scan_lines(log, tail, target, 0, NULL);
+    tail = target;
+    /* Start at a line, if one begins soon enough */
+    if (scan_lines(log, tail, tail + LINE_ALIGN_MAX < head ?
+                   tail + LINE_ALIGN_MAX : head, 1, &end)) {
+      lines--;
+      tail = end;
+    }
+
+    hdr.tail = tail < hdr.head ? tail : hdr.head;
+    hdr.lines = tail < hdr.head ? lines - log->buf_lines : 0;
+    if (store_hdr(log, &hdr)) {
+      goto out;
+    }
+    log->hdr.seq = hdr.seq;
+    log->hdr.tail = hdr.tail;
+    log->hdr.lines = hdr.lines;
+  }
+
+  /* Too many lines: drop the oldest */
+  if (log->max_lines && lines > log->max_lines) {
+    lines -= scan_lines(log, tail, head, lines - log->max_lines, &tail);
+  }
+
+  if (data_io(log->fd, capacity, hdr.head, log->buf, log->len, true) ||
+      fdatasync(log->fd)) {
+    goto out;
+  }
+  hdr.head = head;
+  hdr.tail = tail;
+  hdr.lines = lines;
+  if (store_hdr(log, &hdr)) {
+    goto out;
+  }
+  log->hdr = hdr;
+  ret = 0;
+out:
+  if (ret) {
+    syslog(LOG_WARNING, "console_log_commit: %zu bytes lost, errno: %d",
+           log->len, errno);
+  }
+  log->len = 0;
+  log->buf_lines = 0;
+  return ret;
+}
+
+static long
+elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000 +
+         (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+int
+console_log_timeout(console_log_t *log)
+{
+  long left;
+
+  if (!log->len) {
+    return -1;
+  }
+  left = log->sync_ms - elapsed_ms(&log->first);
+  return left > 0 ? (int)left : 0;
+}
+
+int
+console_log_write(console_log_t *log, const char *buf, size_t len)
+{
+  int ret = 0;
+
+  while (len) {
+    size_t n = log->buf_size - log->len;
+    if (n > len) {
+      n = len;
+    }
+    if (!log->len) {
+      clock_gettime(CLOCK_MONOTONIC, &log->first);
+    }
+    memcpy(log->buf + log->len, buf, n);
+    log->buf_lines += count_lines(buf, n);
+    log->len += n;
+    buf += n;
+    len -= n;
+
+    if (log->len >= log->commit_bytes || log->sync_ms <= 0 ||
+        console_log_timeout(log) == 0) {
+      if (console_log_commit(log)) {
+        ret = -1;
+      }
+    }
+  }
+  return ret;
+}
+
+uint32_t
+console_log_lines(console_log_t *log)
+{
+  return log->hdr.lines + log->buf_lines;
+}
+
+uint64_t
+console_log_bytes(console_log_t *log)
+{
+  return log->hdr.head - log->hdr.tail + log->len;
+}
+
+void
+console_log_close(console_log_t *log)
+{
+  if (!log) {
+    return;
+  }
+  console_log_commit(log);
+  close(log->fd);
+  free(log->buf);
+  free(log);
+}
+
+static int
+write_all(int fd, const char *p, size_t n)
+{
+  while (n) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+int
+console_log_dump(const char *path, int out)
+{
+  console_log_hdr_t hdr, now;
+  struct stat st;
+  char *buf = NULL;
+  uint64_t skip;
+  int fd, tries, ret = -1;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) || st.st_size <= DATA_OFFSET ||
+      (buf = malloc(st.st_size - DATA_OFFSET)) == NULL) {
+    goto out;
+  }
+  /*
+   * consoled may wrap over what is being read: it commits a header
+   * dropping the bytes before it writes over them, so what is still past
+   * the tail of a header loaded after the copy is intact.
+   */
+  for (tries = 0; tries < DUMP_RETRIES; tries++) {
+    if (load_hdr(fd, st.st_size - DATA_OFFSET, &hdr) ||
+        data_io(fd, hdr.capacity, hdr.tail, buf, hdr.head - hdr.tail, false) ||
+        load_hdr(fd, hdr.capacity, &now)) {
+      goto out;
+    }
+    if (hdr.tail == hdr.head) {
+      ret = 0;
+      goto out;
+    }
+    if (now.tail >= hdr.tail && now.tail < hdr.head) {
+      skip = now.tail - hdr.tail;
+      ret = write_all(out, buf + skip, hdr.head - hdr.tail - skip);
+      goto out;
+    }
+  }
+out:
+  free(buf);
+  close(fd);
+  return ret;
+}
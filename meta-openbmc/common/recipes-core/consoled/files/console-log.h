@@ -0,0 +1,100 @@
+/*
+ * consoled ring log
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __CONSOLE_LOG_H__
+#define __CONSOLE_LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Console history kept in a file of fixed size, allocated once: two
+ * header slots followed by a circular data area. The header tells where
+ * the oldest byte (tail) and the next one to write (head) are, so old
+ * output is dropped by moving the tail, with no rename or truncate.
+ *
+ * Data is gathered in memory and committed to the file as a group, once
+ * COMMIT_BYTES are pending or the oldest pending byte is sync_ms old.
+ * A commit writes the data, syncs it, then writes the header to the
+ * older of the two slots and syncs again. Should the process or the
+ * BMC go down at any point, the newest valid header describes data that
+ * is on the file: at most sync_ms of output is lost, none is garbled.
+ */
+
+#define CONSOLE_LOG_MAGIC     0x474c4e43 /* "CNLG" */
+#define CONSOLE_LOG_VERSION   1
+#define CONSOLE_LOG_HDR_SIZE  512
+/* Default size of the file, and most lines kept */
+#define CONSOLE_LOG_SIZE      (200 * 1024 + 2 * CONSOLE_LOG_HDR_SIZE)
+#define CONSOLE_LOG_LINES     2400
+/* Default durability interval */
+#define CONSOLE_LOG_SYNC_MS   1000
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdr_size;
+  uint32_t capacity;  /* bytes in the data area */
+  uint32_t seq;       /* bumped by every header write */
+  uint64_t head;      /* bytes ever written, the data area holds */
+  uint64_t tail;      /* [tail, head) at offset % capacity */
+  uint32_t lines;     /* '\n' in [tail, head) */
+  uint32_t crc;       /* of all of the above */
+} console_log_hdr_t;
+
+typedef struct console_log console_log_t;
+
+/*
+ * Open or create the log at path. An existing log of the same size is
+ * continued from its newest valid header, anything else is started
+ * afresh. sync_ms is the durability interval, 0 commits (and syncs)
+ * every console_log_write(). max_lines bounds the lines kept, 0 for no
+ * bound. Returns NULL on failure.
+ */
+console_log_t *console_log_open(const char *path, size_t size,
+                                uint32_t max_lines, int sync_ms);
+
+/* Add data. Commits when enough is pending; returns -1 if that failed */
+int console_log_write(console_log_t *log, const char *buf, size_t len);
+
+/* Commit what is pending now */
+int console_log_commit(console_log_t *log);
+
+/*
+ * Milliseconds until a commit is due, to be used as poll() timeout, and
+ * console_log_commit() called once it expires. -1 if nothing is pending.
+ */
+int console_log_timeout(console_log_t *log);
+
+/* Lines and bytes held, committed or not */
+uint32_t console_log_lines(console_log_t *log);
+uint64_t console_log_bytes(console_log_t *log);
+
+/* Commit and close */
+void console_log_close(console_log_t *log);
+
+/*
+ * Write the committed content of the log at path, oldest first, to fd.
+ * Safe while consoled writes to it: what it wrapped over during the copy
+ * is left out.
+ */
+int console_log_dump(const char *path, int fd);
+
+#endif /* __CONSOLE_LOG_H__ */
@@ -30,14 +30,15 @@
 #include <termios.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <openbmc/pal.h>
+#include "console-log.h"
 
 #define BAUDRATE      B57600
 #define CTRL_X        0x18
 #define ASCII_ENTER   0x0D
-#define MAX_LOGFILE_LINES 1200 // Maximum lines based on carriage returns or new line
-#define MAX_LOGFILE_SIZE 102400 // 100KB size => 1200 lines of 80 characters each = ~108000B
 static sig_atomic_t sigexit = 0;
+static int sync_ms = CONSOLE_LOG_SYNC_MS;
 
 static void
 write_data(int file, char *buf, int len, char *fname) {
@@ -66,19 +67,17 @@ exit_session(int sig)
 
 static void
 print_usage() {
-  printf("Usage: consoled [ %s ]\n", pal_server_list);
+  printf("Usage: consoled [ %s ] [ --buffer | --term | --dump ] [ --sync-ms <ms> ]\n",
+      pal_server_list);
 }
 
 static void
 run_console(char* fru_name, int term) {
 
-  int i;
   int tty;    // serial port
-  int buf_fd;  // Buffer File
   int blen;   // len for
   int nfd = 0;      // For number of fd
   int nevents;      // For number of events in fd
-  int nline = 0;
   //int pid_fd;
   int flags;
   pid_t pid;        // For pid of the daemon
@@ -89,7 +88,8 @@ run_console(char* fru_name, int term) {
   char devtty[32];  // For tty dev path
   char bfname[32];  // For buffer file path
   char old_bfname[32];  // For old buffer file path
-  char buf[256];    // For buffer data
+  char buf[4096];   // For buffer data
+  console_log_t *log;
   struct termios ottytio, nttytio;  // For the tty dev
 
   int stdi;    // STDIN_FILENO
@@ -97,8 +97,6 @@ run_console(char* fru_name, int term) {
   struct termios ostditio, nstditio;  // For STDIN_FILENO
   struct termios ostdotio, nstdotio;  // For STDOUT_FILENO
 
-  struct stat buf_stat;
-
   struct pollfd pfd[2];
 
   /* Start Daemon for the console buffering */
@@ -144,10 +142,13 @@ run_console(char* fru_name, int term) {
   pfd[0].events = POLLIN;
   nfd++;
 
-  /* Buffering the console data into a file */
+  /* Buffering the console data into a ring log, see console-log.h.
+   * The rotated file of the plain text log it replaces is gone */
   sprintf(old_bfname, "/tmp/consoled_%s_log-old", fru_name);
   sprintf(bfname, "/tmp/consoled_%s_log", fru_name);
-  if ((buf_fd = open(bfname, O_RDWR | O_APPEND | O_CREAT, 0666)) < 0) {
+  remove(old_bfname);
+  if (!(log = console_log_open(bfname, CONSOLE_LOG_SIZE, CONSOLE_LOG_LINES,
+                               sync_ms))) {
     syslog(LOG_WARNING, "Cannot open the file %s", bfname);
     exit(-1);
   }
@@ -175,8 +176,21 @@ run_console(char* fru_name, int term) {
     nfd++;
   }
 
-  /* Handling the input event from the  terminal and tty dev */
-  while (!sigexit && (nevents = poll(pfd, nfd, -1 /* Timeout */))) {
+  /* Handling the input event from the  terminal and tty dev. Console
+   * output is committed to the log once enough of it is pending, or
+   * when the oldest pending byte is sync_ms old */
+  while (!sigexit) {
+    nevents = poll(pfd, nfd, console_log_timeout(log));
+    if (nevents < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (nevents == 0) {
+      console_log_commit(log);
+      continue;
+    }
 
     /* Input to the terminal from the user */
     if (term && nevents && nfd > 1 && pfd[1].revents > 0) {
@@ -198,40 +212,19 @@ run_console(char* fru_name, int term) {
     if (nevents && pfd[0].revents > 0) {
       blen = read(tty, buf, sizeof(buf));
       if (blen > 0) {
-        for (i = 0; i < blen; i++) {
-          if (buf[i] == 0xD || buf[i] == 0xA)
-            nline++;
-        }
-        write_data(buf_fd, buf, blen, bfname);
-        fsync(buf_fd);
+        console_log_write(log, buf, blen);
         if (term) {
           write_data(stdo, buf, blen, "STDOUT_FILENO");
         }
       } else if (blen < 0) {
         raise(SIGHUP);
       }
-
-      // Get File stat information
-      memset(&buf_stat, 0, sizeof(struct stat));
-      fstat(buf_fd, &buf_stat);
-
-      /* Log Rotation based on max number of lines or max file size */
-      if (nline >= MAX_LOGFILE_LINES || buf_stat.st_size >= MAX_LOGFILE_SIZE) {
-        close(buf_fd);
-        remove(old_bfname);
-        rename(bfname, old_bfname);
-        if ((buf_fd = open(bfname, O_RDWR | O_APPEND | O_CREAT, 0666)) < 0) {
-          syslog(LOG_WARNING, "Cannot open the file %s", bfname);
-          exit(-1);
-        }
-        nline = 0;
-      }
       nevents--;
     }
   }
 
-  /* Close the console buffer file */
-  close(buf_fd);
+  /* Commit what is pending and close the console buffer file */
+  console_log_close(log);
 
   /* Revert the tty dev to old attributes */
   tcflush(tty, TCIFLUSH);
@@ -251,16 +244,29 @@ run_console(char* fru_name, int term) {
 }
 
 int
-main(int argc, void **argv) {
-  int dev, rc, lock_file;
+main(int argc, char **argv) {
+  int rc, lock_file;
   char file[64];
   int term;
   char *fru_name;
 
-  if (argc != 3) {
+  if (argc != 3 && !(argc == 5 && !strcmp(argv[3], "--sync-ms"))) {
     print_usage();
     exit(1);
   }
+  if (argc == 5) {
+    sync_ms = atoi(argv[4]);
+  }
+
+  // The history can be read while consoled runs
+  if (!strcmp(argv[2], "--dump")) {
+    sprintf(file, "/tmp/consoled_%s_log", argv[1]);
+    if (console_log_dump(file, STDOUT_FILENO)) {
+      printf("No console history for %s\n", argv[1]);
+      exit(-1);
+    }
+    return 0;
+  }
 
   // A lock file for one instance of consoled for each fru
   sprintf(file, "/var/lock/consoled_%s", argv[1]);
@@ -289,4 +295,3 @@ main(int argc, void **argv) {
 
   return sigexit;
 }
-
@@ -0,0 +1,433 @@
+/*
+ * consoled ring log test
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "console-log.h"
+
+/*
+ * The console log fed through a pty the way consoled does, plus direct
+ * checks of the ring: wrap around, line bound, reopen, a torn header,
+ * dumps while it wraps, and consoled killed at random points. The console output is numbered
+ * lines, so any dump can be checked for holes and garbage.
+ */
+
+#define SMALL_SIZE   (16 * 1024 + 2 * CONSOLE_LOG_HDR_SIZE)
+#define LINE_LEN     16
+
+static char path[256];
+
+static void
+make_line(char *buf, unsigned int n)
+{
+  snprintf(buf, LINE_LEN + 1, "line %010u\n", n);
+}
+
+static char *
+dump(size_t *len)
+{
+  char tmp[] = "/tmp/consoled-test-dumpXXXXXX";
+  int fd = mkstemp(tmp);
+  struct stat st;
+  char *buf;
+
+  assert(fd >= 0);
+  unlink(tmp);
+  assert(console_log_dump(path, fd) == 0);
+  fstat(fd, &st);
+  buf = malloc(st.st_size + 1);
+  assert(pread(fd, buf, st.st_size, 0) == st.st_size);
+  buf[st.st_size] = '\0';
+  close(fd);
+  *len = st.st_size;
+  return buf;
+}
+
+/*
+ * The dump is whole consecutive numbered lines, maybe ending with a
+ * part of the next one. Returns the number of the first line, stores
+ * the number of whole lines.
+ */
+static unsigned int
+check_dump(const char *buf, size_t len, unsigned int *lines)
+{
+  unsigned int first = 0, i;
+  char expect[LINE_LEN + 1];
+
+  *lines = len / LINE_LEN;
+  if (len >= LINE_LEN) {
+    assert(sscanf(buf, "line %010u\n", &first) == 1);
+  }
+  for (i = 0; i <= *lines && i * LINE_LEN < len; i++) {
+    size_t n = len - i * LINE_LEN < LINE_LEN ? len - i * LINE_LEN : LINE_LEN;
+    make_line(expect, first + i);
+    if (memcmp(buf + i * LINE_LEN, expect, n)) {
+      printf("FAIL: line %u of the dump is not %.15s\n", i, expect);
+      exit(1);
+    }
+  }
+  return first;
+}
+
+static void
+test_ring(void)
+{
+  console_log_t *log;
+  char line[LINE_LEN + 1], *buf;
+  unsigned int i, first, lines;
+  size_t len;
+
+  unlink(path);
+  log = console_log_open(path, SMALL_SIZE, 0, 1000);
+  assert(log);
+
+  /* Pending data is not in the file until committed */
+  make_line(line, 0);
+  assert(console_log_write(log, line, LINE_LEN) == 0);
+  buf = dump(&len);
+  assert(len == 0);
+  free(buf);
+  assert(console_log_timeout(log) > 0);
+  assert(console_log_commit(log) == 0);
+  assert(console_log_timeout(log) == -1);
+  buf = dump(&len);
+  assert(len == LINE_LEN && !memcmp(buf, line, LINE_LEN));
+  free(buf);
+
+  /* Wrap around several times, in odd sized writes */
+  for (i = 1; i < 10000; i++) {
+    make_line(line, i);
+    assert(console_log_write(log, line, 7) == 0);
+    assert(console_log_write(log, line + 7, LINE_LEN - 7) == 0);
+  }
+  assert(console_log_commit(log) == 0);
+  assert(console_log_bytes(log) <= SMALL_SIZE - 2 * CONSOLE_LOG_HDR_SIZE);
+  buf = dump(&len);
+  first = check_dump(buf, len, &lines);
+  assert(len % LINE_LEN == 0);
+  assert(first + lines == 10000);
+  assert(lines == console_log_lines(log));
+  /* Nearly all of the space is used */
+  assert(len > (SMALL_SIZE - 2 * CONSOLE_LOG_HDR_SIZE) * 7 / 8);
+  free(buf);
+  console_log_close(log);
+
+  /* Reopened, it goes on where it was */
+  log = console_log_open(path, SMALL_SIZE, 0, 1000);
+  assert(log && console_log_lines(log) == lines);
+  make_line(line, 10000);
+  console_log_write(log, line, LINE_LEN);
+  console_log_close(log);
+  buf = dump(&len);
+  first = check_dump(buf, len, &lines);
+  assert(first + lines == 10001);
+  free(buf);
+
+  /* Line bound */
+  log = console_log_open(path, SMALL_SIZE, 100, 1000);
+  for (i = 10001; i < 10200; i++) {
+    make_line(line, i);
+    console_log_write(log, line, LINE_LEN);
+  }
+  console_log_commit(log);
+  assert(console_log_lines(log) == 100);
+  buf = dump(&len);
+  first = check_dump(buf, len, &lines);
+  assert(lines == 100 && first == 10100);
+  free(buf);
+  console_log_close(log);
+
+  /* A log of another size is started afresh */
+  log = console_log_open(path, SMALL_SIZE * 2, 0, 1000);
+  assert(log && console_log_bytes(log) == 0);
+  console_log_close(log);
+
+  printf("ring: passed\n");
+}
+
+static void
+test_torn_header(void)
+{
+  console_log_t *log;
+  char line[LINE_LEN + 1], *buf, junk[64];
+  unsigned int i, first, lines, before;
+  size_t len;
+  int fd, slot;
+  console_log_hdr_t hdr[2];
+
+  unlink(path);
+  log = console_log_open(path, SMALL_SIZE, 0, 1000);
+  for (i = 0; i < 500; i++) {
+    make_line(line, i);
+    console_log_write(log, line, LINE_LEN);
+    if (i == 299) {
+      console_log_commit(log);
+    }
+  }
+  console_log_close(log);
+
+  /* The power went while the newest header was written */
+  fd = open(path, O_RDWR);
+  assert(pread(fd, &hdr[0], sizeof(hdr[0]), 0) == sizeof(hdr[0]));
+  assert(pread(fd, &hdr[1], sizeof(hdr[1]), CONSOLE_LOG_HDR_SIZE) ==
+         sizeof(hdr[1]));
+  slot = (int32_t)(hdr[1].seq - hdr[0].seq) > 0;
+  before = hdr[!slot].head / LINE_LEN;
+  memset(junk, 0xA5, sizeof(junk));
+  assert(pwrite(fd, junk, 20, slot * CONSOLE_LOG_HDR_SIZE + 8) == 20);
+  close(fd);
+
+  buf = dump(&len);
+  first = check_dump(buf, len, &lines);
+  assert(first + lines == before);
+  free(buf);
+
+  /* And consoled goes on from the header before */
+  log = console_log_open(path, SMALL_SIZE, 0, 1000);
+  assert(log);
+  make_line(line, before);
+  console_log_write(log, line, LINE_LEN);
+  console_log_close(log);
+  buf = dump(&len);
+  first = check_dump(buf, len, &lines);
+  assert(first + lines == before + 1);
+  free(buf);
+  printf("torn header: falls back to %u lines\n", before);
+}
+
+static int
+open_pty(int *slave)
+{
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  assert(master >= 0);
+  assert(grantpt(master) == 0 && unlockpt(master) == 0);
+  *slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  assert(*slave >= 0);
+  tcgetattr(*slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(*slave, TCSANOW, &tio);
+  return master;
+}
+
+/* consoled's capture loop, on the pty */
+static void
+capture(int tty, int sync_ms, size_t size, size_t stop_after)
+{
+  console_log_t *log = console_log_open(path, size, 0, sync_ms);
+  struct pollfd pfd = {.fd = tty, .events = POLLIN};
+  char buf[4096];
+  size_t total = 0;
+  ssize_t n;
+
+  assert(log);
+  while (!stop_after || total < stop_after) {
+    int ret = poll(&pfd, 1, console_log_timeout(log));
+    if (ret == 0) {
+      console_log_commit(log);
+      continue;
+    }
+    if ((n = read(tty, buf, sizeof(buf))) <= 0) {
+      break;
+    }
+    console_log_write(log, buf, n);
+    total += n;
+  }
+  console_log_close(log);
+}
+
+static void
+feed(int master, unsigned int from, unsigned int count)
+{
+  char buf[LINE_LEN * 256 + 1];
+  unsigned int i, j;
+
+  for (i = 0; i < count; i += 256) {
+    size_t len = 0;
+    for (j = 0; j < 256 && i + j < count; j++) {
+      make_line(buf + len, from + i + j);
+      len += LINE_LEN;
+    }
+    assert(write(master, buf, len) == len);
+  }
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+test_throughput(int sync_ms, unsigned int count)
+{
+  int master, slave, status;
+  double start;
+  pid_t pid;
+
+  unlink(path);
+  master = open_pty(&slave);
+  start = now();
+  pid = fork();
+  if (pid == 0) {
+    close(master);
+    capture(slave, sync_ms, CONSOLE_LOG_SIZE, (size_t)count * LINE_LEN);
+    _exit(0);
+  }
+  close(slave);
+  feed(master, 0, count);
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  printf("throughput: sync-ms %4d: %.2f MB/s\n", sync_ms,
+         count * LINE_LEN / (now() - start) / 1e6);
+  close(master);
+}
+
+/* Dumps taken while consoled keeps wrapping the log */
+static void
+test_live_dump(int rounds)
+{
+  int master, slave, status, i, null;
+  unsigned int first, lines, last = 0;
+  pid_t capturer, feeder;
+  size_t len;
+  char *buf;
+
+  unlink(path);
+  master = open_pty(&slave);
+  capturer = fork();
+  if (capturer == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(master);
+    capture(slave, 0, SMALL_SIZE, 0);
+    _exit(0);
+  }
+  close(slave);
+  feeder = fork();
+  if (feeder == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    feed(master, 0, 1000000000);
+    _exit(0);
+  }
+  /* Once the log is set up */
+  null = open("/dev/null", O_WRONLY);
+  while (console_log_dump(path, null)) {
+    usleep(1000);
+  }
+  close(null);
+  for (i = 0; i < rounds; i++) {
+    buf = dump(&len);
+    first = check_dump(buf, len, &lines);
+    assert(len == 0 || first >= last);
+    last = first;
+    free(buf);
+  }
+  kill(feeder, SIGKILL);
+  kill(capturer, SIGKILL);
+  waitpid(feeder, &status, 0);
+  waitpid(capturer, &status, 0);
+  close(master);
+  printf("live dump: %d dumps while wrapping, all intact, up to line %u\n",
+         rounds, last);
+}
+
+/* consoled killed at random points while the console is busy */
+static void
+test_crash(int rounds)
+{
+  unsigned int next = 0, first, lines, lost = 0;
+  size_t len;
+  char *buf;
+  int i;
+
+  unlink(path);
+  srand(1);
+  for (i = 0; i < rounds; i++) {
+    int master, slave, status;
+    unsigned int count = 200 + rand() % 3000;
+    pid_t pid;
+
+    master = open_pty(&slave);
+    pid = fork();
+    if (pid == 0) {
+      close(master);
+      capture(slave, 20, SMALL_SIZE * 4, 0);
+      _exit(0);
+    }
+    close(slave);
+    feed(master, next, count);
+    usleep(rand() % 40000);
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    close(master);
+
+    /* Whatever was committed is intact, the rest is gone */
+    buf = dump(&len);
+    first = check_dump(buf, len, &lines);
+    assert(first + lines <= next + count);
+    lost += next + count - (first + lines);
+    free(buf);
+    /* Carry on from a whole line */
+    if (len % LINE_LEN) {
+      console_log_t *log = console_log_open(path, SMALL_SIZE * 4, 0, 1000);
+      char line[LINE_LEN + 1];
+      make_line(line, first + lines);
+      console_log_write(log, line + len % LINE_LEN, LINE_LEN - len % LINE_LEN);
+      console_log_close(log);
+      lines++;
+    }
+    next = first + lines;
+  }
+  printf("crash: %d kills, the log always consistent, %u lines "
+         "not captured before a kill\n", rounds, lost);
+}
+
+int
+main(int argc, char **argv)
+{
+  snprintf(path, sizeof(path), "%s/consoled-test.log",
+           argc > 1 ? argv[1] : "/tmp");
+
+  test_ring();
+  test_torn_header();
+  test_crash(30);
+  test_live_dump(2000);
+  test_throughput(0, 50000);
+  test_throughput(CONSOLE_LOG_SYNC_MS, 50000);
+  unlink(path);
+  printf("All tests passed\n");
+  return 0;
+}
@@ -45,6 +45,12 @@ static const char* xml =
 "      <arg type='s' name='binFilePath' direction='in'/>"
 "      <arg type='b' name='status' direction='out'/>"
 "    </method>"
+"    <method name='fruIdRevalidate'>"
+"      <arg type='b' name='changed' direction='out'/>"
+"    </method>"
+"    <signal name='FruChanged'>"
+"      <arg type='u' name='contentHash'/>"
+"    </signal>"
 "  </interface>"
 "</node>";
 
@@ -72,10 +78,10 @@ void DBusFruInterface::getFruIdInfo(GDBusMethodInvocation* invocation,
 
 
   //Get getFruIdInfo list from fru
-  std::vector<std::pair<std::string, std::string>> getFruIdInfoList =  fru->getFruIdInfoList();
+  std::shared_ptr<const FruIdInfoList> getFruIdInfoList = fru->getFruIdInfoList();
 
   //Add getFruIdInfo list to dictionary
-  for (auto& it: getFruIdInfoList){
+  for (auto& it: *getFruIdInfoList){
     g_variant_builder_add (builder, "{ss}", it.first.c_str(), it.second.c_str());
   }
 
@@ -117,6 +123,19 @@ void DBusFruInterface::fruIdWriteBinaryData(GVariant*              parameters,
   }
 }
 
+void DBusFruInterface::fruIdRevalidate(GDBusMethodInvocation* invocation,
+                                       gpointer               arg){
+  FRU* fru = static_cast<FRU*>(arg);
+  LOG(INFO) << "fruIdRevalidate " << fru->getName();
+
+  if (fru->revalidate(true)) {
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(b)", TRUE));
+  }
+  else {
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(b)", FALSE));
+  }
+}
+
 void DBusFruInterface::methodCallBack(GDBusConnection*       connection,
                                       const char*            sender,
                                       const char*            objectPath,
@@ -137,6 +156,9 @@ void DBusFruInterface::methodCallBack(GDBusConnection*       connection,
   else if (g_strcmp0(methodName, "fruIdWriteBinaryData") == 0) {
     fruIdWriteBinaryData(parameters, invocation, arg);
   }
+  else if (g_strcmp0(methodName, "fruIdRevalidate") == 0) {
+    fruIdRevalidate(invocation, arg);
+  }
 }
 
 } // namespace qin
@@ -75,6 +75,13 @@ class DBusFruInterface: public DBusInterfaceBase {
     static void fruIdWriteBinaryData(GVariant*              parameters,
                                      GDBusMethodInvocation* invocation,
                                      gpointer               arg);
+
+    /**
+     * Callback for fruIdRevalidate method, reads the fruID binary data
+     * again, e.g. on a hotplug event. FruChanged is emitted if it changed.
+     */
+    static void fruIdRevalidate(GDBusMethodInvocation* invocation,
+                                gpointer               arg);
 };
 } // namespace qin
 } // namespace openbmc
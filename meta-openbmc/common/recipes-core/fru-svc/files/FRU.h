@@ -19,6 +19,7 @@
  */
 
 #pragma once
+#include <functional>
 #include <string>
 #include <object-tree/Object.h>
 #include "FruIdAccessMechanism.h"
@@ -27,9 +28,30 @@ namespace openbmc {
 namespace qin {
 
 class FRU : public Object {
+  public:
+    // Called with the new content hash when the FruId information changes
+    typedef std::function<void(FRU &fru, uint32_t hash)> ChangeCallback;
+
   private:
-    std::vector<std::pair<std::string, std::string>> fruIdInfoList_; // To store fruId information
     std::unique_ptr<FruIdAccessMechanism> fruIdAccess_;
+    uint32_t contentHash_;            // hash of the FruId information last seen
+    ChangeCallback onFruChanged_;
+
+    /*
+     * Notify onFruChanged_ if the content hash moved since last seen
+     * Returns true if it did
+     */
+    bool checkFruChanged() {
+      uint32_t hash = fruIdAccess_.get()->getContentHash();
+      if (hash == contentHash_) {
+        return false;
+      }
+      contentHash_ = hash;
+      if (onFruChanged_) {
+        onFruChanged_(*this, hash);
+      }
+      return true;
+    }
 
   public:
     /*
@@ -38,30 +60,42 @@ class FRU : public Object {
     FRU(const std::string &name, Object* parent, std::unique_ptr<FruIdAccessMechanism> fruIdAccess)
        : Object(name, parent){
       fruIdAccess_ = std::move(fruIdAccess);
-      fruIdInfoList_ = fruIdAccess_.get()->getFruIdInfoList();
+      contentHash_ = fruIdAccess_.get()->getContentHash();
     }
 
+    void setOnFruChanged(ChangeCallback onFruChanged) {
+      onFruChanged_ = onFruChanged;
+    }
+
+    /*
+     * Returns a snapshot of the fruId information
+     */
+    std::shared_ptr<const FruIdInfoList> getFruIdInfoList() {
+      std::shared_ptr<const FruIdInfoList> fruIdInfoList =
+        fruIdAccess_.get()->getFruIdInfoList();
+      checkFruChanged();
+      return fruIdInfoList;
+    }
 
     /*
-     * Returns fruIdInfoList_
+     * Check the fruId information against the device, see
+     * FruIdAccessMechanism::revalidate()
+     * Returns true if it changed
      */
-    const std::vector<std::pair<std::string, std::string>> & getFruIdInfoList(){
-      return fruIdInfoList_;
+    bool revalidate(bool force) {
+      fruIdAccess_.get()->revalidate(force);
+      return checkFruChanged();
     }
 
     /*
      * Write fruId binary data from binFilePath
-     * Update fruIdInfoList_ if write operation is successful
+     * The fruId information is read back if write operation is successful
      * Returns status of operation
      */
     bool fruIdWriteBinaryData(const std::string & binFilePath) {
-      if (fruIdAccess_.get()->writeBinaryData(binFilePath)){
-        fruIdInfoList_ = fruIdAccess_.get()->getFruIdInfoList();
-        return true;
-      }
-      else {
-        return false;
-      }
+      bool status = fruIdAccess_.get()->writeBinaryData(binFilePath);
+      checkFruChanged();
+      return status;
     }
 
     /*
@@ -69,7 +103,9 @@ class FRU : public Object {
      * Returns status of operation
      */
     bool fruIdDumpBinaryData(const std::string & destFilePath) {
-      return fruIdAccess_.get()->dumpBinaryData(destFilePath);
+      bool status = fruIdAccess_.get()->dumpBinaryData(destFilePath);
+      checkFruChanged();
+      return status;
     }
 };
 
@@ -19,9 +19,13 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glog/logging.h>
 #include <openbmc/fruid.h>
 #include "FruIdAccessI2CEEPROM.h"
@@ -29,112 +33,184 @@
 namespace openbmc {
 namespace qin {
 
-std::vector<std::pair<std::string, std::string>> FruIdAccessI2CEEPROM::getFruIdInfoList() {
-  std::vector<std::pair<std::string, std::string>> fruIdInfoList;
-  std::ifstream eepromFile;
+// FNV-1a
+static uint32_t hashImage(const unsigned char* data, int len) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
 
-  //open eeprom file
-  eepromFile.open(eepromPath_, std::ios::in | std::ios::binary | std::ios::ate);
+static void addCustomFields(FruIdInfoList &fruIdInfoList,
+                            const std::string &area,
+                            char* custom1, char* custom2,
+                            char* custom3, char* custom4) {
+  char* custom[] = {custom1, custom2, custom3, custom4};
+  for (int i = 0; i < 4; i++) {
+    if (custom[i] != nullptr) {
+      fruIdInfoList.push_back({area + " Custom Data " + std::to_string(i + 1),
+                               std::string(custom[i])});
+    }
+  }
+}
 
-  if (eepromFile.is_open()) {
-    //Get size of eepromFile
-    int size = eepromFile.tellg();
+/*
+ * Parse the FruId image into its fields
+ */
+static std::shared_ptr<const FruIdInfoList> parseFruIdInfo(
+    const unsigned char* fruIdData, int size, const std::string &path) {
+  std::shared_ptr<FruIdInfoList> fruIdInfoList(new FruIdInfoList());
+  fruid_info_t fruid;
 
-    if (size >= FRUID_SIZE) {
-      unsigned char fruIdData[FRUID_SIZE] = {0};
-      fruid_info_t fruid;
+  if (size == 0) {
+    return fruIdInfoList;
+  }
 
-      //Get binary data from eepromFile
-      eepromFile.seekg (0, std::ios::beg);
-      eepromFile.read ((char*)fruIdData, FRUID_SIZE);
+  // parse fruId from eepromFile dump
+  if (fruid_parse_eeprom(fruIdData, size, &fruid) != 0) {
+    LOG(ERROR) << "FRUID in " << path << " cannot be parsed";
+    return fruIdInfoList;
+  }
 
-      // parse fruId from eepromFile dump
-      fruid_parse_eeprom(fruIdData, FRUID_SIZE, &fruid);
+  //decode struct fruid and stored it in map
+  if (fruid.chassis.flag == 1) {
+    fruIdInfoList->push_back({"Chassis Type", std::string(fruid.chassis.type_str)});
+    fruIdInfoList->push_back({"Chassis Part Number", std::string(fruid.chassis.part)});
+    fruIdInfoList->push_back({"Chassis Serial Number", std::string(fruid.chassis.serial)});
+    addCustomFields(*fruIdInfoList, "Chassis", fruid.chassis.custom1,
+                    fruid.chassis.custom2, fruid.chassis.custom3,
+                    fruid.chassis.custom4);
+  }
+  else {
+    LOG(INFO) << "Chassis Info not set";
+  }
 
-      //decode struct fruid and stored it in map
-      if (fruid.chassis.flag == 1) {
-        fruIdInfoList.push_back({"Chassis Type", std::string(fruid.chassis.type_str)});
-        fruIdInfoList.push_back({"Chassis Part Number", std::string(fruid.chassis.part)});
-        fruIdInfoList.push_back({"Chassis Serial Number", std::string(fruid.chassis.serial)});
-        if (fruid.chassis.custom1 != nullptr) {
-          fruIdInfoList.push_back({"Chassis Custom Data 1", std::string(fruid.chassis.custom1)});
-        }
-        if (fruid.chassis.custom2 != nullptr) {
-          fruIdInfoList.push_back({"Chassis Custom Data 2", std::string(fruid.chassis.custom2)});
-        }
-        if (fruid.chassis.custom3 != nullptr) {
-          fruIdInfoList.push_back({"Chassis Custom Data 3", std::string(fruid.chassis.custom3)});
-        }
-        if (fruid.chassis.custom4 != nullptr) {
-          fruIdInfoList.push_back({"Chassis Custom Data 4", std::string(fruid.chassis.custom4)});
-        }
-      }
-      else {
-        LOG(INFO) << "Chassis Info not set";
-      }
+  if (fruid.board.flag == 1) {
+    fruIdInfoList->push_back({"Board Mfg Date", std::string(fruid.board.mfg_time_str)});
+    fruIdInfoList->push_back({"Board Manufacturer", std::string(fruid.board.mfg)});
+    fruIdInfoList->push_back({"Board Product", std::string(fruid.board.name)});
+    fruIdInfoList->push_back({"Board Serial", std::string(fruid.board.serial)});
+    fruIdInfoList->push_back({"Board Part Number", std::string(fruid.board.part)});
+    fruIdInfoList->push_back({"Board Fru Id", std::string(fruid.board.fruid)});
+    addCustomFields(*fruIdInfoList, "Board", fruid.board.custom1,
+                    fruid.board.custom2, fruid.board.custom3,
+                    fruid.board.custom4);
+  }
+  else {
+    LOG(INFO) << "Board Info not set";
+  }
 
-      if (fruid.board.flag == 1) {
-        fruIdInfoList.push_back({"Board Mfg Date", std::string(fruid.board.mfg_time_str)});
-        fruIdInfoList.push_back({"Board Manufacturer", std::string(fruid.board.mfg)});
-        fruIdInfoList.push_back({"Board Product", std::string(fruid.board.name)});
-        fruIdInfoList.push_back({"Board Serial", std::string(fruid.board.serial)});
-        fruIdInfoList.push_back({"Board Part Number", std::string(fruid.board.part)});
-        fruIdInfoList.push_back({"Board Fru Id", std::string(fruid.board.fruid)});
-        if (fruid.board.custom1 != nullptr) {
-          fruIdInfoList.push_back({"Board Custom Data 1", std::string(fruid.board.custom1)});
-        }
-        if (fruid.board.custom2 != nullptr) {
-          fruIdInfoList.push_back({"Board Custom Data 2", std::string(fruid.board.custom2)});
-        }
-        if (fruid.board.custom3 != nullptr) {
-          fruIdInfoList.push_back({"Board Custom Data 3", std::string(fruid.board.custom3)});
-        }
-        if (fruid.board.custom4 != nullptr) {
-          fruIdInfoList.push_back({"Board Custom Data 4", std::string(fruid.board.custom4)});
-        }
+  if (fruid.product.flag == 1) {
+    fruIdInfoList->push_back({"Product Manufacturer", std::string(fruid.product.mfg)});
+    fruIdInfoList->push_back({"Product Name", std::string(fruid.product.name)});
+    fruIdInfoList->push_back({"Product Part Number", std::string(fruid.product.part)});
+    fruIdInfoList->push_back({"Product Version", std::string(fruid.product.version)});
+    fruIdInfoList->push_back({"Product Serial", std::string(fruid.product.serial)});
+    fruIdInfoList->push_back({"Product Asset Tag", std::string(fruid.product.asset_tag)});
+    fruIdInfoList->push_back({"Product Fru Id", std::string(fruid.product.fruid)});
+    addCustomFields(*fruIdInfoList, "Product", fruid.product.custom1,
+                    fruid.product.custom2, fruid.product.custom3,
+                    fruid.product.custom4);
+  }
+  else {
+    LOG(INFO) << "Product Info not set";
+  }
 
-      }
-      else {
-        LOG(INFO) << "Board Info not set";
-      }
+  free_fruid_info(&fruid);
+  return fruIdInfoList;
+}
 
-      if (fruid.product.flag == 1) {
-        fruIdInfoList.push_back({"Product Manufacturer", std::string(fruid.product.mfg)});
-        fruIdInfoList.push_back({"Product Name", std::string(fruid.product.name)});
-        fruIdInfoList.push_back({"Product Part Number", std::string(fruid.product.part)});
-        fruIdInfoList.push_back({"Product Version", std::string(fruid.product.version)});
-        fruIdInfoList.push_back({"Product Serial", std::string(fruid.product.serial)});
-        fruIdInfoList.push_back({"Product Asset Tag", std::string(fruid.product.asset_tag)});
-        fruIdInfoList.push_back({"Product Fru Id", std::string(fruid.product.fruid)});
-        if (fruid.product.custom1 != nullptr) {
-          fruIdInfoList.push_back({"Product Custom Data 1", std::string(fruid.product.custom1)});
-        }
-        if (fruid.product.custom2 != nullptr) {
-          fruIdInfoList.push_back({"Product Custom Data 2", std::string(fruid.product.custom2)});
-        }
-        if (fruid.product.custom3 != nullptr) {
-          fruIdInfoList.push_back({"Product Custom Data 3", std::string(fruid.product.custom3)});
-        }
-        if (fruid.product.custom4 != nullptr) {
-          fruIdInfoList.push_back({"Product Custom Data 4", std::string(fruid.product.custom4)});
-        }
-      }
-      else {
-        LOG(INFO) << "Product Info not set";
+bool FruIdAccessI2CEEPROM::reload() {
+  unsigned char fruIdData[FRUID_SIZE] = {0};
+  struct stat st;
+  int size = 0;
+  int fd;
+
+  // An unreadable EEPROM has no FruId information: the FRU may be gone
+  dev_ = 0;
+  ino_ = 0;
+  mtime_ = {0, 0};
+  size_ = -1;
+  fd = open(eepromPath_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (!cached_ || imageSize_ > 0) {
+      LOG(ERROR) << "File " << eepromPath_ << " does not exists";
+    }
+  }
+  else {
+    if (fstat(fd, &st) == 0) {
+      dev_ = st.st_dev;
+      ino_ = st.st_ino;
+      mtime_ = st.st_mtim;
+      size_ = st.st_size;
+    }
+    if (size_ < FRUID_SIZE) {
+      if (!cached_ || imageSize_ > 0) {
+        LOG(ERROR) << "File " << eepromPath_ << " size " << size_ << " is less than " << FRUID_SIZE;
       }
     }
+    else if (pread(fd, fruIdData, FRUID_SIZE, 0) == FRUID_SIZE) {
+      size = FRUID_SIZE;
+    }
     else {
-      LOG(ERROR) << "File " << eepromPath_ << " size " << size << " is less than " << FRUID_SIZE;
+      LOG(ERROR) << "Unable to read " << eepromPath_;
     }
+    close(fd);
+  }
 
-    //close eepromFile
-    eepromFile.close();
+  uint32_t hash = hashImage(fruIdData, size);
+  lastValidated_ = std::chrono::steady_clock::now();
+  if (cached_ && size == imageSize_ && hash == hash_ &&
+      memcmp(fruIdData, image_, size) == 0) {
+    return false;
   }
-  else {
-    LOG(ERROR) << "File " << eepromPath_ << " does not exists";
+
+  memcpy(image_, fruIdData, size);
+  imageSize_ = size;
+  hash_ = hash;
+  fruIdInfoList_ = parseFruIdInfo(image_, imageSize_, eepromPath_);
+  cached_ = true;
+  return true;
+}
+
+bool FruIdAccessI2CEEPROM::fileChanged() const {
+  struct stat st;
+
+  if (stat(eepromPath_.c_str(), &st) != 0) {
+    return size_ != -1;
   }
+  return st.st_dev != dev_ || st.st_ino != ino_ || st.st_size != size_ ||
+         st.st_mtim.tv_sec != mtime_.tv_sec ||
+         st.st_mtim.tv_nsec != mtime_.tv_nsec;
+}
 
-  return fruIdInfoList;
+std::shared_ptr<const FruIdInfoList> FruIdAccessI2CEEPROM::getFruIdInfoList() {
+  std::lock_guard<std::mutex> lock(m_);
+  if (!cached_ || fileChanged()) {
+    reload();
+  }
+  return fruIdInfoList_;
+}
+
+uint32_t FruIdAccessI2CEEPROM::getContentHash() {
+  std::lock_guard<std::mutex> lock(m_);
+  if (!cached_) {
+    reload();
+  }
+  return hash_;
+}
+
+bool FruIdAccessI2CEEPROM::revalidate(bool force) {
+  std::lock_guard<std::mutex> lock(m_);
+  if (!force && cached_) {
+    if (revalidateInterval_.count() == 0 ||
+        std::chrono::steady_clock::now() - lastValidated_ < revalidateInterval_) {
+      return false;
+    }
+  }
+  return reload();
 }
 
 bool FruIdAccessI2CEEPROM::writeBinaryData(const std::string & binFilePath){
@@ -155,10 +231,13 @@ bool FruIdAccessI2CEEPROM::writeBinaryData(const std::string & binFilePath){
 
       // parse fruId from binFilePath dump and check if it is successful
       if (fruid_parse_eeprom(fruIdData, FRUID_SIZE, &fruid) == 0){
+        free_fruid_info(&fruid);
         //Parse successful -> binFilePath is verified
         //Write to eepromPath_
         std::string command = "dd if=" + binFilePath + " of=" + eepromPath_ + " bs=" + std::to_string(FRUID_SIZE) + " count=1";
         if (system(command.c_str()) == EXIT_SUCCESS) {
+          //Read back what the EEPROM now holds
+          revalidate(true);
           return true;
         }
         else{
@@ -183,40 +262,26 @@ bool FruIdAccessI2CEEPROM::writeBinaryData(const std::string & binFilePath){
 }
 
 bool FruIdAccessI2CEEPROM::dumpBinaryData(const std::string & destFilePath){
-  std::ifstream eepromFile;
   std::ofstream outFile;
-  eepromFile.open(eepromPath_, std::ios::in | std::ios::binary | std::ios::ate);
 
-  if (eepromFile.is_open()) {
-    //Get size of eepromFile
-    int size = eepromFile.tellg();
-    if (size >= FRUID_SIZE) {
-      unsigned char fruIdData[FRUID_SIZE] = {0};
-
-      //Get binary data from eepromFile
-      eepromFile.seekg (0, std::ios::beg);
-      eepromFile.read ((char*)fruIdData, FRUID_SIZE);
+  //Dump what the EEPROM holds now, and update the cache with it
+  revalidate(true);
 
-      //write data to destFilePath
-      outFile.open(destFilePath, std::ios::binary);
-      if(outFile.is_open()) {
-        outFile.write((char*)fruIdData, FRUID_SIZE);
-        outFile.close();
-        return true;
-      }
-      else {
-        LOG(ERROR) << "Unable to create file " << destFilePath;
-      }
-    }
-    else {
-      LOG(ERROR) << "File " << eepromPath_ << " size " << size << " is less than " << FRUID_SIZE;
-    }
+  std::lock_guard<std::mutex> lock(m_);
+  if (imageSize_ < FRUID_SIZE) {
+    LOG(ERROR) << "File " << eepromPath_ << " cannot be read";
+    return false;
+  }
 
-    //close eepromFile
-    eepromFile.close();
+  //write data to destFilePath
+  outFile.open(destFilePath, std::ios::binary);
+  if(outFile.is_open()) {
+    outFile.write((char*)image_, FRUID_SIZE);
+    outFile.close();
+    return true;
   }
   else {
-    LOG(ERROR) << "File " << eepromPath_ << " does not exists";
+    LOG(ERROR) << "Unable to create file " << destFilePath;
   }
 
   return false;
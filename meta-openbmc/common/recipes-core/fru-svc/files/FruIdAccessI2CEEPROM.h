@@ -19,29 +19,74 @@
  */
 
 #pragma once
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <sys/types.h>
 #include "FruIdAccessMechanism.h"
 
 namespace openbmc {
 namespace qin {
 
+/*
+ * FruId information from an I2C EEPROM, kept in memory: the raw image,
+ * its hash and the parsed fields. Queries are answered from memory; the
+ * EEPROM is read again on revalidate(), and the fields parsed again only
+ * when the hash of the image changed. The inode, mtime and size of
+ * eepromPath_ are checked on each query, so an image replaced through the
+ * file system (a FRU backed by a binary file) shows without waiting for
+ * the interval.
+ */
 class FruIdAccessI2CEEPROM : public FruIdAccessMechanism {
   private:
     std::string eepromPath_;               //path for eeprom file
     static const int FRUID_SIZE = 512;     //FRUID size in eeprom file
 
+    std::mutex m_;
+    std::chrono::seconds revalidateInterval_; //0 to only revalidate on demand
+    std::chrono::steady_clock::time_point lastValidated_;
+    bool cached_{false};                   //image_ holds a read of eepromPath_
+    unsigned char image_[FRUID_SIZE];      //raw FruId image
+    int imageSize_{0};                     //0 if eepromPath_ could not be read
+    uint32_t hash_{0};                     //hash of image_
+    dev_t dev_{0};                         //of eepromPath_ when image_ was read
+    ino_t ino_{0};
+    struct timespec mtime_{0, 0};
+    off_t size_{-1};
+    std::shared_ptr<const FruIdInfoList> fruIdInfoList_;
+
+    /*
+     * Read eepromPath_ into the cache; m_ must be held.
+     * Returns true if the content changed
+     */
+    bool reload();
+
+    /*
+     * True if eepromPath_ is not the file image_ was read from
+     */
+    bool fileChanged() const;
+
   public:
+    static const int DEFAULT_REVALIDATE_INTERVAL = 60; //seconds
+
     /*
      * Constructor
      */
-    FruIdAccessI2CEEPROM(const std::string &eepromPath) {
+    FruIdAccessI2CEEPROM(const std::string &eepromPath,
+                         int revalidateInterval = DEFAULT_REVALIDATE_INTERVAL)
+        : revalidateInterval_(revalidateInterval) {
       this->eepromPath_ = eepromPath;
     }
 
     /*
-     * Parses FruId information from eeprom file at eepromPath_
-     * and returns vector represensation FruId information
+     * Returns the FruId information parsed from eeprom file at eepromPath_,
+     * reading it only if it was not read yet or the file changed
      */
-    std::vector<std::pair<std::string, std::string>> getFruIdInfoList() override;
+    std::shared_ptr<const FruIdInfoList> getFruIdInfoList() override;
+
+    uint32_t getContentHash() override;
+
+    bool revalidate(bool force) override;
 
     /*
      * Validate FruId information at binFilePath
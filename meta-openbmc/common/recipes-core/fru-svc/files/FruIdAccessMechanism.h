@@ -19,20 +19,40 @@
  */
 
 #pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace openbmc {
 namespace qin {
 
+typedef std::vector<std::pair<std::string, std::string>> FruIdInfoList;
+
 /* FruIdAccessMechanism : abstract class for FruIdAccess
  */
 class FruIdAccessMechanism {
   public:
+    virtual ~FruIdAccessMechanism() {}
+
+    /*
+     * Returns vector represensation FruId information.
+     * The snapshot is not modified once returned; a change of the
+     * FruId information replaces it with a new one.
+     */
+    virtual std::shared_ptr<const FruIdInfoList> getFruIdInfoList() = 0;
+
+    /*
+     * Hash of the FruId binary data behind getFruIdInfoList()
+     */
+    virtual uint32_t getContentHash() = 0;
 
     /*
-     * Returns vector represensation FruId information
+     * Check the FruId information against the device: when force is
+     * set, or once the revalidation interval has passed since the last check.
+     * Returns true if the content changed
      */
-    virtual std::vector<std::pair<std::string, std::string>> getFruIdInfoList() = 0;
+    virtual bool revalidate(bool force) = 0;
 
     /*
      * Write fruId binary data from binFilePath
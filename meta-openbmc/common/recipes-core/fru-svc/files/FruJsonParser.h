@@ -61,7 +61,13 @@ class FruJsonParser {
 
         if (type.compare("I2CEEPROM") == 0) {
           const std::string &eepromPath = fruIdAccess.at("eepromPath");
-          std::unique_ptr<FruIdAccessMechanism> upFruIdAccess(new FruIdAccessI2CEEPROM(eepromPath));
+          // seconds between reads of the EEPROM, 0 for on demand only
+          int revalidateInterval = FruIdAccessI2CEEPROM::DEFAULT_REVALIDATE_INTERVAL;
+          if (fruIdAccess.find("revalidateInterval") != fruIdAccess.end()) {
+            revalidateInterval = fruIdAccess.at("revalidateInterval");
+          }
+          std::unique_ptr<FruIdAccessMechanism> upFruIdAccess(
+              new FruIdAccessI2CEEPROM(eepromPath, revalidateInterval));
           object = fruTree.addFRU(name, parentPath, std::move(upFruIdAccess));
         } else {
           LOG(ERROR) << "Specified fruid access mechanism " << type;
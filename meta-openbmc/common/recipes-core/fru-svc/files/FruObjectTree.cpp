@@ -58,8 +58,23 @@ FRU* FruObjectTree::addFRU(const std::string                     &name,
   Object* parent = getParent(parentPath, name);
 
   std::unique_ptr<FRU> upDev(new FRU(name, parent, std::move(fruIdAccess)));
+  DBus* dbus = getDBusObject(ipc_.get());
+  upDev->setOnFruChanged([dbus, path](FRU &fru, uint32_t hash) {
+    LOG(INFO) << "FruId information of " << path << " changed";
+    dbus->emitSignal(path, fruInterface.getName(), "FruChanged",
+                     g_variant_new("(u)", hash));
+  });
   return static_cast<FRU*>(addObjectByPath(std::move(upDev), path, fruInterface));
 }
 
+void FruObjectTree::revalidateFRUs() {
+  for (auto &it : objectMap_) {
+    FRU* fru = dynamic_cast<FRU*>(it.second.get());
+    if (fru != nullptr) {
+      fru->revalidate(false);
+    }
+  }
+}
+
 } // namespace qin
 } // namespace openbmc
@@ -66,6 +66,12 @@ class FruObjectTree : public ObjectTree {
                  const std::string                     &parentPath,
                  std::unique_ptr<FruIdAccessMechanism> fruIdAccess);
 
+     /**
+      * Revalidate the FRUs due for it; FruChanged is emitted for those
+      * whose FruId information changed.
+      */
+     void revalidateFRUs();
+
   private:
 
     /**
@@ -29,9 +29,19 @@
 #include "FruObjectTree.h"
 using namespace openbmc::qin;
 
+DEFINE_int32(revalidate_period, 10,
+             "Seconds between checks for FRUs due for revalidation, 0 to disable");
+
 // implementation for handling DBus request messages
 static DBusObjectInterface objectInterface;
 
+// Runs in the event loop, with the DBus method calls
+static gboolean revalidateFRUs(gpointer arg) {
+  FruObjectTree* fruTree = static_cast<FruObjectTree*>(arg);
+  fruTree->revalidateFRUs();
+  return TRUE;
+}
+
 // event handler for DBus request messages
 static void eventLoop(GMainLoop* loop) {
   LOG(INFO) << "Event loop begins";
@@ -76,6 +86,10 @@ int main (int argc, char* argv[]) {
   fruTree.addObject("openbmc","/org");
   fruTree.addFruService("FruService", "/org/openbmc");
 
+  if (FLAGS_revalidate_period > 0) {
+    g_timeout_add_seconds(FLAGS_revalidate_period, revalidateFRUs, &fruTree);
+  }
+
   LOG(INFO) << "Main thread joining the event loop thread" << std::endl;
   t.join();
 
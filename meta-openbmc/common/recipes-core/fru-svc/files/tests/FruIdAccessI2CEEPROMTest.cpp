@@ -0,0 +1,269 @@
+/*
+ * FruIdAccessI2CEEPROMTest.cpp
+ *
+ * Copyright 2017-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include <openbmc/fruid.h>
+#include "../FruIdAccessI2CEEPROM.h"
+#include "../FRU.h"
+
+using namespace openbmc::qin;
+
+static const int TEST_FRU_SIZE = 512;
+
+static uint8_t zeroChksum(const uint8_t* buf, int len) {
+  uint8_t sum = 0;
+  for (int i = 0; i < len; i++) {
+    sum += buf[i];
+  }
+  return ~sum + 1;
+}
+
+static int addField(uint8_t* area, int idx, const std::string &str) {
+  area[idx++] = 0xC0 | str.length();
+  memcpy(&area[idx], str.c_str(), str.length());
+  return idx + str.length();
+}
+
+/**
+ * Fixture with a fake EEPROM: a file holding a FRU image with only
+ * a Board area, whose serial number tells the contents apart.
+ */
+class FruIdAccessI2CEEPROMTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/fru-access-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != nullptr);
+    dir_ = dir;
+    eeprom_ = dir_ + "/eeprom";
+    writeFru(eeprom_, "SN-0001");
+  }
+
+  virtual void TearDown() {
+    unlink(eeprom_.c_str());
+    unlink((dir_ + "/new.bin").c_str());
+    rmdir(dir_.c_str());
+  }
+
+  static void writeFru(const std::string &path, const std::string &serial) {
+    uint8_t fru[TEST_FRU_SIZE] = {0};
+    uint8_t* board = &fru[8];
+    int idx = 6, len;
+
+    fru[0] = FRUID_FORMAT_VER;
+    fru[3] = 1;
+    fru[7] = zeroChksum(fru, 7);
+
+    board[0] = FRUID_FORMAT_VER;
+    idx = addField(board, idx, "LinkedIn");
+    idx = addField(board, idx, "Test Board");
+    idx = addField(board, idx, serial);
+    idx = addField(board, idx, "PN-0001");
+    idx = addField(board, idx, "fru.bin");
+    board[idx++] = 0xC1;
+    len = (idx + 1 + 7) & ~7;
+    board[1] = len / FRUID_AREA_LEN_MULTIPLIER;
+    board[len - 1] = zeroChksum(board, len - 1);
+
+    // In place, as an EEPROM is written
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pwrite(fd, fru, sizeof(fru), 0), (ssize_t)sizeof(fru));
+    close(fd);
+  }
+
+  // Rewrite the fake EEPROM without its mtime showing it, as sysfs does
+  void writeFruKeepMtime(const std::string &serial) {
+    struct stat st;
+    ASSERT_EQ(stat(eeprom_.c_str(), &st), 0);
+    writeFru(eeprom_, serial);
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    ASSERT_EQ(utimensat(AT_FDCWD, eeprom_.c_str(), times, 0), 0);
+  }
+
+  static std::string serialOf(const FruIdInfoList &fruIdInfoList) {
+    for (auto &it : fruIdInfoList) {
+      if (it.first == "Board Serial") {
+        return it.second;
+      }
+    }
+    return "";
+  }
+
+  std::string dir_;
+  std::string eeprom_;
+};
+
+TEST_F(FruIdAccessI2CEEPROMTest, Parse) {
+  FruIdAccessI2CEEPROM access(eeprom_);
+  std::shared_ptr<const FruIdInfoList> list = access.getFruIdInfoList();
+
+  EXPECT_EQ(serialOf(*list), "SN-0001");
+  EXPECT_EQ(list->size(), 6);
+  EXPECT_EQ(list->at(0).first, "Board Mfg Date");
+  EXPECT_EQ(list->at(1).second, "LinkedIn");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, ServedFromMemory) {
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  std::shared_ptr<const FruIdInfoList> list = access.getFruIdInfoList();
+  uint32_t hash = access.getContentHash();
+
+  // Changed behind the file's back: not seen until revalidated
+  writeFruKeepMtime("SN-0002");
+  EXPECT_EQ(access.getFruIdInfoList(), list);
+  EXPECT_FALSE(access.revalidate(false));
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0001");
+
+  // A hotplug event
+  EXPECT_TRUE(access.revalidate(true));
+  EXPECT_NE(access.getContentHash(), hash);
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0002");
+
+  // The old snapshot is left as it was for whoever holds it
+  EXPECT_EQ(serialOf(*list), "SN-0001");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, SameContentKeepsSnapshot) {
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  std::shared_ptr<const FruIdInfoList> list = access.getFruIdInfoList();
+  uint32_t hash = access.getContentHash();
+
+  writeFru(eeprom_, "SN-0001");
+  EXPECT_FALSE(access.revalidate(true));
+  EXPECT_EQ(access.getContentHash(), hash);
+  EXPECT_EQ(access.getFruIdInfoList(), list);
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, FileChange) {
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0001");
+
+  // A new image moved in place has a new mtime
+  std::string newBin = dir_ + "/new.bin";
+  writeFru(newBin, "SN-0003");
+  ASSERT_EQ(rename(newBin.c_str(), eeprom_.c_str()), 0);
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0003");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, Interval) {
+  FruIdAccessI2CEEPROM access(eeprom_, 1);
+  uint32_t hash = access.getContentHash();
+
+  writeFruKeepMtime("SN-0004");
+  EXPECT_FALSE(access.revalidate(false));
+  EXPECT_EQ(access.getContentHash(), hash);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_TRUE(access.revalidate(false));
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0004");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, RemovedAndBack) {
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  uint32_t hash = access.getContentHash();
+
+  unlink(eeprom_.c_str());
+  EXPECT_TRUE(access.getFruIdInfoList()->empty());
+  EXPECT_NE(access.getContentHash(), hash);
+
+  writeFru(eeprom_, "SN-0001");
+  EXPECT_TRUE(access.revalidate(true));
+  EXPECT_EQ(access.getContentHash(), hash);
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0001");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, WriteAndDump) {
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  std::string newBin = dir_ + "/new.bin";
+
+  writeFru(newBin, "SN-0005");
+  ASSERT_TRUE(access.writeBinaryData(newBin));
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0005");
+
+  writeFruKeepMtime("SN-0006");
+  ASSERT_TRUE(access.dumpBinaryData(newBin));
+  fruid_info_t fruid;
+  ASSERT_EQ(fruid_parse(newBin.c_str(), &fruid), 0);
+  EXPECT_STREQ(fruid.board.serial, "SN-0006");
+  free_fruid_info(&fruid);
+  EXPECT_EQ(serialOf(*access.getFruIdInfoList()), "SN-0006");
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, FruChanged) {
+  std::unique_ptr<FruIdAccessMechanism> access(new FruIdAccessI2CEEPROM(eeprom_, 0));
+  FRU fru("fru", nullptr, std::move(access));
+  int changes = 0;
+  uint32_t lastHash = 0;
+
+  fru.setOnFruChanged([&](FRU &f, uint32_t hash) {
+    changes++;
+    lastHash = hash;
+  });
+
+  EXPECT_FALSE(fru.revalidate(true));
+  writeFruKeepMtime("SN-0007");
+  EXPECT_TRUE(fru.revalidate(true));
+  EXPECT_EQ(changes, 1);
+  EXPECT_NE(lastHash, 0);
+  EXPECT_FALSE(fru.revalidate(true));
+  EXPECT_EQ(changes, 1);
+}
+
+TEST_F(FruIdAccessI2CEEPROMTest, QueryLatency) {
+  const int loops = 10000;
+  FruIdAccessI2CEEPROM access(eeprom_, 0);
+  size_t fields = 0;
+
+  // Every query reading and parsing the EEPROM, as it used to
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loops; i++) {
+    access.revalidate(true);
+    fields += access.getFruIdInfoList()->size();
+  }
+  std::chrono::duration<double, std::micro> uncached =
+    std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loops; i++) {
+    fields += access.getFruIdInfoList()->size();
+  }
+  std::chrono::duration<double, std::micro> cached =
+    std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(fields, 2 * loops * 6);
+  std::cout << "query: read " << uncached.count() / loops << " us, cached "
+            << cached.count() / loops << " us" << std::endl;
+  EXPECT_LT(cached.count(), uncached.count());
+}
+
+int main(int argc, char* argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,4 @@
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <cstdio>
 #include <cstring>
@@ -7,6 +6,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include "fw-util.h"
+#include "mtd.h"
 
 using namespace std;
 
@@ -18,20 +18,6 @@ using namespace std;
 #define VERIFIED_BOOT_HARDWARE_ENFORCE(base) \
   *((uint8_t *)(base + 0x215))
 
-static int system_w(const string &cmd)
-{
-#ifdef DEBUG
-  cout << "Executing: " << cmd << endl;
-#endif
-  int status = system(cmd.c_str());
-  if (status == -1) {
-    return 127;
-  }
-  if (WIFEXITED(status) && (WEXITSTATUS(status) == 0))
-    return FW_STATUS_SUCCESS;
-  return FW_STATUS_FAILURE;
-}
-
 static bool vboot_hardware_enforce(void)
 {
   int mem_fd;
@@ -133,9 +119,6 @@ class BmcComponent : public Component {
     int update(string image_path)
     {
       char dev[12];
-      int ret;
-      string flash_image = image_path;
-      stringstream cmd_str;
 
       if (_mtd_name == "") {
         // Upgrade not supported
@@ -152,70 +135,30 @@ class BmcComponent : public Component {
         return FW_STATUS_FAILURE;
       }
       cout << "Flashing to device: " << string(dev) << endl;
-      if (_skip_offset > 0 || _writable_offset > 0) {
-        flash_image = image_path + "-tmp";
-        // Ensure that we are not overwriting an existing file.
-        while (access( flash_image.c_str(), F_OK  ) != -1) {
-          flash_image.append("_");
-        }
-        // Open input image and seek skipping to the writable offset.
-        int fd_r = open(image_path.c_str(), O_RDONLY);
-        if (fd_r < 0) {
-          cerr << "Cannot open " << image_path << " for reading" << endl;
-          return FW_STATUS_FAILURE;
-        }
-        if (lseek(fd_r, _skip_offset, SEEK_SET) != (off_t)_skip_offset) {
-          close(fd_r);
-          cerr << "Cannot seek " << image_path << endl;
-          return FW_STATUS_FAILURE;
-        }
-        // create tmp file for writing.
-        int fd_w = open(flash_image.c_str(), O_WRONLY | O_CREAT);
-        if (fd_w < 0) {
-          cerr << "Cannot write to " << flash_image << endl;
-          close(fd_r);
-          return FW_STATUS_FAILURE;
-        }
-        uint8_t buf[1024];
-        size_t r_b;
-
-        if (_skip_offset > _writable_offset) {
-          size_t copy = _skip_offset - _writable_offset;
-          int fd_d = open(dev, O_RDONLY);
-          if (fd_d < 0) {
-            close(fd_r);
-            close(fd_w);
-            return FW_STATUS_FAILURE;
-          }
-          while (copy > 0) {
-            size_t to_copy = copy > sizeof(buf) ? sizeof(buf) : copy;
-            r_b = read(fd_d, buf, to_copy);
-            if (r_b != to_copy) {
-              close(fd_r);
-              close(fd_d);
-              close(fd_d);
-              return FW_STATUS_FAILURE;
-            }
-            write(fd_w, buf, to_copy);
-            copy -= to_copy;
-          }
-          close(fd_d);
-        }
 
-        // Copy from r to w.
-        while ((r_b = read(fd_r, buf, 1024)) > 0) {
-          write(fd_w, buf, r_b);
-        }
-        close(fd_r);
-        close(fd_w);
+      int fd_r = open(image_path.c_str(), O_RDONLY);
+      if (fd_r < 0) {
+        cerr << "Cannot open " << image_path << " for reading" << endl;
+        return FW_STATUS_FAILURE;
       }
-      cmd_str << "flashcp -v " << flash_image << " " << string(dev);
-      ret = system_w(cmd_str.str());
-      if (_writable_offset > 0) {
-        // this is a temp. file, remove it.
-        remove(flash_image.c_str());
+      // Below _skip_offset the image would overwrite data which is kept
+      // on the flash, the rest lands at its offset in the writable part.
+      size_t mtd_offset = 0;
+      if (_skip_offset > _writable_offset) {
+        mtd_offset = _skip_offset - _writable_offset;
       }
-      return ret;
+      MtdWriter mtd(true);
+      if (mtd.open(dev) < 0 ||
+          mtd.write(fd_r, _skip_offset, mtd_offset) < 0) {
+        close(fd_r);
+        return FW_STATUS_FAILURE;
+      }
+      close(fd_r);
+      cout << "Flashed " << mtd.stats.bytes << " bytes in "
+           << mtd.stats.seconds << "s: " << mtd.stats.blocks_written
+           << " blocks written, " << mtd.stats.blocks_skipped
+           << " unchanged" << endl;
+      return FW_STATUS_SUCCESS;
     }
     int print_version()
     {
@@ -0,0 +1,305 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <mtd/mtd-user.h>
+#include "mtd.h"
+
+using namespace std;
+
+// Flash is compared and programmed this much at a time
+#define MTD_CHUNK_SIZE    (1024 * 1024)
+
+// A block that does not read back as written is erased and written again
+#define MTD_WRITE_RETRIES 1
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int pread_full(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t r = pread(fd, buf, len, offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    buf += r;
+    len -= r;
+    offset += r;
+  }
+  return 0;
+}
+
+static int pwrite_full(int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t r = pwrite(fd, buf, len, offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    buf += r;
+    len -= r;
+    offset += r;
+  }
+  return 0;
+}
+
+// True if some bit has to go from 0 to 1, which only an erase can do
+static bool needs_erase(const uint8_t *old, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] & ~old[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_erased(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] != 0xff) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MtdWriter::MtdWriter(bool verbose)
+  : _fd(-1), _is_mtd(false), _size(0), _erasesize(0), _verbose(verbose)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+MtdWriter::~MtdWriter()
+{
+  close();
+}
+
+int MtdWriter::open(const string &dev, size_t file_erasesize)
+{
+  struct mtd_info_user info;
+  struct stat st;
+
+  close();
+  _fd = ::open(dev.c_str(), O_RDWR | O_SYNC);
+  if (_fd < 0) {
+    cerr << "Cannot open " << dev << ": " << strerror(errno) << endl;
+    return -1;
+  }
+
+  if (ioctl(_fd, MEMGETINFO, &info) == 0) {
+    _is_mtd = true;
+    _size = info.size;
+    _erasesize = info.erasesize;
+  } else if (file_erasesize > 0 && fstat(_fd, &st) == 0 &&
+             S_ISREG(st.st_mode)) {
+    _is_mtd = false;
+    _size = st.st_size;
+    _erasesize = file_erasesize;
+  } else {
+    cerr << "Cannot get MTD info of " << dev << endl;
+    close();
+    return -1;
+  }
+
+  if (_erasesize == 0 || _size % _erasesize) {
+    cerr << dev << ": unsupported erase size " << _erasesize << endl;
+    close();
+    return -1;
+  }
+  return 0;
+}
+
+void MtdWriter::close()
+{
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+int MtdWriter::erase(size_t offset)
+{
+  if (_is_mtd) {
+    struct erase_info_user ei;
+    ei.start = offset;
+    ei.length = _erasesize;
+    return ioctl(_fd, MEMERASE, &ei);
+  }
+
+  uint8_t *ff = (uint8_t *)malloc(_erasesize);
+  if (!ff) {
+    return -1;
+  }
+  memset(ff, 0xff, _erasesize);
+  int ret = pwrite_full(_fd, ff, _erasesize, offset);
+  free(ff);
+  return ret;
+}
+
+int MtdWriter::program(size_t offset, const uint8_t *buf, size_t len)
+{
+  if (_is_mtd) {
+    return pwrite_full(_fd, buf, len, offset);
+  }
+
+  // Programming NOR flash can only clear bits
+  uint8_t *cell = (uint8_t *)malloc(len);
+  if (!cell) {
+    return -1;
+  }
+  int ret = pread_full(_fd, cell, len, offset);
+  if (ret == 0) {
+    for (size_t i = 0; i < len; i++) {
+      cell[i] &= buf[i];
+    }
+    ret = pwrite_full(_fd, cell, len, offset);
+  }
+  free(cell);
+  return ret;
+}
+
+// Bring one erase block from old to data, erasing only if needed
+int MtdWriter::flash_block(size_t offset, const uint8_t *data,
+    const uint8_t *old, uint8_t *readback)
+{
+  bool erase_first = needs_erase(old, data, _erasesize);
+
+  for (int attempt = 0; attempt <= MTD_WRITE_RETRIES; attempt++) {
+    if (erase_first) {
+      if (erase(offset) < 0) {
+        cerr << "Erase failed at 0x" << hex << offset << dec << endl;
+        return -1;
+      }
+      stats.blocks_erased++;
+    }
+    if (!erase_first || !is_erased(data, _erasesize)) {
+      if (program(offset, data, _erasesize) < 0) {
+        cerr << "Write failed at 0x" << hex << offset << dec << endl;
+        return -1;
+      }
+    }
+    if (pread_full(_fd, readback, _erasesize, offset) < 0) {
+      cerr << "Read back failed at 0x" << hex << offset << dec << endl;
+      return -1;
+    }
+    if (memcmp(readback, data, _erasesize) == 0) {
+      stats.blocks_written++;
+      return 0;
+    }
+    erase_first = true;
+  }
+
+  cerr << "Verification failed at 0x" << hex << offset << dec << endl;
+  return -1;
+}
+
+void MtdWriter::progress(size_t done, size_t total)
+{
+  if (!_verbose || total == 0) {
+    return;
+  }
+  cout << "\rWriting: " << (done * 100 / total) << "% ("
+       << stats.blocks_written << " written, "
+       << stats.blocks_skipped << " unchanged)" << flush;
+  if (done == total) {
+    cout << endl;
+  }
+}
+
+int MtdWriter::write(int image_fd, size_t image_offset, size_t mtd_offset)
+{
+  struct stat st;
+  size_t len, end, first, last, chunk;
+  uint8_t *data = NULL, *old = NULL, *readback = NULL;
+  double start = now();
+  int ret = -1;
+
+  memset(&stats, 0, sizeof(stats));
+  if (_fd < 0 || fstat(image_fd, &st) < 0 ||
+      (size_t)st.st_size < image_offset) {
+    return -1;
+  }
+  len = st.st_size - image_offset;
+  end = mtd_offset + len;
+  if (end > _size) {
+    cerr << "Image (" << len << " bytes at 0x" << hex << mtd_offset << dec
+         << ") does not fit the " << _size << " byte device" << endl;
+    return -1;
+  }
+
+  first = mtd_offset - mtd_offset % _erasesize;
+  last = (end + _erasesize - 1) / _erasesize * _erasesize;
+  chunk = _erasesize > MTD_CHUNK_SIZE ? _erasesize :
+          MTD_CHUNK_SIZE / _erasesize * _erasesize;
+
+  if (posix_memalign((void **)&data, _erasesize, chunk) ||
+      posix_memalign((void **)&old, _erasesize, chunk) ||
+      posix_memalign((void **)&readback, _erasesize, _erasesize)) {
+    cerr << "Out of memory" << endl;
+    goto bail;
+  }
+  posix_fadvise(image_fd, image_offset, len, POSIX_FADV_SEQUENTIAL);
+
+  for (size_t pos = first; pos < last; pos += chunk) {
+    size_t n = last - pos < chunk ? last - pos : chunk;
+    size_t from = pos > mtd_offset ? pos : mtd_offset;
+    size_t to = pos + n < end ? pos + n : end;
+
+    // let the kernel fetch the next chunk of the image meanwhile
+    if (to < end) {
+      posix_fadvise(image_fd, image_offset + (to - mtd_offset), chunk,
+          POSIX_FADV_WILLNEED);
+    }
+
+    if (pread_full(_fd, old, n, pos) < 0) {
+      cerr << "Read failed at 0x" << hex << pos << dec << endl;
+      goto bail;
+    }
+    // bytes of partial blocks outside the image keep their contents
+    memcpy(data, old, n);
+    if (pread_full(image_fd, data + (from - pos), to - from,
+                   image_offset + (from - mtd_offset)) < 0) {
+      cerr << "Cannot read image" << endl;
+      goto bail;
+    }
+
+    for (size_t b = 0; b < n; b += _erasesize) {
+      if (memcmp(data + b, old + b, _erasesize) == 0) {
+        stats.blocks_skipped++;
+        continue;
+      }
+      if (flash_block(pos + b, data + b, old + b, readback) < 0) {
+        goto bail;
+      }
+    }
+    stats.bytes += to - from;
+    progress(pos + n - first, last - first);
+  }
+  ret = 0;
+
+bail:
+  stats.seconds = now() - start;
+  free(data);
+  free(old);
+  free(readback);
+  return ret;
+}
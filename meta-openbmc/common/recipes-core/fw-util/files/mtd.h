@@ -0,0 +1,47 @@
+#ifndef _MTD_H_
+#define _MTD_H_
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/* Writes an image straight to an MTD partition. Every erase block is
+ * read first and only the blocks whose contents differ are erased and
+ * programmed; each programmed block is read back and compared. */
+class MtdWriter {
+  int _fd;
+  bool _is_mtd;
+  size_t _size;
+  size_t _erasesize;
+  bool _verbose;
+
+  int erase(size_t offset);
+  int program(size_t offset, const uint8_t *buf, size_t len);
+  int flash_block(size_t offset, const uint8_t *data, const uint8_t *old,
+      uint8_t *readback);
+  void progress(size_t done, size_t total);
+  public:
+    struct Stats {
+      size_t blocks_erased;
+      size_t blocks_written;
+      size_t blocks_skipped;
+      size_t bytes;
+      double seconds;
+    } stats;
+
+    MtdWriter(bool verbose = false);
+    ~MtdWriter();
+
+    // A regular file may stand in for the device; it then behaves like
+    // NOR flash with the given erase block size.
+    int open(const std::string &dev, size_t file_erasesize = 0);
+    void close();
+
+    // Write image_fd from image_offset to its end at mtd_offset. Bytes of
+    // the device outside that range are left as they are.
+    int write(int image_fd, size_t image_offset, size_t mtd_offset);
+
+    size_t size() { return _size; }
+    size_t erasesize() { return _erasesize; }
+};
+
+#endif
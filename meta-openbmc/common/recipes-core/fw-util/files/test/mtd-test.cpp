@@ -0,0 +1,162 @@
+/*
+ * mtd-test.cpp
+ *
+ * Copyright 2017-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../mtd.h"
+
+using namespace std;
+
+/* MtdWriter against a file-backed fake MTD, which behaves like NOR
+ * flash: erase sets a block to 0xff and programming only clears bits,
+ * so a block written without the erase it needed fails verification. */
+
+#define ERASE_SIZE  (64 * 1024)
+#define FLASH_SIZE  (8 * 1024 * 1024)
+#define IMAGE_SIZE  (6 * 1024 * 1024 + 1000)
+
+static string flash_path;
+static string image_path;
+
+static void write_file(const string &path, const vector<uint8_t> &buf)
+{
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  assert(write(fd, buf.data(), buf.size()) == (ssize_t)buf.size());
+  close(fd);
+}
+
+static vector<uint8_t> read_file(const string &path)
+{
+  vector<uint8_t> buf(FLASH_SIZE);
+  int fd = open(path.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  assert(read(fd, buf.data(), buf.size()) == (ssize_t)buf.size());
+  close(fd);
+  return buf;
+}
+
+static MtdWriter::Stats flash(const vector<uint8_t> &image,
+    size_t image_offset, size_t mtd_offset, int expect = 0)
+{
+  MtdWriter mtd;
+  write_file(image_path, image);
+  int fd = open(image_path.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  assert(mtd.open(flash_path, ERASE_SIZE) == 0);
+  assert(mtd.size() == FLASH_SIZE && mtd.erasesize() == ERASE_SIZE);
+  assert(mtd.write(fd, image_offset, mtd_offset) == expect);
+  close(fd);
+  return mtd.stats;
+}
+
+static void report(const char *name, const MtdWriter::Stats &s)
+{
+  cout << name << ": " << s.blocks_erased << " erased, "
+       << s.blocks_written << " written, " << s.blocks_skipped
+       << " unchanged, " << s.bytes / s.seconds / (1024 * 1024)
+       << " MB/s" << endl;
+}
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/mtd-test.XXXXXX";
+  size_t blocks = (IMAGE_SIZE + ERASE_SIZE - 1) / ERASE_SIZE;
+  vector<uint8_t> image(IMAGE_SIZE), old, now;
+  MtdWriter::Stats s;
+
+  assert(mkdtemp(dir));
+  flash_path = string(dir) + "/flash";
+  image_path = string(dir) + "/image";
+
+  srand(1);
+  for (auto &b : image) {
+    b = rand();
+  }
+  old.resize(FLASH_SIZE);
+  for (auto &b : old) {
+    b = rand();
+  }
+  write_file(flash_path, old);
+
+  // Full write over unrelated contents
+  s = flash(image, 0, 0);
+  report("full write", s);
+  now = read_file(flash_path);
+  assert(memcmp(now.data(), image.data(), IMAGE_SIZE) == 0);
+  assert(memcmp(&now[IMAGE_SIZE], &old[IMAGE_SIZE],
+                FLASH_SIZE - IMAGE_SIZE) == 0);
+  assert(s.blocks_written == blocks && s.blocks_erased == blocks);
+  assert(s.bytes == IMAGE_SIZE);
+
+  // Same image again: nothing is erased or written
+  s = flash(image, 0, 0);
+  report("same image", s);
+  assert(s.blocks_written == 0 && s.blocks_erased == 0);
+  assert(s.blocks_skipped == blocks);
+
+  // A few bytes changed: only their blocks are rewritten
+  image[10] ^= 0x01;
+  image[3 * ERASE_SIZE + 7] |= 0x80;
+  image[IMAGE_SIZE - 1] ^= 0xff;
+  s = flash(image, 0, 0);
+  report("3 blocks changed", s);
+  assert(s.blocks_written == 3 && s.blocks_skipped == blocks - 3);
+  now = read_file(flash_path);
+  assert(memcmp(now.data(), image.data(), IMAGE_SIZE) == 0);
+
+  // Only bits cleared: programmed without an erase
+  for (size_t i = 0; i < ERASE_SIZE; i++) {
+    image[5 * ERASE_SIZE + i] &= 0x0f;
+  }
+  s = flash(image, 0, 0);
+  assert(s.blocks_written == 1 && s.blocks_erased == 0);
+  now = read_file(flash_path);
+  assert(memcmp(now.data(), image.data(), IMAGE_SIZE) == 0);
+
+  // Verified boot layout: skip the first 84K of the image and write the
+  // rest 20K into the partition, keeping what is there before it
+  old = read_file(flash_path);
+  for (auto &b : image) {
+    b = rand();
+  }
+  s = flash(image, 84 * 1024, 20 * 1024);
+  now = read_file(flash_path);
+  assert(memcmp(now.data(), old.data(), 20 * 1024) == 0);
+  assert(memcmp(&now[20 * 1024], &image[84 * 1024],
+                IMAGE_SIZE - 84 * 1024) == 0);
+  assert(memcmp(&now[IMAGE_SIZE - 64 * 1024], &old[IMAGE_SIZE - 64 * 1024],
+                FLASH_SIZE - (IMAGE_SIZE - 64 * 1024)) == 0);
+
+  // Does not fit
+  image.resize(FLASH_SIZE + 1);
+  flash(image, 0, 0, -1);
+
+  unlink(flash_path.c_str());
+  unlink(image_path.c_str());
+  rmdir(dir);
+  cout << "All tests passed" << endl;
+  return 0;
+}
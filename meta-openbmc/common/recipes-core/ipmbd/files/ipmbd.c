@@ -88,6 +88,23 @@ typedef struct _ipmb_sfd_t {
   int sock;
 } ipmb_sfd_t;
 
+// A multiplexed connection, see SOCK_PATH_IPMB_MUX
+typedef struct _ipmb_mux_conn_t {
+  int fd;
+  int sock;
+  int refs; // the reader and each request being handled
+  int inflight;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} ipmb_mux_conn_t;
+
+// A request read from a multiplexed connection
+typedef struct _ipmb_mux_req_t {
+  ipmb_mux_conn_t *conn;
+  int len;
+  unsigned char buf[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+} ipmb_mux_req_t;
+
 // Structure for sequence number and buffer
 typedef struct _seq_buf_t {
   bool in_use; // seq# is being used
@@ -679,6 +696,15 @@ ipmb_handle_out:
   return;
 }
 
+// With bicup, only the BIC update requests go through
+static bool
+ipmb_req_allowed(unsigned char *req, int len) {
+  if (bic_up_flag) {
+    return (len > 5) && (req[1] == 0xe0) && (req[5] == CMD_OEM_1S_ENABLE_BIC_UPDATE);
+  }
+  return true;
+}
+
 void
 *conn_handler(void *sfd) {
   ipmb_sfd_t *p_sfd = (ipmb_sfd_t *) sfd;
@@ -703,10 +729,8 @@ void
       goto conn_cleanup;
   }
 
-  if(bic_up_flag){
-      if(!((req_buf[1] == 0xe0) && (req_buf[5] == CMD_OEM_1S_ENABLE_BIC_UPDATE))){
-          goto conn_cleanup;
-	}
+  if (!ipmb_req_allowed(req_buf, n)) {
+      goto conn_cleanup;
   }
 
   ipmb_handle(fd, req_buf, n, res_buf, &res_len);
@@ -725,6 +749,163 @@ conn_cleanup:
   return 0;
 }
 
+static void
+mux_conn_put(ipmb_mux_conn_t *conn, bool req) {
+  int refs;
+
+  pthread_mutex_lock(&conn->mutex);
+  if (req) {
+    conn->inflight--;
+    pthread_cond_signal(&conn->cond);
+  }
+  refs = --conn->refs;
+  pthread_mutex_unlock(&conn->mutex);
+
+  if (refs == 0) {
+    close(conn->sock);
+    pthread_mutex_destroy(&conn->mutex);
+    pthread_cond_destroy(&conn->cond);
+    free(conn);
+  }
+}
+
+// Thread to handle one request of a multiplexed connection
+static void*
+mux_req_handler(void *arg) {
+  ipmb_mux_req_t *r = (ipmb_mux_req_t *) arg;
+  ipmb_mux_conn_t *conn = r->conn;
+  unsigned char *req = r->buf + sizeof(ipmb_mux_hdr_t);
+  int n = r->len - sizeof(ipmb_mux_hdr_t);
+  unsigned char res_buf[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+  unsigned char res_len = 0;
+
+  // Answered with the tag of the request, and no message if it failed
+  memcpy(res_buf, r->buf, sizeof(ipmb_mux_hdr_t));
+  if (n >= MIN_IPMB_REQ_LEN && ipmb_req_allowed(req, n)) {
+    ipmb_handle(conn->fd, req, n, res_buf + sizeof(ipmb_mux_hdr_t), &res_len);
+  }
+
+  if (send(conn->sock, res_buf, sizeof(ipmb_mux_hdr_t) + res_len, MSG_NOSIGNAL) < 0) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "ipmbd: mux send() failed\n");
+#endif
+  }
+
+  free(r);
+  mux_conn_put(conn, true);
+  pthread_exit(NULL);
+  return 0;
+}
+
+// Thread to read the requests of a multiplexed connection
+static void*
+mux_conn_handler(void *arg) {
+  ipmb_mux_conn_t *conn = (ipmb_mux_conn_t *) arg;
+  ipmb_mux_req_t *r;
+  pthread_attr_t attr;
+  pthread_t tid;
+  int n;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (1) {
+    r = (ipmb_mux_req_t *) malloc(sizeof(ipmb_mux_req_t));
+    if (r == NULL) {
+      break;
+    }
+
+    n = recv(conn->sock, r->buf, sizeof(r->buf), 0);
+    if (n < 0 && errno == EINTR) {
+      free(r);
+      continue;
+    }
+    if (n < (int)sizeof(ipmb_mux_hdr_t)) {
+      // Closed by the client
+      free(r);
+      break;
+    }
+
+    // Stop reading while enough requests are outstanding, the client
+    // then blocks in send()
+    pthread_mutex_lock(&conn->mutex);
+    while (conn->inflight >= IPMB_MUX_MAX_INFLIGHT) {
+      pthread_cond_wait(&conn->cond, &conn->mutex);
+    }
+    conn->inflight++;
+    conn->refs++;
+    pthread_mutex_unlock(&conn->mutex);
+
+    r->conn = conn;
+    r->len = n;
+    if (pthread_create(&tid, &attr, mux_req_handler, (void*) r) != 0) {
+      syslog(LOG_WARNING, "ipmbd: pthread_create failed\n");
+      free(r);
+      mux_conn_put(conn, true);
+    }
+  }
+
+  pthread_attr_destroy(&attr);
+  mux_conn_put(conn, false);
+  pthread_exit(NULL);
+  return 0;
+}
+
+// Thread to accept the multiplexed connections of the IPMB lib
+static void*
+ipmb_mux_handler(void *i2c_fd) {
+  int s, s2, len;
+  struct sockaddr_un local;
+  ipmb_mux_conn_t *conn;
+  pthread_attr_t attr;
+  pthread_t tid;
+
+  if ((s = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+    syslog(LOG_WARNING, "ipmbd: mux socket() failed\n");
+    return NULL;
+  }
+
+  local.sun_family = AF_UNIX;
+  snprintf(local.sun_path, sizeof(local.sun_path), "%s_%d", SOCK_PATH_IPMB_MUX, g_bus_id);
+  unlink(local.sun_path);
+  len = strlen(local.sun_path) + sizeof(local.sun_family);
+  if (bind(s, (struct sockaddr *) &local, len) == -1 || listen(s, 5) == -1) {
+    syslog(LOG_WARNING, "ipmbd: mux bind() or listen() failed\n");
+    close(s);
+    return NULL;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (1) {
+    if ((s2 = accept(s, NULL, NULL)) < 0) {
+      syslog(LOG_WARNING, "ipmbd: mux accept() failed, errno: %x\n", errno);
+      sleep(5);
+      continue;
+    }
+
+    conn = (ipmb_mux_conn_t *) calloc(1, sizeof(ipmb_mux_conn_t));
+    if (conn == NULL) {
+      close(s2);
+      continue;
+    }
+    conn->fd = (int)(intptr_t) i2c_fd;
+    conn->sock = s2;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->mutex, NULL);
+    pthread_cond_init(&conn->cond, NULL);
+    if (pthread_create(&tid, &attr, mux_conn_handler, (void*) conn) != 0) {
+      syslog(LOG_WARNING, "ipmbd: pthread_create failed\n");
+      mux_conn_put(conn, false);
+    }
+  }
+
+  close(s);
+  pthread_attr_destroy(&attr);
+  return NULL;
+}
+
 // Thread to receive the IPMB lib messages from various apps
 static void*
 ipmb_lib_handler(void *bus_num) {
@@ -735,9 +916,10 @@ ipmb_lib_handler(void *bus_num) {
   ipmb_sfd_t *sfd;
   int fd;
   uint8_t *bnum = (uint8_t*) bus_num;
-  char sock_path[24] = {0};
+  char sock_path[32] = {0};
   int rc = 0;
   pthread_attr_t attr;
+  pthread_t tid_mux;
 
   // Open the i2c bus for sending request
   fd = i2c_open(*bnum);
@@ -784,6 +966,11 @@ ipmb_lib_handler(void *bus_num) {
     exit (1);
   }
 
+  // Clients which keep their connections, alongside the ones above
+  if (pthread_create(&tid_mux, &attr, ipmb_mux_handler, (void*)(intptr_t) fd) != 0) {
+    syslog(LOG_WARNING, "ipmbd: pthread_create failed\n");
+  }
+
   while(1) {
     t = sizeof (remote);
     // TODO: Seen accept() call failure and need further debug
@@ -0,0 +1,267 @@
+/*
+ *
+ * Copyright 2014-present Facebook. All Rights Reserved.
+ *
+ * This file contains the response cache for the read-mostly IPMI
+ * commands handled by ipmid.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#define _GNU_SOURCE
+#include "ipmi-cache.h"
+#include "sdr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <openbmc/ipmi.h>
+
+// Responses of the command are kept
+#define CACHE_F_STORE       0x01
+// The command changes what others return: invalidate the event once handled
+#define CACHE_F_INVALIDATE  0x02
+// The first two data bytes are an SDR reservation ID (IPMI/Section 33.12)
+#define CACHE_F_SDR_RSV     0x04
+
+typedef struct {
+  unsigned char netfn;
+  unsigned char cmd;
+  unsigned char event;
+  unsigned char flags;
+  unsigned char min_len;  // request data bytes the handler reads
+  int ttl;                // msec, 0 for as long as the event allows
+} cache_policy_t;
+
+static const cache_policy_t g_policy[] = {
+  {NETFN_APP_REQ, CMD_APP_GET_DEVICE_ID, IPMI_CACHE_EV_NONE,
+   CACHE_F_STORE, 0, 0},
+  {NETFN_APP_REQ, CMD_APP_GET_SELFTEST_RESULTS, IPMI_CACHE_EV_NONE,
+   CACHE_F_STORE, 0, IPMI_CACHE_SELFTEST_TTL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SDR_INFO, IPMI_CACHE_EV_SDR,
+   CACHE_F_STORE, 0, 0},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SDR, IPMI_CACHE_EV_SDR,
+   CACHE_F_STORE | CACHE_F_SDR_RSV, 6, 0},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_FRUID_INFO, IPMI_CACHE_EV_FRU,
+   CACHE_F_STORE, 0, IPMI_CACHE_FRU_TTL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_READ_FRUID_DATA, IPMI_CACHE_EV_FRU,
+   CACHE_F_STORE, 4, IPMI_CACHE_FRU_TTL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_WRITE_FRUID_DATA, IPMI_CACHE_EV_FRU,
+   CACHE_F_INVALIDATE, 0, 0},
+};
+
+#define NUM_POLICIES (sizeof(g_policy) / sizeof(g_policy[0]))
+
+typedef struct {
+  unsigned char key[IPMI_CACHE_KEY_MAX];
+  unsigned char key_len;    // 0 for an unused slot
+  unsigned short res_len;
+  uint32_t gen;
+  long long expires;        // msec, 0 for never
+  unsigned char res[IPMI_CACHE_RES_MAX];
+} cache_entry_t;
+
+static cache_entry_t g_cache[IPMI_CACHE_SLOTS];
+static pthread_rwlock_t g_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned int g_victim;
+
+// Generations of the events; the FRU one is per payload
+static volatile uint32_t g_sdr_gen;
+static volatile uint32_t g_fru_gen[256];
+
+static ipmi_cache_stats_t g_stats;
+
+static long long
+now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+find_policy(unsigned char netfn, unsigned char cmd) {
+  int i;
+
+  for (i = 0; i < NUM_POLICIES; i++) {
+    if (g_policy[i].netfn == netfn && g_policy[i].cmd == cmd)
+      return i;
+  }
+  return -1;
+}
+
+static uint32_t
+event_gen(int event, unsigned char payload_id) {
+  switch (event) {
+    case IPMI_CACHE_EV_SDR:
+      return g_sdr_gen;
+    case IPMI_CACHE_EV_FRU:
+      return g_fru_gen[payload_id];
+    default:
+      return 0;
+  }
+}
+
+// Payload, netfn, cmd and the request data, less the reservation ID
+static int
+make_key(const cache_policy_t *p, unsigned char *request,
+         unsigned char req_len, unsigned char *key) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  int data_len = req_len - IPMI_MN_REQ_HDR_SIZE;
+  int skip = (p->flags & CACHE_F_SDR_RSV) ? 2 : 0;
+
+  if (data_len < p->min_len || data_len - skip > IPMI_CACHE_KEY_MAX - 3)
+    return -1;
+
+  key[0] = req->payload_id;
+  key[1] = req->netfn_lun >> 2;
+  key[2] = req->cmd;
+  memcpy(&key[3], &req->data[skip], data_len - skip);
+
+  return data_len - skip + 3;
+}
+
+// FNV-1a, to the first slot of a set of IPMI_CACHE_WAYS
+static cache_entry_t *
+key_set(const unsigned char *key, int len) {
+  uint32_t hash = 2166136261u;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= key[i];
+    hash *= 16777619u;
+  }
+  return &g_cache[(hash % (IPMI_CACHE_SLOTS / IPMI_CACHE_WAYS)) * IPMI_CACHE_WAYS];
+}
+
+static cache_entry_t *
+set_find(cache_entry_t *set, const unsigned char *key, int len) {
+  int i;
+
+  for (i = 0; i < IPMI_CACHE_WAYS; i++) {
+    if (set[i].key_len == len && !memcmp(set[i].key, key, len))
+      return &set[i];
+  }
+  return NULL;
+}
+
+int
+ipmi_cache_lookup(unsigned char *request, unsigned char req_len,
+                  unsigned char *response, unsigned char *res_len,
+                  ipmi_cache_ctx_t *ctx) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  const cache_policy_t *p;
+  cache_entry_t *e;
+  unsigned char key[IPMI_CACHE_KEY_MAX];
+  int key_len, ret = -1;
+
+  ctx->policy = -1;
+  if (req_len < IPMI_MN_REQ_HDR_SIZE)
+    return -1;
+  if ((ctx->policy = find_policy(req->netfn_lun >> 2, req->cmd)) < 0)
+    return -1;
+
+  p = &g_policy[ctx->policy];
+  ctx->gen = event_gen(p->event, req->payload_id);
+  if (!(p->flags & CACHE_F_STORE))
+    return -1;
+  if ((key_len = make_key(p, request, req_len, key)) < 0)
+    return -1;
+
+  // A stale reservation gets its error from the handler
+  if ((p->flags & CACHE_F_SDR_RSV) &&
+      !sdr_rsv_valid(req->payload_id, (req->data[1] << 8) | req->data[0])) {
+    __sync_fetch_and_add(&g_stats.misses, 1);
+    return -1;
+  }
+
+  pthread_rwlock_rdlock(&g_cache_lock);
+  e = set_find(key_set(key, key_len), key, key_len);
+  if (e && e->gen == ctx->gen && (!e->expires || now_ms() < e->expires)) {
+    memcpy(response, e->res, e->res_len);
+    *(unsigned short*)res_len = e->res_len;
+    ret = 0;
+  }
+  pthread_rwlock_unlock(&g_cache_lock);
+
+  __sync_fetch_and_add(ret ? &g_stats.misses : &g_stats.hits, 1);
+  return ret;
+}
+
+void
+ipmi_cache_update(unsigned char *request, unsigned char req_len,
+                  unsigned char *response, unsigned char *res_len,
+                  ipmi_cache_ctx_t *ctx) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  unsigned short len = *(unsigned short*)res_len;
+  const cache_policy_t *p;
+  cache_entry_t *set, *e;
+  unsigned char key[IPMI_CACHE_KEY_MAX];
+  int key_len, i;
+
+  if (ctx->policy < 0)
+    return;
+
+  p = &g_policy[ctx->policy];
+  if (p->flags & CACHE_F_INVALIDATE) {
+    ipmi_cache_invalidate(p->event, req->payload_id);
+    return;
+  }
+
+  if (res->cc != CC_SUCCESS || len > IPMI_CACHE_RES_MAX)
+    return;
+  if ((key_len = make_key(p, request, req_len, key)) < 0)
+    return;
+
+  // Stored under the generation seen before the handler ran: an
+  // invalidation racing with the handler leaves a stale entry, not a wrong one
+  set = key_set(key, key_len);
+  pthread_rwlock_wrlock(&g_cache_lock);
+  if ((e = set_find(set, key, key_len)) == NULL) {
+    // An unused slot of the set, or else each one in turn
+    for (i = 0; i < IPMI_CACHE_WAYS && set[i].key_len; i++);
+    e = &set[(i < IPMI_CACHE_WAYS) ? i : g_victim++ % IPMI_CACHE_WAYS];
+  }
+  memcpy(e->key, key, key_len);
+  e->key_len = key_len;
+  memcpy(e->res, response, len);
+  e->res_len = len;
+  e->gen = ctx->gen;
+  e->expires = p->ttl ? now_ms() + p->ttl : 0;
+  pthread_rwlock_unlock(&g_cache_lock);
+
+  __sync_fetch_and_add(&g_stats.stores, 1);
+}
+
+void
+ipmi_cache_invalidate(int event, unsigned char payload_id) {
+  switch (event) {
+    case IPMI_CACHE_EV_SDR:
+      __sync_fetch_and_add(&g_sdr_gen, 1);
+      break;
+    case IPMI_CACHE_EV_FRU:
+      __sync_fetch_and_add(&g_fru_gen[payload_id], 1);
+      break;
+    default:
+      return;
+  }
+  __sync_fetch_and_add(&g_stats.invalidations, 1);
+}
+
+void
+ipmi_cache_get_stats(ipmi_cache_stats_t *stats) {
+  memcpy(stats, &g_stats, sizeof(ipmi_cache_stats_t));
+}
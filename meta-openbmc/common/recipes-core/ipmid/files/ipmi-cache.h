@@ -0,0 +1,87 @@
+/*
+ *
+ * Copyright 2014-present Facebook. All Rights Reserved.
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __IPMI_CACHE_H__
+#define __IPMI_CACHE_H__
+
+#include <stdint.h>
+
+/*
+ * Response cache for the read-mostly IPMI commands: Get Device ID, Get
+ * Self-Test Results, Get SDR Repository Info, Get SDR and the FRU
+ * inventory reads. Responses are kept per (netfn, cmd, payload, request
+ * bytes) and served without taking the netfn mutex.
+ *
+ * An entry stays good until its TTL runs out or until the event it
+ * depends on happens: an SDR add bumps the SDR generation, a Write FRU
+ * Data bumps the generation of that payload's FRU. Get SDR is keyed
+ * without its reservation ID, so every reservation shares the entries,
+ * and a hit is only served while the request's reservation is current.
+ */
+
+#define IPMI_CACHE_SLOTS    512
+#define IPMI_CACHE_WAYS     4
+#define IPMI_CACHE_KEY_MAX  16
+#define IPMI_CACHE_RES_MAX  80
+
+// Events an entry depends on
+#define IPMI_CACHE_EV_NONE  0
+#define IPMI_CACHE_EV_SDR   1
+#define IPMI_CACHE_EV_FRU   2
+
+// FRU binaries may also be rewritten by fruid-util behind ipmid's back
+#define IPMI_CACHE_FRU_TTL     5000 // msec
+#define IPMI_CACHE_SELFTEST_TTL 10000 // msec
+
+// Filled in by ipmi_cache_lookup() and handed to ipmi_cache_update()
+typedef struct {
+  int policy;       // index into the policy table, -1 if not cacheable
+  uint32_t gen;     // generation of the event when the request came in
+} ipmi_cache_ctx_t;
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t stores;
+  uint32_t invalidations;
+} ipmi_cache_stats_t;
+
+/*
+ * Look up the response to request. On a hit, response and res_len
+ * (an unsigned short, as ipmi_handle() uses it) are filled in with the
+ * complete response and 0 is returned. On a miss, -1 is returned and ctx
+ * is to be passed to ipmi_cache_update() once the response is built.
+ */
+int ipmi_cache_lookup(unsigned char *request, unsigned char req_len,
+                      unsigned char *response, unsigned char *res_len,
+                      ipmi_cache_ctx_t *ctx);
+
+// Keep the response of a cacheable command, or apply the invalidation
+// of a command which changes what others return
+void ipmi_cache_update(unsigned char *request, unsigned char req_len,
+                       unsigned char *response, unsigned char *res_len,
+                       ipmi_cache_ctx_t *ctx);
+
+// Drop the entries depending on event (for the FRU, of this payload)
+void ipmi_cache_invalidate(int event, unsigned char payload_id);
+
+void ipmi_cache_get_stats(ipmi_cache_stats_t *stats);
+
+#endif /* __IPMI_CACHE_H__ */
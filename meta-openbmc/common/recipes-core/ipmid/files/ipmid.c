@@ -23,6 +23,7 @@
 #include "sdr.h"
 #include "sel.h"
 #include "fruid.h"
+#include "ipmi-cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -3563,9 +3564,15 @@ ipmi_handle (unsigned char *request, unsigned char req_len,
 
   ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
   ipmi_res_t *res = (ipmi_res_t *) response;
+  ipmi_cache_ctx_t cache;
   unsigned char netfn;
   netfn = req->netfn_lun >> 2;
 
+  // Read-mostly commands are answered from the cache, without the netfn lock
+  if (ipmi_cache_lookup(request, req_len, response, res_len, &cache) == 0) {
+    return;
+  }
+
   // Provide default values in the response message
   res->cmd = req->cmd;
   res->cc = 0xFF;   // Unspecified completion code
@@ -3625,6 +3632,8 @@ ipmi_handle (unsigned char *request, unsigned char req_len,
   // This header includes NetFunction, Command, and Completion Code
   *(unsigned short*)res_len += IPMI_RESP_HDR_SIZE;
 
+  ipmi_cache_update(request, req_len, response, res_len, &cache);
+
   return;
 }
 
@@ -3652,11 +3661,19 @@ void
       goto conn_cleanup;
   }
 
-  ipmi_handle(req_buf, n, res_buf, (unsigned char*)&res_len);
+  // Clients using lib_ipmi_handle_persistent() keep the connection open
+  // for further requests; others close it after the first response
+  tv.tv_sec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,sizeof(struct timeval));
 
-  if (send (sock, res_buf, res_len, 0) < 0) {
-    syslog(LOG_WARNING, "ipmid: send() failed\n");
-  }
+  do {
+    ipmi_handle(req_buf, n, res_buf, (unsigned char*)&res_len);
+
+    if (send (sock, res_buf, res_len, MSG_NOSIGNAL) < 0) {
+      syslog(LOG_WARNING, "ipmid: send() failed\n");
+      break;
+    }
+  } while ((n = recv (sock, req_buf, sizeof(req_buf), 0)) > 0);
 
 conn_cleanup:
   close(sock);
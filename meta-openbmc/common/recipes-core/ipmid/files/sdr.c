@@ -23,6 +23,7 @@
 #include "sdr.h"
 #include "sensor.h"
 #include "timestamp.h"
+#include "ipmi-cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -108,6 +109,9 @@ sdr_add_entry(sdr_rec_t *rec, int *rec_id) {
   // Update timestamp for add in header
   time_stamp_fill(g_sdr_hdr.ts_add.ts);
 
+  // Cached SDR responses are stale now
+  ipmi_cache_invalidate(IPMI_CACHE_EV_SDR, 0);
+
   return 0;
 }
 
@@ -314,6 +318,12 @@ sdr_rsv_id(int node) {
   return g_rsv_id[node];
 }
 
+// Check a reservation ID is the current one for the node
+int
+sdr_rsv_valid(int node, int rsv_id) {
+  return (rsv_id == g_rsv_id[node]);
+}
+
 // Get the SDR entry for a given record ID
 // IPMI/Section 33.12
 int
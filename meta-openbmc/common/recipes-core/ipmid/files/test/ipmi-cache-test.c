@@ -0,0 +1,578 @@
+/*
+ * ipmid response cache test
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openbmc/ipmi.h>
+#include "sdr.h"
+#include "sensor.h"
+#include "ipmi-cache.h"
+
+/*
+ * Captured request streams are replayed through a dispatcher laid out
+ * like ipmid's ipmi_handle(), over the real SDR repository and a FRU
+ * binary on disk: once as ipmid did before the cache, once with it.
+ * The responses have to be the same byte for byte; the hit rate and the
+ * time per request are reported.
+ */
+
+#define DEFAULT_CAPTURE "/usr/local/share/ipmid-test/host-poll.txt"
+#define MAX_REQS        8192
+#define ROUNDS          20
+#define NUM_THRESH      20
+#define NUM_DISC        4
+#define FRU_SIZE        256
+
+typedef struct {
+  unsigned char req[MAX_IPMI_MSG_SIZE];
+  unsigned char req_len;
+} capture_t;
+
+static capture_t g_reqs[MAX_REQS];
+static int g_num_reqs;
+static unsigned char *g_ref;   // responses without the cache, per request
+
+static char g_fru_path[64];
+static char g_issue_path[64];
+static int g_use_cache;
+static long long g_clock_skew;  // msec added to the cache's clock
+
+// Error checking, so a handler run while the test holds it shows
+static pthread_mutex_t m_app;
+static pthread_mutex_t m_storage;
+static pthread_mutex_t m_sensor;
+
+/* The SDR repository: threshold and discrete sensors */
+static sensor_thresh_t g_thresh[NUM_THRESH];
+static sensor_disc_t g_disc[NUM_DISC];
+
+void
+plat_sensor_mgmt_info(int *num, sensor_mgmt_t **p_sensor) {
+  *num = 0;
+  *p_sensor = NULL;
+}
+
+void
+plat_sensor_disc_info(int *num, sensor_disc_t **p_sensor) {
+  *num = NUM_DISC;
+  *p_sensor = g_disc;
+}
+
+void
+plat_sensor_thresh_info(int *num, sensor_thresh_t **p_sensor) {
+  *num = NUM_THRESH;
+  *p_sensor = g_thresh;
+}
+
+void
+plat_sensor_oem_info(int *num, sensor_oem_t **p_sensor) {
+  *num = 0;
+  *p_sensor = NULL;
+}
+
+int __real_clock_gettime(clockid_t clk, struct timespec *ts);
+
+int
+__wrap_clock_gettime(clockid_t clk, struct timespec *ts) {
+  int ret = __real_clock_gettime(clk, ts);
+
+  ts->tv_sec += g_clock_skew / 1000;
+  return ret;
+}
+
+static void
+lock(pthread_mutex_t *m) {
+  int ret = pthread_mutex_lock(m);
+
+  if (ret) {
+    printf("FAIL: handler ran with its netfn lock held (%s)\n", strerror(ret));
+    exit(1);
+  }
+}
+
+/* The handlers, as ipmid has them */
+static void
+app_get_device_id(unsigned char *response, unsigned char *res_len) {
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  unsigned char *data = &res->data[0];
+  int fv_major = 0x01, fv_minor = 0x03;
+  char buffer[32];
+  FILE *fp;
+
+  if ((fp = fopen(g_issue_path, "r")) != NULL) {
+    if (fgets(buffer, sizeof(buffer), fp))
+      sscanf(buffer, "%*[^v]v%d.%d", &fv_major, &fv_minor);
+    fclose(fp);
+  }
+  res->cc = CC_SUCCESS;
+  *data++ = 0x20;
+  *data++ = 0x81;
+  *data++ = fv_major & 0x7f;
+  *data++ = ((fv_minor / 10) << 4) | (fv_minor % 10);
+  *data++ = 0x02;
+  *data++ = 0xBF;
+  *data++ = 0x15;
+  *data++ = 0xA0;
+  *data++ = 0x00;
+  *data++ = 0x46;
+  *data++ = 0x31;
+  memset(data, 0, 4);
+  data += 4;
+  *(unsigned short*)res_len = data - &res->data[0];
+}
+
+static void
+app_get_selftest_results(unsigned char *response, unsigned char *res_len) {
+  ipmi_res_t *res = (ipmi_res_t *) response;
+
+  res->cc = CC_SUCCESS;
+  res->data[0] = 0x55;
+  res->data[1] = 0x00;
+  *(unsigned short*)res_len = 2;
+}
+
+static void
+storage_get_sdr_info(unsigned char *response, unsigned char *res_len) {
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  unsigned char *data = &res->data[0];
+  int num_entries = sdr_num_entries();
+  int free_space = sdr_free_space();
+  time_stamp_t ts_add, ts_erase;
+
+  sdr_ts_recent_add(&ts_add);
+  sdr_ts_recent_erase(&ts_erase);
+  res->cc = CC_SUCCESS;
+  *data++ = IPMI_SDR_VERSION;
+  *data++ = num_entries & 0xFF;
+  *data++ = (num_entries >> 8) & 0xFF;
+  *data++ = free_space & 0xFF;
+  *data++ = (free_space >> 8) & 0xFF;
+  memcpy(data, ts_add.ts, SIZE_TIME_STAMP);
+  data += SIZE_TIME_STAMP;
+  memcpy(data, ts_erase.ts, SIZE_TIME_STAMP);
+  data += SIZE_TIME_STAMP;
+  *data++ = 0x02;
+  *(unsigned short*)res_len = data - &res->data[0];
+}
+
+static void
+storage_rsv_sdr(unsigned char *request, unsigned char *response,
+                unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  int rsv_id = sdr_rsv_id(req->payload_id);
+
+  res->cc = CC_SUCCESS;
+  res->data[0] = rsv_id & 0xFF;
+  res->data[1] = (rsv_id >> 8) & 0xFF;
+  *(unsigned short*)res_len = 2;
+}
+
+static void
+storage_get_sdr(unsigned char *request, unsigned char *response,
+                unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  int rsv_id = (req->data[1] << 8) | req->data[0];
+  int read_rec_id = (req->data[3] << 8) | req->data[2];
+  int rec_offset = req->data[4], rec_bytes = req->data[5];
+  int next_rec_id;
+  sdr_rec_t entry;
+
+  if (sdr_get_entry(req->payload_id, rsv_id, read_rec_id, &entry, &next_rec_id)) {
+    res->cc = CC_UNSPECIFIED_ERROR;
+    return;
+  }
+  res->cc = CC_SUCCESS;
+  res->data[0] = next_rec_id & 0xFF;
+  res->data[1] = (next_rec_id >> 8) & 0xFF;
+  memcpy(&res->data[2], &entry.rec[rec_offset], rec_bytes);
+  *(unsigned short*)res_len = 2 + rec_bytes;
+}
+
+static void
+storage_get_fruid_info(unsigned char *response, unsigned char *res_len) {
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  struct stat st;
+  int size = stat(g_fru_path, &st) ? 0 : st.st_size;
+
+  res->cc = CC_SUCCESS;
+  res->data[0] = size & 0xFF;
+  res->data[1] = (size >> 8) & 0xFF;
+  res->data[2] = 0x00;
+  *(unsigned short*)res_len = 3;
+}
+
+static void
+storage_get_fruid_data(unsigned char *request, unsigned char *response,
+                       unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  int offset = req->data[1] + (req->data[2] << 8);
+  int count = req->data[3];
+  int fd = open(g_fru_path, O_RDONLY);
+
+  res->cc = CC_UNSPECIFIED_ERROR;
+  if (fd < 0)
+    return;
+  if (pread(fd, &res->data[1], count, offset) == count) {
+    res->cc = CC_SUCCESS;
+    res->data[0] = count;
+    *(unsigned short*)res_len = 1 + count;
+  }
+  close(fd);
+}
+
+static void
+storage_write_fruid_data(unsigned char *request, unsigned char req_len,
+                         unsigned char *response, unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  int offset = req->data[1] + (req->data[2] << 8);
+  int count = req_len - IPMI_MN_REQ_HDR_SIZE - 3;
+  int fd = open(g_fru_path, O_WRONLY);
+
+  res->cc = CC_UNSPECIFIED_ERROR;
+  if (fd < 0)
+    return;
+  if (pwrite(fd, &req->data[3], count, offset) == count) {
+    res->cc = CC_SUCCESS;
+    res->data[0] = count;
+    *(unsigned short*)res_len = 1;
+  }
+  close(fd);
+}
+
+static void
+sensor_get_reading(unsigned char *request, unsigned char *response,
+                   unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+
+  res->cc = CC_SUCCESS;
+  res->data[0] = 30 + req->data[0];
+  res->data[1] = 0xC0;
+  res->data[2] = 0x00;
+  *(unsigned short*)res_len = 3;
+}
+
+/* ipmi_handle(), less the netfns the captures do not use */
+static void
+handle(unsigned char *request, unsigned char req_len,
+       unsigned char *response, unsigned char *res_len) {
+  ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
+  ipmi_res_t *res = (ipmi_res_t *) response;
+  unsigned char netfn = req->netfn_lun >> 2;
+  ipmi_cache_ctx_t cache;
+
+  if (g_use_cache &&
+      ipmi_cache_lookup(request, req_len, response, res_len, &cache) == 0)
+    return;
+
+  res->cmd = req->cmd;
+  res->cc = 0xFF;
+  *(unsigned short*)res_len = 0;
+  res->netfn_lun = (netfn + 1) << 2;
+
+  switch (netfn) {
+    case NETFN_APP_REQ:
+      lock(&m_app);
+      if (req->cmd == CMD_APP_GET_DEVICE_ID)
+        app_get_device_id(response, res_len);
+      else if (req->cmd == CMD_APP_GET_SELFTEST_RESULTS)
+        app_get_selftest_results(response, res_len);
+      else
+        res->cc = CC_INVALID_CMD;
+      pthread_mutex_unlock(&m_app);
+      break;
+    case NETFN_STORAGE_REQ:
+      lock(&m_storage);
+      switch (req->cmd) {
+        case CMD_STORAGE_GET_FRUID_INFO:
+          storage_get_fruid_info(response, res_len);
+          break;
+        case CMD_STORAGE_READ_FRUID_DATA:
+          storage_get_fruid_data(request, response, res_len);
+          break;
+        case CMD_STORAGE_WRITE_FRUID_DATA:
+          storage_write_fruid_data(request, req_len, response, res_len);
+          break;
+        case CMD_STORAGE_GET_SDR_INFO:
+          storage_get_sdr_info(response, res_len);
+          break;
+        case CMD_STORAGE_RSV_SDR:
+          storage_rsv_sdr(request, response, res_len);
+          break;
+        case CMD_STORAGE_GET_SDR:
+          storage_get_sdr(request, response, res_len);
+          break;
+        default:
+          res->cc = CC_INVALID_CMD;
+          break;
+      }
+      pthread_mutex_unlock(&m_storage);
+      break;
+    case NETFN_SENSOR_REQ:
+      lock(&m_sensor);
+      sensor_get_reading(request, response, res_len);
+      pthread_mutex_unlock(&m_sensor);
+      break;
+  }
+
+  *(unsigned short*)res_len += IPMI_RESP_HDR_SIZE;
+
+  if (g_use_cache)
+    ipmi_cache_update(request, req_len, response, res_len, &cache);
+}
+
+/* One request per line, in hex; '#' starts a comment */
+static void
+load_capture(const char *path) {
+  char line[1024], *tok, *save;
+  FILE *fp = fopen(path, "r");
+
+  if (!fp) {
+    printf("FAIL: cannot open %s\n", path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), fp) && g_num_reqs < MAX_REQS) {
+    capture_t *c = &g_reqs[g_num_reqs];
+
+    if ((tok = strchr(line, '#')) != NULL)
+      *tok = '\0';
+    c->req_len = 0;
+    for (tok = strtok_r(line, " \t\n", &save); tok && c->req_len < 255;
+         tok = strtok_r(NULL, " \t\n", &save))
+      c->req[c->req_len++] = strtoul(tok, NULL, 16);
+    if (c->req_len >= IPMI_MN_REQ_HDR_SIZE)
+      g_num_reqs++;
+  }
+  fclose(fp);
+}
+
+static void
+write_file(const char *path, const unsigned char *buf, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  assert(fd >= 0);
+  assert(write(fd, buf, len) == len);
+  close(fd);
+}
+
+static void
+reset_fru(unsigned char fill) {
+  unsigned char fru[FRU_SIZE];
+  int i;
+
+  for (i = 0; i < FRU_SIZE; i++)
+    fru[i] = fill + i;
+  write_file(g_fru_path, fru, FRU_SIZE);
+}
+
+/* BMC state as ipmid starts: SDR built, reservations at 1, FRU unwritten */
+static void
+reset_state(void) {
+  sdr_init();
+  reset_fru(0);
+  ipmi_cache_invalidate(IPMI_CACHE_EV_FRU, 1);
+}
+
+static double
+now(void) {
+  struct timespec ts;
+
+  __real_clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Replay the capture; returns the time per request in usec */
+static double
+replay(int check) {
+  unsigned char res[MAX_IPMI_MSG_SIZE];
+  unsigned short res_len;
+  double t;
+  int i;
+
+  reset_state();
+  t = now();
+  for (i = 0; i < g_num_reqs; i++) {
+    unsigned char *ref = &g_ref[i * (MAX_IPMI_MSG_SIZE + 2)];
+
+    handle(g_reqs[i].req, g_reqs[i].req_len, res, (unsigned char*)&res_len);
+    if (!check) {
+      memcpy(ref, &res_len, 2);
+      memcpy(ref + 2, res, res_len);
+    } else if (memcmp(ref, &res_len, 2) || memcmp(ref + 2, res, res_len)) {
+      printf("FAIL: request %d (netfn 0x%02X cmd 0x%02X): response differs\n",
+             i, g_reqs[i].req[1] >> 2, g_reqs[i].req[2]);
+      exit(1);
+    }
+  }
+  return (now() - t) * 1e6 / g_num_reqs;
+}
+
+static unsigned char
+cc_of(unsigned char *req, unsigned char req_len) {
+  unsigned char res[MAX_IPMI_MSG_SIZE];
+  unsigned short res_len;
+
+  handle(req, req_len, res, (unsigned char*)&res_len);
+  return ((ipmi_res_t *) res)->cc;
+}
+
+static void
+test_semantics(void) {
+  unsigned char rsv[] = {1, NETFN_STORAGE_REQ << 2, CMD_STORAGE_RSV_SDR};
+  unsigned char get_sdr[] = {1, NETFN_STORAGE_REQ << 2, CMD_STORAGE_GET_SDR,
+                             0, 0, 3, 0, 0, 16};
+  unsigned char read_fru[] = {1, NETFN_STORAGE_REQ << 2,
+                              CMD_STORAGE_READ_FRUID_DATA, 0, 0x10, 0, 16};
+  unsigned char res[MAX_IPMI_MSG_SIZE];
+  unsigned short res_len;
+  ipmi_cache_stats_t st;
+  int id;
+
+  g_use_cache = 1;
+  g_clock_skew = 0;
+  reset_state();
+
+  /* A hit shares no reservation it should not */
+  handle(rsv, sizeof(rsv), res, (unsigned char*)&res_len);
+  id = res[3] | (res[4] << 8);
+  get_sdr[3] = id & 0xFF;
+  get_sdr[4] = id >> 8;
+  assert(cc_of(get_sdr, sizeof(get_sdr)) == CC_SUCCESS);
+  handle(rsv, sizeof(rsv), res, (unsigned char*)&res_len);
+  assert(cc_of(get_sdr, sizeof(get_sdr)) == CC_UNSPECIFIED_ERROR);
+  get_sdr[3] = res[3];
+  get_sdr[4] = res[4];
+  ipmi_cache_get_stats(&st);
+  assert(cc_of(get_sdr, sizeof(get_sdr)) == CC_SUCCESS);
+  ipmi_cache_stats_t st2;
+  ipmi_cache_get_stats(&st2);
+  assert(st2.hits == st.hits + 1);
+
+  /* Hits do not take the netfn lock */
+  lock(&m_storage);
+  assert(cc_of(get_sdr, sizeof(get_sdr)) == CC_SUCCESS);
+  pthread_mutex_unlock(&m_storage);
+
+  /* An SDR add drops what was cached of the repository */
+  sdr_init();
+  ipmi_cache_get_stats(&st);
+  handle(rsv, sizeof(rsv), res, (unsigned char*)&res_len);
+  get_sdr[3] = res[3];
+  get_sdr[4] = res[4];
+  assert(cc_of(get_sdr, sizeof(get_sdr)) == CC_SUCCESS);
+  ipmi_cache_get_stats(&st2);
+  assert(st2.hits == st.hits);
+
+  /* A FRU rewritten behind ipmid shows once the TTL runs out */
+  handle(read_fru, sizeof(read_fru), res, (unsigned char*)&res_len);
+  assert(res[4] == 0x10);
+  reset_fru(0x80);
+  handle(read_fru, sizeof(read_fru), res, (unsigned char*)&res_len);
+  assert(res[4] == 0x10);
+  g_clock_skew = IPMI_CACHE_FRU_TTL + 1000;
+  handle(read_fru, sizeof(read_fru), res, (unsigned char*)&res_len);
+  assert(res[4] == 0x90);
+  g_clock_skew = 0;
+}
+
+int
+main(int argc, char **argv) {
+  pthread_mutexattr_t attr;
+  ipmi_cache_stats_t st;
+  double t_ref, t_cache;
+  char tmpl[] = "/tmp/ipmi-cache-testXXXXXX";
+  int i;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+  pthread_mutex_init(&m_app, &attr);
+  pthread_mutex_init(&m_storage, &attr);
+  pthread_mutex_init(&m_sensor, &attr);
+
+  for (i = 0; i < NUM_THRESH; i++) {
+    g_thresh[i].sensor_num = i + 1;
+    g_thresh[i].sensor_type = 0x01;
+    g_thresh[i].uc_thresh = 90 + i;
+    g_thresh[i].str_type_len = 0xC0 + 8;
+    snprintf(g_thresh[i].str, SENSOR_STR_SIZE, "TEMP_%02d", i);
+  }
+  for (i = 0; i < NUM_DISC; i++) {
+    g_disc[i].sensor_num = 0x80 + i;
+    g_disc[i].sensor_type = 0x07;
+    g_disc[i].str_type_len = 0xC0 + 8;
+    snprintf(g_disc[i].str, SENSOR_STR_SIZE, "DISC_%02d", i);
+  }
+
+  assert(mkdtemp(tmpl));
+  snprintf(g_fru_path, sizeof(g_fru_path), "%s/fru.bin", tmpl);
+  snprintf(g_issue_path, sizeof(g_issue_path), "%s/issue", tmpl);
+  write_file(g_issue_path, (unsigned char*)"OpenBMC Release fbtp-v12.3\n", 27);
+
+  if (argc > 1) {
+    for (i = 1; i < argc; i++)
+      load_capture(argv[i]);
+  } else {
+    load_capture(DEFAULT_CAPTURE);
+  }
+  g_ref = malloc(g_num_reqs * (MAX_IPMI_MSG_SIZE + 2));
+  assert(g_ref);
+
+  /* Reference responses, then the same with the cache */
+  g_use_cache = 0;
+  replay(0);
+  t_ref = 0;
+  for (i = 0; i < ROUNDS; i++)
+    t_ref += replay(1);
+  t_ref /= ROUNDS;
+
+  g_use_cache = 1;
+  t_cache = replay(1);
+  ipmi_cache_get_stats(&st);
+  printf("replayed %d requests: %u hits, %u misses, hit rate %.1f%%\n",
+         g_num_reqs, st.hits, st.misses,
+         100.0 * st.hits / g_num_reqs);
+  for (i = 0; i < ROUNDS; i++)
+    t_cache += replay(1);
+  t_cache /= ROUNDS + 1;
+  printf("per request: %.2f us without the cache, %.2f us with it\n",
+         t_ref, t_cache);
+
+  test_semantics();
+
+  unlink(g_fru_path);
+  unlink(g_issue_path);
+  rmdir(tmpl);
+  free(g_ref);
+  printf("All tests passed\n");
+  return 0;
+}
@@ -730,7 +730,7 @@ udbg_get_info_page (uint8_t frame, uint8_t page, uint8_t *next, uint8_t *count,
   int ret;
   char line_buff[1000], *pres_dev = line_buff, *delim = "\n";
   FILE *fp;
-  fruid_info_t fruid;
+  const fruid_info_t *fruid;
   lan_config_t lan_config = { 0 };
   unsigned char zero_ip_addr[SIZE_IP_ADDR] = { 0 };
   unsigned char zero_ip6_addr[SIZE_IP6_ADDR] = { 0 };
@@ -750,12 +750,12 @@ udbg_get_info_page (uint8_t frame, uint8_t page, uint8_t *next, uint8_t *count,
 
     // FRU
     if (pos != FRU_ALL && pal_get_fruid_path(pos, fruid_path) == 0 &&
-      fruid_parse(fruid_path, &fruid) == 0) {
+      (fruid = fruid_cache_get(fruid_path)) != NULL) {
       frame_info.append(&frame_info, "SN:", 0);
-      frame_info.append(&frame_info, fruid.board.serial, 1);
+      frame_info.append(&frame_info, fruid->board.serial, 1);
       frame_info.append(&frame_info, "PN:", 0);
-      frame_info.append(&frame_info, fruid.board.part, 1);
-      free_fruid_info(&fruid);
+      frame_info.append(&frame_info, fruid->board.part, 1);
+      fruid_cache_put(fruid);
     }
 
     // LAN
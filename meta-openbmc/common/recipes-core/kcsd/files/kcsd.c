@@ -59,19 +59,53 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
 #include <openbmc/gpio.h>
 #include "openbmc/ipmi.h"
 
-unsigned char req_buf[256];
+// Polling period when the KCS driver gives no usable poll() wakeup
+#define KCS_IDLE_POLL_MS   10
+// Shorter period used for a while after a request, as requests come in bursts
+#define KCS_BURST_POLL_MS  1
+#define KCS_BURST_WINDOW_MS 200
+
+#define KCS_TOUCH_FILE "/tmp/kcs_touch"
+
+// One byte of headroom so the payload ID is prepended without a copy
+unsigned char req_buf[1 + 256];
 unsigned char res_buf[300];
 uint8_t debug = 0;
 uint8_t fm_bmc_ready_n = 145;
 int kcs_fd;
 
-#define TOUCH(path) \
-{\
-  int fd = creat(path, 0644);\
-  if (fd) close(fd);\
+static long
+now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Readers of KCS_TOUCH_FILE compare its mtime in seconds, so refreshing
+ * it once per second is enough
+ */
+static void
+kcs_touch(void) {
+  static time_t last;
+  time_t now = time(NULL);
+  int fd;
+
+  if (now == last)
+    return;
+  last = now;
+
+  if (utimensat(AT_FDCWD, KCS_TOUCH_FILE, NULL, 0) < 0 && errno == ENOENT) {
+    fd = creat(KCS_TOUCH_FILE, 0644);
+    if (fd >= 0)
+      close(fd);
+  }
 }
 
 void set_bmc_ready(bool ready)
@@ -87,50 +121,71 @@ void set_bmc_ready(bool ready)
 }
 
 void *kcs_thread(void *unused) {
-  struct timespec req;
-  struct timespec rem;
-
-  unsigned char req_len;
+  struct pollfd pfd;
+  unsigned char *req = &req_buf[1];
+  ssize_t req_len;
   unsigned short res_len;
-  int i = 0;
+  long last_req = 0;
+  int ipmi_sock = -1;
+  bool poll_ok = false;
+  int i = 0, ret, timeout;
 
   set_bmc_ready(true);
 
-  // Setup wait time
-  req.tv_sec = 0;
-  req.tv_nsec = 10000000;//10mSec
+  pfd.fd = kcs_fd;
+  pfd.events = POLLIN;
+
   while(1) {
-    req_len = read(kcs_fd, req_buf, sizeof(req_buf));
-    if (req_len > 0) {
-      //dump read data
-      if(debug) {
-        syslog(LOG_WARNING, "Req [%d] : ", req_len);
-        for(i=0;i<req_len;i++) {
-          syslog(LOG_WARNING, "%x ", req_buf[i]);
-        }
-        syslog(LOG_WARNING, "\n");
+    // Block until the driver reports a request. A driver without poll
+    // support reports the device as always readable and never lets poll()
+    // time out; in that case an empty read backs off for a polling period
+    // instead of spinning.
+    timeout = (now_ms() - last_req < KCS_BURST_WINDOW_MS) ?
+              KCS_BURST_POLL_MS : KCS_IDLE_POLL_MS;
+
+    req_len = read(kcs_fd, req, sizeof(req_buf) - 1);
+    if (req_len <= 0) {
+      ret = poll(&pfd, 1, poll_ok ? -1 : timeout);
+      if (ret == 0) {
+        poll_ok = true;
+        continue;
       }
+      if (ret < 0 || !(pfd.revents & POLLIN))
+        continue;
+      req_len = read(kcs_fd, req, sizeof(req_buf) - 1);
+      if (req_len <= 0) {
+        poll_ok = false;
+        poll(NULL, 0, timeout);
+        continue;
+      }
+    }
 
-      // Add payload_id as 1 to  pass to ipmid
-      for (i = req_len; i >=0; i--) {
-        req_buf[i+1] = req_buf[i];
+    //dump read data
+    if(debug) {
+      syslog(LOG_WARNING, "Req [%d] : ", (int)req_len);
+      for(i=0;i<req_len;i++) {
+        syslog(LOG_WARNING, "%x ", req[i]);
       }
+      syslog(LOG_WARNING, "\n");
+    }
 
-      req_buf[0] = 0x01;
+    // Add payload_id as 1 to  pass to ipmid
+    req_buf[0] = 0x01;
 
-      TOUCH("/tmp/kcs_touch");
+    kcs_touch();
 
     // Send to IPMI stack and get response
     // Additional byte as we are adding and passing payload ID for MN support
-    lib_ipmi_handle(req_buf, req_len + 1, res_buf, &res_len);
-
-    } else {
-      //sleep(0);
-      nanosleep(&req, &rem);
-      continue;
+    res_len = 0;
+    if (lib_ipmi_handle_persistent(&ipmi_sock, req_buf, req_len + 1,
+                                   res_buf, &res_len) < 0) {
+      syslog(LOG_WARNING, "kcsd: failed to get response from ipmid\n");
     }
 
-    res_len = write(kcs_fd, res_buf, res_len);
+    if (res_len > 0)
+      write(kcs_fd, res_buf, res_len);
+
+    last_req = now_ms();
   }
 
 }
@@ -0,0 +1,341 @@
+/*
+ * log-index
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "log-index.h"
+
+/*
+ * The logfile a new store was built from. rsyslog hands the daemon the
+ * lines it writes to the logfile as well, so the first ones read may be
+ * there already.
+ */
+static char *backfilled;
+static size_t backfilled_len;
+static const char *backfilled_next;
+
+static void
+print_usage_help(void) {
+  printf("Usage: log-index [--dir <dir>] [--logfile <file>] --daemon\n");
+  printf("       log-index [--dir <dir>] --print <fru#|all>\n");
+  printf("       log-index [--dir <dir>] --clear <fru#|all>\n");
+  printf("  --daemon   index the lines read from stdin (rsyslog omprog)\n");
+  printf("  --print    print the lines of a FRU, or of all\n");
+  printf("  --clear    clear the lines of a FRU, or of all\n");
+  printf("  --logfile  where rsyslog keeps the lines too, a new store is\n");
+  printf("             built from it and its .0 (default %s)\n", LOG_INDEX_LOGFILE);
+}
+
+static int
+parse_fru(const char *str) {
+  char *end;
+  long fru;
+
+  if (!strcmp(str, "all"))
+    return LOG_INDEX_ALL;
+  fru = strtol(str, &end, 0);
+  if (*end || fru < 0 || fru > LOG_INDEX_MAX_FRU)
+    return -1;
+  return fru;
+}
+
+// The lines of path, with room for a missing newline at the end
+static char *
+read_file(const char *path, size_t *len) {
+  struct stat st;
+  char *buf = NULL;
+  ssize_t n;
+  int fd;
+
+  *len = 0;
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 && (buf = malloc(st.st_size + 1)) != NULL) {
+    while (*len < st.st_size && (n = read(fd, buf + *len, st.st_size - *len)) > 0)
+      *len += n;
+    if (*len > 0 && buf[*len - 1] != '\n')
+      buf[(*len)++] = '\n';
+  }
+  close(fd);
+  return buf;
+}
+
+/*
+ * What a "log-util: User cleared <all|sys|FRU: n> logs" note clears: a
+ * FRU, LOG_INDEX_ALL, or -1 if the line is no such note
+ */
+static int
+note_cleared(const char *line, size_t len) {
+  static const char note[] = "log-util: User cleared ";
+  const char *p = memmem(line, len, note, sizeof(note) - 1);
+  size_t rest;
+
+  if (p == NULL)
+    return -1;
+  p += sizeof(note) - 1;
+  rest = line + len - p;
+  if (rest >= 8 && !memcmp(p, "all logs", 8))
+    return LOG_INDEX_ALL;
+  if (rest >= 8 && !memcmp(p, "sys logs", 8))
+    return 0;
+  if (rest >= 6 && !memcmp(p, "FRU: ", 5) && p[5] >= '0' && p[5] <= '9')
+    return log_index_line_fru(p, rest);
+  return -1;
+}
+
+/*
+ * A clear through log-index leaves the logfile as it is, with only its
+ * note in it. Drop the lines of a FRU before the last note clearing it,
+ * as the index did, and return what is left of buf.
+ */
+static size_t
+drop_cleared(char *buf, size_t len) {
+  const char *line, *nl, *end = buf + len;
+  size_t cut[LOG_INDEX_MAX_FRU + 1] = {0}, cut_all = 0, kept = 0, l, off;
+  int fru;
+
+  for (line = buf; line < end && (nl = memchr(line, '\n', end - line)); line = nl + 1) {
+    fru = note_cleared(line, nl + 1 - line);
+    if (fru == LOG_INDEX_ALL)
+      cut_all = line - buf;
+    else if (fru >= 0 && fru <= LOG_INDEX_MAX_FRU)
+      cut[fru] = line - buf;
+  }
+  for (line = buf; line < end && (nl = memchr(line, '\n', end - line)); line = nl + 1) {
+    l = nl + 1 - line;
+    off = line - buf;
+    // "log-util: ... all logs" notes go for any FRU, only a clear of all drops them
+    if (memmem(line, l, "log-util:", 9) && memmem(line, l, "all logs", 8))
+      fru = LOG_INDEX_ALL;
+    else if ((fru = log_index_line_fru(line, l)) > LOG_INDEX_MAX_FRU)
+      fru = 0;
+    if (off >= cut_all && (fru == LOG_INDEX_ALL || off >= cut[fru])) {
+      memmove(buf + kept, line, l);
+      kept += l;
+    }
+  }
+  return kept;
+}
+
+static void
+remove_dir(const char *dir) {
+  char path[PATH_MAX];
+  struct dirent *de;
+  DIR *d;
+
+  if ((d = opendir(dir)) == NULL)
+    return;
+  while ((de = readdir(d)) != NULL) {
+    if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")) {
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      unlink(path);
+    }
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+/*
+ * A new store starts with the lines already in the logfile and not
+ * cleared, or log-util would lose them when it moves over to the index. It is built aside
+ * and renamed in place, as log-util prints from it once it exists.
+ */
+static int
+create_store(const char *dir, const char *logfile) {
+  char tmp[PATH_MAX], rotated[PATH_MAX], *old, *lines;
+  log_index_t *idx;
+  size_t old_len, len;
+
+  snprintf(tmp, sizeof(tmp), "%s.new", dir);
+  snprintf(rotated, sizeof(rotated), "%s.0", logfile);
+  remove_dir(tmp);
+  if ((idx = log_index_open(tmp, LOG_INDEX_SEG_SIZE, LOG_INDEX_SEGS)) == NULL)
+    return -1;
+  old = read_file(rotated, &old_len);
+  backfilled = read_file(logfile, &backfilled_len);
+  if ((lines = malloc(old_len + backfilled_len + 1)) != NULL) {
+    if (old_len)
+      memcpy(lines, old, old_len);
+    if (backfilled_len)
+      memcpy(lines + old_len, backfilled, backfilled_len);
+    len = drop_cleared(lines, old_len + backfilled_len);
+    if (len > 0 && log_index_append(idx, lines, len) < 0)
+      syslog(LOG_WARNING, "log-index: cannot import %s to %s", logfile, tmp);
+  }
+  free(lines);
+  free(old);
+  log_index_close(idx);
+  if (rename(tmp, dir) < 0) {
+    syslog(LOG_WARNING, "log-index: cannot rename %s to %s", tmp, dir);
+    remove_dir(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+// Is line the one at the start of a line in the backfilled logfile?
+static const char *
+find_backfilled(const char *line, size_t len) {
+  const char *p = backfilled, *end = backfilled + backfilled_len;
+
+  while ((p = memmem(p, end - p, line, len)) != NULL) {
+    if (p == backfilled || p[-1] == '\n')
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+/*
+ * How much of buf, from its start, is lines of the backfilled logfile
+ * which came after the store was built from it: the ones up to its end,
+ * in order. Past the first line which is not, nothing is skipped.
+ */
+static size_t
+skip_backfilled(const char *buf, size_t len) {
+  const char *line = buf, *nl, *end = buf + len, *found;
+  size_t l;
+
+  while (backfilled && line < end && (nl = memchr(line, '\n', end - line))) {
+    l = nl + 1 - line;
+    if (backfilled_next == NULL)
+      found = find_backfilled(line, l);
+    else if (backfilled + backfilled_len - backfilled_next >= l &&
+             !memcmp(backfilled_next, line, l))
+      found = backfilled_next;
+    else
+      found = NULL;
+    if (found) {
+      backfilled_next = found + l;
+      line = nl + 1;
+    }
+    if (!found || backfilled_next == backfilled + backfilled_len) {
+      free(backfilled);
+      backfilled = NULL;
+    }
+  }
+  return line - buf;
+}
+
+/*
+ * rsyslog hands over one line at a time, as they come; whatever is read
+ * at once goes to the index in one go.
+ */
+static int
+run_daemon(const char *dir, const char *logfile) {
+  log_index_t *idx;
+  char buf[8192];
+  size_t have = 0, skip;
+  ssize_t n;
+  int taken;
+
+  if (access(dir, F_OK) < 0 && errno == ENOENT && create_store(dir, logfile) < 0)
+    syslog(LOG_WARNING, "log-index: cannot build %s from %s", dir, logfile);
+  if ((idx = log_index_open(dir, LOG_INDEX_SEG_SIZE, LOG_INDEX_SEGS)) == NULL)
+    return -1;
+
+  while ((n = read(STDIN_FILENO, buf + have, sizeof(buf) - have)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    have += n;
+    // A line longer than the buffer is cut
+    if (have == sizeof(buf) && !memchr(buf, '\n', have))
+      buf[have - 1] = '\n';
+    if ((skip = skip_backfilled(buf, have)) > 0) {
+      have -= skip;
+      memmove(buf, buf + skip, have);
+    }
+    if ((taken = log_index_append(idx, buf, have)) < 0) {
+      syslog(LOG_WARNING, "log-index: cannot append to %s", dir);
+      taken = have;
+    }
+    have -= taken;
+    memmove(buf, buf + taken, have);
+  }
+
+  log_index_close(idx);
+  free(backfilled);
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  const char *dir = LOG_INDEX_DIR, *logfile = LOG_INDEX_LOGFILE;
+  int opt, fru = -1, cmd = 0;
+
+  static const struct option long_options[] = {
+    {"dir", required_argument, 0, 'd'},
+    {"logfile", required_argument, 0, 'l'},
+    {"daemon", no_argument, 0, 'D'},
+    {"print", required_argument, 0, 'p'},
+    {"clear", required_argument, 0, 'c'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'd':
+      dir = optarg;
+      break;
+    case 'l':
+      logfile = optarg;
+      break;
+    case 'p':
+    case 'c':
+      if ((fru = parse_fru(optarg)) < 0) {
+        print_usage_help();
+        return -1;
+      }
+      /* fall through */
+    case 'D':
+      cmd = opt;
+      break;
+    default:
+      print_usage_help();
+      return (opt == 'h') ? 0 : -1;
+    }
+  }
+
+  openlog("log-index", LOG_CONS, LOG_DAEMON);
+  switch (cmd) {
+  case 'D':
+    return run_daemon(dir, logfile);
+  case 'p':
+    return (log_index_dump(dir, fru, STDOUT_FILENO) < 0) ? -1 : 0;
+  case 'c':
+    return log_index_clear(dir, fru);
+  }
+  print_usage_help();
+  return -1;
+}
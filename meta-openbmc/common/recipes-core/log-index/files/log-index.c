@@ -0,0 +1,661 @@
+/*
+ * log-index
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "log-index.h"
+
+#define GLOBAL_NAME "fru.global"
+#define CLEAR_NAME  "clear"
+#define LOCK_NAME   "lock"
+#define REC_SIZE    sizeof(log_index_rec_t)
+
+struct log_index {
+  char dir[PATH_MAX];
+  int lock_fd;
+  int seg_fd;
+  uint32_t first_seg;
+  uint32_t cur_seg;
+  uint32_t offset;
+  uint32_t next_seq;
+  size_t seg_size;
+  int max_segs;
+  bool dirty;       // entries of removed segments left in the index
+};
+
+// Lines before cut[fru] are cleared, before cut_all for any FRU
+typedef struct {
+  uint32_t cut[256];
+  uint32_t cut_all;
+} cutoff_t;
+
+static void
+make_path(char *path, const char *dir, const char *name) {
+  snprintf(path, PATH_MAX, "%s/%s", dir, name);
+}
+
+static void
+index_name(char *name, int fru) {
+  if (fru == LOG_INDEX_ALL)
+    strcpy(name, GLOBAL_NAME);
+  else
+    sprintf(name, "fru.%d", fru);
+}
+
+static int
+lock_dir(const char *dir, int op) {
+  char path[PATH_MAX];
+  int fd;
+
+  make_path(path, dir, LOCK_NAME);
+  fd = open(path, (op == LOCK_EX) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+  if (fd < 0)
+    return -1;
+  if (flock(fd, op) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void
+unlock_dir(int fd) {
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+// First and last segment in dir, returns how many there are
+static int
+scan_segs(const char *dir, uint32_t *first, uint32_t *last) {
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  unsigned int n;
+  int count = 0;
+  char c;
+
+  *first = UINT32_MAX;
+  *last = 0;
+  if (d == NULL)
+    return -1;
+  while ((de = readdir(d)) != NULL) {
+    if (sscanf(de->d_name, "seg.%u%c", &n, &c) != 1)
+      continue;
+    if (n < *first)
+      *first = n;
+    if (n > *last)
+      *last = n;
+    count++;
+  }
+  closedir(d);
+  return count;
+}
+
+/*
+ * Call fn for every index file in dir. fru is LOG_INDEX_ALL for the
+ * global one.
+ */
+static int
+for_each_index(const char *dir, int (*fn)(const char *dir, int fru, void *arg),
+               void *arg) {
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  int fru, ret = 0;
+  char c;
+
+  if (d == NULL)
+    return -1;
+  while ((de = readdir(d)) != NULL) {
+    // Not the fru.<n>.new of a compaction
+    if (!strcmp(de->d_name, GLOBAL_NAME))
+      fru = LOG_INDEX_ALL;
+    else if (sscanf(de->d_name, "fru.%d%c", &fru, &c) != 1 ||
+             fru < 0 || fru > LOG_INDEX_MAX_FRU)
+      continue;
+    if ((ret = fn(dir, fru, arg)) < 0)
+      break;
+  }
+  closedir(d);
+  return ret;
+}
+
+/*
+ * Read the records of an index file from the first one at or past seq
+ * and seg, both of which only grow along the file. Returns the number
+ * of records stored in *recs (malloc'ed), or -1.
+ */
+static int
+read_index(const char *dir, int fru, uint32_t seq, uint32_t seg,
+           log_index_rec_t **recs) {
+  char path[PATH_MAX], name[16];
+  log_index_rec_t rec;
+  struct stat st;
+  int fd, lo, hi, mid, n;
+
+  *recs = NULL;
+  index_name(name, fru);
+  make_path(path, dir, name);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return (errno == ENOENT) ? 0 : -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // A record torn by a crash at the end is not there
+  n = st.st_size / REC_SIZE;
+  lo = 0;
+  hi = n;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (pread(fd, &rec, REC_SIZE, (off_t)mid * REC_SIZE) != REC_SIZE)
+      break;
+    if (rec.seq >= seq && rec.seg >= seg)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  n -= lo;
+  if (n > 0) {
+    if ((*recs = malloc(n * REC_SIZE)) == NULL ||
+        pread(fd, *recs, n * REC_SIZE, (off_t)lo * REC_SIZE) != n * REC_SIZE) {
+      free(*recs);
+      *recs = NULL;
+      n = -1;
+    }
+  }
+  close(fd);
+  return n;
+}
+
+static int
+load_cutoff(const char *dir, cutoff_t *cut) {
+  char path[PATH_MAX];
+  log_index_clear_t tomb;
+  int fd;
+
+  memset(cut, 0, sizeof(*cut));
+  make_path(path, dir, CLEAR_NAME);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return (errno == ENOENT) ? 0 : -1;
+  while (read(fd, &tomb, sizeof(tomb)) == sizeof(tomb)) {
+    if (tomb.fru == LOG_INDEX_ALL) {
+      if (tomb.seq > cut->cut_all)
+        cut->cut_all = tomb.seq;
+    } else if (tomb.seq > cut->cut[tomb.fru]) {
+      cut->cut[tomb.fru] = tomb.seq;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+static uint32_t
+index_cutoff(const cutoff_t *cut, int fru) {
+  if (fru == LOG_INDEX_ALL || cut->cut[fru] < cut->cut_all)
+    return cut->cut_all;
+  return cut->cut[fru];
+}
+
+/*
+ * The sequence number of the last line in an index file. With trim, a
+ * record torn at the end is cut off.
+ */
+typedef struct {
+  uint32_t seq;
+  bool trim;
+} last_seq_t;
+
+static int
+index_last_seq(const char *dir, int fru, void *arg) {
+  last_seq_t *last = arg;
+  char path[PATH_MAX], name[16];
+  log_index_rec_t rec;
+  struct stat st;
+  int fd;
+
+  index_name(name, fru);
+  make_path(path, dir, name);
+  if ((fd = open(path, last->trim ? O_RDWR : O_RDONLY)) < 0)
+    return 0;
+  if (fstat(fd, &st) == 0) {
+    if (last->trim && st.st_size % REC_SIZE &&
+        ftruncate(fd, st.st_size - st.st_size % REC_SIZE) < 0)
+      syslog(LOG_WARNING, "%s: cannot trim %s", __func__, path);
+    if (st.st_size >= REC_SIZE &&
+        pread(fd, &rec, REC_SIZE, (st.st_size / REC_SIZE - 1) * REC_SIZE) ==
+        REC_SIZE && rec.seq > last->seq)
+      last->seq = rec.seq;
+  }
+  close(fd);
+  return 0;
+}
+
+static uint32_t
+last_seq(const char *dir, bool trim) {
+  last_seq_t last = {0, trim};
+
+  for_each_index(dir, index_last_seq, &last);
+  return last.seq;
+}
+
+static int
+open_seg(log_index_t *idx, bool create) {
+  char path[PATH_MAX], name[32];
+  struct stat st;
+
+  sprintf(name, "seg.%u", idx->cur_seg);
+  make_path(path, idx->dir, name);
+  idx->seg_fd = open(path, O_WRONLY | O_CREAT | (create ? O_TRUNC : 0), 0644);
+  if (idx->seg_fd < 0 || fstat(idx->seg_fd, &st) < 0) {
+    syslog(LOG_WARNING, "%s: cannot open %s", __func__, path);
+    return -1;
+  }
+  idx->offset = st.st_size;
+  return 0;
+}
+
+/*
+ * Drop the cleared entries, and those of removed segments, from an
+ * index file. The tombstones are truncated by the caller afterwards,
+ * unless an index could not be rewritten and still needs them.
+ */
+typedef struct {
+  cutoff_t cut;
+  uint32_t first_seg;
+  bool failed;
+} compact_t;
+
+static int
+compact_index(const char *dir, int fru, void *arg) {
+  compact_t *c = arg;
+  char path[PATH_MAX], tmp[PATH_MAX], name[16], tmp_name[24];
+  log_index_rec_t *recs;
+  int n, fd;
+  bool done = false;
+
+  n = read_index(dir, fru, index_cutoff(&c->cut, fru), c->first_seg, &recs);
+  if (n < 0) {
+    c->failed = true;
+    return 0;
+  }
+  index_name(name, fru);
+  make_path(path, dir, name);
+  if (n == 0) {
+    if (unlink(path) < 0 && errno != ENOENT)
+      c->failed = true;
+    return 0;
+  }
+  snprintf(tmp_name, sizeof(tmp_name), "%s.new", name);
+  make_path(tmp, dir, tmp_name);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+    if (write(fd, recs, n * REC_SIZE) == n * REC_SIZE && rename(tmp, path) == 0)
+      done = true;
+    else
+      unlink(tmp);
+    close(fd);
+  }
+  if (!done) {
+    syslog(LOG_WARNING, "%s: cannot rewrite %s", __func__, path);
+    c->failed = true;
+  }
+  free(recs);
+  return 0;
+}
+
+static void
+compact(log_index_t *idx) {
+  char path[PATH_MAX];
+  struct stat st;
+  compact_t c;
+
+  make_path(path, idx->dir, CLEAR_NAME);
+  if (!idx->dirty && (stat(path, &st) < 0 || st.st_size == 0))
+    return;
+  if (load_cutoff(idx->dir, &c.cut) < 0)
+    return;
+  c.first_seg = idx->first_seg;
+  c.failed = false;
+  // An index left as it was keeps its cleared entries, so the tombstones stay
+  if (for_each_index(idx->dir, compact_index, &c) < 0 || c.failed)
+    return;
+  if (truncate(path, 0) && errno != ENOENT)
+    syslog(LOG_WARNING, "%s: cannot truncate %s", __func__, path);
+  idx->dirty = false;
+}
+
+// Start the next segment, and tidy the index while at it
+static int
+next_seg(log_index_t *idx) {
+  char path[PATH_MAX], name[32];
+
+  close(idx->seg_fd);
+  idx->cur_seg++;
+  while (idx->cur_seg - idx->first_seg + 1 > idx->max_segs) {
+    sprintf(name, "seg.%u", idx->first_seg++);
+    make_path(path, idx->dir, name);
+    unlink(path);
+    idx->dirty = true;
+  }
+  if (open_seg(idx, true) < 0)
+    return -1;
+  compact(idx);
+  return 0;
+}
+
+log_index_t *
+log_index_open(const char *dir, size_t seg_size, int max_segs) {
+  log_index_t *idx;
+  uint32_t first, last;
+
+  if ((idx = calloc(1, sizeof(*idx))) == NULL)
+    return NULL;
+  strncpy(idx->dir, dir, sizeof(idx->dir) - 1);
+  idx->seg_size = seg_size;
+  idx->max_segs = max_segs > 1 ? max_segs : 2;
+  idx->seg_fd = -1;
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    goto err;
+  if ((idx->lock_fd = lock_dir(dir, LOCK_EX)) < 0)
+    goto err;
+  if (scan_segs(dir, &first, &last) > 0) {
+    idx->first_seg = first;
+    idx->cur_seg = last;
+  } else {
+    idx->first_seg = idx->cur_seg = 1;
+  }
+  idx->next_seq = last_seq(dir, true) + 1;
+  if (open_seg(idx, false) < 0) {
+    unlock_dir(idx->lock_fd);
+    goto err;
+  }
+  flock(idx->lock_fd, LOCK_UN);
+  return idx;
+
+err:
+  syslog(LOG_WARNING, "%s: cannot open %s", __func__, dir);
+  free(idx);
+  return NULL;
+}
+
+void
+log_index_close(log_index_t *idx) {
+  if (idx == NULL)
+    return;
+  if (idx->seg_fd >= 0)
+    close(idx->seg_fd);
+  close(idx->lock_fd);
+  free(idx);
+}
+
+int
+log_index_line_fru(const char *line, size_t len) {
+  size_t i;
+  int fru;
+
+  for (i = 0; i + 6 <= len; i++) {
+    if (strncasecmp(line + i, "FRU: ", 5) || line[i + 5] < '0' || line[i + 5] > '9')
+      continue;
+    fru = line[i + 5] - '0';
+    if (i + 6 < len && line[i + 6] >= '0' && line[i + 6] <= '9')
+      fru = fru * 10 + line[i + 6] - '0';
+    return fru;
+  }
+  return 0;
+}
+
+static bool
+is_global(const char *line, size_t len) {
+  return memmem(line, len, "log-util:", 9) && memmem(line, len, "all logs", 8);
+}
+
+// Append the records of one FRU from the batch to its index file
+static int
+write_recs(log_index_t *idx, log_index_rec_t *recs, int num, int fru,
+           log_index_rec_t *out) {
+  char path[PATH_MAX], name[16];
+  int i, n = 0, fd, ret = 0;
+
+  for (i = 0; i < num; i++) {
+    int f = (recs[i].flags & LOG_INDEX_GLOBAL) ? LOG_INDEX_ALL : recs[i].fru;
+    if (f == fru)
+      out[n++] = recs[i];
+  }
+  index_name(name, fru);
+  make_path(path, idx->dir, name);
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+    return -1;
+  if (write(fd, out, n * REC_SIZE) != n * REC_SIZE)
+    ret = -1;
+  close(fd);
+  return ret;
+}
+
+/*
+ * The lines of a batch are written to the segment first and then to the
+ * indexes, so a crash in between leaves lines no index points to.
+ */
+static int
+flush(log_index_t *idx, const char *data, size_t len, uint32_t offset,
+      log_index_rec_t *recs, int num, log_index_rec_t *tmp) {
+  uint8_t done[256];
+  int i, ret = 0;
+
+  if (num == 0)
+    return 0;
+  if (pwrite(idx->seg_fd, data, len, offset) != len)
+    return -1;
+  memset(done, 0, sizeof(done));
+  for (i = 0; i < num; i++) {
+    int f = (recs[i].flags & LOG_INDEX_GLOBAL) ? LOG_INDEX_ALL : recs[i].fru;
+    if (!done[f]) {
+      done[f] = 1;
+      if (write_recs(idx, recs, num, f, tmp) < 0)
+        ret = -1;
+    }
+  }
+  return ret;
+}
+
+int
+log_index_append(log_index_t *idx, const char *buf, size_t len) {
+  const char *line, *nl, *end = buf + len;
+  char *data;
+  log_index_rec_t *recs, *tmp;
+  size_t l, dlen = 0;
+  uint32_t start;
+  int num = 0, max = 0, ret = -1;
+
+  for (line = buf; line < end && (nl = memchr(line, '\n', end - line)); line = nl + 1)
+    max++;
+  if (max == 0)
+    return 0;
+
+  data = malloc(len);
+  recs = malloc(max * REC_SIZE);
+  tmp = malloc(max * REC_SIZE);
+  if (!data || !recs || !tmp)
+    goto exit;
+  if (flock(idx->lock_fd, LOCK_EX) < 0)
+    goto exit;
+
+  start = idx->offset;
+  for (line = buf; line < end && (nl = memchr(line, '\n', end - line)); line = nl + 1) {
+    l = nl + 1 - line;
+    if (l > LOG_INDEX_LINE_MAX)
+      l = LOG_INDEX_LINE_MAX;
+    if (idx->offset + l > idx->seg_size && idx->offset > 0) {
+      if (flush(idx, data, dlen, start, recs, num, tmp) < 0 || next_seg(idx) < 0)
+        goto unlock;
+      num = 0;
+      dlen = 0;
+      start = idx->offset;
+    }
+    memcpy(data + dlen, line, l);
+    data[dlen + l - 1] = '\n';
+    recs[num].seq = idx->next_seq++;
+    recs[num].seg = idx->cur_seg;
+    recs[num].offset = idx->offset;
+    recs[num].len = l;
+    recs[num].fru = log_index_line_fru(line, l);
+    if (recs[num].fru > LOG_INDEX_MAX_FRU)
+      recs[num].fru = 0;
+    recs[num].flags = is_global(line, l) ? LOG_INDEX_GLOBAL : 0;
+    num++;
+    dlen += l;
+    idx->offset += l;
+  }
+  if (flush(idx, data, dlen, start, recs, num, tmp) == 0)
+    ret = line - buf;
+
+unlock:
+  flock(idx->lock_fd, LOCK_UN);
+exit:
+  free(data);
+  free(recs);
+  free(tmp);
+  return ret;
+}
+
+typedef struct {
+  uint32_t first_seg;
+  cutoff_t cut;
+  int fru;
+  log_index_rec_t *recs;
+  int num;
+} dump_t;
+
+static int
+collect_index(const char *dir, int fru, void *arg) {
+  dump_t *d = arg;
+  log_index_rec_t *recs, *more;
+  int n;
+
+  if (d->fru != LOG_INDEX_ALL && fru != d->fru && fru != LOG_INDEX_ALL)
+    return 0;
+  n = read_index(dir, fru, index_cutoff(&d->cut, fru), d->first_seg, &recs);
+  if (n <= 0)
+    return n;
+  if ((more = realloc(d->recs, (d->num + n) * REC_SIZE)) == NULL) {
+    free(recs);
+    return -1;
+  }
+  d->recs = more;
+  memcpy(d->recs + d->num, recs, n * REC_SIZE);
+  d->num += n;
+  free(recs);
+  return 0;
+}
+
+static int
+cmp_seq(const void *a, const void *b) {
+  const log_index_rec_t *ra = a, *rb = b;
+
+  return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+int
+log_index_dump(const char *dir, int fru, int fd) {
+  char path[PATH_MAX], name[32], buf[8192];
+  uint32_t last, seg = 0;
+  size_t used = 0;
+  int lock, i, seg_fd = -1, lines = 0;
+  dump_t d;
+
+  if ((lock = lock_dir(dir, LOCK_SH)) < 0)
+    return -1;
+  memset(&d, 0, sizeof(d));
+  d.fru = fru;
+  if (scan_segs(dir, &d.first_seg, &last) <= 0 || load_cutoff(dir, &d.cut) < 0 ||
+      for_each_index(dir, collect_index, &d) < 0) {
+    unlock_dir(lock);
+    free(d.recs);
+    return -1;
+  }
+  qsort(d.recs, d.num, REC_SIZE, cmp_seq);
+
+  for (i = 0; i < d.num; i++) {
+    log_index_rec_t *rec = &d.recs[i];
+
+    if (seg_fd < 0 || rec->seg != seg) {
+      if (seg_fd >= 0)
+        close(seg_fd);
+      seg = rec->seg;
+      sprintf(name, "seg.%u", seg);
+      make_path(path, dir, name);
+      seg_fd = open(path, O_RDONLY);
+    }
+    if (seg_fd < 0 || rec->len > LOG_INDEX_LINE_MAX)
+      continue;
+    if (used + rec->len > sizeof(buf)) {
+      if (write(fd, buf, used) != used)
+        break;
+      used = 0;
+    }
+    // Skip what did not make it to the segment before a crash
+    if (pread(seg_fd, buf + used, rec->len, rec->offset) != rec->len)
+      continue;
+    used += rec->len;
+    lines++;
+  }
+  if (used && write(fd, buf, used) != used)
+    lines = -1;
+
+  if (seg_fd >= 0)
+    close(seg_fd);
+  unlock_dir(lock);
+  free(d.recs);
+  return lines;
+}
+
+int
+log_index_clear(const char *dir, int fru) {
+  char path[PATH_MAX];
+  log_index_clear_t tomb;
+  int lock, fd, ret = -1;
+
+  if ((lock = lock_dir(dir, LOCK_EX)) < 0)
+    return -1;
+  memset(&tomb, 0, sizeof(tomb));
+  tomb.seq = last_seq(dir, false) + 1;
+  tomb.fru = fru;
+  make_path(path, dir, CLEAR_NAME);
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) >= 0) {
+    if (write(fd, &tomb, sizeof(tomb)) == sizeof(tomb))
+      ret = 0;
+    close(fd);
+  }
+  unlock_dir(lock);
+  return ret;
+}
@@ -0,0 +1,101 @@
+/*
+ * log-index
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __LOG_INDEX_H__
+#define __LOG_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Critical log lines, as rsyslog formats them for log-util, kept in a
+ * directory of:
+ *   seg.<n>      the lines themselves, in segments of bounded size; the
+ *                oldest segment is removed once there are too many
+ *   fru.<n>      per FRU index of the lines naming "FRU: <n>" (0 for
+ *                the ones which name none), in the order they came
+ *   fru.global   the "log-util: ... all logs" lines, shown for any FRU
+ *   clear        tombstones: the lines of a FRU before a sequence
+ *                number are cleared
+ *   lock         flock()ed by readers (shared) and writers (exclusive)
+ *
+ * Printing a FRU reads its index from the first line after its last
+ * clear, and then only the lines it names. A clear appends a tombstone.
+ * The daemon drops cleared entries and those of removed segments from
+ * the index when it starts a new segment. It builds a new store from the
+ * lines already in the logfile (and its rotated .0), leaving out those
+ * before a "log-util: User cleared" note for their FRU.
+ */
+
+#define LOG_INDEX_DIR         "/mnt/data/log-index"
+#define LOG_INDEX_LOGFILE     "/mnt/data/logfile"
+#define LOG_INDEX_SEG_SIZE    (32 * 1024)
+#define LOG_INDEX_SEGS        12
+#define LOG_INDEX_LINE_MAX    1024
+#define LOG_INDEX_ALL         0xFF
+#define LOG_INDEX_MAX_FRU     99
+
+typedef struct {
+  uint32_t seq;
+  uint32_t seg;
+  uint32_t offset;
+  uint16_t len;
+  uint8_t fru;
+  uint8_t flags;
+} log_index_rec_t;
+
+#define LOG_INDEX_GLOBAL      0x01
+
+typedef struct {
+  uint32_t seq;      /* lines before this one are cleared */
+  uint8_t fru;       /* or LOG_INDEX_ALL */
+  uint8_t pad[3];
+} log_index_clear_t;
+
+typedef struct log_index log_index_t;
+
+/*
+ * Open the index in dir for appending, creating it if need be. Lines
+ * go to segments of seg_size bytes, max_segs of them are kept.
+ * Returns NULL on failure.
+ */
+log_index_t *log_index_open(const char *dir, size_t seg_size, int max_segs);
+
+/*
+ * Append the whole lines in buf. Returns the number of bytes taken,
+ * the part of a line at the end is left to the caller, or -1 on error.
+ */
+int log_index_append(log_index_t *idx, const char *buf, size_t len);
+
+void log_index_close(log_index_t *idx);
+
+/* The FRU a line names, 0 if none */
+int log_index_line_fru(const char *line, size_t len);
+
+/*
+ * Write the lines of fru (LOG_INDEX_ALL for all of them) which are not
+ * cleared to fd, oldest first. Returns the number of lines, -1 on error.
+ */
+int log_index_dump(const char *dir, int fru, int fd);
+
+/* Clear the lines of fru, or of all FRUs */
+int log_index_clear(const char *dir, int fru);
+
+#endif /* __LOG_INDEX_H__ */
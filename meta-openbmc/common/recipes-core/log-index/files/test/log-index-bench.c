@@ -0,0 +1,322 @@
+/*
+ * log-index benchmark
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <regex.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "log-index.h"
+
+/*
+ * A synthetic critical log of LOG_SIZE bytes over NUM_FRUS FRUs, kept
+ * both as the flat logfile log-util scans and in the index. Printing
+ * and clearing a FRU are timed both ways, and the index is checked to
+ * print what the scan finds, before and after clears and compaction.
+ */
+
+#define LOG_SIZE   (1024 * 1024)
+#define NUM_FRUS   32
+#define ROUNDS     20
+
+static char dir[256], flat[300];
+static regex_t re_crit, re_util, re_fru, re_all;
+
+static const char *apps[] = {
+  "power-util", "healthd", "sensord", "ipmid", "fscd", "gpiod",
+};
+
+/* The next line of the log, as rsyslog writes it for log-util */
+static size_t
+gen_line(char *buf, unsigned int n) {
+  unsigned int kind = rand() % 100, fru = rand() % (NUM_FRUS + 1);
+
+  if (kind < 2) {
+    return sprintf(buf, " 2018 Mar 02 10:%02u:%02u bmc-oob. user.crit fbtp: "
+                   "log-util: User cleared %s logs\n", n / 60 % 60, n % 60,
+                   (kind == 0) ? "all" : "FRU: 3");
+  }
+  if (fru == 0) {
+    return sprintf(buf, " 2018 Mar 02 10:%02u:%02u bmc-oob. kern.crit fbtp: "
+                   "%s: BMC event %u, no FRU\n", n / 60 % 60, n % 60,
+                   apps[n % 6], n);
+  }
+  return sprintf(buf, " 2018 Mar 02 10:%02u:%02u bmc-oob. user.crit fbtp: "
+                 "%s: ASSERT: Upper Critical threshold - raised - FRU: %u, "
+                 "num: 0x%02X curr_val: %u.00 C, event %u\n",
+                 n / 60 % 60, n % 60, apps[n % 6], fru, n % 256, 70 + n % 20, n);
+}
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+read_all(int fd, size_t *len) {
+  struct stat st;
+  char *buf;
+
+  fstat(fd, &st);
+  buf = malloc(st.st_size + 1);
+  assert(pread(fd, buf, st.st_size, 0) == st.st_size);
+  buf[st.st_size] = '\0';
+  *len = st.st_size;
+  return buf;
+}
+
+/* What log-util does: every line of the file against the regexes */
+static int
+line_fru(const char *line) {
+  regmatch_t m;
+
+  if (regexec(&re_fru, line, 1, &m, 0))
+    return 0;
+  return atoi(line + m.rm_so + 5);
+}
+
+static int
+scan_print(int fru, int out) {
+  FILE *fp = fopen(flat, "r");
+  char line[LOG_INDEX_LINE_MAX + 2];
+  int lines = 0;
+
+  assert(fp);
+  while (fgets(line, sizeof(line), fp)) {
+    int util = !regexec(&re_util, line, 0, NULL, 0);
+
+    if (regexec(&re_crit, line, 0, NULL, 0) && !util)
+      continue;
+    if (!(util && !regexec(&re_all, line, 0, NULL, 0)) &&
+        fru != LOG_INDEX_ALL && line_fru(line) != fru)
+      continue;
+    assert(write(out, line, strlen(line)) == strlen(line));
+    lines++;
+  }
+  fclose(fp);
+  return lines;
+}
+
+/* And its clear: a copy without the FRU's lines swapped in */
+static void
+scan_clear(int fru) {
+  char tmp[320], line[LOG_INDEX_LINE_MAX + 2];
+  FILE *fp = fopen(flat, "r"), *out;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", flat, getpid());
+  out = fopen(tmp, "w");
+  assert(fp && out);
+  while (fgets(line, sizeof(line), fp)) {
+    int util = !regexec(&re_util, line, 0, NULL, 0);
+    if ((!regexec(&re_crit, line, 0, NULL, 0) || util) &&
+        (fru == LOG_INDEX_ALL || line_fru(line) == fru))
+      continue;
+    fputs(line, out);
+  }
+  fclose(fp);
+  fclose(out);
+  assert(rename(tmp, flat) == 0);
+}
+
+static char *
+capture(int fru, int by_index, int *lines, size_t *len) {
+  char tmp[] = "/tmp/log-index-outXXXXXX";
+  int fd = mkstemp(tmp);
+  char *buf;
+
+  assert(fd >= 0);
+  unlink(tmp);
+  *lines = by_index ? log_index_dump(dir, fru, fd) : scan_print(fru, fd);
+  buf = read_all(fd, len);
+  close(fd);
+  return buf;
+}
+
+static void
+check_same(int fru) {
+  char *a, *b;
+  size_t alen, blen;
+  int alines, blines;
+
+  a = capture(fru, 0, &alines, &alen);
+  b = capture(fru, 1, &blines, &blen);
+  if (alines != blines || alen != blen || memcmp(a, b, alen)) {
+    printf("FAIL: FRU %d: scan %d lines, index %d lines\n", fru, alines, blines);
+    exit(1);
+  }
+  free(a);
+  free(b);
+}
+
+/* Feed n bytes of generated log to both the flat file and the index */
+static void
+feed(log_index_t *idx, size_t n, unsigned int *seq) {
+  char *buf = malloc(n + 1024);
+  size_t len = 0;
+  int fd = open(flat, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+  while (len < n)
+    len += gen_line(buf + len, (*seq)++);
+  assert(write(fd, buf, len) == len);
+  close(fd);
+  // rsyslog hands the lines over a few at a time
+  for (n = 0; n < len; ) {
+    size_t chunk = len - n < 600 ? len - n : 600;
+    int taken = log_index_append(idx, buf + n, chunk);
+    assert(taken > 0);
+    n += taken;
+  }
+  free(buf);
+}
+
+static off_t
+index_bytes(void) {
+  char path[300];
+  struct stat st;
+  off_t total = 0;
+  int fru;
+
+  for (fru = 0; fru <= NUM_FRUS; fru++) {
+    snprintf(path, sizeof(path), "%s/fru.%d", dir, fru);
+    if (stat(path, &st) == 0)
+      total += st.st_size;
+  }
+  return total;
+}
+
+int
+main(int argc, char **argv) {
+  log_index_t *idx;
+  unsigned int seq = 0;
+  double t, scan_t, index_t;
+  int i, lines, frus[] = {0, 1, 3, 17, NUM_FRUS, LOG_INDEX_ALL};
+  size_t len;
+  off_t before;
+  char *buf;
+
+  snprintf(dir, sizeof(dir), "%s/log-index-benchXXXXXX", argc > 1 ? argv[1] : "/tmp");
+  assert(mkdtemp(dir));
+  snprintf(flat, sizeof(flat), "%s/logfile", dir);
+  assert(regcomp(&re_crit, " [a-z]*.crit ", REG_EXTENDED | REG_NOSUB) == 0);
+  assert(regcomp(&re_util, "log-util:", REG_EXTENDED | REG_NOSUB) == 0);
+  assert(regcomp(&re_all, "all logs", REG_EXTENDED | REG_NOSUB) == 0);
+  assert(regcomp(&re_fru, "FRU: [0-9]{1,2}", REG_EXTENDED | REG_ICASE) == 0);
+  srand(1);
+
+  /* Room for all of it, nothing is dropped */
+  idx = log_index_open(dir, LOG_INDEX_SEG_SIZE, 2 * LOG_SIZE / LOG_INDEX_SEG_SIZE);
+  assert(idx);
+  feed(idx, LOG_SIZE, &seq);
+  for (i = 0; i < sizeof(frus) / sizeof(frus[0]); i++)
+    check_same(frus[i]);
+  printf("generated %u lines, %d KB, %d FRUs: index prints what the scan finds\n",
+         seq, LOG_SIZE / 1024, NUM_FRUS);
+
+  /* Print one FRU */
+  int null = open("/dev/null", O_WRONLY);
+  t = now();
+  for (i = 0; i < ROUNDS; i++)
+    lines = scan_print(17, null);
+  scan_t = (now() - t) / ROUNDS;
+  t = now();
+  for (i = 0; i < ROUNDS; i++)
+    assert(log_index_dump(dir, 17, null) == lines);
+  index_t = (now() - t) / ROUNDS;
+  printf("print FRU 17 (%d lines): scan %.2f ms, index %.2f ms, %.0fx\n",
+         lines, scan_t * 1e3, index_t * 1e3, scan_t / index_t);
+  close(null);
+
+  /* Clear */
+  t = now();
+  scan_clear(5);
+  scan_t = now() - t;
+  t = now();
+  assert(log_index_clear(dir, 5) == 0);
+  index_t = now() - t;
+  printf("clear FRU 5: rewrite %.2f ms, tombstone %.3f ms\n",
+         scan_t * 1e3, index_t * 1e3);
+  buf = capture(5, 1, &lines, &len);
+  // Only the "all logs" lines are left
+  assert(lines > 0 && !memmem(buf, len, "FRU: 5,", 7));
+  free(buf);
+  for (i = 0; i < sizeof(frus) / sizeof(frus[0]); i++)
+    check_same(frus[i]);
+
+  /* Lines after the clear show, compaction drops the cleared ones */
+  before = index_bytes();
+  scan_clear(LOG_INDEX_ALL);
+  assert(log_index_clear(dir, LOG_INDEX_ALL) == 0);
+  feed(idx, 2 * LOG_INDEX_SEG_SIZE, &seq);
+  check_same(5);
+  check_same(LOG_INDEX_ALL);
+  printf("clear all + %d KB more: index %lld -> %lld bytes after compaction\n",
+         2 * LOG_INDEX_SEG_SIZE / 1024, (long long)before, (long long)index_bytes());
+  assert(index_bytes() < before / 4);
+
+  /* An index compaction cannot rewrite keeps the tombstones it needs */
+  char bad[300], tombs[300];
+  struct stat st;
+  snprintf(bad, sizeof(bad), "%s/fru.%d", dir, LOG_INDEX_MAX_FRU);
+  snprintf(tombs, sizeof(tombs), "%s/clear", dir);
+  assert(mkdir(bad, 0755) == 0);
+  scan_clear(7);
+  assert(log_index_clear(dir, 7) == 0);
+  feed(idx, 2 * LOG_INDEX_SEG_SIZE, &seq);
+  assert(stat(tombs, &st) == 0 && st.st_size > 0);
+  check_same(7);
+  assert(rmdir(bad) == 0);
+  feed(idx, 2 * LOG_INDEX_SEG_SIZE, &seq);
+  assert(stat(tombs, &st) == 0 && st.st_size == 0);
+  check_same(7);
+  check_same(LOG_INDEX_ALL);
+
+  /* Reopened, it goes on in order */
+  log_index_close(idx);
+  idx = log_index_open(dir, LOG_INDEX_SEG_SIZE, 2 * LOG_SIZE / LOG_INDEX_SEG_SIZE);
+  feed(idx, 4096, &seq);
+  check_same(LOG_INDEX_ALL);
+  check_same(7);
+  log_index_close(idx);
+
+  /* A bounded store keeps the newest lines */
+  idx = log_index_open(dir, LOG_INDEX_SEG_SIZE, 4);
+  feed(idx, 8 * LOG_INDEX_SEG_SIZE, &seq);
+  buf = capture(LOG_INDEX_ALL, 1, &lines, &len);
+  assert(len <= 4 * LOG_INDEX_SEG_SIZE && len > 2 * LOG_INDEX_SEG_SIZE);
+  free(buf);
+  log_index_close(idx);
+
+  if (argc <= 2) {
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    assert(system(cmd) == 0);
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -26,8 +26,12 @@ from ctypes import *
 from lib_pal import *
 import subprocess
 import codecs
+import syslog
 
 syslogfiles = ['/var/log/logfile.0', '/var/log/logfile']
+# Critical lines indexed per FRU by log-index, when it runs
+LOG_INDEX = '/usr/local/bin/log-index'
+LOG_INDEX_DIR = '/mnt/data/log-index'
 cmdlist = ['--print', '--clear']
 APPNAME = 'log-util'
 frulist = ''
@@ -47,6 +51,194 @@ def rsyslog_hup():
     except (OSError, IOError, subprocess.CalledProcessError) as e:
         pass
 
+def log_index_available():
+    return os.path.isdir(LOG_INDEX_DIR) and os.access(LOG_INDEX, os.X_OK)
+
+def log_index_fru(fru):
+    # log-index knows FRUs by number, 0 for lines which name none
+    if fru == 'all':
+        return 'all'
+    if fru == 'sys':
+        return '0'
+    return str(frulist.index(fru))
+
+def log_index_print(fru):
+    # Only the lines of the FRU are read, no need to scan the logfile
+    try:
+        out = subprocess.check_output([LOG_INDEX, '--print', log_index_fru(fru)])
+    except (OSError, subprocess.CalledProcessError) as e:
+        return None
+    return out.decode('utf-8', 'replace').splitlines(True)
+
+def log_index_clear(fru):
+    try:
+        subprocess.check_call([LOG_INDEX, '--clear', log_index_fru(fru)])
+    except (OSError, subprocess.CalledProcessError) as e:
+        print("Failed to clear the logs of %s" % fru)
+        return -1
+
+    if fru == 'all' or fru == 'sys':
+        temp = fru
+    else:
+        temp = 'FRU: ' + str(frulist.index(fru))
+    # Logged like any critical line, so it goes to the index as well
+    syslog.openlog(APPNAME)
+    syslog.syslog(syslog.LOG_CRIT, 'User cleared ' + temp + ' logs')
+    syslog.closelog()
+    return 0
+
+def read_logfile(logfile):
+    try:
+        fd = open(logfile, 'a+', encoding='utf-8')
+        fd.seek(0, os.SEEK_SET)
+        logs = fd.readlines()
+        fd.close()
+    except Exception:
+        print("Unexpected error:", sys.exc_info()[0])
+        return None
+    return logs
+
+def clear_logfile(fru, logfile, logs, note):
+    newlog = ''
+
+    for log in logs:
+        # Print only critical logs
+        if not (re.search(r'[a-z]*.crit ', log) or re.search(r'log-util:', log)):
+            continue
+
+        # Find the FRU number
+        if re.search(r'FRU: [0-9]{1,2}', log, re.IGNORECASE):
+            # FRU is in format "FRU: X" or "FRU: XX"
+            fru_num = re.search(r'FRU: ([0-9]{1,2})', log, re.IGNORECASE).group(1)
+        else:
+            fru_num = '0'
+
+        # FRU # is always aligned with indexing of fru list
+        if fru == 'sys' and fru_num == '0':
+            fruname = 'sys'
+        else:
+            fruname = frulist[int(fru_num)]
+
+        # Clear the log is the argument fru matches the log fru
+        if fru == 'all' or fru == fruname:
+            # Drop this log line
+            continue
+        else:
+            newlog = newlog + log
+
+    # Dump the new log in a tmp file
+    if note:
+       if fru == 'all':
+          temp = 'all'
+       else:
+          if fru == 'sys':
+             temp = 'sys'
+          else:
+             fru_num = str(frulist.index(fru))
+             temp = 'FRU: ' + fru_num
+       time = datetime.now()
+       newlog = newlog + time.strftime('%Y %b %d %H:%M:%S') + ' log-util: User cleared ' + temp + ' logs\n'
+    curpid = os.getpid()
+    tmpfd = open('%s.tmp%d' % (logfile, curpid), 'w')
+    tmpfd.write(newlog)
+    tmpfd.close()
+    # Rename the tmp file to original syslog file
+    os.rename('%s.tmp%d' % (logfile, curpid), logfile)
+
+def drop_cleared(logs):
+    # A clear through log-index leaves the logfile as it is, with only its
+    # "User cleared" note in it: the lines of the FRU before the note are gone
+    cut = {}
+    for i, log in enumerate(logs):
+        m = re.search(r'log-util: User cleared (all|sys|FRU: ([0-9]{1,2})) logs', log)
+        if m:
+            if m.group(2):
+                cut[str(int(m.group(2)))] = i
+            else:
+                cut['0' if m.group(1) == 'sys' else 'all'] = i
+    if not cut:
+        return logs
+
+    kept = []
+    for i, log in enumerate(logs):
+        if re.search(r'log-util:', log) and re.search(r'all logs', log):
+            fru_num = 'all'
+        elif re.search(r'FRU: [0-9]{1,2}', log, re.IGNORECASE):
+            fru_num = str(int(re.search(r'FRU: ([0-9]{1,2})', log, re.IGNORECASE).group(1)))
+        else:
+            fru_num = '0'
+        if i >= cut.get('all', 0) and i >= cut.get(fru_num, 0):
+            kept.append(log)
+    return kept
+
+def print_logs(fru, logs):
+    for log in logs:
+        # log eg: 2017 Nov 21 21:46:09 rtptest1413-oob.prn3.facebook.com user.crit fbttn-c279551: power-util: SERVER_POWER_CYCLE successful for FRU: 1
+        #         =date==========  =hostname======================= =loglevel= =version===== =appname=  =message===========================
+        # Print only critical logs
+        if not (re.search(r' [a-z]*.crit ', log) or re.search(r'log-util:', log)):
+            continue
+
+        # Find the FRU number
+        if re.search(r'FRU: [0-9]{1,2}', log, re.IGNORECASE):
+            # FRU is in format "FRU: X" or "FRU: XX"
+            fru_num = re.search(r'FRU: ([0-9]{1,2})', log, re.IGNORECASE).group(1)
+        else:
+            fru_num = '0'
+
+        # FRU # is always aligned with indexing of fru list
+        if fru == 'sys' and fru_num == '0':
+            fruname = 'sys'
+        else:
+            fruname = frulist[int(fru_num)]
+
+        # Print only if the argument fru matches the log fru
+        if re.search(r'log-util:', log):
+           if re.search(r'all logs', log):
+             print (log)
+             continue
+
+        if fru != 'all' and fru != fruname:
+            continue
+
+        if re.search(r'log-util:', log):
+             print (log)
+             continue
+
+
+        tmp = log.split()
+        if len(tmp[0]) is 4 and re.match(r'[0-9]{4}', tmp[0]) is not None:
+            # Time format 2017 Sep 28 22:10:50
+            ts= ' '.join(tmp[0:4])
+            time = datetime.strptime(ts, '%Y %b %d %H:%M:%S')
+            time = time.strftime('%Y-%m-%d %H:%M:%S')
+        else:
+            # Time format Sep 28 22:10:50
+            ts= ' '.join(tmp[0:3])
+            time = datetime.strptime(ts, '%b %d %H:%M:%S')
+            time = time.strftime('%m-%d %H:%M:%S')
+            tmp[1:] = log.split()
+
+        # Hostname
+        hostname = tmp[4]
+
+        # OpenBMC Version Information
+        version = tmp[6]
+
+        # Application Name
+        app = tmp[7].strip(':')
+
+        # Log Message
+        message = ' '.join(tmp[8:]).rstrip('\n')
+
+        print('%-4s %-8s %-22s %-16s %s' % (
+            fru_num,
+            fruname,
+            time,
+            app,
+            message
+            ))
+
 def log_main():
 
     global frulist
@@ -85,139 +277,30 @@ def log_main():
             "MESSAGE"
             ))
     sys.stdout = codecs.getwriter('utf-8')(sys.stdout.buffer, 'strict')
-    for logfile in syslogfiles:
-
-        try:
-            fd = open(logfile, 'a+', encoding='utf-8')
-            fd.seek(0, os.SEEK_SET)
-            syslog = fd.readlines()
-            fd.close()
-        except Exception:
-            print("Unexpected error:", sys.exc_info()[0])
-            continue
 
-        # Clear cmd
+    if log_index_available():
         if cmd == cmdlist[1]:
+            if log_index_clear(fru) == 0:
+                pal_log_clear(fru)
+            return
+        logs = log_index_print(fru)
+        if logs is not None:
+            print_logs(fru, logs)
+            return
 
-            newlog = ''
-
-            for log in syslog:
-                # Print only critical logs
-                if not (re.search(r'[a-z]*.crit ', log) or re.search(r'log-util:', log)):
-                    continue
-
-                # Find the FRU number
-                if re.search(r'FRU: [0-9]{1,2}', log, re.IGNORECASE):
-                    fru_num = ''.join(re.findall(r'FRU: [0-9]{1,2}', log, re.IGNORECASE))
-                    # FRU is in format "FRU: X"
-                    fru_num = fru_num[5]
-                else:
-                    fru_num = '0'
-
-                # FRU # is always aligned with indexing of fru list
-                if fru == 'sys' and fru_num == '0':
-                    fruname = 'sys'
-                else:
-                    fruname = frulist[int(fru_num)]
-
-                # Clear the log is the argument fru matches the log fru
-                if fru == 'all' or fru == fruname:
-                    # Drop this log line
-                    continue
-                else:
-                    newlog = newlog + log
-
-            # Dump the new log in a tmp file
-            if logfile == syslogfiles[1]:
-               if fru == 'all':
-                  temp = 'all'
-               else:
-                  if fru == 'sys':
-                     temp = 'sys'
-                  else:
-                     fru_num = str(frulist.index(fru))
-                     temp = 'FRU: ' + fru_num
-               time = datetime.now()
-               newlog = newlog + time.strftime('%Y %b %d %H:%M:%S') + ' log-util: User cleared ' + temp + ' logs\n'
-            curpid = os.getpid()
-            tmpfd = open('%s.tmp%d' % (logfile, curpid), 'w')
-            tmpfd.write(newlog)
-            tmpfd.close()
-            # Rename the tmp file to original syslog file
-            os.rename('%s.tmp%d' % (logfile, curpid), logfile)
-
-        # Print cmd
-        if cmd == cmdlist[0]:
-
-            for log in syslog:
-                # log eg: 2017 Nov 21 21:46:09 rtptest1413-oob.prn3.facebook.com user.crit fbttn-c279551: power-util: SERVER_POWER_CYCLE successful for FRU: 1
-                #         =date==========  =hostname======================= =loglevel= =version===== =appname=  =message===========================
-                # Print only critical logs
-                if not (re.search(r' [a-z]*.crit ', log) or re.search(r'log-util:', log)):
-                    continue
-
-                # Find the FRU number
-                if re.search(r'FRU: [0-9]{1,2}', log, re.IGNORECASE):
-                    fru_num = ''.join(re.findall(r'FRU: [0-9]{1,2}', log, re.IGNORECASE))
-                    # FRU is in format "FRU: X"
-                    fru_num = fru_num[5]
-                else:
-                    fru_num = '0'
-
-                # FRU # is always aligned with indexing of fru list
-                if fru == 'sys' and fru_num == '0':
-                    fruname = 'sys'
-                else:
-                    fruname = frulist[int(fru_num)]
-
-                # Print only if the argument fru matches the log fru
-                if re.search(r'log-util:', log):
-                   if re.search(r'all logs', log):
-                     print (log)
-                     continue
-
-                if fru != 'all' and fru != fruname:
-                    continue
-
-                if re.search(r'log-util:', log):
-                     print (log)
-                     continue
-
-
-                tmp = log.split()
-                if len(tmp[0]) is 4 and re.match(r'[0-9]{4}', tmp[0]) is not None:
-                    # Time format 2017 Sep 28 22:10:50
-                    ts= ' '.join(tmp[0:4])
-                    time = datetime.strptime(ts, '%Y %b %d %H:%M:%S')
-                    time = time.strftime('%Y-%m-%d %H:%M:%S')
-                else:
-                    # Time format Sep 28 22:10:50
-                    ts= ' '.join(tmp[0:3])
-                    time = datetime.strptime(ts, '%b %d %H:%M:%S')
-                    time = time.strftime('%m-%d %H:%M:%S')
-                    tmp[1:] = log.split()
-
-                # Hostname
-                hostname = tmp[4]
-
-                # OpenBMC Version Information
-                version = tmp[6]
-
-                # Application Name
-                app = tmp[7].strip(':')
-
-                # Log Message
-                message = ' '.join(tmp[8:]).rstrip('\n')
-
-                print('%-4s %-8s %-22s %-16s %s' % (
-                    fru_num,
-                    fruname,
-                    time,
-                    app,
-                    message
-                    ))
-
-    if cmd == cmdlist[1]:
+    # Print cmd
+    if cmd == cmdlist[0]:
+        logs = []
+        for logfile in syslogfiles:
+            logs += read_logfile(logfile) or []
+        print_logs(fru, drop_cleared(logs))
+        return
+
+    # Clear cmd
+    for logfile in syslogfiles:
+        logs = read_logfile(logfile)
+        if logs is not None:
+            clear_logfile(fru, logfile, logs, logfile == syslogfiles[1])
         pal_log_clear(fru)
         rsyslog_hup()
 
@@ -21,7 +21,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <errno.h>
 #include <syslog.h>
 #include <stdint.h>
 #include <pthread.h>
@@ -30,62 +29,28 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
-#include <sys/ioctl.h>
 #include <getopt.h>
 #include <openbmc/pal.h>
-
-/***********************************************************************/
-struct timing_negotiation {
-  uint8_t msg_timing;
-  uint8_t addr_timing;
-};
-
-struct xfer_msg {
-  uint8_t client_addr;
-  uint8_t tx_len;
-  uint8_t rx_len;
-  uint8_t tx_fcs;
-  uint8_t rx_fcs;
-  uint8_t fcs_en;
-  uint8_t sw_fcs;
-  uint8_t *tx_buf;
-  uint8_t *rx_buf;
-  uint32_t sts;
-};
-
-#define PECI_DEVICE "/dev/ast-peci"
-
-//IOCTL ..
-#define PECIIOC_BASE 'P'
-
-#define AST_PECI_IOCRTIMING _IOR(PECIIOC_BASE, 0, struct timing_negotiation*)
-#define AST_PECI_IOCWTIMING _IOW(PECIIOC_BASE, 1, struct timing_negotiation*)
-#define AST_PECI_IOCXFER _IOWR(PECIIOC_BASE, 2, struct xfer_msg*)
-
-#define PECI_INT_TIMEOUT     (0x1 << 4)
-#define PECI_INT_CONNECT     (0x1 << 3)
-#define PECI_INT_W_FCS_BAD   (0x1 << 2)
-#define PECI_INT_W_FCS_ABORT (0x1 << 1)
-#define PECI_INT_CMD_DONE    (0x1)
-
-/***********************************************************************/
+#include <openbmc/peci.h>
 
 #if defined(__GNUC__)
 int pal_before_peci(void) __attribute__((weak));
 int pal_after_peci(void) __attribute__((weak));
 #endif
-static int process_file (int peci_fd, char* file_path);
-static int process_command (int peci_fd, int argc, char **argv);
+static int process_file (peci_handle_t *peci, char* file_path);
+static int process_batch (peci_handle_t *peci, char* file_path);
+static int process_command (peci_handle_t *peci, int argc, char **argv);
 
 static uint8_t awfcs_en = 0;
-static uint8_t retry_times = 3;
-static uint8_t retry_interval = 250;
+static int retry_times = PECI_RETRY_TIMES;
+static int retry_interval = PECI_RETRY_INTERVAL;
 static uint8_t verbose = 0;
 
 static void
 print_usage_help(void) {
   printf("Usage: peci-util <client addr> <Tx length> <Rx length> <[0..n]data_bytes_to_send>\n");
   printf("       peci-util -f <peci command file>\n");
+  printf("       peci-util -b <peci command file>\n");
   printf("  client addr: 0x30 CPU0, 0x31 CPU1\n");
   printf("  --awfcs, -a <1|0>\n");
   printf("    Enable/Disable AW FCS, default is 0\n");
@@ -99,16 +64,86 @@ print_usage_help(void) {
   printf("    Display this help messages\n");
   printf("  --file, -f <file>\n");
   printf("    Read commands from <file>\n");
+  printf("  --batch, -b <file>\n");
+  printf("    Run the commands of <file> as one batch, commands to one CPU\n");
+  printf("    are retried while those to the other go on. Lines carry no options\n");
+}
+
+static void
+print_response(peci_cmd_t *cmd) {
+  int i;
+
+  if (cmd->status < 0) {
+    fprintf(stderr, "PECI failed. sts:%08Xh\n", cmd->sts);
+    return;
+  }
+  if (verbose && cmd->retries)
+    printf("retried %d times\n", cmd->retries);
+
+  // Print the response
+  for (i = 0; i < cmd->rx_len; i++) {
+    printf("%02X ", cmd->rx[i]);
+  }
+  printf("\n");
+}
+
+// <client addr> <Tx length> <Rx length> <[0..n]data_bytes_to_send>
+static int
+parse_cmd(int argc, char **argv, peci_cmd_t *cmd) {
+  int i = 0;
+
+  if (argc < 3) {
+    return -1;
+  }
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->addr = (uint8_t)strtoul(argv[i++], NULL, 0);
+  cmd->tx_len = (uint8_t)strtoul(argv[i++], NULL, 0);
+  cmd->rx_len = (uint8_t)strtoul(argv[i++], NULL, 0);
+  cmd->awfcs = awfcs_en;
+  if (argc - i != cmd->tx_len || cmd->tx_len > PECI_BUF_MAX ||
+      cmd->rx_len > PECI_BUF_MAX) {
+    return -1;
+  }
+  while (i < argc) {
+    cmd->tx[i - 3] = (uint8_t)strtoul(argv[i], NULL, 0);
+    i++;
+  }
+  return 0;
 }
 
 #define MAX_ARG_NUM 64
+/*
+ * Split a line of a command file. Return the number of arguments, which
+ * start at argv[1], or 0 for a line with nothing to run; an echo line
+ * stores the text to print in *echo.
+ */
+static int
+split_line(char *buf, char **argv, char **echo) {
+  int argc;
+  char *str, *next, *del=" \n";
+
+  *echo = NULL;
+  // getopt parse arguments from argv[1], we have to fill arg from 1.
+  str = strtok_r(buf, del, &next);
+  for (argc = 1; argc < MAX_ARG_NUM && str; argc++, str = strtok_r(NULL, del, &next)) {
+    if (str[0] == '#')
+      break;
+
+    if ((argc == 1) && !strcmp(str, "echo")) {
+      *echo = (*next) ? next : "\n";
+      break;
+    }
+    argv[argc] = str;
+  }
+  return argc - 1;
+}
+
 static int
-process_file (int peci_fd, char* path) {
+process_file (peci_handle_t *peci, char* path) {
   FILE *fp;
   int argc, final_ret=0, ret;
   char buf[1024];
-  char *str, *next, *del=" \n";
-  char *argv[MAX_ARG_NUM];
+  char *argv[MAX_ARG_NUM], *echo;
 
   if (!(fp = fopen(path, "r"))) {
     syslog(LOG_WARNING, "Failed to open %s", path);
@@ -117,22 +152,13 @@ process_file (int peci_fd, char* path) {
 
   argv[0] = path;
   while (fgets(buf, sizeof(buf), fp) != NULL) {
-    // getopt parse arguments from argv[1], we have to fill arg from 1.
-    str = strtok_r(buf, del, &next);
-    for (argc = 1; argc < MAX_ARG_NUM && str; argc++, str = strtok_r(NULL, del, &next)) {
-      if (str[0] == '#')
-        break;
-
-      if ((argc == 1) && !strcmp(str, "echo")) {
-        printf("%s", (*next) ? next : "\n");
-        break;
-      }
-      argv[argc] = str;
-    }
-    if (argc == 1)
+    argc = split_line(buf, argv, &echo);
+    if (echo)
+      printf("%s", echo);
+    if (argc == 0)
       continue;
 
-    ret = process_command(peci_fd, argc, argv);
+    ret = process_command(peci, argc + 1, argv);
     // return failure if any command failed
     if (ret)
       final_ret = ret;
@@ -142,31 +168,112 @@ process_file (int peci_fd, char* path) {
   return final_ret;
 }
 
+/*
+ * Read the whole file first, run its commands with one peci_xfer_batch()
+ * and print the responses and echo lines in the order of the file.
+ */
+typedef struct {
+  char *echo;     // or NULL for the next command
+} batch_line_t;
+
 static int
-process_command (int peci_fd, int argc, char **argv) {
-  struct xfer_msg msg;
-  uint8_t tbuf[32] = {0x00};
-  uint8_t rbuf[32] = {0x00};
-  uint8_t tlen = 0;
-  int i, opt, retry;
+process_batch (peci_handle_t *peci, char* path) {
+  FILE *fp;
+  int argc, final_ret = 0;
+  int num_lines = 0, max_lines = 0, num_cmds = 0, max_cmds = 0, i, c;
+  char buf[1024];
+  char *argv[MAX_ARG_NUM], *echo;
+  batch_line_t *lines = NULL, *ltmp;
+  peci_cmd_t *cmds = NULL, *ctmp;
+
+  if (!(fp = fopen(path, "r"))) {
+    syslog(LOG_WARNING, "Failed to open %s", path);
+    return -1;
+  }
+
+  argv[0] = path;
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    argc = split_line(buf, argv, &echo);
+    if (!echo && argc == 0)
+      continue;
+
+    if (num_lines == max_lines) {
+      max_lines = max_lines ? max_lines * 2 : 256;
+      if (!(ltmp = realloc(lines, max_lines * sizeof(*lines))))
+        goto nomem;
+      lines = ltmp;
+    }
+    if (echo) {
+      if (!(lines[num_lines].echo = strdup(echo)))
+        goto nomem;
+      num_lines++;
+      continue;
+    }
+
+    if (num_cmds == max_cmds) {
+      max_cmds = max_cmds ? max_cmds * 2 : 256;
+      if (!(ctmp = realloc(cmds, max_cmds * sizeof(*cmds))))
+        goto nomem;
+      cmds = ctmp;
+    }
+    if (parse_cmd(argc, &argv[1], &cmds[num_cmds])) {
+      printf("wrong arg:");
+      for (i = 1; i <= argc; i++)
+        printf("%s ", argv[i]);
+      printf("\n");
+      final_ret = -1;
+      continue;
+    }
+    lines[num_lines++].echo = NULL;
+    num_cmds++;
+  }
+  fclose(fp);
+  fp = NULL;
+
+  if (peci_xfer_batch(peci, cmds, num_cmds))
+    final_ret = -1;
+
+  for (i = 0, c = 0; i < num_lines; i++) {
+    if (lines[i].echo)
+      printf("%s", lines[i].echo);
+    else
+      print_response(&cmds[c++]);
+  }
+  goto exit;
+
+nomem:
+  fprintf(stderr, "Out of memory reading %s\n", path);
+  final_ret = -1;
+exit:
+  if (fp)
+    fclose(fp);
+  for (i = 0; i < num_lines; i++)
+    free(lines[i].echo);
+  free(lines);
+  free(cmds);
+  return final_ret;
+}
+
+static int
+process_command (peci_handle_t *peci, int argc, char **argv) {
+  peci_cmd_t cmd;
+  int i, opt;
   char file_path[256];
   int optind_long = 0;
 
-  static const char* optstring = "a:r:i:f:vhe";
+  static const char* optstring = "a:r:i:f:b:vhe";
   static const struct option long_options[] = {
     {"awfcs", required_argument, 0, 'a'},
     {"retry", required_argument, 0, 'r'},
     {"interval", required_argument, 0, 'i'},
     {"file", required_argument, 0, 'f'},
+    {"batch", required_argument, 0, 'b'},
     {"verbose", no_argument, 0, 'v'},
     {"help", no_argument, 0, 'h'},
     {"echo", no_argument, 0, 'e'},
     {0, 0, 0, 0}
   };
 
-  msg.tx_buf = tbuf;
-  msg.rx_buf = rbuf;
-
   optind = 0; // Reset getopt function
   while ((opt = getopt_long(argc, argv, optstring, long_options, &optind_long)) != -1) {
     switch (opt) {
@@ -175,13 +282,20 @@ process_command (int peci_fd, int argc, char **argv) {
       break;
     case 'r':
       retry_times = strtoul(optarg, NULL, 0);
+      peci_set_retry(peci, retry_times, retry_interval);
       break;
     case 'i':
       retry_interval = strtoul(optarg, NULL, 0);
+      peci_set_retry(peci, retry_times, retry_interval);
       break;
     case 'f':
       strncpy(file_path, optarg, 256);
-      return process_file(peci_fd, file_path);
+      file_path[255] = '\0';
+      return process_file(peci, file_path);
+    case 'b':
+      strncpy(file_path, optarg, 256);
+      file_path[255] = '\0';
+      return process_batch(peci, file_path);
     case 'v':
       verbose = 1;
       break;
@@ -199,79 +313,23 @@ process_command (int peci_fd, int argc, char **argv) {
     }
   }
 
-  // fill xfer_msg
-  if (argc - optind < 3) {
+  if (parse_cmd(argc - optind, &argv[optind], &cmd)) {
     goto err_exit;
   }
-  i = optind;
-  msg.client_addr = (uint8_t)strtoul(argv[i++], NULL, 0);
-  msg.tx_len = (uint8_t)strtoul(argv[i++], NULL, 0);
-  msg.rx_len = (uint8_t)strtoul(argv[i++], NULL, 0);
-  msg.fcs_en = awfcs_en;
-  if (argc - i != msg.tx_len || msg.tx_len > 32 || msg.rx_len > 32) {
-    goto err_exit;
-  }
-  while (i < argc) {
-    tbuf[tlen++] = (uint8_t)strtoul(argv[i++], NULL, 0);
-  }
 
   if (verbose) {
-    printf("awfcs:%d,addr:%d,", msg.fcs_en, msg.client_addr);
-    printf("tx(%d):", msg.tx_len);
-    for (i=0; i<msg.tx_len; i++)
-      printf("%02X ", tbuf[i]);
-    printf("rx(%d)", msg.rx_len);
+    printf("awfcs:%d,addr:%d,", cmd.awfcs, cmd.addr);
+    printf("tx(%d):", cmd.tx_len);
+    for (i=0; i<cmd.tx_len; i++)
+      printf("%02X ", cmd.tx[i]);
+    printf("rx(%d)", cmd.rx_len);
     printf("\n");
   }
 
-  retry = 0;
-  do {
-    ioctl(peci_fd, AST_PECI_IOCXFER, &msg);
-
-    switch (msg.sts) {
-      case PECI_INT_CMD_DONE:
-        break;
-      default:
-        fprintf(stderr, "PECI failed. sts:%08Xh\n", msg.sts);
-        return -1;
-    }
+  peci_xfer(peci, &cmd);
+  print_response(&cmd);
+  return cmd.status;
 
-    if (retry_times) {
-      switch (msg.rx_buf[0]) {
-        case 0x80: // Response timeout, Data not ready
-        case 0x81: // Response timeout, not able to allocate resource
-          if (verbose) {
-            printf("CC: %02Xh, retry...\n", msg.rx_buf[0]);
-          }
-          if (retry < retry_times) {
-            retry++;
-            usleep(retry_interval*1000);
-            continue;
-          }
-          break;
-        case 0x40: // Command Passed
-        case 0x82: // Low power state
-        case 0x90: // Unknown/Invalid/Illegal Request
-        case 0x91: // Error
-        default:
-          break;
-      }
-    }
-    break;
-  } while (retry < retry_times);
-
-  if (verbose && retry_times) {
-    if (retry == retry_times)
-      printf("retry count is full.\n");
-  }
-
-  // Print the response
-  for (i = 0; i < msg.rx_len; i++) {
-    printf("%02X ", msg.rx_buf[i]);
-  }
-  printf("\n");
-
-  return 0;
 err_exit:
   printf("wrong arg:");
   for (i=0; i<argc; i++)
@@ -283,25 +341,21 @@ err_exit:
 
 int
 main(int argc, char **argv) {
-  int peci_fd = 0;
-  int timeout = 5;
+  peci_handle_t *peci;
   int ret = -1;
 
   if (pal_before_peci != NULL)
     pal_before_peci();
 
-  while ((peci_fd = open(PECI_DEVICE, O_RDWR)) < 0) {
-    if (timeout-- < 0) {
-      fprintf(stderr, "Failed to open %s\n", PECI_DEVICE);
-      return -1;
-    }
-    usleep(10*1000);
+  if ((peci = peci_open()) == NULL) {
+    fprintf(stderr, "Failed to open %s\n", PECI_DEVICE);
+    goto exit;
   }
 
-  ret = process_command(peci_fd, argc, argv);
+  ret = process_command(peci, argc, argv);
 
-  if (peci_fd)
-    close(peci_fd);
+  peci_close(peci);
+exit:
   if (pal_after_peci != NULL)
     pal_after_peci();
   return ret;
@@ -28,8 +28,13 @@
 #include <math.h>
 #include <string.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
 #include <openbmc/ipmi.h>
 #include <openbmc/sdr.h>
 #include <openbmc/pal.h>
@@ -40,10 +45,32 @@
 #define STOP_PERIOD 10
 #define MAX_SENSOR_CHECK_RETRY 3
 #define MAX_ASSERT_CHECK_RETRY 1
+#define THRESH_TOKEN_LEN 32
 
-static thresh_sensor_t g_snr[MAX_NUM_FRUS][MAX_SENSOR_NUM] = {0};
+/*
+ * Thresholds of a FRU, double buffered. The monitor evaluates
+ * snr[active]; new thresholds from threshold-util are read into the
+ * other buffer and made active by the monitor between two passes, so a
+ * pass never sees half of an update and a failed read changes nothing.
+ */
+typedef struct {
+  thresh_sensor_t snr[2][MAX_SENSOR_NUM + 1];
+  volatile int active;
+  pthread_mutex_t mutex;          // back buffer, pending and token
+  pthread_cond_t cond;            // signalled when a reload is pending
+  volatile bool pending;
+  volatile bool monitored;        // a monitor thread runs or will run for the FRU
+  char token[THRESH_TOKEN_LEN];   // threshold-util request being applied
+} fru_thresh_t;
+
+static fru_thresh_t g_fru_thresh[MAX_NUM_FRUS];
 static thresh_sensor_t g_aggregate_snr[MAX_SENSOR_NUM] = {0};
 
+// Names of the reinit flags in THRESHOLD_PATH, per FRU
+static char g_reinit_flag[MAX_NUM_FRUS][32];
+// Flags come through inotify; without it, the monitors look for them
+static bool g_thresh_watch = false;
+
 static void
 print_usage() {
     printf("Usage: sensord <options>\n");
@@ -67,7 +94,7 @@ get_struct_thresh_sensor(uint8_t fru) {
     syslog(LOG_WARNING, "get_struct_thresh_sensor: Wrong FRU ID %d\n", fru);
     return NULL;
   }
-  snr = g_snr[fru-1];
+  snr = g_fru_thresh[fru-1].snr[g_fru_thresh[fru-1].active];
   return snr;
 }
 
@@ -382,32 +409,231 @@ check_thresh_assert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
   return 0;
 }
 
+/*
+ * Read the thresholds threshold-util asked for into the back buffer of
+ * the FRU, and have the monitor make them active. The token written in
+ * the reinit flag is kept to acknowledge that very request.
+ */
 static int
-reinit_snr_threshold(uint8_t fru, int mode) {
-  int ret = 0;
-  thresh_sensor_t *snr;
+thresh_reload(uint8_t fru) {
+  fru_thresh_t *ft = &g_fru_thresh[fru-1];
+  thresh_sensor_t *back;
+  char fpath[64] = {0};
+  char fru_name[16] = {0};
+  char token[THRESH_TOKEN_LEN] = {0};
+  int fd, mode, ret;
 
-  snr = get_struct_thresh_sensor(fru);
-  if (snr == NULL) {
-#ifdef DEBUG
-    syslog(LOG_WARNING, "%s: get_struct_thresh_sensor failed",__func__);
-#endif /* DEBUG */
+  ret = pal_get_fru_name(fru, fru_name);
+  if (ret < 0) {
+    syslog(LOG_WARNING, "%s: Fail to get fru%d name", __func__, fru);
+    return -1;
+  }
+
+  sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+  fd = open(fpath, O_RDONLY);
+  if (fd >= 0) {
+    if (read(fd, token, sizeof(token) - 1) < 0)
+      token[0] = '\0';
+    close(fd);
+  }
+
+  // Without THRESHOLD_BIN, threshold-util --clear went back to the defaults
+  sprintf(fpath, THRESHOLD_BIN, fru_name);
+  mode = access(fpath, F_OK) ? SENSORD_MODE_NORMAL : SENSORD_MODE_TESTING;
+
+  pthread_mutex_lock(&ft->mutex);
+  back = ft->snr[!ft->active];
+  memcpy(back, ft->snr[ft->active], sizeof(ft->snr[0]));
+  ret = pal_get_all_thresh_from_file(fru, back, mode);
+  if (ret == 0) {
+    strcpy(ft->token, token);
+    ft->pending = true;
+    pthread_cond_signal(&ft->cond);
+  } else {
+    syslog(LOG_WARNING, "%s: Fail to get threshold from file for fru%d", __func__, fru);
+  }
+  pthread_mutex_unlock(&ft->mutex);
+
+  return ret;
+}
+
+/* Make a pending reload the active thresholds; false if there is none */
+static bool
+thresh_apply(uint8_t fru, char *token) {
+  fru_thresh_t *ft = &g_fru_thresh[fru-1];
+  thresh_sensor_t *curr, *next;
+  int i;
+
+  if (!ft->pending)
+    return false;
+
+  pthread_mutex_lock(&ft->mutex);
+  curr = ft->snr[ft->active];
+  next = ft->snr[!ft->active];
+  // The assertion state is the monitor's own, carry it over
+  for (i = 0; i <= MAX_SENSOR_NUM; i++) {
+    next[i].curr_state = curr[i].curr_state;
+  }
+  ft->active = !ft->active;
+  ft->pending = false;
+  strcpy(token, ft->token);
+  pthread_mutex_unlock(&ft->mutex);
+
+  return true;
+}
+
+/*
+ * Tell threshold-util the new thresholds are live: the reinit flag is
+ * removed once a pass has run with them, unless a newer request has
+ * been written to it since.
+ */
+static void
+thresh_ack(uint8_t fru, const char *token) {
+  char fpath[64] = {0};
+  char fru_name[16] = {0};
+  char curr[THRESH_TOKEN_LEN] = {0};
+  int fd;
+
+  if (pal_get_fru_name(fru, fru_name) < 0)
+    return;
+
+  sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+  fd = open(fpath, O_RDONLY);
+  if (fd < 0)
+    return;
+  if (read(fd, curr, sizeof(curr) - 1) < 0)
+    curr[0] = '\0';
+  close(fd);
+
+  if (!strcmp(curr, token))
+    unlink(fpath);
+}
+
+/* Sleep between two passes, or until new thresholds are pending */
+static void
+snr_monitor_wait(uint8_t fru, int secs) {
+  fru_thresh_t *ft = &g_fru_thresh[fru-1];
+  struct timeval tv;
+  struct timespec ts;
+
+  gettimeofday(&tv, NULL);
+  ts.tv_sec = tv.tv_sec + secs;
+  ts.tv_nsec = tv.tv_usec * 1000;
+
+  pthread_mutex_lock(&ft->mutex);
+  while (!ft->pending) {
+    if (pthread_cond_timedwait(&ft->cond, &ft->mutex, &ts) == ETIMEDOUT)
+      break;
+  }
+  pthread_mutex_unlock(&ft->mutex);
+}
+
+/* The FRU a reinit flag in THRESHOLD_PATH is for, 0 if none */
+static uint8_t
+thresh_flag_fru(const char *name) {
+  uint8_t fru;
+
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    if (g_reinit_flag[fru-1][0] && !strcmp(g_reinit_flag[fru-1], name))
+      return fru;
+  }
+  return 0;
+}
+
+/*
+ * threshold-util writes the reinit flag of a FRU after its threshold
+ * file; reload the FRU whenever that happens.
+ */
+static void *
+thresh_watcher(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  char buf[1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  char fpath[128];
+  uint8_t fru;
+  ssize_t len;
+  char *ptr;
+
+  while (1) {
+    len = read(fd, buf, sizeof(buf));
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR)
+        continue;
+      syslog(LOG_WARNING, "%s: inotify read failed, errno: %d", __func__, errno);
+      break;
+    }
+
+    for (ptr = buf; ptr < buf + len; ptr += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event *)ptr;
+      if (!ev->len || !(fru = thresh_flag_fru(ev->name)))
+        continue;
+      if (g_fru_thresh[fru-1].monitored) {
+        thresh_reload(fru);
+      } else {
+        // Nothing to apply, don't keep threshold-util waiting
+        snprintf(fpath, sizeof(fpath), "%s/%s", THRESHOLD_PATH, ev->name);
+        unlink(fpath);
+      }
+    }
   }
-  ret = pal_get_all_thresh_from_file(fru, snr, mode);
-  if (0 != ret) {
-    syslog(LOG_WARNING, "%s: Fail to get threshold from file for slot%d", __func__, fru);
+
+  // The monitors go back to looking for the flags
+  g_thresh_watch = false;
+  close(fd);
+  pthread_exit(NULL);
+}
+
+static int
+thresh_watch_init(uint8_t fru_flag) {
+  pthread_t tid;
+  char fpath[64];
+  char fru_name[16];
+  uint8_t fru;
+  int fd;
+
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    // A request that comes before the FRU's monitor is up waits for it
+    if (GETBIT(fru_flag, fru))
+      g_fru_thresh[fru-1].monitored = true;
+    if (pal_get_fru_name(fru, fru_name) < 0)
+      continue;
+    sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+    strncpy(g_reinit_flag[fru-1], strrchr(fpath, '/') + 1,
+        sizeof(g_reinit_flag[0]) - 1);
+  }
+
+  fd = inotify_init();
+  if (fd < 0) {
+    syslog(LOG_WARNING, "%s: inotify_init failed, errno: %d", __func__, errno);
+    return -1;
+  }
+  if (inotify_add_watch(fd, THRESHOLD_PATH, IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+      pthread_create(&tid, NULL, thresh_watcher, (void *)(intptr_t)fd) != 0) {
+    syslog(LOG_WARNING, "%s: cannot watch %s", __func__, THRESHOLD_PATH);
+    close(fd);
     return -1;
   }
+  pthread_detach(tid);
+  g_thresh_watch = true;
+
+  // Requests made before sensord was watching
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    if (!GETBIT(fru_flag, fru) || pal_get_fru_name(fru, fru_name) < 0)
+      continue;
+    sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+    if (access(fpath, F_OK) == 0)
+      thresh_reload(fru);
+  }
 
   return 0;
 }
 
+/* Without inotify, look for the reinit flag on each pass */
 static int
 thresh_reinit_chk(uint8_t fru) {
   int ret;
   char fpath[64] = {0};
-  char initpath[64] = {0};
-  char fru_name[8];
+  char fru_name[16] = {0};
 
   ret = pal_get_fru_name(fru, fru_name);
   if (ret < 0) {
@@ -415,22 +641,26 @@ thresh_reinit_chk(uint8_t fru) {
     return -1;
   }
 
-  sprintf(fpath, THRESHOLD_BIN, fru_name);
-  sprintf(initpath, THRESHOLD_RE_FLAG, fru_name);
-  if (0 != access(fpath, F_OK)) {
-    // If there is no THRESHOLD_BIN file but INIT_FLAG exist, it means threshold-util --clear is triggered.
-    // And snr info should be loaded default.
-    if (0 == access(initpath, F_OK)) {
-      ret = reinit_snr_threshold(fru, SENSORD_MODE_NORMAL);
-    }
-  } else {
-    // If THRESHOLD_BIN file exist and INIT_FLAG also exist, it means threshold-util --set is triggered.
-    // And snr info should be updated.    
-    if (0 == access(initpath, F_OK))
-      ret = reinit_snr_threshold(fru, SENSORD_MODE_TESTING);
-  }
+  sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+  if (access(fpath, F_OK) == 0)
+    return thresh_reload(fru);
 
-  return ret;
+  return 0;
+}
+
+/* A FRU without a monitor acknowledges requests right away */
+static void
+snr_monitor_exit(uint8_t fru) {
+  char fpath[64] = {0};
+  char fru_name[16] = {0};
+
+  g_fru_thresh[fru-1].monitored = false;
+  if (pal_get_fru_name(fru, fru_name) == 0) {
+    sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
+    unlink(fpath);
+  }
+  pthread_detach(pthread_self());
+  pthread_exit(NULL);
 }
 
 /*
@@ -446,22 +676,21 @@ snr_monitor(void *arg) {
   uint8_t *sensor_list, *discrete_list;
   thresh_sensor_t *snr;
   uint8_t snr_poll_interval[MAX_SENSOR_NUM] = {0};
+  char token[THRESH_TOKEN_LEN];
+  bool reloaded;
 
   ret = pal_get_fru_sensor_list(fru, &sensor_list, &sensor_cnt);
   if (ret < 0) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+    snr_monitor_exit(fru);
   }
 
   ret = pal_get_fru_discrete_list(fru, &discrete_list, &discrete_cnt);
   if (ret < 0) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+    snr_monitor_exit(fru);
   }
 
   if ((sensor_cnt == 0) && (discrete_cnt == 0)) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+    snr_monitor_exit(fru);
   }
 
   snr = get_struct_thresh_sensor(fru);
@@ -481,9 +710,18 @@ snr_monitor(void *arg) {
       continue;
     }
 
-    ret = thresh_reinit_chk(fru);
-    if (ret < 0)
-      syslog(LOG_ERR, "%s: Fail to reinit sensor threshold for fru%d",__func__,fru);
+    if (!g_thresh_watch) {
+      ret = thresh_reinit_chk(fru);
+      if (ret < 0)
+        syslog(LOG_ERR, "%s: Fail to reinit sensor threshold for fru%d",__func__,fru);
+    }
+
+    // New thresholds are checked against every sensor before the ack
+    reloaded = thresh_apply(fru, token);
+    if (reloaded) {
+      memset(snr_poll_interval, 0, sizeof(snr_poll_interval));
+    }
+    snr = get_struct_thresh_sensor(fru);
 
     for (i = 0; i < sensor_cnt; i++) {
       snr_num = sensor_list[i];
@@ -542,7 +780,11 @@ snr_monitor(void *arg) {
     }
 #endif
 
-    sleep(MIN_POLL_INTERVAL);
+    if (reloaded) {
+      thresh_ack(fru, token);
+    }
+
+    snr_monitor_wait(fru, MIN_POLL_INTERVAL);
   } /* while loop*/
 } /* function definition */
 
@@ -692,11 +934,19 @@ run_sensord(int argc, char **argv) {
   }
 
   for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    pthread_mutex_init(&g_fru_thresh[fru-1].mutex, NULL);
+    pthread_cond_init(&g_fru_thresh[fru-1].cond, NULL);
 
-    if (GETBIT(fru_flag, fru)) {
+    if (GETBIT(fru_flag, fru) && init_fru_snr_thresh(fru) < 0)
+      fru_flag = CLEARBIT(fru_flag, fru);
+  }
 
-      if (init_fru_snr_thresh(fru) < 0)
-        continue;
+  /* Threshold updates from threshold-util */
+  thresh_watch_init(fru_flag);
+
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+
+    if (GETBIT(fru_flag, fru)) {
 
       /* Threshold Sensors */
       if (pthread_create(&thread_snr[fru-1], NULL, snr_monitor,
@@ -0,0 +1,328 @@
+/*
+ * sensord threshold reload test
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openbmc/pal.h>
+
+/*
+ * The monitor of one FRU with one sensor runs against faked PAL and
+ * sensor calls, and the test does what threshold-util does to it: write
+ * a threshold file and the reinit flag, then wait for the flag to go.
+ * pal_sensor_thresh_modify() is libpal's own, so the files are in
+ * THRESHOLD_PATH, under FRU names no platform uses.
+ */
+
+// Looking for the flag is what inotify saves the monitor
+static volatile int g_access_calls;
+static int
+counted_access(const char *path, int mode) {
+  __sync_fetch_and_add(&g_access_calls, 1);
+  return access(path, mode);
+}
+#define access counted_access
+
+#define main sensord_main
+#include "../sensord.c"
+#undef main
+#undef access
+
+#define TEST_FRU      1
+#define TEST_SNR      0x10
+#define DEFAULT_UCR   90.0
+#define TESTING_UCR   50.0
+
+const char pal_fru_list[] = "all, fru1, fru2";
+
+static uint8_t g_sensor_list[] = {TEST_SNR};
+static volatile float g_val = 70.0;
+static volatile int g_load_fail;
+static volatile int g_loads;
+static volatile int g_asserts, g_deasserts;
+// Events logged after threshold-util got its ack
+static volatile int g_late_events;
+
+static int
+flag_exists(uint8_t fru) {
+  char path[64];
+
+  snprintf(path, sizeof(path), THRESHOLD_RE_FLAG, fru == 1 ? "fru1" : "fru2");
+  return access(path, F_OK) == 0;
+}
+
+int
+pal_get_fru_id(char *fru_str, uint8_t *fru) {
+  *fru = TEST_FRU;
+  return 0;
+}
+
+int
+pal_get_fru_name(uint8_t fru, char *name) {
+  if (fru < 1 || fru > 2)
+    return -1;
+  sprintf(name, "fru%d", fru);
+  return 0;
+}
+
+int
+pal_get_fru_sensor_list(uint8_t fru, uint8_t **sensor_list, int *cnt) {
+  *sensor_list = g_sensor_list;
+  *cnt = (fru == TEST_FRU) ? 1 : 0;
+  return 0;
+}
+
+int
+pal_get_fru_discrete_list(uint8_t fru, uint8_t **sensor_list, int *cnt) {
+  *sensor_list = NULL;
+  *cnt = 0;
+  return 0;
+}
+
+int
+sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr) {
+  snr->flag = SETBIT(0, UCR_THRESH);
+  snr->ucr_thresh = DEFAULT_UCR;
+  strcpy(snr->name, "TEST_TEMP");
+  strcpy(snr->units, "C");
+  return 0;
+}
+
+int
+pal_init_sensor_check(uint8_t fru, uint8_t snr_num, void *snr) {
+  return 0;
+}
+
+int
+pal_copy_all_thresh_to_file(uint8_t fru, thresh_sensor_t *sinfo) {
+  return 0;
+}
+
+int
+pal_get_thresh_from_file(uint8_t fru, uint8_t snr_num, thresh_sensor_t *sinfo) {
+  return sdr_get_snr_thresh(fru, snr_num, sinfo);
+}
+
+int
+pal_copy_thresh_to_file(uint8_t fru, uint8_t snr_num, thresh_sensor_t *sinfo) {
+  char path[64], name[16];
+  int fd;
+
+  pal_get_fru_name(fru, name);
+  snprintf(path, sizeof(path), THRESHOLD_BIN, name);
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  close(fd);
+  return 0;
+}
+
+int
+pal_get_all_thresh_from_file(uint8_t fru, thresh_sensor_t *sinfo, int mode) {
+  g_loads++;
+  // A failed read may leave half an update behind
+  sinfo[TEST_SNR].ucr_thresh = 1.0;
+  if (g_load_fail)
+    return -1;
+  sinfo[TEST_SNR].ucr_thresh =
+    (mode == SENSORD_MODE_TESTING) ? TESTING_UCR : DEFAULT_UCR;
+  return 0;
+}
+
+int
+sensor_raw_read(uint8_t fru, uint8_t sensor_num, float *value) {
+  *value = g_val;
+  return 0;
+}
+
+int
+sensor_cache_write(uint8_t fru, uint8_t sensor_num, bool available, float value) {
+  return 0;
+}
+
+void
+pal_sensor_assert_handle(uint8_t fru, uint8_t snr_num, float val, uint8_t thresh) {
+  if (!flag_exists(fru))
+    g_late_events++;
+  g_asserts++;
+}
+
+void
+pal_sensor_deassert_handle(uint8_t fru, uint8_t snr_num, float val, uint8_t thresh) {
+  if (!flag_exists(fru))
+    g_late_events++;
+  g_deasserts++;
+}
+
+void pal_update_ts_sled(void) {}
+void msleep(int msec) { usleep(msec * 1000); }
+bool pal_is_fw_update_ongoing(uint8_t fruid) { return false; }
+int pal_get_sensor_name(uint8_t fru, uint8_t sensor_num, char *name) { return -1; }
+int pal_sensor_discrete_check(uint8_t fru, uint8_t snr_num, char *snr_name,
+    uint8_t o_val, uint8_t n_val) { return 0; }
+int pal_get_fru_health(uint8_t fru, uint8_t *value) { return -1; }
+int pal_set_sensor_health(uint8_t fru, uint8_t value) { return 0; }
+int aggregate_sensor_init(const char *conf_file) { return -1; }
+int aggregate_sensor_count(size_t *count) { *count = 0; return 0; }
+int aggregate_sensor_read(size_t index, float *value) { return -1; }
+int aggregate_sensor_threshold(size_t index, thresh_sensor_t *thresh) { return -1; }
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+write_file(const char *fmt, uint8_t fru, const char *data) {
+  char path[64], name[16];
+  int fd;
+
+  pal_get_fru_name(fru, name);
+  snprintf(path, sizeof(path), fmt, name);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || write(fd, data, strlen(data)) != strlen(data)) {
+    printf("FAIL: cannot write %s\n", path);
+    exit(1);
+  }
+  close(fd);
+}
+
+static void
+remove_file(const char *fmt, uint8_t fru) {
+  char path[64], name[16];
+
+  pal_get_fru_name(fru, name);
+  snprintf(path, sizeof(path), fmt, name);
+  unlink(path);
+}
+
+/* What threshold-util waits for; the time it took, or -1 */
+static double
+wait_ack(uint8_t fru, double timeout) {
+  double start = now();
+
+  while (flag_exists(fru)) {
+    if (now() - start > timeout)
+      return -1;
+    usleep(1000);
+  }
+  return now() - start;
+}
+
+static float
+live_ucr(void) {
+  return get_struct_thresh_sensor(TEST_FRU)[TEST_SNR].ucr_thresh;
+}
+
+#define CHECK(cond, ...) do { \
+  if (!(cond)) { \
+    printf("FAIL: " __VA_ARGS__); \
+    printf("\n"); \
+    exit(1); \
+  } \
+} while (0)
+
+int
+main(int argc, char **argv) {
+  pthread_t tid;
+  double lat;
+  int calls, loads;
+  uint8_t fru;
+
+  mkdir(THRESHOLD_PATH, 0777);
+  remove_file(THRESHOLD_BIN, TEST_FRU);
+  remove_file(THRESHOLD_RE_FLAG, TEST_FRU);
+  remove_file(THRESHOLD_RE_FLAG, 2);
+
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    pthread_mutex_init(&g_fru_thresh[fru-1].mutex, NULL);
+    pthread_cond_init(&g_fru_thresh[fru-1].cond, NULL);
+  }
+  CHECK(init_fru_snr_thresh(TEST_FRU) == 0, "init_fru_snr_thresh");
+  CHECK(thresh_watch_init(SETBIT(0, TEST_FRU)) == 0, "thresh_watch_init");
+
+  /* A request before the monitor is up waits for it, not acknowledged unapplied */
+  write_file(THRESHOLD_RE_FLAG, TEST_FRU, "99");
+  CHECK(wait_ack(TEST_FRU, 0.2) < 0, "acknowledged before the monitor ran");
+  CHECK(pthread_create(&tid, NULL, snr_monitor, (void *)(uintptr_t)TEST_FRU) == 0,
+        "pthread_create");
+  CHECK(wait_ack(TEST_FRU, 5) >= 0, "early request was not acknowledged");
+
+  /* Idle passes don't look for the flag */
+  sleep(1);
+  calls = g_access_calls;
+  sleep(2 * MIN_POLL_INTERVAL);
+  CHECK(g_access_calls == calls, "%d access() calls while idle",
+        g_access_calls - calls);
+  CHECK(g_asserts == 0 && live_ucr() == DEFAULT_UCR, "unexpected assert");
+
+  /* threshold-util --set */
+  write_file(THRESHOLD_BIN, TEST_FRU, "thresholds");
+  write_file(THRESHOLD_RE_FLAG, TEST_FRU, "100");
+  lat = wait_ack(TEST_FRU, 5);
+  CHECK(lat >= 0, "set was not acknowledged");
+  CHECK(g_asserts == 1 && live_ucr() == TESTING_UCR, "set not applied");
+  printf("set: acknowledged in %.1f ms, assert logged first\n", lat * 1e3);
+  CHECK(lat < MIN_POLL_INTERVAL / 2.0, "set took %.1f ms", lat * 1e3);
+
+  /* A read that fails leaves the live thresholds alone, unacknowledged */
+  g_load_fail = 1;
+  write_file(THRESHOLD_RE_FLAG, TEST_FRU, "101");
+  CHECK(wait_ack(TEST_FRU, MIN_POLL_INTERVAL + 1) < 0, "failed read acknowledged");
+  CHECK(live_ucr() == TESTING_UCR && g_deasserts == 0,
+        "failed read changed the thresholds to %.2f", live_ucr());
+  printf("failed read: live thresholds unchanged\n");
+  g_load_fail = 0;
+
+  /* threshold-util --clear, over the pending request */
+  remove_file(THRESHOLD_BIN, TEST_FRU);
+  write_file(THRESHOLD_RE_FLAG, TEST_FRU, "102");
+  lat = wait_ack(TEST_FRU, 5);
+  CHECK(lat >= 0, "clear was not acknowledged");
+  CHECK(g_deasserts == 1 && live_ucr() == DEFAULT_UCR, "clear not applied");
+  printf("clear: acknowledged in %.1f ms, deassert logged first\n", lat * 1e3);
+  CHECK(g_late_events == 0, "%d events logged after the ack", g_late_events);
+
+  /* threshold-util --set through the PAL: only its token asks for a reload */
+  loads = g_loads;
+  write_file(THRESHOLD_BIN, TEST_FRU, "thresholds");
+  CHECK(pal_sensor_thresh_modify(TEST_FRU, TEST_SNR, UCR_THRESH, TESTING_UCR) == 0,
+        "pal_sensor_thresh_modify");
+  CHECK(!flag_exists(TEST_FRU), "the PAL made the reinit flag");
+  usleep(100 * 1000);
+  write_file(THRESHOLD_RE_FLAG, TEST_FRU, "104");
+  CHECK(wait_ack(TEST_FRU, 5) >= 0, "PAL set was not acknowledged");
+  CHECK(g_loads == loads + 1 && live_ucr() == TESTING_UCR,
+        "PAL set: %d reloads", g_loads - loads);
+  printf("PAL set: one reload, for the token\n");
+
+  /* A FRU sensord doesn't monitor is acknowledged right away */
+  write_file(THRESHOLD_RE_FLAG, 2, "103");
+  CHECK(wait_ack(2, 1) >= 0, "unmonitored FRU not acknowledged");
+
+  remove_file(THRESHOLD_BIN, TEST_FRU);
+  printf("All tests passed\n");
+  return 0;
+}
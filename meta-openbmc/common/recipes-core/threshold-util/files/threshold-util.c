@@ -26,9 +26,16 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/time.h>
 #include <openbmc/pal.h>
 #include <openbmc/sdr.h>
 
+// How long sensord gets to make new thresholds live
+#define THRESH_ACK_TIMEOUT 10000 // msec
+
 enum {
   UCR = 0x01,
   UNC,
@@ -81,11 +88,15 @@ is_fru_valid(uint8_t fru) {
   return 0;
 }
 
+/*
+ * Ask sensord to reload the thresholds of fru: the reinit flag holds a
+ * token of this request, and sensord removes it once they are live.
+ */
 static int
-clear_thresh_value_setting(uint8_t fru) {
-  int ret;
+request_thresh_reload(uint8_t fru) {
+  int fd, ret;
   char fpath[64] = {0};
-  char cmd[128] = {0};
+  char token[16] = {0};
   char fruname[16] = {0};
 
   ret = pal_get_fru_name(fru, fruname);
@@ -93,20 +104,89 @@ clear_thresh_value_setting(uint8_t fru) {
     printf("%s: Fail to get fru%d name\n",__func__,fru);
     return ret;
   }
-  
-  memset(fpath, 0, sizeof(fpath));
-  sprintf(fpath, THRESHOLD_BIN, fruname);
-  sprintf(cmd,"rm -rf %s",fpath);
-  system(cmd);
 
-  memset(fpath, 0, sizeof(fpath));
   sprintf(fpath, THRESHOLD_RE_FLAG, fruname);
-  sprintf(cmd,"touch %s",fpath);
-  system(cmd); 
+  sprintf(token, "%d", getpid());
+  fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    printf("%s: Fail to create %s\n", __func__, fpath);
+    return -1;
+  }
+  if (write(fd, token, strlen(token)) != strlen(token)) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
 
   return 0;
 }
 
+static long long
+now_ms(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * Wait for sensord to acknowledge the reloads of the FRUs in fru_flag,
+ * ifd watching THRESHOLD_PATH for removals since before they were asked.
+ */
+static int
+wait_thresh_ack(int ifd, uint32_t fru_flag) {
+  char buf[1024];
+  char fpath[64];
+  char fruname[16];
+  struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+  long long deadline = now_ms() + THRESH_ACK_TIMEOUT;
+  long long left;
+  uint8_t fru;
+
+  while (1) {
+    for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+      if (!(fru_flag & (1 << fru)) || pal_get_fru_name(fru, fruname) < 0)
+        continue;
+      sprintf(fpath, THRESHOLD_RE_FLAG, fruname);
+      if (access(fpath, F_OK) != 0)
+        fru_flag &= ~(1 << fru);
+    }
+    if (!fru_flag)
+      return 0;
+
+    left = deadline - now_ms();
+    if (ifd < 0 || left <= 0 || poll(&pfd, 1, left) <= 0)
+      break;
+    if (read(ifd, buf, sizeof(buf)) < 0)
+      break;
+  }
+
+  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
+    if (fru_flag & (1 << fru))
+      printf("sensord did not apply the thresholds of fru%d yet\n", fru);
+  }
+  return -1;
+}
+
+static int
+clear_thresh_value_setting(uint8_t fru) {
+  int ret;
+  char fpath[64] = {0};
+  char fruname[16] = {0};
+
+  ret = pal_get_fru_name(fru, fruname);
+  if (ret < 0) {
+    printf("%s: Fail to get fru%d name\n",__func__,fru);
+    return ret;
+  }
+
+  // Without its threshold file, sensord goes back to the defaults
+  sprintf(fpath, THRESHOLD_BIN, fruname);
+  unlink(fpath);
+
+  return request_thresh_reload(fru);
+}
+
 int
 main(int argc, char **argv) {
   uint8_t fru;
@@ -116,6 +196,8 @@ main(int argc, char **argv) {
   int errno, ret = -1;
   char cmd[128] = {0};  
   char *fru_name = NULL;
+  uint32_t fru_flag = 0;
+  int ifd;
 
   // Check for border conditions
   if ((argc != 3) && (argc != 6)) {
@@ -135,6 +217,13 @@ main(int argc, char **argv) {
     return ret;
   }
 
+  // Watch for sensord's acknowledgements before asking for anything
+  ifd = inotify_init();
+  if (ifd >= 0 && inotify_add_watch(ifd, THRESHOLD_PATH, IN_DELETE) < 0) {
+    close(ifd);
+    ifd = -1;
+  }
+
   if (!(strcmp(argv[2], "--set"))) {
     if (!strcmp(argv[4], "UCR")) {
       thresh_type = UCR;
@@ -167,6 +256,8 @@ main(int argc, char **argv) {
         ret = pal_sensor_thresh_modify(fru, snr_num, thresh_type, threshold_value);
         if (ret < 0)
           printf("Fail to set sensor 0x%x threshold for fru%d\n", snr_num, fru);
+        else if (request_thresh_reload(fru) == 0)
+          fru_flag |= 1 << fru;
       }
     } else {
       if (!pal_is_sensor_existing(fru, snr_num)) {
@@ -176,7 +267,10 @@ main(int argc, char **argv) {
       ret = pal_sensor_thresh_modify(fru, snr_num, thresh_type, threshold_value);
       if (ret < 0)
         printf("Fail to set sensor 0x%x threshold for fru%d\n", snr_num, fru);
+      else if (request_thresh_reload(fru) == 0)
+        fru_flag |= 1 << fru;
     }
+    wait_thresh_ack(ifd, fru_flag);
   } else if (!(strcmp(argv[2], "--clear"))) {
     fru_name = argv[1];
     if (FRU_ALL == fru) { // For FRU ALL
@@ -185,29 +279,27 @@ main(int argc, char **argv) {
         ret |= clear_thresh_value_setting(fru);
         if (ret < 0) {
           printf("Fail to clear threshold for fru%d\n", fru);
-        } 
-      }
-
-      if (0 == ret) {
-        // sleep 6 seconds to avoid test deassert events
-        sleep(6);
-        memset(cmd, 0, sizeof(cmd));
-        sprintf(cmd,"/usr/local/bin/log-util %s --clear", fru_name);
-        system(cmd);
+        } else {
+          fru_flag |= 1 << fru;
+        }
       }
     } else {
       ret = clear_thresh_value_setting(fru);
       if (ret < 0) {
         printf("Fail to clear threshold for fru%d\n", fru);
       } else {
-        // sleep 6 seconds to avoid test deassert events
-        sleep(6);
-
-        memset(cmd, 0, sizeof(cmd));
-        sprintf(cmd,"/usr/local/bin/log-util %s --clear", fru_name);
-        system(cmd);
+        fru_flag |= 1 << fru;
       }
     }
+
+    if (0 == ret) {
+      // The deasserts of the test thresholds are logged by the time sensord
+      // acknowledges, so they go with the rest
+      wait_thresh_ack(ifd, fru_flag);
+      memset(cmd, 0, sizeof(cmd));
+      sprintf(cmd,"/usr/local/bin/log-util %s --clear", fru_name);
+      system(cmd);
+    }
   } else {
     print_usage_help();
     return -1;
@@ -45,15 +45,32 @@ typedef struct {
   size_t formula_index;
 } value_map_element_type;
 
+/* Sources an expression reads, as indexes in aggregate_sensor_t::sources */
+typedef struct {
+  size_t num;
+  size_t *idx;
+} source_list_type;
+
 typedef struct {
   thresh_sensor_t sensor;
   size_t idx;
   size_t num_expressions;
   expression_type **expressions;
+  source_list_type *expression_sources;
+  /* Distinct (fru, id) of all the variables, each read once per read */
+  size_t num_sources;
+  struct sensor_src *sources;
+  /* Variable i of the expressions is sources[var_source[i]] */
+  size_t num_vars;
+  size_t *var_source;
   char cond_key[MAX_KEY_LEN];
   size_t value_map_size;
   value_map_element_type value_map[MAX_CONDITIONALS];
   int default_expression_idx; /* -1 == invalid */
+  /* expression chosen for cond_key as of edb generation cond_gen */
+  bool cond_cached;
+  uint32_t cond_gen;
+  int cond_expression_idx; /* -1 == none */
 } aggregate_sensor_t;
 
 extern size_t g_sensors_count;
@@ -125,6 +125,56 @@ bail:
   return NULL;
 }
 
+/* Collect the distinct (fru, id) of the variables, so a source named
+ * twice is still read once per aggregate read */
+static int load_sources(aggregate_sensor_t *snr, variable_type *vars, size_t num_vars)
+{
+  size_t i, j;
+
+  snr->num_vars = num_vars;
+  snr->var_source = calloc(num_vars, sizeof(size_t));
+  snr->sources = calloc(num_vars, sizeof(struct sensor_src));
+  if (!snr->var_source || !snr->sources) {
+    return -1;
+  }
+  for (i = 0; i < num_vars; i++) {
+    struct sensor_src *src = (struct sensor_src *)vars[i].state;
+    for (j = 0; j < snr->num_sources; j++) {
+      if (snr->sources[j].fru == src->fru && snr->sources[j].id == src->id) {
+        break;
+      }
+    }
+    if (j == snr->num_sources) {
+      snr->sources[snr->num_sources++] = *src;
+    }
+    snr->var_source[i] = j;
+  }
+  return 0;
+}
+
+/* The sources expression[idx] reads, each once */
+static int load_expression_sources(aggregate_sensor_t *snr, size_t idx)
+{
+  source_list_type *list = &snr->expression_sources[idx];
+  size_t vars[snr->num_vars];
+  size_t num, i, j;
+
+  num = expression_variables(snr->expressions[idx], vars, snr->num_vars);
+  list->idx = calloc(num ? num : 1, sizeof(size_t));
+  if (!list->idx) {
+    return -1;
+  }
+  for (i = 0; i < num; i++) {
+    size_t src = snr->var_source[vars[i]];
+    for (j = 0; j < list->num && list->idx[j] != src; j++)
+      ;
+    if (j == list->num) {
+      list->idx[list->num++] = src;
+    }
+  }
+  return 0;
+}
+
 /* Parse SENSORS[X]::composition if it is of type
  * "conditional_linear_expression". */
 static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
@@ -141,6 +191,10 @@ static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
   if (!vars) {
     return -1;
   }
+  if (load_sources(snr, vars, num_vars)) {
+    DEBUG("Allocation failure");
+    goto bail_linear_exp;
+  }
 
   tmp = json_object_get(obj, "linear_expressions");
   if (!tmp) {
@@ -151,8 +205,11 @@ static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
   snr->num_expressions = json_object_size(tmp);
   /* array of pointers to expressions */
   snr->expressions = calloc(snr->num_expressions, sizeof(expression_type *));
-  if (!snr->expressions) {
+  snr->expression_sources = calloc(snr->num_expressions, sizeof(source_list_type));
+  if (!snr->expressions || !snr->expression_sources) {
     DEBUG("Allocation failure");
+    free(snr->expressions);
+    free(snr->expression_sources);
     goto bail_linear_exp;
   }
 
@@ -174,6 +231,10 @@ static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
       DEBUG("Expression[%zu] parsing failed!\n", i);
       goto bail_exp_parse;
     }
+    if (load_expression_sources(snr, i)) {
+      DEBUG("Allocation failure");
+      goto bail_exp_parse;
+    }
   }
   /* This should never happen */
   assert(!iter);
@@ -212,6 +273,7 @@ static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
   }
   snr->value_map_size = i;
   snr->default_expression_idx = -1;
+  snr->cond_cached = false;
   if ((tmp = json_object_get(tmp, "default_expression")) != NULL &&
       json_is_string(tmp)) {
     size_t idx;
@@ -228,9 +290,13 @@ bail_exp_parse:
     if (snr->expressions[i]) {
       expression_destroy(snr->expressions[i]);
     }
+    free(snr->expression_sources[i].idx);
   }
   free(snr->expressions);
+  free(snr->expression_sources);
 bail_linear_exp:
+  free(snr->sources);
+  free(snr->var_source);
   cleanup_vars(vars, num_vars);
   return -1;
 }
@@ -56,36 +56,75 @@ aggregate_sensor_count(size_t *count)
   return 0;
 }
 
-int
-aggregate_sensor_read(size_t index, float *value)
+/* Index of the expression for the current value of cond_key, -1 if
+ * there is none. The choice is kept until the edb generation moves. */
+static int
+get_expression_idx(aggregate_sensor_t *snr)
 {
   char cond_value[MAX_VALUE_LEN];
+  int f_idx = snr->default_expression_idx;
+  uint32_t gen;
+  bool have_gen = edb_cache_generation(&gen) == 0;
   size_t i;
+
+  if (have_gen && snr->cond_cached && snr->cond_gen == gen) {
+    return snr->cond_expression_idx;
+  }
+  if (edb_cache_get(snr->cond_key, cond_value)) {
+    DEBUG("key: %s not available\n", snr->cond_key);
+  } else {
+    for (i = 0; i < snr->value_map_size; i++) {
+      if (!strncmp(snr->value_map[i].condition_value, cond_value,
+            sizeof(snr->value_map[i].condition_value))) {
+        f_idx = (int)snr->value_map[i].formula_index;
+        break;
+      }
+    }
+  }
+  snr->cond_expression_idx = f_idx;
+  if (have_gen) {
+    snr->cond_gen = gen;
+  }
+  snr->cond_cached = have_gen;
+  return f_idx;
+}
+
+int
+aggregate_sensor_read(size_t index, float *value)
+{
   aggregate_sensor_t *snr;
+  source_list_type *list;
+  int f_idx, ret;
+  size_t i;
+
   if (index >= g_sensors_count) {
     return -1;
   }
   snr = &g_sensors[index];
-  if (edb_cache_get(snr->cond_key, cond_value)) {
-    if (snr->default_expression_idx != -1) {
-      size_t f_idx = snr->default_expression_idx;
-      return expression_evaluate(snr->expressions[f_idx], value);
-    }
-    DEBUG("key: %s not available\n", snr->cond_key);
+  if ((f_idx = get_expression_idx(snr)) < 0) {
     return -1;
   }
-  for (i = 0; i < snr->value_map_size; i++) {
-    if (!strncmp(snr->value_map[i].condition_value, cond_value,
-          sizeof(snr->value_map[i].condition_value))) {
-      size_t f_idx = snr->value_map[i].formula_index;
-      return expression_evaluate(snr->expressions[f_idx], value);
+
+  /* Snapshot the sources the expression needs, each read once
+   * however many variables name it, then evaluate on the copy */
+  {
+    float snap[snr->num_sources];
+    float values[snr->num_vars];
+
+    memset(snap, 0, sizeof(snap));
+    list = &snr->expression_sources[f_idx];
+    for (i = 0; i < list->num; i++) {
+      struct sensor_src *src = &snr->sources[list->idx[i]];
+      ret = sensor_cache_read(src->fru, src->id, &snap[list->idx[i]]);
+      if (ret) {
+        return ret;
+      }
     }
+    for (i = 0; i < snr->num_vars; i++) {
+      values[i] = snap[snr->var_source[i]];
+    }
+    return expression_evaluate_values(snr->expressions[f_idx], values, value);
   }
-  if (snr->default_expression_idx != -1) {
-    size_t f_idx = (size_t)snr->default_expression_idx;
-    return expression_evaluate(snr->expressions[f_idx], value);
-  }
-  return -1;
 }
 
 int
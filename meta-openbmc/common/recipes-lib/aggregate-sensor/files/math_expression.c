@@ -18,251 +18,523 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 #include "math_expression.h"
 
-typedef enum {
-  TERM_VARIABLE,
-  TERM_CONSTANT
-} term_type;
-
-typedef struct {
-  term_type type;
-  union {
-    variable_type var;
-    float         constant;
-  } term;
-} expression_term_type;
+#define MAX_TOKEN_LEN 64
 
 typedef enum {
-  OP_INVALID = 0, /* No R value */
+  OP_CONSTANT = 0, /* push constant */
+  OP_VARIABLE, /* push variable */
+  OP_NEGATE, /* - A */
   OP_ADD, /* L + R */
   OP_SUBTRACT, /* L - R */
-  OP_MULTIPLY /* L * R */
+  OP_MULTIPLY, /* L * R */
+  OP_DIVIDE, /* L / R */
+  OP_MIN, /* min(A0, A1, ...) */
+  OP_MAX, /* max(A0, A1, ...) */
+  OP_AVG /* avg(A0, A1, ...) */
 } operator_type;
 
-struct expression_type_s {
+/* Parse tree, kept for expression_print() */
+typedef struct expression_node_s {
   operator_type type;
-  expression_term_type *left_exp_term;
-  expression_type      *left_exp_group;
-  expression_term_type *right_exp_term;
-  expression_type      *right_exp_group;
-  expression_type      *parent;
+  float constant;
+  size_t var;
+  size_t num_args;
+  struct expression_node_s *args[];
+} expression_node;
+
+/* One instruction of the compiled program. Operators pop their
+ * num_args operands and push the result. */
+typedef struct {
+  uint8_t op;
+  uint16_t num_args;
+  union {
+    float constant;
+    uint32_t var;
+  };
+} instruction_type;
+
+struct expression_type_s {
+  expression_node *tree;
+  instruction_type *code;
+  size_t code_len;
+  /* Stack slots the program needs */
+  size_t depth;
+  variable_type *vars;
+  size_t num_vars;
+  /* Distinct variables used, in order of first use */
+  size_t *used;
+  size_t num_used;
 };
 
-static operator_type get_operator(char *str)
-{
-  operator_type op;
+typedef enum {
+  TOK_END,
+  TOK_NUMBER,
+  TOK_NAME,
+  TOK_CHAR
+} token_kind;
 
-  if (str[1] != '\0') {
-    return OP_INVALID;
-  }
+typedef struct {
+  const char *pos;
+  token_kind kind;
+  char token[MAX_TOKEN_LEN];
+  variable_type *vars;
+  size_t num_vars;
+} parser_type;
 
-  switch(str[0]) {
-    case '+':
-      op = OP_ADD;
-      break;
-    case '-':
-      op = OP_SUBTRACT;
-      break;
-    case '*':
-      op = OP_MULTIPLY;
-      break;
-    default:
-      op = OP_INVALID;
-      break;
-  }
-  return op;
+static const char *func_names[] = {
+  [OP_MIN] = "min",
+  [OP_MAX] = "max",
+  [OP_AVG] = "avg",
+};
+
+static bool is_name_char(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '.';
 }
 
-static bool is_constant(char *str)
+/* Advance to the next token: a number, a name or a single
+ * character (operator, parenthesis, comma) */
+static bool next_token(parser_type *p)
 {
-  bool period_done = false;
-  while(*str) {
-    if (period_done == false && *str == '.') {
-      period_done = true;
-    } else if (!isdigit(*str)) {
+  size_t len = 0;
+
+  while (isspace((unsigned char)*p->pos)) {
+    p->pos++;
+  }
+  if (*p->pos == '\0') {
+    p->kind = TOK_END;
+    p->token[0] = '\0';
+    return true;
+  }
+  if (!is_name_char(*p->pos)) {
+    p->kind = TOK_CHAR;
+    p->token[0] = *p->pos++;
+    p->token[1] = '\0';
+    return true;
+  }
+  p->kind = isdigit((unsigned char)*p->pos) || *p->pos == '.' ?
+    TOK_NUMBER : TOK_NAME;
+  while (is_name_char(*p->pos)) {
+    if (len == sizeof(p->token) - 1) {
       return false;
     }
-    str++;
+    p->token[len++] = *p->pos++;
   }
+  p->token[len] = '\0';
   return true;
 }
 
-static expression_type *alloc_expression(expression_type *parent)
+static bool is_char(parser_type *p, char c)
+{
+  return p->kind == TOK_CHAR && p->token[0] == c;
+}
+
+static expression_node *alloc_node(operator_type type, size_t num_args)
 {
-  expression_type *o = calloc(1, sizeof(expression_type));
-  if (!o) {
+  expression_node *n = calloc(1, sizeof(expression_node) +
+      num_args * sizeof(expression_node *));
+  if (!n) {
     return NULL;
   }
-  o->parent = parent;
-  return o;
+  n->type = type;
+  n->num_args = num_args;
+  return n;
 }
 
-static expression_term_type *alloc_expression_term(char *name, variable_type *va, int num)
+static void free_node(expression_node *n)
 {
-  int i;
-  expression_term_type *term = calloc(1, sizeof(expression_term_type));
-  if (!term) {
-    return NULL;
+  size_t i;
+
+  if (!n) {
+    return;
   }
-  term->type = is_constant(name) ? TERM_CONSTANT : TERM_VARIABLE;
-  if (term->type == TERM_CONSTANT) {
-    term->term.constant = atof(name);
-  } else {
-    /* Look for the variable name in the list and copy it over */
-    for (i = 0; i < num; i++) {
-      if (!strncmp(name, va[i].name, sizeof(va[i].name))) {
-        term->term.var = va[i];
-        break;
-      }
-    }
-    assert(i < num);
+  for (i = 0; i < n->num_args; i++) {
+    free_node(n->args[i]);
   }
-  return term;
+  free(n);
 }
 
-static int expression_term_evaluate(expression_term_type *term, float *value)
+static expression_node *binary_node(operator_type type,
+    expression_node *l, expression_node *r)
 {
-  if (term->type == TERM_CONSTANT) {
-    *value = term->term.constant;
-    return 0;
+  expression_node *n;
+
+  if (!l || !r || !(n = alloc_node(type, 2))) {
+    free_node(l);
+    free_node(r);
+    return NULL;
   }
-  return term->term.var.value(term->term.var.state, value);
+  n->args[0] = l;
+  n->args[1] = r;
+  return n;
 }
 
-expression_type *expression_parse(const char *user_str, variable_type *vars, size_t num)
+static expression_node *parse_sum(parser_type *p);
+
+/* func '(' sum [',' sum]* ')' with the current token on '(' */
+static expression_node *parse_function(parser_type *p, operator_type type)
 {
-  char *token, *saveptr;
-  expression_type *tmp, *current = NULL, *ret = NULL;
-  char *str;
+  expression_node **args = NULL, **tmp, *n = NULL;
+  size_t num = 0, i;
 
-  str = calloc(strlen(user_str) + 1, 1);
-  if (!str) {
-    return NULL;
+  do {
+    if (!next_token(p) || num == UINT16_MAX) {
+      goto bail;
+    }
+    tmp = realloc(args, (num + 1) * sizeof(*args));
+    if (!tmp) {
+      goto bail;
+    }
+    args = tmp;
+    if (!(args[num] = parse_sum(p))) {
+      goto bail;
+    }
+    num++;
+  } while (is_char(p, ','));
+
+  if (!is_char(p, ')') || !next_token(p)) {
+    goto bail;
+  }
+  if ((n = alloc_node(type, num))) {
+    memcpy(n->args, args, num * sizeof(*args));
+    free(args);
+    return n;
   }
-  strcpy(str, user_str);
+bail:
+  for (i = 0; i < num; i++) {
+    free_node(args[i]);
+  }
+  free(args);
+  return NULL;
+}
 
-  ret = current = alloc_expression(NULL);
-  if (!current) {
-    free(str);
+/* number | variable | function | '(' sum ')' | '-' primary */
+static expression_node *parse_primary(parser_type *p)
+{
+  expression_node *n;
+  char *end;
+  size_t i;
+
+  if (is_char(p, '-')) {
+    if (!next_token(p) || !(n = alloc_node(OP_NEGATE, 1))) {
+      return NULL;
+    }
+    if (!(n->args[0] = parse_primary(p))) {
+      free(n);
+      return NULL;
+    }
+    return n;
+  }
+  if (is_char(p, '(')) {
+    if (!next_token(p) || !(n = parse_sum(p))) {
+      return NULL;
+    }
+    if (!is_char(p, ')') || !next_token(p)) {
+      free_node(n);
+      return NULL;
+    }
+    return n;
+  }
+  if (p->kind == TOK_NUMBER) {
+    if (!(n = alloc_node(OP_CONSTANT, 0))) {
+      return NULL;
+    }
+    n->constant = strtof(p->token, &end);
+    if (*end != '\0' || !next_token(p)) {
+      free(n);
+      return NULL;
+    }
+    return n;
+  }
+  if (p->kind != TOK_NAME) {
+    return NULL;
+  }
+  for (i = OP_MIN; i <= OP_AVG; i++) {
+    if (!strcmp(p->token, func_names[i])) {
+      const char *save = p->pos;
+      if (!next_token(p)) {
+        return NULL;
+      }
+      if (is_char(p, '(')) {
+        return parse_function(p, i);
+      }
+      /* Not a call, just a variable which happens to be named so */
+      p->pos = save;
+      strcpy(p->token, func_names[i]);
+      p->kind = TOK_NAME;
+      break;
+    }
+  }
+  for (i = 0; i < p->num_vars; i++) {
+    if (!strncmp(p->token, p->vars[i].name, sizeof(p->vars[i].name))) {
+      break;
+    }
+  }
+  if (i == p->num_vars || !(n = alloc_node(OP_VARIABLE, 0))) {
     return NULL;
   }
+  n->var = i;
+  if (!next_token(p)) {
+    free(n);
+    return NULL;
+  }
+  return n;
+}
 
-  for(token = strtok_r(str, " \n", &saveptr);
-      token != NULL;
-      token = strtok_r(NULL, " \n", &saveptr)) {
+/* primary [('*' | '/') primary]* */
+static expression_node *parse_product(parser_type *p)
+{
+  expression_node *n = parse_primary(p);
 
-    assert(current);
+  while (n && (is_char(p, '*') || is_char(p, '/'))) {
+    operator_type type = is_char(p, '*') ? OP_MULTIPLY : OP_DIVIDE;
+    if (!next_token(p)) {
+      free_node(n);
+      return NULL;
+    }
+    n = binary_node(type, n, parse_primary(p));
+  }
+  return n;
+}
 
-    if (!strncmp(token, "(", 2)) {
-      /* Start a new group and set it as current */
-      current = alloc_expression(current);
-      if (!current) {
-        goto free_bail;
-      }
-    } else if (!strncmp(token, ")", 2)) {
-      expression_type *parent = current->parent;
-      /* Close the current group, set it as the parent's
-       * left (if empty) or right term and finally set
-       * the parent as the current group. */
-      if (parent->left_exp_term == NULL && parent->left_exp_group == NULL) {
-        parent->left_exp_group = current;
-      } else if (parent->right_exp_term == NULL && parent->right_exp_group == NULL) {
-        parent->right_exp_group = current;
-      } 
-      current = parent;
-    } else if(get_operator(token) != OP_INVALID) {
-      if (current->type == OP_INVALID) {
-        /* Simple case, we have parsed the left term
-         * and just parsing the operator. Just set it */
-        current->type = get_operator(token);
-      } else {
-        /* If the current expression is already a valid
-         * operation, then this is the second + in a + b + c.
-         * Thus, artificially close the current group, create
-         * a parent group with the left expression as the current
-         * group and then set the new one as the current with
-         * its operator set to the freshly parsed operator */
-        tmp = alloc_expression(current->parent);
-        if (!tmp) {
-          goto free_bail;
+/* product [('+' | '-') product]* */
+static expression_node *parse_sum(parser_type *p)
+{
+  expression_node *n = parse_product(p);
+
+  while (n && (is_char(p, '+') || is_char(p, '-'))) {
+    operator_type type = is_char(p, '+') ? OP_ADD : OP_SUBTRACT;
+    if (!next_token(p)) {
+      free_node(n);
+      return NULL;
+    }
+    n = binary_node(type, n, parse_product(p));
+  }
+  return n;
+}
+
+/* Result of an operator given its operands. Shared by the program and
+ * constant folding so both compute exactly the same */
+static float apply(operator_type op, const float *args, size_t num)
+{
+  float ret;
+  size_t i;
+
+  switch (op) {
+    case OP_NEGATE:
+      return -args[0];
+    case OP_ADD:
+      return args[0] + args[1];
+    case OP_SUBTRACT:
+      return args[0] - args[1];
+    case OP_MULTIPLY:
+      return args[0] * args[1];
+    case OP_DIVIDE:
+      return args[0] / args[1];
+    case OP_MIN:
+    case OP_MAX:
+      ret = args[0];
+      for (i = 1; i < num; i++) {
+        if (op == OP_MIN ? args[i] < ret : args[i] > ret) {
+          ret = args[i];
         }
-        tmp->left_exp_group = current;
-        current->parent = tmp;
-        tmp->type = get_operator(token);
-        current = tmp;
       }
-    } else {
-      expression_term_type *term = alloc_expression_term(token, vars, num);
-      if (!term) {
-        goto free_bail;
+      return ret;
+    case OP_AVG:
+      ret = 0;
+      for (i = 0; i < num; i++) {
+        ret += args[i];
       }
-      /* This is either a variable or a constant. Allocate
-       * a expression term and set it as the left (if available) or
-       * right of the current expression group */
-      if (current->left_exp_term == NULL && current->left_exp_group == NULL) {
-        current->left_exp_term = term;
-      } else if (current->right_exp_term == NULL && current->right_exp_term == NULL) {
-        current->right_exp_term = term;
-      } else {
-        assert(0);
+      return ret / num;
+    default:
+      assert(0);
+  }
+  return 0;
+}
+
+/* Emit the program for n after what is at code[*len], post order.
+ * An operator whose operands all turned out constant is replaced by
+ * its result. */
+static void compile(expression_type *exp, expression_node *n, size_t *len,
+    size_t *depth)
+{
+  instruction_type *code = exp->code;
+  size_t i, start = *len, base = *depth;
+
+  if (n->type == OP_CONSTANT || n->type == OP_VARIABLE) {
+    code[*len].op = n->type;
+    code[*len].num_args = 0;
+    if (n->type == OP_CONSTANT) {
+      code[*len].constant = n->constant;
+    } else {
+      code[*len].var = n->var;
+    }
+    (*len)++;
+    if (++(*depth) > exp->depth) {
+      exp->depth = *depth;
+    }
+    return;
+  }
+
+  for (i = 0; i < n->num_args; i++) {
+    compile(exp, n->args[i], len, depth);
+  }
+  *depth = base + 1;
+
+  if (*len - start == n->num_args) {
+    float args[n->num_args];
+    for (i = 0; i < n->num_args && code[start + i].op == OP_CONSTANT; i++) {
+      args[i] = code[start + i].constant;
+    }
+    if (i == n->num_args) {
+      code[start].op = OP_CONSTANT;
+      code[start].num_args = 0;
+      code[start].constant = apply(n->type, args, n->num_args);
+      *len = start + 1;
+      return;
+    }
+  }
+  code[*len].op = n->type;
+  code[*len].num_args = n->num_args;
+  (*len)++;
+}
+
+static size_t count_nodes(expression_node *n)
+{
+  size_t i, count = 1;
+
+  for (i = 0; i < n->num_args; i++) {
+    count += count_nodes(n->args[i]);
+  }
+  return count;
+}
+
+static int build(expression_type *exp)
+{
+  size_t i, j, len = 0, depth = 0;
+
+  exp->code = calloc(count_nodes(exp->tree), sizeof(instruction_type));
+  exp->used = calloc(exp->num_vars ? exp->num_vars : 1, sizeof(size_t));
+  if (!exp->code || !exp->used) {
+    return -1;
+  }
+  compile(exp, exp->tree, &len, &depth);
+  exp->code_len = len;
+
+  for (i = 0; i < len; i++) {
+    if (exp->code[i].op != OP_VARIABLE) {
+      continue;
+    }
+    for (j = 0; j < exp->num_used; j++) {
+      if (exp->used[j] == exp->code[i].var) {
+        break;
       }
     }
+    if (j == exp->num_used) {
+      exp->used[exp->num_used++] = exp->code[i].var;
+    }
+  }
+  return 0;
+}
+
+expression_type *expression_parse(const char *user_str, variable_type *vars, size_t num)
+{
+  expression_type *exp;
+  parser_type p = {
+    .pos = user_str,
+    .vars = vars,
+    .num_vars = num,
+  };
+
+  exp = calloc(1, sizeof(expression_type));
+  if (!exp) {
+    return NULL;
   }
-  /* We are done parsing, ensure that we are the top group
-   * and the user is not missing any unclosed parenthesis */
-  assert(current->parent == NULL);
-  free(str);
-  return current;
-free_bail:
-  /* Free the partially created tree if it exists */
-  expression_destroy(ret);
+  exp->num_vars = num;
+  exp->vars = calloc(num ? num : 1, sizeof(variable_type));
+  if (!exp->vars) {
+    goto bail;
+  }
+  memcpy(exp->vars, vars, num * sizeof(variable_type));
+
+  if (!next_token(&p) || !(exp->tree = parse_sum(&p))) {
+    goto bail;
+  }
+  /* Everything should have been consumed, else this is either
+   * an unbalanced ')' or two terms without an operator between */
+  if (p.kind != TOK_END) {
+    goto bail;
+  }
+  if (build(exp)) {
+    goto bail;
+  }
+  return exp;
+bail:
+  expression_destroy(exp);
   return NULL;
 }
 
+int expression_evaluate_values(expression_type *exp, const float *values, float *value)
+{
+  float stack[exp->depth];
+  size_t sp = 0, i;
+
+  for (i = 0; i < exp->code_len; i++) {
+    instruction_type *in = &exp->code[i];
+    switch (in->op) {
+      case OP_CONSTANT:
+        stack[sp++] = in->constant;
+        break;
+      case OP_VARIABLE:
+        stack[sp++] = values[in->var];
+        break;
+      default:
+        sp -= in->num_args;
+        stack[sp] = apply(in->op, &stack[sp], in->num_args);
+        sp++;
+        break;
+    }
+  }
+  assert(sp == 1);
+  if (!isfinite(stack[0])) {
+    return -1;
+  }
+  *value = stack[0];
+  return 0;
+}
+
 int expression_evaluate(expression_type *exp, float *value)
 {
-  float l_val, r_val;
+  float values[exp->num_vars ? exp->num_vars : 1];
+  size_t i;
   int ret;
-  assert(exp->left_exp_term || exp->left_exp_group);
-  ret = exp->left_exp_term ? expression_term_evaluate(exp->left_exp_term, &l_val) :
-    expression_evaluate(exp->left_exp_group, &l_val);
-  if (ret) {
-    return ret;
-  }
-
-  if (!exp->right_exp_term && !exp->right_exp_group) {
-    /* Example use case would be the expression ( a + b ). This would be parsed
-     * as ( ( a + b ) ) thus, the outer redundant group would have ( a + b )
-     * as the left expression group with nothing on the right. Hense just
-     * return success with the evaluation of the left expression. */
-    *value = l_val;
-    return 0;
-  }
-  ret = exp->right_exp_term ? expression_term_evaluate(exp->right_exp_term, &r_val) :
-    expression_evaluate(exp->right_exp_group, &r_val);
-  if (ret) {
-    return ret;
+
+  for (i = 0; i < exp->num_used; i++) {
+    variable_type *var = &exp->vars[exp->used[i]];
+    ret = var->value(var->state, &values[exp->used[i]]);
+    if (ret) {
+      return ret;
+    }
   }
+  return expression_evaluate_values(exp, values, value);
+}
 
-  switch(exp->type) {
-    case OP_ADD:
-      *value = l_val + r_val;
-      break;
-    case OP_SUBTRACT:
-      *value = l_val - r_val;
-      break;
-    case OP_MULTIPLY:
-      *value = l_val * r_val;
-      break;
-    default:
-      assert(0);
+size_t expression_variables(expression_type *exp, size_t *idx, size_t max)
+{
+  size_t i;
+
+  for (i = 0; i < exp->num_used && i < max; i++) {
+    idx[i] = exp->used[i];
   }
-  return 0;
+  return exp->num_used;
 }
 
 void expression_destroy(expression_type *exp)
@@ -270,56 +542,59 @@ void expression_destroy(expression_type *exp)
   if (!exp) {
     return;
   }
-  if (exp->left_exp_term)
-    free(exp->left_exp_term);
-  else if (exp->left_exp_group)
-    expression_destroy(exp->left_exp_group);
-  if (exp->right_exp_term)
-    free(exp->right_exp_term);
-  else if (exp->right_exp_group)
-    expression_destroy(exp->right_exp_group);
+  free_node(exp->tree);
+  free(exp->code);
+  free(exp->used);
+  free(exp->vars);
   free(exp);
 }
 
-void expression_print(expression_type *exp)
+static void print_node(expression_type *exp, expression_node *n)
 {
-  printf("( ");
-  if (exp->left_exp_term) {
-    if (exp->left_exp_term->type == TERM_CONSTANT) {
-      printf("%2.5f ", exp->left_exp_term->term.constant);
-    } else {
-      printf("%s ", exp->left_exp_term->term.var.name);
-    }
-  } else {
-      expression_print(exp->left_exp_group);
-  }
+  static const char ops[] = {
+    [OP_ADD] = '+',
+    [OP_SUBTRACT] = '-',
+    [OP_MULTIPLY] = '*',
+    [OP_DIVIDE] = '/',
+  };
+  size_t i;
 
-  switch(exp->type) {
-    case OP_ADD:
-      printf("+ ");
+  switch (n->type) {
+    case OP_CONSTANT:
+      printf("%2.5f ", n->constant);
       break;
-    case OP_SUBTRACT:
+    case OP_VARIABLE:
+      printf("%s ", exp->vars[n->var].name);
+      break;
+    case OP_NEGATE:
       printf("- ");
+      print_node(exp, n->args[0]);
       break;
-    case OP_MULTIPLY:
-      printf("* ");
+    case OP_MIN:
+    case OP_MAX:
+    case OP_AVG:
+      printf("%s( ", func_names[n->type]);
+      for (i = 0; i < n->num_args; i++) {
+        if (i) {
+          printf(", ");
+        }
+        print_node(exp, n->args[i]);
+      }
+      printf(") ");
       break;
     default:
-      /* This case is possible only if there is no right term */
-      assert(exp->right_exp_term == NULL && exp->right_exp_group == NULL);
+      printf("( ");
+      print_node(exp, n->args[0]);
+      printf("%c ", ops[n->type]);
+      print_node(exp, n->args[1]);
+      printf(") ");
       break;
   }
+}
 
-  if (exp->right_exp_term) {
-    if (exp->right_exp_term->type == TERM_CONSTANT) {
-      printf("%2.5f ", exp->right_exp_term->term.constant);
-    } else {
-      printf("%s ", exp->right_exp_term->term.var.name);
-    }
-  } else if (exp->right_exp_group) {
-    expression_print(exp->right_exp_group);
-  }
-  printf(") ");
+void expression_print(expression_type *exp)
+{
+  print_node(exp, exp->tree);
 }
 
 #ifdef __EXPRESSION_TEST__
@@ -329,6 +604,293 @@ int test_get_value(void *state, float *value)
   return 0;
 }
 
+/* Reference: evaluate the parse tree recursively, nothing folded */
+static int tree_evaluate(expression_node *n, const float *values, float *value)
+{
+  float args[n->num_args ? n->num_args : 1];
+  size_t i;
+
+  if (n->type == OP_CONSTANT) {
+    *value = n->constant;
+    return 0;
+  }
+  if (n->type == OP_VARIABLE) {
+    *value = values[n->var];
+    return 0;
+  }
+  for (i = 0; i < n->num_args; i++) {
+    if (tree_evaluate(n->args[i], values, &args[i])) {
+      return -1;
+    }
+  }
+  *value = apply(n->type, args, n->num_args);
+  return 0;
+}
+
+static int expression_evaluate_tree(expression_type *exp, const float *values, float *value)
+{
+  float ret;
+
+  if (tree_evaluate(exp->tree, values, &ret) || !isfinite(ret)) {
+    return -1;
+  }
+  *value = ret;
+  return 0;
+}
+
+#define FUZZ_VARS 8
+
+typedef struct {
+  char str[4096];
+  size_t len;
+} fuzz_buf;
+
+static float fuzz_values[FUZZ_VARS];
+
+static void fuzz_put(fuzz_buf *b, const char *s)
+{
+  /* Optional spaces between tokens */
+  if (b->len && rand() % 2) {
+    b->str[b->len++] = ' ';
+  }
+  b->len += snprintf(&b->str[b->len], sizeof(b->str) - b->len, "%s", s);
+  assert(b->len < sizeof(b->str) - 1);
+}
+
+/* Append a random expression to b and return its value, computed here
+ * in the order the grammar says. prec is the binding strength of the
+ * top of what was appended: 1 sum, 2 product, 3 anything tighter. */
+static float fuzz_gen(fuzz_buf *b, int depth, int *prec)
+{
+  float l, r, args[5];
+  int lp, rp, op, n, i;
+  char tmp[32];
+
+  if (depth == 0 || rand() % 4 == 0) {
+    *prec = 3;
+    if (rand() % 2) {
+      i = rand() % FUZZ_VARS;
+      snprintf(tmp, sizeof(tmp), "v%d", i);
+      fuzz_put(b, tmp);
+      return fuzz_values[i];
+    }
+    /* Exactly representable constants */
+    l = (rand() % 64) / 4.0f;
+    snprintf(tmp, sizeof(tmp), "%g", l);
+    fuzz_put(b, tmp);
+    return l;
+  }
+
+  op = rand() % 7;
+  if (op == 5) {
+    fuzz_put(b, "-");
+    fuzz_put(b, "(");
+    l = fuzz_gen(b, depth - 1, &lp);
+    fuzz_put(b, ")");
+    *prec = 3;
+    return -l;
+  }
+  if (op == 6) {
+    static const operator_type func_ops[] = {OP_MIN, OP_MAX, OP_AVG};
+    n = 1 + rand() % 5;
+    i = rand() % 3;
+    fuzz_put(b, func_names[func_ops[i]]);
+    fuzz_put(b, "(");
+    for (lp = 0; lp < n; lp++) {
+      if (lp) {
+        fuzz_put(b, ",");
+      }
+      args[lp] = fuzz_gen(b, depth - 1, &rp);
+    }
+    fuzz_put(b, ")");
+    *prec = 3;
+    return apply(func_ops[i], args, n);
+  }
+
+  /* Binary: add parenthesis where the precedence needs them, and
+   * sometimes where it does not */
+  {
+    static const struct { const char *s; operator_type op; int prec; } bin[] = {
+      {"+", OP_ADD, 1}, {"-", OP_SUBTRACT, 1},
+      {"*", OP_MULTIPLY, 2}, {"/", OP_DIVIDE, 2}, {"+", OP_ADD, 1},
+    };
+    fuzz_buf lb = {.len = 0}, rb = {.len = 0};
+    bool paren;
+    float vals[2];
+
+    l = fuzz_gen(&lb, depth - 1, &lp);
+    r = fuzz_gen(&rb, depth - 1, &rp);
+    paren = lp < bin[op].prec || rand() % 8 == 0;
+    if (paren) {
+      fuzz_put(b, "(");
+    }
+    fuzz_put(b, lb.str);
+    if (paren) {
+      fuzz_put(b, ")");
+    }
+    fuzz_put(b, bin[op].s);
+    /* Left associative: same precedence on the right needs them */
+    paren = rp <= bin[op].prec || rand() % 8 == 0;
+    if (paren) {
+      fuzz_put(b, "(");
+    }
+    fuzz_put(b, rb.str);
+    if (paren) {
+      fuzz_put(b, ")");
+    }
+    *prec = bin[op].prec;
+    vals[0] = l;
+    vals[1] = r;
+    return apply(bin[op].op, vals, 2);
+  }
+}
+
+static bool same(int ret1, float v1, int ret2, float v2)
+{
+  if (ret1 || ret2) {
+    return ret1 == ret2;
+  }
+  return v1 == v2;
+}
+
+static int fuzz(int iterations)
+{
+  variable_type vars[FUZZ_VARS];
+  size_t folded = 0, total = 0;
+  int i, j, prec, ret, tret, rret;
+  float expected, value = 0, tvalue = 0;
+
+  memset(vars, 0, sizeof(vars));
+  for (i = 0; i < FUZZ_VARS; i++) {
+    snprintf(vars[i].name, sizeof(vars[i].name), "v%d", i);
+    vars[i].value = test_get_value;
+    vars[i].state = &fuzz_values[i];
+  }
+  srand(1);
+
+  for (i = 0; i < iterations; i++) {
+    fuzz_buf b = {.len = 0};
+    expression_type *exp;
+
+    for (j = 0; j < FUZZ_VARS; j++) {
+      fuzz_values[j] = (rand() % 2000 - 1000) / 8.0f;
+    }
+    expected = fuzz_gen(&b, 1 + rand() % 6, &prec);
+    rret = isfinite(expected) ? 0 : -1;
+
+    exp = expression_parse(b.str, vars, FUZZ_VARS);
+    if (!exp) {
+      printf("FAIL: could not parse %s\n", b.str);
+      return -1;
+    }
+    ret = expression_evaluate(exp, &value);
+    tret = expression_evaluate_tree(exp, fuzz_values, &tvalue);
+    if (!same(ret, value, tret, tvalue) || !same(ret, value, rret, expected)) {
+      printf("FAIL: %s\n  bytecode (ret=%d) %f tree (ret=%d) %f expected %f\n",
+          b.str, ret, value, tret, tvalue, expected);
+      expression_print(exp);
+      printf("\n");
+      return -1;
+    }
+    folded += count_nodes(exp->tree) - exp->code_len;
+    total += count_nodes(exp->tree);
+    expression_destroy(exp);
+  }
+  printf("fuzz: %d expressions, bytecode == tree, %zu of %zu nodes folded\n",
+      iterations, folded, total);
+  return 0;
+}
+
+static int count_calls;
+
+static int counting_get_value(void *state, float *value)
+{
+  count_calls++;
+  *value = *((float *)state);
+  return 0;
+}
+
+static void check(const char *str, float a, float b, float expected)
+{
+  float va = a, vb = b, value;
+  variable_type vars[] = {
+    {"a", counting_get_value, &va},
+    {"b", counting_get_value, &vb},
+    {"min", counting_get_value, &vb},
+  };
+  expression_type *exp = expression_parse(str, vars, 3);
+
+  assert(exp);
+  count_calls = 0;
+  assert(expression_evaluate(exp, &value) == 0);
+  if (value != expected) {
+    printf("FAIL: %s = %f, expected %f\n", str, value, expected);
+    exit(1);
+  }
+  assert(count_calls == (int)expression_variables(exp, NULL, 0));
+  expression_destroy(exp);
+}
+
+static int unit_tests(void)
+{
+  static const char *bad[] = {
+    "", "a +", "( a", "a )", "a b", "c", "min()", "min( a, )", "a ++ b",
+    "1.2.3", "max a",
+  };
+  variable_type vars[] = {{"a", test_get_value, NULL}, {"b", test_get_value, NULL}};
+  float rpm0 = 7000, rpm1 = 7100, zero = 0, value;
+  size_t i, idx[4];
+  expression_type *exp;
+
+  /* What the shipped configurations have, unchanged */
+  check("( a * 0.0053118 ) + ( b * 0.0053118 ) - 6.98", rpm0, rpm1,
+      ((rpm0 * 0.0053118f) + (rpm1 * 0.0053118f)) - 6.98f);
+  /* Precedence */
+  check("4 * a + 5 * b - 6", 2, 3, 8 + 15 - 6);
+  check("4*a+5*b-6", 2, 3, 8 + 15 - 6);
+  check("a - b - 1", 10, 3, 6);
+  check("a / b / 2", 12, 3, 2);
+  check("- a * b", 2, 3, -6);
+  check("a - - b", 2, 3, 5);
+  check("( a + b ) * 2", 2, 3, 10);
+  check("((a))", 2, 3, 2);
+  /* Functions; a variable may still be named like one */
+  check("min( a, b ) + max( a, b, 1 ) * avg( a, b, 4 )", 2, 3, 2 + 3 * 3);
+  check("min * 2", 2, 3, 6);
+  check("avg( a )", 2, 3, 2);
+  /* Each variable is read once, however often it is used */
+  check("a * a + a - b * b", 3, 2, 8);
+
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    if ((exp = expression_parse(bad[i], vars, 2))) {
+      printf("FAIL: parsed '%s'\n", bad[i]);
+      return -1;
+    }
+  }
+
+  /* Constants are folded */
+  exp = expression_parse("( 2 * 3 + 4 ) * a + min( 1, 2 ) - 1", vars, 2);
+  assert(exp && exp->code_len == 7);
+  assert(expression_variables(exp, idx, 4) == 1 && idx[0] == 0);
+  expression_destroy(exp);
+  exp = expression_parse("b + a + b", vars, 2);
+  assert(expression_variables(exp, idx, 4) == 2 && idx[0] == 1 && idx[1] == 0);
+  expression_destroy(exp);
+
+  /* Division by zero fails */
+  vars[0].state = &rpm0;
+  vars[1].state = &zero;
+  exp = expression_parse("a / b", vars, 2);
+  assert(expression_evaluate(exp, &value) == -1);
+  expression_destroy(exp);
+  exp = expression_parse("1 / 0", vars, 2);
+  assert(exp && expression_evaluate(exp, &value) == -1);
+  expression_destroy(exp);
+
+  printf("unit tests passed\n");
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
   expression_type *op;
@@ -337,6 +899,10 @@ int main(int argc, char *argv[])
   float ret;
 
   if (argc < 3) {
+    if (unit_tests() || fuzz(argc == 2 ? atoi(argv[1]) : 100000)) {
+      return 1;
+    }
+    printf("All tests passed\n");
     return 0;
   }
 
@@ -356,6 +922,10 @@ int main(int argc, char *argv[])
     *((float *)vi->state) = atof(tmp);
   }
   op = expression_parse(argv[1], input, num);
+  if (!op) {
+    printf("Parsing failed!\n");
+    return 1;
+  }
   printf("Input:\n");
   for(i = 0; i < num; i++) {
     int rc;
@@ -366,6 +936,7 @@ int main(int argc, char *argv[])
   printf("Evaluating expression: ");
   expression_print(op);
   printf("\n");
+  printf("Compiled to %zu instructions, stack depth %zu\n", op->code_len, op->depth);
   rc = expression_evaluate(op, &ret);
   printf("= (ret=%d) %4.3f\n", rc, ret);
   expression_destroy(op);
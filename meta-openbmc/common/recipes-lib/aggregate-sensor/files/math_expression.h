@@ -18,17 +18,24 @@
  */
 #ifndef _MATH_EXPRESSION_H_
 #define _MATH_EXPRESSION_H_
+#include <stddef.h>
+
 /* Rules:
- * 1. Expression is always parsed left to right with no regard to operator
- *    precedence. When in doubt, use parenthesis. Also use
- *    expression_print() which should clearly show the order of evaluation.
- *    Example: Input: "4 * a + 5 * b - 6" ->
- *    ( ( ( ( 4.00000 * a  ) + 5.00000  ) * b  ) - 6.00000  ) which is most
- *    probably not what you want. Hence use "( 4 * a ) + ( 5 * b ) - 6" ->
- *    ( ( ( 4.00000 * a  ) + ( 5.00000 * b  )  ) - 6.00000  )
+ * 1. The usual precedence applies: unary minus binds tightest, then
+ *    '*' and '/', then '+' and '-', all left associative. So
+ *    "4 * a + 5 * b - 6" is ( ( ( 4 * a ) + ( 5 * b ) ) - 6 ). Parenthesis
+ *    group as expected. expression_print() shows the order of evaluation.
+ *
+ * 2. min( x, y, ... ), max( x, y, ... ) and avg( x, y, ... ) take one or
+ *    more arguments.
+ *
+ * 3. Spaces between tokens are optional. Variable names are made of
+ *    letters, digits and '_', constants are decimal numbers.
  *
- * 2. Expressions are parsed using spaces. So, 'a*b+c' is invalid while
- *    'a * b + c' is valid.
+ * 4. The expression is compiled to a flat stack program at parse time,
+ *    with the parts made of constants only folded, so evaluation is a
+ *    single loop. A division by zero (or any result which is not a finite
+ *    number) fails the evaluation.
  */
 
 /* The function which is fed into expression_parse which stores this 
@@ -59,10 +66,21 @@ typedef struct expression_type_s expression_type;
  * the scope of 'value' & 'state' if they are dynamic objects */
 expression_type *expression_parse(const char *str, variable_type *vars, size_t num);
 
-/* Evaluate the expression. Note, multiple calls to the functions
- * provided in 'vars' in expression_parse might be made */
+/* Evaluate the expression. The function provided in 'vars' in
+ * expression_parse is called once for each variable the expression uses.
+ * The first failure is returned as is. */
 int expression_evaluate(expression_type *op, float *value);
 
+/* Evaluate the expression with the variable values already at hand.
+ * values[i] is the value of vars[i] given to expression_parse; only the
+ * entries of the variables used (see expression_variables) are read. */
+int expression_evaluate_values(expression_type *op, const float *values, float *value);
+
+/* Indexes (in the 'vars' given to expression_parse) of the distinct
+ * variables the expression uses, in order of first use. Up to 'max'
+ * are stored in 'idx', the total number is returned. */
+size_t expression_variables(expression_type *op, size_t *idx, size_t max);
+
 /* Destroy the object created in expression_parse */
 void expression_destroy(expression_type *exp);
 
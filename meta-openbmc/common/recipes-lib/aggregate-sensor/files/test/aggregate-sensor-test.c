@@ -53,9 +53,26 @@ int edb_cache_get(char *key, char *value)
   return -1;
 }
 
+/* Moves whenever the test switches the condition value */
+int edb_cache_generation(uint32_t *gen)
+{
+  static char *last_val = NULL;
+  static uint32_t generation = 0;
+
+  if (curr_val != last_val) {
+    last_val = curr_val;
+    generation++;
+  }
+  *gen = generation;
+  return 0;
+}
+
+size_t num_cache_reads = 0;
+
 int sensor_cache_read(uint8_t fru, uint8_t snr_num, float *value)
 {
   size_t i;
+  num_cache_reads++;
   for (i = 0; i < num_test_sensors; i++) {
     sensor_test_t *s = &test_sensors[i];
     if (s->fru == fru && s->snr == snr_num) {
@@ -148,7 +165,12 @@ void set_all_sensors_valid(void)
 bool test_sensor_ret(size_t num, bool should_pass)
 {
   float value;
-  int ret = aggregate_sensor_read(num, &value);
+  int ret;
+
+  num_cache_reads = 0;
+  ret = aggregate_sensor_read(num, &value);
+  /* A source is read at most once, and not at all once one failed */
+  assert(num_cache_reads <= num_test_sensors);
   if (should_pass) {
     if (ret != 0) {
       assert(0);
@@ -23,13 +23,61 @@
 #include <errno.h>
 #include <syslog.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "unqlite.h"
 #include "edb.h"
 
 #define MAX_BUF 80
 #define MAX_RETRY 5
 
+static uint32_t *cache_gen = NULL;
+
+/* Map the shared generation counter once per process. */
+static uint32_t *
+edb_cache_gen_map(void) {
+  uint32_t *gen;
+  struct stat st;
+  int fd;
+
+  if (cache_gen)
+    return cache_gen;
+
+  if (access(CACHE_STORE_PATH, F_OK) == -1) {
+    mkdir(CACHE_STORE_PATH, 0777);
+  }
+  fd = open(CACHE_GENERATION, O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 ||
+      (st.st_size < sizeof(uint32_t) && ftruncate(fd, sizeof(uint32_t)) < 0)) {
+    close(fd);
+    return NULL;
+  }
+  gen = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (gen == MAP_FAILED)
+    return NULL;
+
+  // another thread may have got there first
+  if (!__sync_bool_compare_and_swap(&cache_gen, NULL, gen))
+    munmap(gen, sizeof(uint32_t));
+  return cache_gen;
+}
+
+int
+edb_cache_generation(uint32_t *gen) {
+  uint32_t *map = edb_cache_gen_map();
+
+  if (!map)
+    return -1;
+  *gen = *(volatile uint32_t *)map;
+  __sync_synchronize();
+  return 0;
+}
+
 int
 edb_cache_set(char *key, char *value) {
 
@@ -79,6 +127,11 @@ edb_cache_set(char *key, char *value) {
   }
   fflush(fp);
 
+  // after the value is in place, so a reader seeing the new generation
+  // reads the new value
+  if (edb_cache_gen_map())
+    __sync_fetch_and_add(cache_gen, 1);
+
   rc = flock(fileno(fp), LOCK_UN);
   if (rc < 0) {
      int err = errno;
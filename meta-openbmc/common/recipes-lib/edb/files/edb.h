@@ -19,6 +19,8 @@
 #ifndef __EDB_H__
 #define __EDB_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,9 +31,18 @@ extern "C" {
 
 #define CACHE_STORE "/tmp/cache_store/%s"
 #define CACHE_STORE_PATH "/tmp/cache_store"
+#define CACHE_GENERATION "/tmp/cache_store/.generation"
 
 int edb_cache_get(char* key, char *value);
 int edb_cache_set(char* key, char *value);
+/*
+ * Counter bumped by every edb_cache_set(), shared by all processes. A
+ * value read after a generation is current until the generation changes,
+ * so readers can cache it. Reading the generation costs no system call
+ * once mapped. Returns -1 if it is not available; callers then read the
+ * value every time.
+ */
+int edb_cache_generation(uint32_t *gen);
 
 #ifdef __cplusplus
 }
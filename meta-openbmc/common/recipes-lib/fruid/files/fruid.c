@@ -22,6 +22,11 @@
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "fruid.h"
 
 #define FIELD_TYPE(x)     ((x & (0x03 << 6)) >> 6)
@@ -32,6 +37,42 @@
 /* Unix time difference between 1970 and 1996. */
 #define UNIX_TIMESTAMP_1996   820454400
 
+/* List of all the Chassis types. */
+const char * fruid_chassis_type [] = {
+  "Other",                    /* 0x01 */
+  "Unknown",                  /* 0x02 */
+  "Desktop",                  /* 0x03 */
+  "Low Profile Desktop",      /* 0x04 */
+  "Pizza Box",                /* 0x05 */
+  "Mini Tower",               /* 0x06 */
+  "Tower",                    /* 0x07 */
+  "Portable",                 /* 0x08 */
+  "Laptop",                   /* 0x09 */
+  "Notebook",                 /* 0x0A */
+  "Hand Held",                /* 0x0B */
+  "Docking Station",          /* 0x0C */
+  "All in One",               /* 0x0D */
+  "Sub Notebook",             /* 0x0E */
+  "Space-saving",             /* 0x0F */
+  "Lunch Box",                /* 0x10 */
+  "Main Server Chassis",      /* 0x11 */
+  "Expansion Chassis",        /* 0x12 */
+  "SubChassis",               /* 0x13 */
+  "Bus Expansion Chassis",    /* 0x14 */
+  "Peripheral Chassis",       /* 0x15 */
+  "RAID Chassis",             /* 0x16 */
+  "Rack Mount Chassis",       /* 0x17 */
+  "Sealed-case PC",           /* 0x18 */
+  "Multi-system Chassis",     /* 0x19 */
+  "Compact PCI",              /* 0x1A */
+  "Advanced TCA",             /* 0x1B */
+  "Blade",                    /* 0x1C */
+  "Blade Enclosure",          /* 0x1D */
+  "Tablet",                   /* 0x1E */
+  "Convertible",              /* 0x1F */
+  "Detachable"                /* 0x20 */
+};
+
 /* Array for BCD Plus definition. */
 const char bcd_plus_array[] = "0123456789 -.XXX";
 
@@ -735,6 +776,47 @@ int populate_fruid_info(fruid_eeprom_t * fruid_eeprom, fruid_info_t * fruid)
   return 0;
 }
 
+/*
+ * fruid_parse_fd - parse an open FRUID binary
+ *
+ * The image is mapped read-only when the file supports it (regular files
+ * such as /tmp/fruid_*.bin) and read into a buffer otherwise (sysfs
+ * eeprom attributes).
+ */
+static int fruid_parse_fd(int fd, off_t fruid_len, fruid_info_t * fruid)
+{
+  uint8_t * eeprom;
+  int ret;
+
+  if (fruid_len <= 0)
+    return EINVAL;
+
+  eeprom = mmap(NULL, fruid_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (eeprom != MAP_FAILED) {
+    ret = fruid_parse_eeprom(eeprom, fruid_len, fruid);
+    munmap(eeprom, fruid_len);
+    return ret;
+  }
+
+  eeprom = (uint8_t *) malloc(fruid_len);
+  if (!eeprom) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "fruid: malloc: memory allocation failed\n");
+#endif
+    return ENOMEM;
+  }
+
+  if (pread(fd, eeprom, fruid_len, 0) != fruid_len) {
+    free(eeprom);
+    return EIO;
+  }
+
+  ret = fruid_parse_eeprom(eeprom, fruid_len, fruid);
+  free(eeprom);
+
+  return ret;
+}
+
 /*
  * fruid_parse - To parse the bin file (eeprom) and populate
  *               the fruid information in the struct
@@ -746,49 +828,190 @@ int populate_fruid_info(fruid_eeprom_t * fruid_eeprom, fruid_info_t * fruid)
  */
 int fruid_parse(const char * bin, fruid_info_t * fruid)
 {
-  int fruid_len, ret;
-  FILE *fruid_fd;
-  uint8_t * eeprom;
-
-  /* Reset parser return value */
-  ret = 0;
+  struct stat st;
+  int fd, ret;
 
   /* Open the FRUID binary file */
-  fruid_fd = fopen(bin, "rb");
-  if (!fruid_fd) {
+  fd = open(bin, O_RDONLY);
+  if (fd < 0) {
 #ifdef DEBUG
     syslog(LOG_ERR, "fruid: unable to open the file");
 #endif
     return ENOENT;
   }
 
-  /* Get the size of the binary file */
-  fseek(fruid_fd, 0, SEEK_END);
-  fruid_len = (uint32_t) ftell(fruid_fd);
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return EIO;
+  }
 
-  fseek(fruid_fd, 0, SEEK_SET);
+  ret = fruid_parse_fd(fd, st.st_size, fruid);
+  close(fd);
 
-  eeprom = (uint8_t *) malloc(fruid_len);
-  if (!eeprom) {
-#ifdef DEBUG
-    syslog(LOG_WARNING, "fruid: malloc: memory allocation failed\n");
-#endif
-    return ENOMEM;
+  return ret;
+}
+
+/*
+ * Cache of parsed FRUID binaries for long running consumers.
+ *
+ * Entries are keyed by path and revalidated with a stat() of the file, so
+ * a FRU rewritten by fruid-util or a hotplug handler is reparsed on the
+ * next lookup. Callers borrow the cached strings instead of getting their
+ * own copies; an entry replaced while borrowed is freed on the last put.
+ */
+typedef struct fruid_cache_entry_t {
+  fruid_info_t info;          /* must be first, see fruid_cache_put() */
+  char path[FRUID_CACHE_PATH_LEN];
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  unsigned int refs;
+  unsigned int stale;
+  unsigned long last_used;
+} fruid_cache_entry_t;
+
+static fruid_cache_entry_t * g_fruid_cache[FRUID_CACHE_SIZE];
+static unsigned long g_fruid_cache_tick;
+static pthread_mutex_t g_fruid_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fruid_cache_drop(fruid_cache_entry_t * entry)
+{
+  if (entry->refs) {
+    entry->stale = 1;
+    return;
   }
+  free_fruid_info(&entry->info);
+  free(entry);
+}
 
-  /* Read the binary file */
-  fread(eeprom, sizeof(uint8_t), fruid_len, fruid_fd);
+static int fruid_cache_match(fruid_cache_entry_t * entry, struct stat * st)
+{
+  return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+         entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
 
-  /* Close the FRUID binary file */
-  fclose(fruid_fd);
+/*
+ * fruid_cache_get - get the parsed fruid information of a bin file
+ * @bin       : Eeprom binary file
+ *
+ * returns a read-only fruid_info_t shared with other callers, which must
+ * be released with fruid_cache_put()
+ * returns NULL on error with errno set
+ */
+const fruid_info_t * fruid_cache_get(const char * bin)
+{
+  fruid_cache_entry_t * entry = NULL;
+  struct stat st;
+  int fd, i, slot = 0, ret;
 
-  /* Parse eeprom dump*/
-  ret = fruid_parse_eeprom(eeprom, fruid_len, fruid);
+  if (strlen(bin) >= FRUID_CACHE_PATH_LEN) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
 
-  /* Free the eeprom malloced memory */
-  free(eeprom);
+  fd = open(bin, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
 
-  return ret;
+  pthread_mutex_lock(&g_fruid_cache_lock);
+
+  for (i = 0; i < FRUID_CACHE_SIZE; i++) {
+    if (!g_fruid_cache[i]) {
+      slot = i;
+      continue;
+    }
+    if (!strcmp(g_fruid_cache[i]->path, bin)) {
+      slot = i;
+      if (fruid_cache_match(g_fruid_cache[i], &st)) {
+        entry = g_fruid_cache[i];
+      } else {
+        fruid_cache_drop(g_fruid_cache[i]);
+        g_fruid_cache[i] = NULL;
+      }
+      break;
+    }
+    if (g_fruid_cache[slot] &&
+        g_fruid_cache[i]->last_used < g_fruid_cache[slot]->last_used) {
+      slot = i;
+    }
+  }
+
+  if (!entry) {
+    entry = calloc(1, sizeof(fruid_cache_entry_t));
+    if (!entry) {
+      pthread_mutex_unlock(&g_fruid_cache_lock);
+      close(fd);
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    ret = fruid_parse_fd(fd, st.st_size, &entry->info);
+    if (ret) {
+      pthread_mutex_unlock(&g_fruid_cache_lock);
+      free(entry);
+      close(fd);
+      errno = ret;
+      return NULL;
+    }
+
+    strcpy(entry->path, bin);
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+
+    /* Evict the least recently used entry if the cache is full */
+    if (g_fruid_cache[slot]) {
+      fruid_cache_drop(g_fruid_cache[slot]);
+    }
+    g_fruid_cache[slot] = entry;
+  }
+
+  entry->refs++;
+  entry->last_used = ++g_fruid_cache_tick;
+  pthread_mutex_unlock(&g_fruid_cache_lock);
+  close(fd);
+
+  return &entry->info;
+}
+
+/* Release the fruid information returned by fruid_cache_get() */
+void fruid_cache_put(const fruid_info_t * fruid)
+{
+  fruid_cache_entry_t * entry = (fruid_cache_entry_t *) fruid;
+
+  if (!fruid)
+    return;
+
+  pthread_mutex_lock(&g_fruid_cache_lock);
+  if (--entry->refs == 0 && entry->stale) {
+    free_fruid_info(&entry->info);
+    free(entry);
+  }
+  pthread_mutex_unlock(&g_fruid_cache_lock);
+}
+
+/* Forget the cached copy of bin, or of all files if bin is NULL */
+void fruid_cache_invalidate(const char * bin)
+{
+  int i;
+
+  pthread_mutex_lock(&g_fruid_cache_lock);
+  for (i = 0; i < FRUID_CACHE_SIZE; i++) {
+    if (g_fruid_cache[i] && (!bin || !strcmp(g_fruid_cache[i]->path, bin))) {
+      fruid_cache_drop(g_fruid_cache[i]);
+      g_fruid_cache[i] = NULL;
+    }
+  }
+  pthread_mutex_unlock(&g_fruid_cache_lock);
 }
 
 /* Populate the fruid from eeprom dump*/
@@ -40,6 +40,9 @@ extern "C" {
 #define FRUID_CHASSIS_TYPECODE_MIN        1
 #define FRUID_CHASSIS_TYPECODE_MAX        32
 
+#define FRUID_CACHE_SIZE                  16
+#define FRUID_CACHE_PATH_LEN              64
+
 /* To hold the common header information. */
 typedef struct fruid_header_t {
   uint8_t format_ver : 4;
@@ -165,44 +168,14 @@ typedef struct fruid_eeprom_t {
 } fruid_eeprom_t;
 
 /* List of all the Chassis types. */
-const char * fruid_chassis_type [] = {
-  "Other",                    /* 0x01 */
-  "Unknown",                  /* 0x02 */
-  "Desktop",                  /* 0x03 */
-  "Low Profile Desktop",      /* 0x04 */
-  "Pizza Box",                /* 0x05 */
-  "Mini Tower",               /* 0x06 */
-  "Tower",                    /* 0x07 */
-  "Portable",                 /* 0x08 */
-  "Laptop",                   /* 0x09 */
-  "Notebook",                 /* 0x0A */
-  "Hand Held",                /* 0x0B */
-  "Docking Station",          /* 0x0C */
-  "All in One",               /* 0x0D */
-  "Sub Notebook",             /* 0x0E */
-  "Space-saving",             /* 0x0F */
-  "Lunch Box",                /* 0x10 */
-  "Main Server Chassis",      /* 0x11 */
-  "Expansion Chassis",        /* 0x12 */
-  "SubChassis",               /* 0x13 */
-  "Bus Expansion Chassis",    /* 0x14 */
-  "Peripheral Chassis",       /* 0x15 */
-  "RAID Chassis",             /* 0x16 */
-  "Rack Mount Chassis",       /* 0x17 */
-  "Sealed-case PC",           /* 0x18 */
-  "Multi-system Chassis",     /* 0x19 */
-  "Compact PCI",              /* 0x1A */
-  "Advanced TCA",             /* 0x1B */
-  "Blade",                    /* 0x1C */
-  "Blade Enclosure",          /* 0x1D */
-  "Tablet",                   /* 0x1E */
-  "Convertible",              /* 0x1F */
-  "Detachable"                /* 0x20 */
-};
+extern const char * fruid_chassis_type [];
 
 int fruid_parse(const char * bin, fruid_info_t * fruid);
 int fruid_parse_eeprom(const uint8_t * eeprom, int eeprom_len, fruid_info_t * fruid);
 void free_fruid_info(fruid_info_t * fruid);
+const fruid_info_t * fruid_cache_get(const char * bin);
+void fruid_cache_put(const fruid_info_t * fruid);
+void fruid_cache_invalidate(const char * bin);
 
 #ifdef __cplusplus
 }
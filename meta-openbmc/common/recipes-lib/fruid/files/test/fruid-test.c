@@ -0,0 +1,180 @@
+/*
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "fruid.h"
+
+#define TEST_FRU_SIZE 256
+#define TEST_LOOPS    10000
+
+static uint8_t zero_chksum(const uint8_t *buf, int len)
+{
+  uint8_t sum = 0;
+  int i;
+
+  for (i = 0; i < len; i++)
+    sum += buf[i];
+
+  return ~sum + 1;
+}
+
+static int add_field(uint8_t *area, int idx, const char *str)
+{
+  int len = strlen(str);
+
+  area[idx++] = 0xC0 | len;
+  memcpy(&area[idx], str, len);
+
+  return idx + len;
+}
+
+/* Build an image with only a Board area holding the given serial number */
+static void write_fru(const char *path, const char *serial)
+{
+  uint8_t fru[TEST_FRU_SIZE] = {0};
+  uint8_t *board = &fru[8];
+  int idx = 6, len;
+  FILE *fp;
+
+  fru[0] = FRUID_FORMAT_VER;
+  fru[3] = 1;
+  fru[7] = zero_chksum(fru, 7);
+
+  board[0] = FRUID_FORMAT_VER;
+  idx = add_field(board, idx, "LinkedIn");
+  idx = add_field(board, idx, "Test Board");
+  idx = add_field(board, idx, serial);
+  idx = add_field(board, idx, "PN-0001");
+  idx = add_field(board, idx, "fru.bin");
+  idx = add_field(board, idx, "custom");
+  board[idx++] = 0xC1;
+  len = (idx + 1 + 7) & ~7;
+  board[1] = len / FRUID_AREA_LEN_MULTIPLIER;
+  board[len - 1] = zero_chksum(board, len - 1);
+
+  fp = fopen(path, "wb");
+  assert(fp);
+  assert(fwrite(fru, 1, sizeof(fru), fp) == sizeof(fru));
+  fclose(fp);
+}
+
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void test_parse(const char *path)
+{
+  fruid_info_t fruid;
+
+  write_fru(path, "SN-0001");
+  assert(fruid_parse(path, &fruid) == 0);
+  assert(fruid.board.flag);
+  assert(!fruid.chassis.flag && !fruid.product.flag);
+  assert(!strcmp(fruid.board.mfg, "LinkedIn"));
+  assert(!strcmp(fruid.board.serial, "SN-0001"));
+  assert(!strcmp(fruid.board.custom1, "custom"));
+  free_fruid_info(&fruid);
+
+  assert(fruid_parse("/nonexistent/fru.bin", &fruid) == ENOENT);
+}
+
+static void test_cache(const char *path)
+{
+  const fruid_info_t *a, *b;
+
+  write_fru(path, "SN-0001");
+  a = fruid_cache_get(path);
+  assert(a);
+  assert(!strcmp(a->board.serial, "SN-0001"));
+
+  /* Unchanged file: same parsed copy */
+  b = fruid_cache_get(path);
+  assert(b == a);
+  fruid_cache_put(b);
+
+  /* Rewritten file: reparsed, old copy stays valid until released */
+  sleep(1);
+  write_fru(path, "SN-0002");
+  b = fruid_cache_get(path);
+  assert(b && b != a);
+  assert(!strcmp(b->board.serial, "SN-0002"));
+  assert(!strcmp(a->board.serial, "SN-0001"));
+  fruid_cache_put(a);
+  fruid_cache_put(b);
+
+  fruid_cache_invalidate(path);
+  a = fruid_cache_get(path);
+  assert(a && !strcmp(a->board.serial, "SN-0002"));
+  fruid_cache_put(a);
+
+  assert(fruid_cache_get("/nonexistent/fru.bin") == NULL);
+}
+
+static void bench(const char *path)
+{
+  const fruid_info_t *cached;
+  fruid_info_t fruid;
+  double start, parse_us, cache_us;
+  int i;
+
+  start = now_us();
+  for (i = 0; i < TEST_LOOPS; i++) {
+    assert(fruid_parse(path, &fruid) == 0);
+    free_fruid_info(&fruid);
+  }
+  parse_us = (now_us() - start) / TEST_LOOPS;
+
+  start = now_us();
+  for (i = 0; i < TEST_LOOPS; i++) {
+    cached = fruid_cache_get(path);
+    assert(cached);
+    fruid_cache_put(cached);
+  }
+  cache_us = (now_us() - start) / TEST_LOOPS;
+
+  printf("fruid_parse:     %8.2f us/call\n", parse_us);
+  printf("fruid_cache_get: %8.2f us/call\n", cache_us);
+}
+
+int main(int argc, char *argv[])
+{
+  char path[] = "/tmp/fruid-test-XXXXXX";
+  int fd = mkstemp(path);
+
+  assert(fd >= 0);
+  close(fd);
+
+  test_parse(path);
+  test_cache(path);
+  bench(path);
+
+  unlink(path);
+  printf("All tests passed\n");
+  return 0;
+}
@@ -28,7 +28,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <time.h>
 
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/errno.h>
@@ -36,6 +38,7 @@
 #include <openbmc/log.h>
 
 #define MAX_PINS 64
+#define MAX_POLL_WORKERS 16
 
 static void strip(char *str) {
   while(*str != '\0') {
@@ -317,68 +320,277 @@ int gpio_poll_open(gpio_poll_st *gpios, int count)
   return 0;
 }
 
-static void *gpio_poll_pin(void *arg)
+/*
+ * gpio_poll() watches all pins from one thread with epoll. Each edge is
+ * acknowledged by reading the value (sysfs keeps reporting POLLPRI until
+ * then), timestamped, optionally debounced, and handed to a small pool of
+ * worker threads that run the callbacks. Callbacks for one pin never run
+ * concurrently; edges that arrive while a pin's callback is running are
+ * folded into one more call, as with the old thread-per-pin poller.
+ */
+typedef struct {
+  gpio_poll_st *gpio;
+  int value;               /* value read when the edge was acknowledged */
+  struct timespec ts;      /* time of that edge */
+  int reported;            /* last value passed to the callback */
+  int armed;               /* debounce window running */
+  struct timespec deadline;
+  int queued;              /* waiting for or running in a worker */
+  int pending;             /* another edge arrived while queued */
+} gpio_poll_pin_t;
+
+typedef struct {
+  gpio_poll_pin_t *pins;
+  int count;
+  int *queue;              /* ring of pin indexes waiting for a worker */
+  int head, len;
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} gpio_poll_ctx_t;
+
+static int g_poll_workers = GPIO_POLL_DEFAULT_WORKERS;
+
+/*
+ * Set the number of callback workers used by subsequent gpio_poll() calls.
+ * 0 runs callbacks on the polling thread, which suits short callbacks.
+ */
+int gpio_poll_set_workers(int workers)
 {
-  gpio_poll_st *gpios = (gpio_poll_st *)arg;
-  struct pollfd fdset;
-  int rc;
+  if (workers < 0) {
+    return -EINVAL;
+  }
+  g_poll_workers = workers;
+  return 0;
+}
 
-  while (1) {
-    memset((void *)&fdset, 0, sizeof(fdset));
-    fdset.fd = gpios->gs.gs_fd;
-    fdset.events = POLLPRI;
-    gpios->value = gpio_read(&gpios->gs);
+static long ts_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_nsec - b->tv_nsec) / 1000000;
+}
 
-    rc = poll(&fdset, 1, -1); /* -1 : Forever */
-    if (rc < 0) {
-      if (errno == EINTR) {
-        continue;
-      } else {
-        rc = -errno;
-        LOG_ERR(rc, "gpio_poll: %s poll() fails\n", gpios[0].desc);
-        pthread_exit(&rc);
-      }
-    }
+static void ts_add_ms(struct timespec *ts, int ms)
+{
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
 
-    if (rc == 0) {
-      LOG_ERR(rc, "gpio_poll: %s poll() timeout\n", gpios[0].desc);
-      pthread_exit(&rc);
-    }
+static void gpio_poll_call(gpio_poll_pin_t *pin)
+{
+  pin->gpio->value = pin->value;
+  pin->gpio->ts = pin->ts;
+  pin->gpio->fp(pin->gpio);
+}
+
+static void *gpio_poll_worker(void *arg)
+{
+  gpio_poll_ctx_t *ctx = (gpio_poll_ctx_t *)arg;
+  gpio_poll_pin_t *pin;
+  int idx;
 
-    if (fdset.revents & POLLPRI) {
-      gpios->value = gpio_read(&gpios->gs);
-      gpios->fp(gpios);
+  pthread_mutex_lock(&ctx->lock);
+  while (1) {
+    while (ctx->len == 0 && !ctx->stop) {
+      pthread_cond_wait(&ctx->cond, &ctx->lock);
+    }
+    if (ctx->len == 0) {
+      break;
+    }
+    idx = ctx->queue[ctx->head];
+    ctx->head = (ctx->head + 1) % ctx->count;
+    ctx->len--;
+    pin = &ctx->pins[idx];
+    pin->pending = 0;
+
+    pthread_mutex_unlock(&ctx->lock);
+    gpio_poll_call(pin);
+    pthread_mutex_lock(&ctx->lock);
+
+    if (pin->pending) {
+      ctx->queue[(ctx->head + ctx->len) % ctx->count] = idx;
+      ctx->len++;
+    } else {
+      pin->queued = 0;
     }
   }
+  pthread_mutex_unlock(&ctx->lock);
 
-  pthread_exit(&rc);
+  return NULL;
 }
 
-int gpio_poll(gpio_poll_st *gpios, int count, int timeout)
+static void gpio_poll_dispatch(gpio_poll_ctx_t *ctx, int idx, int workers)
 {
-  pthread_t thread_ids[count];
-  int ret;
-  int i;
+  gpio_poll_pin_t *pin = &ctx->pins[idx];
+
+  pin->reported = pin->value;
+  if (workers == 0) {
+    gpio_poll_call(pin);
+    return;
+  }
+
+  pthread_mutex_lock(&ctx->lock);
+  if (pin->queued) {
+    pin->pending = 1;
+  } else {
+    pin->queued = 1;
+    ctx->queue[(ctx->head + ctx->len) % ctx->count] = idx;
+    ctx->len++;
+    pthread_cond_signal(&ctx->cond);
+  }
+  pthread_mutex_unlock(&ctx->lock);
+}
 
-  if (count > MAX_PINS) {
+/*
+ * Watch gpios for the edges configured by gpio_poll_open() and call their
+ * callbacks. timeout is in ms, -1 waits forever.
+ *
+ * returns 0 when no edge was seen for timeout ms, negative errno on error
+ */
+int gpio_poll(gpio_poll_st *gpios, int count, int timeout)
+{
+  struct epoll_event ev, events[MAX_PINS];
+  gpio_poll_ctx_t ctx;
+  pthread_t threads[MAX_POLL_WORKERS];
+  struct timespec now, last_edge;
+  int workers = g_poll_workers;
+  int efd, rc = 0, n, i, wait_ms;
+  long left;
+
+  if (count > MAX_PINS || count <= 0) {
     return -EINVAL;
   }
+  if (workers > count) {
+    workers = count;
+  }
+  if (workers > MAX_POLL_WORKERS) {
+    workers = MAX_POLL_WORKERS;
+  }
 
-  for ( i = 0; i < count; i++) {
-    // TODO pass timeout value into thread
-    if ((ret = pthread_create(&thread_ids[i], NULL, gpio_poll_pin, &gpios[i])) < 0) {
-      LOG_ERR(ret, "pthread_create failed for %s\n", gpios[i].desc);
-      return ret;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.count = count;
+  ctx.pins = calloc(count, sizeof(gpio_poll_pin_t));
+  ctx.queue = calloc(count, sizeof(int));
+  if (!ctx.pins || !ctx.queue) {
+    free(ctx.pins);
+    free(ctx.queue);
+    return -ENOMEM;
+  }
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+
+  efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    rc = -errno;
+    LOG_ERR(-rc, "gpio_poll: epoll_create1() fails");
+    goto free_ctx;
+  }
+
+  for (i = 0; i < count; i++) {
+    ctx.pins[i].gpio = &gpios[i];
+    ctx.pins[i].value = ctx.pins[i].reported = gpio_read(&gpios[i].gs);
+    gpios[i].value = ctx.pins[i].value;
+    if (gpios[i].gs.gs_fd < 0) {
+      continue;
+    }
+    ev.events = EPOLLPRI | EPOLLERR;
+    ev.data.u32 = i;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, gpios[i].gs.gs_fd, &ev) < 0) {
+      rc = -errno;
+      LOG_ERR(-rc, "gpio_poll: cannot watch %s", gpios[i].desc);
+      goto close_epoll;
     }
   }
 
-  for ( i = 0; i < count; i++) {
-    if ((ret = pthread_join(thread_ids[i], NULL) < 0)) {
-      LOG_ERR(ret, "pthread_join failed for %s\n", gpios[i].desc);
+  for (i = 0; i < workers; i++) {
+    if (pthread_create(&threads[i], NULL, gpio_poll_worker, &ctx)) {
+      LOG_ERR(EAGAIN, "gpio_poll: pthread_create failed");
+      break;
     }
   }
+  workers = i;
 
-  return 0;
+  clock_gettime(CLOCK_MONOTONIC, &last_edge);
+  while (1) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* Report pins whose debounce window has expired */
+    wait_ms = -1;
+    for (i = 0; i < count; i++) {
+      gpio_poll_pin_t *pin = &ctx.pins[i];
+      if (!pin->armed) {
+        continue;
+      }
+      left = ts_diff_ms(&pin->deadline, &now);
+      if (left <= 0) {
+        pin->armed = 0;
+        if (pin->value != pin->reported) {
+          gpio_poll_dispatch(&ctx, i, workers);
+        }
+      } else if (wait_ms < 0 || left < wait_ms) {
+        wait_ms = left;
+      }
+    }
+
+    if (timeout >= 0) {
+      left = timeout - ts_diff_ms(&now, &last_edge);
+      if (left <= 0) {
+        rc = 0;
+        break;
+      }
+      if (wait_ms < 0 || left < wait_ms) {
+        wait_ms = left;
+      }
+    }
+
+    n = epoll_wait(efd, events, count, wait_ms);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      rc = -errno;
+      LOG_ERR(-rc, "gpio_poll: epoll_wait() fails");
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < n; i++) {
+      gpio_poll_pin_t *pin = &ctx.pins[events[i].data.u32];
+
+      pin->value = gpio_read(&pin->gpio->gs);
+      pin->ts = now;
+      last_edge = now;
+
+      if (pin->gpio->debounce_ms > 0) {
+        pin->armed = 1;
+        pin->deadline = now;
+        ts_add_ms(&pin->deadline, pin->gpio->debounce_ms);
+      } else {
+        gpio_poll_dispatch(&ctx, events[i].data.u32, workers);
+      }
+    }
+  }
+
+  /* Let the workers finish the callbacks already queued */
+  pthread_mutex_lock(&ctx.lock);
+  ctx.stop = 1;
+  pthread_cond_broadcast(&ctx.cond);
+  pthread_mutex_unlock(&ctx.lock);
+  for (i = 0; i < workers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+close_epoll:
+  close(efd);
+free_ctx:
+  pthread_cond_destroy(&ctx.cond);
+  pthread_mutex_destroy(&ctx.lock);
+  free(ctx.pins);
+  free(ctx.queue);
+  return rc;
 }
 
 int gpio_poll_close(gpio_poll_st *gpios, int count)
@@ -18,10 +18,15 @@
 #ifndef GPIO_H
 #define GPIO_H
 
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Callback workers used by gpio_poll() unless changed */
+#define GPIO_POLL_DEFAULT_WORKERS 4
+
 typedef struct {
   int gs_gpio;
   int gs_fd;
@@ -55,6 +60,10 @@ struct gpio_poll_s {
   void (*fp)(gpio_poll_st *);
   char name[32];
   char desc[64];
+  /* Report a change only once the pin has been stable this long */
+  int debounce_ms;
+  /* CLOCK_MONOTONIC time of the edge being reported to fp */
+  struct timespec ts;
 };
 
 /* Operations for extended gpio operations */
@@ -80,6 +89,7 @@ int gpio_unexport(int gpio);
 int gpio_poll_open(gpio_poll_st *gpios, int count);
 int gpio_poll(gpio_poll_st *gpios, int count, int timeout);
 int gpio_poll_close(gpio_poll_st *gpios, int count);
+int gpio_poll_set_workers(int workers);
 
 #ifdef __cplusplus
 } // extern "C"
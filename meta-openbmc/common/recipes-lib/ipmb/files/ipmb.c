@@ -29,6 +29,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <poll.h>
+#include <time.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <unistd.h>
@@ -85,6 +87,405 @@ ipmb_txb()
   return (ipmb_req_t*)buf;
 }
 
+/*
+ * Multiplexed client
+ */
+#define CLIENT_SLOTS        64  // requests in flight per connection
+#define CLIENT_SLOT_BITS    6
+#define CLIENT_CONN_BITS    2
+#define CLIENT_TAG_SHIFT    (CLIENT_SLOT_BITS + CLIENT_CONN_BITS)
+
+#if IPMB_CLIENT_POOL_SIZE > (1 << CLIENT_CONN_BITS)
+#error "IPMB_CLIENT_POOL_SIZE is too large"
+#endif
+
+enum {
+  SLOT_FREE = 0,
+  SLOT_WAITING,
+  SLOT_DONE,
+  SLOT_FAILED,
+};
+
+typedef struct {
+  int tag;
+  int state;
+  int gen;      // of the connection the request went out on, 0 until sent
+  int len;
+  pthread_cond_t cond;
+  unsigned char buf[MAX_IPMB_RES_LEN];
+} client_slot_t;
+
+typedef struct {
+  int fd;       // -1 when not connected
+  int gen;      // bumped on each connect
+  int inflight;
+  // Held while sending, connecting and closing, before the client mutex
+  pthread_mutex_t send_lock;
+  pthread_cond_t closed;
+  client_slot_t slots[CLIENT_SLOTS];
+} client_conn_t;
+
+struct _ipmb_client_t {
+  unsigned char bus_id;
+  pthread_mutex_t mutex;
+  int seq;
+  client_conn_t conn[IPMB_CLIENT_POOL_SIZE];
+};
+
+typedef struct {
+  ipmb_client_t *client;
+  client_conn_t *conn;
+  int fd;
+  int gen;
+} client_reader_t;
+
+static ipmb_client_t *g_clients[256];
+static pthread_mutex_t g_clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_clients_once = PTHREAD_ONCE_INIT;
+
+// A forked child must not share the connections of its parent, whose
+// threads it doesn't have
+static void
+client_atfork_child(void)
+{
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    if (g_clients[i]) {
+      for (j = 0; j < IPMB_CLIENT_POOL_SIZE; j++) {
+        if (g_clients[i]->conn[j].fd >= 0) {
+          close(g_clients[i]->conn[j].fd);
+        }
+      }
+      g_clients[i] = NULL;
+    }
+  }
+  pthread_mutex_init(&g_clients_lock, NULL);
+}
+
+static void
+client_init_once(void)
+{
+  pthread_atfork(NULL, NULL, client_atfork_child);
+}
+
+// Deliver the responses of a connection until ipmbd closes it
+static void*
+client_reader(void *arg)
+{
+  client_reader_t *r = (client_reader_t *)arg;
+  client_conn_t *conn = r->conn;
+  unsigned char buf[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+  ipmb_mux_hdr_t hdr;
+  client_slot_t *slot;
+  int i, n;
+
+  for (;;) {
+    n = recv(r->fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < (int)sizeof(hdr)) {
+      break;
+    }
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    slot = &conn->slots[hdr.tag & (CLIENT_SLOTS - 1)];
+    pthread_mutex_lock(&r->client->mutex);
+    // A response to a request which timed out finds its slot reused
+    if (slot->tag == (int)hdr.tag && slot->state == SLOT_WAITING) {
+      slot->len = n - sizeof(hdr);
+      memcpy(slot->buf, buf + sizeof(hdr), slot->len);
+      slot->state = SLOT_DONE;
+      pthread_cond_signal(&slot->cond);
+    }
+    pthread_mutex_unlock(&r->client->mutex);
+  }
+
+  // The requests sent on this connection will not be answered. Only
+  // the reader closes the socket, so no one sends on a reused fd.
+  pthread_mutex_lock(&conn->send_lock);
+  pthread_mutex_lock(&r->client->mutex);
+  conn->fd = -1;
+  for (i = 0; i < CLIENT_SLOTS; i++) {
+    slot = &conn->slots[i];
+    if (slot->state == SLOT_WAITING && slot->gen == r->gen) {
+      slot->state = SLOT_FAILED;
+      pthread_cond_signal(&slot->cond);
+    }
+  }
+  pthread_cond_broadcast(&conn->closed);
+  pthread_mutex_unlock(&r->client->mutex);
+  close(r->fd);
+  pthread_mutex_unlock(&conn->send_lock);
+
+  free(r);
+  return NULL;
+}
+
+// With send_lock held: connect, unless connected
+static int
+client_connect(ipmb_client_t *client, client_conn_t *conn)
+{
+  struct sockaddr_un remote;
+  client_reader_t *r;
+  pthread_attr_t attr;
+  pthread_t tid;
+  int s, len;
+
+  if (conn->fd >= 0) {
+    return 0;
+  }
+
+  if ((s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+    return -1;
+  }
+
+  remote.sun_family = AF_UNIX;
+  sprintf(remote.sun_path, "%s_%d", SOCK_PATH_IPMB_MUX, client->bus_id);
+  len = strlen(remote.sun_path) + sizeof(remote.sun_family);
+  if (connect(s, (struct sockaddr *)&remote, len) == -1) {
+    close(s);
+    return -1;
+  }
+
+  if ((r = malloc(sizeof(client_reader_t))) == NULL) {
+    close(s);
+    return -1;
+  }
+
+  pthread_mutex_lock(&client->mutex);
+  conn->fd = s;
+  if (++conn->gen <= 0) {
+    conn->gen = 1;
+  }
+  r->client = client;
+  r->conn = conn;
+  r->fd = s;
+  r->gen = conn->gen;
+  pthread_mutex_unlock(&client->mutex);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&tid, &attr, client_reader, r) != 0) {
+    pthread_mutex_lock(&client->mutex);
+    conn->fd = -1;
+    pthread_mutex_unlock(&client->mutex);
+    close(s);
+    free(r);
+    pthread_attr_destroy(&attr);
+    return -1;
+  }
+  pthread_attr_destroy(&attr);
+
+  return 0;
+}
+
+static ipmb_client_t*
+client_new(unsigned char bus_id)
+{
+  ipmb_client_t *client;
+  pthread_condattr_t cattr;
+  int i, j;
+
+  if ((client = calloc(1, sizeof(ipmb_client_t))) == NULL) {
+    return NULL;
+  }
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  client->bus_id = bus_id;
+  pthread_mutex_init(&client->mutex, NULL);
+  for (i = 0; i < IPMB_CLIENT_POOL_SIZE; i++) {
+    client->conn[i].fd = -1;
+    pthread_mutex_init(&client->conn[i].send_lock, NULL);
+    pthread_cond_init(&client->conn[i].closed, NULL);
+    for (j = 0; j < CLIENT_SLOTS; j++) {
+      pthread_cond_init(&client->conn[i].slots[j].cond, &cattr);
+    }
+  }
+  pthread_condattr_destroy(&cattr);
+
+  return client;
+}
+
+ipmb_client_t*
+ipmb_client_get(unsigned char bus_id)
+{
+  ipmb_client_t *client;
+  int i, ret;
+
+  pthread_once(&g_clients_once, client_init_once);
+
+  pthread_mutex_lock(&g_clients_lock);
+  if ((client = g_clients[bus_id]) == NULL) {
+    client = g_clients[bus_id] = client_new(bus_id);
+  }
+  pthread_mutex_unlock(&g_clients_lock);
+  if (client == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&client->mutex);
+  for (i = 0; i < IPMB_CLIENT_POOL_SIZE; i++) {
+    if (client->conn[i].fd >= 0) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&client->mutex);
+  if (i < IPMB_CLIENT_POOL_SIZE) {
+    return client;
+  }
+
+  // Nothing connected: ipmbd is new to us, restarted, or has no such socket
+  pthread_mutex_lock(&client->conn[0].send_lock);
+  ret = client_connect(client, &client->conn[0]);
+  pthread_mutex_unlock(&client->conn[0].send_lock);
+
+  return (ret == 0) ? client : NULL;
+}
+
+static void
+client_slot_free(client_conn_t *conn, client_slot_t *slot)
+{
+  slot->tag = -1;
+  slot->state = SLOT_FREE;
+  conn->inflight--;
+}
+
+int
+ipmb_client_submit(ipmb_client_t *client,
+  unsigned char *request, unsigned short req_len)
+{
+  unsigned char buf[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+  ipmb_mux_hdr_t hdr;
+  client_conn_t *conn;
+  client_slot_t *slot = NULL;
+  int i, c = 0, tries, tag, gen;
+
+  if (req_len > MAX_IPMB_RES_LEN) {
+    return -1;
+  }
+
+  // A free slot on the least loaded connection, connected or not
+  pthread_mutex_lock(&client->mutex);
+  for (i = 1; i < IPMB_CLIENT_POOL_SIZE; i++) {
+    if (client->conn[i].inflight < client->conn[c].inflight) {
+      c = i;
+    }
+  }
+  conn = &client->conn[c];
+  for (i = 0; i < CLIENT_SLOTS; i++) {
+    if (conn->slots[i].state == SLOT_FREE) {
+      slot = &conn->slots[i];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    pthread_mutex_unlock(&client->mutex);
+    return -1;
+  }
+  client->seq = (client->seq + 1) & (INT32_MAX >> CLIENT_TAG_SHIFT);
+  tag = (client->seq << CLIENT_TAG_SHIFT) | (c << CLIENT_SLOT_BITS) | i;
+  slot->tag = tag;
+  slot->state = SLOT_WAITING;
+  slot->gen = 0;
+  conn->inflight++;
+  pthread_mutex_unlock(&client->mutex);
+
+  hdr.tag = tag;
+  memcpy(buf, &hdr, sizeof(hdr));
+  memcpy(buf + sizeof(hdr), request, req_len);
+
+  // A request which could not be sent never reached ipmbd, so it is
+  // safe to send again once reconnected
+  for (tries = 0; tries < 2; tries++) {
+    pthread_mutex_lock(&conn->send_lock);
+    if (client_connect(client, conn) < 0) {
+      pthread_mutex_unlock(&conn->send_lock);
+      break;
+    }
+    pthread_mutex_lock(&client->mutex);
+    slot->state = SLOT_WAITING;
+    slot->gen = gen = conn->gen;
+    pthread_mutex_unlock(&client->mutex);
+    if (send(conn->fd, buf, sizeof(hdr) + req_len, MSG_NOSIGNAL) ==
+        sizeof(hdr) + req_len) {
+      pthread_mutex_unlock(&conn->send_lock);
+      return tag;
+    }
+    // ipmbd went away: wait for the reader to see it too and close
+    shutdown(conn->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&conn->send_lock);
+    pthread_mutex_lock(&client->mutex);
+    while (conn->fd >= 0 && conn->gen == gen) {
+      pthread_cond_wait(&conn->closed, &client->mutex);
+    }
+    pthread_mutex_unlock(&client->mutex);
+  }
+
+#ifdef DEBUG
+  syslog(LOG_WARNING, "ipmb_client_submit: bus %d, send() failed\n", client->bus_id);
+#endif
+  pthread_mutex_lock(&client->mutex);
+  client_slot_free(conn, slot);
+  pthread_mutex_unlock(&client->mutex);
+  return -1;
+}
+
+int
+ipmb_client_wait(ipmb_client_t *client, int tag,
+  unsigned char *response, int timeout_ms)
+{
+  client_conn_t *conn;
+  client_slot_t *slot;
+  struct timespec deadline;
+  int len = -1;
+
+  if (tag < 0) {
+    return -1;
+  }
+  conn = &client->conn[(tag >> CLIENT_SLOT_BITS) & ((1 << CLIENT_CONN_BITS) - 1)];
+  slot = &conn->slots[tag & (CLIENT_SLOTS - 1)];
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&client->mutex);
+  if (slot->tag != tag) {
+    pthread_mutex_unlock(&client->mutex);
+    return -1;
+  }
+  while (slot->state == SLOT_WAITING) {
+    if (pthread_cond_timedwait(&slot->cond, &client->mutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  // ipmbd answers with no message when the target did not
+  if (slot->state == SLOT_DONE && slot->len > 0) {
+    len = slot->len;
+    memcpy(response, slot->buf, len);
+  }
+  client_slot_free(conn, slot);
+  pthread_mutex_unlock(&client->mutex);
+
+  return len;
+}
+
+int
+ipmb_client_xfer(ipmb_client_t *client,
+  unsigned char *request, unsigned short req_len,
+  unsigned char *response, int timeout_ms)
+{
+  return ipmb_client_wait(client,
+    ipmb_client_submit(client, request, req_len), response, timeout_ms);
+}
+
 /*
  * Function to handle IPMB messages
  */
@@ -93,15 +494,25 @@ lib_ipmb_handle(unsigned char bus_id,
             unsigned char *request, unsigned short req_len,
             unsigned char *response, unsigned char *res_len) {
 
+  ipmb_client_t *client;
   int s, t, len;
   int r, retries = 5, delay = 20;
   struct sockaddr_un remote;
   char sock_path[64] = {0};
   struct timeval tv;
 
+  // Connections kept across requests, if ipmbd has them
+  if ((client = ipmb_client_get(bus_id)) != NULL) {
+    t = ipmb_client_xfer(client, request, req_len, response,
+                         (TIMEOUT_IPMB + 1) * 1000);
+    if (t > 0) {
+      *res_len = t;
+    }
+    return;
+  }
+
   sprintf(sock_path, "%s_%d", SOCK_PATH_IPMB, bus_id);
 
-  // TODO: Need to update to reuse the socket instead of creating new
   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
 #ifdef DEBUG
     syslog(LOG_WARNING, "lib_ipmb_handle: socket() failed\n");
@@ -227,3 +638,271 @@ ipmb_send_internal (unsigned char bus_id,
 
   return data_len;
 }
+
+static int
+ipmb_connect(unsigned char bus_id)
+{
+  struct sockaddr_un remote;
+  int s, len;
+
+  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    return -1;
+  }
+
+  remote.sun_family = AF_UNIX;
+  sprintf(remote.sun_path, "%s_%d", SOCK_PATH_IPMB, bus_id);
+  len = strlen(remote.sun_path) + sizeof(remote.sun_family);
+
+  if (connect(s, (struct sockaddr *)&remote, len) == -1) {
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int
+ipmb_req_start(unsigned char bus_id,
+  unsigned char *request, unsigned short req_len)
+{
+  int s;
+
+  if ((s = ipmb_connect(bus_id)) < 0) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "ipmb_req_start: connect() failed\n");
+#endif
+    return -1;
+  }
+
+  if (send(s, request, req_len, MSG_NOSIGNAL) != req_len) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "ipmb_req_start: send() failed\n");
+#endif
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int
+ipmb_req_finish(int sock, unsigned char *response)
+{
+  int t;
+
+  do {
+    t = recv(sock, response, MAX_IPMB_RES_LEN, MSG_DONTWAIT);
+  } while (t < 0 && errno == EINTR);
+  close(sock);
+
+  // ipmbd closes the connection without a response when the target
+  // did not answer
+  return (t > 0) ? t : -1;
+}
+
+/*
+ * Windowed transfer
+ */
+typedef struct {
+  int sock;
+  int len;
+  int flags;
+  int tries;
+  struct timespec deadline;
+  unsigned char buf[MAX_IPMB_RES_LEN];
+} xfer_slot_t;
+
+static long
+ms_until(struct timespec *t)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (t->tv_sec - now.tv_sec) * 1000 +
+         (t->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+static int
+xfer_send(ipmb_xfer_t *x, xfer_slot_t *slot)
+{
+  int s;
+
+  if (x->connect) {
+    s = x->connect(x->ctx);
+    if (s >= 0 && send(s, slot->buf, slot->len, MSG_NOSIGNAL) != slot->len) {
+      close(s);
+      s = -1;
+    }
+  } else {
+    s = ipmb_req_start(x->bus_id, slot->buf, slot->len);
+  }
+
+  slot->sock = s;
+  clock_gettime(CLOCK_MONOTONIC, &slot->deadline);
+  slot->deadline.tv_sec += x->timeout_ms / 1000;
+  slot->deadline.tv_nsec += (x->timeout_ms % 1000) * 1000000;
+  if (slot->deadline.tv_nsec >= 1000000000) {
+    slot->deadline.tv_sec++;
+    slot->deadline.tv_nsec -= 1000000000;
+  }
+  x->requests++;
+
+  return (s < 0) ? -1 : 0;
+}
+
+// A request failed: back off and send it again
+static int
+xfer_retry(ipmb_xfer_t *x, xfer_slot_t *slot, int *good)
+{
+  *good = 0;
+  x->window = (x->window > 1) ? x->window / 2 : 1;
+  x->chunk = (x->chunk / 2 > x->min_chunk) ? x->chunk / 2 : x->min_chunk;
+
+  while (slot->tries++ < x->retries) {
+    x->retransmits++;
+    usleep(10 * 1000 * slot->tries);
+    if (xfer_send(x, slot) == 0) {
+      return 0;
+    }
+  }
+
+  syslog(LOG_WARNING, "ipmb_xfer: bus %d, request failed after %d tries\n",
+         x->bus_id, slot->tries);
+  return -1;
+}
+
+int
+ipmb_xfer(ipmb_xfer_t *x)
+{
+  xfer_slot_t *slots;
+  struct pollfd pfd[IPMB_XFER_WINDOW_MAX];
+  unsigned char res[MAX_IPMB_RES_LEN];
+  int idx[IPMB_XFER_WINDOW_MAX];
+  int inflight = 0, barrier = 0, pending = 0, end = 0, good = 0;
+  int i, n, ret = -1;
+  xfer_slot_t next;
+
+  if (x->max_window < 1 || x->max_window > IPMB_XFER_WINDOW_MAX ||
+      x->min_chunk < 1 || x->max_chunk < x->min_chunk || !x->next) {
+    return -1;
+  }
+
+  slots = calloc(IPMB_XFER_WINDOW_MAX, sizeof(xfer_slot_t));
+  if (!slots) {
+    return -1;
+  }
+  for (i = 0; i < IPMB_XFER_WINDOW_MAX; i++) {
+    slots[i].sock = -1;
+  }
+  if (x->window < 1 || x->window > x->max_window) {
+    x->window = x->max_window;
+  }
+  if (x->chunk < x->min_chunk || x->chunk > x->max_chunk) {
+    x->chunk = x->max_chunk;
+  }
+
+  for (;;) {
+    // Start requests while the window and the barriers allow
+    while (!end && !barrier && inflight < x->window) {
+      if (!pending) {
+        next.flags = 0;
+        next.len = x->next(x->ctx, next.buf, x->chunk, &next.flags);
+        if (next.len < 0) {
+          goto bail;
+        }
+        if (next.len == 0) {
+          end = 1;
+          break;
+        }
+        pending = 1;
+      }
+      if ((next.flags & IPMB_XFER_BARRIER) && inflight) {
+        break;
+      }
+
+      for (i = 0; slots[i].sock >= 0; i++);
+      memcpy(&slots[i], &next, sizeof(next));
+      slots[i].tries = 0;
+      pending = 0;
+      if (xfer_send(x, &slots[i]) < 0 && xfer_retry(x, &slots[i], &good) < 0) {
+        goto bail;
+      }
+      inflight++;
+      barrier = slots[i].flags & IPMB_XFER_BARRIER;
+    }
+
+    if (inflight == 0) {
+      if (end) {
+        break;
+      }
+      continue;
+    }
+
+    // Wait for the first response or the first deadline
+    long wait = -1;
+    for (i = 0, n = 0; i < IPMB_XFER_WINDOW_MAX; i++) {
+      if (slots[i].sock < 0) {
+        continue;
+      }
+      long ms = ms_until(&slots[i].deadline);
+      if (wait < 0 || ms < wait) {
+        wait = (ms > 0) ? ms : 0;
+      }
+      pfd[n].fd = slots[i].sock;
+      pfd[n].events = POLLIN;
+      idx[n++] = i;
+    }
+    if (poll(pfd, n, wait) < 0 && errno != EINTR) {
+      goto bail;
+    }
+
+    for (i = 0; i < n; i++) {
+      xfer_slot_t *slot = &slots[idx[i]];
+      int len;
+
+      if (pfd[i].revents) {
+        len = ipmb_req_finish(slot->sock, res);
+        slot->sock = -1;
+        if (len >= MIN_IPMB_RES_LEN && ((ipmb_res_t *)res)->cc == 0) {
+          inflight--;
+          if (slot->flags & IPMB_XFER_BARRIER) {
+            barrier = 0;
+          }
+          if (++good >= x->window) {
+            good = 0;
+            if (x->window < x->max_window) {
+              x->window++;
+            }
+            x->chunk = (x->chunk * 2 < x->max_chunk) ? x->chunk * 2 : x->max_chunk;
+          }
+          continue;
+        }
+        if (len >= MIN_IPMB_RES_LEN) {
+          x->naks++;
+        } else {
+          x->timeouts++;
+        }
+      } else if (ms_until(&slot->deadline) <= 0) {
+        close(slot->sock);
+        slot->sock = -1;
+        x->timeouts++;
+      } else {
+        continue;
+      }
+
+      if (xfer_retry(x, slot, &good) < 0) {
+        goto bail;
+      }
+    }
+  }
+  ret = 0;
+
+bail:
+  for (i = 0; i < IPMB_XFER_WINDOW_MAX; i++) {
+    if (slots[i].sock >= 0) {
+      close(slots[i].sock);
+    }
+  }
+  free(slots);
+  return ret;
+}
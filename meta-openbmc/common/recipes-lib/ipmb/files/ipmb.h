@@ -26,6 +26,8 @@ extern "C" {
 #endif
 
 #define SOCK_PATH_IPMB "/tmp/ipmb_socket"
+// Connections carrying many tagged requests, see ipmb_client_get()
+#define SOCK_PATH_IPMB_MUX "/tmp/ipmb_mux_socket"
 
 #define BMC_SLAVE_ADDR 0x10
 #define BRIDGE_SLAVE_ADDR 0x20
@@ -100,6 +102,112 @@ int ipmb_send_buf (unsigned char bus_id, unsigned char tlen);
 ipmb_res_t* ipmb_rxb();
 ipmb_req_t* ipmb_txb();
 
+/*
+ * ipmb_req_start():
+ *   Connect to ipmbd and send a complete request without waiting for the
+ *   response. Every started request has a connection of its own, so ipmbd
+ *   gives each one its own sequence number and they are in flight at the
+ *   same time.
+ *   Return the socket the response arrives on, on Success
+ *   Return -1 on failure
+ * ipmb_req_finish():
+ *   Read the response of a started request once its socket is readable
+ *   and close the socket. response must hold MAX_IPMB_RES_LEN bytes.
+ *   Return length of response on Success
+ *   Return -1 on failure
+ */
+int ipmb_req_start(unsigned char bus_id,
+  unsigned char *request, unsigned short req_len);
+int ipmb_req_finish(int sock, unsigned char *response);
+
+/*
+ * ipmb_xfer():
+ *   Send a stream of requests keeping up to 'window' of them in flight.
+ *   next() writes the next complete request into 'request', carrying at
+ *   most 'chunk' bytes of payload, and returns its length, 0 at the end of
+ *   the stream or -1 on error. A request it flags IPMB_XFER_BARRIER starts
+ *   only after all earlier ones completed, and later ones start only after
+ *   it completed.
+ *   A request which is NAKed or times out is sent again, up to 'retries'
+ *   times; each of those halves the window and the chunk size, and a
+ *   window's worth of completed requests in a row grows them again.
+ *   Return 0 on Success
+ *   Return -1 on failure
+ */
+#define IPMB_XFER_WINDOW_MAX  16
+#define IPMB_XFER_BARRIER     0x01
+
+typedef struct _ipmb_xfer_t {
+  unsigned char bus_id;
+  int max_window;
+  int max_chunk;
+  int min_chunk;
+  int retries;
+  int timeout_ms;
+  int (*next)(void *ctx, unsigned char *request, int chunk, int *flags);
+  // Optional, connects a new request instead of ipmbd on bus_id
+  int (*connect)(void *ctx);
+  void *ctx;
+  // Current window and chunk size, and counters
+  int window;
+  int chunk;
+  unsigned long requests;
+  unsigned long retransmits;
+  unsigned long naks;
+  unsigned long timeouts;
+} ipmb_xfer_t;
+
+int ipmb_xfer(ipmb_xfer_t *xfer);
+
+/*
+ * Multiplexed connections to ipmbd:
+ *   SOCK_PATH_IPMB_MUX_<bus> is a SOCK_SEQPACKET socket; every packet on
+ *   it is an ipmb_mux_hdr_t followed by a complete request or response.
+ *   A connection carries any number of requests at once, and ipmbd
+ *   answers each of them with the tag of the request, in the order the
+ *   responses come in. A response with no IPMB message means the target
+ *   did not answer.
+ */
+#define IPMB_MUX_MAX_INFLIGHT  32   // per connection, ipmbd reads no more
+
+typedef struct _ipmb_mux_hdr_t {
+  uint32_t tag;
+} ipmb_mux_hdr_t;
+
+/*
+ * ipmb_client_get():
+ *   Return the client handle of bus_id, shared by the whole process.
+ *   It keeps a pool of up to IPMB_CLIENT_POOL_SIZE connections to ipmbd,
+ *   made when first needed and made again if ipmbd restarts.
+ *   Return NULL if ipmbd can't be connected to, e.g. it has no
+ *   multiplexed socket
+ * ipmb_client_submit():
+ *   Send a complete request on the least loaded connection of the pool
+ *   without waiting for its response.
+ *   Return a tag for ipmb_client_wait() on Success
+ *   Return -1 on failure
+ * ipmb_client_wait():
+ *   Wait up to timeout_ms for the response of the request of tag; each
+ *   submitted request must be waited for once. response must hold
+ *   MAX_IPMB_RES_LEN bytes.
+ *   Return length of response on Success
+ *   Return -1 on failure or timeout
+ * ipmb_client_xfer():
+ *   ipmb_client_submit() and ipmb_client_wait() in one call
+ */
+#define IPMB_CLIENT_POOL_SIZE  2
+
+typedef struct _ipmb_client_t ipmb_client_t;
+
+ipmb_client_t* ipmb_client_get(unsigned char bus_id);
+int ipmb_client_submit(ipmb_client_t *client,
+  unsigned char *request, unsigned short req_len);
+int ipmb_client_wait(ipmb_client_t *client, int tag,
+  unsigned char *response, int timeout_ms);
+int ipmb_client_xfer(ipmb_client_t *client,
+  unsigned char *request, unsigned short req_len,
+  unsigned char *response, int timeout_ms);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,393 @@
+/*
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ipmb.h"
+
+/*
+ * The IPMB client against a loopback ipmbd: a stub serving both of
+ * ipmbd's sockets on an unused bus the way ipmbd does, a thread per
+ * connection on the old one and a thread per request on the multiplexed
+ * one. Its BIC echoes the request data back after the delay the request
+ * asks for, so responses come back out of order.
+ *
+ * Request data: {id (4 bytes), delay (2 bytes, usec), flags}
+ */
+
+#define TEST_BUS      250
+#define LATENCY_US    200
+#define BENCH_THREADS 8
+#define BENCH_REQS    2000  // per thread
+#define PIPE_DEPTH    16
+
+#define F_NO_ANSWER   0x01
+
+#define MAX_CONNS     64
+
+typedef struct {
+  int listen_sock;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  int conns[MAX_CONNS];
+  int nconns;
+  uint32_t order[PIPE_DEPTH];  // ids, as responses went out
+  int norder;
+} stub_t;
+
+typedef struct {
+  stub_t *stub;
+  int sock;
+  int len;
+  uint8_t buf[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+} stub_req_t;
+
+static stub_t g_legacy, g_mux;
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+make_req(uint8_t *req, uint32_t id, uint16_t delay_us, uint8_t flags)
+{
+  ipmb_req_t *rq = (ipmb_req_t *)req;
+
+  memset(rq, 0, sizeof(ipmb_req_t));
+  rq->res_slave_addr = BRIDGE_SLAVE_ADDR << 1;
+  rq->cmd = 0x01;
+  memcpy(&rq->data[0], &id, 4);
+  memcpy(&rq->data[4], &delay_us, 2);
+  rq->data[6] = flags;
+  return MIN_IPMB_REQ_LEN + 7;
+}
+
+static uint32_t
+res_id(uint8_t *res)
+{
+  uint32_t id;
+  memcpy(&id, ((ipmb_res_t *)res)->data, 4);
+  return id;
+}
+
+// The BIC: the response to req, 0 for none
+static int
+bic_handle(stub_t *stub, uint8_t *req, int len, uint8_t *res)
+{
+  ipmb_req_t *rq = (ipmb_req_t *)req;
+  ipmb_res_t *rs = (ipmb_res_t *)res;
+  uint16_t delay;
+  uint32_t id;
+
+  assert(len == MIN_IPMB_REQ_LEN + 7);
+  memcpy(&id, &rq->data[0], 4);
+  memcpy(&delay, &rq->data[4], 2);
+  usleep(delay);
+  if (rq->data[6] & F_NO_ANSWER) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&stub->lock);
+  if (stub->norder < PIPE_DEPTH) {
+    stub->order[stub->norder++] = id;
+  }
+  pthread_mutex_unlock(&stub->lock);
+
+  memset(rs, 0, MIN_IPMB_RES_LEN);
+  rs->cmd = rq->cmd;
+  memcpy(rs->data, rq->data, len - MIN_IPMB_REQ_LEN);
+  return len - MIN_IPMB_REQ_LEN + MIN_IPMB_RES_LEN;
+}
+
+static void *
+legacy_conn(void *arg)
+{
+  stub_req_t *r = arg;
+  uint8_t res[MAX_IPMB_RES_LEN];
+  int n;
+
+  n = recv(r->sock, r->buf, MAX_IPMB_RES_LEN, 0);
+  if (n > 0 && (n = bic_handle(r->stub, r->buf, n, res)) > 0) {
+    send(r->sock, res, n, MSG_NOSIGNAL);
+  }
+  close(r->sock);
+  free(r);
+  return NULL;
+}
+
+static void *
+mux_req(void *arg)
+{
+  stub_req_t *r = arg;
+  uint8_t res[sizeof(ipmb_mux_hdr_t) + MAX_IPMB_RES_LEN];
+  int n;
+
+  memcpy(res, r->buf, sizeof(ipmb_mux_hdr_t));
+  n = bic_handle(r->stub, r->buf + sizeof(ipmb_mux_hdr_t),
+                 r->len - sizeof(ipmb_mux_hdr_t), res + sizeof(ipmb_mux_hdr_t));
+  send(r->sock, res, sizeof(ipmb_mux_hdr_t) + n, MSG_NOSIGNAL);
+  free(r);
+  return NULL;
+}
+
+static void *
+mux_conn(void *arg)
+{
+  stub_req_t *c = arg, *r;
+  pthread_t tid;
+
+  for (;;) {
+    r = malloc(sizeof(stub_req_t));
+    assert(r);
+    r->stub = c->stub;
+    r->sock = c->sock;
+    r->len = recv(c->sock, r->buf, sizeof(r->buf), 0);
+    if (r->len < (int)sizeof(ipmb_mux_hdr_t)) {
+      free(r);
+      break;
+    }
+    assert(pthread_create(&tid, NULL, mux_req, r) == 0);
+    pthread_detach(tid);
+  }
+  // Requests still being handled fail to send, as with ipmbd going away
+  free(c);
+  return NULL;
+}
+
+static void *
+stub_accept(void *arg)
+{
+  stub_t *stub = arg;
+  stub_req_t *c;
+  pthread_t tid;
+  int s;
+
+  while ((s = accept(stub->listen_sock, NULL, NULL)) >= 0) {
+    c = malloc(sizeof(stub_req_t));
+    assert(c);
+    c->stub = stub;
+    c->sock = s;
+    if (stub == &g_mux) {
+      pthread_mutex_lock(&stub->lock);
+      assert(stub->nconns < MAX_CONNS);
+      stub->conns[stub->nconns++] = s;
+      pthread_mutex_unlock(&stub->lock);
+      assert(pthread_create(&tid, NULL, mux_conn, c) == 0);
+    } else {
+      assert(pthread_create(&tid, NULL, legacy_conn, c) == 0);
+    }
+    pthread_detach(tid);
+  }
+  return NULL;
+}
+
+static void
+stub_start(stub_t *stub, const char *path, int type)
+{
+  struct sockaddr_un local;
+
+  stub->listen_sock = socket(AF_UNIX, type, 0);
+  assert(stub->listen_sock >= 0);
+  local.sun_family = AF_UNIX;
+  snprintf(local.sun_path, sizeof(local.sun_path), "%s_%d", path, TEST_BUS);
+  unlink(local.sun_path);
+  assert(bind(stub->listen_sock, (struct sockaddr *)&local, sizeof(local)) == 0);
+  assert(listen(stub->listen_sock, 64) == 0);
+  stub->nconns = 0;
+  assert(pthread_create(&stub->tid, NULL, stub_accept, stub) == 0);
+}
+
+// ipmbd going away: the socket and its connections with it
+static void
+stub_stop(stub_t *stub, const char *path)
+{
+  char sock_path[64];
+  int i;
+
+  shutdown(stub->listen_sock, SHUT_RDWR);
+  pthread_join(stub->tid, NULL);
+  close(stub->listen_sock);
+  snprintf(sock_path, sizeof(sock_path), "%s_%d", path, TEST_BUS);
+  unlink(sock_path);
+
+  pthread_mutex_lock(&stub->lock);
+  for (i = 0; i < stub->nconns; i++) {
+    shutdown(stub->conns[i], SHUT_RDWR);
+  }
+  stub->nconns = 0;
+  pthread_mutex_unlock(&stub->lock);
+}
+
+typedef struct {
+  int id;
+  double *lat;
+} bench_thread_t;
+
+static void *
+bench_thread(void *arg)
+{
+  bench_thread_t *b = arg;
+  uint8_t req[MAX_IPMB_RES_LEN], res[MAX_IPMB_RES_LEN];
+  uint8_t rlen;
+  uint32_t id;
+  double start;
+  int i, tlen;
+
+  for (i = 0; i < BENCH_REQS; i++) {
+    id = b->id * BENCH_REQS + i;
+    tlen = make_req(req, id, LATENCY_US, 0);
+    rlen = 0;
+    start = now();
+    lib_ipmb_handle(TEST_BUS, req, tlen, res, &rlen);
+    b->lat[i] = now() - start;
+    assert(rlen == MIN_IPMB_RES_LEN + 7 && res_id(res) == id);
+  }
+  return NULL;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Requests/s through lib_ipmb_handle() from BENCH_THREADS threads
+static double
+bench(const char *name)
+{
+  static double lat[BENCH_THREADS * BENCH_REQS];
+  bench_thread_t b[BENCH_THREADS];
+  pthread_t tid[BENCH_THREADS];
+  double start, secs, rate;
+  int i, n = BENCH_THREADS * BENCH_REQS;
+
+  start = now();
+  for (i = 0; i < BENCH_THREADS; i++) {
+    b[i].id = i;
+    b[i].lat = &lat[i * BENCH_REQS];
+    assert(pthread_create(&tid[i], NULL, bench_thread, &b[i]) == 0);
+  }
+  for (i = 0; i < BENCH_THREADS; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  secs = now() - start;
+
+  qsort(lat, n, sizeof(double), cmp_double);
+  rate = n / secs;
+  printf("%-8s %d threads: %7.0f requests/s, p50 %5.0f us, p99 %5.0f us\n",
+         name, BENCH_THREADS, rate, lat[n / 2] * 1e6, lat[n * 99 / 100] * 1e6);
+  return rate;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint8_t req[MAX_IPMB_RES_LEN], res[MAX_IPMB_RES_LEN];
+  int tags[PIPE_DEPTH];
+  ipmb_client_t *client;
+  double legacy, pooled, start;
+  uint8_t rlen;
+  int i, tlen, tag;
+
+  pthread_mutex_init(&g_legacy.lock, NULL);
+  pthread_mutex_init(&g_mux.lock, NULL);
+
+  // An ipmbd without the multiplexed socket is still served
+  stub_start(&g_legacy, SOCK_PATH_IPMB, SOCK_STREAM);
+  assert(ipmb_client_get(TEST_BUS) == NULL);
+  tlen = make_req(req, 1, 0, 0);
+  rlen = 0;
+  lib_ipmb_handle(TEST_BUS, req, tlen, res, &rlen);
+  assert(rlen == MIN_IPMB_RES_LEN + 7 && res_id(res) == 1);
+  legacy = bench("legacy");
+
+  stub_start(&g_mux, SOCK_PATH_IPMB_MUX, SOCK_SEQPACKET);
+  client = ipmb_client_get(TEST_BUS);
+  assert(client);
+
+  // Pipelined on one connection, answered in the reverse order
+  g_mux.norder = 0;
+  for (i = 0; i < PIPE_DEPTH; i++) {
+    tlen = make_req(req, 100 + i, (PIPE_DEPTH - i) * 2000, 0);
+    tags[i] = ipmb_client_submit(client, req, tlen);
+    assert(tags[i] >= 0);
+  }
+  for (i = 0; i < PIPE_DEPTH; i++) {
+    assert(ipmb_client_wait(client, tags[i], res, 1000) == MIN_IPMB_RES_LEN + 7);
+    assert(res_id(res) == 100 + i);
+  }
+  assert(g_mux.norder == PIPE_DEPTH);
+  assert(g_mux.order[0] == 100 + PIPE_DEPTH - 1);
+  assert(g_mux.order[PIPE_DEPTH - 1] == 100);
+  printf("pipelined: %d requests answered out of order\n", PIPE_DEPTH);
+
+  pooled = bench("pooled");
+  assert(pooled > legacy);
+
+  // No answer from the target, and a late answer which must not be
+  // taken for the answer to the next request
+  tlen = make_req(req, 200, 0, F_NO_ANSWER);
+  assert(ipmb_client_xfer(client, req, tlen, res, 1000) == -1);
+  tlen = make_req(req, 201, 60 * 1000, 0);
+  assert(ipmb_client_xfer(client, req, tlen, res, 20) == -1);
+  tlen = make_req(req, 202, 50 * 1000, 0);
+  assert(ipmb_client_xfer(client, req, tlen, res, 1000) == MIN_IPMB_RES_LEN + 7);
+  assert(res_id(res) == 202);
+  printf("timeouts: late response dropped\n");
+
+  // ipmbd restarting fails what it had in flight, right away, and the
+  // next requests go to the new one
+  tlen = make_req(req, 300, 50 * 1000, 0);
+  tag = ipmb_client_submit(client, req, tlen);
+  assert(tag >= 0);
+  usleep(10 * 1000);
+  start = now();
+  stub_stop(&g_mux, SOCK_PATH_IPMB_MUX);
+  stub_start(&g_mux, SOCK_PATH_IPMB_MUX, SOCK_SEQPACKET);
+  assert(ipmb_client_wait(client, tag, res, 5000) == -1);
+  assert(now() - start < 1);
+  for (i = 0; i < 20; i++) {
+    // Right after the restart, before the client has seen it, or later
+    stub_stop(&g_mux, SOCK_PATH_IPMB_MUX);
+    stub_start(&g_mux, SOCK_PATH_IPMB_MUX, SOCK_SEQPACKET);
+    usleep((i % 2) * 1000);
+    tlen = make_req(req, 400 + i, 0, 0);
+    rlen = 0;
+    lib_ipmb_handle(TEST_BUS, req, tlen, res, &rlen);
+    assert(rlen == MIN_IPMB_RES_LEN + 7 && res_id(res) == 400 + i);
+  }
+  printf("restart: reconnected\n");
+
+  stub_stop(&g_mux, SOCK_PATH_IPMB_MUX);
+  stub_stop(&g_legacy, SOCK_PATH_IPMB);
+  printf("All tests passed\n");
+  return 0;
+}
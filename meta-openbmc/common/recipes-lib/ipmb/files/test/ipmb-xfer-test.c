@@ -0,0 +1,312 @@
+/*
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "ipmb.h"
+
+/*
+ * ipmb_xfer() against a simulated BIC: every request gets a socketpair
+ * and a thread standing in for ipmbd. Requests carry {offset, len, data}
+ * of an image the simulated BIC writes into its flash; it can NAK, drop
+ * or stall chosen requests and checks that barriers are honoured.
+ */
+
+#define IMAGE_SIZE    (256 * 1024)
+#define BLOCK_SIZE    (64 * 1024)
+#define MAX_CHUNK     224
+#define WIRE_US       300   // one request on the bus, serialized
+#define LATENCY_US    2000  // BIC handling, overlaps between requests
+#define TIMEOUT_MS    200
+#define STALL_MS      400
+
+enum {
+  FAULT_NONE = 0,
+  FAULT_NAK,
+  FAULT_DROP,
+  FAULT_STALL,
+};
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_mutex_t bus;
+  uint8_t flash[IMAGE_SIZE];
+  uint8_t written[IMAGE_SIZE];
+  unsigned long received;
+  int nak_every;
+  int drop_every;
+  int stall_at;
+  int violations;
+} bic_t;
+
+typedef struct {
+  bic_t *bic;
+  int sock;
+} conn_t;
+
+typedef struct {
+  ipmb_xfer_t *xfer;
+  const uint8_t *image;
+  int offset;
+  int min_window;
+} stream_t;
+
+typedef struct {
+  stream_t stream;
+  bic_t *bic;
+} test_ctx_t;
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+bic_conn(void *arg)
+{
+  conn_t *c = arg;
+  bic_t *bic = c->bic;
+  uint8_t req[MAX_IPMB_RES_LEN];
+  uint8_t res[MIN_IPMB_RES_LEN];
+  ipmb_req_t *rq = (ipmb_req_t *)req;
+  ipmb_res_t *rs = (ipmb_res_t *)res;
+  int fault = FAULT_NONE;
+  uint32_t offset;
+  uint16_t len;
+  unsigned long n;
+  int i, t;
+
+  t = recv(c->sock, req, sizeof(req), 0);
+  assert(t >= MIN_IPMB_REQ_LEN + 6);
+
+  pthread_mutex_lock(&bic->bus);
+  usleep(WIRE_US);
+  pthread_mutex_unlock(&bic->bus);
+
+  memcpy(&offset, &rq->data[0], 4);
+  memcpy(&len, &rq->data[4], 2);
+  assert(t == MIN_IPMB_REQ_LEN - 1 + 6 + len);
+  assert(offset + len <= IMAGE_SIZE);
+
+  pthread_mutex_lock(&bic->lock);
+  n = ++bic->received;
+  if (bic->nak_every && n % bic->nak_every == 0) {
+    fault = FAULT_NAK;
+  } else if (bic->drop_every && n % bic->drop_every == 0) {
+    fault = FAULT_DROP;
+  } else if (bic->stall_at && n == bic->stall_at) {
+    fault = FAULT_STALL;
+  }
+
+  // A barrier starts only after everything before it completed, and
+  // nothing after a barrier starts before it completed
+  if (rq->cmd & IPMB_XFER_BARRIER) {
+    for (i = 0; i < offset; i++) {
+      if (!bic->written[i]) {
+        bic->violations++;
+        break;
+      }
+    }
+  } else if (!bic->written[offset - offset % BLOCK_SIZE] &&
+             offset % BLOCK_SIZE) {
+    bic->violations++;
+  }
+
+  if (fault != FAULT_NAK) {
+    memcpy(&bic->flash[offset], &rq->data[6], len);
+    memset(&bic->written[offset], 1, len);
+  }
+  pthread_mutex_unlock(&bic->lock);
+
+  usleep(LATENCY_US);
+  if (fault == FAULT_STALL) {
+    usleep(STALL_MS * 1000);
+  }
+
+  if (fault != FAULT_DROP) {
+    memset(res, 0, sizeof(res));
+    rs->cmd = rq->cmd;
+    rs->cc = (fault == FAULT_NAK) ? 0xC0 : 0;
+    send(c->sock, res, sizeof(res), MSG_NOSIGNAL);
+  }
+  close(c->sock);
+  free(c);
+  return NULL;
+}
+
+static int
+test_connect(void *ctx)
+{
+  test_ctx_t *t = ctx;
+  pthread_t tid;
+  conn_t *c;
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    return -1;
+  }
+  c = malloc(sizeof(conn_t));
+  assert(c);
+  c->bic = t->bic;
+  c->sock = sv[1];
+  assert(pthread_create(&tid, NULL, bic_conn, c) == 0);
+  pthread_detach(tid);
+  return sv[0];
+}
+
+static int
+test_next(void *ctx, unsigned char *request, int chunk, int *flags)
+{
+  test_ctx_t *t = ctx;
+  stream_t *s = &t->stream;
+  ipmb_req_t *rq = (ipmb_req_t *)request;
+  uint32_t offset = s->offset;
+  uint16_t len;
+
+  if (s->xfer->window < s->min_window) {
+    s->min_window = s->xfer->window;
+  }
+  if (offset >= IMAGE_SIZE) {
+    return 0;
+  }
+
+  len = (IMAGE_SIZE - offset < chunk) ? IMAGE_SIZE - offset : chunk;
+  // like BIOS updates, never cross an erase block
+  if (offset / BLOCK_SIZE != (offset + len - 1) / BLOCK_SIZE) {
+    len = BLOCK_SIZE - offset % BLOCK_SIZE;
+  }
+  s->offset += len;
+
+  if (offset % BLOCK_SIZE == 0 || s->offset == IMAGE_SIZE) {
+    *flags |= IPMB_XFER_BARRIER;
+  }
+
+  memset(rq, 0, sizeof(ipmb_req_t));
+  rq->res_slave_addr = BRIDGE_SLAVE_ADDR << 1;
+  rq->cmd = *flags;
+  memcpy(&rq->data[0], &offset, 4);
+  memcpy(&rq->data[4], &len, 2);
+  memcpy(&rq->data[6], &s->image[offset], len);
+
+  return MIN_IPMB_REQ_LEN - 1 + 6 + len;
+}
+
+static double
+run(const char *name, bic_t *bic, const uint8_t *image, int window,
+    ipmb_xfer_t *out)
+{
+  ipmb_xfer_t xfer;
+  test_ctx_t t;
+  double start, secs;
+
+  memset(bic->flash, 0xff, sizeof(bic->flash));
+  memset(bic->written, 0, sizeof(bic->written));
+  bic->received = 0;
+  bic->violations = 0;
+
+  memset(&t, 0, sizeof(t));
+  memset(&xfer, 0, sizeof(xfer));
+  t.bic = bic;
+  t.stream.xfer = &xfer;
+  t.stream.image = image;
+  t.stream.min_window = window;
+
+  xfer.max_window = window;
+  xfer.max_chunk = MAX_CHUNK;
+  xfer.min_chunk = 32;
+  xfer.retries = 3;
+  xfer.timeout_ms = TIMEOUT_MS;
+  xfer.next = test_next;
+  xfer.connect = test_connect;
+  xfer.ctx = &t;
+
+  start = now();
+  assert(ipmb_xfer(&xfer) == 0);
+  secs = now() - start;
+
+  assert(memcmp(bic->flash, image, IMAGE_SIZE) == 0);
+  assert(bic->violations == 0);
+
+  printf("%-8s window %2d: %6.1f KB/s, %lu requests, %lu retransmitted "
+         "(%lu NAK, %lu timeout), window %d..%d, chunk %d\n",
+         name, window, IMAGE_SIZE / 1024.0 / secs, xfer.requests,
+         xfer.retransmits, xfer.naks, xfer.timeouts, t.stream.min_window,
+         xfer.window, xfer.chunk);
+  if (out) {
+    *out = xfer;
+    out->window = t.stream.min_window;
+  }
+  return secs;
+}
+
+int
+main(int argc, char **argv)
+{
+  static bic_t bic;
+  static uint8_t image[IMAGE_SIZE];
+  ipmb_xfer_t x;
+  double serial, windowed;
+  int i;
+
+  srand(1);
+  for (i = 0; i < IMAGE_SIZE; i++) {
+    image[i] = rand();
+  }
+  pthread_mutex_init(&bic.lock, NULL);
+  pthread_mutex_init(&bic.bus, NULL);
+
+  // clean link: pipelining has to pay off
+  serial = run("clean", &bic, image, 1, &x);
+  assert(x.retransmits == 0);
+  windowed = run("clean", &bic, image, 8, &x);
+  assert(x.retransmits == 0);
+  assert(windowed * 2 < serial);
+
+  // NAKs are retried and shrink the window
+  bic.nak_every = 37;
+  run("nak", &bic, image, 8, &x);
+  assert(x.naks > 0 && x.retransmits == x.naks);
+  assert(x.window < 8);
+  bic.nak_every = 0;
+
+  // dropped responses look like ipmbd timing out
+  bic.drop_every = 53;
+  run("drop", &bic, image, 8, &x);
+  assert(x.timeouts > 0);
+  bic.drop_every = 0;
+
+  // a stalled BIC is timed out and the transfer recovers
+  bic.stall_at = 100;
+  run("stall", &bic, image, 8, &x);
+  assert(x.timeouts == 1);
+  assert(x.window == 4);
+  bic.stall_at = 0;
+
+  printf("All tests passed\n");
+  return 0;
+}
@@ -34,22 +34,19 @@
 #define MAX_IPMI_RES_LEN 300
 
 /*
- * Function to handle IPMI messages
+ * Connect to ipmid, returns the socket or -1 on failure
  */
-void
-lib_ipmi_handle(unsigned char *request, unsigned char req_len,
-            unsigned char *response, unsigned short *res_len) {
-
-  int s, t, len;
+static int
+ipmi_connect(void) {
+  int s, len;
   struct sockaddr_un remote;
   struct timeval tv;
 
-  // TODO: Need to update to reuse the socket instead of creating new
   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
 #ifdef DEBUG
     syslog(LOG_WARNING, "lib_ipmi_handle: socket() failed\n");
 #endif
-    return;
+    return -1;
   }
 
   // setup timeout for receving on socket
@@ -66,31 +63,95 @@ lib_ipmi_handle(unsigned char *request, unsigned char req_len,
 #ifdef DEBUG
     syslog(LOG_WARNING, "lib_ipmi_handle: connect() failed\n");
 #endif
-    return;
+    close(s);
+    return -1;
   }
 
-  if (send(s, request, req_len, 0) == -1) {
+  return s;
+}
+
+/*
+ * Send one request on a connected socket and wait for its response
+ * returns 0 on success, -1 if the request could not be sent, -2 if it
+ * was sent but no response came back
+ */
+static int
+ipmi_transfer(int s, unsigned char *request, unsigned char req_len,
+            unsigned char *response, unsigned short *res_len) {
+  int t;
+
+  if (send(s, request, req_len, MSG_NOSIGNAL) == -1) {
 #ifdef DEBUG
     syslog(LOG_WARNING, "lib_ipmi_handle: send() failed\n");
 #endif
-    return;
+    return -1;
   }
 
   if ((t=recv(s, response, MAX_IPMI_RES_LEN, 0)) > 0) {
     *res_len = t;
-  } else {
-    if (t < 0) {
+    return 0;
+  }
+
 #ifdef DEBUG
-      syslog(LOG_WARNING, "lib_ipmi_handle: recv() failed\n");
+  if (t < 0) {
+    syslog(LOG_WARNING, "lib_ipmi_handle: recv() failed\n");
+  } else {
+    syslog(LOG_WARNING, "lib_ipmi_handle: server closed connection\n");
+  }
 #endif
-    } else {
-      printf("Server closed connection");
-    }
 
+  return -2;
+}
+
+/*
+ * Function to handle IPMI messages
+ */
+void
+lib_ipmi_handle(unsigned char *request, unsigned char req_len,
+            unsigned char *response, unsigned short *res_len) {
+
+  int s;
+
+  if ((s = ipmi_connect()) < 0) {
     return;
   }
 
+  ipmi_transfer(s, request, req_len, response, res_len);
+
   close(s);
 
   return;
 }
+
+/*
+ * Function to handle IPMI messages over a connection kept open across
+ * calls. *sock must be initialized to -1 and is (re)connected as needed;
+ * a request that can't be sent on a stale connection (e.g. ipmid
+ * restarted) is retried once on a fresh one. One that was sent is never
+ * sent again: ipmid may have executed it already.
+ * returns 0 on success, -1 on failure
+ */
+int
+lib_ipmi_handle_persistent(int *sock, unsigned char *request,
+            unsigned char req_len, unsigned char *response,
+            unsigned short *res_len) {
+  int retry, ret;
+
+  for (retry = 0; retry < 2; retry++) {
+    if (*sock < 0 && (*sock = ipmi_connect()) < 0) {
+      return -1;
+    }
+
+    if ((ret = ipmi_transfer(*sock, request, req_len, response, res_len)) == 0) {
+      return 0;
+    }
+
+    close(*sock);
+    *sock = -1;
+    if (ret != -1) {
+      break;
+    }
+  }
+
+  return -1;
+}
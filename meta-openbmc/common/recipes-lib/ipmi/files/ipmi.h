@@ -626,6 +626,9 @@ enum CHANNEL_MEDIUM_TYPE {
 
 void lib_ipmi_handle(unsigned char *request, unsigned char req_len,
                  unsigned char *response, unsigned short *res_len);
+int lib_ipmi_handle_persistent(int *sock, unsigned char *request,
+                 unsigned char req_len, unsigned char *response,
+                 unsigned short *res_len);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -19,27 +19,26 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <syslog.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include "kv.h"
+#ifdef CONFIG_KV_LOG_STORE
+#include "kv_log.h"
+#endif
 
+#ifndef CONFIG_KV_LOG_STORE
 /*
-*  set binary value
-*  retrun number of successfully write
+*  create the directories leading to kpath
 */
-int
-kv_set_bin(char *key, char *value, unsigned char len) {
-  FILE *fp;
-  int rc, ret = 0;
-  char kpath[MAX_KEY_PATH_LEN] = {0};
-  char *p;
-
-  sprintf(kpath, KV_STORE, key);
+static void
+kv_mkdir_parents(char *kpath) {
+  char *p = &kpath[strlen(KV_STORE_PATH)-1];
 
-  p = &kpath[strlen(KV_STORE_PATH)-1];
   while ((*p != '\0') && ((p = strchr(p+1, '/')) != NULL)) {
     *p = '\0';
     if (access(kpath, F_OK) == -1) {
@@ -47,56 +46,89 @@ kv_set_bin(char *key, char *value, unsigned char len) {
     }
     *p = '/';
   }
+}
 
-  fp = fopen(kpath, "r+");
-  if (!fp && (errno == ENOENT))
-    fp = fopen(kpath, "w");
-  if (!fp) {
-    int err = errno;
-#ifdef DEBUG
-    syslog(LOG_WARNING, "kv_set: failed to open %s", kpath);
-#endif
-    return err;
-  }
+/*
+*  read the current value of kpath
+*  retrun number of bytes read, -1 on failure
+*/
+static int
+kv_read_file(const char *kpath, char *value, int size) {
+  int fd, ret;
 
-  rc = flock(fileno(fp), LOCK_EX);
-  if (rc < 0) {
-    int err = errno;
-#ifdef DEBUG
-    syslog(LOG_WARNING, "kv_set: failed to flock on %s, err %d", kpath, err);
+  fd = open(kpath, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  ret = read(fd, value, size);
+  close(fd);
+
+  return ret;
+}
 #endif
-    fclose(fp);
+
+/*
+*  set binary value
+*  retrun number of successfully write
+*/
+int
+kv_set_bin(char *key, char *value, unsigned char len) {
+#ifdef CONFIG_KV_LOG_STORE
+  return kv_log_set(key, value, len);
+#else
+  int fd, ret;
+  char kpath[MAX_KEY_PATH_LEN] = {0};
+  char tpath[MAX_KEY_PATH_LEN + 16] = {0};
+  char cur[256];
+
+  if (snprintf(kpath, sizeof(kpath), KV_STORE, key) >= sizeof(kpath))
     return -1;
-  }
 
-  if (ftruncate(fileno(fp), 0) < 0) {  //truncate cache file after getting flock
-    fclose(fp);
+  // Rewriting an unchanged value only wears the flash
+  ret = kv_read_file(kpath, cur, sizeof(cur));
+  if (ret == len && !memcmp(cur, value, len))
+    return len;
+
+  // Write a private copy and rename it over the key so that a power loss
+  // leaves either the old or the new value, never a truncated one. The
+  // copy is unique to this call, as other threads may set the same key.
+  snprintf(tpath, sizeof(tpath), "%s.XXXXXX", kpath);
+  fd = mkstemp(tpath);
+  if (fd < 0 && errno == ENOENT) {
+    kv_mkdir_parents(kpath);
+    snprintf(tpath, sizeof(tpath), "%s.XXXXXX", kpath);
+    fd = mkstemp(tpath);
+  }
+  if (fd < 0) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "kv_set: failed to open %s", tpath);
+#endif
     return -1;
   }
+  // mkstemp() makes it 0600, keys are read by other users
+  fchmod(fd, 0644);
 
-  ret = fwrite(value, 1, len, fp);
-  if (ret < 0) {
+  ret = write(fd, value, len);
+  if (ret != len || fsync(fd) < 0) {
 #ifdef DEBUG
-    syslog(LOG_WARNING, "kv_set: failed to write to %s", kpath);
+    syslog(LOG_WARNING, "kv_set: failed to write to %s", tpath);
 #endif
-    fclose(fp);
-    return ENOENT;
+    close(fd);
+    unlink(tpath);
+    return -1;
   }
-  fflush(fp);
+  close(fd);
 
-  rc = flock(fileno(fp), LOCK_UN);
-  if (rc < 0) {
-    int err = errno;
+  if (rename(tpath, kpath) < 0) {
 #ifdef DEBUG
-    syslog(LOG_WARNING, "kv_set: failed to unlock flock on %s, err %d", kpath, err);
+    syslog(LOG_WARNING, "kv_set: failed to rename %s, err %d", tpath, errno);
 #endif
-    fclose(fp);
+    unlink(tpath);
     return -1;
   }
 
-  fclose(fp);
-
   return ret;
+#endif
 }
 
 /*
@@ -105,63 +137,50 @@ kv_set_bin(char *key, char *value, unsigned char len) {
 */
 int
 kv_get_bin(char *key, char *value) {
-  FILE *fp;
-  int rc, ret=0;
+#ifdef CONFIG_KV_LOG_STORE
+  return kv_log_get(key, value);
+#else
   char kpath[MAX_KEY_PATH_LEN] = {0};
-  char *p;
-
-  sprintf(kpath, KV_STORE, key);
+  int ret;
 
-  p = &kpath[strlen(KV_STORE_PATH)-1];
-  while ((*p != '\0') && ((p = strchr(p+1, '/')) != NULL)) {
-    *p = '\0';
-    if (access(kpath, F_OK) == -1) {
-      mkdir(kpath, 0777);
-    }
-    *p = '/';
-  }
-
-  fp = fopen(kpath, "r");
-  if (!fp) {
-    int err = errno;
-#ifdef DEBUG
-    syslog(LOG_WARNING, "kv_get: failed to open %s, err %d", kpath, err);
-#endif
+  if (snprintf(kpath, sizeof(kpath), KV_STORE, key) >= sizeof(kpath))
     return -1;
-  }
 
-  rc = flock(fileno(fp), LOCK_EX);
-  if (rc < 0) {
-    int err = errno;
+  // Values are replaced by rename, so a plain read never sees a partial one
+  ret = kv_read_file(kpath, value, MAX_VALUE_LEN);
 #ifdef DEBUG
-    syslog(LOG_WARNING, "kv_get: failed to flock %s, err %d", kpath, err);
+  if (ret < 0)
+    syslog(LOG_INFO, "kv_get: failed to read %s, err %d", kpath, errno);
 #endif
-    fclose(fp);
-    return -1;
-  }
 
-  ret = (int) fread(value, 1, MAX_VALUE_LEN, fp);
-  if (ret < 0 || ferror(fp)) {
-#ifdef DEBUG
-    syslog(LOG_INFO, "kv_get: failed to read %s", kpath);
+  return ret;
 #endif
-    fclose(fp);
-    return -1;
-  }
+}
 
-  rc = flock(fileno(fp), LOCK_UN);
-  if (rc < 0) {
-    int err = errno;
-#ifdef DEBUG
-    syslog(LOG_WARNING, "kv_get: failed to unlock flock on %s, err %d", kpath, err);
+/*
+*  start grouping kv_set calls into one commit
+*  retrun 0 on success, else on failure
+*/
+int
+kv_batch_begin(void) {
+#ifdef CONFIG_KV_LOG_STORE
+  return kv_log_batch_begin();
+#else
+  return 0;
 #endif
-    fclose(fp);
-    return -1;
-  }
-
-  fclose(fp);
+}
 
-  return ret;
+/*
+*  commit the kv_set calls made since kv_batch_begin
+*  retrun 0 on success, else on failure
+*/
+int
+kv_batch_end(void) {
+#ifdef CONFIG_KV_LOG_STORE
+  return kv_log_batch_end();
+#else
+  return 0;
+#endif
 }
 
 /*
@@ -33,11 +33,24 @@ extern "C" {
 #define KV_STORE "/mnt/data/kv_store/%s"
 #define KV_STORE_PATH "/mnt/data/kv_store"
 
+/*
+ * Log-structured store used when built with CONFIG_KV_LOG_STORE.
+ * Existing KV_STORE_PATH files are imported on first use.
+ */
+#define KV_LOG_FILE "/mnt/data/kv_store.log"
+
 int kv_get(char* key, char *value);
 int kv_set(char* key, char *value);
 int kv_get_bin(char* key, char *value);
 int kv_set_bin(char* key, char *value, unsigned char len);
 
+/*
+ * Group the kv_set()/kv_set_bin() calls between begin and end into a
+ * single atomic commit. No-ops with the file-per-key store.
+ */
+int kv_batch_begin(void);
+int kv_batch_end(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,610 @@
+/*
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Log-structured backend for the kv store.
+ *
+ * All keys live in a single append-only file, KV_LOG_FILE. Every commit
+ * appends one frame:
+ *
+ *   | magic | payload length | crc32(payload) | payload |
+ *
+ * where the payload is a list of (klen, vlen, key, value) entries. A frame
+ * is only applied when its CRC matches, so a commit torn by power loss is
+ * dropped as a whole and the previous values stay intact. The next writer
+ * truncates the torn tail before appending.
+ *
+ * Each process keeps an in-memory index of the log and only replays the
+ * bytes appended since its last access, so a kv_get() costs a flock and
+ * two stats instead of a walk of the key path. Writes of unchanged values
+ * are skipped, and kv_batch_begin()/kv_batch_end() fold many updates into
+ * one frame and one fdatasync. Once the log is mostly stale entries it is
+ * rewritten to a temporary file and renamed into place; other processes
+ * notice the new inode and reload.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <string.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "kv.h"
+#include "kv_log.h"
+
+#define KV_LOG_MAGIC      0x314c564b  /* "KVL1" */
+#define KV_LOG_HASH_SIZE  64
+#define KV_LOG_TMP_FILE   KV_LOG_FILE ".tmp"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t len;
+  uint32_t crc;
+} kv_frame_hdr_t;
+
+typedef struct kv_entry {
+  struct kv_entry *next;
+  uint8_t klen;
+  uint8_t vlen;
+  char key[MAX_KEY_LEN + 1];
+  char value[KV_LOG_MAX_VALUE];
+} kv_entry_t;
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+} kv_payload_t;
+
+static struct {
+  pthread_mutex_t lock;
+  int fd;
+  ino_t ino;
+  off_t applied;   /* log bytes reflected in the index */
+  off_t size;      /* log size seen at the last sync */
+  int batch;       /* kv_batch_begin() nesting depth */
+  kv_payload_t pend;
+  kv_entry_t *hash[KV_LOG_HASH_SIZE];
+} g_kv = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .fd = -1,
+};
+
+/* Payload being built by the nftw() callback during migration */
+static kv_payload_t *g_migrate;
+
+static uint32_t
+kv_crc32(const uint8_t *buf, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  int i;
+
+  while (len--) {
+    crc ^= *buf++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+
+  return ~crc;
+}
+
+static unsigned int
+kv_hash(const char *key, int klen) {
+  unsigned int h = 5381;
+
+  while (klen--)
+    h = (h * 33) ^ (uint8_t)*key++;
+
+  return h % KV_LOG_HASH_SIZE;
+}
+
+static kv_entry_t *
+index_find(const char *key, int klen) {
+  kv_entry_t *e;
+
+  for (e = g_kv.hash[kv_hash(key, klen)]; e; e = e->next) {
+    if (e->klen == klen && !memcmp(e->key, key, klen))
+      return e;
+  }
+
+  return NULL;
+}
+
+static int
+index_put(const char *key, int klen, const char *value, int vlen) {
+  kv_entry_t *e = index_find(key, klen);
+  unsigned int h;
+
+  if (!e) {
+    e = calloc(1, sizeof(kv_entry_t));
+    if (!e)
+      return -1;
+    memcpy(e->key, key, klen);
+    e->klen = klen;
+    h = kv_hash(key, klen);
+    e->next = g_kv.hash[h];
+    g_kv.hash[h] = e;
+  }
+  memcpy(e->value, value, vlen);
+  e->vlen = vlen;
+
+  return 0;
+}
+
+static void
+index_clear(void) {
+  kv_entry_t *e, *next;
+  int i;
+
+  for (i = 0; i < KV_LOG_HASH_SIZE; i++) {
+    for (e = g_kv.hash[i]; e; e = next) {
+      next = e->next;
+      free(e);
+    }
+    g_kv.hash[i] = NULL;
+  }
+  g_kv.applied = 0;
+  g_kv.size = 0;
+}
+
+static int
+payload_add(kv_payload_t *p, const char *key, int klen,
+            const char *value, int vlen) {
+  size_t need = p->len + 2 + klen + vlen;
+  uint8_t *buf;
+
+  if (need > KV_LOG_MAX_FRAME)
+    return -1;
+
+  if (need > p->cap) {
+    size_t cap = p->cap ? p->cap : 256;
+    while (cap < need)
+      cap *= 2;
+    buf = realloc(p->buf, cap);
+    if (!buf)
+      return -1;
+    p->buf = buf;
+    p->cap = cap;
+  }
+
+  p->buf[p->len++] = klen;
+  p->buf[p->len++] = vlen;
+  memcpy(&p->buf[p->len], key, klen);
+  p->len += klen;
+  memcpy(&p->buf[p->len], value, vlen);
+  p->len += vlen;
+
+  return 0;
+}
+
+static int
+payload_apply(const uint8_t *buf, size_t len) {
+  size_t off = 0;
+  uint8_t klen, vlen;
+
+  while (off < len) {
+    if (off + 2 > len)
+      return -1;
+    klen = buf[off];
+    vlen = buf[off + 1];
+    off += 2;
+    if (klen == 0 || klen > MAX_KEY_LEN || off + klen + vlen > len)
+      return -1;
+    if (index_put((const char *)&buf[off], klen,
+                  (const char *)&buf[off + klen], vlen))
+      return -1;
+    off += klen + vlen;
+  }
+
+  return 0;
+}
+
+/* Apply every complete frame appended since the last sync */
+static void
+log_replay(void) {
+  kv_frame_hdr_t hdr;
+  uint8_t *buf;
+
+  while (g_kv.applied + (off_t)sizeof(hdr) <= g_kv.size) {
+    if (pread(g_kv.fd, &hdr, sizeof(hdr), g_kv.applied) != sizeof(hdr))
+      break;
+    if (hdr.magic != KV_LOG_MAGIC || hdr.len > KV_LOG_MAX_FRAME ||
+        g_kv.applied + (off_t)(sizeof(hdr) + hdr.len) > g_kv.size)
+      break;
+
+    buf = malloc(hdr.len ? hdr.len : 1);
+    if (!buf)
+      break;
+    if (pread(g_kv.fd, buf, hdr.len, g_kv.applied + sizeof(hdr)) != (ssize_t)hdr.len ||
+        kv_crc32(buf, hdr.len) != hdr.crc || payload_apply(buf, hdr.len)) {
+      free(buf);
+      break;
+    }
+    free(buf);
+    g_kv.applied += sizeof(hdr) + hdr.len;
+  }
+
+#ifdef DEBUG
+  if (g_kv.applied < g_kv.size)
+    syslog(LOG_WARNING, "kv_log: ignoring %ld bytes of torn log at %ld",
+           (long)(g_kv.size - g_kv.applied), (long)g_kv.applied);
+#endif
+}
+
+static int
+log_write_frame(int fd, off_t offset, const kv_payload_t *p) {
+  kv_frame_hdr_t *hdr;
+  uint8_t *buf;
+  size_t total = sizeof(kv_frame_hdr_t) + p->len;
+  int ret = 0;
+
+  buf = malloc(total);
+  if (!buf)
+    return -1;
+
+  hdr = (kv_frame_hdr_t *)buf;
+  hdr->magic = KV_LOG_MAGIC;
+  hdr->len = p->len;
+  hdr->crc = kv_crc32(p->buf, p->len);
+  memcpy(buf + sizeof(kv_frame_hdr_t), p->buf, p->len);
+
+  if (pwrite(fd, buf, total, offset) != (ssize_t)total || fdatasync(fd) < 0)
+    ret = -1;
+
+  free(buf);
+  return ret;
+}
+
+static int
+migrate_cb(const char *fpath, const struct stat *sb, int type,
+           struct FTW *ftwbuf) {
+  char value[KV_LOG_MAX_VALUE];
+  const char *key;
+  int fd, len;
+
+  if (type != FTW_F)
+    return 0;
+
+  key = fpath + strlen(KV_STORE_PATH) + 1;
+  if (strlen(key) == 0 || strlen(key) > MAX_KEY_LEN)
+    return 0;
+
+  // A key left behind would be lost for good once the log is in use
+  fd = open(fpath, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  len = read(fd, value, sizeof(value));
+  close(fd);
+  if (len < 0)
+    return -1;
+
+  return payload_add(g_migrate, key, strlen(key), value, len);
+}
+
+/*
+ * Import the file-per-key store into an empty log, under LOCK_EX
+ * return 0 on success, -1 if any key couldn't be imported
+ */
+static int
+log_migrate(void) {
+  kv_payload_t p = {0};
+  int ret = 0;
+
+  if (access(KV_STORE_PATH, F_OK) == -1)
+    return 0;
+
+  g_migrate = &p;
+  if (nftw(KV_STORE_PATH, migrate_cb, 8, FTW_PHYS) != 0)
+    ret = -1;
+  g_migrate = NULL;
+
+  if (ret == 0 && p.len && log_write_frame(g_kv.fd, 0, &p) != 0)
+    ret = -1;
+
+  if (ret == 0) {
+    if (p.len)
+      syslog(LOG_INFO, "kv_log: imported %s into %s", KV_STORE_PATH, KV_LOG_FILE);
+  } else {
+    syslog(LOG_WARNING, "kv_log: failed to import %s into %s", KV_STORE_PATH, KV_LOG_FILE);
+  }
+  free(p.buf);
+  return ret;
+}
+
+static int
+log_open(void) {
+  struct stat st;
+
+  g_kv.fd = open(KV_LOG_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (g_kv.fd < 0) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "kv_log: failed to open %s, err %d", KV_LOG_FILE, errno);
+#endif
+    return -1;
+  }
+
+  if (fstat(g_kv.fd, &st) < 0) {
+    close(g_kv.fd);
+    g_kv.fd = -1;
+    return -1;
+  }
+  g_kv.ino = st.st_ino;
+  index_clear();
+
+  // Left empty on failure, to be imported again by the next open
+  if (st.st_size == 0 && flock(g_kv.fd, LOCK_EX) == 0) {
+    if (fstat(g_kv.fd, &st) == 0 && st.st_size == 0 && log_migrate() < 0) {
+      flock(g_kv.fd, LOCK_UN);
+      close(g_kv.fd);
+      g_kv.fd = -1;
+      return -1;
+    }
+    flock(g_kv.fd, LOCK_UN);
+  }
+
+  return 0;
+}
+
+static void
+log_close(void) {
+  if (g_kv.fd >= 0)
+    close(g_kv.fd);
+  g_kv.fd = -1;
+  index_clear();
+}
+
+/*
+ * Lock the current log file and bring the index up to date with it.
+ * Reopens the log if another process has compacted it.
+ */
+static int
+log_lock(int op) {
+  struct stat st;
+  int retry;
+
+  for (retry = 0; retry < 3; retry++) {
+    if (g_kv.fd < 0 && log_open() < 0)
+      return -1;
+
+    if (flock(g_kv.fd, op) < 0)
+      return -1;
+
+    if (stat(KV_LOG_FILE, &st) == 0 && st.st_ino == g_kv.ino) {
+      if (fstat(g_kv.fd, &st) < 0)
+        break;
+      if (st.st_size < g_kv.applied)
+        index_clear();
+      g_kv.size = st.st_size;
+      log_replay();
+      return 0;
+    }
+
+    flock(g_kv.fd, LOCK_UN);
+    log_close();
+  }
+
+  if (g_kv.fd >= 0)
+    flock(g_kv.fd, LOCK_UN);
+  return -1;
+}
+
+static void
+log_unlock(void) {
+  flock(g_kv.fd, LOCK_UN);
+}
+
+/* Rewrite the log with only live entries once it is mostly stale */
+static void
+log_compact(void) {
+  kv_payload_t p = {0};
+  kv_entry_t *e;
+  struct stat st;
+  int i, fd, dfd;
+
+  if (g_kv.applied < KV_LOG_COMPACT_MIN)
+    return;
+
+  for (i = 0; i < KV_LOG_HASH_SIZE; i++) {
+    for (e = g_kv.hash[i]; e; e = e->next) {
+      if (payload_add(&p, e->key, e->klen, e->value, e->vlen)) {
+        free(p.buf);
+        return;
+      }
+    }
+  }
+
+  if ((off_t)(sizeof(kv_frame_hdr_t) + p.len) * KV_LOG_COMPACT_RATIO >
+      g_kv.applied) {
+    free(p.buf);
+    return;
+  }
+
+  fd = open(KV_LOG_TMP_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    free(p.buf);
+    return;
+  }
+
+  if (log_write_frame(fd, 0, &p) < 0 || rename(KV_LOG_TMP_FILE, KV_LOG_FILE) < 0) {
+    syslog(LOG_WARNING, "kv_log: compaction of %s failed", KV_LOG_FILE);
+    close(fd);
+    unlink(KV_LOG_TMP_FILE);
+    free(p.buf);
+    return;
+  }
+  free(p.buf);
+
+  dfd = open("/mnt/data", O_RDONLY | O_DIRECTORY);
+  if (dfd >= 0) {
+    fsync(dfd);
+    close(dfd);
+  }
+
+  /* Closing the old file drops its lock; waiters then see the new inode */
+  close(g_kv.fd);
+  g_kv.fd = fd;
+  g_kv.ino = (fstat(fd, &st) == 0) ? st.st_ino : 0;
+  g_kv.applied = g_kv.size = sizeof(kv_frame_hdr_t) + p.len;
+}
+
+/* Append a frame after the last good one, under LOCK_EX */
+static int
+log_append(const kv_payload_t *p) {
+  if (g_kv.applied < g_kv.size && ftruncate(g_kv.fd, g_kv.applied) < 0)
+    return -1;
+
+  if (log_write_frame(g_kv.fd, g_kv.applied, p) < 0) {
+#ifdef DEBUG
+    syslog(LOG_WARNING, "kv_log: failed to append to %s", KV_LOG_FILE);
+#endif
+    return -1;
+  }
+
+  g_kv.applied += sizeof(kv_frame_hdr_t) + p->len;
+  g_kv.size = g_kv.applied;
+
+  return 0;
+}
+
+/*
+*  set binary value
+*  return number of bytes stored, -1 on failure
+*/
+int
+kv_log_set(const char *key, const char *value, int len) {
+  kv_payload_t p = {0};
+  kv_entry_t *e;
+  int klen = strlen(key);
+  int ret = -1;
+
+  if (klen == 0 || klen > MAX_KEY_LEN || len < 0 || len > KV_LOG_MAX_VALUE)
+    return -1;
+
+  pthread_mutex_lock(&g_kv.lock);
+
+  if (log_lock(g_kv.batch ? LOCK_SH : LOCK_EX) < 0)
+    goto exit;
+
+  /* Unchanged values cost no flash write */
+  e = index_find(key, klen);
+  if (e && e->vlen == len && !memcmp(e->value, value, len)) {
+    ret = len;
+    goto unlock;
+  }
+
+  if (g_kv.batch) {
+    if (payload_add(&g_kv.pend, key, klen, value, len) == 0 &&
+        index_put(key, klen, value, len) == 0)
+      ret = len;
+    goto unlock;
+  }
+
+  if (payload_add(&p, key, klen, value, len) == 0 && log_append(&p) == 0) {
+    index_put(key, klen, value, len);
+    log_compact();
+    ret = len;
+  }
+  free(p.buf);
+
+unlock:
+  log_unlock();
+exit:
+  pthread_mutex_unlock(&g_kv.lock);
+  return ret;
+}
+
+/*
+*  get binary value
+*  return number of bytes read, -1 if the key does not exist
+*/
+int
+kv_log_get(const char *key, char *value) {
+  kv_entry_t *e;
+  int klen = strlen(key);
+  int ret = -1;
+
+  if (klen == 0 || klen > MAX_KEY_LEN)
+    return -1;
+
+  pthread_mutex_lock(&g_kv.lock);
+
+  if (log_lock(LOCK_SH) < 0)
+    goto exit;
+
+  e = index_find(key, klen);
+  if (e) {
+    ret = (e->vlen < MAX_VALUE_LEN) ? e->vlen : MAX_VALUE_LEN;
+    memcpy(value, e->value, ret);
+  }
+
+  log_unlock();
+exit:
+  pthread_mutex_unlock(&g_kv.lock);
+  return ret;
+}
+
+int
+kv_log_batch_begin(void) {
+  pthread_mutex_lock(&g_kv.lock);
+  g_kv.batch++;
+  pthread_mutex_unlock(&g_kv.lock);
+
+  return 0;
+}
+
+/*
+*  commit all values set since the outermost kv_log_batch_begin()
+*  return 0 on success, -1 on failure
+*/
+int
+kv_log_batch_end(void) {
+  int ret = 0;
+
+  pthread_mutex_lock(&g_kv.lock);
+
+  if (g_kv.batch == 0 || --g_kv.batch > 0 || g_kv.pend.len == 0)
+    goto exit;
+
+  if (log_lock(LOCK_EX) < 0) {
+    ret = -1;
+  } else {
+    if (log_append(&g_kv.pend) < 0) {
+      ret = -1;
+    } else {
+      /* Replay may have applied older frames over the batched values */
+      payload_apply(g_kv.pend.buf, g_kv.pend.len);
+      log_compact();
+    }
+    log_unlock();
+  }
+
+  /* Drop the uncommitted values from the index on failure */
+  if (ret < 0)
+    log_close();
+  g_kv.pend.len = 0;
+
+exit:
+  pthread_mutex_unlock(&g_kv.lock);
+  return ret;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __KV_LOG_H__
+#define __KV_LOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest value kv_set_bin() can store (its length is an unsigned char) */
+#define KV_LOG_MAX_VALUE    255
+
+/* Do not bother compacting a log smaller than this */
+#define KV_LOG_COMPACT_MIN  (64 * 1024)
+
+/* Compact once the log is this many times larger than its live data */
+#define KV_LOG_COMPACT_RATIO  4
+
+/* Sanity bound on a single commit frame */
+#define KV_LOG_MAX_FRAME    (1024 * 1024)
+
+int kv_log_set(const char *key, const char *value, int len);
+int kv_log_get(const char *key, char *value);
+int kv_log_batch_begin(void);
+int kv_log_batch_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __KV_LOG_H__ */
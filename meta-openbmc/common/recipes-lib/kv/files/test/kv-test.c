@@ -0,0 +1,410 @@
+/*
+ * kv log-structured store test
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * kv.c and kv_log.c are built into the test with CONFIG_KV_LOG_STORE and
+ * the store moved under TEST_DIR, so the BMC's own /mnt/data is left
+ * alone. A "fresh process" is a forked child that drops the log it
+ * inherited and opens its own, as kvcmd or another daemon would.
+ */
+#define TEST_DIR "/tmp/kv-test"
+
+#include "kv.h"
+#undef KV_STORE
+#undef KV_STORE_PATH
+#undef KV_LOG_FILE
+#define KV_STORE      TEST_DIR "/kv_store/%s"
+#define KV_STORE_PATH TEST_DIR "/kv_store"
+#define KV_LOG_FILE   TEST_DIR "/kv_store.log"
+
+#define CONFIG_KV_LOG_STORE
+#include "../kv.c"
+#include "../kv_log.c"
+
+#define CHECK(cond, ...) do { \
+  if (!(cond)) { \
+    printf("FAIL: " __VA_ARGS__); \
+    printf("\n"); \
+    exit(1); \
+  } \
+} while (0)
+
+static off_t
+log_size(void) {
+  struct stat st;
+
+  return stat(KV_LOG_FILE, &st) == 0 ? st.st_size : -1;
+}
+
+static ino_t
+log_ino(void) {
+  struct stat st;
+
+  return stat(KV_LOG_FILE, &st) == 0 ? st.st_ino : 0;
+}
+
+static int
+has(char *key, const char *expect) {
+  char value[MAX_VALUE_LEN];
+
+  if (kv_get(key, value) < 0)
+    return expect == NULL;
+  return expect && !strcmp(value, expect);
+}
+
+/* Start over as if the store had never been used */
+static void
+reset(void) {
+  log_close();
+  g_kv.batch = 0;
+  g_kv.pend.len = 0;
+  if (system("rm -rf " TEST_DIR) != 0 || mkdir(TEST_DIR, 0755) < 0) {
+    printf("FAIL: cannot create %s\n", TEST_DIR);
+    exit(1);
+  }
+}
+
+static void
+write_file(const char *path, const void *buf, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  CHECK(fd >= 0 && write(fd, buf, len) == (ssize_t)len, "cannot write %s", path);
+  close(fd);
+}
+
+static void
+append_log(const void *buf, size_t len) {
+  int fd = open(KV_LOG_FILE, O_WRONLY | O_APPEND);
+
+  CHECK(fd >= 0 && write(fd, buf, len) == (ssize_t)len, "cannot append to log");
+  close(fd);
+}
+
+static void
+corrupt_last_byte(void) {
+  int fd = open(KV_LOG_FILE, O_RDWR);
+  off_t off = log_size() - 1;
+  char c;
+
+  CHECK(fd >= 0 && pread(fd, &c, 1, off) == 1, "cannot read log");
+  c ^= 0xff;
+  CHECK(pwrite(fd, &c, 1, off) == 1, "cannot write log");
+  close(fd);
+}
+
+/* Start a fresh process that runs until told to go on, or killed */
+static pid_t
+fork_reader(int *go, int *done) {
+  int to[2], from[2];
+  pid_t pid;
+
+  CHECK(pipe(to) == 0 && pipe(from) == 0, "pipe");
+  pid = fork();
+  CHECK(pid >= 0, "fork");
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(to[1]);
+    close(from[0]);
+    log_close();
+    *go = to[0];
+    *done = from[1];
+    return 0;
+  }
+  close(to[0]);
+  close(from[1]);
+  *go = to[1];
+  *done = from[0];
+  return pid;
+}
+
+static void
+step(int fd) {
+  char c = 0;
+
+  CHECK(write(fd, &c, 1) == 1, "step");
+}
+
+static void
+wait_step(int fd) {
+  char c;
+
+  if (read(fd, &c, 1) != 1)
+    _exit(2);
+}
+
+/* Reap a reader, 0 if all its checks passed */
+static int
+reap(pid_t pid) {
+  int status;
+
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+/* Run the checks of fn in a fresh process */
+static int
+in_fresh_process(int (*fn)(void)) {
+  pid_t pid = fork();
+
+  CHECK(pid >= 0, "fork");
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    log_close();
+    _exit(fn() ? 0 : 1);
+  }
+  return reap(pid);
+}
+
+static int
+imported(void) {
+  char value[MAX_VALUE_LEN];
+
+  return has("sys_config/fru1_power_on", "1") &&
+         has("server_por_cfg", "lps") &&
+         kv_get_bin("identify_slot1", value) == 3 && !memcmp(value, "\0on", 3);
+}
+
+static void
+test_import(void) {
+  reset();
+  CHECK(mkdir(KV_STORE_PATH, 0755) == 0 &&
+        mkdir(KV_STORE_PATH "/sys_config", 0755) == 0, "mkdir");
+  write_file(KV_STORE_PATH "/sys_config/fru1_power_on", "1", 1);
+  write_file(KV_STORE_PATH "/server_por_cfg", "lps", 3);
+  write_file(KV_STORE_PATH "/identify_slot1", "\0on", 3);
+
+  CHECK(imported(), "kv_store not imported");
+  CHECK(in_fresh_process(imported) == 0, "import not seen by a fresh process");
+
+  // Once imported, the directory is no longer read
+  write_file(KV_STORE_PATH "/server_por_cfg", "on", 2);
+  CHECK(kv_set("new_key", "x") == 0 && has("server_por_cfg", "lps"),
+        "kv_store read after import");
+  CHECK(in_fresh_process(imported) == 0, "kv_store imported twice");
+
+  printf("import: kv_store read once, into the empty log\n");
+}
+
+static int
+torn_survivors(void) {
+  return has("a", "1") && has("b", "2") && has("c", "3");
+}
+
+static void
+test_torn_tail(void) {
+  kv_frame_hdr_t hdr = {KV_LOG_MAGIC, 40, 0};
+  char junk[16] = "half a frame";
+  off_t good;
+
+  reset();
+  CHECK(kv_set("a", "1") == 0 && kv_set("b", "2") == 0, "set");
+  good = log_size();
+
+  // A frame cut short by power loss
+  append_log(&hdr, sizeof(hdr));
+  append_log(junk, sizeof(junk));
+  log_close();
+  CHECK(has("a", "1") && has("b", "2"), "values lost to a torn tail");
+
+  // The next writer drops the torn bytes before appending
+  CHECK(kv_set("c", "3") == 0, "set after a torn tail");
+  CHECK(log_size() == good + (off_t)sizeof(hdr) + 2 + 1 + 1,
+        "torn tail not truncated");
+  CHECK(in_fresh_process(torn_survivors) == 0, "append after a torn tail lost");
+
+  // A whole frame with a bad CRC is dropped too
+  good = log_size();
+  CHECK(kv_set("a", "9") == 0, "set");
+  corrupt_last_byte();
+  CHECK(in_fresh_process(torn_survivors) == 0, "corrupt frame applied");
+  log_close();
+  CHECK(kv_set("d", "4") == 0 && has("a", "1") && log_size() == good + 16,
+        "corrupt frame kept");
+  printf("torn tail: dropped, earlier values kept, truncated by the next write\n");
+}
+
+static void
+test_second_process(void) {
+  int go, done;
+  pid_t pid;
+
+  reset();
+  CHECK(kv_set("fan_mode", "auto") == 0, "set");
+
+  pid = fork_reader(&go, &done);
+  if (pid == 0) {
+    int ok = has("fan_mode", "auto") && has("fan_pwm", NULL);
+    step(done);
+    wait_step(go);
+    // Replayed from where its index left off
+    ok = ok && has("fan_mode", "manual") && has("fan_pwm", "70");
+    _exit(ok ? 0 : 1);
+  }
+
+  wait_step(done);
+  CHECK(kv_set("fan_mode", "manual") == 0 && kv_set("fan_pwm", "70") == 0,
+        "set");
+  step(go);
+  CHECK(reap(pid) == 0, "second process missed new frames");
+  close(go);
+  close(done);
+  printf("second process: sees frames appended after its first read\n");
+}
+
+static int
+compacted(void) {
+  char value[KV_LOG_MAX_VALUE];
+
+  return has("counter", "last") && has("static", "kept") &&
+         kv_get_bin("big", value) == MAX_VALUE_LEN;
+}
+
+static void
+test_compaction(void) {
+  char value[KV_LOG_MAX_VALUE];
+  int go, done, i;
+  ino_t ino;
+  pid_t pid;
+
+  reset();
+  memset(value, 'v', sizeof(value));
+  CHECK(kv_set("static", "kept") == 0, "set");
+  ino = log_ino();
+
+  pid = fork_reader(&go, &done);
+  if (pid == 0) {
+    int ok = has("static", "kept");
+    step(done);
+    wait_step(go);
+    // Still holding the replaced log, it has to notice the new one
+    ok = ok && compacted();
+    _exit(ok ? 0 : 1);
+  }
+  wait_step(done);
+
+  for (i = 0; log_ino() == ino; i++) {
+    CHECK(i < 2 * KV_LOG_COMPACT_MIN / KV_LOG_MAX_VALUE, "no compaction");
+    value[0] = i;
+    CHECK(kv_set_bin("big", value, KV_LOG_MAX_VALUE) == KV_LOG_MAX_VALUE,
+          "set big");
+  }
+  CHECK(log_size() < KV_LOG_COMPACT_MIN / KV_LOG_COMPACT_RATIO,
+        "log not shrunk");
+  CHECK(access(KV_LOG_TMP_FILE, F_OK) == -1, "temporary file left");
+  CHECK(kv_set("counter", "last") == 0 && compacted(), "values lost");
+
+  step(go);
+  CHECK(reap(pid) == 0, "reader missed the compaction");
+  CHECK(in_fresh_process(compacted) == 0, "compacted log unreadable");
+  close(go);
+  close(done);
+  printf("compaction: after %d writes, log shrunk to %ld bytes\n",
+         i, (long)log_size());
+}
+
+static int
+batch_none(void) {
+  return has("x", NULL) && has("y", NULL) && has("z", NULL) && has("w", "0");
+}
+
+static int
+batch_all(void) {
+  return has("x", "1") && has("y", "2") && has("z", "3") && has("w", "0");
+}
+
+static void
+test_batch(void) {
+  int go, done;
+  off_t size;
+  pid_t pid;
+
+  reset();
+  CHECK(kv_set("w", "0") == 0, "set");
+  size = log_size();
+
+  // Nothing reaches the log before the outermost end
+  kv_batch_begin();
+  kv_set("x", "1");
+  kv_batch_begin();
+  kv_set("y", "2");
+  CHECK(kv_batch_end() == 0, "inner batch end");
+  kv_set("z", "3");
+  CHECK(batch_all(), "batched values not visible to their writer");
+  CHECK(log_size() == size && in_fresh_process(batch_none) == 0,
+        "batch committed early");
+  CHECK(kv_batch_end() == 0 && in_fresh_process(batch_all) == 0,
+        "batch not committed");
+
+  // A writer that dies inside a batch commits nothing
+  reset();
+  CHECK(kv_set("w", "0") == 0, "set");
+  pid = fork_reader(&go, &done);
+  if (pid == 0) {
+    kv_batch_begin();
+    kv_set("x", "1");
+    kv_set("y", "2");
+    step(done);
+    pause();
+    _exit(1);
+  }
+  wait_step(done);
+  kill(pid, SIGKILL);
+  reap(pid);
+  close(go);
+  close(done);
+  CHECK(in_fresh_process(batch_none) == 0, "dead writer's batch applied");
+
+  // A batch torn anywhere is dropped as a whole
+  kv_batch_begin();
+  kv_set("x", "1");
+  kv_set("y", "2");
+  kv_set("z", "3");
+  size = log_size();
+  CHECK(kv_batch_end() == 0, "batch end");
+  CHECK(truncate(KV_LOG_FILE, size + (log_size() - size) / 2) == 0, "truncate");
+  CHECK(in_fresh_process(batch_none) == 0, "torn batch partly applied");
+  printf("batch: one frame, all or nothing\n");
+}
+
+int
+main(int argc, char **argv) {
+  test_import();
+  test_torn_tail();
+  test_second_process();
+  test_compaction();
+  test_batch();
+
+  log_close();
+  if (system("rm -rf " TEST_DIR) != 0)
+    printf("cannot remove %s\n", TEST_DIR);
+  printf("All tests passed\n");
+  return 0;
+}
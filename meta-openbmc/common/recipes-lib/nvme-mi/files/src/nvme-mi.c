@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -37,6 +39,17 @@
 #define NVME_SERIAL_NUM_REG 0x0B
 #define SERIAL_NUM_SIZE 20
 
+/* Basic management data structures: command code and byte count */
+#define NVME_STATUS_CMD 0x00
+#define NVME_STATUS_LEN 6
+#define NVME_VENDOR_CMD 0x08
+#define NVME_VENDOR_LEN 22
+
+/* nvme_basic_read() retries, sleeping 10, 20, 40, 80 and 160 ms */
+#define NVME_RETRIES 5
+#define NVME_BACKOFF_MS 10
+#define NVME_BACKOFF_MAX_MS 160
+
 /* NVMe-MI Temperature Definition Code */
 #define TEMP_HIGHER_THAN_127 0x7F
 #define TEPM_LOWER_THAN_n60 0xC4
@@ -255,6 +268,238 @@ nvme_serial_num_read(const char *i2c_bus_device, uint8_t *value, int size) {
   return 0;
 }
 
+/* Compute the SMBus PEC (CRC-8, polynomial x^8 + x^2 + x + 1) of buf. */
+static uint8_t
+nvme_pec(uint8_t crc, const uint8_t *buf, int len) {
+  int i, bit;
+
+  for (i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+/*
+ * Check one SMBus block of the basic management data. Whatever offset the
+ * read started at, each PEC is the one of a block read of its own command
+ * code: slave address (write), command code, slave address (read), then
+ * the byte count and data.
+ */
+static int
+nvme_block_valid(const uint8_t *buf, uint8_t cmd, uint8_t count) {
+  uint8_t hdr[3] = {I2C_NVME_INTF_ADDR << 1, cmd, (I2C_NVME_INTF_ADDR << 1) | 1};
+  uint8_t crc;
+
+  if (buf[cmd] != count)
+    return 0;
+  crc = nvme_pec(0, hdr, sizeof(hdr));
+  crc = nvme_pec(crc, &buf[cmd], count + 1);
+  return crc == buf[cmd + count + 1];
+}
+
+/* Decode NVMe-MI basic management command data read from offset 0. */
+int
+nvme_basic_decode(const uint8_t *buf, int len, ssd_data *data) {
+
+  if (len < NVME_BASIC_MGMT_LEN ||
+      !nvme_block_valid(buf, NVME_STATUS_CMD, NVME_STATUS_LEN) ||
+      !nvme_block_valid(buf, NVME_VENDOR_CMD, NVME_VENDOR_LEN)) {
+    errno = EBADMSG;
+    return -1;
+  }
+
+  data->sflgs = buf[NVME_SFLGS_REG];
+  data->warning = buf[NVME_WARNING_REG];
+  data->temp = buf[NVME_TEMP_REG];
+  data->pdlu = buf[NVME_PDLU_REG];
+  data->vendor = buf[NVME_VENDOR_REG] << 8 | buf[NVME_VENDOR_REG + 1];
+  memcpy(data->serial_num, &buf[NVME_SERIAL_NUM_REG], SERIAL_NUM_SIZE);
+  return 0;
+}
+
+/* Read and decode all NVMe-MI basic management data in one transaction. */
+int
+nvme_basic_read(int fd, ssd_data *data) {
+  uint8_t cmd = NVME_STATUS_CMD;
+  uint8_t buf[NVME_BASIC_MGMT_LEN];
+  int delay = NVME_BACKOFF_MS;
+  int retry, err = EIO;
+
+  if (fd < 0 || data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (retry = 0; ; retry++) {
+    if (i2c_rdwr_msg_transfer(fd, I2C_NVME_INTF_ADDR << 1, &cmd, 1,
+                              buf, sizeof(buf)) < 0) {
+      err = EIO;
+    } else if (nvme_basic_decode(buf, sizeof(buf), data) < 0) {
+      err = EBADMSG;
+    } else {
+      return 0;
+    }
+
+    if (retry == NVME_RETRIES)
+      break;
+    msleep(delay);
+    if (delay < NVME_BACKOFF_MAX_MS)
+      delay *= 2;
+  }
+
+  syslog(LOG_DEBUG, "%s(): %s", __func__,
+         err == EIO ? "i2c transfer failed" : "bad PEC");
+  errno = err;
+  return -1;
+}
+
+void
+nvme_sflgs_decode(uint8_t value, t_status_flags *status_flag_decoding) {
+
+  sprintf(status_flag_decoding->self.key, "Status Flags");
+  sprintf(status_flag_decoding->self.value, "0x%02X", value);
+
+  sprintf(status_flag_decoding->read_complete.key, "SMBUS block read complete");
+  if ((value & 0x80) == 0)
+    sprintf(status_flag_decoding->read_complete.value, "FAIL");
+  else
+    sprintf(status_flag_decoding->read_complete.value, "OK");
+
+  sprintf(status_flag_decoding->ready.key, "Drive Ready");
+  if ((value & 0x40) == 0)
+    sprintf(status_flag_decoding->ready.value, "Ready");
+  else
+    sprintf(status_flag_decoding->ready.value, "Not ready");
+
+  sprintf(status_flag_decoding->functional.key, "Drive Functional");
+  if ((value & 0x20) == 0)
+    sprintf(status_flag_decoding->functional.value, "Unrecoverable Failure");
+  else
+    sprintf(status_flag_decoding->functional.value, "Functional");
+
+  sprintf(status_flag_decoding->reset_required.key, "Reset Required");
+  if ((value & 0x10) == 0)
+    sprintf(status_flag_decoding->reset_required.value, "Required");
+  else
+    sprintf(status_flag_decoding->reset_required.value, "No");
+
+  sprintf(status_flag_decoding->port0_link.key, "Port 0 PCIe Link Active");
+  if ((value & 0x08) == 0)
+    sprintf(status_flag_decoding->port0_link.value, "Down");
+  else
+    sprintf(status_flag_decoding->port0_link.value, "Up");
+
+  sprintf(status_flag_decoding->port1_link.key, "Port 1 PCIe Link Active");
+  if ((value & 0x04) == 0)
+    sprintf(status_flag_decoding->port1_link.value, "Down");
+  else
+    sprintf(status_flag_decoding->port1_link.value, "Up");
+}
+
+void
+nvme_smart_warning_decode(uint8_t value, t_smart_warning *smart_warning_decoding) {
+
+  sprintf(smart_warning_decoding->self.key, "SMART Critical Warning");
+  sprintf(smart_warning_decoding->self.value, "0x%02X", value);
+
+  sprintf(smart_warning_decoding->spare_space.key, "Spare Space");
+  if ((value & 0x01) == 0)
+    sprintf(smart_warning_decoding->spare_space.value, "Low");
+  else
+    sprintf(smart_warning_decoding->spare_space.value, "Normal");
+
+  sprintf(smart_warning_decoding->temp_warning.key, "Temperature Warning");
+  if ((value & 0x02) == 0)
+    sprintf(smart_warning_decoding->temp_warning.value, "Abnormal");
+  else
+    sprintf(smart_warning_decoding->temp_warning.value, "Normal");
+
+  sprintf(smart_warning_decoding->reliability.key, "NVM Subsystem Reliability");
+  if ((value & 0x04) == 0)
+    sprintf(smart_warning_decoding->reliability.value, "Degraded");
+  else
+    sprintf(smart_warning_decoding->reliability.value, "Normal");
+
+  sprintf(smart_warning_decoding->media_status.key, "Media Status");
+  if ((value & 0x08) == 0)
+    sprintf(smart_warning_decoding->media_status.value, "Read Only mode");
+  else
+    sprintf(smart_warning_decoding->media_status.value, "Normal");
+
+  sprintf(smart_warning_decoding->backup_device.key, "Volatile Memory Backup Device");
+  if ((value & 0x10) == 0)
+    sprintf(smart_warning_decoding->backup_device.value, "Failed");
+  else
+    sprintf(smart_warning_decoding->backup_device.value, "Normal");
+}
+
+void
+nvme_temp_decode(uint8_t value, t_key_value_pair *temp_decoding) {
+
+  sprintf(temp_decoding->key, "Composite Temperature");
+  if (value <= TEMP_HIGHER_THAN_127)
+    sprintf(temp_decoding->value, "%d C", value);
+  else if (value >= TEPM_LOWER_THAN_n60)
+    sprintf(temp_decoding->value, "%d C", (value - 0x100));
+  else if (value == TEMP_NO_UPDATE)
+    sprintf(temp_decoding->value, "No data or data is too old");
+  else if (value == TEMP_SENSOR_FAIL)
+    sprintf(temp_decoding->value, "Sensor failure");
+  else
+    sprintf(temp_decoding->value, "Reserved(0x%02X)", value);
+}
+
+void
+nvme_pdlu_decode(uint8_t value, t_key_value_pair *pdlu_decoding) {
+
+  sprintf(pdlu_decoding->key, "Percentage Drive Life Used");
+  sprintf(pdlu_decoding->value, "%d", value);
+}
+
+void
+nvme_vendor_decode(uint16_t value, t_key_value_pair *vendor_decoding) {
+
+  sprintf(vendor_decoding->key, "Vendor");
+  switch (value) {
+  case VENDOR_ID_HGST:
+    sprintf(vendor_decoding->value, "HGST(0x%04X)", value);
+    break;
+  case VENDOR_ID_HYNIX:
+    sprintf(vendor_decoding->value, "Hynix(0x%04X)", value);
+    break;
+  case VENDOR_ID_INTEL:
+    sprintf(vendor_decoding->value, "Intel(0x%04X)", value);
+    break;
+  case VENDOR_ID_LITEON:
+    sprintf(vendor_decoding->value, "Lite-on(0x%04X)", value);
+    break;
+  case VENDOR_ID_MICRON:
+    sprintf(vendor_decoding->value, "Micron(0x%04X)", value);
+    break;
+  case VENDOR_ID_SAMSUNG:
+    sprintf(vendor_decoding->value, "Samsung(0x%04X)", value);
+    break;
+  case VENDOR_ID_SEAGATE:
+    sprintf(vendor_decoding->value, "Seagate(0x%04X)", value);
+    break;
+  case VENDOR_ID_TOSHIBA:
+    sprintf(vendor_decoding->value, "Toshiba(0x%04X)", value);
+    break;
+  default:
+    sprintf(vendor_decoding->value, "Unknown(0x%04X)", value);
+  }
+}
+
+void
+nvme_serial_num_decode(const uint8_t *value, t_key_value_pair *sn_decoding) {
+
+  sprintf(sn_decoding->key, "Serial Number");
+  memcpy(sn_decoding->value, value, SERIAL_NUM_SIZE);
+  sn_decoding->value[SERIAL_NUM_SIZE] = '\0';
+}
+
 /* Read NVMe-MI Status Flags and decode it. */
 int
 nvme_sflgs_read_decode(const char *i2c_bus_device, uint8_t *value, t_status_flags *status_flag_decoding) {
@@ -264,52 +509,14 @@ nvme_sflgs_read_decode(const char *i2c_bus_device, uint8_t *value, t_status_flag
     return -1;
   }
 
-  sprintf(status_flag_decoding->self.key, "Status Flags");
   if (nvme_sflgs_read(i2c_bus_device, value)) {
     syslog(LOG_DEBUG, "%s(): nvme_sflgs_read failed", __func__);
+    sprintf(status_flag_decoding->self.key, "Status Flags");
     sprintf(status_flag_decoding->self.value, "Fail on reading");
     return -1;
   }
-  else {
-    sprintf(status_flag_decoding->self.value, "0x%02X", *value);
-
-    sprintf(status_flag_decoding->read_complete.key, "SMBUS block read complete");
-    if ((*value & 0x80) == 0)
-      sprintf(status_flag_decoding->read_complete.value, "FAIL");
-    else
-      sprintf(status_flag_decoding->read_complete.value, "OK");
-
-    sprintf(status_flag_decoding->ready.key, "Drive Ready");
-    if ((*value & 0x40) == 0)
-      sprintf(status_flag_decoding->ready.value, "Ready");
-    else
-      sprintf(status_flag_decoding->ready.value, "Not ready");
-
-    sprintf(status_flag_decoding->functional.key, "Drive Functional");
-    if ((*value & 0x20) == 0)
-      sprintf(status_flag_decoding->functional.value, "Unrecoverable Failure");
-    else
-      sprintf(status_flag_decoding->functional.value, "Functional");
-
-    sprintf(status_flag_decoding->reset_required.key, "Reset Required");
-    if ((*value & 0x10) == 0)
-      sprintf(status_flag_decoding->reset_required.value, "Required");
-    else
-      sprintf(status_flag_decoding->reset_required.value, "No");
-
-    sprintf(status_flag_decoding->port0_link.key, "Port 0 PCIe Link Active");
-    if ((*value & 0x08) == 0)
-      sprintf(status_flag_decoding->port0_link.value, "Down");
-    else
-      sprintf(status_flag_decoding->port0_link.value, "Up");
-
-    sprintf(status_flag_decoding->port1_link.key, "Port 1 PCIe Link Active");
-    if ((*value & 0x04) == 0)
-      sprintf(status_flag_decoding->port1_link.value, "Down");
-    else
-      sprintf(status_flag_decoding->port1_link.value, "Up");
-  }
 
+  nvme_sflgs_decode(*value, status_flag_decoding);
   return 0;
 }
 
@@ -322,46 +529,14 @@ nvme_smart_warning_read_decode(const char *i2c_bus_device, uint8_t *value, t_sma
     return -1;
   }
 
-  sprintf(smart_warning_decoding->self.key, "SMART Critical Warning");
   if (nvme_smart_warning_read(i2c_bus_device, value)) {
     syslog(LOG_DEBUG, "%s(): nvme_smart_warning_read failed", __func__);
+    sprintf(smart_warning_decoding->self.key, "SMART Critical Warning");
     sprintf(smart_warning_decoding->self.value, "Fail on reading");
     return -1;
   }
-  else {
-    sprintf(smart_warning_decoding->self.value, "0x%02X", *value);
-
-    sprintf(smart_warning_decoding->spare_space.key, "Spare Space");
-    if ((*value & 0x01) == 0)
-      sprintf(smart_warning_decoding->spare_space.value, "Low");
-    else
-      sprintf(smart_warning_decoding->spare_space.value, "Normal");
-
-    sprintf(smart_warning_decoding->temp_warning.key, "Temperature Warning");
-    if ((*value & 0x02) == 0)
-      sprintf(smart_warning_decoding->temp_warning.value, "Abnormal");
-    else
-      sprintf(smart_warning_decoding->temp_warning.value, "Normal");
-
-    sprintf(smart_warning_decoding->reliability.key, "NVM Subsystem Reliability");
-    if ((*value & 0x04) == 0)
-      sprintf(smart_warning_decoding->reliability.value, "Degraded");
-    else
-      sprintf(smart_warning_decoding->reliability.value, "Normal");
-
-    sprintf(smart_warning_decoding->media_status.key, "Media Status");
-    if ((*value & 0x08) == 0)
-      sprintf(smart_warning_decoding->media_status.value, "Read Only mode");
-    else
-      sprintf(smart_warning_decoding->media_status.value, "Normal");
-
-    sprintf(smart_warning_decoding->backup_device.key, "Volatile Memory Backup Device");
-    if ((*value & 0x10) == 0)
-      sprintf(smart_warning_decoding->backup_device.value, "Failed");
-    else
-      sprintf(smart_warning_decoding->backup_device.value, "Normal");
-  }
 
+  nvme_smart_warning_decode(*value, smart_warning_decoding);
   return 0;
 }
 
@@ -374,23 +549,14 @@ nvme_temp_read_decode(const char *i2c_bus_device, uint8_t *value, t_key_value_pa
     return -1;
   }
 
-  sprintf(temp_decoding->key, "Composite Temperature");
   if (nvme_temp_read(i2c_bus_device, value)) {
     syslog(LOG_DEBUG, "%s(): nvme_temp_read failed", __func__);
+    sprintf(temp_decoding->key, "Composite Temperature");
     sprintf(temp_decoding->value, "Fail on reading");
     return -1;
   }
-  else {
-    if (*value <= TEMP_HIGHER_THAN_127)
-      sprintf(temp_decoding->value, "%d C", *value);
-    else if (*value >= TEPM_LOWER_THAN_n60)
-      sprintf(temp_decoding->value, "%d C", (*value - 0x100));
-    else if (*value == TEMP_NO_UPDATE)
-      sprintf(temp_decoding->value, "No data or data is too old");
-    else if (*value == TEMP_SENSOR_FAIL)
-      sprintf(temp_decoding->value, "Sensor failure");
-  }
 
+  nvme_temp_decode(*value, temp_decoding);
   return 0;
 }
 
@@ -403,15 +569,14 @@ nvme_pdlu_read_decode(const char *i2c_bus_device, uint8_t *value, t_key_value_pa
     return -1;
   }
 
-  sprintf(pdlu_decoding->key, "Percentage Drive Life Used");
   if (nvme_pdlu_read(i2c_bus_device, value)) {
     syslog(LOG_DEBUG, "%s(): nvme_pdlu_read failed", __func__);
+    sprintf(pdlu_decoding->key, "Percentage Drive Life Used");
     sprintf(pdlu_decoding->value, "Fail on reading");
     return -1;
   }
-  else
-    sprintf(pdlu_decoding->value, "%d", *value);
 
+  nvme_pdlu_decode(*value, pdlu_decoding);
   return 0;
 }
 
@@ -424,43 +589,14 @@ nvme_vendor_read_decode(const char *i2c_bus_device, uint16_t *value, t_key_value
     return -1;
   }
 
-  sprintf(vendor_decoding->key, "Vendor");
   if (nvme_vendor_read(i2c_bus_device, value)) {
     syslog(LOG_DEBUG, "%s(): nvme_vendor_read failed", __func__);
+    sprintf(vendor_decoding->key, "Vendor");
     sprintf(vendor_decoding->value, "Fail on reading");
     return -1;
   }
-  else{
-    switch (*value) {
-    case VENDOR_ID_HGST:
-      sprintf(vendor_decoding->value, "HGST(0x%04X)", *value);
-      break;
-    case VENDOR_ID_HYNIX:
-      sprintf(vendor_decoding->value, "Hynix(0x%04X)", *value);
-      break;
-    case VENDOR_ID_INTEL:
-      sprintf(vendor_decoding->value, "Intel(0x%04X)", *value);
-      break;
-    case VENDOR_ID_LITEON:
-      sprintf(vendor_decoding->value, "Lite-on(0x%04X)", *value);
-      break;
-    case VENDOR_ID_MICRON:
-      sprintf(vendor_decoding->value, "Micron(0x%04X)", *value);
-      break;
-    case VENDOR_ID_SAMSUNG:
-      sprintf(vendor_decoding->value, "Samsung(0x%04X)", *value);
-      break;
-    case VENDOR_ID_SEAGATE:
-      sprintf(vendor_decoding->value, "Seagate(0x%04X)", *value);
-      break;
-    case VENDOR_ID_TOSHIBA:
-      sprintf(vendor_decoding->value, "Toshiba(0x%04X)", *value);
-      break;
-    default:
-      sprintf(vendor_decoding->value, "Unknown(0x%04X)", *value);
-    }
-  }
 
+  nvme_vendor_decode(*value, vendor_decoding);
   return 0;
 }
 
@@ -473,17 +609,13 @@ nvme_serial_num_read_decode(const char *i2c_bus_device, uint8_t *value, int size
     return -1;
   }
 
-  sprintf(sn_decoding->key, "Serial Number");
   if (nvme_serial_num_read(i2c_bus_device, value, SERIAL_NUM_SIZE)) {
     syslog(LOG_DEBUG, "%s(): nvme_serial_num_read failed", __func__);
+    sprintf(sn_decoding->key, "Serial Number");
     sprintf(sn_decoding->value, "Fail on reading");
     return -1;
   }
-  else{
-    memcpy(sn_decoding->value, value, SERIAL_NUM_SIZE);
-    sn_decoding->value[SERIAL_NUM_SIZE] = '\0';
-  }
 
+  nvme_serial_num_decode(value, sn_decoding);
   return 0;
 }
-
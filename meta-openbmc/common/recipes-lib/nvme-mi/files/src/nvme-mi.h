@@ -53,6 +53,31 @@ t_key_value_pair media_status;
 t_key_value_pair backup_device;
 } t_smart_warning; 
 
+/*
+ * NVMe-MI basic management command data, offsets 0x00-0x1F: the status
+ * structure (command code 0) and the vendor/serial number structure
+ * (command code 8), each an SMBus block ending with its own PEC
+ */
+#define NVME_BASIC_MGMT_LEN 32
+
+/*
+ * Read all of the above in one I2C transaction on a /dev/i2c-N fd the
+ * caller keeps open, check both PECs and decode it into data. Failed or
+ * corrupted transfers are retried with exponential backoff. Returns 0, or
+ * -1 with errno set to EIO (no answer) or EBADMSG (bad length or PEC).
+ */
+int nvme_basic_read(int fd, ssd_data *data);
+// Decode a buffer read as above, -1 with errno EBADMSG if it is corrupted
+int nvme_basic_decode(const uint8_t *buf, int len, ssd_data *data);
+
+// Decode single fields, e.g. of an ssd_data from nvme_basic_read()
+void nvme_sflgs_decode(uint8_t value, t_status_flags *status_flag_decoding);
+void nvme_smart_warning_decode(uint8_t value, t_smart_warning *smart_warning_decoding);
+void nvme_temp_decode(uint8_t value, t_key_value_pair *temp_decoding);
+void nvme_pdlu_decode(uint8_t value, t_key_value_pair *pdlu_decoding);
+void nvme_vendor_decode(uint16_t value, t_key_value_pair *vendor_decoding);
+void nvme_serial_num_decode(const uint8_t *value, t_key_value_pair *sn_decoding);
+
 int nvme_read_byte(const char *i2c_bus, uint8_t item, uint8_t *value);
 int nvme_read_word(const char *i2c_bus, uint8_t item, uint16_t *value);
 int nvme_sflgs_read(const char *i2c_bus, uint8_t *value);
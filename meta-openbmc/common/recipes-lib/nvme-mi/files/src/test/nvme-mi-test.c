@@ -0,0 +1,306 @@
+/* Copyright 2017-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <openbmc/obmc-i2c.h>
+#include "nvme-mi.h"
+
+/*
+ * nvme-mi against a fake drive: open(), close(), ioctl() and nanosleep()
+ * are redirected (-Wl,--wrap) so /dev/i2c-fake talks to a model of the
+ * NVMe-MI basic management registers, which can fail or corrupt chosen
+ * transfers, and backoff sleeps are only added up.
+ */
+
+#define FAKE_DEV      "/dev/i2c-fake"
+#define FAKE_FD       1000
+#define NVME_ADDR     0x6A
+
+static uint8_t regs[256];
+static int slave = -1;
+static int transfers;
+static int fail_next;
+static int corrupt_next;
+static long slept_ms;
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_ioctl(int fd, unsigned long req, ...);
+
+int
+__wrap_open(const char *path, int flags, ...)
+{
+  va_list ap;
+  int mode;
+
+  if (strcmp(path, FAKE_DEV) == 0) {
+    return FAKE_FD;
+  }
+  va_start(ap, flags);
+  mode = va_arg(ap, int);
+  va_end(ap);
+  return __real_open(path, flags, mode);
+}
+
+int
+__wrap_close(int fd)
+{
+  if (fd == FAKE_FD) {
+    return 0;
+  }
+  return __real_close(fd);
+}
+
+int
+__wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+  slept_ms += req->tv_sec * 1000 + req->tv_nsec / 1000000;
+  return 0;
+}
+
+static int
+fault(void)
+{
+  transfers++;
+  if (fail_next > 0) {
+    fail_next--;
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+static int
+fake_rdwr(struct i2c_rdwr_ioctl_data *data)
+{
+  struct i2c_msg *w = &data->msgs[0], *r = &data->msgs[1];
+
+  assert(data->nmsgs == 2);
+  assert(w->addr == NVME_ADDR && !(w->flags & I2C_M_RD) && w->len == 1);
+  assert(r->addr == NVME_ADDR && (r->flags & I2C_M_RD));
+  if (fault() < 0) {
+    return -1;
+  }
+  memcpy(r->buf, &regs[w->buf[0]], r->len);
+  if (corrupt_next > 0) {
+    corrupt_next--;
+    r->buf[12] ^= 0x10;
+  }
+  return 0;
+}
+
+static int
+fake_smbus(struct i2c_smbus_ioctl_data *args)
+{
+  assert(slave == NVME_ADDR && args->read_write == I2C_SMBUS_READ);
+  if (fault() < 0) {
+    return -1;
+  }
+  if (args->size == I2C_SMBUS_WORD_DATA) {
+    args->data->word = regs[args->command] | regs[args->command + 1] << 8;
+  } else {
+    args->data->byte = regs[args->command];
+  }
+  return 0;
+}
+
+int
+__wrap_ioctl(int fd, unsigned long req, ...)
+{
+  va_list ap;
+  void *arg;
+
+  va_start(ap, req);
+  arg = va_arg(ap, void *);
+  va_end(ap);
+
+  if (fd != FAKE_FD) {
+    return __real_ioctl(fd, req, arg);
+  }
+  switch (req) {
+  case I2C_SLAVE:
+  case I2C_SLAVE_FORCE:
+    slave = (int)(intptr_t) arg;
+    return 0;
+  case I2C_RDWR:
+    return fake_rdwr(arg);
+  case I2C_SMBUS:
+    return fake_smbus(arg);
+  }
+  return -1;
+}
+
+/* SMBus PEC, written out independently of the library */
+static uint8_t
+crc8(uint8_t crc, const uint8_t *buf, int len)
+{
+  for (int i = 0; i < len; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      int msb = (crc >> 7) ^ ((buf[i] >> bit) & 1);
+      crc <<= 1;
+      if (msb) {
+        crc ^= 0x07;
+      }
+    }
+  }
+  return crc;
+}
+
+static void
+seal_block(uint8_t cmd)
+{
+  uint8_t hdr[3] = {NVME_ADDR << 1, cmd, NVME_ADDR << 1 | 1};
+  uint8_t count = regs[cmd];
+
+  regs[cmd + count + 1] = crc8(crc8(0, hdr, 3), &regs[cmd], count + 1);
+}
+
+static void
+setup_drive(void)
+{
+  memset(regs, 0, sizeof(regs));
+  regs[0x00] = 6;
+  regs[0x01] = 0xBF;          // status flags
+  regs[0x02] = 0xFF;          // no SMART warning
+  regs[0x03] = 0xC4;          // -60 C
+  regs[0x04] = 17;            // drive life used
+  seal_block(0x00);
+  regs[0x08] = 22;
+  regs[0x09] = 0x14;          // vendor ID, MSB first
+  regs[0x0A] = 0x4D;
+  memcpy(&regs[0x0B], "S3EVNX0J600123      ", 20);
+  seal_block(0x08);
+}
+
+int
+main(int argc, char **argv)
+{
+  const uint8_t check[] = "123456789";
+  t_key_value_pair kv;
+  t_status_flags sf;
+  ssd_data ssd, old;
+  int fd, before, legacy;
+
+  // the reference PEC: CRC-8/SMBUS check value
+  assert(crc8(0, check, 9) == 0xF4);
+
+  fd = open(FAKE_DEV, O_RDWR);
+  assert(fd == FAKE_FD);
+  setup_drive();
+
+  /*
+   * everything in one transfer
+   */
+  memset(&ssd, 0, sizeof(ssd));
+  transfers = 0;
+  assert(nvme_basic_read(fd, &ssd) == 0);
+  assert(transfers == 1 && slept_ms == 0);
+  assert(ssd.sflgs == 0xBF && ssd.warning == 0xFF && ssd.temp == 0xC4);
+  assert(ssd.pdlu == 17 && ssd.vendor == 0x144D);
+  assert(memcmp(ssd.serial_num, "S3EVNX0J600123      ", 20) == 0);
+
+  nvme_temp_decode(ssd.temp, &kv);
+  assert(strcmp(kv.value, "-60 C") == 0);
+  nvme_vendor_decode(ssd.vendor, &kv);
+  assert(strcmp(kv.value, "Samsung(0x144D)") == 0);
+  nvme_serial_num_decode(ssd.serial_num, &kv);
+  assert(strcmp(kv.value, "S3EVNX0J600123      ") == 0);
+  nvme_sflgs_decode(ssd.sflgs, &sf);
+  assert(strcmp(sf.read_complete.value, "OK") == 0);
+  assert(strcmp(sf.port1_link.value, "Up") == 0);
+
+  /*
+   * the same fields one register at a time, as before
+   */
+  transfers = 0;
+  assert(nvme_sflgs_read(FAKE_DEV, &old.sflgs) == 0);
+  assert(nvme_smart_warning_read(FAKE_DEV, &old.warning) == 0);
+  assert(nvme_temp_read(FAKE_DEV, &old.temp) == 0);
+  assert(nvme_pdlu_read(FAKE_DEV, &old.pdlu) == 0);
+  assert(nvme_vendor_read(FAKE_DEV, &old.vendor) == 0);
+  assert(nvme_serial_num_read(FAKE_DEV, old.serial_num, 20) == 0);
+  legacy = transfers;
+  assert(old.sflgs == ssd.sflgs && old.warning == ssd.warning);
+  assert(old.temp == ssd.temp && old.pdlu == ssd.pdlu);
+  assert(old.vendor == ssd.vendor);
+  assert(memcmp(old.serial_num, ssd.serial_num, 20) == 0);
+  printf("per field: %d transfers and opens, basic read: 1 transfer\n",
+         legacy);
+
+  /*
+   * a transfer corrupted on the wire is caught by the PEC and retried
+   */
+  transfers = 0;
+  slept_ms = 0;
+  corrupt_next = 2;
+  assert(nvme_basic_read(fd, &ssd) == 0);
+  assert(transfers == 3 && slept_ms == 10 + 20);
+
+  /*
+   * a drive that never answers costs a bounded time
+   */
+  transfers = 0;
+  slept_ms = 0;
+  fail_next = 100;
+  errno = 0;
+  assert(nvme_basic_read(fd, &ssd) == -1 && errno == EIO);
+  assert(transfers == 6 && slept_ms == 10 + 20 + 40 + 80 + 160);
+  fail_next = 0;
+
+  /*
+   * persistent corruption and bad block lengths are reported as such
+   */
+  corrupt_next = 100;
+  errno = 0;
+  assert(nvme_basic_read(fd, &ssd) == -1 && errno == EBADMSG);
+  corrupt_next = 0;
+
+  regs[0x08] = 21;
+  before = transfers;
+  assert(nvme_basic_read(fd, &ssd) == -1 && errno == EBADMSG);
+  assert(transfers - before == 6);
+  setup_drive();
+
+  // every single bit flip in either block is detected
+  {
+    uint8_t buf[NVME_BASIC_MGMT_LEN];
+    memcpy(buf, regs, sizeof(buf));
+    assert(nvme_basic_decode(buf, sizeof(buf), &ssd) == 0);
+    assert(nvme_basic_decode(buf, sizeof(buf) - 1, &ssd) == -1);
+    for (int i = 0; i < NVME_BASIC_MGMT_LEN; i++) {
+      for (int bit = 0; bit < 8; bit++) {
+        buf[i] ^= 1 << bit;
+        assert(nvme_basic_decode(buf, sizeof(buf), &ssd) == -1);
+        buf[i] ^= 1 << bit;
+      }
+    }
+  }
+
+  close(fd);
+  printf("All tests passed\n");
+  return 0;
+}
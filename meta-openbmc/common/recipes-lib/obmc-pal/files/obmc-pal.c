@@ -1860,7 +1860,6 @@ pal_get_all_thresh_from_file(uint8_t fru, thresh_sensor_t *sinfo, int mode) {
   uint8_t *sensor_list;
   char fpath[64] = {0};
   char initpath[64] = {0};
-  char cmd[128] = {0};
   thresh_sensor_t *snr;
   int curr_state = 0;
 
@@ -1915,14 +1914,7 @@ pal_get_all_thresh_from_file(uint8_t fru, thresh_sensor_t *sinfo, int mode) {
 
   close(fd);
 
-  // Remove reinit file
-  memset(fpath, 0, sizeof(fpath));
-  sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
-  if (0 == access(fpath, F_OK)) {
-    sprintf(cmd,"rm -rf %s",fpath);
-    system(cmd);
-  }
-
+  // The reinit file is removed by sensord once the thresholds are live
   return 0;
 }
 
@@ -2090,12 +2082,7 @@ pal_sensor_thresh_modify(uint8_t fru,  uint8_t sensor_num, uint8_t thresh_type,
     return ret;
   }
 
-  // Create reinit file
-  memset(fpath, 0, sizeof(fpath));
-  sprintf(fpath, THRESHOLD_RE_FLAG, fru_name);
-  sprintf(cmd,"touch %s",fpath);
-  system(cmd);
-
+  // The caller asks sensord to reload, with its own token in the reinit flag
   return 0;
 }
 
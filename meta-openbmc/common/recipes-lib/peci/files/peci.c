@@ -0,0 +1,411 @@
+/*
+ * libpeci
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "peci.h"
+
+#define MIN_RETRY_DELAY 1000 // us
+
+struct _peci_handle_t {
+  int fd;
+  int retry_times;
+  int retry_interval;      // ms
+  // The wait each command needed lately before it was answered, us
+  uint32_t delay[256];
+};
+
+// Per command state of a batch
+typedef struct {
+  int64_t due;             // not to be tried again before, us
+  int64_t first_fail;
+  int64_t deadline;
+  uint32_t delay;          // the next wait, us
+  bool done;
+} batch_state_t;
+
+static int64_t
+now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+open_device(void) {
+  int fd, timeout = 5;
+
+  while ((fd = open(PECI_DEVICE, O_RDWR)) < 0) {
+    if (timeout-- < 0) {
+      syslog(LOG_WARNING, "Failed to open %s", PECI_DEVICE);
+      return -1;
+    }
+    usleep(10*1000);
+  }
+  return fd;
+}
+
+peci_handle_t *
+peci_open(void) {
+  peci_handle_t *h = calloc(1, sizeof(*h));
+
+  if (h == NULL)
+    return NULL;
+  if ((h->fd = open_device()) < 0) {
+    free(h);
+    return NULL;
+  }
+  h->retry_times = PECI_RETRY_TIMES;
+  h->retry_interval = PECI_RETRY_INTERVAL;
+  return h;
+}
+
+void
+peci_close(peci_handle_t *h) {
+  if (h == NULL)
+    return;
+  if (h->fd >= 0)
+    close(h->fd);
+  free(h);
+}
+
+void
+peci_set_retry(peci_handle_t *h, int times, int interval_ms) {
+  h->retry_times = times > 0 ? times : 0;
+  h->retry_interval = interval_ms > 0 ? interval_ms : 1;
+}
+
+// Ping, GetDIB and GetTemp answer with data only
+static bool
+has_cc(const peci_cmd_t *cmd) {
+  if (cmd->tx_len == 0 || cmd->rx_len == 0)
+    return false;
+  switch (cmd->tx[0]) {
+    case PECI_CMD_GET_TEMP:
+    case PECI_CMD_GET_DIB:
+      return false;
+  }
+  return true;
+}
+
+// The second byte of these carries the Host ID and the retry bit
+static bool
+has_host_id(const peci_cmd_t *cmd) {
+  if (cmd->tx_len < 2)
+    return false;
+  switch (cmd->tx[0]) {
+    case PECI_CMD_RD_PKG_CONFIG:
+    case PECI_CMD_WR_PKG_CONFIG:
+    case PECI_CMD_RD_IA_MSR:
+    case PECI_CMD_RD_PCI_CONFIG:
+    case PECI_CMD_RD_PCI_CONFIG_LOCAL:
+    case PECI_CMD_WR_PCI_CONFIG_LOCAL:
+      return true;
+  }
+  return false;
+}
+
+/*
+ * One transfer. Should the device be gone from under the handle it is
+ * opened again, once.
+ */
+static int
+xfer_once(peci_handle_t *h, peci_cmd_t *cmd) {
+  struct xfer_msg msg;
+  int i;
+
+  if (cmd->tx_len > PECI_BUF_MAX || cmd->rx_len > PECI_BUF_MAX)
+    return -1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.client_addr = cmd->addr;
+  msg.tx_len = cmd->tx_len;
+  msg.rx_len = cmd->rx_len;
+  msg.fcs_en = cmd->awfcs;
+  msg.tx_buf = cmd->tx;
+  msg.rx_buf = cmd->rx;
+
+  for (i = 0; i < 2; i++) {
+    if (h->fd < 0 && (h->fd = open_device()) < 0)
+      return -1;
+    if (ioctl(h->fd, AST_PECI_IOCXFER, &msg) == 0)
+      break;
+    syslog(LOG_WARNING, "%s: ioctl failed, errno=%d", __func__, errno);
+    close(h->fd);
+    h->fd = -1;
+  }
+  if (i == 2)
+    return -1;
+
+  cmd->sts = msg.sts;
+  return (msg.sts == PECI_INT_CMD_DONE) ? 0 : -1;
+}
+
+/*
+ * Handle the answer to one attempt. Return true if the command is to be
+ * tried again.
+ */
+static bool
+want_retry(peci_handle_t *h, peci_cmd_t *cmd, batch_state_t *st, int64_t now) {
+  uint8_t op = cmd->tx_len ? cmd->tx[0] : 0;
+  uint32_t max_delay = h->retry_interval * 1000;
+
+  if (has_cc(cmd) && h->retry_times &&
+      (cmd->rx[0] == PECI_CC_TIMEOUT || cmd->rx[0] == PECI_CC_NO_RESOURCE)) {
+    if (cmd->retries == 0) {
+      st->first_fail = now;
+      st->deadline = now + (int64_t)h->retry_times * max_delay;
+      st->delay = h->delay[op];
+    }
+    if (now < st->deadline) {
+      if (st->delay < MIN_RETRY_DELAY)
+        st->delay = MIN_RETRY_DELAY;
+      if (st->delay > max_delay)
+        st->delay = max_delay;
+      st->due = now + st->delay;
+      if (st->due > st->deadline)
+        st->due = st->deadline;
+      st->delay *= 2;
+      cmd->retries++;
+      if (has_host_id(cmd))
+        cmd->tx[1] |= 0x01;
+      return true;
+    }
+    syslog(LOG_DEBUG, "%s: addr %02X cmd %02X cc %02X after %d retries",
+           __func__, cmd->addr, op, cmd->rx[0], cmd->retries);
+  } else if (cmd->retries) {
+    // Start the next one of its kind about where this one got its answer
+    h->delay[op] = (h->delay[op] + (uint32_t)(now - st->first_fail)) / 2;
+  } else {
+    h->delay[op] -= h->delay[op] / 4;
+  }
+  return false;
+}
+
+int
+peci_xfer_batch(peci_handle_t *h, peci_cmd_t *cmds, int num) {
+  batch_state_t *st;
+  uint8_t busy[256];
+  int64_t now, wake;
+  int i, first = 0, left = num, ret = 0;
+  bool issued;
+
+  if (num <= 0)
+    return 0;
+  if ((st = calloc(num, sizeof(*st))) == NULL)
+    return -1;
+  for (i = 0; i < num; i++) {
+    cmds[i].status = -1;
+    cmds[i].sts = 0;
+    cmds[i].retries = 0;
+  }
+
+  while (left > 0) {
+    memset(busy, 0, sizeof(busy));
+    now = now_us();
+    wake = INT64_MAX;
+    issued = false;
+
+    while (st[first].done)
+      first++;
+    for (i = first; i < num; i++) {
+      peci_cmd_t *cmd = &cmds[i];
+
+      // The first unfinished command of each client goes
+      if (st[i].done || busy[cmd->addr])
+        continue;
+      busy[cmd->addr] = 1;
+      if (st[i].due > now) {
+        if (st[i].due < wake)
+          wake = st[i].due;
+        continue;
+      }
+
+      issued = true;
+      if (xfer_once(h, cmd) < 0) {
+        st[i].done = true;
+        left--;
+        ret = -1;
+        continue;
+      }
+      now = now_us();
+      if (want_retry(h, cmd, &st[i], now)) {
+        if (st[i].due < wake)
+          wake = st[i].due;
+        continue;
+      }
+      cmd->status = 0;
+      st[i].done = true;
+      left--;
+    }
+
+    // Everybody is waiting for the CPU
+    if (left > 0 && !issued) {
+      now = now_us();
+      if (wake > now)
+        usleep(wake - now);
+    }
+  }
+
+  free(st);
+  return ret;
+}
+
+int
+peci_xfer(peci_handle_t *h, peci_cmd_t *cmd) {
+  return peci_xfer_batch(h, cmd, 1);
+}
+
+void
+peci_cmd_get_temp(peci_cmd_t *cmd, uint8_t addr) {
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->addr = addr;
+  cmd->tx_len = 1;
+  cmd->rx_len = 2;
+  cmd->tx[0] = PECI_CMD_GET_TEMP;
+}
+
+void
+peci_cmd_rd_pkg_config(peci_cmd_t *cmd, uint8_t addr, uint8_t host_id,
+                       uint8_t index, uint16_t param, uint8_t len) {
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->addr = addr;
+  cmd->tx_len = 5;
+  cmd->rx_len = len + 1;
+  cmd->tx[0] = PECI_CMD_RD_PKG_CONFIG;
+  cmd->tx[1] = host_id << 1;
+  cmd->tx[2] = index;
+  cmd->tx[3] = param & 0xFF;
+  cmd->tx[4] = param >> 8;
+}
+
+void
+peci_cmd_rd_ia_msr(peci_cmd_t *cmd, uint8_t addr, uint8_t host_id,
+                   uint8_t thread, uint16_t msr) {
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->addr = addr;
+  cmd->tx_len = 5;
+  cmd->rx_len = 9;
+  cmd->tx[0] = PECI_CMD_RD_IA_MSR;
+  cmd->tx[1] = host_id << 1;
+  cmd->tx[2] = thread;
+  cmd->tx[3] = msr & 0xFF;
+  cmd->tx[4] = msr >> 8;
+}
+
+// Address: Bus[23:20], Device[19:15], Function[14:12], Register[11:0]
+void
+peci_cmd_rd_pci_config_local(peci_cmd_t *cmd, uint8_t addr, uint8_t host_id,
+                             uint8_t bus, uint8_t dev, uint8_t func,
+                             uint16_t reg, uint8_t len) {
+  uint32_t pci = ((bus & 0xF) << 20) | ((dev & 0x1F) << 15) |
+                 ((func & 0x7) << 12) | (reg & 0xFFF);
+
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->addr = addr;
+  cmd->tx_len = 5;
+  cmd->rx_len = len + 1;
+  cmd->tx[0] = PECI_CMD_RD_PCI_CONFIG_LOCAL;
+  cmd->tx[1] = host_id << 1;
+  cmd->tx[2] = pci & 0xFF;
+  cmd->tx[3] = (pci >> 8) & 0xFF;
+  cmd->tx[4] = (pci >> 16) & 0xFF;
+}
+
+// Run a command with a completion code, and take its data little endian
+static int
+xfer_value(peci_handle_t *h, peci_cmd_t *cmd, uint64_t *value, uint8_t *cc) {
+  int i;
+
+  if (peci_xfer(h, cmd) < 0)
+    return -1;
+  if (cc)
+    *cc = cmd->rx[0];
+  if (cmd->rx[0] != PECI_CC_PASS)
+    return -1;
+
+  *value = 0;
+  for (i = cmd->rx_len - 1; i >= 1; i--)
+    *value = (*value << 8) | cmd->rx[i];
+  return 0;
+}
+
+int
+peci_get_temp(peci_handle_t *h, uint8_t addr, int16_t *temp) {
+  peci_cmd_t cmd;
+
+  peci_cmd_get_temp(&cmd, addr);
+  if (peci_xfer(h, &cmd) < 0)
+    return -1;
+  *temp = (int16_t)(cmd.rx[0] | (cmd.rx[1] << 8));
+  return 0;
+}
+
+int
+peci_rd_pkg_config(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+                   uint8_t index, uint16_t param, uint8_t len,
+                   uint32_t *value, uint8_t *cc) {
+  peci_cmd_t cmd;
+  uint64_t val;
+
+  if (len != 1 && len != 2 && len != 4)
+    return -1;
+  peci_cmd_rd_pkg_config(&cmd, addr, host_id, index, param, len);
+  if (xfer_value(h, &cmd, &val, cc) < 0)
+    return -1;
+  *value = (uint32_t)val;
+  return 0;
+}
+
+int
+peci_rd_ia_msr(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+               uint8_t thread, uint16_t msr, uint64_t *value, uint8_t *cc) {
+  peci_cmd_t cmd;
+
+  peci_cmd_rd_ia_msr(&cmd, addr, host_id, thread, msr);
+  return xfer_value(h, &cmd, value, cc);
+}
+
+int
+peci_rd_pci_config_local(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+                         uint8_t bus, uint8_t dev, uint8_t func,
+                         uint16_t reg, uint8_t len, uint32_t *value,
+                         uint8_t *cc) {
+  peci_cmd_t cmd;
+  uint64_t val;
+
+  if (len != 1 && len != 2 && len != 4)
+    return -1;
+  peci_cmd_rd_pci_config_local(&cmd, addr, host_id, bus, dev, func, reg, len);
+  if (xfer_value(h, &cmd, &val, cc) < 0)
+    return -1;
+  *value = (uint32_t)val;
+  return 0;
+}
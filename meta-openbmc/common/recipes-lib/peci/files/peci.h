@@ -0,0 +1,177 @@
+/*
+ * libpeci
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __PECI_H__
+#define __PECI_H__
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***********************************************************************/
+/* ast-peci driver interface */
+struct timing_negotiation {
+  uint8_t msg_timing;
+  uint8_t addr_timing;
+};
+
+struct xfer_msg {
+  uint8_t client_addr;
+  uint8_t tx_len;
+  uint8_t rx_len;
+  uint8_t tx_fcs;
+  uint8_t rx_fcs;
+  uint8_t fcs_en;
+  uint8_t sw_fcs;
+  uint8_t *tx_buf;
+  uint8_t *rx_buf;
+  uint32_t sts;
+};
+
+#define PECI_DEVICE "/dev/ast-peci"
+
+//IOCTL ..
+#define PECIIOC_BASE 'P'
+
+#define AST_PECI_IOCRTIMING _IOR(PECIIOC_BASE, 0, struct timing_negotiation*)
+#define AST_PECI_IOCWTIMING _IOW(PECIIOC_BASE, 1, struct timing_negotiation*)
+#define AST_PECI_IOCXFER _IOWR(PECIIOC_BASE, 2, struct xfer_msg*)
+
+#define PECI_INT_TIMEOUT     (0x1 << 4)
+#define PECI_INT_CONNECT     (0x1 << 3)
+#define PECI_INT_W_FCS_BAD   (0x1 << 2)
+#define PECI_INT_W_FCS_ABORT (0x1 << 1)
+#define PECI_INT_CMD_DONE    (0x1)
+
+/***********************************************************************/
+
+#define PECI_CPU0_ADDR 0x30
+#define PECI_CPU1_ADDR 0x31
+#define PECI_BUF_MAX   32
+
+// Commands
+#define PECI_CMD_GET_TEMP           0x01
+#define PECI_CMD_RD_PKG_CONFIG      0xA1
+#define PECI_CMD_WR_PKG_CONFIG      0xA5
+#define PECI_CMD_RD_IA_MSR          0xB1
+#define PECI_CMD_RD_PCI_CONFIG      0x61
+#define PECI_CMD_RD_PCI_CONFIG_LOCAL 0xE1
+#define PECI_CMD_WR_PCI_CONFIG_LOCAL 0xE5
+#define PECI_CMD_GET_DIB            0xF7
+
+// Completion codes
+#define PECI_CC_PASS          0x40
+#define PECI_CC_TIMEOUT       0x80 // Response timeout, Data not ready
+#define PECI_CC_NO_RESOURCE   0x81 // Response timeout, not able to allocate resource
+#define PECI_CC_LOW_POWER     0x82
+#define PECI_CC_INVALID_REQ   0x90
+#define PECI_CC_ERROR         0x91
+
+// Retry for 0x80/0x81, unless the handle is told otherwise
+#define PECI_RETRY_TIMES      3
+#define PECI_RETRY_INTERVAL   250 // ms
+
+typedef struct _peci_cmd_t {
+  uint8_t addr;
+  uint8_t tx_len;
+  uint8_t rx_len;
+  uint8_t awfcs;
+  uint8_t tx[PECI_BUF_MAX];
+  uint8_t rx[PECI_BUF_MAX];
+  // Set by the transfer: 0 once the CPU answered, -1 if it did not
+  int status;
+  uint32_t sts;     // driver status of the last attempt
+  int retries;      // attempts after the first one
+} peci_cmd_t;
+
+typedef struct _peci_handle_t peci_handle_t;
+
+/*
+ * peci_open():
+ *   Open PECI_DEVICE and keep it open for any number of transfers; the
+ *   device is reopened by itself should a transfer find it gone.
+ *   Return the handle on Success
+ *   Return NULL on failure
+ * peci_set_retry():
+ *   How hard to retry a command answered with 0x80/0x81: it may wait
+ *   up to 'times' x 'interval_ms' in all for an answer, 0 times does not
+ *   retry at all.
+ */
+peci_handle_t *peci_open(void);
+void peci_close(peci_handle_t *h);
+void peci_set_retry(peci_handle_t *h, int times, int interval_ms);
+
+/*
+ * peci_xfer_batch():
+ *   Run 'num' commands back to back. A command answered with 0x80/0x81
+ *   is tried again after a delay that starts from what that command
+ *   needed lately and doubles up to the retry interval. While it waits
+ *   the commands for other clients go on; the commands for the same
+ *   client keep their order.
+ *   Every command gets its status and response, whatever became of the
+ *   others.
+ *   Return 0 if every command was answered
+ *   Return -1 otherwise
+ * peci_xfer():
+ *   The same for one command.
+ */
+int peci_xfer_batch(peci_handle_t *h, peci_cmd_t *cmds, int num);
+int peci_xfer(peci_handle_t *h, peci_cmd_t *cmd);
+
+/*
+ * Typed commands. host_id goes to bits [7:1] of the Host ID byte, 0
+ * unless more than one host talks to the CPU. GetTemp gives the raw
+ * reading: 1/64 degree C, negative, relative to the TCC activation point.
+ *   Return 0 on Success, and *cc PECI_CC_PASS where there is one
+ *   Return -1 if the CPU did not answer or answered another completion
+ *   code, which is stored in *cc if cc is not NULL
+ */
+int peci_get_temp(peci_handle_t *h, uint8_t addr, int16_t *temp);
+int peci_rd_pkg_config(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+                       uint8_t index, uint16_t param, uint8_t len,
+                       uint32_t *value, uint8_t *cc);
+int peci_rd_ia_msr(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+                   uint8_t thread, uint16_t msr, uint64_t *value,
+                   uint8_t *cc);
+int peci_rd_pci_config_local(peci_handle_t *h, uint8_t addr, uint8_t host_id,
+                             uint8_t bus, uint8_t dev, uint8_t func,
+                             uint16_t reg, uint8_t len, uint32_t *value,
+                             uint8_t *cc);
+
+/*
+ * Fill a command without running it, to be run by peci_xfer_batch().
+ */
+void peci_cmd_get_temp(peci_cmd_t *cmd, uint8_t addr);
+void peci_cmd_rd_pkg_config(peci_cmd_t *cmd, uint8_t addr, uint8_t host_id,
+                            uint8_t index, uint16_t param, uint8_t len);
+void peci_cmd_rd_ia_msr(peci_cmd_t *cmd, uint8_t addr, uint8_t host_id,
+                        uint8_t thread, uint16_t msr);
+void peci_cmd_rd_pci_config_local(peci_cmd_t *cmd, uint8_t addr,
+                                  uint8_t host_id, uint8_t bus, uint8_t dev,
+                                  uint8_t func, uint16_t reg, uint8_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* __PECI_H__ */
@@ -0,0 +1,352 @@
+/*
+ * libpeci test
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "peci.h"
+
+/*
+ * libpeci against a fake ast-peci: open(), close() and ioctl() are
+ * redirected (-Wl,--wrap) to a model of two CPUs, and the clock and
+ * usleep() to a virtual clock, so the retries take no real time.
+ * A CPU answers a chosen kind of command with 0x80 for a while, and
+ * answers it only to a request with the retry bit once that is over,
+ * as the PECI spec has it.
+ */
+
+#define FAKE_FD     1000
+#define XFER_US     100   // a transfer on the wire
+#define MAX_LOG     256
+
+static int64_t clock_us;
+static int opens, closes, xfers, fail_ioctl;
+
+// The slow command, of one CPU or of any, and how long it takes
+static uint8_t slow_addr, slow_op;
+static int64_t slow_us;
+static int64_t ready_at[256];
+static int pending[256];
+
+// Order the CPUs saw the commands in: addr << 8 | tx[2]
+static uint16_t xfer_log[MAX_LOG];
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_ioctl(int fd, unsigned long req, ...);
+int __real_usleep(useconds_t usec);
+int __real_clock_gettime(clockid_t id, struct timespec *ts);
+
+int
+__wrap_open(const char *path, int flags, ...) {
+  va_list ap;
+  int mode;
+
+  if (strcmp(path, PECI_DEVICE) == 0) {
+    opens++;
+    return FAKE_FD;
+  }
+  va_start(ap, flags);
+  mode = va_arg(ap, int);
+  va_end(ap);
+  return __real_open(path, flags, mode);
+}
+
+int
+__wrap_close(int fd) {
+  if (fd == FAKE_FD) {
+    closes++;
+    return 0;
+  }
+  return __real_close(fd);
+}
+
+int
+__wrap_usleep(useconds_t usec) {
+  clock_us += usec;
+  return 0;
+}
+
+int
+__wrap_clock_gettime(clockid_t id, struct timespec *ts) {
+  ts->tv_sec = clock_us / 1000000;
+  ts->tv_nsec = (clock_us % 1000000) * 1000;
+  return 0;
+}
+
+static void
+put_le(uint8_t *buf, uint64_t val, int len) {
+  int i;
+
+  for (i = 0; i < len; i++, val >>= 8)
+    buf[i] = val & 0xFF;
+}
+
+static void
+cpu_answer(struct xfer_msg *msg) {
+  uint8_t *tx = msg->tx_buf, *rx = msg->rx_buf;
+  uint8_t addr = msg->client_addr;
+  int len = msg->rx_len - 1;
+
+  if (tx[0] == PECI_CMD_GET_TEMP) {
+    put_le(rx, (uint16_t)-640, 2);   // 10 degree below, LSB is 0x80
+    return;
+  }
+
+  if ((addr == slow_addr || !slow_addr) && tx[0] == slow_op && slow_us) {
+    if (!(tx[1] & 0x01) || !pending[addr]) {
+      // A new request, the CPU starts on it
+      assert(!(tx[1] & 0x01));
+      pending[addr] = 1;
+      ready_at[addr] = clock_us + slow_us;
+    }
+    if (clock_us < ready_at[addr]) {
+      rx[0] = PECI_CC_TIMEOUT;
+      return;
+    }
+    pending[addr] = 0;
+  }
+
+  rx[0] = PECI_CC_PASS;
+  switch (tx[0]) {
+    case PECI_CMD_RD_PKG_CONFIG:
+      put_le(rx + 1, (tx[2] << 16) | tx[3] | (tx[4] << 8), len);
+      break;
+    case PECI_CMD_RD_IA_MSR:
+      put_le(rx + 1, ((uint64_t)tx[2] << 32) | tx[3] | (tx[4] << 8), len);
+      break;
+    case PECI_CMD_RD_PCI_CONFIG_LOCAL:
+      put_le(rx + 1, tx[2] | (tx[3] << 8) | (tx[4] << 16), len);
+      break;
+    default:
+      rx[0] = PECI_CC_INVALID_REQ;
+      break;
+  }
+}
+
+int
+__wrap_ioctl(int fd, unsigned long req, ...) {
+  struct xfer_msg *msg;
+  va_list ap;
+
+  va_start(ap, req);
+  msg = va_arg(ap, struct xfer_msg *);
+  va_end(ap);
+
+  if (fd != FAKE_FD)
+    return __real_ioctl(fd, req, msg);
+  assert(req == AST_PECI_IOCXFER);
+  if (fail_ioctl) {
+    fail_ioctl--;
+    errno = EBADF;
+    return -1;
+  }
+
+  clock_us += XFER_US;
+  if (xfers < MAX_LOG)
+    xfer_log[xfers] = (msg->client_addr << 8) | msg->tx_buf[2];
+  xfers++;
+  // No CPU in the second socket
+  if (msg->client_addr != PECI_CPU0_ADDR && msg->client_addr != PECI_CPU1_ADDR) {
+    msg->sts = PECI_INT_TIMEOUT;
+    return 0;
+  }
+  msg->sts = PECI_INT_CMD_DONE;
+  cpu_answer(msg);
+  return 0;
+}
+
+static void
+reset(int64_t us, uint8_t addr, uint8_t op) {
+  slow_us = us;
+  slow_addr = addr;
+  slow_op = op;
+  memset(pending, 0, sizeof(pending));
+  xfers = 0;
+}
+
+static void
+test_typed(void) {
+  peci_handle_t *h = peci_open();
+  uint64_t msr;
+  uint32_t val;
+  int16_t temp;
+  uint8_t cc;
+
+  assert(h && opens == 1);
+  reset(0, 0, 0);
+
+  // 0x80 in the temperature is no completion code
+  assert(peci_get_temp(h, PECI_CPU0_ADDR, &temp) == 0);
+  assert(temp == -640 && xfers == 1);
+
+  assert(peci_rd_pkg_config(h, PECI_CPU0_ADDR, 0, 0x10, 0x0102, 4, &val, &cc) == 0);
+  assert(cc == PECI_CC_PASS && val == 0x100102);
+  assert(peci_rd_pkg_config(h, PECI_CPU0_ADDR, 0, 0x10, 0x0102, 2, &val, NULL) == 0);
+  assert(val == 0x0102);
+  assert(peci_rd_pkg_config(h, PECI_CPU0_ADDR, 0, 0x10, 0x0102, 3, &val, NULL) < 0);
+
+  assert(peci_rd_ia_msr(h, PECI_CPU1_ADDR, 0, 7, 0x0400, &msr, &cc) == 0);
+  assert(msr == 0x700000400ULL);
+
+  assert(peci_rd_pci_config_local(h, PECI_CPU0_ADDR, 0, 1, 30, 5, 0x10c, 4,
+                                  &val, &cc) == 0);
+  assert(val == ((1 << 20) | (30 << 15) | (5 << 12) | 0x10c));
+
+  // One open for all of it
+  assert(opens == 1 && closes == 0);
+  peci_close(h);
+  assert(closes == 1);
+  printf("typed: passed\n");
+}
+
+static void
+test_retry(void) {
+  peci_handle_t *h = peci_open();
+  int64_t start;
+  peci_cmd_t cmd;
+  uint64_t msr;
+  uint8_t cc;
+  int i, first_tries;
+
+  // The CPU needs 30ms; the retry bit is checked by the model
+  reset(30000, PECI_CPU0_ADDR, PECI_CMD_RD_IA_MSR);
+  start = clock_us;
+  peci_cmd_rd_ia_msr(&cmd, PECI_CPU0_ADDR, 0, 0, 0x0400);
+  assert(peci_xfer(h, &cmd) == 0);
+  assert(cmd.status == 0 && cmd.rx[0] == PECI_CC_PASS);
+  assert(cmd.retries > 0 && (cmd.tx[1] & 0x01));
+  // Backoff overshoots by less than twice what the CPU needed
+  assert(clock_us - start < 2 * 30000 + XFER_US * (cmd.retries + 1));
+  first_tries = cmd.retries;
+
+  // The next ones start waiting about where the last got its answer
+  for (i = 0; i < 5; i++) {
+    peci_cmd_rd_ia_msr(&cmd, PECI_CPU0_ADDR, 0, 0, 0x0400);
+    assert(peci_xfer(h, &cmd) == 0 && cmd.rx[0] == PECI_CC_PASS);
+  }
+  assert(cmd.retries < first_tries && cmd.retries <= 3);
+  printf("retry: %d retries for the first read, %d once learned\n",
+         first_tries, cmd.retries);
+
+  // Longer than the retries are allowed to wait
+  reset(2000000, PECI_CPU0_ADDR, PECI_CMD_RD_IA_MSR);
+  peci_set_retry(h, 3, 100);
+  start = clock_us;
+  assert(peci_rd_ia_msr(h, PECI_CPU0_ADDR, 0, 0, 0x0400, &msr, &cc) < 0);
+  assert(cc == PECI_CC_TIMEOUT);
+  assert(clock_us - start >= 300000 && clock_us - start < 320000);
+
+  // No retries at all
+  peci_set_retry(h, 0, 100);
+  reset(2000000, PECI_CPU0_ADDR, PECI_CMD_RD_IA_MSR);
+  assert(peci_rd_ia_msr(h, PECI_CPU0_ADDR, 0, 0, 0x0400, &msr, &cc) < 0);
+  assert(cc == PECI_CC_TIMEOUT && xfers == 1);
+  peci_close(h);
+  printf("retry: passed\n");
+}
+
+static void
+fill_batch(peci_cmd_t *cmds, int num) {
+  int i;
+
+  // Package config of CPU0 and CPU1 in turn
+  for (i = 0; i < num; i++)
+    peci_cmd_rd_pkg_config(&cmds[i], (i % 2) ? PECI_CPU1_ADDR : PECI_CPU0_ADDR,
+                           0, i, 0, 4);
+}
+
+static void
+test_batch(void) {
+  peci_handle_t *h;
+  peci_cmd_t cmds[12];
+  int64_t start, serial, batch;
+  int i, last0 = -1, last1 = -1;
+
+  // Both CPUs need 40ms for each; one command at a time first
+  h = peci_open();
+  fill_batch(cmds, 12);
+  reset(40000, 0, PECI_CMD_RD_PKG_CONFIG);
+  start = clock_us;
+  for (i = 0; i < 12; i++)
+    assert(peci_xfer(h, &cmds[i]) == 0);
+  serial = clock_us - start;
+  peci_close(h);
+
+  h = peci_open();
+  fill_batch(cmds, 12);
+  reset(40000, 0, PECI_CMD_RD_PKG_CONFIG);
+  start = clock_us;
+  assert(peci_xfer_batch(h, cmds, 12) == 0);
+  batch = clock_us - start;
+  for (i = 0; i < 12; i++) {
+    assert(cmds[i].status == 0 && cmds[i].rx[0] == PECI_CC_PASS);
+    assert(cmds[i].rx[3] == i);
+  }
+
+  // Each CPU saw its commands in order, the other one's wait in between
+  for (i = 0; i < xfers; i++) {
+    uint8_t addr = xfer_log[i] >> 8, idx = xfer_log[i] & 0xFF;
+    if (addr == PECI_CPU0_ADDR) {
+      assert(idx >= last0);
+      last0 = idx;
+    } else {
+      assert(idx >= last1);
+      last1 = idx;
+    }
+  }
+  assert(last0 == 10 && last1 == 11);
+  printf("batch: 12 commands in %lld us, %lld us one at a time\n",
+         (long long)batch, (long long)serial);
+  assert(batch < serial * 6 / 10);
+
+  // A missing CPU fails its commands only
+  peci_cmd_get_temp(&cmds[0], 0x32);
+  peci_cmd_get_temp(&cmds[1], PECI_CPU0_ADDR);
+  peci_cmd_get_temp(&cmds[2], 0x32);
+  reset(0, 0, 0);
+  assert(peci_xfer_batch(h, cmds, 3) < 0);
+  assert(cmds[0].status < 0 && cmds[0].sts == PECI_INT_TIMEOUT);
+  assert(cmds[1].status == 0 && cmds[2].status < 0);
+
+  // The device went away: it is opened again
+  i = opens;
+  fail_ioctl = 1;
+  assert(peci_xfer_batch(h, &cmds[1], 1) == 0);
+  assert(opens == i + 1 && cmds[1].status == 0);
+  peci_close(h);
+  printf("batch: passed\n");
+}
+
+int
+main(int argc, char **argv) {
+  test_typed();
+  test_retry();
+  test_batch();
+  printf("All tests passed\n");
+  return 0;
+}
@@ -50,6 +50,8 @@
 
 #define MAX_NUM_CONDITIONS 32
 #define MAX_NUM_TABLES     32
+#define MAX_NUM_FRUS       256
+#define MAX_NUM_SENSOR_IDS 256
 
 typedef struct {
   char cond_value[MAX_VALUE_LEN];
@@ -64,6 +66,7 @@ typedef struct {
 typedef struct {
   char name[32];
   size_t num;
+  /* sorted by cond_value */
   correction_element_t *corr_table;
 } correction_table_t;
 
@@ -77,10 +80,18 @@ typedef struct {
   char    cond_key[MAX_KEY_LEN];
   size_t  value_map_size;
   value_map_element_t value_map[MAX_NUM_CONDITIONS];
+  /* interpolate between table points instead of stepping */
+  bool    interpolate;
+  /* table chosen for the condition key as of edb generation cond_gen */
+  bool    cond_cached;
+  uint32_t cond_gen;
+  size_t  cond_table;
 } sensor_correction_t;
 
 static sensor_correction_t *g_sensors = NULL;
 static size_t g_sensors_count = 0;
+/* g_index[fru][sensor_id], rows allocated for FRUs with corrections */
+static sensor_correction_t **g_index[MAX_NUM_FRUS];
 
 static int get_table(value_map_element_t *value_map, size_t num, char *value, size_t *idx)
 {
@@ -96,14 +107,49 @@ static int get_table(value_map_element_t *value_map, size_t num, char *value, si
 }
 
 static sensor_correction_t *get_correction(uint8_t fru, uint8_t sensor_id)
+{
+  if (!g_index[fru]) {
+    return NULL;
+  }
+  return g_index[fru][sensor_id];
+}
+
+static void free_index(void)
+{
+  size_t i;
+  for (i = 0; i < MAX_NUM_FRUS; i++) {
+    free(g_index[i]);
+    g_index[i] = NULL;
+  }
+}
+
+static int build_index(void)
 {
   size_t i;
-  for(i = 0; i < g_sensors_count; i++) {
-    if (g_sensors[i].fru == fru && g_sensors[i].id == sensor_id) {
-      return &g_sensors[i];
+
+  free_index();
+  for (i = 0; i < g_sensors_count; i++) {
+    sensor_correction_t *snr = &g_sensors[i];
+    if (!g_index[snr->fru]) {
+      g_index[snr->fru] = calloc(MAX_NUM_SENSOR_IDS, sizeof(sensor_correction_t *));
+      if (!g_index[snr->fru]) {
+        free_index();
+        return -1;
+      }
+    }
+    /* Like the linear scan it replaces, the first entry for a sensor wins */
+    if (!g_index[snr->fru][snr->id]) {
+      g_index[snr->fru][snr->id] = snr;
     }
   }
-  return NULL;
+  return 0;
+}
+
+static int cmp_element(const void *a, const void *b)
+{
+  float x = ((const correction_element_t *)a)->cond_value;
+  float y = ((const correction_element_t *)b)->cond_value;
+  return (x > y) - (x < y);
 }
 
 static int load_table(json_t *obj, correction_table_t *tbl)
@@ -139,6 +185,7 @@ static int load_table(json_t *obj, correction_table_t *tbl)
     tbl->corr_table[i].cond_value = get_float(cond_value_o);
     tbl->corr_table[i].correction = get_float(correction_o);
   }
+  qsort(tbl->corr_table, tbl->num, sizeof(correction_element_t), cmp_element);
   return 0;
 }
 
@@ -162,6 +209,9 @@ static int load_conditional_sensor_correction(json_t *obj, sensor_correction_t *
   void *iter;
   size_t i;
 
+  tmp = json_object_get(obj, "interpolate");
+  snr->interpolate = tmp && json_is_true(tmp);
+
   tmp = json_object_get(obj, "tables");
   if (!tmp) {
     DEBUG("Could not get tables\n");
@@ -300,11 +350,13 @@ int sensor_correction_init(const char *file)
   tmp = json_object_get(conf, "sensors");
   if (!tmp || !json_is_array(tmp)) {
     DEBUG("Failed to get sensors");
+    json_decref(conf);
     return -1;
   }
   g_sensors_count = json_array_size(tmp);
   if (!g_sensors_count) {
     DEBUG("No sensors found in configuration");
+    json_decref(conf);
     return 0;
   }
   g_sensors = calloc(g_sensors_count, sizeof(sensor_correction_t));
@@ -325,6 +377,10 @@ int sensor_correction_init(const char *file)
       goto bail;
     }
   }
+  if (build_index()) {
+    DEBUG("Allocation failure!\n");
+    goto bail;
+  }
   json_decref(conf);
   return 0;
 bail:
@@ -335,33 +391,69 @@ bail:
   return -1;
 }
 
-int sensor_correction_apply(uint8_t fru, uint8_t sensor_id, float cond_value, float *sensor_reading)
+/* Table for the current value of the condition key. The key is only read
+ * again once edb reports that some cached value has changed. */
+static size_t get_cond_table(sensor_correction_t *snr)
 {
   char value[MAX_VALUE_LEN];
-  size_t table_idx = 0;
-  correction_table_t *table;
-  size_t i;
-  float correction;
+  size_t table_idx;
+  uint32_t gen;
+  bool have_gen = edb_cache_generation(&gen) == 0;
 
-  sensor_correction_t *snr = get_correction(fru, sensor_id);
-  if (!snr) {
-    /* No correction defined for this sensor. Return success without
-     * manipulating it */
-    return 0;
+  if (have_gen && snr->cond_cached && snr->cond_gen == gen) {
+    return snr->cond_table;
   }
   if (edb_cache_get(snr->cond_key, value) ||
       get_table(snr->value_map, snr->value_map_size, value, &table_idx)) {
     table_idx = snr->default_table;
   }
-  table = &snr->tables[table_idx];
-  correction = table->corr_table[0].correction;
-  for (i = 0; i < table->num; i++) {
-    if (cond_value < table->corr_table[i].cond_value) {
-      break;
+  snr->cond_table = table_idx;
+  if (have_gen) {
+    snr->cond_gen = gen;
+  }
+  snr->cond_cached = have_gen;
+  return table_idx;
+}
+
+/* Correction at cond_value: the one of the last point at or below it (the
+ * first point below the table), or with interpolation the straight line
+ * between the two points around it, flat beyond the ends */
+static float get_table_correction(correction_table_t *table, bool interpolate, float cond_value)
+{
+  correction_element_t *e = table->corr_table;
+  size_t lo = 0, hi = table->num;
+
+  /* first point above cond_value */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cond_value < e[mid].cond_value) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
     }
-    correction = table->corr_table[i].correction;
   }
-  *sensor_reading = *sensor_reading - correction;
+  if (lo == 0) {
+    return e[0].correction;
+  }
+  if (lo == table->num || !interpolate) {
+    return e[lo - 1].correction;
+  }
+  return e[lo - 1].correction + (e[lo].correction - e[lo - 1].correction) *
+    (cond_value - e[lo - 1].cond_value) / (e[lo].cond_value - e[lo - 1].cond_value);
+}
+
+int sensor_correction_apply(uint8_t fru, uint8_t sensor_id, float cond_value, float *sensor_reading)
+{
+  sensor_correction_t *snr = get_correction(fru, sensor_id);
+  correction_table_t *table;
+
+  if (!snr) {
+    /* No correction defined for this sensor. Return success without
+     * manipulating it */
+    return 0;
+  }
+  table = &snr->tables[get_cond_table(snr)];
+  *sensor_reading = *sensor_reading - get_table_correction(table, snr->interpolate, cond_value);
   return 0;
 }
 
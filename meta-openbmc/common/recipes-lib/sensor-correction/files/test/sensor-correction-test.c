@@ -0,0 +1,270 @@
+/*
+ *
+ * Copyright 2017-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include "sensor-correction.h"
+#include <openbmc/edb.h>
+
+/*
+ * sensor_correction_apply() over sample configs, with edb replaced by
+ * stubs counting how often the condition key is read
+ */
+
+#define MB_FRU        1
+#define INLET_ID      163
+#define OUTLET_ID     164
+
+static char cond_value[MAX_VALUE_LEN] = "SS_D";
+static bool cond_present = true;
+static bool gen_available = true;
+static uint32_t generation = 1;
+static int key_reads;
+
+int edb_cache_get(char *key, char *value)
+{
+  assert(!strcmp(key, "mb_system_conf"));
+  key_reads++;
+  if (!cond_present) {
+    return -1;
+  }
+  strcpy(value, cond_value);
+  return 0;
+}
+
+int edb_cache_generation(uint32_t *gen)
+{
+  if (!gen_available) {
+    return -1;
+  }
+  *gen = generation;
+  return 0;
+}
+
+/* What edb_cache_set() does to readers */
+static void set_cond(const char *value)
+{
+  strcpy(cond_value, value);
+  generation++;
+}
+
+#define TABLE_I0 "[[10, 7], [12, 6], [14, 5], [18, 4], [20, 3], [24, 2], [32, 1], [41, 0]]"
+#define TABLE_I1 "[[41, 0], [10, 9], [24, 4], [18, 6]]"
+
+static const char *config_fmt =
+  "{\n"
+  "  \"version\": \"test\",\n"
+  "  \"sensors\": [\n"
+  "    {\n"
+  "      \"name\": \"MB_INLET_REMOTE_TEMP\", \"fru\": 1, \"id\": 163,\n"
+  "      \"correction\": {\n"
+  "        \"type\": \"conditional_table\", %s\n"
+  "        \"tables\": { \"I0\": " TABLE_I0 ", \"I1\": " TABLE_I1 " },\n"
+  "        \"condition\": {\n"
+  "          \"key\": \"mb_system_conf\", \"default_table\": \"I0\",\n"
+  "          \"value_map\": { \"SS_D\": \"I0\", \"DS_D\": \"I1\" }\n"
+  "        }\n"
+  "      }\n"
+  "    },\n"
+  "    {\n"
+  "      \"name\": \"MB_OUTLET_TEMP\", \"fru\": 1, \"id\": 164,\n"
+  "      \"correction\": {\n"
+  "        \"type\": \"conditional_table\",\n"
+  "        \"tables\": { \"O0\": [[0, 1.5]] },\n"
+  "        \"condition\": {\n"
+  "          \"key\": \"mb_system_conf\", \"default_table\": \"O0\",\n"
+  "          \"value_map\": { \"SS_D\": \"O0\" }\n"
+  "        }\n"
+  "      }\n"
+  "    },\n"
+  "    {\n"
+  "      \"name\": \"SHADOWED\", \"fru\": 1, \"id\": 163,\n"
+  "      \"correction\": {\n"
+  "        \"type\": \"conditional_table\",\n"
+  "        \"tables\": { \"X\": [[0, 100]] },\n"
+  "        \"condition\": {\n"
+  "          \"key\": \"mb_system_conf\", \"default_table\": \"X\",\n"
+  "          \"value_map\": { \"SS_D\": \"X\" }\n"
+  "        }\n"
+  "      }\n"
+  "    }\n"
+  "  ]\n"
+  "}\n";
+
+typedef struct {
+  float cond_value;
+  float correction;
+} point_t;
+
+static const point_t table_i0[] = {
+  {10, 7}, {12, 6}, {14, 5}, {18, 4}, {20, 3}, {24, 2}, {32, 1}, {41, 0},
+};
+static const point_t table_i1[] = {
+  {10, 9}, {18, 6}, {24, 4}, {41, 0},
+};
+
+/* The linear walk the library used to do */
+static float step_reference(const point_t *t, size_t num, float cond)
+{
+  float correction = t[0].correction;
+  size_t i;
+  for (i = 0; i < num; i++) {
+    if (cond < t[i].cond_value) {
+      break;
+    }
+    correction = t[i].correction;
+  }
+  return correction;
+}
+
+static float interp_reference(const point_t *t, size_t num, float cond)
+{
+  size_t i;
+  if (cond <= t[0].cond_value) {
+    return t[0].correction;
+  }
+  for (i = 1; i < num; i++) {
+    if (cond < t[i].cond_value) {
+      return t[i - 1].correction + (t[i].correction - t[i - 1].correction) *
+        (cond - t[i - 1].cond_value) / (t[i].cond_value - t[i - 1].cond_value);
+    }
+  }
+  return t[num - 1].correction;
+}
+
+static float corrected(uint8_t fru, uint8_t id, float cond, float reading)
+{
+  assert(sensor_correction_apply(fru, id, cond, &reading) == 0);
+  return reading;
+}
+
+static void load(bool interpolate)
+{
+  char path[] = "/tmp/sensor-correction-test-XXXXXX";
+  int fd = mkstemp(path);
+  FILE *fp;
+
+  assert(fd >= 0);
+  fp = fdopen(fd, "w");
+  fprintf(fp, config_fmt, interpolate ? "\"interpolate\": true," : "");
+  fclose(fp);
+  assert(sensor_correction_init(path) == 0);
+  unlink(path);
+}
+
+static void check_tables(bool interpolate)
+{
+  float cond;
+
+  set_cond("SS_D");
+  for (cond = 0; cond <= 50; cond += 0.25) {
+    float want = interpolate ? interp_reference(table_i0, 8, cond) :
+                               step_reference(table_i0, 8, cond);
+    assert(fabsf(corrected(MB_FRU, INLET_ID, cond, 50) - (50 - want)) < 1e-4);
+  }
+  /* I1 is listed out of order in the config */
+  set_cond("DS_D");
+  for (cond = 0; cond <= 50; cond += 0.25) {
+    float want = interpolate ? interp_reference(table_i1, 4, cond) :
+                               step_reference(table_i1, 4, cond);
+    assert(fabsf(corrected(MB_FRU, INLET_ID, cond, 50) - (50 - want)) < 1e-4);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  /*
+   * step mode: the same corrections as the linear walk
+   */
+  load(false);
+  check_tables(false);
+  set_cond("SS_D");
+  assert(corrected(MB_FRU, INLET_ID, 13, 30) == 30 - 6);
+  assert(corrected(MB_FRU, INLET_ID, 14, 30) == 30 - 5);
+
+  /* sensors without correction, or on other FRUs, are left alone */
+  assert(corrected(MB_FRU, 1, 13, 30) == 30);
+  assert(corrected(2, INLET_ID, 13, 30) == 30);
+  assert(corrected(255, 255, 13, 30) == 30);
+  /* a second entry for the same sensor does not shadow the first */
+  assert(corrected(MB_FRU, OUTLET_ID, 13, 30) == 30 - 1.5);
+  assert(corrected(MB_FRU, INLET_ID, 50, 30) == 30);
+
+  /*
+   * interpolation between the points, flat beyond them
+   */
+  load(true);
+  check_tables(true);
+  set_cond("SS_D");
+  assert(corrected(MB_FRU, INLET_ID, 13, 30) == 30 - 5.5);
+  assert(corrected(MB_FRU, INLET_ID, 5, 30) == 30 - 7);
+  assert(corrected(MB_FRU, INLET_ID, 45, 30) == 30);
+  assert(corrected(MB_FRU, INLET_ID, 36.5, 30) == 30 - 0.5);
+
+  /*
+   * the condition key is read once per change, not once per sample
+   */
+  key_reads = 0;
+  for (i = 0; i < 1000; i++) {
+    corrected(MB_FRU, INLET_ID, 20, 30);
+  }
+  assert(key_reads == 0);
+  generation++;
+  corrected(MB_FRU, INLET_ID, 20, 30);
+  corrected(MB_FRU, INLET_ID, 20, 30);
+  assert(key_reads == 1);
+
+  set_cond("DS_D");
+  assert(corrected(MB_FRU, INLET_ID, 10, 30) == 30 - 9);
+  /* unknown values and missing keys use the default table */
+  set_cond("XX_X");
+  assert(corrected(MB_FRU, INLET_ID, 10, 30) == 30 - 7);
+  set_cond("DS_D");
+  cond_present = false;
+  assert(corrected(MB_FRU, INLET_ID, 10, 30) == 30 - 7);
+  cond_present = true;
+  generation++;
+  assert(corrected(MB_FRU, INLET_ID, 10, 30) == 30 - 9);
+
+  /* without the generation counter every sample reads the key again */
+  gen_available = false;
+  key_reads = 0;
+  for (i = 0; i < 10; i++) {
+    corrected(MB_FRU, INLET_ID, 20, 30);
+  }
+  assert(key_reads == 10);
+  gen_available = true;
+  key_reads = 0;
+  corrected(MB_FRU, INLET_ID, 20, 30);
+  corrected(MB_FRU, INLET_ID, 20, 30);
+  assert(key_reads == 1);
+
+  /* broken configs are refused */
+  assert(sensor_correction_init("/nonexistent.json") == -1);
+
+  printf("All tests passed\n");
+  return 0;
+}
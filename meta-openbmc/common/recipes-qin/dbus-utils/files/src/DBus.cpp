@@ -178,6 +178,36 @@ void DBus::unregisterObject(const std::string &path) {
   objectMap_.erase(path);
 }
 
+bool DBus::emitSignal(const std::string &path,
+                      const std::string &interfaceName,
+                      const std::string &signalName,
+                      GVariant*         parameters) {
+  GError* error = nullptr;
+  std::lock_guard<std::mutex> lock(m_);
+  if (connection_ == nullptr) {
+    LOG(WARNING) << "Signal " << signalName << " from " << path
+      << " dropped: DBus not connected";
+    if (parameters != nullptr) {
+      g_variant_unref(g_variant_ref_sink(parameters));
+    }
+    return false;
+  }
+
+  if (!g_dbus_connection_emit_signal(connection_,
+                                     nullptr, // broadcast
+                                     path.c_str(),
+                                     interfaceName.c_str(),
+                                     signalName.c_str(),
+                                     parameters,
+                                     &error)) {
+    LOG(ERROR) << "Signal " << signalName << " from " << path
+      << " failed: " << error->message;
+    g_error_free(error);
+    return false;
+  }
+  return true;
+}
+
 void DBus::registerObjectInterface(DBusObject              &object,
                                    DBusInterfaceBase &interface,
                                    void*                   userData) {
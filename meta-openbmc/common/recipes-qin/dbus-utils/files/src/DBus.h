@@ -213,6 +213,21 @@ class DBus : public Ipc {
      */
     void unregisterObject(const std::string &path) override;
 
+    /**
+     * Broadcast a signal from the object at path. Signals emitted
+     * while the DBus is not connected are dropped.
+     *
+     * @param path of the object emitting the signal
+     * @param interfaceName the signal belongs to
+     * @param signalName as declared in the interface xml
+     * @param parameters of the signal; a floating reference is consumed
+     * @return true if the signal was sent; false otherwise
+     */
+    bool emitSignal(const std::string &path,
+                    const std::string &interfaceName,
+                    const std::string &signalName,
+                    GVariant*         parameters);
+
   private:
     DBusObject* getMutableDBusObject(const std::string &path) const {
       DBusObjectMap::const_iterator it;
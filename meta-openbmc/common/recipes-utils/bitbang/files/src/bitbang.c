@@ -25,7 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -37,15 +39,106 @@
 #define BITBANG_FREQ_DEFAULT (1 * 1000 * 1000) /* 1M Hz */
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* AST GPIO controller, data register of each 32-pin group */
+#define AST_GPIO_BASE 0x1e780000
+#define AST_GPIO_MAP_SIZE 4096
+static const uint16_t ast_gpio_data_offset[] = {
+  0x000,                        /* A - D */
+  0x020,                        /* E - H */
+  0x070,                        /* I - L */
+  0x078,                        /* M - P */
+  0x080,                        /* Q - T */
+  0x088,                        /* U - X */
+  0x1e0,                        /* Y - AB */
+  0x1e8,                        /* AC - AF */
+};
 
 struct bitbang_handle {
   bitbang_init_st bbh_init;
   uint32_t bbh_half_clk;           /* ns per clock cycle */
+  uint32_t bbh_half_loops;         /* spin loops per half clock */
 };
 
+/*
+ * The threshold (ns) to use spin instead of nanosleep().
+ * Before adding the high resolution timer support, either spin or nanosleep()
+ * will not bring the process wakeup within 10ms. It turns out the system time
+ * update is also controlled by HZ (100).
+ * After I added the high resolution timer support, the spin works as the
+ * system time is updated more frequently. However, nanosleep() solution is
+ * still noticeable slower comparing with spin. There could be some kernel
+ * scheduling tweak missing. Did not get time on that yet.
+ * For now, use 10ms as the threshold to determine if spin or nanosleep()
+ * is used.
+ */
+#define BITBANG_SPIN_THRESHOLD (10 * 1000 * 1000)
+
+/* Minimum duration (ns) of one spin loop calibration run */
+#define BITBANG_CALIBRATE_NS (2 * 1000 * 1000)
+#define BITBANG_CALIBRATE_RUNS 3
+
+/* spin loops per millisecond, calibrated once per process */
+static uint32_t g_loops_per_ms;
+
+static void __attribute__((noinline)) spin_loops(uint32_t loops)
+{
+  volatile uint32_t n = loops;
+
+  while (n) {
+    n--;
+  }
+}
+
+static uint64_t elapsed_ns(const struct timespec *start,
+                           const struct timespec *end)
+{
+  return (uint64_t)(end->tv_sec - start->tv_sec) * NANOSEC_IN_SEC
+    + end->tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Reading the clock on every edge costs more than a fast edge itself, so
+ * time the spin loop once and busy-wait by loop count afterwards. Keep the
+ * fastest of a few runs so that being preempted while calibrating does not
+ * stretch the clock.
+ */
+static void spin_calibrate(void)
+{
+  struct timespec start, end;
+  uint64_t ns, best = 0;
+  uint32_t loops = 1024;
+  int i;
+
+  if (g_loops_per_ms) {
+    return;
+  }
+
+  for (i = 0; i < BITBANG_CALIBRATE_RUNS; i++) {
+    for (;;) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      spin_loops(loops);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      ns = elapsed_ns(&start, &end);
+      if (ns >= BITBANG_CALIBRATE_NS || loops >= (1U << 30)) {
+        break;
+      }
+      loops <<= 1;
+    }
+    if (!best || ns < best) {
+      best = ns;
+    }
+  }
+
+  g_loops_per_ms = MAX((uint64_t)loops * 1000 * 1000 / MAX(best, 1), 1);
+  LOG_DBG("Calibrated %u spin loops per ms", g_loops_per_ms);
+}
+
 void bitbang_init_default(bitbang_init_st *init)
 {
-  memset(init, sizeof(*init), 0);
+  memset(init, 0, sizeof(*init));
   init->bbi_clk_start = BITBANG_PIN_HIGH;
   init->bbi_data_out = BITBANG_CLK_EDGE_FALLING;
   init->bbi_data_in = BITBANG_CLK_EDGE_RISING;
@@ -56,12 +149,17 @@ bitbang_handle_st* bitbang_open(const bitbang_init_st *init)
 {
   bitbang_handle_st *hdl;
 
-  if (!init || !init->bbi_pin_f
+  if (!init || (!init->bbi_pin_f && !init->bbi_mmio)
       || !init->bbi_freq || init->bbi_freq > BITBANG_FREQ_MAX) {
     LOG_ERR(EINVAL, "Invalid init structure");
     return NULL;
   }
 
+  if (init->bbi_mmio && !init->bbi_mmio->bbm_clk.bbp_reg) {
+    LOG_ERR(EINVAL, "Invalid mmio pins");
+    return NULL;
+  }
+
   hdl = calloc(1, sizeof(*hdl));
   if (!hdl) {
     return NULL;
@@ -69,15 +167,21 @@ bitbang_handle_st* bitbang_open(const bitbang_init_st *init)
 
   hdl->bbh_init = *init;
   hdl->bbh_half_clk = NANOSEC_IN_SEC / init->bbi_freq / 2;
+  if (hdl->bbh_half_clk <= BITBANG_SPIN_THRESHOLD) {
+    spin_calibrate();
+    hdl->bbh_half_loops =
+      (uint64_t)hdl->bbh_half_clk * g_loops_per_ms / (1000 * 1000);
+  }
 
   LOG_DBG("Bitbang open with initial %s, data out at %s, data in at %s, "
-          "freq at %uHz, half clk %uns",
+          "freq at %uHz, half clk %uns, %u loops, %s",
           (init->bbi_clk_start == BITBANG_PIN_LOW) ? "LOW" : "HIGH",
           (init->bbi_data_out == BITBANG_CLK_EDGE_RISING)
           ? "RISING" : "FALLING",
           (init->bbi_data_in == BITBANG_CLK_EDGE_RISING)
           ? "RISING" : "FALLING",
-          init->bbi_freq, hdl->bbh_half_clk);
+          init->bbi_freq, hdl->bbh_half_clk, hdl->bbh_half_loops,
+          (init->bbi_mmio) ? "mmio" : "callback");
 
   return hdl;
 }
@@ -87,49 +191,88 @@ void bitbang_close(bitbang_handle_st *hdl)
   free(hdl);
 }
 
-/*
- * The threshold (ns) to use spin instead of nanosleep().
- * Before adding the high resolution timer support, either spin or nanosleep()
- * will not bring the process wakeup within 10ms. It turns out the system time
- * update is also controlled by HZ (100).
- * After I added the high resolution timer support, the spin works as the
- * system time is updated more frequently. However, nanosleep() solution is
- * still noticeable slower comparing with spin. There could be some kernel
- * scheduling tweak missing. Did not get time on that yet.
- * For now, use 10ms as the threshold to determine if spin or nanosleep()
- * is used.
- */
-#define BITBANG_SPIN_THRESHOLD (10 * 1000 * 1000)
+static int mmio_pin_init(const bitbang_mmio_st *mmio,
+                         bitbang_mmio_pin_st *pin, int gpio)
+{
+  int group = gpio / 32;
+
+  if (gpio < 0) {
+    pin->bbp_reg = NULL;
+    pin->bbp_mask = 0;
+    return 0;
+  }
+
+  if (group >= ARRAY_SIZE(ast_gpio_data_offset)) {
+    LOG_ERR(EINVAL, "GPIO %d has no data register", gpio);
+    return EINVAL;
+  }
+
+  pin->bbp_reg = (volatile uint32_t *)
+    ((uint8_t *)mmio->bbm_base + ast_gpio_data_offset[group]);
+  pin->bbp_mask = 1U << (gpio % 32);
+  return 0;
+}
+
+int bitbang_mmio_open(bitbang_mmio_st *mmio, int clk, int out, int in)
+{
+  int rc;
+
+  memset(mmio, 0, sizeof(*mmio));
+  if (clk < 0) {
+    rc = EINVAL;
+    LOG_ERR(rc, "The clock pin is mandatory");
+    return -rc;
+  }
+
+  mmio->bbm_fd = open("/dev/mem", O_RDWR | O_SYNC);
+  if (mmio->bbm_fd < 0) {
+    rc = errno;
+    LOG_ERR(rc, "Failed to open /dev/mem");
+    return -rc;
+  }
+
+  mmio->bbm_base = mmap(NULL, AST_GPIO_MAP_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, mmio->bbm_fd, AST_GPIO_BASE);
+  if (mmio->bbm_base == MAP_FAILED) {
+    rc = errno;
+    LOG_ERR(rc, "Failed to map GPIO registers");
+    close(mmio->bbm_fd);
+    mmio->bbm_base = NULL;
+    mmio->bbm_fd = -1;
+    return -rc;
+  }
+
+  if ((rc = mmio_pin_init(mmio, &mmio->bbm_clk, clk))
+      || (rc = mmio_pin_init(mmio, &mmio->bbm_out, out))
+      || (rc = mmio_pin_init(mmio, &mmio->bbm_in, in))) {
+    bitbang_mmio_close(mmio);
+    return -rc;
+  }
+
+  return 0;
+}
+
+void bitbang_mmio_close(bitbang_mmio_st *mmio)
+{
+  if (mmio->bbm_base) {
+    munmap(mmio->bbm_base, AST_GPIO_MAP_SIZE);
+    mmio->bbm_base = NULL;
+  }
+  if (mmio->bbm_fd >= 0) {
+    close(mmio->bbm_fd);
+    mmio->bbm_fd = -1;
+  }
+}
 
 static int sleep_ns(uint32_t clk)
 {
   struct timespec req, rem;
-  int rc = 0;
-  if (clk <= BITBANG_SPIN_THRESHOLD) {
-    struct timespec orig;
-    rc = clock_gettime(CLOCK_MONOTONIC, &req);
-    orig = req;
-    while (!rc && clk) {
-      uint32_t tmp;
-      rc = clock_gettime(CLOCK_MONOTONIC, &rem);
-      tmp = (rem.tv_sec - req.tv_sec) * NANOSEC_IN_SEC;
-      if (rem.tv_nsec >= req.tv_nsec) {
-        tmp += rem.tv_nsec - req.tv_nsec;
-      } else {
-        tmp -= req.tv_nsec - rem.tv_nsec;
-      }
-      if (tmp >= clk) {
-        break;
-      }
-      clk -= tmp;
-      req = rem;
-    }
-  } else {
-    req.tv_sec = 0;
-    req.tv_nsec = clk;
-    while ((rc = nanosleep(&req, &rem)) == -1 && errno == EINTR) {
-      req = rem;
-    }
+  int rc;
+
+  req.tv_sec = clk / NANOSEC_IN_SEC;
+  req.tv_nsec = clk % NANOSEC_IN_SEC;
+  while ((rc = nanosleep(&req, &rem)) == -1 && errno == EINTR) {
+    req = rem;
   }
   if (rc == -1) {
     rc = errno;
@@ -138,10 +281,116 @@ static int sleep_ns(uint32_t clk)
   return rc;
 }
 
+static inline int half_clk_wait(const bitbang_handle_st *hdl)
+{
+  if (hdl->bbh_half_clk > BITBANG_SPIN_THRESHOLD) {
+    return sleep_ns(hdl->bbh_half_clk);
+  }
+  spin_loops(hdl->bbh_half_loops);
+  return 0;
+}
+
+static inline void mmio_write(const bitbang_mmio_pin_st *pin,
+                              uint32_t *shadow, int high)
+{
+  if (high) {
+    *shadow |= pin->bbp_mask;
+  } else {
+    *shadow &= ~pin->bbp_mask;
+  }
+  *pin->bbp_reg = *shadow;
+}
+
+/*
+ * Same waveform as the callback loop in bitbang_io(), but it touches the
+ * data registers directly and shifts up to 32 bits per word. Output writes
+ * go through a shadow of the data register that is sampled once per call,
+ * as reading back the register returns pin state, not the output latch.
+ */
+static int bitbang_io_mmio(const bitbang_handle_st *hdl, bitbang_io_st *io,
+                           int out_half, int in_half)
+{
+  const bitbang_mmio_st *mmio = hdl->bbh_init.bbi_mmio;
+  const bitbang_mmio_pin_st *clk = &mmio->bbm_clk;
+  const bitbang_mmio_pin_st *out = &mmio->bbm_out;
+  const bitbang_mmio_pin_st *in = &mmio->bbm_in;
+  uint32_t n_bits = MAX(io->bbio_in_bits, io->bbio_out_bits);
+  uint32_t out_bytes = (io->bbio_out_bits + 7) / 8;
+  uint32_t in_bytes = (io->bbio_in_bits + 7) / 8;
+  uint32_t clk_shadow, out_shadow;
+  uint32_t *out_sh = &out_shadow;
+  int clk_level = (hdl->bbh_init.bbi_clk_start == BITBANG_PIN_HIGH);
+  uint32_t bit, i, n, idx;
+  int rc;
+
+  if ((io->bbio_out_bits && !out->bbp_reg)
+      || (io->bbio_in_bits && !in->bbp_reg)) {
+    rc = EINVAL;
+    LOG_ERR(rc, "Data pin is not mapped");
+    return rc;
+  }
+
+  clk_shadow = *clk->bbp_reg;
+  if (out->bbp_reg == clk->bbp_reg) {
+    out_sh = &clk_shadow;
+  } else if (out->bbp_reg) {
+    out_shadow = *out->bbp_reg;
+  }
+
+  /* set the CLK pin start position */
+  mmio_write(clk, &clk_shadow, clk_level);
+
+  for (bit = 0; bit < n_bits; bit += 32) {
+    uint32_t dword = 0;
+    uint32_t iword = 0;
+
+    n = MIN(32, n_bits - bit);
+    idx = bit / 8;
+
+    /* load the next (up to) 4 bytes to shift out, MSB first */
+    for (i = 0; i < 4 && idx + i < out_bytes; i++) {
+      dword |= (uint32_t)io->bbio_dout[idx + i] << (24 - 8 * i);
+    }
+
+    for (i = 0; i < n; i++, dword <<= 1) {
+      /* first half clock */
+      if ((rc = half_clk_wait(hdl))) {
+        return rc;
+      }
+      if (out_half == 0 && bit + i < io->bbio_out_bits) {
+        mmio_write(out, out_sh, dword >> 31);
+      }
+      if (in_half == 0 && bit + i < io->bbio_in_bits) {
+        iword |= ((*in->bbp_reg & in->bbp_mask) ? 1U : 0) << (31 - i);
+      }
+      clk_level = !clk_level;
+      mmio_write(clk, &clk_shadow, clk_level);
+
+      /* second half clock */
+      if ((rc = half_clk_wait(hdl))) {
+        return rc;
+      }
+      if (out_half == 1 && bit + i < io->bbio_out_bits) {
+        mmio_write(out, out_sh, dword >> 31);
+      }
+      if (in_half == 1 && bit + i < io->bbio_in_bits) {
+        iword |= ((*in->bbp_reg & in->bbp_mask) ? 1U : 0) << (31 - i);
+      }
+      clk_level = !clk_level;
+      mmio_write(clk, &clk_shadow, clk_level);
+    }
+
+    for (i = 0; i < 4 && idx + i < in_bytes; i++) {
+      io->bbio_din[idx + i] = (iword >> (24 - 8 * i)) & 0xFF;
+    }
+  }
+
+  return 0;
+}
+
 int bitbang_io(const bitbang_handle_st *hdl, bitbang_io_st *io)
 {
   int rc = 0;
-  uint32_t clk = hdl->bbh_half_clk;
   const struct {
     bitbang_pin_value_en value;
     bitbang_clk_edge_en edge;
@@ -184,16 +433,25 @@ int bitbang_io(const bitbang_handle_st *hdl, bitbang_io_st *io)
     clk_idx = 1;
   }
 
-  /* set the CLK pin start position */
-  pin_f(BITBANG_CLK_PIN, clks[clk_idx].value, context);
-
   /* clear the first byte of din */
   if (din && io->bbio_in_bits) {
     memset(din, 0, (io->bbio_in_bits + 7) / 8);
   }
 
+  if (hdl->bbh_init.bbi_mmio) {
+    /* which of the two half clocks of a bit drives and samples data */
+    rc = bitbang_io_mmio(
+        hdl, io,
+        (hdl->bbh_init.bbi_data_out == clks[clk_idx].edge) ? 0 : 1,
+        (hdl->bbh_init.bbi_data_in == clks[clk_idx].edge) ? 0 : 1);
+    goto out;
+  }
+
+  /* set the CLK pin start position */
+  pin_f(BITBANG_CLK_PIN, clks[clk_idx].value, context);
+
   do {
-    if ((rc = sleep_ns(clk))) {
+    if ((rc = half_clk_wait(hdl))) {
       goto out;
     }
 
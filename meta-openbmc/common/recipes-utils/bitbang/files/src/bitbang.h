@@ -39,6 +39,29 @@ typedef enum {
 typedef bitbang_pin_value_en  (* bitbang_pin_func)(
     bitbang_pin_type_en pin, bitbang_pin_value_en value, void *context);
 
+/*
+ * Memory-mapped GPIO pins. When bbi_mmio is provided, bitbang_io() drives
+ * the AST GPIO data registers directly through /dev/mem instead of calling
+ * bbi_pin_f for every edge. The pin directions still have to be set up by
+ * the caller, i.e. through gpio_change_direction().
+ */
+typedef struct {
+  volatile uint32_t *bbp_reg;
+  uint32_t bbp_mask;
+} bitbang_mmio_pin_st;
+
+typedef struct {
+  bitbang_mmio_pin_st bbm_clk;
+  bitbang_mmio_pin_st bbm_out;
+  bitbang_mmio_pin_st bbm_in;
+  void *bbm_base;
+  int bbm_fd;
+} bitbang_mmio_st;
+
+/* pass -1 for a data pin that is not used */
+int bitbang_mmio_open(bitbang_mmio_st *mmio, int clk, int out, int in);
+void bitbang_mmio_close(bitbang_mmio_st *mmio);
+
 typedef struct {
   bitbang_pin_value_en bbi_clk_start;
   bitbang_clk_edge_en bbi_data_out;
@@ -46,6 +69,7 @@ typedef struct {
   uint32_t bbi_freq;
   bitbang_pin_func bbi_pin_f;
   void *bbi_context;
+  const bitbang_mmio_st *bbi_mmio;
 } bitbang_init_st;
 
 typedef struct bitbang_handle bitbang_handle_st;
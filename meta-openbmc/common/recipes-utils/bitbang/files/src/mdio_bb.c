@@ -49,9 +49,10 @@ void usage()
           "Usage:\n"
           "mdio-bb: -c <GPIO for MDC> [-C <HIGH|low>]\n"
           "         -d <GPIO for MDIO> [-O <rising|FALLING>]\n"
-          "         [-I <RISING|falling>] [-p] [-b]\n"
+          "         [-I <RISING|falling>] [-p] [-b] [-m]\n"
           "         <read|write> <phy address> <register address>\n"
-          "         [value to write]\n");
+          "         [value to write]\n"
+          "Note: '-m' drives the GPIO registers directly through /dev/mem.\n");
 }
 
 bitbang_pin_value_en mdio_pin_f(
@@ -102,8 +103,10 @@ int main(int argc, char* const argv[])
   int rc = 0;
   int preamble = 0;
   int binary = 0;
+  int use_mmio = 0;
+  bitbang_mmio_st mmio;
 
-  while ((opt = getopt(argc, argv, "bc:C:d:D:p")) != -1) {
+  while ((opt = getopt(argc, argv, "bc:C:d:D:mp")) != -1) {
     switch (opt) {
     case 'b':
       binary = 1;
@@ -144,6 +147,9 @@ int main(int argc, char* const argv[])
         exit(-1);
       }
       break;
+    case 'm':
+      use_mmio = 1;
+      break;
     case 'p':
       preamble = 1;
       break;
@@ -217,7 +223,9 @@ int main(int argc, char* const argv[])
   }
 
   /* open all gpio */
-  memset(&ctx, sizeof(ctx), 0);
+  memset(&ctx, 0, sizeof(ctx));
+  memset(&mmio, 0, sizeof(mmio));
+  mmio.bbm_fd = -1;
   gpio_init_default(&ctx.m_mdc);
   gpio_init_default(&ctx.m_mdio);
   if (gpio_open(&ctx.m_mdc, mdc) || gpio_open(&ctx.m_mdio, mdio)) {
@@ -229,6 +237,11 @@ int main(int argc, char* const argv[])
     goto out;
   }
 
+  /* MDIO is bidirectional, same pin for data out and data in */
+  if (use_mmio && bitbang_mmio_open(&mmio, mdc, mdio, mdio)) {
+    goto out;
+  }
+
   bitbang_init_default(&init);
   init.bbi_clk_start = mdc_start;
   init.bbi_data_out = out_edge;
@@ -236,6 +249,9 @@ int main(int argc, char* const argv[])
   init.bbi_freq = 1000 * 1000;   /* 1M Hz */
   init.bbi_pin_f = mdio_pin_f;
   init.bbi_context = &ctx;
+  if (use_mmio) {
+    init.bbi_mmio = &mmio;
+  }
   hdl = bitbang_open(&init);
   if (!hdl) {
     goto out;
@@ -283,7 +299,7 @@ int main(int argc, char* const argv[])
     n_bits += 2 + 2 + 5 + 5;
   }
 
-  memset(&io, sizeof(io), 0);
+  memset(&io, 0, sizeof(io));
   io.bbio_out_bits = n_bits;
   io.bbio_dout = buf;
   io.bbio_in_bits = 0;
@@ -299,7 +315,7 @@ int main(int argc, char* const argv[])
     /* first, change the MDIO to input */
     gpio_change_direction(&ctx.m_mdio, GPIO_DIRECTION_IN);
     /* then, run the clock for read */
-    memset(&io, sizeof(io), 0);
+    memset(&io, 0, sizeof(io));
     io.bbio_out_bits = 0;
     io.bbio_dout = NULL;;
     io.bbio_in_bits = 18;
@@ -328,6 +344,9 @@ int main(int argc, char* const argv[])
   if (hdl) {
     bitbang_close(hdl);
   }
+  if (use_mmio) {
+    bitbang_mmio_close(&mmio);
+  }
   gpio_close(&ctx.m_mdc);
   gpio_close(&ctx.m_mdio);
 
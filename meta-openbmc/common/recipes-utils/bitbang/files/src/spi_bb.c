@@ -19,6 +19,7 @@
 //#define VERBOSE
 
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <openbmc/gpio.h>
@@ -34,11 +35,13 @@ void usage()
           "        -c <GPIO for CLK> [-C <HIGH|low>]\n"
           "        -o <GPIO for MOSI> [-O <rising|FALLING>]\n"
           "        -i <GPIO for MISO> [-I <RISING|falling>]\n"
-          "        [-b]\n"
+          "        [-b] [-m] [-f <clock frequency in Hz>] [-B <iterations>]\n"
           "        < [-r <number of bits to read>]\n"
           "          [-w <number of bits to write> <byte 1> [... byte N]>\n\n"
           "Note: If both '-r' and '-w' are provided, 'write' will be performed\n"
-          "      before 'read'.\n");
+          "      before 'read'.\n"
+          "      '-m' drives the GPIO registers directly through /dev/mem.\n"
+          "      '-B' repeats the transfer and reports the achieved bit rate.\n");
 }
 
 typedef struct {
@@ -99,18 +102,43 @@ int main(int argc, char * const argv[])
   bitbang_io_st io;
   int rc = 0;
   int binary = 0;
+  int use_mmio = 0;
+  bitbang_mmio_st mmio;
+  uint32_t freq = 1000 * 1000;   /* 1M Hz */
+  int bench = 0;
+  struct timespec start, end;
+  double elapsed;
 
-  memset(&ctx, sizeof(ctx), 0);
+  memset(&ctx, 0, sizeof(ctx));
+  memset(&mmio, 0, sizeof(mmio));
+  mmio.bbm_fd = -1;
   gpio_init_default(&ctx.sc_clk);
   gpio_init_default(&ctx.sc_mosi);
   gpio_init_default(&ctx.sc_miso);
   gpio_init_default(&cs_gpio);
 
-  while ((opt = getopt(argc, argv, "bs:S:c:C:o:O:i:I:w:r:")) != -1) {
+  while ((opt = getopt(argc, argv, "bmf:B:s:S:c:C:o:O:i:I:w:r:")) != -1) {
     switch (opt) {
     case 'b':
       binary = 1;
       break;
+    case 'm':
+      use_mmio = 1;
+      break;
+    case 'f':
+      freq = strtoul(optarg, NULL, 0);
+      if (freq == 0) {
+        usage();
+        exit(-1);
+      }
+      break;
+    case 'B':
+      bench = atoi(optarg);
+      if (bench <= 0) {
+        usage();
+        exit(-1);
+      }
+      break;
     case 's':
       cs = atoi(optarg);
       break;
@@ -243,13 +271,22 @@ int main(int argc, char * const argv[])
     }
   }
 
+  if (use_mmio) {
+    if (bitbang_mmio_open(&mmio, clk, out, in)) {
+      goto out;
+    }
+  }
+
   bitbang_init_default(&init);
   init.bbi_clk_start = clk_start;
   init.bbi_data_out = dout_edge;
   init.bbi_data_in = din_edge;
-  init.bbi_freq = 1000 * 1000;   /* 1M Hz */
+  init.bbi_freq = freq;
   init.bbi_pin_f = spi_pin_f;
   init.bbi_context = &ctx;
+  if (use_mmio) {
+    init.bbi_mmio = &mmio;
+  }
 
   hdl = bitbang_open(&init);
   if (!hdl) {
@@ -262,12 +299,30 @@ int main(int argc, char * const argv[])
                           ? GPIO_VALUE_HIGH : GPIO_VALUE_LOW));
   }
 
-  memset(&io, sizeof(io), 0);
+  memset(&io, 0, sizeof(io));
   io.bbio_in_bits = read_bits;
   io.bbio_din = read_buf;
   io.bbio_out_bits = write_bits;
   io.bbio_dout = write_buf;
 
+  if (bench) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < bench; i++) {
+      rc = bitbang_io(hdl, &io);
+      if (rc != 0) {
+        goto out;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec)
+      + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d x %d bits in %.6f seconds: %.0f bit/s (clock %u Hz, %s)\n",
+           bench, (read_bits > write_bits) ? read_bits : write_bits, elapsed,
+           (double)bench * ((read_bits > write_bits) ? read_bits : write_bits)
+           / elapsed, freq, (use_mmio) ? "mmio" : "sysfs");
+    goto out;
+  }
+
   rc = bitbang_io(hdl, &io);
   if (rc != 0) {
     goto out;
@@ -297,6 +352,9 @@ int main(int argc, char * const argv[])
   if (hdl) {
     bitbang_close(hdl);
   }
+  if (use_mmio) {
+    bitbang_mmio_close(&mmio);
+  }
   gpio_close(&ctx.sc_clk);
   gpio_close(&ctx.sc_miso);
   gpio_close(&ctx.sc_mosi);
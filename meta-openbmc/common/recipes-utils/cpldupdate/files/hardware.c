@@ -16,15 +16,20 @@
  *             Modified the ispVMDelay function
  *             Removed Delay Percent support
  *             Moved the sclock() function from ivm_core.c to hardware.c
+ *             Added jtag_shift_vector() with per-transport shift backends
+ *             and a simulated TAP. calibration() now measures the delay
+ *             loop and the TCK rate of the selected backend.
  *********************************************************************************/
 #include "vmopcode.h"
 #include <sys/io.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
 #if defined(GALAXY100_PRJ)
-#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -45,6 +50,7 @@
 #ifdef GALAXY100_PRJ
 int syscpld_update = 1;
 int use_dll = 0;
+int use_sim = 0;
 const char *dll_name = NULL;
 static struct cpldupdate_helper_st dll_helper;
 static volatile unsigned int *gpio_base;
@@ -56,12 +62,16 @@ unsigned long  g_siIspPins        = 0x00000000;   /*Keeper of JTAG pin state*/
 unsigned short g_usInPort         = PCA953X_INPUT;  /*Address of the TDO pin*/
 unsigned short g_usOutPort	  = PCA953X_OUTPUT;  /*Address of TDI, TMS, TCK pin*/
 unsigned short g_usCpu_Frequency  = 4000; // Here is Intel rangely CPU frequence   /*Enter your CPU frequency here, unit in MHz.*/
+static int i2c_fd = -1;
 #else
 unsigned long  g_siIspPins        = 0x00000000;   /*Keeper of JTAG pin state*/
 unsigned short g_usInPort         = 0x548;  /*Address of the TDO pin*/
 unsigned short g_usOutPort	  = 0x548;  /*Address of TDI, TMS, TCK pin*/
 unsigned short g_usCpu_Frequency  = 4000; // Here is Intel rangely CPU frequence   /*Enter your CPU frequency here, unit in MHz.*/
 #endif
+unsigned char g_ucCpu_FrequencySet = 0;   /*Set when -f overrides the calibrated frequency*/
+unsigned long g_ulTCKCount        = 0;   /*TCK pulses applied, for throughput statistics*/
+unsigned long g_ulDelayUs         = 0;   /*Delay requested by the VME file, in microseconds*/
 
 /*********************************************************************************
 * This is the definition of the bit locations of each respective
@@ -99,7 +109,12 @@ unsigned char readPort();
 void sclock();
 void ispVMDelay( unsigned short a_usTimeDelay );
 void calibration(void);
+int jtag_shift_vector( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                       unsigned char *tdo_bits, unsigned int nbits );
+int jtag_tdo_valid(void);
 #ifdef GALAXY100_PRJ
+static void jtag_sim_write(unsigned long old_pins, unsigned long new_pins);
+static unsigned char jtag_sim_tdo(void);
 static void isp_dll_write(unsigned long pins, int value);
 static int isp_dll_read(cpldupdate_pin_en pin);
 static int isp_i2c_read(int bus, int addr, unsigned char reg);
@@ -145,6 +160,10 @@ static void isp_gpio_unmap(void *addr, int fd);
 
 void writePort( unsigned long a_ucPins, unsigned char a_ucValue )
 {
+#ifdef GALAXY100_PRJ
+	unsigned long old_pins = g_siIspPins;
+#endif
+
 	if ( a_ucValue ) {
 		g_siIspPins = (a_ucPins | g_siIspPins);
 	}
@@ -152,7 +171,9 @@ void writePort( unsigned long a_ucPins, unsigned char a_ucValue )
 		g_siIspPins = (~a_ucPins & g_siIspPins);
 	}
 #ifdef GALAXY100_PRJ
-	if(syscpld_update) {
+	if(use_sim) {
+		jtag_sim_write(old_pins, g_siIspPins);
+	} else if(syscpld_update) {
 		*gpio_base = g_siIspPins;
 		while((*gpio_base & g_siIspPins) != g_siIspPins);
 	} else if (use_dll) {
@@ -176,7 +197,9 @@ unsigned char readPort()
 	int count = 3;
 
 #ifdef GALAXY100_PRJ
-	if(syscpld_update) {
+	if(use_sim) {
+		ucRet = jtag_sim_tdo();
+	} else if(syscpld_update) {
 		while(count--) {
 			if ((*gpio_base) & g_ucPinTDO) {
 				ucRet = 0x01;
@@ -220,6 +243,7 @@ void sclock()
 	for ( usIdleIndex = 0; usIdleIndex < IdleTime; usIdleIndex++ ) {
 		writePort( g_ucPinTCK, 0x00 );
 	}
+	g_ulTCKCount++;
 }
 /********************************************************************************
 *
@@ -269,35 +293,60 @@ void sclock()
 * Users only need to enter the speed of the cpu.
 *
 **********************************************************************************/
-void ispVMDelay( unsigned short a_usTimeDelay )
+static void ispVMDelayLoop( unsigned long a_ulMicroSeconds )
 {
+	unsigned long  us_index       = 0;
 	unsigned short loop_index     = 0;
-	unsigned short ms_index       = 0;
-	unsigned short us_index       = 0;
+
+	for (us_index = 0; us_index < a_ulMicroSeconds; us_index++)
+	{ /*each loop should delay for 1 microsecond or more.*/
+		loop_index = 0;
+		do {
+			/*The NOP fakes the optimizer out so that it doesn't toss out the loop code entirely*/
+			asm("nop");
+		}while (loop_index++ < ((g_usCpu_Frequency/8)+(+ ((g_usCpu_Frequency % 8) ? 1 : 0))));/*use do loop to force at least one loop*/
+	}
+}
+
+void ispVMDelay( unsigned short a_usTimeDelay )
+{
+	unsigned long ulDelayUs = 0;
+	struct timespec req, rem;
 
 	if ( a_usTimeDelay & 0x8000 ) /*Test for unit*/
 	{
-		a_usTimeDelay &= ~0x8000; /*unit in milliseconds*/
+		ulDelayUs = (unsigned long) ( a_usTimeDelay & ~0x8000 ) * 1000; /*unit in milliseconds*/
 	}
 	else { /*unit in microseconds*/
-		a_usTimeDelay = (unsigned short) (a_usTimeDelay/1000); /*convert to milliseconds*/
-		if ( a_usTimeDelay <= 0 ) {
-			 a_usTimeDelay = 1; /*delay is 1 millisecond minimum*/
-		}
+		ulDelayUs = a_usTimeDelay;
 	}
-	/*Users can replace the following section of code by their own*/
-	for( ms_index = 0; ms_index < a_usTimeDelay; ms_index++)
-	{
-		/*Loop 1000 times to produce the milliseconds delay*/
-		for (us_index = 0; us_index < 1000; us_index++)
-		{ /*each loop should delay for 1 microsecond or more.*/
-			loop_index = 0;
-			do {
-				/*The NOP fakes the optimizer out so that it doesn't toss out the loop code entirely*/
-				asm("nop");
-			}while (loop_index++ < ((g_usCpu_Frequency/8)+(+ ((g_usCpu_Frequency % 8) ? 1 : 0))));/*use do loop to force at least one loop*/
+	g_ulDelayUs += ulDelayUs;
+
+#ifdef GALAXY100_PRJ
+	if ( use_sim ) {
+		return; /*no device to wait for*/
+	}
+#endif
+
+	/*
+	 * Millisecond delays sleep, the scheduler can only make them longer.
+	 * Shorter ones spin on the loop timed by calibration().
+	 */
+	if ( ulDelayUs >= 1000 ) {
+		req.tv_sec = ulDelayUs / 1000000;
+		req.tv_nsec = ( ulDelayUs % 1000000 ) * 1000;
+		while ( nanosleep( &req, &rem ) == -1 && errno == EINTR ) {
+			req = rem;
 		}
 	}
+	else {
+		ispVMDelayLoop( ulDelayUs );
+	}
+}
+
+static unsigned long elapsed_ns( const struct timespec *start, const struct timespec *end )
+{
+	return ( end->tv_sec - start->tv_sec ) * 1000000000UL + end->tv_nsec - start->tv_nsec;
 }
 
 /*********************************************************************************
@@ -311,9 +360,18 @@ void ispVMDelay( unsigned short a_usTimeDelay )
 * and the loop_per_micro value for one micro-second delay of the target
 * specific hardware.
 *
+* The delay loop is timed here, unless the frequency was given with -f,
+* keeping the fastest of a few runs so that a preempted run cannot make
+* the delay short. The TCK rate of the selected backend is reported too.
+*
 **********************************************************************************/
 void calibration(void)
 {
+	struct timespec start, end;
+	unsigned long ns = 0, best = 0;
+	unsigned long long freq;
+	int i;
+
 	/*Apply 2 pulses to TCK.*/
 	writePort( g_ucPinTCK, 0x00 );
 	writePort( g_ucPinTCK, 0x01 );
@@ -329,6 +387,339 @@ void calibration(void)
 	writePort( g_ucPinTCK, 0x00 );
 	writePort( g_ucPinTCK, 0x01 );
 	writePort( g_ucPinTCK, 0x00 );
+
+	if ( !g_ucCpu_FrequencySet ) {
+		for ( i = 0; i < 3; i++ ) {
+			clock_gettime( CLOCK_MONOTONIC, &start );
+			ispVMDelayLoop( 1000 );
+			clock_gettime( CLOCK_MONOTONIC, &end );
+			ns = elapsed_ns( &start, &end );
+			if ( !best || ns < best ) {
+				best = ns;
+			}
+		}
+		/*1000 loop passes should take 1ms, round the frequency up*/
+		freq = ( (unsigned long long) g_usCpu_Frequency * 1000000 + best - 1 ) / ( best ? best : 1 );
+		if ( freq < 8 ) {
+			freq = 8;
+		} else if ( freq > 0xFFFF ) {
+			freq = 0xFFFF;
+		}
+		g_usCpu_Frequency = (unsigned short) freq;
+		printf( "Delay loop calibrated to %d MHZ\n", g_usCpu_Frequency );
+	}
+
+	/*TMS stays low, so the devices only move towards Run-Test/Idle*/
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	jtag_shift_vector( NULL, NULL, NULL, 256 );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	ns = elapsed_ns( &start, &end );
+	printf( "TCK rate: %lu kHz\n", ns ? 256UL * 1000000 / ns : 0 );
+
+	g_ulTCKCount = 0;
+	g_ulDelayUs = 0;
+}
+
+/*********************************************************************************
+*
+* jtag_shift_vector
+*
+* Shift nbits through the JTAG chain. For every bit, TMS and TDI are driven
+* from tms_bits and tdi_bits, TDO is sampled into tdo_bits and TCK is pulsed.
+* The bit vectors are MSB first, like the VME data buffers. A NULL tms_bits or
+* tdi_bits leaves that pin as it is, a NULL tdo_bits skips sampling TDO.
+*
+* The generic backend goes through writePort()/readPort()/sclock() one pin at
+* a time, which is what the DLL (sysfs GPIO) transport uses. The GPIO and I2C
+* transports and the simulated TAP have their own batched loops.
+*
+**********************************************************************************/
+#define JTAG_BIT(v, i)  ( ( (v)[ (i) / 8 ] >> ( 7 - (i) % 8 ) ) & 0x1 )
+#define JTAG_SET_BIT(v, i, b) do {                          \
+	if ( b ) {                                              \
+		(v)[ (i) / 8 ] |= 0x80 >> ( (i) % 8 );              \
+	} else {                                                \
+		(v)[ (i) / 8 ] &= ~( 0x80 >> ( (i) % 8 ) );         \
+	}                                                       \
+} while (0)
+
+static int jtag_shift_generic( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                               unsigned char *tdo_bits, unsigned int nbits )
+{
+	unsigned int i;
+
+	for ( i = 0; i < nbits; i++ ) {
+		if ( tms_bits ) {
+			writePort( g_ucPinTMS, JTAG_BIT( tms_bits, i ) );
+		}
+		if ( tdi_bits ) {
+			writePort( g_ucPinTDI, JTAG_BIT( tdi_bits, i ) );
+		}
+		if ( tdo_bits ) {
+			JTAG_SET_BIT( tdo_bits, i, readPort() );
+		}
+		sclock();
+	}
+
+	return 0;
+}
+
+#ifdef GALAXY100_PRJ
+static inline void jtag_gpio_write( unsigned long pins )
+{
+	*gpio_base = pins;
+	while((*gpio_base & pins) != pins);
+}
+
+/*
+ * Changing TMS/TDI together with the falling TCK edge of the previous bit
+ * halves the register writes; devices sample on the rising edge.
+ */
+static int jtag_shift_gpio( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                            unsigned char *tdo_bits, unsigned int nbits )
+{
+	unsigned long pins = g_siIspPins & ~g_ucPinTCK;
+	unsigned int tdo = 0;
+	unsigned int i;
+	int count;
+
+	for ( i = 0; i < nbits; i++ ) {
+		if ( tms_bits ) {
+			pins = JTAG_BIT( tms_bits, i ) ? ( pins | g_ucPinTMS ) : ( pins & ~g_ucPinTMS );
+		}
+		if ( tdi_bits ) {
+			pins = JTAG_BIT( tdi_bits, i ) ? ( pins | g_ucPinTDI ) : ( pins & ~g_ucPinTDI );
+		}
+		jtag_gpio_write( pins );
+		if ( tdo_bits ) {
+			/*same settling reads as readPort()*/
+			for ( count = 0; count < 3; count++ ) {
+				tdo = *gpio_base & g_ucPinTDO;
+			}
+			JTAG_SET_BIT( tdo_bits, i, tdo ? 1 : 0 );
+		}
+		jtag_gpio_write( pins | g_ucPinTCK );
+	}
+	jtag_gpio_write( pins );
+	g_siIspPins = pins;
+
+	return 0;
+}
+
+/*
+ * Up to I2C_RDRW_IOCTL_MAX_MSGS messages go out in one I2C_RDWR transfer.
+ * Each bit takes an output port write with TCK low (which is also the
+ * falling edge of the previous bit) and one with TCK high, plus an input
+ * port register select and read when TDO is wanted.
+ */
+#define JTAG_I2C_MAX_MSGS 42
+#define JTAG_I2C_MSGS_PER_BIT 4
+
+struct jtag_i2c_batch {
+	struct i2c_msg msgs[ JTAG_I2C_MAX_MSGS ];
+	unsigned char wbuf[ JTAG_I2C_MAX_MSGS ][ 2 ];
+	unsigned char rbuf[ JTAG_I2C_MAX_MSGS ];
+	unsigned int tdo_idx[ JTAG_I2C_MAX_MSGS ];  /*bit index of each read*/
+	int n_msgs;
+	int n_reads;
+};
+
+static void jtag_i2c_add( struct jtag_i2c_batch *batch, unsigned char reg,
+                          int len, unsigned char value, int read )
+{
+	struct i2c_msg *msg = &batch->msgs[ batch->n_msgs ];
+
+	msg->addr = I2C_CPLD_ADDRESS;
+	msg->flags = read ? I2C_M_RD : 0;
+	msg->len = len;
+	if ( read ) {
+		msg->buf = &batch->rbuf[ batch->n_reads ];
+	} else {
+		batch->wbuf[ batch->n_msgs ][ 0 ] = reg;
+		batch->wbuf[ batch->n_msgs ][ 1 ] = value;
+		msg->buf = batch->wbuf[ batch->n_msgs ];
+	}
+	batch->n_msgs++;
+}
+
+static int jtag_i2c_flush( struct jtag_i2c_batch *batch, unsigned char *tdo_bits )
+{
+	struct i2c_rdwr_ioctl_data data;
+	int i;
+
+	if ( !batch->n_msgs ) {
+		return 0;
+	}
+
+	data.msgs = batch->msgs;
+	data.nmsgs = batch->n_msgs;
+	if ( ioctl( i2c_fd, I2C_RDWR, &data ) < 0 ) {
+		printf( "i2c jtag transfer of %d messages error: %s\n",
+		        batch->n_msgs, strerror( errno ) );
+		return -1;
+	}
+
+	for ( i = 0; i < batch->n_reads; i++ ) {
+		JTAG_SET_BIT( tdo_bits, batch->tdo_idx[ i ],
+		              ( batch->rbuf[ i ] & g_ucPinTDO ) ? 1 : 0 );
+	}
+	batch->n_msgs = 0;
+	batch->n_reads = 0;
+
+	return 0;
+}
+
+static int jtag_shift_i2c( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                           unsigned char *tdo_bits, unsigned int nbits )
+{
+	static struct jtag_i2c_batch batch;
+	unsigned long enable = 0x1 << CPLD_I2C_ENABLE_OFFSET;
+	unsigned long pins = g_siIspPins & ~g_ucPinTCK;
+	unsigned int i;
+
+	batch.n_msgs = 0;
+	batch.n_reads = 0;
+
+	for ( i = 0; i < nbits; i++ ) {
+		/*keep room for the final TCK low write*/
+		if ( batch.n_msgs + JTAG_I2C_MSGS_PER_BIT + 1 > JTAG_I2C_MAX_MSGS ) {
+			if ( jtag_i2c_flush( &batch, tdo_bits ) ) {
+				return -1;
+			}
+		}
+		if ( tms_bits ) {
+			pins = JTAG_BIT( tms_bits, i ) ? ( pins | g_ucPinTMS ) : ( pins & ~g_ucPinTMS );
+		}
+		if ( tdi_bits ) {
+			pins = JTAG_BIT( tdi_bits, i ) ? ( pins | g_ucPinTDI ) : ( pins & ~g_ucPinTDI );
+		}
+		jtag_i2c_add( &batch, g_usOutPort, 2, pins | enable, 0 );
+		if ( tdo_bits ) {
+			jtag_i2c_add( &batch, g_usInPort, 1, 0, 0 );
+			batch.tdo_idx[ batch.n_reads ] = i;
+			jtag_i2c_add( &batch, 0, 1, 0, 1 );
+			batch.n_reads++;
+		}
+		jtag_i2c_add( &batch, g_usOutPort, 2, pins | g_ucPinTCK | enable, 0 );
+	}
+	jtag_i2c_add( &batch, g_usOutPort, 2, pins | enable, 0 );
+	g_siIspPins = pins;
+
+	return jtag_i2c_flush( &batch, tdo_bits );
+}
+
+/*
+ * Simulated TAP for benchmarking without hardware: a standard TAP state
+ * machine with a 1-bit register between TDI and TDO in the shift states,
+ * like a single device in BYPASS. TDO compares are meaningless against it,
+ * see jtag_tdo_valid().
+ */
+enum {
+	TAP_RESET, TAP_IDLE, TAP_SELDR, TAP_CAPDR, TAP_SHIFTDR, TAP_EXIT1DR,
+	TAP_PAUSEDR, TAP_EXIT2DR, TAP_UPDDR, TAP_SELIR, TAP_CAPIR, TAP_SHIFTIR,
+	TAP_EXIT1IR, TAP_PAUSEIR, TAP_EXIT2IR, TAP_UPDIR,
+};
+
+/*next state for TMS low and TMS high*/
+static const unsigned char tap_next[ 16 ][ 2 ] = {
+	[TAP_RESET]   = { TAP_IDLE,    TAP_RESET },
+	[TAP_IDLE]    = { TAP_IDLE,    TAP_SELDR },
+	[TAP_SELDR]   = { TAP_CAPDR,   TAP_SELIR },
+	[TAP_CAPDR]   = { TAP_SHIFTDR, TAP_EXIT1DR },
+	[TAP_SHIFTDR] = { TAP_SHIFTDR, TAP_EXIT1DR },
+	[TAP_EXIT1DR] = { TAP_PAUSEDR, TAP_UPDDR },
+	[TAP_PAUSEDR] = { TAP_PAUSEDR, TAP_EXIT2DR },
+	[TAP_EXIT2DR] = { TAP_SHIFTDR, TAP_UPDDR },
+	[TAP_UPDDR]   = { TAP_IDLE,    TAP_SELDR },
+	[TAP_SELIR]   = { TAP_CAPIR,   TAP_RESET },
+	[TAP_CAPIR]   = { TAP_SHIFTIR, TAP_EXIT1IR },
+	[TAP_SHIFTIR] = { TAP_SHIFTIR, TAP_EXIT1IR },
+	[TAP_EXIT1IR] = { TAP_PAUSEIR, TAP_UPDIR },
+	[TAP_PAUSEIR] = { TAP_PAUSEIR, TAP_EXIT2IR },
+	[TAP_EXIT2IR] = { TAP_SHIFTIR, TAP_UPDIR },
+	[TAP_UPDIR]   = { TAP_IDLE,    TAP_SELDR },
+};
+
+static struct {
+	unsigned char state;
+	unsigned char reg;
+} sim_tap = { TAP_RESET, 0 };
+
+static inline void jtag_sim_clock( int tms, int tdi )
+{
+	if ( sim_tap.state == TAP_SHIFTDR || sim_tap.state == TAP_SHIFTIR ) {
+		sim_tap.reg = tdi ? 1 : 0;
+	}
+	sim_tap.state = tap_next[ sim_tap.state ][ tms ? 1 : 0 ];
+}
+
+static unsigned char jtag_sim_tdo(void)
+{
+	return sim_tap.reg;
+}
+
+static void jtag_sim_write( unsigned long old_pins, unsigned long new_pins )
+{
+	if ( !( old_pins & g_ucPinTCK ) && ( new_pins & g_ucPinTCK ) ) {
+		jtag_sim_clock( ( new_pins & g_ucPinTMS ) ? 1 : 0, ( new_pins & g_ucPinTDI ) ? 1 : 0 );
+	}
+}
+
+static int jtag_shift_sim( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                           unsigned char *tdo_bits, unsigned int nbits )
+{
+	int tms = ( g_siIspPins & g_ucPinTMS ) ? 1 : 0;
+	int tdi = ( g_siIspPins & g_ucPinTDI ) ? 1 : 0;
+	unsigned int i;
+
+	for ( i = 0; i < nbits; i++ ) {
+		if ( tms_bits ) {
+			tms = JTAG_BIT( tms_bits, i );
+		}
+		if ( tdi_bits ) {
+			tdi = JTAG_BIT( tdi_bits, i );
+		}
+		if ( tdo_bits ) {
+			JTAG_SET_BIT( tdo_bits, i, sim_tap.reg );
+		}
+		jtag_sim_clock( tms, tdi );
+	}
+	g_siIspPins = ( g_siIspPins & ~( g_ucPinTMS | g_ucPinTDI | g_ucPinTCK ) )
+		| ( tms ? g_ucPinTMS : 0 ) | ( tdi ? g_ucPinTDI : 0 );
+
+	return 0;
+}
+#endif
+
+int jtag_shift_vector( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                       unsigned char *tdo_bits, unsigned int nbits )
+{
+	g_ulTCKCount += nbits;
+#ifdef GALAXY100_PRJ
+	if ( use_sim ) {
+		return jtag_shift_sim( tms_bits, tdi_bits, tdo_bits, nbits );
+	} else if ( syscpld_update ) {
+		return jtag_shift_gpio( tms_bits, tdi_bits, tdo_bits, nbits );
+	} else if ( !use_dll ) {
+		return jtag_shift_i2c( tms_bits, tdi_bits, tdo_bits, nbits );
+	}
+#endif
+	/*sclock() counts its own pulses*/
+	g_ulTCKCount -= nbits;
+	return jtag_shift_generic( tms_bits, tdi_bits, tdo_bits, nbits );
+}
+
+/*
+ * Whether TDO comes from a real device. The simulated TAP only loops TDI
+ * back, so the VME verify steps cannot be checked against it.
+ */
+int jtag_tdo_valid(void)
+{
+#ifdef GALAXY100_PRJ
+	return !use_sim;
+#else
+	return 1;
+#endif
 }
 
 #ifdef GALAXY100_PRJ
@@ -377,12 +768,20 @@ int isp_gpio_i2c_init(void)
 {
 	unsigned char value;
 	int ret;
+	char filename[20];
 
 	g_ucPinTDI          = 0x1 << CPLD_TDI_I2C_CONFIG;    /* Bit address of TDI */
 	g_ucPinTCK          = 0x1 << CPLD_TCK_I2C_CONFIG;    /* Bit address of TCK */
 	g_ucPinTMS          = 0x1 << CPLD_TMS_I2C_CONFIG;    /* Bit address of TMS */
 	g_ucPinTDO          = 0x1 << CPLD_TDO_I2C_CONFIG;    /* Bit address of TDO*/
 
+	/*kept open for the batched transfers of jtag_shift_vector()*/
+	i2c_fd = open_i2c_dev(I2C_CPLD_BUS, filename, sizeof(filename));
+	if(i2c_fd < 0) {
+		printf("open i2c bus %d error!", I2C_CPLD_BUS);
+		return -1;
+	}
+
 	/*CPLD JTAG update enable */
 	isp_gpio_i2c_config(CPLD_I2C_ENABLE_OFFSET, GPIO_OUT);
 	ispVMDelay(0x800b);
@@ -35,12 +35,14 @@
 * Removed Delay Percent support
 * 11/15/07  NN moved the checking of the File CRC to the end of processing
 * 08/28/08 NN Added Calculate checksum support.
+* Added the simulated TAP ("sim") and JTAG throughput statistics.
 ***************************************************************/
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/io.h>
 #include "vmopcode.h"
 
@@ -651,6 +653,33 @@ signed char ispVM( const char * a_pszFilename )
 *
 ***************************************************************/
 
+/***************************************************************
+*
+* ispVMStatistics
+*
+* Report the TCK pulses applied and the resulting clock rate,
+* leaving out the delays requested by the VME file.
+*
+***************************************************************/
+
+static void ispVMStatistics( const struct timespec *start, const struct timespec *end )
+{
+	double elapsed = ( end->tv_sec - start->tv_sec )
+		+ ( end->tv_nsec - start->tv_nsec ) / 1e9;
+	double delay = g_ulDelayUs / 1e6;
+	double active = elapsed - delay;
+
+#if defined(GALAXY100_PRJ)
+	if ( use_sim ) {
+		/* delays are skipped against the simulated TAP */
+		active = elapsed;
+	}
+#endif
+	printf( "JTAG: %lu TCK in %.3f s, %.3f s of delays, %.1f kHz\n",
+	        g_ulTCKCount, elapsed, delay,
+	        ( active > 0 ) ? g_ulTCKCount / active / 1000 : 0.0 );
+}
+
 const char *cpld_img = "cpld.vme";
 #define CPLD_VERSION_REG 0x100
 int main( int argc, const char * const argv[] )
@@ -659,6 +688,7 @@ int main( int argc, const char * const argv[] )
 	short siRetCode                   = 0;
 	short sicalibrate                 = 1;
 	unsigned char set_freq		  = 0;
+	struct timespec start, end;
 	//08/28/08 NN Added Calculate checksum support.
 	g_usChecksum = 0;
 	g_uiChecksumIndex = 0;
@@ -679,6 +709,7 @@ int main( int argc, const char * const argv[] )
 			g_usCpu_Frequency = strtoul(argv[iCommandLineIndex+1],NULL,0);
 			iCommandLineIndex += 2;
 			set_freq = 1;
+			g_ucCpu_FrequencySet = 1;
 			printf("CPU Freq set as %d MHZ\n", g_usCpu_Frequency);
 		}
 		else if ( !strcasecmp( argv[iCommandLineIndex], "syscpld" ) ) {
@@ -699,13 +730,22 @@ int main( int argc, const char * const argv[] )
 			iCommandLineIndex += 3;
 			syscpld_update = 0;
 			use_dll = 1;
+		}
+		else if ( !strcasecmp( argv[iCommandLineIndex], "sim" ) ) {
+			cpld_img = argv[iCommandLineIndex + 1];
+			iCommandLineIndex += 2;
+			syscpld_update = 0;
+			use_dll = 0;
+			use_sim = 1;
 		} else {
 			iCommandLineIndex ++;
 		}
 	}
 
 #if defined(GALAXY100_PRJ)
-	if(syscpld_update) {
+	if(use_sim) {
+		vme_out_string( "Using the simulated TAP, nothing is programmed\n\n" );
+	} else if(syscpld_update) {
 		isp_gpio_init();
 		isp_gpio_config(CPLD_TCK_CONFIG, GPIO_OUT);
 		isp_gpio_config(CPLD_TMS_CONFIG, GPIO_OUT);
@@ -728,7 +768,10 @@ int main( int argc, const char * const argv[] )
 	}
 	isp_vme_file_size_set(cpld_img);
     printf( "Processing virtual machine file (%s)......\n", cpld_img);
+	clock_gettime( CLOCK_MONOTONIC, &start );
 	siRetCode = ispVM(cpld_img);
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	ispVMStatistics( &start, &end );
 	if ( siRetCode < 0 ) {
 		vme_out_string( "Failed due to ");
 		vme_out_string ("\n\n");
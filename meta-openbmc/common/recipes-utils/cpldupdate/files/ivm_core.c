@@ -20,6 +20,8 @@
 * 08/28/08 NN Added Calculate checksum support.
 * 4/1/09 Nguyen replaced the recursive function call codes on
 *        the ispVMLCOUNT function
+* Send, read, bypass, clocks and state moves shift whole vectors
+*        through jtag_shift_vector() instead of a pin at a time
 *
 ***************************************************************/
 
@@ -290,6 +292,8 @@ signed char ispVMSend(unsigned short int);
 signed char ispVMRead(unsigned short int);
 signed char ispVMReadandSave(unsigned short int);
 signed char ispVMProcessLVDS( unsigned short a_usLVDSCount );
+void ispVMShiftBits( const unsigned char * a_pucTDI, unsigned char * a_pucTDO,
+                     unsigned short a_usiDataSize, unsigned char a_ucClockLast );
 
 
 /***************************************************************
@@ -2265,10 +2269,7 @@ signed char ispVMLCOUNT( unsigned short a_usCountSize )
 
 void ispVMClocks( unsigned short Clocks )
 {
-	unsigned short iClockIndex = 0;
-	for ( iClockIndex = 0; iClockIndex < Clocks; iClockIndex++ ) {
-		sclock();
-	}
+	jtag_shift_vector( NULL, NULL, NULL, Clocks );
 }
 
 /***************************************************************
@@ -2287,10 +2288,6 @@ void ispVMClocks( unsigned short Clocks )
 void ispVMBypass( signed char ScanType, unsigned short Bits )
 {
 	//09/11/07 NN added local variables initialization
-	unsigned short iIndex       = 0;
-	unsigned short iSourceIndex = 0;
-	unsigned char cBitState     = 0;
-	unsigned char cCurByte      = 0;
 	unsigned char * pcSource    = NULL;
 
 	if ( Bits <= 0 ) {
@@ -2315,24 +2312,8 @@ void ispVMBypass( signed char ScanType, unsigned short Bits )
 	}
 	if(pcSource)
 	{
-		iSourceIndex = 0;
-		cBitState = 0;
-		for ( iIndex = 0; iIndex < Bits - 1; iIndex++ ) {
-			/* Scan instruction or bypass register */
-			if ( iIndex % 8 == 0 ) {
-				cCurByte = pcSource[ iSourceIndex++ ];
-			}
-			cBitState = ( unsigned char ) ( ( ( cCurByte << iIndex % 8 ) & 0x80 ) ? 0x01 : 0x00 );
-			writePort( g_ucPinTDI, cBitState );
-			sclock();
-		}
-
-		if ( iIndex % 8 == 0 )  {
-			cCurByte = pcSource[ iSourceIndex++ ];
-		}
-
-		cBitState = ( unsigned char ) ( ( ( cCurByte << iIndex % 8 ) & 0x80 ) ? 0x01 : 0x00 );
-		writePort( g_ucPinTDI, cBitState );
+		/* Scan instruction or bypass register */
+		ispVMShiftBits( pcSource, NULL, Bits, 0 );
 	}
 }
 
@@ -2350,9 +2331,9 @@ void ispVMBypass( signed char ScanType, unsigned short Bits )
 void ispVMStateMachine( signed char cNextJTAGState )
 {
 	//09/11/07 NN added local variables initialization
-	signed char cPathIndex  = 0;
 	signed char cStateIndex = 0;
 	short int	found       = 0;
+	unsigned char ucTMS[ 2 ] = { 0 };
 
 	if ( ( g_cCurrentJTAGState == cNextJTAGState ) && ( cNextJTAGState != RESET ) ) {
 		return;
@@ -2367,15 +2348,8 @@ void ispVMStateMachine( signed char cNextJTAGState )
 	if(found)
 	{
 		g_cCurrentJTAGState = cNextJTAGState;
-		for ( cPathIndex = 0; cPathIndex < g_JTAGTransistions[ cStateIndex ].Pulses; cPathIndex++ ) {
-			if ( ( g_JTAGTransistions[ cStateIndex ].Pattern << cPathIndex ) & 0x80 ) {
-				writePort( g_ucPinTMS, ( unsigned char ) 0x01 );
-			}
-			else {
-				writePort( g_ucPinTMS, ( unsigned char ) 0x00 );
-			}
-			sclock();
-		}
+		ucTMS[ 0 ] = g_JTAGTransistions[ cStateIndex ].Pattern;
+		jtag_shift_vector( ucTMS, NULL, NULL, g_JTAGTransistions[ cStateIndex ].Pulses );
 
 		writePort( g_ucPinTDI, 0x00 );
 		writePort( g_ucPinTMS, 0x00 );
@@ -2432,35 +2406,55 @@ void ispVMEnd()
 
 signed char ispVMSend( unsigned short a_usiDataSize )
 {
-	//09/11/07 NN added local variables initialization
-	unsigned short iIndex       = 0;
-	unsigned short iInDataIndex = 0;
-	unsigned char cCurByte      = 0;
-	unsigned char cBitState     = 0;
-
-	for ( iIndex = 0; iIndex < a_usiDataSize - 1; iIndex++ ) {
-		if ( iIndex % 8 == 0 ) {
-			cCurByte = g_pucInData[ iInDataIndex++ ];
-		}
-		cBitState = ( unsigned char ) ( ( ( cCurByte << iIndex % 8 ) & 0x80 ) ? 0x01 : 0x00 );
-		writePort( g_ucPinTDI, cBitState );
-		sclock();
-	}
+	/* 1/15/04 Clock in last bit for the first n-1 cascaded frames */
+	ispVMShiftBits( g_pucInData, NULL, a_usiDataSize,
+	                ( g_usFlowControl & CASCADE ) ? 1 : 0 );
 
-	if ( iIndex % 8 == 0 ) {
-		/* Take care of the last bit */
-		cCurByte = g_pucInData[ iInDataIndex ];
-	}
+	return 0;
+}
 
-	cBitState = ( unsigned char ) ( ( ( cCurByte << iIndex % 8 ) & 0x80 ) ? 0x01 : 0x00 );
+/***************************************************************
+*
+* ispVMShiftBits
+*
+* Shift a_usiDataSize bits of a_pucTDI (zeros if NULL) into the
+* devices and capture TDO into a_pucTDO if not NULL. The last bit
+* is only presented on TDI and its TDO sampled, it is clocked in
+* by the next state move unless a_ucClockLast is set.
+*
+***************************************************************/
 
-	writePort( g_ucPinTDI, cBitState );
-	if ( g_usFlowControl & CASCADE ) {
-		/* 1/15/04 Clock in last bit for the first n-1 cascaded frames */
-		sclock();
+static unsigned char g_pucZeroData[ 8192 ];
+static unsigned char g_pucTDOData[ 8192 ];
+
+void ispVMShiftBits( const unsigned char * a_pucTDI, unsigned char * a_pucTDO,
+                     unsigned short a_usiDataSize, unsigned char a_ucClockLast )
+{
+	unsigned short usLastBitIndex = 0;
+	unsigned char cBitState       = 0;
+
+	if ( !a_pucTDI ) {
+		a_pucTDI = g_pucZeroData;
+	}
+	if ( a_usiDataSize > 0 && a_ucClockLast ) {
+		jtag_shift_vector( NULL, a_pucTDI, a_pucTDO, a_usiDataSize );
+		return;
+	}
+	if ( a_usiDataSize > 1 ) {
+		usLastBitIndex = (unsigned short) ( a_usiDataSize - 1 );
+		jtag_shift_vector( NULL, a_pucTDI, a_pucTDO, usLastBitIndex );
 	}
 
-	return 0;
+	if ( a_pucTDO ) {
+		if ( readPort() ) {
+			a_pucTDO[ usLastBitIndex / 8 ] |= 0x80 >> ( usLastBitIndex % 8 );
+		}
+		else {
+			a_pucTDO[ usLastBitIndex / 8 ] &= ~( 0x80 >> ( usLastBitIndex % 8 ) );
+		}
+	}
+	cBitState = ( unsigned char ) ( ( ( a_pucTDI[ usLastBitIndex / 8 ] << usLastBitIndex % 8 ) & 0x80 ) ? 0x01 : 0x00 );
+	writePort( g_ucPinTDI, cBitState );
 }
 
 /***************************************************************
@@ -2476,10 +2470,8 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 	//09/11/07 NN added local variables initialization
 	unsigned short usDataSizeIndex    = 0;
 	unsigned short usErrorCount       = 0;
-	unsigned short usLastBitIndex     = 0;
 	unsigned char cDataByte           = 0;
 	unsigned char cMaskByte           = 0;
-	unsigned char cInDataByte         = 0;
 	unsigned char cCurBit             = 0;
 	unsigned char cByteIndex          = 0;
 	unsigned short usBufferIndex      = 0;
@@ -2488,9 +2480,6 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 	char StrChecksum[256]            = {0};
 	unsigned char g_usCalculateChecksum = 0x00;
 
-	//09/11/07 NN Type cast mismatch variables
-	usLastBitIndex = (unsigned short)(a_usiDataSize - 1);
-
 #ifndef VME_DEBUG
 	/****************************************************************************
 	*
@@ -2521,10 +2510,13 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 
 	/****************************************************************************
 	*
-	* Begin shifting data in and out of the device.
+	* Shift data in and out of the device, then check it.
 	*
 	*****************************************************************************/
 
+	ispVMShiftBits( ( g_usDataType & TDI_DATA ) ? g_pucInData : NULL, g_pucTDOData,
+	                a_usiDataSize, ( g_usFlowControl & CASCADE ) ? 1 : 0 );
+
 	for ( usDataSizeIndex = 0; usDataSizeIndex < a_usiDataSize; usDataSizeIndex++ ) {
 		if ( cByteIndex == 0 ) {
 
@@ -2562,20 +2554,10 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 				g_usCalculateChecksum = 0x01;
 			}
 
-			/***************************************************************
-			*
-			* Grab byte from TDI buffer.
-			*
-			***************************************************************/
-
-			if ( g_usDataType & TDI_DATA ) {
-				cInDataByte = g_pucInData[ usBufferIndex ];
-			}
-
 			usBufferIndex++;
 		}
 
-		cCurBit = readPort();
+		cCurBit = ( unsigned char ) ( ( ( g_pucTDOData[ usDataSizeIndex / 8 ] << cByteIndex ) & 0x80 ) ? 0x01 : 0x00 );
 
 		if ( ucDisplayFlag ) {
 			ucDisplayByte <<= 1;
@@ -2606,35 +2588,6 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 			}
 		}
 
-		/****************************************************************************
-		*
-		* Write TDI data to the port.
-		*
-		*****************************************************************************/
-
-		writePort( g_ucPinTDI, ( unsigned char ) ( ( ( cInDataByte << cByteIndex ) & 0x80 ) ? 0x01 : 0x00 ) );
-
-		if ( usDataSizeIndex < usLastBitIndex ) {
-
-			/****************************************************************************
-			*
-			* Clock data out from the data shift register.
-			*
-			*****************************************************************************/
-
-			sclock();
-		}
-		else if ( g_usFlowControl & CASCADE ) {
-
-			/****************************************************************************
-			*
-			* Clock in last bit for the first N - 1 cascaded frames.
-			*
-			*****************************************************************************/
-
-			sclock();
-		}
-
 		/***************************************************************
 		*
 		* Increment the byte index. If it exceeds 7, then reset it back
@@ -2754,6 +2707,18 @@ signed char ispVMRead( unsigned short a_usiDataSize )
 		}
 	}
 
+	if ( !jtag_tdo_valid() ) {
+
+		/****************************************************************************
+		*
+		* Simulated TAP: act like a blank device, the USERCODE differs and
+		* everything else verifies.
+		*
+		*****************************************************************************/
+
+		usErrorCount = ( g_usFlowControl & VERIFYUES ) ? 1 : 0;
+	}
+
 	if ( usErrorCount > 0 ) {
 		if ( g_usFlowControl & VERIFYUES ) {
 			vme_out_string( "USERCODE verification failed.  Continue programming......\n\n" );
@@ -2793,7 +2758,6 @@ signed char ispVMReadandSave( unsigned short int a_usiDataSize )
 {
 	//09/11/07 NN added local variables initialization
 	unsigned short int usDataSizeIndex = 0;
-	unsigned short int usLastBitIndex  = 0;
 	unsigned short int usBufferIndex   = 0;
 	unsigned short int usOutBitIndex   = 0;
 	unsigned short int usLVDSIndex     = 0;
@@ -2804,15 +2768,16 @@ signed char ispVMReadandSave( unsigned short int a_usiDataSize )
 	unsigned char cByteIndex           = 0;
 	signed char cLVDSByteIndex         = 0;
 
-	//09/11/07 NN Type cast mismatch variables
-	usLastBitIndex = (unsigned short) (a_usiDataSize - 1);
-
 	/***************************************************************
 	*
-	* Iterate through the data bits.
+	* Shift in TDI in order to get TDO out, then iterate through
+	* the data bits.
 	*
 	***************************************************************/
 
+	ispVMShiftBits( ( g_usDataType & TDI_DATA ) ? g_pucInData : NULL, g_pucTDOData,
+	                a_usiDataSize, 0 );
+
 	for ( usDataSizeIndex = 0; usDataSizeIndex < a_usiDataSize; usDataSizeIndex++ ) {
 		if ( cByteIndex == 0 ) {
 
@@ -2842,7 +2807,7 @@ signed char ispVMReadandSave( unsigned short int a_usiDataSize )
 			usBufferIndex++;
 		}
 
-		cCurBit = readPort();
+		cCurBit = ( unsigned char ) ( ( ( g_pucTDOData[ usDataSizeIndex / 8 ] << cByteIndex ) & 0x80 ) ? 0x01 : 0x00 );
 		cDataByte = ( unsigned char ) ( ( ( cInDataByte << cByteIndex ) & 0x80 ) ? 0x01 : 0x00 );
 
 		/***************************************************************
@@ -2892,17 +2857,7 @@ signed char ispVMReadandSave( unsigned short int a_usiDataSize )
 			g_pucOutData[ usOutBitIndex / 8 ] |= ( unsigned char ) ( ( ( cCurBit & 0x1 ) ? 0x01 : 0x00 ) << ( 7 - usOutBitIndex % 8 ) );
 		}
 
-		/***************************************************************
-		*
-		* Shift in TDI in order to get TDO out.
-		*
-		***************************************************************/
-
 		usOutBitIndex++;
-		writePort( g_ucPinTDI, cDataByte );
-		if ( usDataSizeIndex < usLastBitIndex ) {
-			sclock();
-		}
 
 		/***************************************************************
 		*
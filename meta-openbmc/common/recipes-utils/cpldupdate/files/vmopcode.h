@@ -234,9 +234,18 @@ typedef struct {
 	unsigned char  ucUpdate;
 } LVDSPair;
 
+/* JTAG shift engine in hardware.c */
+int jtag_shift_vector( const unsigned char *tms_bits, const unsigned char *tdi_bits,
+                       unsigned char *tdo_bits, unsigned int nbits );
+int jtag_tdo_valid(void);
+extern unsigned char g_ucCpu_FrequencySet;
+extern unsigned long g_ulTCKCount;
+extern unsigned long g_ulDelayUs;
+
 #if defined(GALAXY100_PRJ)
 extern int syscpld_update;
 extern int use_dll;
+extern int use_sim;
 extern const char *dll_name;
 int isp_dll_init(int argc, const char * const argv[]);
 void isp_gpio_config( unsigned int gpio, int dir );
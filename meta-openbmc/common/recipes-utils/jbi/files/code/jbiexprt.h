@@ -174,6 +174,14 @@ int jbi_jtag_io
 	int read_tdo
 );
 
+int jbi_jtag_shift_bits
+(
+	int count,
+	unsigned char *tdi,
+	unsigned char *tdo,
+	int tms_last
+);
+
 void jbi_message
 (
 	char *message_text
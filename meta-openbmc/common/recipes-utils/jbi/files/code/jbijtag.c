@@ -766,8 +766,6 @@ int jbi_jtag_drscan
 	unsigned char *tdo
 )
 {
-	int i = 0;
-	int tdo_bit = 0;
 	int status = 1;
 
 	/*
@@ -803,26 +801,8 @@ int jbi_jtag_drscan
 
 	if (status)
 	{
-		/* loop in the SHIFT-DR state */
-		for (i = 0; i < count; i++)
-		{
-			tdo_bit = jbi_jtag_io(
-				(i == count - 1),
-				tdi[i >> 3] & (1 << (i & 7)),
-				(tdo != NULL));
-
-			if (tdo != NULL)
-			{
-				if (tdo_bit)
-				{
-					tdo[i >> 3] |= (1 << (i & 7));
-				}
-				else
-				{
-					tdo[i >> 3] &= ~(unsigned int) (1 << (i & 7));
-				}
-			}
-		}
+		/* shift the whole register, leaving SHIFT-DR on the last bit */
+		jbi_jtag_shift_bits(count, tdi, tdo, 1);
 
 		jbi_jtag_io(0, 0, 0);	/* DRPAUSE */
 	}
@@ -838,8 +818,6 @@ int jbi_jtag_irscan
 	unsigned char *tdo
 )
 {
-	int i = 0;
-	int tdo_bit = 0;
 	int status = 1;
 
 	/*
@@ -878,26 +856,8 @@ int jbi_jtag_irscan
 
 	if (status)
 	{
-		/* loop in the SHIFT-IR state */
-		for (i = 0; i < count; i++)
-		{
-			tdo_bit = jbi_jtag_io(
-				(i == count - 1),
-				tdi[i >> 3] & (1 << (i & 7)),
-				(tdo != NULL));
-
-			if (tdo != NULL)
-			{
-				if (tdo_bit)
-				{
-					tdo[i >> 3] |= (1 << (i & 7));
-				}
-				else
-				{
-					tdo[i >> 3] &= ~(unsigned int) (1 << (i & 7));
-				}
-			}
-		}
+		/* shift the whole register, leaving SHIFT-IR on the last bit */
+		jbi_jtag_shift_bits(count, tdi, tdo, 1);
 
 		jbi_jtag_io(0, 0, 0);	/* IRPAUSE */
 	}
@@ -82,6 +82,9 @@ typedef unsigned long DWORD;
 #include <openbmc/gpio.h>
 #include <openbmc/log.h>
 #include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #endif
 
 #if PORT == DOS
@@ -156,6 +159,14 @@ gpio_st g_gpio_tck;
 gpio_st g_gpio_tms;
 gpio_st g_gpio_tdo;
 gpio_st g_gpio_tdi;
+
+/* how the JTAG pins are driven, see -gm and -gt */
+enum {
+  JTAG_BACKEND_SYSFS = 0,
+  JTAG_BACKEND_MMIO,
+  JTAG_BACKEND_TAP_MODEL,
+};
+void close_jtag_mmio(void);
 #endif
 
 #if defined(USE_STATIC_MEMORY)
@@ -342,6 +353,110 @@ static int sleep_ns(unsigned long clk)
 }
 #endif
 
+/* half of the 1MHz TCK period used by all hardware backends */
+#define JTAG_HALF_CLK_NS 500
+
+/*
+ * AST GPIO controller, data register of each 32-pin group. The direction
+ * register of a group follows its data register.
+ */
+#define AST_GPIO_BASE 0x1e780000
+#define AST_GPIO_MAP_SIZE 4096
+static const uint16_t ast_gpio_data_offset[] = {
+  0x000,                        /* A - D */
+  0x020,                        /* E - H */
+  0x070,                        /* I - L */
+  0x078,                        /* M - P */
+  0x080,                        /* Q - T */
+  0x088,                        /* U - X */
+  0x1e0,                        /* Y - AB */
+  0x1e8,                        /* AC - AF */
+};
+#define AST_GPIO_GROUPS \
+  ((int)(sizeof(ast_gpio_data_offset) / sizeof(ast_gpio_data_offset[0])))
+
+typedef struct {
+  volatile uint32_t *reg;
+  uint32_t mask;
+  int group;
+} mmio_pin_st;
+
+static void *g_mmio_base = NULL;
+static int g_mmio_fd = -1;
+static mmio_pin_st g_mmio_tck;
+static mmio_pin_st g_mmio_tms;
+static mmio_pin_st g_mmio_tdo;
+static mmio_pin_st g_mmio_tdi;
+/*
+ * Reading a data register returns the pin levels, not the output latch, so
+ * outputs are written through a shadow of each group register.
+ */
+static uint32_t g_mmio_shadow[AST_GPIO_GROUPS];
+static unsigned long g_half_clk_loops = 0;
+
+/* bits clocked and vector shifts done, reported with -v */
+unsigned long g_jtag_bits = 0;
+unsigned long g_jtag_shifts = 0;
+
+/*
+ * Software model of a single TAP with a 10-bit IR, IDCODE and BYPASS.
+ * It lets a .jbc file be played without any hardware attached.
+ */
+#define TAP_MODEL_IR_LEN     10
+#define TAP_MODEL_IR_CAPTURE 0x001
+#define TAP_MODEL_IR_IDCODE  0x006
+#define TAP_MODEL_IR_BYPASS  0x3ff
+#define TAP_MODEL_IDCODE     0x0123c0dd
+
+enum {
+  TAP_RESET = 0,
+  TAP_IDLE,
+  TAP_DRSELECT,
+  TAP_DRCAPTURE,
+  TAP_DRSHIFT,
+  TAP_DREXIT1,
+  TAP_DRPAUSE,
+  TAP_DREXIT2,
+  TAP_DRUPDATE,
+  TAP_IRSELECT,
+  TAP_IRCAPTURE,
+  TAP_IRSHIFT,
+  TAP_IREXIT1,
+  TAP_IRPAUSE,
+  TAP_IREXIT2,
+  TAP_IRUPDATE,
+};
+
+/* next state for TMS low and high */
+static const unsigned char tap_next_state[16][2] = {
+  { TAP_IDLE, TAP_RESET },            /* RESET */
+  { TAP_IDLE, TAP_DRSELECT },         /* IDLE */
+  { TAP_DRCAPTURE, TAP_IRSELECT },    /* DRSELECT */
+  { TAP_DRSHIFT, TAP_DREXIT1 },       /* DRCAPTURE */
+  { TAP_DRSHIFT, TAP_DREXIT1 },       /* DRSHIFT */
+  { TAP_DRPAUSE, TAP_DRUPDATE },      /* DREXIT1 */
+  { TAP_DRPAUSE, TAP_DREXIT2 },       /* DRPAUSE */
+  { TAP_DRSHIFT, TAP_DRUPDATE },      /* DREXIT2 */
+  { TAP_IDLE, TAP_DRSELECT },         /* DRUPDATE */
+  { TAP_IRCAPTURE, TAP_RESET },       /* IRSELECT */
+  { TAP_IRSHIFT, TAP_IREXIT1 },       /* IRCAPTURE */
+  { TAP_IRSHIFT, TAP_IREXIT1 },       /* IRSHIFT */
+  { TAP_IRPAUSE, TAP_IRUPDATE },      /* IREXIT1 */
+  { TAP_IRPAUSE, TAP_IREXIT2 },       /* IRPAUSE */
+  { TAP_IRSHIFT, TAP_IRUPDATE },      /* IREXIT2 */
+  { TAP_IDLE, TAP_DRSELECT },         /* IRUPDATE */
+};
+
+struct {
+  int state;
+  uint32_t ir;
+  uint32_t ir_shift;
+  uint32_t dr_shift;
+  int dr_len;
+} g_tap_model = { TAP_RESET, TAP_MODEL_IR_IDCODE, 0, 0, 1 };
+
+int g_jtag_backend = JTAG_BACKEND_SYSFS;
+
 int initialize_jtag_gpios()
 {
   if (gpio_open(&g_gpio_tck, g_tck) || gpio_open(&g_gpio_tms, g_tms)
@@ -370,20 +485,134 @@ int initialize_jtag_gpios()
   return 0;
 }
 
-int jbi_jtag_io(int tms, int tdi, int read_tdo)
+static void __attribute__((noinline)) spin_loops(unsigned long loops)
 {
-  int tdo = 0;
+  volatile unsigned long n = loops;
 
-	if (!jtag_hardware_initialized)	{
-		initialize_jtag_gpios();
-		jtag_hardware_initialized = TRUE;
-	}
+  while (n) {
+    n--;
+  }
+}
+
+/*
+ * Reading the clock on every edge costs more than the edge itself, so time
+ * the spin loop once and wait by loop count. Keep the fastest of a few runs
+ * so that being preempted while calibrating does not stretch the clock.
+ */
+static void calibrate_half_clk(void)
+{
+  struct timespec start, end;
+  unsigned long long ns, best = 0;
+  unsigned long loops = 1024;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    for (;;) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      spin_loops(loops);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      ns = (unsigned long long)(end.tv_sec - start.tv_sec) * NANOSEC_IN_SEC
+        + end.tv_nsec - start.tv_nsec;
+      if (ns >= 2 * 1000 * 1000 || loops >= (1UL << 30)) {
+        break;
+      }
+      loops <<= 1;
+    }
+    if (!best || ns < best) {
+      best = ns;
+    }
+  }
+
+  g_half_clk_loops = (loops * JTAG_HALF_CLK_NS + best - 1) / (best ? best : 1);
+  LOG_DBG("%lu spin loops per %d ns", g_half_clk_loops, JTAG_HALF_CLK_NS);
+}
+
+static int mmio_pin_init(mmio_pin_st *pin, int gpio)
+{
+  int group = gpio / 32;
+
+  if (gpio < 0 || group >= AST_GPIO_GROUPS) {
+    LOG_ERR(EINVAL, "GPIO %d has no data register", gpio);
+    return -1;
+  }
+
+  pin->reg = (volatile uint32_t *)
+    ((uint8_t *)g_mmio_base + ast_gpio_data_offset[group]);
+  pin->mask = 1U << (gpio % 32);
+  pin->group = group;
+  return 0;
+}
+
+void close_jtag_mmio(void)
+{
+  if (g_mmio_base) {
+    munmap(g_mmio_base, AST_GPIO_MAP_SIZE);
+    g_mmio_base = NULL;
+  }
+  if (g_mmio_fd >= 0) {
+    close(g_mmio_fd);
+    g_mmio_fd = -1;
+  }
+}
+
+/*
+ * The pins are still exported and set up through sysfs, which takes care
+ * of direction and pin muxing; only the bit toggling goes to the registers.
+ */
+static int initialize_jtag_mmio(void)
+{
+  g_mmio_fd = open("/dev/mem", O_RDWR | O_SYNC);
+  if (g_mmio_fd < 0) {
+    LOG_ERR(errno, "Failed to open /dev/mem");
+    return -1;
+  }
+
+  g_mmio_base = mmap(NULL, AST_GPIO_MAP_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, g_mmio_fd, AST_GPIO_BASE);
+  if (g_mmio_base == MAP_FAILED) {
+    LOG_ERR(errno, "Failed to map GPIO registers");
+    g_mmio_base = NULL;
+    close_jtag_mmio();
+    return -1;
+  }
+
+  if (mmio_pin_init(&g_mmio_tck, g_tck) || mmio_pin_init(&g_mmio_tms, g_tms)
+      || mmio_pin_init(&g_mmio_tdo, g_tdo)
+      || mmio_pin_init(&g_mmio_tdi, g_tdi)) {
+    close_jtag_mmio();
+    return -1;
+  }
+
+  calibrate_half_clk();
+
+  return 0;
+}
+
+static void initialize_jtag_backend(void)
+{
+  jtag_hardware_initialized = TRUE;
+
+  if (g_jtag_backend == JTAG_BACKEND_TAP_MODEL) {
+    return;
+  }
+
+  initialize_jtag_gpios();
+
+  if (g_jtag_backend == JTAG_BACKEND_MMIO && initialize_jtag_mmio()) {
+    fprintf(stderr, "Warning: falling back to sysfs GPIO access\n");
+    g_jtag_backend = JTAG_BACKEND_SYSFS;
+  }
+}
+
+static int jtag_io_sysfs(int tms, int tdi, int read_tdo)
+{
+  int tdo = 0;
 
   gpio_write(&g_gpio_tms, tms ? GPIO_VALUE_HIGH : GPIO_VALUE_LOW);
   gpio_write(&g_gpio_tdi, tdi ? GPIO_VALUE_HIGH : GPIO_VALUE_LOW);
 
   /* sleep 500ns to make sure the signal shows up on wire */
-  sleep_ns(500);
+  sleep_ns(JTAG_HALF_CLK_NS);
   /*
    * if we need to read data, the data should be ready from the
    * previous clock falling edge. Read it now.
@@ -394,15 +623,166 @@ int jbi_jtag_io(int tms, int tdi, int read_tdo)
 
   /* do rising edge to clock out the data */
   gpio_write(&g_gpio_tck, GPIO_VALUE_HIGH);
-  sleep_ns(500);
+  sleep_ns(JTAG_HALF_CLK_NS);
   /* do falling edge clocking */
   gpio_write(&g_gpio_tck, GPIO_VALUE_LOW);
 
+  return tdo;
+}
+
+static inline void mmio_write(const mmio_pin_st *pin, int high)
+{
+  uint32_t *shadow = &g_mmio_shadow[pin->group];
+
+  if (high) {
+    *shadow |= pin->mask;
+  } else {
+    *shadow &= ~pin->mask;
+  }
+  *pin->reg = *shadow;
+}
+
+static inline void mmio_sync_shadow(void)
+{
+  g_mmio_shadow[g_mmio_tck.group] = *g_mmio_tck.reg;
+  g_mmio_shadow[g_mmio_tms.group] = *g_mmio_tms.reg;
+  g_mmio_shadow[g_mmio_tdi.group] = *g_mmio_tdi.reg;
+}
+
+/* same waveform as jtag_io_sysfs(), without the syscalls */
+static inline int jtag_io_mmio(int tms, int tdi, int read_tdo)
+{
+  int tdo = 0;
+
+  mmio_write(&g_mmio_tms, tms);
+  mmio_write(&g_mmio_tdi, tdi);
+  spin_loops(g_half_clk_loops);
+  if (read_tdo) {
+    tdo = (*g_mmio_tdo.reg & g_mmio_tdo.mask) ? 1 : 0;
+  }
+  mmio_write(&g_mmio_tck, 1);
+  spin_loops(g_half_clk_loops);
+  mmio_write(&g_mmio_tck, 0);
+
+  return tdo;
+}
+
+/*
+ * Clock the model once. TDO reflects the shift register before the rising
+ * edge, the same point at which the hardware backends sample it.
+ */
+static int jtag_io_tap_model(int tms, int tdi, int read_tdo)
+{
+  int tdo = 0;
+
+  switch (g_tap_model.state) {
+  case TAP_RESET:
+    g_tap_model.ir = TAP_MODEL_IR_IDCODE;
+    break;
+  case TAP_DRCAPTURE:
+    if (g_tap_model.ir == TAP_MODEL_IR_IDCODE) {
+      g_tap_model.dr_shift = TAP_MODEL_IDCODE;
+      g_tap_model.dr_len = 32;
+    } else {
+      g_tap_model.dr_shift = 0;
+      g_tap_model.dr_len = 1;
+    }
+    break;
+  case TAP_DRSHIFT:
+    tdo = g_tap_model.dr_shift & 1;
+    g_tap_model.dr_shift = (g_tap_model.dr_shift >> 1)
+      | ((uint32_t)(tdi ? 1 : 0) << (g_tap_model.dr_len - 1));
+    break;
+  case TAP_IRCAPTURE:
+    g_tap_model.ir_shift = TAP_MODEL_IR_CAPTURE;
+    break;
+  case TAP_IRSHIFT:
+    tdo = g_tap_model.ir_shift & 1;
+    g_tap_model.ir_shift = (g_tap_model.ir_shift >> 1)
+      | ((uint32_t)(tdi ? 1 : 0) << (TAP_MODEL_IR_LEN - 1));
+    break;
+  case TAP_IRUPDATE:
+    g_tap_model.ir = g_tap_model.ir_shift;
+    break;
+  }
+
+  g_tap_model.state = tap_next_state[g_tap_model.state][tms ? 1 : 0];
+
+  return tdo;
+}
+
+int jbi_jtag_io(int tms, int tdi, int read_tdo)
+{
+  int tdo;
+
+  if (!jtag_hardware_initialized) {
+    initialize_jtag_backend();
+  }
+
+  switch (g_jtag_backend) {
+  case JTAG_BACKEND_MMIO:
+    mmio_sync_shadow();
+    tdo = jtag_io_mmio(tms, tdi, read_tdo);
+    break;
+  case JTAG_BACKEND_TAP_MODEL:
+    tdo = jtag_io_tap_model(tms, tdi, read_tdo);
+    break;
+  default:
+    tdo = jtag_io_sysfs(tms, tdi, read_tdo);
+    break;
+  }
+  g_jtag_bits++;
+
   LOG_VER("tms=%d tdi=%d do_read=%d tdo=%d", tms, tdi, read_tdo, tdo);
 
   return tdo;
 }
 
+/*
+ * Shift count bits, LSB first, through the current SHIFT-IR/DR state with
+ * TMS raised on the last bit if tms_last is set. The backend is picked once
+ * per scan rather than per bit; tdo may be NULL if the output is not needed.
+ */
+int jbi_jtag_shift_bits(int count, unsigned char *tdi, unsigned char *tdo,
+                        int tms_last)
+{
+  int (*io)(int tms, int tdi, int read_tdo);
+  int i, tms, tdo_bit;
+
+  if (!jtag_hardware_initialized) {
+    initialize_jtag_backend();
+  }
+
+  switch (g_jtag_backend) {
+  case JTAG_BACKEND_MMIO:
+    mmio_sync_shadow();
+    io = jtag_io_mmio;
+    break;
+  case JTAG_BACKEND_TAP_MODEL:
+    io = jtag_io_tap_model;
+    break;
+  default:
+    io = jtag_io_sysfs;
+    break;
+  }
+
+  for (i = 0; i < count; i++) {
+    tms = tms_last && (i == count - 1);
+    tdo_bit = io(tms, tdi[i >> 3] & (1 << (i & 7)), (tdo != NULL));
+    if (tdo != NULL) {
+      if (tdo_bit) {
+        tdo[i >> 3] |= (1 << (i & 7));
+      } else {
+        tdo[i >> 3] &= ~(unsigned int) (1 << (i & 7));
+      }
+    }
+  }
+  g_jtag_bits += count;
+  g_jtag_shifts++;
+
+  return 0;
+}
+
 #else
 
 int jbi_jtag_io(int tms, int tdi, int read_tdo)
@@ -478,6 +858,40 @@ int jbi_jtag_io(int tms, int tdi, int read_tdo)
 	return (tdo);
 }
 
+int jbi_jtag_shift_bits
+(
+	int count,
+	unsigned char *tdi,
+	unsigned char *tdo,
+	int tms_last
+)
+{
+	int i = 0;
+	int tdo_bit = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		tdo_bit = jbi_jtag_io(
+			tms_last && (i == count - 1),
+			tdi[i >> 3] & (1 << (i & 7)),
+			(tdo != NULL));
+
+		if (tdo != NULL)
+		{
+			if (tdo_bit)
+			{
+				tdo[i >> 3] |= (1 << (i & 7));
+			}
+			else
+			{
+				tdo[i >> 3] &= ~(unsigned int) (1 << (i & 7));
+			}
+		}
+	}
+
+	return (0);
+}
+
 #endif
 
 void jbi_message(char *message_text)
@@ -1069,6 +1483,11 @@ int main(int argc, char **argv)
 	char *description = NULL;
 	JBI_PROCINFO *procedure_list = NULL;
 	JBI_PROCINFO *procptr = NULL;
+#ifdef OPENBMC
+	struct timespec start_ts;
+	struct timespec end_ts;
+	double elapsed = 0.0;
+#endif
 
 	verbose = FALSE;
 
@@ -1161,6 +1580,15 @@ int main(int argc, char **argv)
         case 'O':
           g_tdo = atoi(&argv[arg][3]);
           break;
+        case 'M':
+          g_jtag_backend = JTAG_BACKEND_MMIO;
+          break;
+        case 'T':
+          g_jtag_backend = JTAG_BACKEND_TAP_MODEL;
+          break;
+        default:
+          error = TRUE;
+          break;
         }
         break;
 #else
@@ -1225,7 +1653,7 @@ int main(int argc, char **argv)
 #endif
 
 #ifdef OPENBMC
-  if (execute_program) {
+  if (execute_program && g_jtag_backend != JTAG_BACKEND_TAP_MODEL) {
     if (g_tck == -1 || g_tms == -1 || g_tdo == -1 || g_tdi == -1) {
       fprintf(stderr, "Error:  -gc, -gs, -gi, and -go must be specified\n");
       help = TRUE;
@@ -1253,6 +1681,8 @@ int main(int argc, char **argv)
 		fprintf(stderr, "    -gs<clock>  : GPIO directory for TMS\n");
 		fprintf(stderr, "    -gi<clock>  : GPIO directory for TDI\n");
 		fprintf(stderr, "    -go<clock>  : GPIO directory for TDO\n");
+		fprintf(stderr, "    -gm         : toggle the GPIOs through the memory-mapped registers\n");
+		fprintf(stderr, "    -gt         : play against a software TAP model, no GPIO needed\n");
 #else
 		fprintf(stderr, "    -s<port>    : serial port name (for BitBlaster)\n");
 #endif
@@ -1471,10 +1901,16 @@ int main(int argc, char **argv)
 				*	Execute the Jam STAPL ByteCode program
 				*/
 				time(&start_time);
+#ifdef OPENBMC
+				clock_gettime(CLOCK_MONOTONIC, &start_ts);
+#endif
 				exec_result = jbi_execute(file_buffer, file_length, workspace,
 					workspace_size, action, init_list, reset_jtag,
 					&error_address, &exit_code, &format_version);
 				time(&end_time);
+#ifdef OPENBMC
+				clock_gettime(CLOCK_MONOTONIC, &end_ts);
+#endif
 
 				if (exec_result == JBIC_SUCCESS)
 				{
@@ -1553,6 +1989,13 @@ int main(int argc, char **argv)
 						time_delta / 3600,			/* hours */
 						(time_delta % 3600) / 60,	/* minutes */
 						time_delta % 60);			/* seconds */
+#ifdef OPENBMC
+					elapsed = (end_ts.tv_sec - start_ts.tv_sec) +
+						(end_ts.tv_nsec - start_ts.tv_nsec) / 1e9;
+					printf("JTAG: %lu bits, %lu vector shifts, %.0f bits/s\n",
+						g_jtag_bits, g_jtag_shifts,
+						(elapsed > 0) ? g_jtag_bits / elapsed : 0.0);
+#endif
 				}
 			}
 		}
@@ -1994,6 +2437,10 @@ void initialize_jtag_hardware()
 
 void close_jtag_hardware()
 {
+#ifdef OPENBMC
+	close_jtag_mmio();
+#endif
+
 	if (specified_com_port)
 	{
 		if (com_port != -1) close(com_port);
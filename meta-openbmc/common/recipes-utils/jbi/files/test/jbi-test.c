@@ -0,0 +1,255 @@
+/*
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+ * The player is linked in with its main() renamed to jbi_main() and is
+ * run against the software TAP model (-gt), first on a generated .jbc
+ * and then through the scan routines directly.
+ */
+int jbi_main(int argc, char **argv);
+int jbi_jtag_drscan(int start_state, int count, unsigned char *tdi,
+                    unsigned char *tdo);
+int jbi_jtag_irscan(int start_state, int count, unsigned char *tdi,
+                    unsigned char *tdo);
+int jbi_jtag_io(int tms, int tdi, int read_tdo);
+extern unsigned long g_jtag_bits;
+extern unsigned long g_jtag_shifts;
+
+/* must match the TAP model in jbistub.c */
+#define TAP_IR_LEN     10
+#define TAP_IR_CAPTURE 0x001
+#define TAP_IR_IDCODE  0x006
+#define TAP_IR_BYPASS  0x3ff
+#define TAP_IDCODE     0x0123c0dd
+
+#define TEST_LOOPS     2000
+#define TEST_DR_BITS   4096
+#define TEST_BYPASS_BITS 1024
+
+/* JBC opcodes used by the generated program */
+#define OP_EXIT 0x25
+#define OP_PSH0 0x2F
+#define OP_PSHL 0x40
+#define OP_NEXT 0x44
+#define OP_POPV 0x4D
+#define OP_DS   0x51
+#define OP_IS   0x52
+
+/* variables of the generated program */
+#define VAR_I   0
+#define VAR_IR  1
+#define VAR_DR  2
+
+static uint8_t jbc[TEST_DR_BITS / 8 + 512];
+
+static void put_dword(uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static int put_op(uint8_t *p, int op, uint32_t arg)
+{
+  p[0] = op;
+  if ((op >> 6) & 3) {
+    put_dword(&p[1], arg);
+    return 5;
+  }
+  return 1;
+}
+
+static int put_symbol(uint8_t *p, int attr, int name, uint32_t value,
+                      uint32_t size)
+{
+  p[0] = attr;
+  p[1] = name >> 8;
+  p[2] = name;
+  put_dword(&p[3], value);
+  put_dword(&p[7], size);
+  return 11;
+}
+
+static uint16_t jbc_crc(const uint8_t *buf, int len)
+{
+  uint16_t shift_reg = 0xffff;
+  int i, bit;
+
+  for (i = 0; i < len; i++) {
+    uint8_t databyte = buf[i];
+    for (bit = 0; bit < 8; bit++) {
+      int feedback = (databyte ^ shift_reg) & 1;
+      shift_reg >>= 1;
+      if (feedback)
+        shift_reg ^= 0x8408;
+      databyte >>= 1;
+    }
+  }
+
+  return ~shift_reg;
+}
+
+/*
+ * Jam 1.1 (version 0) ByteCode that runs
+ *   FOR I = 0 TO loops - 1; IRSCAN 10, IR; DRSCAN dr_bits, DR; NEXT I;
+ * and exits with 0.
+ */
+static int build_jbc(uint8_t *buf, int loops, int dr_bits)
+{
+  int strings = 64, symbols = 80, data, code, debug, crc;
+  int top, i, n;
+
+  memset(buf, 0, 64);
+  put_dword(&buf[0], 0x4A414D00);
+
+  /* string table: variable names */
+  memcpy(&buf[strings], "I\0IR\0DR\0", 8);
+
+  n = symbols;
+  n += put_symbol(&buf[n], 0x01, 0, 0, 0);
+  n += put_symbol(&buf[n], 0x0c, 2, 0, TAP_IR_LEN);
+  n += put_symbol(&buf[n], 0x0c, 5, 2, dr_bits);
+
+  /* data section: IR value, then the DR pattern */
+  data = n;
+  buf[n++] = TAP_IR_BYPASS & 0xff;
+  buf[n++] = TAP_IR_BYPASS >> 8;
+  for (i = 0; i < dr_bits / 8; i++)
+    buf[n++] = (i * 37) ^ 0x5a;
+
+  code = n;
+  n += put_op(&buf[n], OP_PSH0, 0);
+  n += put_op(&buf[n], OP_POPV, VAR_I);
+  n += put_op(&buf[n], OP_PSHL, 0);   /* loop top, patched below */
+  top = n;
+  n += put_op(&buf[n], OP_PSHL, loops - 1);
+  n += put_op(&buf[n], OP_PSHL, 1);
+  put_dword(&buf[top - 4], n - code);
+  n += put_op(&buf[n], OP_PSHL, TAP_IR_LEN);
+  n += put_op(&buf[n], OP_PSHL, 0);
+  n += put_op(&buf[n], OP_IS, VAR_IR);
+  n += put_op(&buf[n], OP_PSHL, dr_bits);
+  n += put_op(&buf[n], OP_PSHL, 0);
+  n += put_op(&buf[n], OP_DS, VAR_DR);
+  n += put_op(&buf[n], OP_NEXT, VAR_I);
+  n += put_op(&buf[n], OP_PSH0, 0);
+  n += put_op(&buf[n], OP_EXIT, 0);
+
+  debug = n;
+  crc = n;
+
+  put_dword(&buf[4], strings);
+  put_dword(&buf[16], symbols);
+  put_dword(&buf[20], data);
+  put_dword(&buf[24], code);
+  put_dword(&buf[28], debug);
+  put_dword(&buf[32], crc);
+  put_dword(&buf[48], 3);
+
+  buf[n] = jbc_crc(buf, crc) >> 8;
+  buf[n + 1] = jbc_crc(buf, crc) & 0xff;
+
+  return n + 2;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void test_play_jbc(void)
+{
+  char path[] = "/tmp/jbi-test-XXXXXX";
+  char *argv[] = { "jbi", "-gt", path, NULL };
+  double start, elapsed;
+  int fd, len;
+
+  len = build_jbc(jbc, TEST_LOOPS, TEST_DR_BITS);
+  fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(write(fd, jbc, len) == len);
+  close(fd);
+
+  start = now();
+  assert(jbi_main(3, argv) == 0);
+  elapsed = now() - start;
+  unlink(path);
+
+  /* one vector shift per scan, and every scan bit went through them */
+  assert(g_jtag_shifts == 2 * TEST_LOOPS);
+  assert(g_jtag_bits >= (unsigned long)TEST_LOOPS * (TAP_IR_LEN + TEST_DR_BITS));
+
+  printf("jbc: %d scans, %lu bits in %.3f s: %.0f bits/s\n",
+         2 * TEST_LOOPS, g_jtag_bits, elapsed, g_jtag_bits / elapsed);
+}
+
+static void test_scans(void)
+{
+  unsigned char ir[2], dr[TEST_BYPASS_BITS / 8], out[TEST_BYPASS_BITS / 8];
+  uint32_t idcode;
+  int i;
+
+  /* the player leaves the TAP in RESET, scans start from IDLE */
+  jbi_jtag_io(0, 0, 0);
+
+  /* IR capture value comes out while IDCODE goes in */
+  ir[0] = TAP_IR_IDCODE & 0xff;
+  ir[1] = TAP_IR_IDCODE >> 8;
+  memset(out, 0, sizeof(out));
+  assert(jbi_jtag_irscan(0, TAP_IR_LEN, ir, out) == 1);
+  assert((out[0] | (out[1] & 0x3) << 8) == TAP_IR_CAPTURE);
+
+  /* from IRPAUSE */
+  memset(dr, 0, sizeof(dr));
+  assert(jbi_jtag_drscan(2, 32, dr, out) == 1);
+  idcode = out[0] | out[1] << 8 | out[2] << 16 | (uint32_t)out[3] << 24;
+  assert(idcode == TAP_IDCODE);
+
+  /* from DRPAUSE; BYPASS delays TDI by one bit */
+  ir[0] = TAP_IR_BYPASS & 0xff;
+  ir[1] = TAP_IR_BYPASS >> 8;
+  assert(jbi_jtag_irscan(1, TAP_IR_LEN, ir, NULL) == 1);
+  for (i = 0; i < sizeof(dr); i++)
+    dr[i] = rand();
+  assert(jbi_jtag_drscan(2, TEST_BYPASS_BITS, dr, out) == 1);
+  assert((out[0] & 1) == 0);
+  for (i = 1; i < TEST_BYPASS_BITS; i++) {
+    assert(!!(out[i >> 3] & (1 << (i & 7))) ==
+           !!(dr[(i - 1) >> 3] & (1 << ((i - 1) & 7))));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  test_play_jbc();
+  test_scans();
+  printf("All tests passed\n");
+  return 0;
+}
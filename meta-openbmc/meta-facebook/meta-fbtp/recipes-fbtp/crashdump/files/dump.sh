@@ -35,7 +35,7 @@ function execute_via_peci {
     return
 
   cat | \
-    $PECI_UTIL --file /dev/stdin
+    $PECI_UTIL --batch /dev/stdin
 }
 
 # read command from stdin
@@ -29,6 +29,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,14 +67,6 @@ struct tck_bitbang {
     unsigned char     tdo;        // TDO bit value to read
 };
 
-struct scan_xfer {
-    unsigned int     length;      // number of bits to clock
-    unsigned char    *tdi;        // data to write to tap (optional)
-    unsigned int     tdi_bytes;
-    unsigned char    *tdo;        // data to read from tap (optional)
-    unsigned int     tdo_bytes;
-    unsigned int     end_tap_state;
-};
 
 const char *tap_states_name[] = {
     "TLR",
@@ -126,30 +119,98 @@ const TmsCycle _tmsCycleLookup[][16] = {
 
 
 
+//
+// Requests to the BIC are coalesced before they go out. TAP moves and wait
+// cycles are gathered as TMS bits into one SET_TAP_STATE, and consecutive
+// scans of the same kind are packed into one JTAG_SHIFT. Finished requests
+// go to a sender thread, in order, so the next ASD commands are decoded
+// while the BIC works on the previous ones. Nothing waits for the BIC until
+// JTAG_flush(), which socket_main calls before pins, configuration or the
+// reply need the JTAG traffic to have happened.
+//
+// The sender has one request at a time outstanding on IPMB. Every request
+// moves the TAP, so the BIC must run them in the order they were built,
+// and nothing on the way keeps that order for requests in flight together:
+// ipmbd hands each request to a thread of its own, per connection or per
+// tag on its multiplexed socket, and those race for the bus.
+//
+
+// TMS bits one SET_TAP_STATE carries; clocks past them have TMS low
+#define BIC_TMS_BITS        8
+#define BIC_TMS_MAX_CYCLES  255
+
+// An IPMB frame is at most 255 bytes. Less the IPMB/IPMI headers, the IANA
+// ID and the length and last fields, 240 bytes of scan data fit either way.
+#define BIC_SHIFT_MAX_BYTES 240
+#define BIC_SHIFT_MAX_BITS  (BIC_SHIFT_MAX_BYTES * 8)
+
+// ASD scans whose TDO one JTAG_SHIFT can return
+#define BIC_SHIFT_MAX_READS 32
+
+// requests queued for the sender thread
+#define BIC_QUEUE_DEPTH     8
+
+#define SHIFT_WRITE         0x1
+#define SHIFT_READ          0x2
+
+typedef struct {
+    unsigned char *dst;           // ASD response buffer
+    unsigned int  dst_offset;     // first bit in dst
+    unsigned int  offset;         // first bit in the JTAG_SHIFT
+    unsigned int  bits;
+} tdo_slice;
+
+typedef struct {
+    uint8_t       cmd;
+    uint8_t       tlen;
+    uint8_t       tbuf[BIC_SHIFT_MAX_BYTES + 8];
+    unsigned int  read_bits;
+    int           n_reads;
+    tdo_slice     reads[BIC_SHIFT_MAX_READS];
+} bic_request;
+
+typedef struct {
+    JTAG_Handler    handler;      // must stay first
+
+    // SET_TAP_STATE being built
+    uint8_t         tms_bits;
+    int             tms_count;
+
+    // JTAG_SHIFT being built
+    int             shift_kind;
+    int             shift_sealed;  // last scan wrote or read only part of its bits
+    unsigned int    shift_write_bits;
+    unsigned int    shift_read_bits;
+    uint8_t         shift_data[BIC_SHIFT_MAX_BYTES];
+    int             n_reads;
+    tdo_slice       reads[BIC_SHIFT_MAX_READS];
+
+    // requests waiting for the sender thread
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bic_request     queue[BIC_QUEUE_DEPTH];
+    int             head;
+    int             count;
+    STATUS          error;
+
+    // sender thread, runs from JTAG_initialize() to JTAG_deinitialize()
+    pthread_t       sender;
+    bool            running;
+    bool            stop;
+} bic_jtag_state;
 
 static int jtag_bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
                   uint8_t *txbuf, uint8_t txlen, uint8_t *rxbuf, uint8_t *rxlen);
 
+static STATUS jtag_bic_set_tap_state(bic_jtag_state *bic, JtagStates src_state, JtagStates tap_state);
 
-
-static STATUS jtag_bic_set_tap_state(uint8_t slot_id, JtagStates src_state, JtagStates tap_state);
-
-static STATUS jtag_bic_shift_wrapper(uint8_t slot_id,
-                              unsigned int write_bit_length, uint8_t* write_data,
-                              unsigned int read_bit_length, uint8_t* read_data,
-                              unsigned int last);
-
-static STATUS jtag_bic_read_write_scan(JTAG_Handler* state, struct scan_xfer *scan_xfer);
-
-
-
-static STATUS JTAG_clock_cycle(uint8_t slot_id, int number_of_cycles);
+static STATUS JTAG_clock_cycle(bic_jtag_state *bic, int number_of_cycles);
 static STATUS perform_shift(JTAG_Handler* state , unsigned int number_of_bits,
                      unsigned int input_bytes, unsigned char* input,
                      unsigned int output_bytes, unsigned char* output,
                      JtagStates current_tap_state, JtagStates end_tap_state);
 
-
+static void *bic_sender(void *arg);
 
 
 // debug helper functions
@@ -194,6 +255,7 @@ void initialize_jtag_chains(JTAG_Handler* state) {
 
 JTAG_Handler* SoftwareJTAGHandler(uint8_t fru)
 {
+    bic_jtag_state *bic;
     JTAG_Handler *state;
 
     if ((fru < FRU_SLOT1) || (fru > FRU_SLOT4)) {
@@ -201,10 +263,11 @@ JTAG_Handler* SoftwareJTAGHandler(uint8_t fru)
       return NULL;
     }
 
-    state = (JTAG_Handler*)malloc(sizeof(JTAG_Handler));
-    if (state == NULL) {
+    bic = (bic_jtag_state*)calloc(1, sizeof(bic_jtag_state));
+    if (bic == NULL) {
         return NULL;
     }
+    state = &bic->handler;
 
     initialize_jtag_chains(state);
     state->active_chain = &state->chains[SCAN_CHAIN_0];
@@ -213,41 +276,332 @@ JTAG_Handler* SoftwareJTAGHandler(uint8_t fru)
 
     state->fru = fru;
 
+    bic->error = ST_OK;
+    pthread_mutex_init(&bic->lock, NULL);
+    pthread_cond_init(&bic->cond, NULL);
+
     return state;
 }
 
+//
+// Copy n bits, LSB first within each byte
+//
+static void copy_bits(uint8_t *dst, unsigned int dst_offset,
+                      const uint8_t *src, unsigned int src_offset,
+                      unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int s = src_offset + i;
+        unsigned int d = dst_offset + i;
+
+        if (src[s >> 3] & (1 << (s & 7)))
+            dst[d >> 3] |= (1 << (d & 7));
+        else
+            dst[d >> 3] &= ~(1 << (d & 7));
+    }
+}
+
+//
+// Send queued requests to the BIC in order. An error is kept until
+// JTAG_flush() reports it; requests queued after it are dropped.
+//
+static void *bic_sender(void *arg)
+{
+    bic_jtag_state *bic = (bic_jtag_state *)arg;
+    uint8_t rbuf[256];
+    uint8_t rlen;
+    bic_request *req;
+    STATUS ret;
 
+    for (;;) {
+        pthread_mutex_lock(&bic->lock);
+        while (bic->count == 0 && !bic->stop) {
+            pthread_cond_wait(&bic->cond, &bic->lock);
+        }
+        if (bic->count == 0) {
+            pthread_mutex_unlock(&bic->lock);
+            break;
+        }
+        req = &bic->queue[bic->head];
+        ret = bic->error;
+        pthread_mutex_unlock(&bic->lock);
+
+        if (ret == ST_OK) {
+            rlen = 0;
+            if (jtag_bic_ipmb_wrapper(bic->handler.fru, NETFN_OEM_1S_REQ,
+                                      req->cmd, req->tbuf, req->tlen,
+                                      rbuf, &rlen) < 0) {
+                ret = ST_ERR;
+            } else if (req->n_reads &&
+                       rlen < 3 + ((req->read_bits + 7) >> 3)) {
+                syslog(LOG_ERR, "%s: short JTAG_SHIFT response %d, slot%d",
+                       __FUNCTION__, rlen, bic->handler.fru);
+                ret = ST_ERR;
+            } else {
+                // ignore IANA ID
+                for (int i = 0; i < req->n_reads; i++) {
+                    tdo_slice *s = &req->reads[i];
+                    copy_bits(s->dst, s->dst_offset, &rbuf[3], s->offset,
+                              s->bits);
+                }
+            }
+        }
 
-STATUS JTAG_clock_cycle(uint8_t slot_id, int number_of_cycles)
+        pthread_mutex_lock(&bic->lock);
+        if (ret != ST_OK) {
+            bic->error = ST_ERR;
+        }
+        bic->head = (bic->head + 1) % BIC_QUEUE_DEPTH;
+        bic->count--;
+        pthread_cond_broadcast(&bic->cond);
+        pthread_mutex_unlock(&bic->lock);
+    }
+
+    return NULL;
+}
+
+static STATUS bic_start_sender(bic_jtag_state *bic)
 {
-    uint8_t tbuf[5] = {0x15, 0xA0, 0x00}; // IANA ID
-    uint8_t rbuf[4] = {0x00};
-    uint8_t rlen = 0;
-    uint8_t tlen = 5;
+    if (bic->running)
+        return ST_OK;
 
+    bic->stop = false;
+    if (pthread_create(&bic->sender, NULL, bic_sender, bic) != 0) {
+        syslog(LOG_ERR, "%s: failed to start BIC sender, slot%d",
+               __FUNCTION__, bic->handler.fru);
+        return ST_ERR;
+    }
+    bic->running = true;
 
-    if (number_of_cycles > 255)
-    {
-      syslog(LOG_ERR, "ASD: delay cycle = %d(> 255). slot%d",
-           number_of_cycles, slot_id);
-      number_of_cycles = 255;
+    return ST_OK;
+}
+
+//
+// The sender sends what is still queued before it exits
+//
+static void bic_stop_sender(bic_jtag_state *bic)
+{
+    if (!bic->running)
+        return;
+
+    pthread_mutex_lock(&bic->lock);
+    bic->stop = true;
+    pthread_cond_broadcast(&bic->cond);
+    pthread_mutex_unlock(&bic->lock);
+    pthread_join(bic->sender, NULL);
+    bic->running = false;
+}
+
+static STATUS bic_submit(bic_jtag_state *bic, const bic_request *req)
+{
+    STATUS ret;
+
+    if (!bic->running) {
+        syslog(LOG_ERR, "%s: JTAG handler not initialized, slot%d",
+               __FUNCTION__, bic->handler.fru);
+        return ST_ERR;
+    }
+
+    pthread_mutex_lock(&bic->lock);
+    while (bic->count == BIC_QUEUE_DEPTH) {
+        pthread_cond_wait(&bic->cond, &bic->lock);
     }
+    memcpy(&bic->queue[(bic->head + bic->count) % BIC_QUEUE_DEPTH], req,
+           sizeof(*req));
+    bic->count++;
+    ret = bic->error;
+    pthread_cond_broadcast(&bic->cond);
+    pthread_mutex_unlock(&bic->lock);
+
+    return ret;
+}
+
+static STATUS tms_flush(bic_jtag_state *bic)
+{
+    bic_request req;
+
+    if (bic->tms_count == 0)
+        return ST_OK;
 
     // tbuf[0:2] = IANA ID
     // tbuf[3]   = tms bit length
     // tbuf[4]   = tmsbits
-    tbuf[3] = number_of_cycles;
-    tbuf[4] = 0x0;
+    req.cmd = CMD_OEM_1S_SET_TAP_STATE;
+    req.tbuf[0] = 0x15;
+    req.tbuf[1] = 0xA0;
+    req.tbuf[2] = 0x00;
+    req.tbuf[3] = bic->tms_count;
+    req.tbuf[4] = bic->tms_bits;
+    req.tlen = 5;
+    req.read_bits = 0;
+    req.n_reads = 0;
+
+    bic->tms_count = 0;
+    bic->tms_bits = 0;
+
+#ifdef FBY2_DEBUG
+    printf("      -%s count=%d, tmsbits=0x%02x\n", __FUNCTION__,
+           req.tbuf[3], req.tbuf[4]);
+#endif
+
+    return bic_submit(bic, &req);
+}
+
+static STATUS shift_flush(bic_jtag_state *bic, int last_transaction)
+{
+    bic_request req;
+    unsigned int write_bit_length = 0;
+    unsigned int read_bit_length = 0;
+    unsigned int write_len_bytes;
+
+    if (bic->shift_kind == 0)
+        return ST_OK;
+
+    write_bit_length = bic->shift_write_bits;
+    read_bit_length = bic->shift_read_bits;
+    write_len_bytes = (write_bit_length + 7) >> 3;
+
+    // tbuf[0:2] = IANA ID
+    // tbuf[3]   = write bit length, (LSB)
+    // tbuf[4]   = write bit length, (MSB)
+    // tbuf[5:n-1] = write data
+    // tbuf[n]   = read bit length (LSB)
+    // tbuf[n+1] = read bit length (MSB)
+    // tbuf[n+2] = last transactions
+    req.cmd = CMD_OEM_1S_JTAG_SHIFT;
+    req.tbuf[0] = 0x15;
+    req.tbuf[1] = 0xA0;
+    req.tbuf[2] = 0x00;
+    req.tbuf[3] = write_bit_length & 0xFF;
+    req.tbuf[4] = (write_bit_length >> 8) & 0xFF;
+    memcpy(&req.tbuf[5], bic->shift_data, write_len_bytes);
+    req.tbuf[5 + write_len_bytes] = read_bit_length & 0xFF;
+    req.tbuf[6 + write_len_bytes] = (read_bit_length >> 8) & 0xFF;
+    req.tbuf[7 + write_len_bytes] = last_transaction;
+    req.tlen = write_len_bytes + 8;   //      write payload
+                                      //  + 3 bytes IANA ID
+                                      //  + 2 bytes WR length
+                                      //  + 2 bytes RD length
+                                      //  + 1 byte last_transaction
+    req.read_bits = read_bit_length;
+    req.n_reads = bic->n_reads;
+    memcpy(req.reads, bic->reads, bic->n_reads * sizeof(tdo_slice));
+
+    bic->shift_kind = 0;
+    bic->shift_sealed = 0;
+    bic->shift_write_bits = 0;
+    bic->shift_read_bits = 0;
+    bic->n_reads = 0;
+
+#ifdef FBY2_DEBUG
+    printf("        -%s write=%d, read=%d, last=%d\n", __FUNCTION__,
+           write_bit_length, read_bit_length, last_transaction);
+#endif
+
+    return bic_submit(bic, &req);
+}
 
-    if (jtag_bic_ipmb_wrapper(slot_id, NETFN_OEM_1S_REQ, CMD_OEM_1S_SET_TAP_STATE,
-                           tbuf, tlen, rbuf, &rlen) < 0) {
-        syslog(LOG_ERR, "wait cycle failed, slot%d", slot_id);
+//
+// Queue number_of_bits TMS clocks, bit 0 first. Clocks past the first
+// eight have TMS low.
+//
+static STATUS tms_append(bic_jtag_state *bic, uint8_t tmsbits, int number_of_bits)
+{
+    if (shift_flush(bic, 0) != ST_OK)
         return ST_ERR;
+
+    for (int i = 0; i < number_of_bits; i++) {
+        int tms = (i < BIC_TMS_BITS) && (tmsbits & (1 << i));
+
+        if (bic->tms_count == BIC_TMS_MAX_CYCLES ||
+            (tms && bic->tms_count >= BIC_TMS_BITS)) {
+            if (tms_flush(bic) != ST_OK)
+                return ST_ERR;
+        }
+        if (tms)
+            bic->tms_bits |= (1 << bic->tms_count);
+        bic->tms_count++;
     }
 
     return ST_OK;
 }
 
+//
+// Queue a scan in the current shift state, writing the first write_bits
+// and reading the first read_bits of it. Scans that write and read all or
+// none of their bits are packed with the ones before them if they move
+// data the same way; TDO is copied to output once the BIC answered.
+//
+static STATUS shift_append(bic_jtag_state *bic, unsigned int number_of_bits,
+                           unsigned int write_bits, const unsigned char *input,
+                           unsigned int read_bits, unsigned char *output)
+{
+    int kind = (write_bits ? SHIFT_WRITE : 0) | (read_bits ? SHIFT_READ : 0);
+    int uniform = (write_bits == 0 || write_bits == number_of_bits) &&
+                  (read_bits == 0 || read_bits == number_of_bits);
+    unsigned int write_done = 0;
+    unsigned int read_done = 0;
+    unsigned int done = 0;
+
+    if (tms_flush(bic) != ST_OK)
+        return ST_ERR;
+
+    if (bic->shift_kind != 0 &&
+        (bic->shift_kind != kind || bic->shift_sealed || !uniform) &&
+        shift_flush(bic, 0) != ST_OK)
+        return ST_ERR;
+
+    while (done < number_of_bits) {
+        unsigned int room = BIC_SHIFT_MAX_BITS -
+                            MAX(bic->shift_write_bits, bic->shift_read_bits);
+        unsigned int this_write = MIN(write_bits - write_done, room);
+        unsigned int this_read = MIN(read_bits - read_done, room);
+
+        if (room == 0 ||
+            (this_read && bic->n_reads == BIC_SHIFT_MAX_READS)) {
+            if (shift_flush(bic, 0) != ST_OK)
+                return ST_ERR;
+            continue;
+        }
+
+        if (this_write) {
+            copy_bits(bic->shift_data, bic->shift_write_bits, input,
+                      write_done, this_write);
+        }
+        if (this_read) {
+            tdo_slice *s = &bic->reads[bic->n_reads++];
+            s->dst = output;
+            s->dst_offset = read_done;
+            s->offset = bic->shift_read_bits;
+            s->bits = this_read;
+        }
+
+        bic->shift_kind = kind;
+        bic->shift_write_bits += this_write;
+        bic->shift_read_bits += this_read;
+        write_done += this_write;
+        read_done += this_read;
+        done += MAX(this_write, this_read);
+    }
+
+    if (!uniform)
+        bic->shift_sealed = 1;
+
+    return ST_OK;
+}
+
+STATUS JTAG_clock_cycle(bic_jtag_state *bic, int number_of_cycles)
+{
+    if (number_of_cycles > 255)
+    {
+      syslog(LOG_ERR, "ASD: delay cycle = %d(> 255). slot%d",
+           number_of_cycles, bic->handler.fru);
+      number_of_cycles = 255;
+    }
+
+    return tms_append(bic, 0x0, number_of_cycles);
+}
+
 
 STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode)
 {
@@ -259,9 +613,13 @@ STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode)
     if (state == NULL)
         return ST_ERR;
 
+    if (bic_start_sender((bic_jtag_state *)state) != ST_OK)
+        return ST_ERR;
+
     JTAG_tap_reset(state);
     if (JTAG_set_tap_state(state, JtagTLR) != ST_OK ||
-        JTAG_set_tap_state(state, JtagRTI) != ST_OK) {
+        JTAG_set_tap_state(state, JtagRTI) != ST_OK ||
+        JTAG_flush(state) != ST_OK) {
         syslog(LOG_ERR, "Failed to set initial TAP state for. slot%d",
                state->fru);
         goto bail_err;
@@ -291,6 +649,9 @@ STATUS JTAG_deinitialize(JTAG_Handler* state)
    if (state == NULL)
        return ST_ERR;
 
+    result = JTAG_flush(state);
+    bic_stop_sender((bic_jtag_state *)state);
+
     return result;
 }
 
@@ -365,8 +726,8 @@ STATUS JTAG_set_tap_state(JTAG_Handler* state, JtagStates tap_state)
     if (state == NULL)
         return ST_ERR;
 
-    ret = jtag_bic_set_tap_state(state->fru, state->active_chain->tap_state,
-                                 tap_state);
+    ret = jtag_bic_set_tap_state((bic_jtag_state *)state,
+                                 state->active_chain->tap_state, tap_state);
     if (ret != ST_OK) {
         syslog(LOG_ERR, "ERROR: %s jtag_bic_set_tap_state failed! slot%d",
                __FUNCTION__, state->fru);
@@ -470,6 +831,10 @@ STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
 
 
 
+//
+//  Optionally write and read the requested number of
+
+
 //
 //  Optionally write and read the requested number of
 //  bits and go to the requested target state
@@ -480,6 +845,9 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
                      unsigned int output_bytes, unsigned char* output,
                      JtagStates current_tap_state, JtagStates end_tap_state)
  {
+    bic_jtag_state *bic = (bic_jtag_state *)state;
+    unsigned int write_bits = 0;
+    unsigned int read_bits = 0;
 
 #ifdef FBY2_DEBUG
     int print_len = MIN(10, input_bytes);
@@ -494,24 +862,37 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
     printf("\n\n");
 #endif
 
+    if (input != NULL)
+        write_bits = MIN(input_bytes << 3, number_of_bits);
+    if (output != NULL)
+        read_bits = MIN(output_bytes << 3, number_of_bits);
 
-    struct scan_xfer scan_xfer = {0};
-    scan_xfer.length = number_of_bits;
-    scan_xfer.tdi_bytes = input_bytes;
-    scan_xfer.tdi = input;
-    scan_xfer.tdo_bytes = output_bytes;
-    scan_xfer.tdo = output;
-    scan_xfer.end_tap_state = end_tap_state;
-
+    if (write_bits < number_of_bits && read_bits < number_of_bits) {
+        syslog(LOG_ERR, "%s: ERROR: illegal input, read(%d)/write(%d) length < transfer length(%d)",
+               __FUNCTION__, read_bits, write_bits, number_of_bits);
+        return ST_ERR;
+    }
 
-    if (jtag_bic_read_write_scan(state, &scan_xfer) < 0) {
+    if (number_of_bits &&
+        shift_append(bic, number_of_bits, write_bits, input,
+                     read_bits, output) != ST_OK) {
         syslog(LOG_ERR, "%s: ERROR, BIC_JTAG_READ_WRITE_SCAN failed, slot%d",
                __FUNCTION__, state->fru);
         return ST_ERR;
     }
 
+    // the last bit of the scan leaves the shift state through Exit1
+    if (end_tap_state != current_tap_state && bic->shift_kind) {
+        if (shift_flush(bic, 1) != ST_OK) {
+            syslog(LOG_ERR, "%s: ERROR, BIC_JTAG_READ_WRITE_SCAN failed, slot%d",
+                   __FUNCTION__, state->fru);
+            return ST_ERR;
+        }
+        state->active_chain->tap_state = (current_tap_state == JtagShfDR) ? JtagEx1DR : JtagEx1IR;
+    }
+
     // go to end_tap_state as requested
-    if (jtag_bic_set_tap_state(state->fru, state->active_chain->tap_state, end_tap_state)) {
+    if (jtag_bic_set_tap_state(bic, state->active_chain->tap_state, end_tap_state)) {
         syslog(LOG_ERR, "%s: ERROR, failed to go state %d, slot%d", __FUNCTION__,
                end_tap_state, state->fru);
         return (ST_ERR);
@@ -524,6 +905,7 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
 
 #ifdef DEBUG
     {
+        // TDO is only known after JTAG_flush()
         unsigned int number_of_bytes = (number_of_bits + 7) / 8;
         const char* shiftStr = (current_tap_state == JtagShfDR) ? "DR" : "IR";
         syslog(LogType_Debug, "%s size: %d", shiftStr, number_of_bits);
@@ -531,10 +913,6 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
             syslog_buffer(LogType_Debug, input, number_of_bytes,
                            (current_tap_state == JtagShfDR) ? "DR TDI" : "IR TDI");
         }
-        if (output != NULL && number_of_bytes <= output_bytes) {
-            syslog_buffer(LogType_Debug, output, number_of_bytes,
-                           (current_tap_state == JtagShfDR) ? "DR TDO" : "IR TDO");
-        }
         syslog(LogType_Debug, "%s: End tap state: %d", shiftStr, end_tap_state);
     }
 #endif
@@ -558,7 +936,7 @@ STATUS JTAG_wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles)
     if (state == NULL)
         return ST_ERR;
 
-    if (JTAG_clock_cycle(state->fru, number_of_cycles) != ST_OK) {
+    if (JTAG_clock_cycle((bic_jtag_state *)state, number_of_cycles) != ST_OK) {
             return ST_ERR;
     }
 
@@ -578,6 +956,46 @@ STATUS JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
     return ST_OK;
 }
 
+//
+// Send everything queued so far and wait for the BIC to complete it.
+// Returns the first error any of those requests hit.
+//
+STATUS JTAG_flush(JTAG_Handler* state)
+{
+    bic_jtag_state *bic = (bic_jtag_state *)state;
+    STATUS ret;
+
+    if (state == NULL)
+        return ST_ERR;
+
+    ret = shift_flush(bic, 0);
+    if (ret == ST_OK)
+        ret = tms_flush(bic);
+
+    pthread_mutex_lock(&bic->lock);
+    while (bic->count) {
+        pthread_cond_wait(&bic->cond, &bic->lock);
+    }
+    if (ret == ST_OK)
+        ret = bic->error;
+    bic->error = ST_OK;
+    pthread_mutex_unlock(&bic->lock);
+
+    if (ret != ST_OK) {
+        syslog(LOG_ERR, "%s: BIC JTAG request failed, slot%d",
+               __FUNCTION__, state->fru);
+        bic->shift_kind = 0;
+        bic->shift_sealed = 0;
+        bic->shift_write_bits = 0;
+        bic->shift_read_bits = 0;
+        bic->n_reads = 0;
+        bic->tms_count = 0;
+        bic->tms_bits = 0;
+    }
+
+    return ret;
+}
+
 
 static
 int jtag_bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
@@ -631,31 +1049,25 @@ STATUS generateTMSbits(JtagStates src, JtagStates dst, uint8_t *length, uint8_t
     return ST_OK;
 }
 
-STATUS jtag_bic_set_tap_state(uint8_t slot_id, JtagStates src_state, JtagStates tap_state)
+STATUS jtag_bic_set_tap_state(bic_jtag_state *bic, JtagStates src_state, JtagStates tap_state)
 {
-    uint8_t tbuf[5] = {0x15, 0xA0, 0x00}; // IANA ID
-    uint8_t rbuf[4] = {0x00};
-    uint8_t rlen = 0;
-    uint8_t tlen = 5;
+    uint8_t length;
+    uint8_t tmsbits;
     STATUS ret;
 
     // if we're already are requested state,
     if (src_state == tap_state)
         return ST_OK;
 
-    // tbuf[0:2] = IANA ID
-    // tbuf[3]   = tms bit length (max = 8)
-    // tbuf[4]   = tmsbits
-
     // if goal is to set tap to JtagTLR,  send 8 TMS=1 will do it
     if (tap_state == JtagTLR) {
-        tbuf[3] = 8;
-        tbuf[4] = 0xff;
+        length = 8;
+        tmsbits = 0xff;
     }
     // ... otherwise, look up the TMS sequence to go from current state
     // to tap_state
     else {
-        ret = generateTMSbits(src_state, tap_state, &(tbuf[3]), &(tbuf[4]));
+        ret = generateTMSbits(src_state, tap_state, &length, &tmsbits);
         if (ret != ST_OK) {
             syslog(LOG_ERR, "ERROR: __%s__ failed to find path from state%d to state%d\n",
                    __FUNCTION__, src_state, tap_state);
@@ -665,169 +1077,16 @@ STATUS jtag_bic_set_tap_state(uint8_t slot_id, JtagStates src_state, JtagStates
 
     // add delay count for 2 special cases
     if ((tap_state == JtagRTI) || (tap_state == JtagPauDR)) {
-        tbuf[3] += 5;
+        length += 5;
     }
 
 #ifdef FBY2_DEBUG
     printf("      -%s src_state=%d(%s), dst_state=%d(%s), count=%d, tmsbits=0x%02x\n",
            __FUNCTION__, src_state, tap_states_name[src_state],
-           tap_state, tap_states_name[tap_state], tbuf[3], tbuf[4]);
+           tap_state, tap_states_name[tap_state], length, tmsbits);
 #endif
 
-
-    ret = jtag_bic_ipmb_wrapper(slot_id, NETFN_OEM_1S_REQ, CMD_OEM_1S_SET_TAP_STATE,
-                           tbuf, tlen, rbuf, &rlen);
-
-    return ret;
-}
-
-static
-STATUS jtag_bic_shift_wrapper(uint8_t slot_id, unsigned int write_bit_length,
-                              unsigned char* write_data, unsigned int read_bit_length,
-                              unsigned char* read_data, unsigned int last_transaction)
-{
-    uint8_t tbuf[256] = {0x15, 0xA0, 0x00}; // IANA ID
-    uint8_t rbuf[256] = {0x00};
-    uint8_t rlen = 0;
-    uint8_t tlen = 0;
-    STATUS ret;
-
-    // round up to next byte boundary
-    uint8_t  write_len_bytes = ((write_bit_length+7) >> 3);
-
-#ifdef FBY2_DEBUG
-    printf("        -%s\n", __FUNCTION__);
-    printf("              - write_bit_length=%d (0x%02x)\n", write_bit_length, write_bit_length);
-    printf("              - read_bit_length=%d (0x%02x)\n", read_bit_length, read_bit_length);
-    printf("              - last_transaction=%d\n\n", last_transaction);
-#endif
-    // tbuf[0:2] = IANA ID
-    // tbuf[3]   = write bit length, (LSB)
-    // tbuf[4]   = write bit length, (MSB)
-    // tbuf[5:n-1] = write data
-    // tbuf[n]   = read bit length (LSB)
-    // tbuf[n+1] = read bit length (MSB)
-    // tbuf[n+2] = last transactions
-
-    tbuf[3] = write_bit_length & 0xFF;
-    tbuf[4] = (write_bit_length >> 8) & 0xFF;
-    memcpy(&(tbuf[5]), write_data, write_len_bytes);
-    tbuf[5 + write_len_bytes] = read_bit_length & 0xFF;
-    tbuf[6 + write_len_bytes] = (read_bit_length >> 8) & 0xFF;
-    tbuf[7 + write_len_bytes] = last_transaction;
-
-    tlen    = write_len_bytes + 8;  //      write payload
-                                    //  + 3 bytes IANA ID
-                                    //  + 2 bytes WR length
-                                    //  + 2 bytes RD length
-                                    //  + 1 byte last_transaction
-
-    ret = jtag_bic_ipmb_wrapper(slot_id, NETFN_OEM_1S_REQ, CMD_OEM_1S_JTAG_SHIFT,
-                                tbuf, tlen, rbuf, &rlen);
-
-#ifdef FBY2_DEBUG
-    int print_len = MIN(10, (read_bit_length>>3));
-    printf("        -%s\n", __FUNCTION__);
-    printf("              - ret=%d, rlen=%d\n", ret, rlen);
-    printf("              - first %d bytes of return data\n", print_len);
-    printf("          ");
-    for (int i=0; i<print_len; ++i) {
-        printf("0x%02x ", rbuf[i]) ;
-    }
-    printf("\n\n");
-#endif
-
-    if (ret == ST_OK) {
-        //Ignore IANA ID
-        memcpy(read_data, &rbuf[3], rlen-3);
-    }
-    return ret;
-}
-
-// BIC JTAG driver
-static
-STATUS jtag_bic_read_write_scan(JTAG_Handler* state, struct scan_xfer *scan_xfer)
-{
-#define MAX_TRANSFER_BITS  0x400
-
-    int write_bit_length    = (scan_xfer->tdi_bytes)<<3;
-    int read_bit_length     = (scan_xfer->tdo_bytes)<<3;
-    int transfer_bit_length = scan_xfer->length;
-    int last_transaction    = 0;
-    int slot_id             = state->fru;
-    STATUS ret = ST_OK;
-    unsigned char *tdi_buffer, *tdo_buffer;
-
-
-#ifdef FBY2_DEBUG
-    printf("        -%s initial value:\n", __FUNCTION__);
-    printf("              - transfer_bit_length=%d\n", transfer_bit_length);
-    printf("              - write_bit_length=%d\n", write_bit_length);
-    printf("              - read_bit_length =%d\n\n", read_bit_length);
-#endif
-
-    if (write_bit_length < transfer_bit_length &&
-        read_bit_length < transfer_bit_length)
-    {
-#ifdef FBY2_DEBUG
-        printf("%s: ERROR: illegal input, read(%d)/write(%d) length < transfer length(%d)\n",
-               __FUNCTION__, read_bit_length, write_bit_length, transfer_bit_length);
-#endif
-        syslog(LOG_ERR, "%s: ERROR: illegal input, read(%d)/write(%d) length < transfer length(%d)",
-               __FUNCTION__, read_bit_length, write_bit_length, transfer_bit_length);
-        return ST_ERR;
-    }
-
-    write_bit_length = MIN(write_bit_length, transfer_bit_length);
-    read_bit_length  = MIN(read_bit_length, transfer_bit_length);
-    tdi_buffer = scan_xfer->tdi;
-    tdo_buffer = scan_xfer->tdo;
-    while (transfer_bit_length)
-    {
-        int this_write_bit_length = MIN(write_bit_length, MAX_TRANSFER_BITS);
-        int this_read_bit_length  = MIN(read_bit_length, MAX_TRANSFER_BITS);
-
-        // check if we entered illegal state
-        if (    this_write_bit_length < 0  || this_read_bit_length < 0
-            || last_transaction == 1
-            || (this_write_bit_length == 0 && this_read_bit_length ==0) ) {
-            syslog(LOG_ERR, "ASD_SP02: slot=%d, ERROR: invalid read write length. read=%d, write=%d, last_transaction=%d\n",
-                    slot_id, this_read_bit_length, this_write_bit_length,
-                    last_transaction);
-            return ST_ERR;
-        }
-
-        transfer_bit_length -= MAX(this_write_bit_length, this_read_bit_length);
-        if (transfer_bit_length) {
-            syslog(LOG_DEBUG, "ASD_SP01: slot=%d, multi loop transfer %d",
-                   slot_id, transfer_bit_length);
-        }
-
-        write_bit_length -= this_write_bit_length;
-        read_bit_length  -= this_read_bit_length;
-
-        last_transaction =     (transfer_bit_length <= 0)
-                            && (scan_xfer->end_tap_state != JtagShfDR)
-                            && (scan_xfer->end_tap_state != JtagShfIR);
-
-        ret = jtag_bic_shift_wrapper(slot_id, this_write_bit_length, tdi_buffer,
-                                     this_read_bit_length, tdo_buffer,
-                                     last_transaction);
-
-        if (last_transaction) {
-            state->active_chain->tap_state = (state->active_chain->tap_state == JtagShfDR) ? JtagEx1DR : JtagEx1IR;
-        }
-
-        tdi_buffer += (this_write_bit_length >> 3);
-        tdo_buffer += (this_read_bit_length >> 3);
-        if (ret != ST_OK) {
-            syslog(LOG_ERR, "%s: ERROR, jtag_bic_shift_wrapper failed, slot%d",
-                   __FUNCTION__, slot_id);
-            break;
-        }
-  }
-
-  return ret;
+    return tms_append(bic, tmsbits, length);
 }
 
 STATUS JTAG_set_active_chain(JTAG_Handler* state, scanChain chain) {
@@ -0,0 +1,287 @@
+/*
+ *
+ * Copyright 2015-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <openbmc/pal.h>
+#include <facebook/bic.h>
+#include "SoftwareJTAGHandler.h"
+
+/*
+ * The fby2 JTAG handler is linked against the BIC model below instead of
+ * libbic. The model runs the TAP state machine of one device behind the
+ * BIC and takes about as long as a real IPMB round trip, so the same ASD
+ * style workload can be timed with a flush after every operation (what
+ * the handler used to do) and with one flush per ASD message.
+ */
+
+#define IR_LEN        11
+#define IR_CAPTURE    0x001
+#define IR_IDCODE     0x002
+#define IR_BYPASS     0x7ff
+#define DEV_IDCODE    0x0a5b1013
+
+#define REQ_USEC      1000    // IPMB round trip to the BIC
+#define BYTE_USEC     90      // per byte on the IPMB bus
+
+#define OPS_PER_MSG   16
+
+static pthread_mutex_t bic_lock = PTHREAD_MUTEX_INITIALIZER;
+static JtagStates tap = JtagTLR;
+static uint32_t ir, ir_sr;
+static uint64_t dr_sr;
+static unsigned long requests;
+
+static const uint8_t next_state[16][2] = {
+  /* TLR   */ {JtagRTI,   JtagTLR},
+  /* RTI   */ {JtagRTI,   JtagSelDR},
+  /* SelDR */ {JtagCapDR, JtagSelIR},
+  /* CapDR */ {JtagShfDR, JtagEx1DR},
+  /* ShfDR */ {JtagShfDR, JtagEx1DR},
+  /* Ex1DR */ {JtagPauDR, JtagUpdDR},
+  /* PauDR */ {JtagPauDR, JtagEx2DR},
+  /* Ex2DR */ {JtagShfDR, JtagUpdDR},
+  /* UpdDR */ {JtagRTI,   JtagSelDR},
+  /* SelIR */ {JtagCapIR, JtagTLR},
+  /* CapIR */ {JtagShfIR, JtagEx1IR},
+  /* ShfIR */ {JtagShfIR, JtagEx1IR},
+  /* Ex1IR */ {JtagPauIR, JtagUpdIR},
+  /* PauIR */ {JtagPauIR, JtagEx2IR},
+  /* Ex2IR */ {JtagShfIR, JtagUpdIR},
+  /* UpdIR */ {JtagRTI,   JtagSelDR},
+};
+
+static int
+dr_len(void) {
+  return (ir == IR_IDCODE) ? 32 : 1;
+}
+
+static int
+tck(int tms, int tdi) {
+  int tdo = 0;
+
+  switch (tap) {
+    case JtagTLR:
+      ir = IR_IDCODE;
+      break;
+    case JtagCapDR:
+      dr_sr = (ir == IR_IDCODE) ? DEV_IDCODE : 0;
+      break;
+    case JtagShfDR:
+      tdo = dr_sr & 1;
+      dr_sr = (dr_sr >> 1) | ((uint64_t)tdi << (dr_len() - 1));
+      break;
+    case JtagCapIR:
+      ir_sr = IR_CAPTURE;
+      break;
+    case JtagShfIR:
+      tdo = ir_sr & 1;
+      ir_sr = (ir_sr >> 1) | (tdi << (IR_LEN - 1));
+      break;
+    case JtagUpdIR:
+      ir = ir_sr;
+      break;
+    default:
+      break;
+  }
+  tap = next_state[tap][tms];
+  return tdo;
+}
+
+int
+bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd, uint8_t *txbuf,
+                 uint16_t txlen, uint8_t *rxbuf, uint8_t *rxlen) {
+  int i, wr, rd, n, last;
+
+  assert(slot_id == FRU_SLOT1);
+  assert(netfn == NETFN_OEM_1S_REQ);
+  assert(txlen <= 255 - 5);
+
+  pthread_mutex_lock(&bic_lock);
+  requests++;
+  memcpy(rxbuf, txbuf, 3);
+  *rxlen = 3;
+
+  if (cmd == CMD_OEM_1S_SET_TAP_STATE) {
+    assert(txlen == 5);
+    for (i = 0; i < txbuf[3]; i++) {
+      tck(i < 8 && (txbuf[4] & (1 << i)), 0);
+    }
+  } else {
+    assert(cmd == CMD_OEM_1S_JTAG_SHIFT);
+    assert(tap == JtagShfDR || tap == JtagShfIR);
+    wr = txbuf[3] | (txbuf[4] << 8);
+    rd = txbuf[5 + (wr + 7) / 8] | (txbuf[6 + (wr + 7) / 8] << 8);
+    last = txbuf[7 + (wr + 7) / 8];
+    assert(txlen == (wr + 7) / 8 + 8);
+    n = (wr > rd) ? wr : rd;
+    memset(&rxbuf[3], 0, (rd + 7) / 8);
+    for (i = 0; i < n; i++) {
+      int tdi = (i < wr) && (txbuf[5 + i / 8] & (1 << (i % 8)));
+      int tdo = tck(last && i == n - 1, tdi);
+      if (i < rd && tdo) {
+        rxbuf[3 + i / 8] |= 1 << (i % 8);
+      }
+    }
+    *rxlen = 3 + (rd + 7) / 8;
+  }
+  pthread_mutex_unlock(&bic_lock);
+
+  usleep(REQ_USEC + BYTE_USEC * (txlen + *rxlen));
+  return 0;
+}
+
+#define CHECK(x) do {                     \
+  if ((x) != ST_OK) {                     \
+    printf("FAIL: %s\n", #x);             \
+    exit(1);                              \
+  }                                       \
+} while (0)
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * One ASD message worth of operations per iteration: an IR scan, DR
+ * reads left in ShiftDR and finished with a write, and wait cycles.
+ * TDO lands in tdo[], the flush policy decides when it is valid.
+ */
+static int
+run(JTAG_Handler *h, int iterations, int flush_each, uint8_t *tdo) {
+  uint8_t idcode_ir[2] = {IR_IDCODE & 0xff, IR_IDCODE >> 8};
+  uint8_t bypass_ir[2] = {IR_BYPASS & 0xff, IR_BYPASS >> 8};
+  uint8_t pattern[4] = {0xef, 0xbe, 0xad, 0xde};
+  int i, j, scans = 0, ops = 0;
+  double start;
+
+#define OP(x) do {                        \
+  CHECK(x);                               \
+  if (flush_each || ++ops % OPS_PER_MSG == 0) \
+    CHECK(JTAG_flush(h));                 \
+} while (0)
+
+  start = now();
+  for (i = 0; i < iterations; i++) {
+    OP(JTAG_set_tap_state(h, JtagShfIR));
+    OP(JTAG_shift(h, IR_LEN, sizeof(idcode_ir), idcode_ir, 2, tdo, JtagRTI));
+    tdo += 2;
+    OP(JTAG_set_tap_state(h, JtagShfDR));
+    for (j = 0; j < 4; j++) {
+      OP(JTAG_shift(h, 8, 0, NULL, 1, tdo, JtagShfDR));
+      tdo += 1;
+    }
+    OP(JTAG_shift(h, 32, sizeof(pattern), pattern, 4, tdo, JtagRTI));
+    tdo += 4;
+    OP(JTAG_wait_cycles(h, 20));
+    OP(JTAG_set_tap_state(h, JtagShfIR));
+    OP(JTAG_shift(h, IR_LEN, sizeof(bypass_ir), bypass_ir, 0, NULL, JtagPauIR));
+    OP(JTAG_set_tap_state(h, JtagShfDR));
+    OP(JTAG_shift(h, 16, sizeof(pattern), pattern, 2, tdo, JtagRTI));
+    tdo += 2;
+    scans += 8;
+  }
+  CHECK(JTAG_flush(h));
+
+  return (int)(scans / (now() - start));
+}
+
+int
+main(int argc, char **argv) {
+  int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+  size_t tdo_size = iterations * 12;
+  uint8_t *tdo_before = calloc(1, tdo_size);
+  uint8_t *tdo_after = calloc(1, tdo_size);
+  uint8_t pattern[8] = {0x0d, 0xf0, 0xd4, 0xba, 0xef, 0xbe, 0xad, 0xde};
+  uint8_t out[24];
+  unsigned long req_before, req_after;
+  int rate_before, rate_after;
+  JtagStates state;
+  JTAG_Handler *h;
+  int i;
+
+  h = SoftwareJTAGHandler(FRU_SLOT1);
+  assert(h != NULL && tdo_before != NULL && tdo_after != NULL);
+  CHECK(JTAG_initialize(h, true));
+
+  // jtagtest's discovery: 192 bits read, only the first 64 written
+  CHECK(JTAG_set_tap_state(h, JtagShfDR));
+  memset(out, 0xff, sizeof(out));
+  CHECK(JTAG_shift(h, 192, sizeof(pattern), pattern, sizeof(out), out,
+                   JtagRTI));
+  CHECK(JTAG_flush(h));
+  assert(out[0] == 0x13 && out[1] == 0x10 && out[2] == 0x5b && out[3] == 0x0a);
+  assert(memcmp(&out[4], pattern, sizeof(pattern)) == 0);
+
+  requests = 0;
+  rate_before = run(h, iterations, 1, tdo_before);
+  req_before = requests;
+
+  CHECK(JTAG_tap_reset(h));
+  CHECK(JTAG_set_tap_state(h, JtagRTI));
+  CHECK(JTAG_flush(h));
+
+  requests = 0;
+  rate_after = run(h, iterations, 0, tdo_after);
+  req_after = requests;
+
+  for (i = 0; i < iterations; i++) {
+    uint8_t *t = &tdo_after[i * 12];
+    assert((t[0] | (t[1] << 8)) == IR_CAPTURE);
+    assert(t[2] == 0x13 && t[3] == 0x10 && t[4] == 0x5b && t[5] == 0x0a);
+    // the reads above shifted zeros into the IDCODE register
+    assert(t[6] == 0 && t[7] == 0 && t[8] == 0 && t[9] == 0);
+    // one bypass bit, then the pattern
+    assert(t[10] == 0xde && t[11] == 0x7d);
+  }
+  assert(memcmp(tdo_before, tdo_after, tdo_size) == 0);
+
+  CHECK(JTAG_get_tap_state(h, &state));
+  assert(state == tap);
+
+  printf("flush per operation: %lu BIC requests, %d scans/s\n",
+         req_before, rate_before);
+  printf("flush per message:   %lu BIC requests, %d scans/s\n",
+         req_after, rate_after);
+  assert(req_after < req_before);
+
+  CHECK(JTAG_deinitialize(h));
+  // nothing goes to the BIC without a session, and the next one works
+  CHECK(JTAG_set_tap_state(h, JtagShfDR));
+  assert(JTAG_flush(h) != ST_OK);
+  CHECK(JTAG_initialize(h, true));
+  CHECK(JTAG_set_tap_state(h, JtagShfDR));
+  memset(out, 0xff, sizeof(out));
+  CHECK(JTAG_shift(h, 32, 0, NULL, sizeof(out), out, JtagRTI));
+  CHECK(JTAG_flush(h));
+  assert(out[0] == 0x13 && out[1] == 0x10 && out[2] == 0x5b && out[3] == 0x0a);
+  CHECK(JTAG_deinitialize(h));
+  free(h);
+  printf("All tests passed\n");
+  return 0;
+}
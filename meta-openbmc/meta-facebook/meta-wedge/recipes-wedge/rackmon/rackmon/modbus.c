@@ -38,7 +38,10 @@ int waitfd(int fd) {
     int lsr;
     int ret = ioctl(fd, TIOCSERGETLSR, &lsr);
     if(ret == -1) {
-      fprintf(stderr, "Error checking LSR: %s\n", strerror(errno));
+      // not a UART (e.g. a pty under modbussim), nothing to drain
+      if(errno != ENOTTY) {
+        fprintf(stderr, "Error checking LSR: %s\n", strerror(errno));
+      }
       break;
     }
     if(lsr & TIOCSER_TEMT) break;
@@ -68,26 +71,32 @@ void print_hex(FILE* f, char* buf, size_t len) {
 }
 
 size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us) {
+  return read_frame(fd, dst, maxlen, mdelay_us, mdelay_us);
+}
+
+size_t read_frame(int fd, char* dst, size_t maxlen, int timeout_us, int gap_us) {
   fd_set fdset;
   struct timeval timeout;
   char read_buf[16];
-  size_t read_size = 0;
+  ssize_t read_size = 0;
   size_t pos = 0;
   memset(dst, 0, maxlen);
   while(pos < maxlen) {
+    int wait_us = pos == 0 ? timeout_us : gap_us;
     FD_ZERO(&fdset);
     FD_SET(fd, &fdset);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = mdelay_us;
-    int rv = select(fd + 1, &fdset, NULL, NULL, &timeout);
+    timeout.tv_sec = wait_us / 1000000;
+    timeout.tv_usec = wait_us % 1000000;
+    int rv = select(fd + 1, &fdset, NULL, NULL, wait_us < 0 ? NULL : &timeout);
     if(rv == -1) {
+      if(errno == EINTR) continue;
       perror("select()");
     } else if (rv == 0) {
       break;
     }
     read_size = read(fd, read_buf, 16);
     if(read_size < 0) {
-      if(errno == EAGAIN) continue;
+      if(errno == EAGAIN || errno == EINTR) continue;
       fprintf(stderr, "read error: %s\n", strerror(errno));
       exit(1);
     }
@@ -102,6 +111,23 @@ size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us) {
   return pos;
 }
 
+int modbus_frame_gap_us(speed_t speed) {
+  int baud;
+  switch(speed) {
+    case B9600:   baud = 9600; break;
+    case B19200:  baud = 19200; break;
+    case B38400:  baud = 38400; break;
+    case B57600:  baud = 57600; break;
+    case B115200: baud = 115200; break;
+    default:      baud = 19200; break;
+  }
+  // RTU ends a frame after 3.5 characters of silence, but the UART hands
+  // bytes over a FIFO at a time, so allow for a full FIFO (16 bytes) plus
+  // its receive timeout. A character is 11 bits with parity.
+  int gap_us = 24 * 11 * 1000000 / baud;
+  return gap_us < 5000 ? 5000 : gap_us;
+}
+
 /* From libmodbus, https://github.com/stephane/libmodbus
  * Under LGPL. */
 /* Table of CRC values for high-order byte */
@@ -256,7 +282,8 @@ int modbuscmd(modbus_req *req) {
     if(req->expected_len > req->dest_limit) {
       return -1;
     }
-    mb_pos = read_wait(req->tty_fd, req->dest_buf, req->expected_len, req->timeout);
+    mb_pos = read_frame(req->tty_fd, req->dest_buf, req->expected_len,
+        req->timeout, modbus_frame_gap_us(cfgetispeed(&tio)));
     clock_gettime(CLOCK_MONOTONIC_RAW, &read_end);
     req->dest_len = mb_pos;
     if(mb_pos >= 4) {
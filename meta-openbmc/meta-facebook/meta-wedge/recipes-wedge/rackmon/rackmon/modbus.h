@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <termios.h>
 uint16_t modbus_crc16(char* buffer, size_t length);
 
 #define DEFAULT_TTY "/dev/ttyS3"
@@ -53,6 +54,13 @@ void print_hex(FILE* f, char* buf, size_t len);
 // Read until maxlen bytes or no bytes in mdelay_us microseconds
 size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us);
 
+// Read one frame: wait up to timeout_us for its first byte (forever if
+// negative), then until maxlen bytes or no bytes in gap_us microseconds
+size_t read_frame(int fd, char* dst, size_t maxlen, int timeout_us, int gap_us);
+
+// Silence on the line that ends a frame at the given termios speed
+int modbus_frame_gap_us(speed_t speed);
+
 
 typedef struct _modbus_req {
   int tty_fd;
@@ -26,24 +26,147 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <getopt.h>
+#include <time.h>
 #include <linux/serial.h>
 #include "modbus.h"
 
 void usage() {
   fprintf(stderr,
       "modbussim [-v] [-t <tty>] modbus_request modbus_reply\n"
-      "\ttty defaults to %s\n"
+      "modbussim [-v] [-t <tty>] -s <psus> [-d <dead>] [-l <latency_us>]\n"
+      "\ttty defaults to %s, or a new pty with -s\n"
       "\tmodbus request/reply should be specified in hex\n"
-      "\teg:\ta40300000008\n",
+      "\teg:\ta40300000008\n"
+      "\t-s answers register reads as <psus> PSUs; the last <dead> of\n"
+      "\tthem only answer the presence scan. Replies are delayed by the\n"
+      "\ttime the frames take on the wire plus <latency_us> (default 2000)\n",
       DEFAULT_TTY);
   exit(1);
 }
 
+#define REGISTER_PSU_STATUS 0x68
+#define REGISTER_OUTPUT_POWER 0x96
+#define SIM_MAX_REGISTER 0x200
+#define SIM_CHAR_US (11 * 1000000 / 19200)
+#define SIM_REPORT_EVERY 10
+
+static char psu_address(int n) {
+  // same numbering as rackmond's scan: rack, shelf, psu
+  int rack = n / 6, shelf = (n / 3) % 2, psu = n % 3;
+  return 0xA0 | ((rack & 3) << 3) | ((shelf & 1) << 2) | (psu & 3);
+}
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Answer register reads for a shelf of PSUs and report how often rackmond
+// gets around to reading their output power. tio is the tty's settings,
+// or NULL for a pty.
+int simulate(int fd, struct termios *tio, int psus, int dead, int latency_us) {
+  char req[255];
+  char res[255];
+  long requests = 0, unanswered = 0, power_reads = 0;
+  double report_at = now_s() + SIM_REPORT_EVERY;
+  int gap_us = modbus_frame_gap_us(B19200);
+
+  while(1) {
+    size_t len = read_frame(fd, req, sizeof(req), 1000000, gap_us);
+    double now = now_s();
+    if(now >= report_at) {
+      printf("%.1f requests/s, %.2f power readings/s per PSU, "
+             "%.1f unanswered/s\n",
+             (double) requests / SIM_REPORT_EVERY,
+             (double) power_reads / SIM_REPORT_EVERY / (psus - dead),
+             (double) unanswered / SIM_REPORT_EVERY);
+      fflush(stdout);
+      requests = unanswered = power_reads = 0;
+      report_at = now + SIM_REPORT_EVERY;
+    }
+    if(len < 4) {
+      continue;
+    }
+    uint16_t crc = modbus_crc16(req, len - 2);
+    if((uint8_t)req[len - 2] != (crc >> 8) ||
+       (uint8_t)req[len - 1] != (crc & 0x00FF)) {
+      fprintf(stderr, "Got data that failed modbus CRC.\n");
+      continue;
+    }
+    requests++;
+
+    int n;
+    for(n = 0; n < psus && psu_address(n) != req[0]; n++);
+    if(n == psus || len != 8) {
+      unanswered++;
+      continue;
+    }
+    int begin = ((uint8_t)req[2] << 8) | (uint8_t)req[3];
+    int num = ((uint8_t)req[4] << 8) | (uint8_t)req[5];
+    if(n >= psus - dead &&
+       !(begin == REGISTER_PSU_STATUS && num == 1)) {
+      unanswered++;
+      continue;
+    }
+
+    size_t res_len = 0;
+    res[res_len++] = req[0];
+    if(req[1] != MODBUS_READ_HOLDING_REGISTERS) {
+      res[res_len++] = req[1] | 0x80;
+      res[res_len++] = 1; // illegal function
+    } else if(num < 1 || num > 125 || begin + num > SIM_MAX_REGISTER) {
+      res[res_len++] = req[1] | 0x80;
+      res[res_len++] = 2; // illegal data address
+    } else {
+      res[res_len++] = req[1];
+      res[res_len++] = num * 2;
+      for(int r = begin; r < begin + num; r++) {
+        res[res_len++] = n;
+        res[res_len++] = r;
+      }
+      if(begin <= REGISTER_OUTPUT_POWER &&
+         REGISTER_OUTPUT_POWER < begin + num) {
+        power_reads++;
+      }
+    }
+    append_modbus_crc16(res, &res_len);
+    usleep((len + res_len) * SIM_CHAR_US + latency_us);
+    if(tio) {
+      // Disable UART read
+      tio->c_cflag &= ~CREAD;
+      tcsetattr(fd, TCSANOW, tio);
+    }
+    write(fd, res, res_len);
+    if(tio) {
+      waitfd(fd);
+      tio->c_cflag |= CREAD;
+      tcsetattr(fd, TCSANOW, tio);
+    }
+  }
+  return 0;
+}
+
+int open_pty() {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    return -1;
+  }
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+  printf("%s\n", ptsname(fd));
+  fflush(stdout);
+  return fd;
+}
+
 int main(int argc, char **argv) {
     int error = 0;
     int fd;
     struct termios tio;
-    char *tty = DEFAULT_TTY;
+    char *tty = NULL;
+    int psus = 0, dead = 0, latency_us = 2000;
     char *modbus_cmd = NULL;
     char *modbus_reply = NULL;
     size_t cmd_len = 0;
@@ -51,12 +174,21 @@ int main(int argc, char **argv) {
     verbose = 0;
 
     int opt;
-    while((opt = getopt(argc, argv, "t:g:v"))) {
+    while((opt = getopt(argc, argv, "t:g:vs:d:l:"))) {
       if (opt == -1) break;
       switch (opt) {
       case 't':
         tty = optarg;
         break;
+      case 's':
+        psus = atoi(optarg);
+        break;
+      case 'd':
+        dead = atoi(optarg);
+        break;
+      case 'l':
+        latency_us = atoi(optarg);
+        break;
       case 'v':
         verbose = 1;
         break;
@@ -65,13 +197,25 @@ int main(int argc, char **argv) {
         break;
       }
     }
-    if(optind < argc) {
+    if(psus > 0) {
+      if(psus > 18 || dead >= psus) {
+        usage();
+      }
+      if(tty == NULL) {
+        fd = open_pty();
+        CHECKP(pty, fd);
+        return simulate(fd, NULL, psus, dead, latency_us);
+      }
+    } else if(optind + 1 < argc) {
       modbus_cmd = argv[optind++];
       modbus_reply = argv[optind++];
     }
-    if(modbus_cmd == NULL || modbus_reply == NULL) {
+    if(psus == 0 && (modbus_cmd == NULL || modbus_reply == NULL)) {
       usage();
     }
+    if(tty == NULL) {
+      tty = DEFAULT_TTY;
+    }
 
     if (verbose)
       fprintf(stderr, "[*] Opening TTY\n");
@@ -101,6 +245,12 @@ int main(int argc, char **argv) {
     tio.c_cc[VTIME] = 0;
     CHECK(tcsetattr(fd,TCSANOW,&tio));
 
+    if(psus > 0) {
+      tio.c_cflag |= CREAD;
+      CHECK(tcsetattr(fd,TCSANOW,&tio));
+      return simulate(fd, &tio, psus, dead, latency_us);
+    }
+
     //convert hex to bytes
     cmd_len = strlen(modbus_cmd);
     if(cmd_len < 2) {
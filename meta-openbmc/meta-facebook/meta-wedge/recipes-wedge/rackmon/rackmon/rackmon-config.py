@@ -1,20 +1,29 @@
 from rackmond import configure_rackmond
 
+# "interval" is the least number of seconds between reads of a range;
+# FRU and battery information strings hardly ever change.
 reglist = [
     {"begin": 0x0, #MFR_MODEL
-     "length": 8},
+     "length": 8,
+     "interval": 60},
     {"begin": 0x10, #MFR_DATE
-     "length": 8},
+     "length": 8,
+     "interval": 60},
     {"begin": 0x20, #FB Part #
-     "length": 8},
+     "length": 8,
+     "interval": 60},
     {"begin": 0x30, #HW Revision
-     "length": 4},
+     "length": 4,
+     "interval": 60},
     {"begin": 0x38, #FW Revision
-     "length": 4},
+     "length": 4,
+     "interval": 60},
     {"begin": 0x40, #MFR Serial #
-     "length": 16},
+     "length": 16,
+     "interval": 60},
     {"begin": 0x60, #Workorder #
-     "length": 4},
+     "length": 4,
+     "interval": 60},
     {"begin": 0x68, #PSU Status
      "length": 1,
      "keep": 10,   # 10-sample ring buffer
@@ -146,12 +155,14 @@ reglist = [
      "length": 1,
      "keep": 10},
     {"begin": 0x95, #BBU Design Capacity
-     "length": 1},
+     "length": 1,
+     "interval": 60},
     {"begin": 0x96, #Output Power
      "length": 1,
      "keep": 10},
     {"begin": 0x97, #BBU Design Voltage
-     "length": 1},
+     "length": 1,
+     "interval": 60},
     {"begin": 0x98, #RPM Fan 0
      "length": 1},
     {"begin": 0x99, #BBU At Rate
@@ -194,19 +205,26 @@ reglist = [
     {"begin": 0xD9, #Communication Alarm Status Register
      "length": 1},
     {"begin": 0x106, #BBU Specification Info
-     "length": 1},
+     "length": 1,
+     "interval": 60},
     {"begin": 0x107, #BBU Manufacturer Date
-     "length": 1},
+     "length": 1,
+     "interval": 60},
     {"begin": 0x108, #BBU Serial Number
-     "length": 1},
+     "length": 1,
+     "interval": 60},
     {"begin": 0x109, #BBU Device Chemistry
-     "length": 2},
+     "length": 2,
+     "interval": 60},
     {"begin": 0x10B, #BBU Manufacturer Data
-     "length": 2},
+     "length": 2,
+     "interval": 60},
     {"begin": 0x10D, #BBU Manufacturer Name
-     "length": 8},
+     "length": 8,
+     "interval": 60},
     {"begin": 0x115, #BBU Device Name
-     "length": 8},
+     "length": 8,
+     "interval": 60},
     {"begin": 0x11D, #FB Battery Status
      "length": 4},
     {"begin": 0x121, #SoH results
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2014-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rackmon_shm.h"
+
+static inline uint32_t seq_read(const uint32_t* seq) {
+  return *(volatile const uint32_t*) seq;
+}
+
+static inline void seq_write(uint32_t* seq, uint32_t val) {
+  *(volatile uint32_t*) seq = val;
+}
+
+// Mark a segment left behind by a previous rackmond as gone, so that
+// readers still mapping it move on to the new one
+static void retire(const char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    return;
+  }
+  rackmon_shm* old = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  if (old != MAP_FAILED) {
+    seq_write(&old->magic, 0);
+    munmap(old, sizeof(uint32_t));
+  }
+  close(fd);
+}
+
+rackmon_shm* rackmon_shm_create(const char* name, int num_ranges,
+    const uint16_t* begin, const uint16_t* len) {
+  rackmon_shm* shm;
+  uint32_t offset = 0;
+  int fd;
+
+  if (num_ranges > RACKMON_SHM_MAX_RANGES) {
+    return NULL;
+  }
+  for (int i = 0; i < num_ranges; i++) {
+    offset += len[i];
+  }
+  if (offset > RACKMON_SHM_MAX_REGS) {
+    return NULL;
+  }
+
+  retire(name);
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(rackmon_shm)) < 0) {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  shm = mmap(NULL, sizeof(rackmon_shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  shm->version = RACKMON_SHM_VERSION;
+  shm->size = sizeof(rackmon_shm);
+  shm->num_ranges = num_ranges;
+  shm->num_regs = offset;
+  offset = 0;
+  for (int i = 0; i < num_ranges; i++) {
+    shm->ranges[i].begin = begin[i];
+    shm->ranges[i].len = len[i];
+    shm->ranges[i].offset = offset;
+    offset += len[i];
+  }
+  __sync_synchronize();
+  seq_write(&shm->magic, RACKMON_SHM_MAGIC);
+  return shm;
+}
+
+void rackmon_shm_update(rackmon_shm* shm, uint8_t addr, int first, int count,
+    uint32_t time, const uint16_t* regs,
+    uint32_t crc_errors, uint32_t timeout_errors) {
+  rackmon_shm_psu* psu;
+  uint32_t seq;
+
+  if (shm == NULL || first < 0 || first + count > shm->num_ranges) {
+    return;
+  }
+  psu = &shm->psus[RACKMON_SHM_SLOT(addr)];
+  seq = psu->seq;
+
+  seq_write(&psu->seq, seq + 1);
+  __sync_synchronize();
+  psu->addr = addr;
+  psu->present = 1;
+  psu->crc_errors = crc_errors;
+  psu->timeout_errors = timeout_errors;
+  for (int i = first; i < first + count; i++) {
+    rackmon_shm_range* r = &shm->ranges[i];
+    memcpy(&psu->regs[r->offset], regs, r->len * sizeof(uint16_t));
+    psu->time[i] = time;
+    regs += r->len;
+  }
+  __sync_synchronize();
+  seq_write(&psu->seq, seq + 2);
+}
+
+const rackmon_shm* rackmon_shm_open(const char* name) {
+  const rackmon_shm* shm;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < sizeof(rackmon_shm)) {
+    close(fd);
+    return NULL;
+  }
+  shm = mmap(NULL, sizeof(rackmon_shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    return NULL;
+  }
+  if (!rackmon_shm_valid(shm) || shm->version != RACKMON_SHM_VERSION ||
+      shm->size != sizeof(rackmon_shm)) {
+    rackmon_shm_close(shm);
+    return NULL;
+  }
+  return shm;
+}
+
+void rackmon_shm_close(const rackmon_shm* shm) {
+  if (shm != NULL) {
+    munmap((void*) shm, sizeof(rackmon_shm));
+  }
+}
+
+int rackmon_shm_valid(const rackmon_shm* shm) {
+  return seq_read(&shm->magic) == RACKMON_SHM_MAGIC;
+}
+
+int rackmon_shm_read_psu(const rackmon_shm* shm, uint8_t addr,
+    rackmon_shm_psu* out) {
+  const rackmon_shm_psu* psu = &shm->psus[RACKMON_SHM_SLOT(addr)];
+  uint32_t before, after;
+  int attempt = 0;
+
+  do {
+    if (attempt++ == RACKMON_SHM_RETRIES) {
+      return -2;
+    }
+    before = seq_read(&psu->seq);
+    if (before & 1) {
+      // rackmond is in the middle of an update
+      sched_yield();
+      continue;
+    }
+    __sync_synchronize();
+    memcpy(out, psu, sizeof(*out));
+    __sync_synchronize();
+    after = seq_read(&psu->seq);
+  } while (before & 1 || before != after);
+
+  if (!out->present || out->addr != addr) {
+    return -1;
+  }
+  out->seq = before;
+  return 0;
+}
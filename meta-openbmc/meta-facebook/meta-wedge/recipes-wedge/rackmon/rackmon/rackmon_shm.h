@@ -0,0 +1,109 @@
+/*
+ * Copyright 2014-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RACKMON_SHM_H_
+#define RACKMON_SHM_H_
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latest register values of every PSU, published by rackmond in
+// /dev/shm. Readers map it read-only and never talk to rackmond; each
+// PSU entry is guarded by a sequence counter which is odd while rackmond
+// updates the entry, so readers retry instead of seeing torn data.
+
+#define RACKMON_SHM_NAME "/rackmon"
+#define RACKMON_SHM_MAGIC 0x4e4f4d52 // "RMON"
+#define RACKMON_SHM_VERSION 1
+
+// reads of an entry rackmond keeps updating, or left half updated when
+// it died, give up after this many attempts
+#define RACKMON_SHM_RETRIES 10000
+
+#define RACKMON_SHM_MAX_RANGES 128
+#define RACKMON_SHM_MAX_REGS 1024
+// PSU addresses are 0xA0 | rack << 3 | shelf << 2 | psu
+#define RACKMON_SHM_MAX_PSUS 32
+#define RACKMON_SHM_SLOT(addr) ((addr) & (RACKMON_SHM_MAX_PSUS - 1))
+
+typedef struct rackmon_shm_range {
+  uint16_t begin;
+  uint16_t len;
+  // index of its first register in rackmon_shm_psu.regs
+  uint32_t offset;
+} rackmon_shm_range;
+
+typedef struct rackmon_shm_psu {
+  uint32_t seq;
+  uint8_t addr;
+  uint8_t present;
+  uint16_t reserved;
+  uint32_t crc_errors;
+  uint32_t timeout_errors;
+  // time of the latest reading of each range, 0 if never read
+  uint32_t time[RACKMON_SHM_MAX_RANGES];
+  uint16_t regs[RACKMON_SHM_MAX_REGS];
+} rackmon_shm_psu;
+
+typedef struct rackmon_shm {
+  // written last when the segment is set up, cleared when rackmond
+  // replaces it; readers reopen once it no longer matches
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint16_t num_ranges;
+  uint16_t num_regs;
+  rackmon_shm_range ranges[RACKMON_SHM_MAX_RANGES];
+  rackmon_shm_psu psus[RACKMON_SHM_MAX_PSUS];
+} rackmon_shm;
+
+/*
+ * Writer (rackmond)
+ */
+// Replace the segment with one for the given monitored ranges
+rackmon_shm* rackmon_shm_create(const char* name, int num_ranges,
+    const uint16_t* begin, const uint16_t* len);
+// Publish count ranges starting at first, whose registers are consecutive
+// in regs, and the PSU's error counters. count may be 0 to only mark the
+// PSU present and update its counters.
+void rackmon_shm_update(rackmon_shm* shm, uint8_t addr, int first, int count,
+    uint32_t time, const uint16_t* regs,
+    uint32_t crc_errors, uint32_t timeout_errors);
+
+/*
+ * Reader
+ */
+// Map the segment read-only, NULL if rackmond hasn't published it
+const rackmon_shm* rackmon_shm_open(const char* name);
+void rackmon_shm_close(const rackmon_shm* shm);
+// 1 while rackmond still publishes to this mapping
+int rackmon_shm_valid(const rackmon_shm* shm);
+// Copy a consistent snapshot of a PSU's entry. No system calls but
+// sched_yield() while the entry is being updated.
+// Return 0 on success, -1 if no such PSU is present, -2 if no consistent
+// snapshot could be taken within RACKMON_SHM_RETRIES attempts
+int rackmon_shm_read_psu(const rackmon_shm* shm, uint8_t addr,
+    rackmon_shm_psu* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -26,6 +27,57 @@
 #include <sys/un.h>
 #include "modbus.h"
 #include "rackmond.h"
+#include "rackmon_shm.h"
+
+// Print the latest readings from rackmond's shared memory segment,
+// without going through (and waiting on) rackmond
+int dump_latest(const char *addr_arg) {
+    const rackmon_shm *shm = rackmon_shm_open(RACKMON_SHM_NAME);
+    static rackmon_shm_psu psu;
+    int first = 1;
+    if (shm == NULL) {
+      fprintf(stderr, "rackmond isn't publishing readings\n");
+      return 1;
+    }
+    int only = addr_arg ? strtol(addr_arg, NULL, 16) : -1;
+    printf("[");
+    for (int slot = 0; slot < RACKMON_SHM_MAX_PSUS; slot++) {
+      uint8_t addr = 0xA0 | slot;
+      if (only >= 0 && only != addr) {
+        continue;
+      }
+      int ret = rackmon_shm_read_psu(shm, addr, &psu);
+      if (ret == -2) {
+        fprintf(stderr, "PSU %02x: readings kept changing, skipped\n", addr);
+      }
+      if (ret < 0) {
+        continue;
+      }
+      printf("%s{\"addr\":%d,\"crc_fails\":%d,\"timeouts\":%d,\"ranges\":[",
+          first ? "" : ",", addr, psu.crc_errors, psu.timeout_errors);
+      first = 0;
+      int first_range = 1;
+      for (int i = 0; i < shm->num_ranges; i++) {
+        const rackmon_shm_range *r = &shm->ranges[i];
+        if (psu.time[i] == 0) {
+          continue;
+        }
+        printf("%s{\"begin\":%d,\"time\":%u,\"data\":\"",
+            first_range ? "" : ",", r->begin, psu.time[i]);
+        first_range = 0;
+        // registers are kept as they came off the wire, like "data" shows
+        const uint8_t *data = (const uint8_t *) &psu.regs[r->offset];
+        for (int j = 0; j < r->len * 2; j++) {
+          printf("%02x", data[j]);
+        }
+        printf("\"}");
+      }
+      printf("]}");
+    }
+    printf("]\n");
+    rackmon_shm_close(shm);
+    return 0;
+}
 
 int main(int argc, char **argv) {
     int error = 0;
@@ -59,6 +111,9 @@ int main(int argc, char **argv) {
     if (argc > 1 && (strcmp("force_scan", argv[1]) == 0)) {
       cmd.type = COMMAND_TYPE_FORCE_SCAN;
     }
+    if (argc > 1 && (strcmp("latest", argv[1]) == 0)) {
+      return dump_latest(argc > 2 ? argv[2] : NULL);
+    }
     if (argc > 1 && (strcmp("pause", argv[1]) == 0)) {
       cmd.type = COMMAND_TYPE_PAUSE_MONITORING;
     }
@@ -66,7 +121,7 @@ int main(int argc, char **argv) {
       cmd.type = COMMAND_TYPE_START_MONITORING;
     }
     if(cmd.type == 0) {
-      fprintf(stderr, "Usage: %s { status | data | force_scan | pause | resume }\n", callname);
+      fprintf(stderr, "Usage: %s { status | data | latest [addr] | force_scan | pause | resume }\n", callname);
       exit(1);
     }
     clisock = socket(AF_UNIX, SOCK_STREAM, 0);
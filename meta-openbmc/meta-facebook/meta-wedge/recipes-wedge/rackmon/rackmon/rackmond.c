@@ -1,5 +1,6 @@
 #include "modbus.h"
 #include "rackmond.h"
+#include "rackmon_shm.h"
 #include <string.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -23,6 +24,13 @@
 
 #define READ_ERROR_RESPONSE -2
 
+// Neighbouring ranges due at the same time are read with one request
+#define MAX_COALESCED_REGS 64
+// A PSU that keeps timing out is left alone for a while, doubling up to
+// the max, so that it does not hold up polling of the others
+#define TIMEOUT_BACKOFF_MS 1000
+#define TIMEOUT_BACKOFF_MAX_MS 32000
+
 struct _lock_holder {
   pthread_mutex_t *lock;
   int held;
@@ -45,11 +53,13 @@ struct _lock_holder {
   } \
 }
 
-int scanning = 0;
-
 typedef struct _rs485_dev {
-  // hold this for the duration of a command
   pthread_mutex_t lock;
+  // the bus is busy for the duration of a command; client commands
+  // waiting for it go before monitoring reads
+  pthread_cond_t idle;
+  int busy;
+  int clients_waiting;
   int tty_fd;
 } rs485_dev;
 
@@ -62,12 +72,21 @@ typedef struct register_range_data {
   monitor_interval* i;
   void* mem_begin;
   size_t mem_pos;
+  // monotonic ms at which the range is due again
+  uint64_t next_read;
+  // last monitoring pass that read the range
+  unsigned int pass;
+  // not to be read together with its neighbours
+  int no_merge;
 } register_range_data;
 
 typedef struct monitoring_data {
   uint8_t addr;
   uint32_t crc_errors;
   uint32_t timeout_errors;
+  uint32_t timeouts_in_row;
+  unsigned int skip_pass;
+  uint64_t skip_until;
   register_range_data range_data[1];
 } monitoring_data;
 
@@ -84,11 +103,15 @@ typedef struct _rackmond_data {
   uint8_t active_addrs[MAX_ACTIVE_ADDRS];
   monitoring_data* stored_data[MAX_ACTIVE_ADDRS];
   FILE *status_log;
+  // latest readings for readers that don't go through the socket
+  rackmon_shm *shm;
 
   // timeout in nanosecs
   int modbus_timeout;
 
   int paused;
+  // a PSU scan read is on the bus; absent PSUs' timeouts aren't logged
+  int scanning;
 
   rs485_dev rs485;
 } rackmond_data;
@@ -184,6 +207,14 @@ cleanup:
 
 rackmond_data world;
 
+static unsigned int pass_id = 0;
+
+static uint64_t mono_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 char psu_address(int rack, int shelf, int psu) {
     int rack_a = ((rack & 3) << 3);
     int shelf_a = ((shelf & 1) << 2);
@@ -191,9 +222,30 @@ char psu_address(int rack, int shelf, int psu) {
     return 0xA0 | rack_a | shelf_a | psu_a;
 }
 
-int modbus_command(rs485_dev* dev, int timeout, char* command, size_t len, char* destbuf, size_t dest_limit, size_t expect) {
+void bus_acquire(rs485_dev* dev, int prio) {
+  pthread_mutex_lock(&dev->lock);
+  if (prio) {
+    dev->clients_waiting++;
+  }
+  while (dev->busy || (!prio && dev->clients_waiting > 0)) {
+    pthread_cond_wait(&dev->idle, &dev->lock);
+  }
+  if (prio) {
+    dev->clients_waiting--;
+  }
+  dev->busy = 1;
+  pthread_mutex_unlock(&dev->lock);
+}
+
+void bus_release(rs485_dev* dev) {
+  pthread_mutex_lock(&dev->lock);
+  dev->busy = 0;
+  pthread_cond_broadcast(&dev->idle);
+  pthread_mutex_unlock(&dev->lock);
+}
+
+int modbus_command(rs485_dev* dev, int timeout, char* command, size_t len, char* destbuf, size_t dest_limit, size_t expect, int prio) {
   int error = 0;
-  lock_holder(devlock, &dev->lock);
   modbus_req req;
   req.tty_fd = dev->tty_fd;
   req.modbus_cmd = command;
@@ -202,12 +254,14 @@ int modbus_command(rs485_dev* dev, int timeout, char* command, size_t len, char*
   req.dest_limit = dest_limit;
   req.timeout = timeout;
   req.expected_len = expect != 0 ? expect : dest_limit;
-  req.scan = scanning;
-  lock_take(devlock);
+  // monitoring reads only come from the monitoring thread, which sets
+  // world.scanning under the world lock and holds it for scan reads
+  req.scan = prio ? 0 : world.scanning;
+  bus_acquire(dev, prio);
   int cmd_error = modbuscmd(&req);
+  bus_release(dev);
   CHECK(cmd_error);
 cleanup:
-  lock_release(devlock);
   if (error >= 0) {
     return req.dest_len;
   }
@@ -233,7 +287,7 @@ int read_registers(rs485_dev *dev, int timeout, uint8_t addr, uint16_t begin, ui
     modbus_command(
         dev, timeout,
         command, sizeof(addr) + 1 + sizeof(begin) + sizeof(num),
-        response, sizeof(addr) + 1 + 1 + (2 * num) + 2, 0);
+        response, sizeof(addr) + 1 + 1 + (2 * num) + 2, 0, 0);
   CHECK(dest_len);
 
   if (dest_len >= 5) {
@@ -269,6 +323,8 @@ int sub_uint8s(const void* a, const void* b) {
 
 int check_active_psus() {
   int error = 0;
+  uint8_t active_addrs[MAX_ACTIVE_ADDRS];
+  uint8_t num_active_addrs = 0;
   lock_holder(worldlock, &world.lock);
   lock_take(worldlock);
   if (world.paused == 1) {
@@ -281,18 +337,27 @@ int check_active_psus() {
     usleep(5000);
     goto cleanup;
   }
-  world.num_active_addrs = 0;
+  // absent PSUs each take a full timeout; don't hold up clients for the
+  // whole scan, only for one read at a time
+  lock_release(worldlock);
 
-  scanning = 1;
   for(int rack = 0; rack < 3; rack++) {
     for(int shelf = 0; shelf < 2; shelf++) {
       for(int psu = 0; psu < 3; psu++) {
         char addr = psu_address(rack, shelf, psu);
         uint16_t status = 0;
+        lock_take(worldlock);
+        if (world.paused == 1) {
+          // keep the PSUs found by the last full scan
+          goto cleanup;
+        }
+        world.scanning = 1;
         int err = read_registers(&world.rs485, world.modbus_timeout, addr, REGISTER_PSU_STATUS, 1, &status);
+        world.scanning = 0;
+        lock_release(worldlock);
         if (err == 0) {
-          world.active_addrs[world.num_active_addrs] = addr;
-          world.num_active_addrs++;
+          active_addrs[num_active_addrs] = addr;
+          num_active_addrs++;
         } else {
           dbg("%02x - %d; ", addr, err);
         }
@@ -300,10 +365,12 @@ int check_active_psus() {
     }
   }
   //its the only stdlib sort
-  qsort(world.active_addrs, world.num_active_addrs,
+  qsort(active_addrs, num_active_addrs,
       sizeof(uint8_t), sub_uint8s);
+  lock_take(worldlock);
+  memcpy(world.active_addrs, active_addrs, num_active_addrs);
+  world.num_active_addrs = num_active_addrs;
 cleanup:
-  scanning = 0;
   lock_release(worldlock);
   return error;
 }
@@ -325,6 +392,7 @@ monitoring_data* alloc_monitoring_data(uint8_t addr) {
   d->addr = addr;
   d->crc_errors = 0;
   d->timeout_errors = 0;
+  rackmon_shm_update(world.shm, addr, 0, 0, 0, NULL, 0, 0);
   void* mem = d;
   mem = mem + (sizeof(monitoring_data) +
     sizeof(register_range_data) * world.config->num_intervals);
@@ -407,9 +475,146 @@ void record_data(register_range_data* rd, uint32_t time, uint16_t* regs) {
   rd->mem_pos = rd->mem_pos % mem_size;
 }
 
+void store_range(monitoring_data* d, register_range_data* rd,
+                 uint32_t timestamp, uint16_t* regs) {
+  lock_holder(worldlock, &world.lock);
+  monitor_interval* i = rd->i;
+  if (i->flags & MONITOR_FLAG_ONLY_CHANGES) {
+    int pitch = sizeof(timestamp) + (sizeof(uint16_t) * i->len);
+    int lastpos = rd->mem_pos - pitch;
+    if (lastpos < 0) {
+      lastpos = (pitch * i->keep) - pitch;
+    }
+    if (!memcmp(rd->mem_begin + lastpos + sizeof(timestamp),
+          regs, sizeof(uint16_t) * i->len) &&
+       memcmp(rd->mem_begin, "\x00\x00\x00\x00", 4)) {
+      return;
+    }
+
+    if (world.status_log) {
+      time_t rawt;
+      struct tm* ti;
+      time(&rawt);
+      ti = localtime(&rawt);
+      char timestr[80];
+      strftime(timestr, sizeof(timestr), "%b %e %T", ti);
+      fprintf(world.status_log,
+          "%s: Change to status register %02x on address %02x. New value: %02x\n",
+          timestr, i->begin, d->addr, regs[0]);
+      fflush(world.status_log);
+    }
+  }
+  lock_take(worldlock);
+  record_data(rd, timestamp, regs);
+  lock_release(worldlock);
+}
+
+int range_due(register_range_data* rd, uint64_t now) {
+  return rd->pass != pass_id && rd->next_read <= now;
+}
+
+// Find the first due range of a PSU, and how many of the ranges after it
+// are due as well and follow on from it, so one request reads them all
+int next_due_ranges(monitoring_data* d, uint64_t now, int* first, int* count) {
+  int n = world.config->num_intervals;
+  for(int r = 0; r < n; r++) {
+    register_range_data* rd = &d->range_data[r];
+    if (!range_due(rd, now)) {
+      continue;
+    }
+    int num = rd->i->len;
+    int c = 1;
+    while (!rd->no_merge && r + c < n) {
+      register_range_data* prev = &d->range_data[r + c - 1];
+      register_range_data* next = &d->range_data[r + c];
+      if (next->no_merge || !range_due(next, now) ||
+          next->i->begin != prev->i->begin + prev->i->len ||
+          num + next->i->len > MAX_COALESCED_REGS) {
+        break;
+      }
+      num += next->i->len;
+      c++;
+    }
+    *first = r;
+    *count = c;
+    return 1;
+  }
+  return 0;
+}
+
+void fetch_ranges(monitoring_data* d, int first, int count, uint64_t now) {
+  register_range_data* rd = &d->range_data[first];
+  int num = 0;
+  for(int c = 0; c < count; c++) {
+    num += d->range_data[first + c].i->len;
+  }
+  uint16_t regs[num];
+  int err = read_registers(&world.rs485,
+      world.modbus_timeout, d->addr, rd->i->begin, num, regs);
+  if (err == READ_ERROR_RESPONSE && count > 1) {
+    // some of these registers are missing on this model (e.g. stingray),
+    // read the ranges one at a time from now on
+    for(int c = 0; c < count; c++) {
+      d->range_data[first + c].no_merge = 1;
+    }
+    return;
+  }
+  for(int c = 0; c < count; c++) {
+    d->range_data[first + c].pass = pass_id;
+  }
+  if (err) {
+    if (err != READ_ERROR_RESPONSE) {
+      log("Error %d reading %02x registers at %02x from %02x\n",
+          err, num, rd->i->begin, d->addr);
+      if(err == MODBUS_BAD_CRC) {
+        d->crc_errors++;
+      }
+      if(err == MODBUS_RESPONSE_TIMEOUT) {
+        d->timeout_errors++;
+        // try the others first; if it keeps timing out, back off
+        d->skip_pass = pass_id;
+        if (d->timeouts_in_row < 16) {
+          d->timeouts_in_row++;
+        }
+        if (d->timeouts_in_row > 1) {
+          uint64_t backoff = (uint64_t)TIMEOUT_BACKOFF_MS << (d->timeouts_in_row - 2);
+          if (backoff > TIMEOUT_BACKOFF_MAX_MS) {
+            backoff = TIMEOUT_BACKOFF_MAX_MS;
+          }
+          d->skip_until = mono_ms() + backoff;
+        }
+      }
+      rackmon_shm_update(world.shm, d->addr, 0, 0, 0, NULL,
+          d->crc_errors, d->timeout_errors);
+      return;
+    }
+  } else {
+    d->timeouts_in_row = 0;
+  }
+  for(int c = 0; c < count; c++) {
+    rd = &d->range_data[first + c];
+    rd->next_read = now + rd->i->interval * 1000;
+  }
+  if (err) {
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint32_t timestamp = ts.tv_sec;
+  rackmon_shm_update(world.shm, d->addr, first, count, timestamp, regs,
+      d->crc_errors, d->timeout_errors);
+  uint16_t* pos = regs;
+  for(int c = 0; c < count; c++) {
+    rd = &d->range_data[first + c];
+    store_range(d, rd, timestamp, pos);
+    pos += rd->i->len;
+  }
+}
+
 int fetch_monitored_data() {
   int error = 0;
-  int data_pos = 0;
+  int progress;
   lock_holder(worldlock, &world.lock);
   lock_take(worldlock);
   if (world.paused == 1) {
@@ -424,68 +629,62 @@ int fetch_monitored_data() {
 
   usleep(1000); // wait a sec btween PSUs to not overload RT scheduling
                 // threshold
-  while(world.stored_data[data_pos] != NULL && data_pos < MAX_ACTIVE_ADDRS) {
-    uint8_t addr = world.stored_data[data_pos]->addr;
-    //log("readpsu %02x\n", addr);
-    for(int r = 0; r < world.config->num_intervals; r++) {
-      register_range_data* rd = &world.stored_data[data_pos]->range_data[r];
-      monitor_interval* i = rd->i;
-      uint16_t regs[i->len];
-      int err = read_registers(&world.rs485,
-          world.modbus_timeout, addr, i->begin, i->len, regs);
-      if (err) {
-        if (err != READ_ERROR_RESPONSE) {
-          log("Error %d reading %02x registers at %02x from %02x\n",
-              err, i->len, i->begin, addr);
-          if(err == MODBUS_BAD_CRC) {
-            world.stored_data[data_pos]->crc_errors++;
-          }
-          if(err == MODBUS_RESPONSE_TIMEOUT) {
-            world.stored_data[data_pos]->timeout_errors++;
-          }
-        }
+  pass_id++;
+  // Take turns between PSUs, one request each, until none has anything
+  // due, so a PSU that doesn't answer only delays its own readings
+  do {
+    progress = 0;
+    for(int data_pos = 0; data_pos < MAX_ACTIVE_ADDRS &&
+        world.stored_data[data_pos] != NULL; data_pos++) {
+      monitoring_data* d = world.stored_data[data_pos];
+      uint64_t now = mono_ms();
+      int first, count;
+      lock_take(worldlock);
+      int paused = world.paused;
+      lock_release(worldlock);
+      if (paused) {
+        goto cleanup;
+      }
+      if (d->skip_pass == pass_id || d->skip_until > now) {
         continue;
       }
-      struct timespec ts;
-      clock_gettime(CLOCK_REALTIME, &ts);
-      uint32_t timestamp = ts.tv_sec;
-      if (rd->i->flags & MONITOR_FLAG_ONLY_CHANGES) {
-        int pitch = sizeof(timestamp) + (sizeof(uint16_t) * i->len);
-        int lastpos = rd->mem_pos - pitch;
-        if (lastpos < 0) {
-          lastpos = (pitch * rd->i->keep) - pitch;
-        }
-        if (!memcmp(rd->mem_begin + lastpos + sizeof(timestamp),
-              regs, sizeof(uint16_t) * i->len) &&
-           memcmp(rd->mem_begin, "\x00\x00\x00\x00", 4)) {
-          continue;
-        }
-
-        if (world.status_log) {
-          time_t rawt;
-          struct tm* ti;
-          time(&rawt);
-          ti = localtime(&rawt);
-          char timestr[80];
-          strftime(timestr, sizeof(timestr), "%b %e %T", ti);
-          fprintf(world.status_log,
-              "%s: Change to status register %02x on address %02x. New value: %02x\n",
-              timestr, i->begin, addr, regs[0]);
-          fflush(world.status_log);
-        }
-
+      if (!next_due_ranges(d, now, &first, &count)) {
+        continue;
       }
-      lock_take(worldlock);
-      record_data(rd, timestamp, regs);
-      lock_release(worldlock);
+      fetch_ranges(d, first, count, now);
+      progress = 1;
     }
-    data_pos++;
-  }
+  } while(progress);
 cleanup:
   lock_release(worldlock);
   return error;
 }
 
+// Sleep until some range is due again, at most a second
+void wait_for_due_ranges() {
+  if (world.config == NULL || world.paused) {
+    return;
+  }
+  uint64_t now = mono_ms();
+  uint64_t wake = now + 1000;
+  for(int data_pos = 0; data_pos < MAX_ACTIVE_ADDRS &&
+      world.stored_data[data_pos] != NULL; data_pos++) {
+    monitoring_data* d = world.stored_data[data_pos];
+    for(int r = 0; r < world.config->num_intervals; r++) {
+      uint64_t t = d->range_data[r].next_read;
+      if (t < d->skip_until) {
+        t = d->skip_until;
+      }
+      if (t < wake) {
+        wake = t;
+      }
+    }
+  }
+  if (wake > now) {
+    usleep((wake - now) * 1000);
+  }
+}
+
 // check for new psus every N seconds
 static int search_at = 0;
 #define SEARCH_PSUS_EVERY 120
@@ -502,6 +701,7 @@ void* monitoring_loop(void* arg) {
       search_at = ts.tv_sec + SEARCH_PSUS_EVERY;
     }
     fetch_monitored_data();
+    wait_for_due_ranges();
   }
   return NULL;
 }
@@ -517,6 +717,12 @@ int open_rs485_dev(const char* tty_filename, rs485_dev *dev) {
   rs485conf.flags |= SER_RS485_ENABLED;
   dbg("[*] Putting TTY in RS485 mode\n");
   error = ioctl(tty_fd, TIOCSRS485, &rs485conf);
+  if (error < 0 && errno == ENOTTY) {
+    // e.g. a pty pair with modbussim on the other end
+    log("Warning: %s is not a serial port, not using RS485 mode\n",
+        tty_filename);
+    error = 0;
+  }
   if (error < 0) {
     fprintf(stderr, "FATAL: could not set TTY to RS485 mode: %d %s\n",
         error, strerror(error));
@@ -525,6 +731,9 @@ int open_rs485_dev(const char* tty_filename, rs485_dev *dev) {
 
   dev->tty_fd = tty_fd;
   pthread_mutex_init(&dev->lock, NULL);
+  pthread_cond_init(&dev->idle, NULL);
+  dev->busy = 0;
+  dev->clients_waiting = 0;
 cleanup:
   return error;
 }
@@ -551,7 +760,7 @@ int do_command(int sock, rackmond_command* cmd) {
         int response_len = modbus_command(
             &world.rs485, timeout,
             cmd->raw_modbus.data, cmd->raw_modbus.length,
-            response, expected, expected);
+            response, expected, expected, 1);
         uint16_t response_len_wire = response_len;
         if(response_len < 0) {
           uint16_t error = -response_len;
@@ -575,6 +784,16 @@ int do_command(int sock, rackmond_command* cmd) {
         world.config = calloc(1, config_size);
         memcpy(world.config, &cmd->set_config.config, config_size);
         syslog(LOG_INFO, "got configuration");
+        int n = world.config->num_intervals;
+        uint16_t begin[n], len[n];
+        for (int i = 0; i < n; i++) {
+          begin[i] = world.config->intervals[i].begin;
+          len[i] = world.config->intervals[i].len;
+        }
+        world.shm = rackmon_shm_create(RACKMON_SHM_NAME, n, begin, len);
+        if (world.shm == NULL) {
+          syslog(LOG_WARNING, "not publishing readings in shared memory");
+        }
         struct timespec ts;
         clock_gettime(CLOCK_REALTIME, &ts);
         uint32_t now = ts.tv_sec;
@@ -732,7 +951,9 @@ int handle_connection(int sock) {
   // if you don't do anything for a whole second we bail
 next:
   CHECKP(poll, poll(&pfd, 1, 1000));
-  if (pfd.revents & (POLLERR | POLLHUP)) {
+  // a client that sent its command and closed the socket already still
+  // gets it handled
+  if (!(pfd.revents & POLLIN) && (pfd.revents & (POLLERR | POLLHUP))) {
     goto cleanup;
   }
   switch(state) {
@@ -770,6 +991,7 @@ int main(int argc, char** argv) {
   signal(SIGPIPE, SIG_IGN);
   int error = 0;
   world.paused = 0;
+  world.scanning = 0;
   world.modbus_timeout = 300000;
   if (getenv("RACKMOND_TIMEOUT") != NULL) {
     world.modbus_timeout = atoll(getenv("RACKMOND_TIMEOUT"));
@@ -781,7 +1003,11 @@ int main(int argc, char** argv) {
   verbose = getenv("RACKMOND_VERBOSE") != NULL ? 1 : 0;
   openlog("rackmond", 0, LOG_USER);
   syslog(LOG_INFO, "rackmon/modbus service starting");
-  CHECK(open_rs485_dev(DEFAULT_TTY, &world.rs485));
+  const char* tty = DEFAULT_TTY;
+  if (getenv("RACKMOND_TTY") != NULL) {
+    tty = getenv("RACKMOND_TTY");
+  }
+  CHECK(open_rs485_dev(tty, &world.rs485));
   pthread_t monitoring_thread;
   pthread_create(&monitoring_thread, NULL, monitoring_loop, NULL);
   struct sockaddr_un local, client;
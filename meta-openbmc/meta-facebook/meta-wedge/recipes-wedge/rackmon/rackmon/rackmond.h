@@ -20,6 +20,7 @@ typedef struct monitor_interval {
   uint16_t len;
   uint16_t keep; // How long of a history to keep?
   uint16_t flags;
+  uint16_t interval; // Seconds between reads, 0 to read on every pass
 } monitor_interval;
 
 typedef struct monitoring_config {
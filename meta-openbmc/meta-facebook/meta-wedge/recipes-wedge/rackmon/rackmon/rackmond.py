@@ -16,7 +16,11 @@ def configure_rackmond(reglist, verify_configure=False):
         flags = 0
         if "flags" in r:
             flags = r["flags"]
-        monitor_interval = struct.pack("@HHHH", r["begin"], r["length"], keep, flags)
+        interval = 0
+        if "interval" in r:
+            interval = r["interval"]
+        monitor_interval = struct.pack("@HHHHH", r["begin"], r["length"], keep,
+                flags, interval)
         config_command += monitor_interval
 
     config_packet = struct.pack("H", len(config_command)) + config_command
@@ -45,7 +49,7 @@ def configure_rackmond(reglist, verify_configure=False):
             o =subprocess.check_output(cmd)
             if 'Monitored PSUs' in o.decode():
                 configured = True
-        except Exceptions as e:
+        except Exception as e:
             configured = False
         return configured
 
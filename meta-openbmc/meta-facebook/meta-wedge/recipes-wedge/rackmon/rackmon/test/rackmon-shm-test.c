@@ -0,0 +1,197 @@
+/*
+ * Copyright 2014-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "rackmon_shm.h"
+
+// A simulated rackmond publishes readings as fast as it can while reader
+// threads check that every snapshot they get is consistent: each register
+// of a range is derived from the range's timestamp, so registers from two
+// different updates, or a timestamp from another update than its
+// registers, show up as a mismatch.
+
+#define NUM_RANGES 60
+#define NUM_PSUS 12
+#define NUM_READERS 4
+#define RUN_SECONDS 2
+
+static char name[32];
+static uint16_t range_begin[NUM_RANGES];
+static uint16_t range_len[NUM_RANGES];
+static volatile int stop;
+
+static uint8_t psu_addr(int n) {
+  return 0xA0 | ((n / 6) << 3) | (((n / 3) % 2) << 2) | (n % 3);
+}
+
+static uint16_t reg_value(uint32_t time, int range, int reg) {
+  return (time * 31 + range * 7 + reg) & 0xffff;
+}
+
+static void* writer(void* arg) {
+  rackmon_shm* shm = arg;
+  static uint16_t regs[RACKMON_SHM_MAX_REGS];
+  unsigned long updates = 0;
+  uint32_t time = 1;
+
+  while (!stop) {
+    for (int n = 0; n < NUM_PSUS; n++, time++) {
+      // like rackmond, publish a run of ranges read with one request
+      int first = rand() % NUM_RANGES;
+      int count = 1 + rand() % (NUM_RANGES - first);
+      uint16_t* pos = regs;
+      for (int r = first; r < first + count; r++) {
+        for (int j = 0; j < range_len[r]; j++) {
+          *pos++ = reg_value(time, r, j);
+        }
+      }
+      rackmon_shm_update(shm, psu_addr(n), first, count, time, regs,
+          time / 100, time / 1000);
+      updates++;
+    }
+  }
+  return (void*) updates;
+}
+
+static void* reader(void* arg) {
+  const rackmon_shm* shm = rackmon_shm_open(name);
+  static __thread rackmon_shm_psu psu;
+  unsigned long reads = 0;
+
+  assert(shm != NULL);
+  assert(shm->num_ranges == NUM_RANGES);
+  while (!stop) {
+    int n = rand() % NUM_PSUS;
+    if (rackmon_shm_read_psu(shm, psu_addr(n), &psu) < 0) {
+      continue;
+    }
+    assert(psu.addr == psu_addr(n));
+    for (int r = 0; r < NUM_RANGES; r++) {
+      const rackmon_shm_range* range = &shm->ranges[r];
+      if (psu.time[r] == 0) {
+        continue;
+      }
+      for (int j = 0; j < range->len; j++) {
+        if (psu.regs[range->offset + j] != reg_value(psu.time[r], r, j)) {
+          fprintf(stderr, "torn read: psu %02x range %d reg %d\n",
+              psu.addr, r, j);
+          abort();
+        }
+      }
+    }
+    reads++;
+  }
+  rackmon_shm_close(shm);
+  return (void*) reads;
+}
+
+// The same check without the sequence counter, to show the test can see
+// torn data at all
+static void* unsafe_reader(void* arg) {
+  const rackmon_shm* shm = arg;
+  static __thread rackmon_shm_psu psu;
+  unsigned long torn = 0;
+
+  while (!stop) {
+    memcpy(&psu, &shm->psus[RACKMON_SHM_SLOT(psu_addr(0))], sizeof(psu));
+    for (int r = 0; r < NUM_RANGES; r++) {
+      const rackmon_shm_range* range = &shm->ranges[r];
+      if (psu.time[r] != 0 &&
+          psu.regs[range->offset] != reg_value(psu.time[r], r, 0)) {
+        torn++;
+        break;
+      }
+    }
+  }
+  return (void*) torn;
+}
+
+int main(int argc, char** argv) {
+  pthread_t w, u, readers[NUM_READERS];
+  unsigned long updates, reads = 0, torn;
+  void* ret;
+
+  snprintf(name, sizeof(name), "/rackmon-test-%d", getpid());
+  for (int r = 0; r < NUM_RANGES; r++) {
+    range_begin[r] = r * 16;
+    range_len[r] = 1 + r % 8;
+  }
+
+  assert(rackmon_shm_open(name) == NULL);
+  rackmon_shm* shm = rackmon_shm_create(name, NUM_RANGES, range_begin,
+      range_len);
+  assert(shm != NULL);
+
+  // a PSU is only there once rackmond published it
+  const rackmon_shm* ro = rackmon_shm_open(name);
+  rackmon_shm_psu psu;
+  assert(ro != NULL);
+  assert(rackmon_shm_read_psu(ro, psu_addr(0), &psu) < 0);
+  rackmon_shm_update(shm, psu_addr(0), 0, 0, 0, NULL, 1, 2);
+  assert(rackmon_shm_read_psu(ro, psu_addr(0), &psu) == 0);
+  assert(psu.crc_errors == 1 && psu.timeout_errors == 2);
+  assert(psu.time[0] == 0);
+
+  // rackmond died in the middle of an update: readers give up
+  shm->psus[RACKMON_SHM_SLOT(psu_addr(0))].seq++;
+  assert(rackmon_shm_read_psu(ro, psu_addr(0), &psu) == -2);
+  shm->psus[RACKMON_SHM_SLOT(psu_addr(0))].seq++;
+  assert(rackmon_shm_read_psu(ro, psu_addr(0), &psu) == 0);
+
+  pthread_create(&w, NULL, writer, shm);
+  pthread_create(&u, NULL, unsafe_reader, (void*) ro);
+  for (int i = 0; i < NUM_READERS; i++) {
+    pthread_create(&readers[i], NULL, reader, NULL);
+  }
+  sleep(RUN_SECONDS);
+  stop = 1;
+  pthread_join(w, &ret);
+  updates = (unsigned long) ret;
+  pthread_join(u, &ret);
+  torn = (unsigned long) ret;
+  for (int i = 0; i < NUM_READERS; i++) {
+    pthread_join(readers[i], &ret);
+    reads += (unsigned long) ret;
+  }
+  printf("%lu updates/s, %lu consistent reads/s by %d readers, "
+         "%lu torn reads/s without the sequence counter\n",
+         updates / RUN_SECONDS, reads / RUN_SECONDS, NUM_READERS,
+         torn / RUN_SECONDS);
+  assert(updates > 0 && reads > 0);
+
+  // a new rackmond retires the old segment
+  rackmon_shm* again = rackmon_shm_create(name, NUM_RANGES, range_begin,
+      range_len);
+  assert(again != NULL);
+  assert(!rackmon_shm_valid(ro));
+  rackmon_shm_close(ro);
+  ro = rackmon_shm_open(name);
+  assert(ro != NULL && rackmon_shm_valid(ro));
+  rackmon_shm_close(ro);
+  shm_unlink(name);
+
+  printf("All tests passed\n");
+  return 0;
+}
@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <time.h>
+#include <pthread.h>
 
 #define    HEALTHMON_INTERVAL      10
 #define    MAX_RETRIES             10
@@ -67,11 +68,10 @@
  */
 efuse_info_t efuse_info_cache[MAX_EFUSE_NUM];
 psu_info_t   psu_info_cache[MAX_PSU_NUM];
-psu_info_t   psu_info_mem[MAX_PSU_NUM];
 fan_info_t   fan_info_cache;
-int         *mmap_addr;
+uint32_t     psu_clear_ack[MAX_PSU_NUM];
+health_shm_t *health_shm;
 
-int          fd_mmap;
 int          bmc_id;
 
 /*
@@ -110,6 +110,8 @@ save_efuse_info (efuse_info_t *efuse_info)
 int
 save_psu_info (psu_info_t *psu_info)
 {
+    int n;
+
     if (!psu_info) {
         syslog(LOG_WARNING, "Invalid input:  NULL \n");
         return -1;
@@ -120,10 +122,18 @@ save_psu_info (psu_info_t *psu_info)
        return -1;
     }
 
-    get_mmap_info((int*)&psu_info_mem, FILE_PSU, sizeof(psu_info_mem));
+    n = psu_info->psu_num - 1;
+
+    /*
+     * psu-util asked to clear the status counters
+     */
+    if (health_shm && health_shm->psu_clear_req[n] != psu_clear_ack[n]) {
+        psu_clear_ack[n] = health_shm->psu_clear_req[n];
+        memset(psu_info_cache[n].status_cntr, 0, sizeof(psu_info_cache[n].status_cntr));
+    }
 
     for(int i=0; i < PSU_STATUS_MAX; i++) {
-        psu_info->status_cntr[i] += psu_info_mem[psu_info->psu_num - 1].status_cntr[i];
+        psu_info->status_cntr[i] += psu_info_cache[n].status_cntr[i];
     }
 
     memcpy(&psu_info_cache[psu_info->psu_num - 1], psu_info, sizeof(psu_info_t));
@@ -146,63 +156,28 @@ save_fan_info (fan_info_t *fan_info)
 }
 
 /*
- * Write to mmap file
+ * Publish the cached data to the health segment
  */
 int
-write_mmap_file(uint8_t fd)
+write_health_shm(health_shm_t *shm)
 {
-    uint8_t   retries = 5;
-    int       done = 0, offset, len;
-
-    for(int attempt; attempt < retries; ++attempt) {
-        done = flock(fd, LOCK_EX | LOCK_NB);
-        if (done != 0) {
-            syslog(LOG_WARNING, "Failed to lock mmap file, errno: %d", errno);
-            /*
-             * lock held by another proc
-             */
-            sleep(1);
-            continue;
-        }
-        else
-            break;
-    }
-
-    if (done != 0) {
-        syslog(LOG_WARNING, "Failed to lock mmap file\n");
+    if (!shm) {
         return -1;
     }
 
-    /*
-     * write fan info to the mmaped file
-     */
-    offset = get_file_offset(FILE_FAN);
-    len = sizeof(fan_info_cache) + 1;
-    memcpy(mmap_addr+offset, &fan_info_cache, len);
-
-    /*
-     * write psu info to the mmaped file
-     */
-    offset = get_file_offset(FILE_PSU);
-    len = sizeof(psu_info_cache);
-    memcpy(mmap_addr+offset, psu_info_cache, len);
-
-    /*
-     * write efuse info to the mmaped file
-     */
-    offset = get_file_offset(FILE_EFUSE);
-    len = sizeof(efuse_info_cache);
-    memcpy(mmap_addr + offset, efuse_info_cache, len);
-
-    flock(fd, LOCK_UN);
+    health_shm_write_begin(shm);
+    memcpy(&shm->fan_info, &fan_info_cache, sizeof(fan_info_cache));
+    memcpy(shm->psu_info, psu_info_cache, sizeof(psu_info_cache));
+    memcpy(shm->efuse_info, efuse_info_cache, sizeof(efuse_info_cache));
+    health_shm_write_end(shm);
     return 0;
 }
 
-void init_psus (int *mmap_addr)
+void init_psus (health_shm_t *shm)
 {
     psu_info_t *psu_info;
 
-    if (!mmap_addr)
+    if (!shm)
        return;
 
     psu_info = (psu_info_t *) malloc(sizeof(psu_info_t));
@@ -219,39 +194,20 @@ void init_psus (int *mmap_addr)
     free(psu_info);
 }
 
-int init_poll (int filesize)
+int init_poll (void)
 {
-    int mode = 0x0777;
-
     bmc_id = which_bmc();
 
-    if (fd_mmap == -1) {
-        syslog(LOG_WARNING, "failed to open mmap file");
-        return -1;
-    }
-
-    /* go to the location corresponding to the last byte */
-    if (lseek (fd_mmap, filesize - 1, SEEK_SET) == -1)
-    {
-        syslog(LOG_WARNING, "mmap file lseek error");
-        return -1;
-    }
-
-    /* write a dummy byte at the last location */
-    if (write (fd_mmap, "", 1) != 1)  {
-        syslog(LOG_WARNING, "mmap file write error");
-        return -1;
-    }
-
-    /* Now the file is ready to be mmapped.
+    /*
+     * Mapped once, every poll only copies the readings into it
      */
-    mmap_addr = mmap(NULL, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mmap, 0);
-    if (mmap_addr == MAP_FAILED) {
-        syslog(LOG_WARNING, "failed to mmap()");
+    health_shm = health_shm_create();
+    if (!health_shm) {
+        syslog(LOG_WARNING, "failed to create health segment");
         return -1;
     }
 
-    init_psus(mmap_addr);
+    init_psus(health_shm);
 
     return 0;
 }
@@ -259,13 +215,11 @@ int init_poll (int filesize)
 /*
  *  Poll the Hardware and save to structures
  */
-void poll_psu_info (int *mmap_addr, uint8_t fd)
+void poll_psu_info (health_shm_t *shm, int bus)
 {
-    int        len;
-    int        offset;
     psu_info_t *psu_info;
 
-    if (!mmap_addr)
+    if (!shm)
        return;
 
     psu_info = (psu_info_t *) malloc(sizeof(psu_info_t));
@@ -326,14 +280,12 @@ void check_efuse_temp(efuse_info_t *efuse_info)
     }
 }
 
-void poll_efuse_info(int *mmap_addr, uint8_t fd)
+void poll_efuse_info(health_shm_t *shm, int bus)
 {
-    int          i2c_bus, selector_addr, len;
-    int          offset;
     efuse_info_t *efuse_info;
 
-    if (!mmap_addr) {
-        syslog(LOG_WARNING, "healthmon: efuse mmap: NULL");
+    if (!shm) {
+        syslog(LOG_WARNING, "healthmon: health segment: NULL");
         return;
     }
 
@@ -347,6 +299,10 @@ void poll_efuse_info(int *mmap_addr, uint8_t fd)
      * check faults and warning
      */
     for (int i = 1; i < MAX_EFUSE_NUM + 1; i++) {
+        if (efuse_to_i2cbus(i) != bus) {
+            continue;
+        }
+
         memset(efuse_info, 0, sizeof(efuse_info_t));
         efuse_info->efuse_num = i;
         if (efuse_poll_info(efuse_info) == -1) {
@@ -367,9 +323,8 @@ void poll_efuse_info(int *mmap_addr, uint8_t fd)
  * Poll FAN Hardware info
  * save hardware data into cached data table
  */
-void poll_fan_info (int *mmap_addr, uint8_t fd)
+void poll_fan_info (health_shm_t *shm, int bus)
 {
-    int    len, offset;
     fan_info_t *fan_info;
     fan_info = (fan_info_t *) malloc(sizeof(fan_info_t));
 
@@ -410,7 +365,58 @@ void set_gpio_out_direction(uint8_t gpio_num)
     return;
 }
 
-int do_poll(int timedout_flag, int fd)
+/*
+ * Devices behind different master selectors are polled in parallel, one
+ * worker per selector. Each worker fills its own part of the cached
+ * data, which is published once all of them are done.
+ */
+typedef struct poll_worker {
+    void      (*poll)(health_shm_t *shm, int bus);
+    int       bus;
+    pthread_t tid;
+    int       started;
+} poll_worker_t;
+
+static poll_worker_t poll_workers[] = {
+    {poll_efuse_info, I2C_MASTER_EFUSE_BUS_1},
+    {poll_efuse_info, I2C_MASTER_EFUSE_BUS_2},
+    {poll_psu_info,   PSU_BUS},
+    {poll_fan_info,   FAN_BUS},
+};
+
+static void *poll_worker(void *arg)
+{
+    poll_worker_t *worker = (poll_worker_t *) arg;
+
+    worker->poll(health_shm, worker->bus);
+    return NULL;
+}
+
+void poll_all(void)
+{
+    int num_workers = sizeof(poll_workers) / sizeof(poll_workers[0]);
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_workers; i++) {
+        poll_workers[i].started =
+            pthread_create(&poll_workers[i].tid, NULL, poll_worker, &poll_workers[i]) == 0;
+        if (!poll_workers[i].started) {
+            poll_worker(&poll_workers[i]);
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (poll_workers[i].started) {
+            pthread_join(poll_workers[i].tid, NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    syslog(LOG_DEBUG, "healthmon: polled all devices in %ld ms",
+           (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+}
+
+int do_poll(int timedout_flag)
 {
     int    randomTime = 0, ret = 0;
     time_t endwait;
@@ -430,23 +436,25 @@ int do_poll(int timedout_flag, int fd)
     /*
      * Get HW data
      */
-    poll_efuse_info(mmap_addr, fd);
-    poll_psu_info(mmap_addr, fd);
-    poll_fan_info(mmap_addr, fd);
+    poll_all();
 
-    if (write_mmap_file(fd) == -1)  {
-        syslog(LOG_WARNING, "failed to write to mmap");
+    if (write_health_shm(health_shm) == -1)  {
+        syslog(LOG_WARNING, "failed to write to health segment");
     }
 
     /*
      * Done access HW, set GPIO OUT to HIGH
      */
     sleep(BMC_POLL_WAIT_TIME);
+
+    /*
+     * the other BMC may have the buses until the next poll
+     */
+    i2c_master_selector_release_idle();
     return 0;
 }
 
 int main(int argc, char **argv) {
-    int     filesize;
     struct  stat statbuf;
     int     retry = 3;
     int     boot_timeout_count  = BMC_BOOT_TIMEOUT;
@@ -458,19 +466,11 @@ int main(int argc, char **argv) {
     int     gpio_pulse_count = 0;
     int     gpio_low_count = 0;
     int     gpio_value = GPIO_VALUE_HIGH;
-    int     mode = 0x0777;
-
-    filesize = sizeof(efuse_info_cache) + sizeof(psu_info_cache) + sizeof(fan_info_cache);
-
-    /*
-     * Open a file for writing efuse info.
-     */
-    fd_mmap = open(MMAP_FILEPATH, O_RDWR | O_CREAT | O_TRUNC, mode);
 
     /*
      * initialization
      */
-    init_poll(filesize);
+    init_poll();
 
     if (bmc_id == 0)
     {
@@ -487,17 +487,6 @@ int main(int argc, char **argv) {
         /*
          * timeout check
          */
-        do_poll(timedout_flag, fd_mmap);
-    }
-
-    /* Don't forget to free the mmapped memory
-     */
-    if (munmap(mmap_addr, filesize) == -1) {
-        syslog(LOG_WARNING, "Error un-mmapping the efuse file");
+        do_poll(timedout_flag);
     }
-
-    /*
-     * Un-mmaping doesn't close the file, so we still need to do that.
-     */
-    close(fd_mmap);
 }
@@ -0,0 +1,265 @@
+/*
+ * fan-control-replay
+ *
+ * Copyright 2019-present LinkedIn. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Feed a recorded temperature trace through the controller of a zone,
+ * offline, and report the duty it would have set. The trace is CSV:
+ * "seconds,temp[,temp...]" per line, the hottest column counts; lines
+ * that do not start with a number are skipped. Empty columns are missing
+ * readings, ridden out for FAILSAFE_SWEEPS sweeps as the daemon does.
+ * With -l the previous threshold stepping controller is run on the same
+ * trace for comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "fan-zone.hpp"
+
+using json = nlohmann::json;
+
+#define CONFIG_FILE "/etc/fan-control-config.json"
+
+// The controller fan-control had before, with its shipped settings
+#define LEGACY_PERIOD 10
+#define LEGACY_UPPER 80
+#define LEGACY_LOWER 70
+
+struct Sample
+{
+    double time;
+    double temp;
+};
+
+struct Report
+{
+    int steps = 0;
+    int writes = 0;
+    int reversals = 0;
+    int maxStep = 0;
+    int travel = 0;
+    double sum = 0;
+    // seconds from the first reading above the setpoint to a duty raise
+    double hot = NAN;
+    double reaction = NAN;
+    int min = 100;
+    int max = 0;
+    int last = -1;
+    int dir = 0;
+
+    void add(double t, double temp, double setpoint, int percent)
+    {
+        if (std::isnan(hot) && temp > setpoint)
+            hot = t;
+        if (!std::isnan(hot) && std::isnan(reaction) && percent > last &&
+            last >= 0)
+            reaction = t - hot;
+        steps++;
+        sum += percent;
+        min = std::min(min, percent);
+        max = std::max(max, percent);
+        if (last >= 0 && percent != last)
+        {
+            int d = percent > last ? 1 : -1;
+            if (dir && d != dir)
+                reversals++;
+            dir = d;
+            maxStep = std::max(maxStep, std::abs(percent - last));
+            travel += std::abs(percent - last);
+        }
+        if (percent != last)
+            writes++;
+        last = percent;
+    }
+
+    void print(const char *name) const
+    {
+        printf("# %s: %d steps, %d PWM writes, duty %d..%d%% mean %.1f%%, "
+               "travel %d%%, largest step %d%%, %d reversals, "
+               "reaction %.0fs\n", name, steps, writes, min, max,
+               steps ? sum / steps : 0, travel, maxStep, reversals, reaction);
+    }
+};
+
+static std::vector<Sample> readTrace(const char *path)
+{
+    std::vector<Sample> trace;
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        exit(1);
+    }
+    while (std::getline(file, line))
+    {
+        std::stringstream ss(line);
+        std::string col;
+        Sample s;
+        char *end;
+
+        if (!std::getline(ss, col, ','))
+            continue;
+        s.time = strtod(col.c_str(), &end);
+        if (end == col.c_str())
+            continue;
+        s.temp = NAN;
+        while (std::getline(ss, col, ','))
+        {
+            double t = strtod(col.c_str(), &end);
+            if (end != col.c_str() && (std::isnan(s.temp) || t > s.temp))
+                s.temp = t;
+        }
+        trace.push_back(s);
+    }
+    if (trace.empty())
+    {
+        std::cerr << "No samples in " << path << std::endl;
+        exit(1);
+    }
+    return trace;
+}
+
+// Latest sample at or before t
+static double sampleAt(const std::vector<Sample> &trace, size_t &pos, double t)
+{
+    while (pos + 1 < trace.size() && trace[pos + 1].time <= t)
+        pos++;
+    return trace[pos].temp;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c config] [-z zone] [-l] [-q] trace.csv\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *configPath = CONFIG_FILE;
+    const char *zoneName = NULL;
+    bool legacy = false, quiet = false;
+    const ZoneConfig *zone = NULL;
+    ControlConfig config;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:z:lq")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            configPath = optarg;
+            break;
+        case 'z':
+            zoneName = optarg;
+            break;
+        case 'l':
+            legacy = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    try
+    {
+        std::ifstream jsonFile(configPath);
+        json configFile;
+        jsonFile >> configFile;
+        config = parseConfig(configFile);
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Invalid " << configPath << ": " << ex.what() << std::endl;
+        return 1;
+    }
+    for (auto &z : config.zones)
+    {
+        if (!zoneName || z.name == zoneName)
+        {
+            zone = &z;
+            break;
+        }
+    }
+    if (!zone)
+    {
+        std::cerr << "No zone " << (zoneName ? zoneName : "") << std::endl;
+        return 1;
+    }
+
+    std::vector<Sample> trace = readTrace(argv[optind]);
+    ZoneController ctrl(*zone);
+    Report pid, step;
+    size_t pos = 0;
+    // the legacy controller starts from its top state, like the daemon did
+    int legacyPercent = 100;
+    double legacyNext = trace.front().time;
+
+    if (!quiet)
+        printf(legacy ? "time,temp,duty,legacy\n" : "time,temp,duty\n");
+
+    for (double t = trace.front().time; t <= trace.back().time;
+         t += config.period)
+    {
+        double temp = sampleAt(trace, pos, t);
+        ctrl.update(temp, config.period);
+        int percent = ctrl.duty();
+        pid.add(t, temp, zone->setpoint, percent);
+
+        if (legacy)
+        {
+            if (t >= legacyNext)
+            {
+                if (std::isnan(temp) || temp > LEGACY_UPPER)
+                    legacyPercent = std::min(100, legacyPercent + 10);
+                else if (temp < LEGACY_LOWER)
+                    legacyPercent = std::max(20, legacyPercent - 10);
+                legacyNext += LEGACY_PERIOD;
+            }
+            step.add(t, temp, zone->setpoint, legacyPercent);
+        }
+
+        if (quiet)
+            continue;
+        if (legacy)
+            printf("%.1f,%.1f,%d,%d\n", t, temp, percent, legacyPercent);
+        else
+            printf("%.1f,%.1f,%d\n", t, temp, percent);
+    }
+
+    pid.print(zone->name.c_str());
+    if (legacy)
+        step.print("legacy");
+    return 0;
+}
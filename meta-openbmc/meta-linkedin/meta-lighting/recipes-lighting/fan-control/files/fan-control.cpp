@@ -22,12 +22,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
-#include <fstream>
+#include <fcntl.h>
+#include <string.h>
 #include <syslog.h>
+#include <sys/timerfd.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
 #include <string>
-#include <bits/stdc++.h>
+#include <vector>
 #include <nlohmann/json.hpp>
-#include <experimental/filesystem>
+#include "fan-zone.hpp"
 
 extern "C"
 {
@@ -37,328 +42,272 @@ extern "C"
 
 using json = nlohmann::json;
 
-#define MAX_RPM 30300 // RPM
-#define ADJUSTMENT_PERIOD 60 // seconds
-#define UPPER_THRESHOLD 55 // celcius
-#define LOWER_THRESHOLD 45 // celcius
+#define CONFIG_FILE "/etc/fan-control-config.json"
 #define MAX_DEVIATION 10 // percent from set value
+#define FAN_SETTLE_TIME 5 // seconds before a new duty is checked
 
-static int upperThreshold;
-static int lowerThreshold;
+// I2C master selectors in front of the fan and the temperature sensors
+#define FAN_SELECTOR_BUS 8
+#define FAN_SELECTOR_ADDR 0x7C
+#define TEMP_SELECTOR_BUS 6
+#define TEMP_SELECTOR_ADDR 0x7E
 
-class Fan
+static bool verbose;
+
+/*
+ * A hwmon attribute opened once and accessed with pread/pwrite at offset
+ * 0, so a reading costs one system call. The file is reopened after an
+ * error, in case the driver was rebound meanwhile.
+ */
+class SysfsAttr
 {
 public:
-
-    Fan(std::string name, std::string path, float a, float b, float c) : name(name), path(path), a(a), b(b), c(c) {}
-
-    std::string name;
-    std::string path;
-    float a;
-    float b;
-    float c;
-
-    int getRPM()
+    SysfsAttr(const DeviceConfig &dev, const char *attr, int flags)
+        : dev(dev), attr(attr), flags(flags) {}
+    SysfsAttr(const SysfsAttr &) = delete;
+    SysfsAttr &operator=(const SysfsAttr &) = delete;
+    SysfsAttr(SysfsAttr &&other)
+        : dev(other.dev), attr(other.attr), flags(other.flags),
+          fd(other.fd), failing(other.failing)
     {
-        std::ifstream ifile(path+"fan1_input");
-        if(!ifile.is_open())
-        {
-            printf("ERROR: open path to %s failed!\n", name.c_str());
-            syslog(LOG_WARNING, "ERROR: open path to %s failed!", name.c_str());
-            return 0;
-        }
-
-        i2c_master_selector_access(8, 0x7C);
-        std::string val;
-        ifile >> val;
-        ifile.close();
-        int rpm = std::stoi(val);
-        int percent = rpmToPercent(rpm);
-        printf("RPM %s = %d, which is %d%%\n", name.c_str(), rpm, percent);
-        return rpm;
+        other.fd = -1;
     }
-
-    int setPWM(uint8_t percent)
+    ~SysfsAttr()
     {
-        std::ofstream ofile(path+"pwm1");
-        if(!ofile.is_open())
-        {
-            printf("ERROR: open path to %s failed!\n", name.c_str());
-            syslog(LOG_WARNING, "ERROR: open path to %s failed!", name.c_str());
-            return -1;
-        }
-
-        int p = percentToPwm(percent);
-        printf("set %s to %d pwm value, which is %d%%\n", name.c_str(), p, percent);
-        i2c_master_selector_access(8, 0x7C);
-        ofile << p;
-        ofile.close();
-        return 0;
+        if (fd >= 0)
+            close(fd);
     }
 
-private:
-    uint8_t percentToPwm(unsigned int percent)
+    bool read(long &val)
     {
-        unsigned int result = 255 * percent / 100;
-        return result;
+        char buf[32];
+        ssize_t len;
+
+        if (!reopen())
+            return false;
+        len = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (len <= 0)
+            return fail("read");
+        buf[len] = '\0';
+        val = strtol(buf, NULL, 10);
+        recover();
+        return true;
     }
 
-    uint8_t rpmToPercent(unsigned int rpm)
+    bool write(long val)
     {
-        unsigned int result = rpm * 100 / MAX_RPM;
-        return result;
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%ld", val);
+
+        if (!reopen())
+            return false;
+        if (pwrite(fd, buf, len, 0) != len)
+            return fail("write");
+        recover();
+        return true;
     }
-};
-
-class Temp
-{
-public:
-    Temp(std::string name, std::string path) : name(name), path(path) {}
 
-    std::string name;
-    std::string path;
+private:
+    DeviceConfig dev;
+    std::string attr;
+    int flags;
+    int fd = -1;
+    bool failing = false;
 
-    int getTemp()
+    bool reopen()
     {
-        std::string val;
-        std::ifstream ifile(path+"temp1_input");
-        if(!ifile.is_open())
-        {
-            printf("ERROR: open path to %s failed!\n", name.c_str());
-            syslog(LOG_WARNING, "ERROR: open path to %s failed!", name.c_str());
-            return INT_MIN;
-        }
-
-        i2c_master_selector_access(6, 0x7E);
-        ifile >> val;
-        ifile.close();
-        int temp = std::stoi(val) / 1000;
-        printf("temp %s = %d\n", name.c_str(), temp);
-        return temp;
+        char dir[DEVICE_FILENAME_SIZE];
+
+        if (fd >= 0)
+            return true;
+        if (i2c_hwmon_dir(dev.bus, dev.address, dir) < 0)
+            return fail("find hwmon for");
+        fd = open((std::string(dir) + "/" + attr).c_str(), flags | O_CLOEXEC);
+        if (fd < 0)
+            return fail("open");
+        return true;
     }
-};
-
-std::optional<std::string> findDevicePath(std::string bus, std::string address)
-{
-    std::string devicePath;
-    std::string hwmonPath;
 
-    try
+    // log only the first of a series of errors
+    bool fail(const char *what)
     {
-        // find the device on the bus
-        for (const auto & entry : std::experimental::filesystem::directory_iterator("/sys/class/i2c-adapter/i2c-" + bus))
+        if (!failing)
         {
-            std::string foundPath = entry.path();
-            // check if path ends with device address
-            if(std::equal(address.rbegin(), address.rend(), foundPath.rbegin()))
-            {
-                devicePath = entry.path();
-            }
+            syslog(LOG_WARNING, "ERROR: cannot %s %s of %s (%d-%04x): %s",
+                   what, attr.c_str(), dev.name.c_str(), dev.bus, dev.address,
+                   strerror(errno));
+            failing = true;
         }
-    }
-    catch (const std::exception & ex)
-    {
-        syslog(LOG_WARNING, "ERROR: could not find the bus %s", bus.c_str());
-        return std::nullopt;
-    }
-
-    if(devicePath.empty())
-    {
-        syslog(LOG_WARNING, "ERROR: could not find device %s on the bus %s", address.c_str(), bus.c_str());
-        return std::nullopt;
-    }
-
-    try
-    {
-        // find hwmon
-        for (const auto & entry : std::experimental::filesystem::directory_iterator(devicePath + "/hwmon"))
+        if (fd >= 0)
         {
-            hwmonPath = entry.path();
-            std::cout << entry.path() << std::endl;
+            close(fd);
+            fd = -1;
         }
-    }
-    catch (const std::exception & ex)
-    {
-        syslog(LOG_WARNING, "ERROR: could not find hwmon for device %s on the bus %s", address.c_str(), bus.c_str());
-        return std::nullopt;
+        return false;
     }
 
-    if(hwmonPath.empty())
+    void recover()
     {
-        syslog(LOG_WARNING, "ERROR: could not find hwmon for device %s on the bus %s", address.c_str(), bus.c_str());
-        return std::nullopt;
+        if (failing)
+        {
+            syslog(LOG_INFO, "%s of %s is back", attr.c_str(), dev.name.c_str());
+            failing = false;
+        }
     }
+};
 
-    return hwmonPath + "/";
-}
-
-class FanCtrlZone
+class Fan
 {
 public:
-    FanCtrlZone(std::string name, std::vector<unsigned int> &thresholds, std::vector<Temp> &tempList, 
-                std::vector<Fan> &fanList) : name(name), tempList(tempList), fanList(fanList)
-    {
-        populateFanState(thresholds);
-        setInitialState();
-    }
+    Fan(const FanConfig &config)
+        : config(config), rpm(config, "fan1_input", O_RDONLY),
+          pwm(config, "pwm1", O_WRONLY) {}
 
-    void checkFansSpeed()
+    // Only touch the hardware if the duty changes
+    void setPercent(int percent, double dt)
     {
-        auto fanSpeed = speedTable.find(state);
-        if(fanSpeed == speedTable.end())
+        if (percent == lastPercent)
         {
-            syslog(LOG_WARNING, "Wrong state");
+            held += dt;
             return;
         }
-
-        for (auto &fan : fanList)
+        if (pwm.write(255 * percent / 100))
         {
-            unsigned int currentRPM = fan.getRPM();
-
-            int adjustedRPM = (fan.a * (fanSpeed->second * fanSpeed->second)) + (fan.b * fanSpeed->second) + fan.c;
-            int deviation = std::abs((int(currentRPM) - int(adjustedRPM))) * 100 / (adjustedRPM);
-            printf("checkFanSpeed: ""%s"" rpm: %d, set percentage: %d, adjusted rpm: %d, deviation: %d\n", fan.name.c_str(), currentRPM, fanSpeed->second, adjustedRPM, deviation);
-
-            if(deviation > MAX_DEVIATION)
-            {
-                printf("Deviation of ""%s"" speed is %d%%!\n", fan.name.c_str(), deviation);
-                syslog(LOG_WARNING, "Deviation of ""%s"" speed is %d%%!", fan.name.c_str(), deviation);
-            }
+            lastPercent = percent;
+            held = 0;
         }
     }
 
-    int getMaxTemp()
+    void checkSpeed()
     {
-        static int errorCnt = 0;
-        int max = INT_MIN;
-
-        for (auto &sensor : tempList)
-        {
-            int temp = sensor.getTemp();
-            if(max < temp)
-                max = temp;
-        }
-
-        if(max == INT_MIN)
-        {
-            if(errorCnt < 5)
-            {
-                errorCnt++;
-                syslog(LOG_WARNING, "ERROR: temperature readings in zone %s are invalid. Reporting max value", name.c_str());
-            }
-            return INT_MAX;
-        }
+        long current;
+        double expected = expectedRPM(config, lastPercent);
 
-        errorCnt = 0;
-        printf("MAX temp = %d\n", max); 
-        return max;
-    }
-
-    void adjustSpeed()
-    {
-        printf("\nADJUSTING %s\n", name.c_str());
-        int currentTemp = getMaxTemp();
+        if (lastPercent < 0 || held < FAN_SETTLE_TIME || expected <= 0)
+            return;
+        if (!rpm.read(current))
+            return;
 
-        if(currentTemp > upperThreshold)
-        {
-            printf("Current temperature > %dC. Increase Speed\n", upperThreshold);
-            increaseSpeed();
-        }
-        else if(currentTemp < lowerThreshold)
+        int deviation = std::abs(current - expected) * 100 / expected;
+        if (verbose)
+            printf("%s: %ld rpm at %d%%, expected %.0f\n",
+                   config.name.c_str(), current, lastPercent, expected);
+        if (deviation > MAX_DEVIATION && !deviating)
         {
-            printf("Current temperature < %dC. Decrease Speed\n", lowerThreshold);
-            decreaseSpeed();
+            syslog(LOG_WARNING, "Deviation of %s speed is %d%%!",
+                   config.name.c_str(), deviation);
         }
-        else
+        else if (deviation <= MAX_DEVIATION && deviating)
         {
-            printf("Current temperature is between %dC and %dC. Do nothing\n", upperThreshold, lowerThreshold);
+            syslog(LOG_INFO, "%s speed is back in range", config.name.c_str());
         }
+        deviating = deviation > MAX_DEVIATION;
     }
 
 private:
-    std::string name;
-    unsigned int state;
-    std::map<unsigned int, unsigned int> speedTable;
-    std::vector<Temp> tempList;
-    std::vector<Fan> fanList;
+    FanConfig config;
+    SysfsAttr rpm;
+    SysfsAttr pwm;
+    int lastPercent = -1;
+    double held = 0;
+    bool deviating = false;
+};
 
-    void populateFanState(std::vector<unsigned int> &thresholds)
+class FanCtrlZone
+{
+public:
+    FanCtrlZone(const ZoneConfig &config) : config(config), ctrl(config)
     {
-        int i = 0;
-        for (auto &threshold : thresholds)
-        {
-            speedTable[++i] = threshold;
-        }
-        state = i;
+        for (auto &temp : config.temps)
+            temps.emplace_back(temp, "temp1_input", O_RDONLY);
+        for (auto &fan : config.fans)
+            fans.emplace_back(fan);
     }
 
-    void setFansSpeed(uint8_t percent)
+    // Hottest sensor of the zone, NaN if none could be read
+    double readTemp()
     {
-        for (auto &fan : fanList)
-        {
-            fan.setPWM(percent);
-        }
-    }
+        double max = NAN;
+        long val;
 
-    void setInitialState()
-    {
-        auto fanSpeed = speedTable.find(state);
-        if(fanSpeed == speedTable.end())
+        for (auto &temp : temps)
         {
-            return;
+            if (temp.read(val) && (std::isnan(max) || val / 1000.0 > max))
+                max = val / 1000.0;
         }
-
-        setFansSpeed(fanSpeed->second);
+        return max;
     }
 
-    void increaseSpeed()
+    void update(double temp, double dt)
     {
-        printf("Increasing speed from state %d\n", state);
-        auto nextSpeed = speedTable.find(state+1);
+        bool failsafe = ctrl.inFailsafe();
 
-        if(nextSpeed == speedTable.end())
+        ctrl.update(temp, dt);
+        if (ctrl.inFailsafe() && !failsafe)
         {
-            printf("Cant increase speed, max state\n");
-            return;
+            syslog(LOG_WARNING, "ERROR: temperature readings in %s are invalid. "
+                   "Setting fans to %.0f%%", config.name.c_str(), config.failsafe);
+        }
+        else if (failsafe && !ctrl.inFailsafe())
+        {
+            syslog(LOG_INFO, "temperature readings in %s are back",
+                   config.name.c_str());
         }
 
-        setFansSpeed(nextSpeed->second);
-        printf("Increased speed to %d%%\n", nextSpeed->second);
-        state++;
-        return;
+        if (verbose)
+            printf("%s: %.1fC, duty %.1f%% (integral %.1f)\n",
+                   config.name.c_str(), temp, ctrl.output(), ctrl.integral());
     }
 
-    void decreaseSpeed()
+    void setFans(double dt)
     {
-        printf("Decreasing speed from state %d\n", state);
-        auto nextSpeed = speedTable.find(state-1);
+        int percent = ctrl.duty();
 
-        if(nextSpeed == speedTable.end())
+        for (auto &fan : fans)
         {
-            printf("Cant decrease speed, min state\n");
-            return;
+            fan.setPercent(percent, dt);
+            fan.checkSpeed();
         }
-
-        setFansSpeed(nextSpeed->second);
-        printf("Decreased speed to %d%%\n", nextSpeed->second);
-        state--;
-        return;
     }
+
+private:
+    ZoneConfig config;
+    ZoneController ctrl;
+    std::vector<SysfsAttr> temps;
+    std::vector<Fan> fans;
 };
 
-struct jsonDevice {
-std::string name;
-std::string bus;
-std::string address;
-} jsonDevice;
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c config] [-v]\n", prog);
+    exit(1);
+}
 
-int main()
+int main(int argc, char **argv)
 {
-    std::cout << "FAN CTRL\n" << std::endl;
-    std::vector<FanCtrlZone> zonesVec;
-    std::vector<unsigned int> fanThresholds;
+    const char *configPath = CONFIG_FILE;
+    std::vector<FanCtrlZone> zones;
+    ControlConfig config;
+    struct itimerspec its;
+    uint64_t expirations;
+    int opt, tfd;
+
+    while ((opt = getopt(argc, argv, "c:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            configPath = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
 
-    if(gpio_get(76))
+    if (gpio_get(76))
     {
         return 0;
     }
@@ -366,164 +315,73 @@ int main()
     printf("BMC0. Running fan-control\n");
     syslog(LOG_WARNING, "BMC0. Running fan-control");
 
-    std::ifstream jsonFile("/etc/fan-control-config.json");
-    nlohmann::json configFile;
-    jsonFile >> configFile;
-
-    // find adjustment period in config file
-    int adjPeriod = configFile.value("AdjustmentPeriod", ADJUSTMENT_PERIOD);
-    upperThreshold = configFile.value("UpperThreshold", UPPER_THRESHOLD);
-    lowerThreshold = configFile.value("LowerThreshold", LOWER_THRESHOLD);
-
-    // find thresholds in config file
-    auto const thresholds = configFile.find("FanSpeedStates");
-    if (thresholds == configFile.end())
+    try
     {
-        std::cerr << "Thresholds Not Found";
-        return 1;
+        std::ifstream jsonFile(configPath);
+        json configFile;
+        jsonFile >> configFile;
+        config = parseConfig(configFile);
     }
-    else
+    catch (const std::exception &ex)
     {
-        for (auto threshold : *thresholds)
-        {
-            fanThresholds.push_back(threshold);
-        }
+        std::cerr << "Invalid " << configPath << ": " << ex.what() << std::endl;
+        syslog(LOG_ERR, "Invalid %s: %s", configPath, ex.what());
+        return 1;
+    }
 
-        if(fanThresholds.empty())
-        {
-            std::cerr << "Thresholds not found";
-            return 1;
-        }
+    zones.reserve(config.zones.size());
+    for (auto &zone : config.zones)
+    {
+        printf("%s: setpoint %.1fC, kp %g ki %g kd %g, %.0f-%.0f%%\n",
+               zone.name.c_str(), zone.setpoint, zone.pid.kp, zone.pid.ki,
+               zone.pid.kd, zone.minPercent, zone.maxPercent);
+        zones.emplace_back(zone);
     }
 
-    // find zones in config file
-    auto const zones = configFile.find("Zones");
-    if (zones == configFile.end())
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd < 0)
     {
-        std::cerr << "Zones Not Found";
+        syslog(LOG_ERR, "timerfd_create: %s", strerror(errno));
         return 1;
     }
-
-    int i = 1;
-    int fanNum = 1;
-    int tempNum = 1;
-    for (const nlohmann::json& zone : *zones)
+    its.it_interval.tv_sec = (time_t)config.period;
+    its.it_interval.tv_nsec = (long)((config.period - its.it_interval.tv_sec) * 1e9);
+    // the first sweep right away
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = 1;
+    if (timerfd_settime(tfd, 0, &its, NULL) < 0)
     {
-        std::vector<struct::jsonDevice> fansVec;
-        std::vector<struct::jsonDevice> tempVec;
-        std::vector<Fan> fanList;
-        std::vector<Temp> tempList;
+        syslog(LOG_ERR, "timerfd_settime: %s", strerror(errno));
+        return 1;
+    }
 
-        auto const fans = zone.find("fans");
-        if (fans == zone.end())
+    // Control loop: one sweep per period, each master selector is
+    // acquired once per sweep rather than once per file
+    while (1)
+    {
+        if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
         {
-            std::cerr << "Fans Not Found";
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "timerfd read: %s", strerror(errno));
             return 1;
         }
-        else
-        {
-            for (auto it : *fans)
-            {
-                fansVec.push_back({"fan" + std::to_string(fanNum), it[0], it[1]});
-                fanNum++;
-            }
-        }
+        // a late sweep catches up on the time it missed
+        double dt = expirations * config.period;
+        std::vector<double> temps;
 
-        auto const temp = zone.find("temp");
-        if (temp == zone.end())
-        {
-            std::cerr << "Temperature sensors Not Found";
-            return 1;
-        }
-        else
-        {
-            for (auto it : *temp)
-            {
-                tempVec.push_back({"temp" + std::to_string(tempNum), it[0], it[1]});
-                tempNum++;
-            }
-        }
+        i2c_master_selector_access(TEMP_SELECTOR_BUS, TEMP_SELECTOR_ADDR);
+        for (auto &zone : zones)
+            temps.push_back(zone.readTemp());
 
-        for (auto vec : fansVec)
-        {
-            float a, b, c;
-            if(vec.address.compare("18") == 0)
-            {
-                a = -1.9469;
-                b = 475.4;
-                c = -1829.1;
-            }
-            else if(vec.address.compare("19") == 0)
-            {
-                a = -0.8753;
-                b = 395;
-                c = -498.75;
-            }
-            else if(vec.address.compare("1a") == 0)
-            {
-                a = -0.9237;
-                b = 398.58;
-                c = -628.9;
-            }
-            else if(vec.address.compare("2c") == 0)
-            {
-                a = -0.8487;
-                b = 389.09;
-                c = -413.5;
-            }
-            else
-            {
-                a = 0;
-                b = 0;
-                c = 0;
-            }
-
-
-            std::cout << vec.name << " " << vec.bus << " " << vec.address << " " << a << " " << b << " " << c << '\n';
-            std::optional<std::string> path = findDevicePath(vec.bus, vec.address);
-            if(path)
-                fanList.push_back(Fan(vec.name, *path, a, b, c));
-        }
-        for (auto vec : tempVec)
-        {
-            std::cout << vec.name << " " << vec.bus << " " << vec.address  << '\n';
-            std::optional<std::string> path = findDevicePath(vec.bus, vec.address);
-            if(path)
-                tempList.push_back(Temp(vec.name, *path));
-        }
+        for (size_t i = 0; i < zones.size(); i++)
+            zones[i].update(temps[i], dt);
 
-        std::string zoneName = "zone" + std::to_string(i++);
-        std::cout << zoneName << '\n';
-        if(fanList.empty())
-        {
-            printf("No fans in %s\n", zoneName.c_str());
+        if (i2c_master_selector_access(FAN_SELECTOR_BUS, FAN_SELECTOR_ADDR) < 0)
             continue;
-        }
-        if(tempList.empty())
-        {
-            printf("No temp sensors in %s\n", zoneName.c_str());
-        }
-
-        zonesVec.push_back(FanCtrlZone(zoneName, fanThresholds, tempList, fanList));
-    }
-
-    // Control algorythm
-    while(1)
-    {
-        printf("\n\n\n\n");
-        sleep(5);
-        printf("\nfan readings:\n");
-        for (auto &zone : zonesVec)
-        {
-            zone.checkFansSpeed();
-        }
-
-        for (auto &zone : zonesVec)
-        {
-            zone.adjustSpeed();
-        }
-        sleep(adjPeriod - 5);
+        for (auto &zone : zones)
+            zone.setFans(dt);
     }
 
     return 0;
-}
\ No newline at end of file
+}
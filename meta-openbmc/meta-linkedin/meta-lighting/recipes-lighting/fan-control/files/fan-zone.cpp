@@ -0,0 +1,283 @@
+/*
+ * fan-control zone controller
+ *
+ * Copyright 2019-present LinkedIn. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "fan-zone.hpp"
+
+using json = nlohmann::json;
+
+// Bus numbers are decimal, addresses hex; both may be strings or numbers
+static int toInt(const json &val, int base)
+{
+    if (val.is_number())
+    {
+        return val.get<int>();
+    }
+    return std::stoi(val.get<std::string>(), nullptr, base);
+}
+
+// A device is either ["bus", "address"] or {"bus": .., "address": ..}
+static void parseDevice(const json &dev, DeviceConfig &out)
+{
+    if (dev.is_array())
+    {
+        out.bus = toInt(dev.at(0), 10);
+        out.address = toInt(dev.at(1), 16);
+    }
+    else
+    {
+        out.bus = toInt(dev.at("bus"), 10);
+        out.address = toInt(dev.at("address"), 16);
+    }
+}
+
+// Zone settings fall back to the top level "Defaults"
+static const json *lookup(const json &zone, const json &defaults,
+                          const char *key)
+{
+    auto it = zone.find(key);
+    if (it != zone.end())
+    {
+        return &*it;
+    }
+    it = defaults.find(key);
+    if (it != defaults.end())
+    {
+        return &*it;
+    }
+    return nullptr;
+}
+
+static void parseZone(const std::string &name, const json &zone,
+                      const json &defaults, ZoneConfig &cfg, int &fanNum,
+                      int &tempNum)
+{
+    const json *val;
+
+    cfg.name = name;
+
+    auto const fans = zone.find("fans");
+    if (fans == zone.end() || fans->empty())
+    {
+        throw std::runtime_error("Fans not found in " + name);
+    }
+    for (auto &dev : *fans)
+    {
+        FanConfig fan;
+        fan.name = "fan" + std::to_string(fanNum++);
+        parseDevice(dev, fan);
+        if (dev.is_object() && dev.find("curve") != dev.end())
+        {
+            auto &curve = dev.at("curve");
+            fan.a = curve.at(0).get<double>();
+            fan.b = curve.at(1).get<double>();
+            fan.c = curve.at(2).get<double>();
+        }
+        cfg.fans.push_back(fan);
+    }
+
+    auto const temps = zone.find("temp");
+    if (temps == zone.end())
+    {
+        throw std::runtime_error("Temperature sensors not found in " + name);
+    }
+    for (auto &dev : *temps)
+    {
+        DeviceConfig temp;
+        temp.name = "temp" + std::to_string(tempNum++);
+        parseDevice(dev, temp);
+        cfg.temps.push_back(temp);
+    }
+
+    if ((val = lookup(zone, defaults, "setpoint")))
+    {
+        cfg.setpoint = val->get<double>();
+    }
+    if ((val = lookup(zone, defaults, "feedforward")))
+    {
+        for (auto &point : *val)
+        {
+            cfg.feedForward.emplace_back(point.at(0).get<double>(),
+                                         point.at(1).get<double>());
+        }
+        std::sort(cfg.feedForward.begin(), cfg.feedForward.end());
+    }
+    if ((val = lookup(zone, defaults, "pid")))
+    {
+        cfg.pid.kp = val->value("kp", cfg.pid.kp);
+        cfg.pid.ki = val->value("ki", cfg.pid.ki);
+        cfg.pid.kd = val->value("kd", cfg.pid.kd);
+        cfg.pid.iLimit = val->value("ilimit", cfg.pid.iLimit);
+    }
+    if ((val = lookup(zone, defaults, "min")))
+    {
+        cfg.minPercent = val->get<double>();
+    }
+    if ((val = lookup(zone, defaults, "max")))
+    {
+        cfg.maxPercent = val->get<double>();
+    }
+    if ((val = lookup(zone, defaults, "slew")))
+    {
+        cfg.slewUp = val->value("up", cfg.slewUp);
+        cfg.slewDown = val->value("down", cfg.slewDown);
+    }
+    if ((val = lookup(zone, defaults, "hysteresis")))
+    {
+        cfg.hysteresis = val->get<double>();
+    }
+    if ((val = lookup(zone, defaults, "failsafe")))
+    {
+        cfg.failsafe = val->get<double>();
+    }
+
+    if (cfg.minPercent < 0 || cfg.maxPercent > 100 ||
+        cfg.minPercent > cfg.maxPercent)
+    {
+        throw std::runtime_error("Invalid duty range in " + name);
+    }
+    if (cfg.slewUp <= 0 || cfg.slewDown <= 0)
+    {
+        throw std::runtime_error("Invalid slew limit in " + name);
+    }
+}
+
+ControlConfig parseConfig(const json &config)
+{
+    ControlConfig cfg;
+    json defaults = config.value("Defaults", json::object());
+    int fanNum = 1;
+    int tempNum = 1;
+
+    cfg.period = config.value("Period", (double)DEFAULT_PERIOD);
+    if (cfg.period <= 0)
+    {
+        throw std::runtime_error("Invalid control period");
+    }
+
+    auto const zones = config.find("Zones");
+    if (zones == config.end())
+    {
+        throw std::runtime_error("Zones not found");
+    }
+    for (auto it = zones->begin(); it != zones->end(); ++it)
+    {
+        ZoneConfig zone;
+        parseZone(it.key(), it.value(), defaults, zone, fanNum, tempNum);
+        cfg.zones.push_back(zone);
+    }
+    return cfg;
+}
+
+double expectedRPM(const FanConfig &fan, double percent)
+{
+    return fan.a * percent * percent + fan.b * percent + fan.c;
+}
+
+ZoneController::ZoneController(const ZoneConfig &config)
+    : config(config), out(config.failsafe), lastTemp(NAN)
+{
+}
+
+// Piecewise linear, flat beyond the first and last points
+double ZoneController::feedForward(double temp) const
+{
+    auto &points = config.feedForward;
+
+    if (points.empty())
+    {
+        return config.minPercent;
+    }
+    if (temp <= points.front().first)
+    {
+        return points.front().second;
+    }
+    if (temp >= points.back().first)
+    {
+        return points.back().second;
+    }
+
+    auto hi = std::upper_bound(points.begin(), points.end(), temp,
+        [](double t, const std::pair<double, double> &p) {
+            return t < p.first;
+        });
+    auto lo = hi - 1;
+    return lo->second + (hi->second - lo->second) *
+           (temp - lo->first) / (hi->first - lo->first);
+}
+
+double ZoneController::update(double temp, double dt)
+{
+    if (std::isnan(temp))
+    {
+        // ride out a short outage, e.g. the other BMC holding the bus
+        if (missed < FAILSAFE_SWEEPS && ++missed < FAILSAFE_SWEEPS)
+        {
+            return out;
+        }
+        // then go to the failsafe duty at once, and start the derivative
+        // afresh once the sensors are back
+        lastTemp = NAN;
+        out = std::max(out, config.failsafe);
+        return out;
+    }
+    missed = 0;
+
+    double err = temp - config.setpoint;
+    double deriv = std::isnan(lastTemp) || dt <= 0 ? 0 : (temp - lastTemp) / dt;
+    double base = feedForward(temp) + config.pid.kp * err + config.pid.kd * deriv;
+    double iNext = std::clamp(iTerm + config.pid.ki * err * dt,
+                              -config.pid.iLimit, config.pid.iLimit);
+    double target = base + iNext;
+    lastTemp = temp;
+
+    // anti-windup: do not integrate further into saturation
+    if (!((target > config.maxPercent && err > 0) ||
+          (target < config.minPercent && err < 0)))
+    {
+        iTerm = iNext;
+    }
+    target = std::clamp(base + iTerm, config.minPercent, config.maxPercent);
+
+    if (target > out)
+    {
+        out = std::min(target, out + config.slewUp * dt);
+    }
+    else
+    {
+        out = std::max(target, out - config.slewDown * dt);
+    }
+    return out;
+}
+
+int ZoneController::duty()
+{
+    int percent = std::lround(out);
+
+    if (lastDuty < 0 || std::abs(out - lastDuty) >= config.hysteresis ||
+        (percent != lastDuty && (out <= config.minPercent ||
+                                 out >= config.maxPercent)))
+    {
+        lastDuty = percent;
+    }
+    return lastDuty;
+}
@@ -0,0 +1,132 @@
+/*
+ * fan-control zone controller
+ *
+ * Copyright 2019-present LinkedIn. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FAN_ZONE_HPP
+#define FAN_ZONE_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <nlohmann/json.hpp>
+
+#define DEFAULT_PERIOD 2 // seconds
+#define DEFAULT_FAILSAFE 100 // percent
+#define FAILSAFE_SWEEPS 3 // sweeps without a reading before failsafe
+
+// Device as found in the config: bus number and hex address
+struct DeviceConfig
+{
+    std::string name;
+    int bus;
+    int address;
+};
+
+struct FanConfig : DeviceConfig
+{
+    // expected RPM = a * percent^2 + b * percent + c, all zero if unknown
+    double a = 0;
+    double b = 0;
+    double c = 0;
+};
+
+struct PidConfig
+{
+    double kp = 0;
+    double ki = 0;
+    double kd = 0;
+    // bound of the integral term, in percent
+    double iLimit = 30;
+};
+
+struct ZoneConfig
+{
+    std::string name;
+    std::vector<FanConfig> fans;
+    std::vector<DeviceConfig> temps;
+
+    // temperature the PID loop holds the hottest sensor at
+    double setpoint = 75;
+    // (temperature, percent) points, the open loop part of the output
+    std::vector<std::pair<double, double>> feedForward;
+    PidConfig pid;
+    double minPercent = 20;
+    double maxPercent = 100;
+    // largest change of the output, in percent per second
+    double slewUp = 100;
+    double slewDown = 100;
+    // smallest duty change written to the fans, in percent
+    double hysteresis = 1;
+    // output while no temperature sensor of the zone can be read
+    double failsafe = DEFAULT_FAILSAFE;
+};
+
+struct ControlConfig
+{
+    // seconds between two control sweeps
+    double period = DEFAULT_PERIOD;
+    std::vector<ZoneConfig> zones;
+};
+
+// Parse /etc/fan-control-config.json, throws std::runtime_error or
+// nlohmann::json exceptions on malformed configs
+ControlConfig parseConfig(const nlohmann::json &config);
+
+// Expected RPM of a fan running at percent, 0 if its curve is unknown
+double expectedRPM(const FanConfig &fan, double percent);
+
+/*
+ * Feed-forward + PID on the hottest sensor of a zone. The feed-forward
+ * curve gives the duty a temperature needs in steady state, the PID loop
+ * trims it to hold the setpoint. The integral only winds while the output
+ * is not saturated in the same direction, and the derivative is taken on
+ * the measurement so setpoint changes do not kick the fans. The output is
+ * slew limited, except towards the failsafe duty, which it takes once
+ * FAILSAFE_SWEEPS updates in a row had no reading.
+ */
+class ZoneController
+{
+public:
+    explicit ZoneController(const ZoneConfig &config);
+
+    // temp: hottest sensor of the zone, NaN if none could be read;
+    // dt: seconds since the previous update. Returns the duty in percent,
+    // held as it was through the first sweeps without a reading.
+    double update(double temp, double dt);
+
+    // Duty to write to the fans: the output rounded to a percent, only
+    // moved once the output is hysteresis away or at the end of its range
+    int duty();
+
+    double output() const { return out; }
+    double integral() const { return iTerm; }
+    bool inFailsafe() const { return missed >= FAILSAFE_SWEEPS; }
+
+private:
+    ZoneConfig config;
+    double out;
+    double iTerm = 0;
+    double lastTemp;
+    int lastDuty = -1;
+    int missed = 0;
+
+    double feedForward(double temp) const;
+};
+
+#endif
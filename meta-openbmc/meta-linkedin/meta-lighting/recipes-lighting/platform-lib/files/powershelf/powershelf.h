@@ -9,11 +9,40 @@
 #define   MAX_STR_SIZE                    32
 #define   MAX_RETRIES                     10
 #define   DEVICE_FILENAME_SIZE            128
-#define   MMAP_FILEPATH                   "/tmp/mmap.bin"
+#ifndef   HEALTH_SHM_NAME
+#define   HEALTH_SHM_NAME                 "/powershelf-health"
+#endif
+#define   HEALTH_SHM_MAGIC                0x48535350    /* "PSSH" */
+#define   HEALTH_SHM_VERSION              1
 
 #define   DEVICE_OPERATION_ON             0x80
 #define   DEVICE_OPERATION_OFF            0x0
 
+/*
+ * PCA9541A I2C-bus master selector
+ */
+#define   PCA9541_CONTROL                 0x1
+#define   PCA9541_ISTAT                   0x2
+#define   PCA9541_CTL_MYBUS               1 << 0
+#define   PCA9541_CTL_NMYBUS              1 << 1
+#define   PCA9541_CTL_BUSON               1 << 2
+#define   PCA9541_CTL_NBUSON              1 << 3
+#define   PCA9541_ISTAT_NMYTEST           1 << 5    /* other master asks for the bus */
+/*
+ * Bus ownership is trusted for this long after it was last checked
+ */
+#define   PCA9541_HOLD_MS                 200
+#define   MAX_SELECTOR_NUM                8
+/*
+ * Selector ownership and the PSU mux channel, shared by every process
+ * using the buses
+ */
+#ifndef   SELECTOR_SHM_NAME
+#define   SELECTOR_SHM_NAME               "/powershelf-selector"
+#endif
+#define   SELECTOR_SHM_MAGIC              0x4c455350    /* "PSEL" */
+#define   SELECTOR_SHM_VERSION            1
+
 /*
  * Register addresses
  */
@@ -28,6 +57,19 @@
 #define   STATUS_MFR_SPECIFIC             0x80
 #define   STATUS_FAN_ADDR                 0x81
 
+/*
+ * PMBus telemetry
+ */
+#define   PMBUS_VOUT_MODE                 0x20
+#define   PMBUS_READ_VIN                  0x88
+#define   PMBUS_READ_IIN                  0x89
+#define   PMBUS_READ_VOUT                 0x8b
+#define   PMBUS_READ_IOUT                 0x8c
+#define   PMBUS_READ_TEMPERATURE_1        0x8d
+#define   PMBUS_READ_FAN_SPEED_1          0x90
+#define   PMBUS_READ_POUT                 0x96
+#define   PMBUS_READ_PIN                  0x97
+
 #define   STATUS_POWER_GOOD_MASK         0x800
 #define   STATUS_INPUT_MASK              0x2000
 
@@ -175,6 +217,8 @@ typedef struct status_info {
  *                PSU                     *
  ******************************************/
 
+#define   PSU_BUS                  3
+#define   PSU_MUX_ADDR             0x70
 #define   MAX_PSU_NUM              6
 #define   MAX_PSU_NUM_ASIDE        3
 #define   PSU_FAN_NUM              3
@@ -334,6 +378,32 @@ typedef struct psu_info {
     int    temperature[PSU_FAN_NUM];
 } psu_info_t;
 
+/* ****************************************
+ *         Health segment                 *
+ ******************************************/
+/*
+ * Latest readings of all devices, published by healthmon in /dev/shm.
+ * healthmon maps it once and is its only writer; seq is odd while it
+ * updates the readings, readers copy them out and retry if seq changed.
+ */
+typedef struct health_shm {
+    /*
+     * written last when the segment is set up, cleared when a new
+     * healthmon replaces it; readers then map the new one
+     */
+    uint32_t      magic;
+    uint32_t      version;
+    uint32_t      size;
+    uint32_t      seq;
+    /*
+     * bumped by psu-util to have healthmon clear a PSU's status counters
+     */
+    uint32_t      psu_clear_req[MAX_PSU_NUM];
+    fan_info_t    fan_info;
+    psu_info_t    psu_info[MAX_PSU_NUM];
+    efuse_info_t  efuse_info[MAX_EFUSE_NUM];
+} health_shm_t;
+
 
 /* ****************************************
  *         Common Functions               *
@@ -341,12 +411,21 @@ typedef struct psu_info {
 uint8_t crc8(const void* vptr, int len);
 int i2c_master_selector_ctrl(uint8_t ctrl_reg);
 int i2c_master_selector_access(uint8_t bus, uint8_t addr);
+unsigned int i2c_master_selector_epoch(uint8_t bus);
+void i2c_master_selector_hold(int ms);
+void i2c_master_selector_release_idle(void);
+int i2c_select_psu(uint8_t psu_num);
+int i2c_hwmon_dir(uint8_t bus, uint8_t addr, char *dev_file);
+int i2c_read_byte_retry(int fd, uint8_t reg);
 int i2c_open(uint8_t bus, uint8_t addr);
 int i2c_write_device(const char *device, int value);
 int i2c_read_device(const char *device, int *value);
 int i2c_read_device_float(char* dir, char *device, float *value);
 int get_file_offset(device_type type);
 int get_mmap_info (int* cache, device_type type, size_t len);
+health_shm_t* health_shm_create(void);
+void health_shm_write_begin(health_shm_t *shm);
+void health_shm_write_end(health_shm_t *shm);
 int convert2compl_to_decimal (int data, int bits);
 int read_value_linear (char* dir, char *device, float *value);
 
@@ -16,6 +16,11 @@
 #include "powershelf.h"
 #include <syslog.h>
 #include <sys/mman.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
 
 int
 i2c_open(uint8_t bus, uint8_t addr) {
@@ -158,75 +163,263 @@ int read_value_linear (char* dir, char *device, float *value)
 }
 
 /*
- * PCA9541A I2C-bus master selector
+ * SMBus byte read with the usual retries
  */
+int
+i2c_read_byte_retry(int fd, uint8_t reg)
+{
+  int val = i2c_smbus_read_byte_data(fd, reg);
+
+  for (int retry = 0; (retry < MAX_RETRIES) && (val < 0); retry++) {
+    usleep(1000);
+    val = i2c_smbus_read_byte_data(fd, reg);
+  }
+  return val;
+}
 
 /*
- * I2C-bus master selector: check if bus on and has control
+ * hwmon directory of a device, found once and kept while it exists
  */
-int i2c_master_selector_ctrl(uint8_t ctrl_reg) {
-  /*
-   * check bus on and has the control
-   * PCA9541A I2C-bus master selector:  table 12
-   */
-  if ((ctrl_reg == 0x4) || (ctrl_reg == 0x7) || (ctrl_reg == 0x8) || (ctrl_reg == 0xb)) {
+#define MAX_HWMON_CACHE   96
+
+static struct {
+  uint8_t bus;
+  uint8_t addr;
+  char    path[DEVICE_FILENAME_SIZE];
+} hwmon_cache[MAX_HWMON_CACHE];
+static int hwmon_cached = 0;
+static pthread_mutex_t hwmon_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int
+i2c_hwmon_dir(uint8_t bus, uint8_t addr, char *dev_file)
+{
+  char dir[DEVICE_FILENAME_SIZE];
+  struct dirent *ent;
+  DIR *d;
+  int i, ret = -1;
+
+  pthread_mutex_lock(&hwmon_lock);
+  for (i = 0; i < hwmon_cached; i++) {
+    if (hwmon_cache[i].bus == bus && hwmon_cache[i].addr == addr) {
+      break;
+    }
+  }
+  if (i < hwmon_cached && access(hwmon_cache[i].path, F_OK) == 0) {
+    strcpy(dev_file, hwmon_cache[i].path);
+    pthread_mutex_unlock(&hwmon_lock);
     return 0;
   }
-  else
-    return -1;
+
+  snprintf(dir, DEVICE_FILENAME_SIZE,
+           "/sys/class/i2c-adapter/i2c-%d/%d-%04x/hwmon", bus, bus, addr);
+  d = opendir(dir);
+  if (d) {
+    while ((ent = readdir(d)) != NULL) {
+      if (strncmp(ent->d_name, "hwmon", 5) == 0) {
+        if (snprintf(dev_file, DEVICE_FILENAME_SIZE, "%s/%s", dir, ent->d_name) <
+            DEVICE_FILENAME_SIZE) {
+          ret = 0;
+        }
+        break;
+      }
+    }
+    closedir(d);
+  }
+
+  if (ret == 0) {
+    if (i == hwmon_cached && hwmon_cached < MAX_HWMON_CACHE) {
+      hwmon_cached++;
+    }
+    if (i < hwmon_cached) {
+      hwmon_cache[i].bus = bus;
+      hwmon_cache[i].addr = addr;
+      strcpy(hwmon_cache[i].path, dev_file);
+    }
+  }
+  pthread_mutex_unlock(&hwmon_lock);
+  return ret;
 }
 
-int i2c_select_psu(uint8_t psu_num)
+/*
+ * PCA9541A I2C-bus master selector
+ *
+ * Ownership of each selector is cached: it is taken once and then
+ * trusted for PCA9541_HOLD_MS after it was last checked, so a batch of
+ * reads costs no arbitration at all. Once the hold time is over the bus
+ * is checked again and handed over if the other master asked for it.
+ *
+ * Ownership belongs to this BMC, not to a process: healthmon and the
+ * utilities share it, and the PSU mux channel, in SELECTOR_SHM_NAME
+ * under a flock() on the segment. Only the i2c-dev handles are per
+ * process. Without the segment nothing is cached.
+ */
+typedef struct selector_state {
+  uint8_t         bus;
+  uint8_t         addr;
+  uint8_t         used;
+  uint8_t         owned;
+  uint32_t        epoch;
+  uint64_t        checked;
+} selector_state_t;
+
+typedef struct selector_shm {
+  uint32_t          magic;
+  uint32_t          version;
+  selector_state_t  sel[MAX_SELECTOR_NUM];
+  int               psu_channel;    /* 0 if not known */
+  uint32_t          psu_epoch;
+} selector_shm_t;
+
+static selector_shm_t *selector_shm = NULL;
+static selector_shm_t selector_local;
+static int selector_shm_fd = -1;
+static int selector_fds[MAX_SELECTOR_NUM];
+static int selector_hold_ms = PCA9541_HOLD_MS;
+static pthread_mutex_t selector_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t selector_once = PTHREAD_ONCE_INIT;
+
+static uint64_t
+mono_ms(void)
 {
-  int  fd = -1;
+  struct timespec ts;
 
-  if(psu_num < 1 || psu_num > MAX_PSU_NUM) {
-    return -1;
-  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-  fd = i2c_open(3, 0x70);
+static void
+selector_shm_init(void)
+{
+  selector_shm_t *shm;
+  struct stat st;
+  int fd;
 
-  if (fd < 0) {
-    return -1;
+  for (int i = 0; i < MAX_SELECTOR_NUM; i++) {
+    selector_fds[i] = -1;
   }
 
-  uint8_t val = pow(2, psu_num-1);
+  fd = shm_open(SELECTOR_SHM_NAME, O_RDWR | O_CREAT, 0600);
+  if (fd == -1) {
+    syslog(LOG_WARNING, "Failed to open selector segment, errno: %d", errno);
+    return;
+  }
+
+  flock(fd, LOCK_EX);
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < sizeof(selector_shm_t) && ftruncate(fd, sizeof(selector_shm_t)) != 0)) {
+    flock(fd, LOCK_UN);
+    close(fd);
+    return;
+  }
+  shm = mmap(NULL, sizeof(selector_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (shm == MAP_FAILED) {
+    flock(fd, LOCK_UN);
+    close(fd);
+    return;
+  }
+  if (shm->magic != SELECTOR_SHM_MAGIC || shm->version != SELECTOR_SHM_VERSION) {
+    memset(shm, 0, sizeof(selector_shm_t));
+    shm->magic = SELECTOR_SHM_MAGIC;
+    shm->version = SELECTOR_SHM_VERSION;
+  }
+  flock(fd, LOCK_UN);
 
-  i2c_smbus_write_byte_data(fd, 0x0, val);
-  close(fd);
-  return 0;
+  selector_shm = shm;
+  selector_shm_fd = fd;
 }
 
-int i2c_master_selector_access(uint8_t bus, uint8_t addr) {
-  int      fd = -1;
-  int      ret = -1, retry = 0;
-  int      val, write_val;
-  int      change = 1;
-  uint8_t  control_reg = 0x1;
+/*
+ * Lock the selector state against the other threads and processes
+ */
+static selector_shm_t *
+selector_state_lock(void)
+{
+  pthread_once(&selector_once, selector_shm_init);
+  pthread_mutex_lock(&selector_lock);
+  if (selector_shm) {
+    while (flock(selector_shm_fd, LOCK_EX) < 0 && errno == EINTR);
+    return selector_shm;
+  }
+  return &selector_local;
+}
 
-  if(bus > MAX_I2C_BUS_NUM) {
-    return -1;
+static void
+selector_state_unlock(void)
+{
+  if (selector_shm) {
+    flock(selector_shm_fd, LOCK_UN);
   }
+  pthread_mutex_unlock(&selector_lock);
+}
 
-  fd = i2c_open(bus, addr);
+/*
+ * Hold time in effect: cached ownership can't be trusted without the
+ * segment, some other process may have given the bus away
+ */
+static int
+selector_hold(void)
+{
+  return selector_shm ? selector_hold_ms : 0;
+}
 
-  if (fd < 0) {
-    return -1;
+/*
+ * Index of the selector in the shared state, with its i2c-dev handle
+ * opened in this process, or -1
+ */
+static int
+selector_get(selector_shm_t *shm, uint8_t bus, uint8_t addr)
+{
+  int i;
+
+  for (i = 0; i < MAX_SELECTOR_NUM; i++) {
+    if (shm->sel[i].used && shm->sel[i].bus == bus && shm->sel[i].addr == addr) {
+      break;
+    }
+  }
+  if (i == MAX_SELECTOR_NUM) {
+    for (i = 0; i < MAX_SELECTOR_NUM && shm->sel[i].used; i++);
+    if (i == MAX_SELECTOR_NUM) {
+      return -1;
+    }
+    memset(&shm->sel[i], 0, sizeof(selector_state_t));
+    shm->sel[i].bus = bus;
+    shm->sel[i].addr = addr;
+    shm->sel[i].used = 1;
   }
 
-  val = i2c_smbus_read_byte_data(fd, control_reg);
+  if (selector_fds[i] < 0) {
+    selector_fds[i] = i2c_open(bus, addr);
+  }
+  return (selector_fds[i] >= 0) ? i : -1;
+}
 
-  while ((retry < MAX_RETRIES) && (val < 0)) {
-    usleep(10000);
-    val = i2c_smbus_read_byte_data(fd, control_reg);
-    if (val < 0)
-      retry++;
-    else
-      break;
+/*
+ * I2C-bus master selector: check if bus on and has control
+ */
+int i2c_master_selector_ctrl(uint8_t ctrl_reg) {
+  /*
+   * check bus on and has the control
+   * PCA9541A I2C-bus master selector:  table 12
+   */
+  if ((ctrl_reg == 0x4) || (ctrl_reg == 0x7) || (ctrl_reg == 0x8) || (ctrl_reg == 0xb)) {
+    return 0;
   }
+  else
+    return -1;
+}
+
+/*
+ * Take the bus unless it is ours already.
+ * Return 1 if it was taken over, 0 if it was ours, -1 on failure
+ */
+static int
+selector_arbitrate(int fd)
+{
+  int      val, write_val;
+  int      change = 1;
 
+  val = i2c_read_byte_retry(fd, PCA9541_CONTROL);
   if (val < 0) {
-    close(fd);
     return -1;
   }
   val = val & 0xf;
@@ -235,7 +428,6 @@ int i2c_master_selector_access(uint8_t bus, uint8_t addr) {
    * already bus on and has the control
    */
   if (i2c_master_selector_ctrl(val) == 0) {
-    close(fd);
     return 0;
   }
 
@@ -258,161 +450,402 @@ int i2c_master_selector_access(uint8_t bus, uint8_t addr) {
     change = 0;
 
   if (change) {
-    i2c_smbus_write_byte_data(fd, control_reg, write_val);
+    i2c_smbus_write_byte_data(fd, PCA9541_CONTROL, write_val);
   }
 
   /*
    * check bus on and has the control after write
    */
-  val = i2c_smbus_read_byte_data(fd, control_reg);
-  if (i2c_master_selector_ctrl(val) != 0) {
-    close(fd);
+  val = i2c_smbus_read_byte_data(fd, PCA9541_CONTROL);
+  if (val < 0 || i2c_master_selector_ctrl(val & 0xf) != 0) {
+    return -1;
+  }
+
+  /*
+   * drop requests the other master made before we took over
+   */
+  i2c_smbus_read_byte_data(fd, PCA9541_ISTAT);
+  return 1;
+}
+
+/*
+ * Turn the bus off so the other master can take it without waiting
+ */
+static void
+selector_release(selector_state_t *sel, int fd)
+{
+  int val = i2c_smbus_read_byte_data(fd, PCA9541_CONTROL);
+
+  if (val >= 0 && i2c_master_selector_ctrl(val & 0xf) == 0) {
+    i2c_smbus_write_byte_data(fd, PCA9541_CONTROL, (val & PCA9541_CTL_NBUSON) >> 1);
+  }
+  sel->owned = 0;
+}
+
+int i2c_master_selector_access(uint8_t bus, uint8_t addr) {
+  selector_shm_t   *shm;
+  selector_state_t *sel;
+  uint64_t          now;
+  int               i, fd, val, ret = 0;
+
+  if(bus > MAX_I2C_BUS_NUM) {
+    return -1;
+  }
+
+  shm = selector_state_lock();
+  if ((i = selector_get(shm, bus, addr)) < 0) {
+    selector_state_unlock();
+    return -1;
+  }
+  sel = &shm->sel[i];
+  fd = selector_fds[i];
+
+  now = mono_ms();
+  if (sel->owned && now - sel->checked < selector_hold()) {
+    selector_state_unlock();
+    return 0;
+  }
+
+  if (sel->owned) {
+    val = i2c_smbus_read_byte_data(fd, PCA9541_ISTAT);
+    if (val >= 0 && (val & PCA9541_ISTAT_NMYTEST)) {
+      /*
+       * the other master wants the bus: let it have it and take it
+       * back on the next access
+       */
+      selector_release(sel, fd);
+      selector_state_unlock();
+      return -1;
+    }
+  }
+
+  val = selector_arbitrate(fd);
+  if (val >= 0) {
+    if (val == 1 || !sel->owned) {
+      sel->epoch++;
+    }
+    sel->owned = 1;
+    sel->checked = now;
+  } else {
+    sel->owned = 0;
+    ret = -1;
+  }
+  selector_state_unlock();
+  return ret;
+}
+
+/*
+ * Changes whenever some selector on the bus was (re)taken, after which
+ * the other master may have changed what is behind it
+ */
+static unsigned int
+selector_epoch(selector_shm_t *shm, uint8_t bus)
+{
+  unsigned int epoch = 0;
+
+  for (int i = 0; i < MAX_SELECTOR_NUM; i++) {
+    if (shm->sel[i].used && shm->sel[i].bus == bus) {
+      epoch += shm->sel[i].epoch;
+    }
+  }
+  return epoch;
+}
+
+unsigned int i2c_master_selector_epoch(uint8_t bus)
+{
+  unsigned int epoch;
+
+  epoch = selector_epoch(selector_state_lock(), bus);
+  selector_state_unlock();
+  return epoch;
+}
+
+void i2c_master_selector_hold(int ms)
+{
+  selector_hold_ms = ms;
+}
+
+/*
+ * Hand back the buses that were not used for the hold time, by this or
+ * any other process. Left to healthmon, which runs all the time: a
+ * utility exiting doesn't know whether others still use the bus.
+ */
+void i2c_master_selector_release_idle(void)
+{
+  selector_shm_t *shm;
+  uint64_t now = mono_ms();
+  int i;
+
+  shm = selector_state_lock();
+  for (i = 0; i < MAX_SELECTOR_NUM; i++) {
+    if (shm->sel[i].used && shm->sel[i].owned &&
+        now - shm->sel[i].checked >= selector_hold_ms &&
+        selector_get(shm, shm->sel[i].bus, shm->sel[i].addr) == i) {
+      selector_release(&shm->sel[i], selector_fds[i]);
+    }
+  }
+  selector_state_unlock();
+}
+
+/*
+ * PSU channel of the mux behind the PSU bus selector, only written when
+ * it is not the one last written by any process
+ */
+int i2c_select_psu(uint8_t psu_num)
+{
+  static int          fd = -1;
+  selector_shm_t     *shm;
+  unsigned int        now_epoch;
+  int                 ret = 0;
+
+  if(psu_num < 1 || psu_num > MAX_PSU_NUM) {
     return -1;
   }
 
-  close(fd);
-  return 0;
+  shm = selector_state_lock();
+  if (fd < 0) {
+    fd = i2c_open(PSU_BUS, PSU_MUX_ADDR);
+    if (fd < 0) {
+      selector_state_unlock();
+      return -1;
+    }
+  }
+
+  now_epoch = selector_epoch(shm, PSU_BUS);
+  if (!selector_shm || shm->psu_channel != psu_num || shm->psu_epoch != now_epoch) {
+    if (i2c_smbus_write_byte_data(fd, 0x0, 1 << (psu_num - 1)) < 0) {
+      shm->psu_channel = 0;
+      ret = -1;
+    } else {
+      shm->psu_channel = psu_num;
+      shm->psu_epoch = now_epoch;
+    }
+  }
+  selector_state_unlock();
+  return ret;
+}
+
+/*
+ * Readers give up after this many attempts that overlapped an update
+ */
+#define HEALTH_SHM_RETRIES    10000
+
+static const health_shm_t *health_shm = NULL;
+
+static inline uint32_t seq_read(const uint32_t *seq) {
+    return *(volatile const uint32_t *) seq;
+}
+
+static inline void seq_write(uint32_t *seq, uint32_t val) {
+    *(volatile uint32_t *) seq = val;
 }
 
 int get_file_offset(device_type type)
 {
     switch(type) {
     case FILE_FAN:
-       return 0;
+       return offsetof(health_shm_t, fan_info);
     case FILE_PSU:
-       return (sizeof(fan_info_t));
+       return offsetof(health_shm_t, psu_info);
     case FILE_EFUSE:
-       return (sizeof(fan_info_t) + MAX_PSU_NUM*sizeof(psu_info_t));
+       return offsetof(health_shm_t, efuse_info);
     default:
        return -1;
     }
 }
 
-int
-get_mmap_info (int* cache, device_type type, size_t len)
+static health_shm_t *
+health_shm_map (int flags)
 {
-    int fd;
-    int *map;
-    int status, size, offset;
+    health_shm_t *shm;
     struct stat s;
-    int pagesize = getpagesize();
-    int done = 0, retries = 5;
+    int fd;
 
-    fd = open(MMAP_FILEPATH, O_RDONLY);
+    fd = shm_open(HEALTH_SHM_NAME, flags, 0);
     if (fd == -1) {
-        syslog(LOG_WARNING, "Failed to open mmap file\n");
-        return -1;
+        return NULL;
     }
 
-    for(int attempt; attempt < retries; ++attempt) {
-        done = flock(fd, LOCK_EX);
-        if (done != 0) {
-            /*
-             * flock errors
-             */
-            syslog(LOG_WARNING, "Failed to lock mmap file\n");
-            sleep(1);
-            continue;
-        }
-        else
-            break;
+    if (fstat(fd, &s) != 0 || s.st_size < sizeof(health_shm_t)) {
+        close(fd);
+        return NULL;
     }
 
-    if (done != 0) {
-        syslog(LOG_WARNING, "Failed to lock mmap file\n");
-        close(fd);
-        return -1;
+    shm = mmap(NULL, sizeof(health_shm_t),
+               (flags == O_RDWR) ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        syslog(LOG_ERR, "mmap failed, errno: %d", errno);
+        return NULL;
     }
 
-    /* Get the size of the file. */
-    status = fstat (fd, &s);
-    size = s.st_size;
-    size += pagesize-(size%pagesize);
+    if (seq_read(&shm->magic) != HEALTH_SHM_MAGIC ||
+        shm->version != HEALTH_SHM_VERSION ||
+        shm->size != sizeof(health_shm_t)) {
+        munmap(shm, sizeof(health_shm_t));
+        return NULL;
+    }
+    return shm;
+}
 
-    map = mmap(0, size,  PROT_READ, MAP_SHARED, fd, 0);
-    if (map == MAP_FAILED) {
-        close(fd);
-        syslog(LOG_ERR, "mmap failed, errno: %d", errno);
-        return -1;
+/*
+ * Mapping of the segment, kept for the life of the process and only
+ * replaced once healthmon has restarted
+ */
+static const health_shm_t *
+health_shm_get (void)
+{
+    if (health_shm && seq_read(&health_shm->magic) == HEALTH_SHM_MAGIC) {
+        return health_shm;
     }
 
-    offset = get_file_offset(type);
-    memcpy(cache, map+offset, len);
+    if (health_shm) {
+        munmap((void *) health_shm, sizeof(health_shm_t));
+    }
+    health_shm = health_shm_map(O_RDONLY);
+    return health_shm;
+}
 
-    flock(fd, LOCK_UN);
-    if (munmap(map, size) == -1) {
-        syslog(LOG_WARNING, "Error un-mmapping the file");
+/*
+ * Mark a segment left behind by a previous healthmon as gone
+ */
+static void
+health_shm_retire (void)
+{
+    health_shm_t *old = health_shm_map(O_RDWR);
+
+    if (old) {
+        seq_write(&old->magic, 0);
+        munmap(old, sizeof(health_shm_t));
     }
+}
+
+health_shm_t *
+health_shm_create (void)
+{
+    health_shm_t *shm;
+    int fd;
+
+    health_shm_retire();
+    shm_unlink(HEALTH_SHM_NAME);
 
+    fd = shm_open(HEALTH_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        syslog(LOG_WARNING, "Failed to create health segment, errno: %d", errno);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(health_shm_t)) != 0) {
+        syslog(LOG_WARNING, "Failed to size health segment, errno: %d", errno);
+        close(fd);
+        shm_unlink(HEALTH_SHM_NAME);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(health_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     close(fd);
-    return 0;
+    if (shm == MAP_FAILED) {
+        syslog(LOG_ERR, "mmap failed, errno: %d", errno);
+        shm_unlink(HEALTH_SHM_NAME);
+        return NULL;
+    }
+
+    shm->version = HEALTH_SHM_VERSION;
+    shm->size = sizeof(health_shm_t);
+    __sync_synchronize();
+    seq_write(&shm->magic, HEALTH_SHM_MAGIC);
+    return shm;
+}
+
+void
+health_shm_write_begin (health_shm_t *shm)
+{
+    seq_write(&shm->seq, shm->seq + 1);
+    __sync_synchronize();
+}
+
+void
+health_shm_write_end (health_shm_t *shm)
+{
+    __sync_synchronize();
+    seq_write(&shm->seq, shm->seq + 1);
 }
 
+/*
+ * Copy a consistent snapshot of one device table out of the segment.
+ * No locks or system calls unless the segment has to be (re)mapped.
+ */
 int
-reset_psu_mmap_stats (int psu_num, status_info_t *status_info, int num_status)
+get_mmap_info (int* cache, device_type type, size_t len)
 {
-    int fd;
-    int *map;
-    int status, size, offset;
-    struct stat s;
-    int pagesize = getpagesize();
-    int done = 0, retries = 5;
+    const health_shm_t *shm;
+    uint32_t before, after;
+    int offset;
 
-    fd = open(MMAP_FILEPATH, O_RDWR);
-    if (fd == -1) {
-        syslog(LOG_WARNING, "Failed to open mmap file\n");
+    offset = get_file_offset(type);
+    if (offset < 0 || offset + len > sizeof(health_shm_t)) {
         return -1;
     }
 
-    for(int attempt; attempt < retries; ++attempt) {
-        done = flock(fd, LOCK_EX);
-        if (done != 0) {
+    for (int attempt = 0; attempt < HEALTH_SHM_RETRIES; ++attempt) {
+        shm = health_shm_get();
+        if (!shm) {
+            syslog(LOG_WARNING, "Failed to map health segment\n");
+            return -1;
+        }
+
+        before = seq_read(&shm->seq);
+        if (before & 1) {
             /*
-             * flock errors
+             * healthmon is in the middle of an update
              */
-            syslog(LOG_WARNING, "Failed to lock mmap file\n");
-            sleep(1);
+            sched_yield();
             continue;
         }
-        else
-            break;
+        __sync_synchronize();
+        memcpy(cache, (const uint8_t *) shm + offset, len);
+        __sync_synchronize();
+        after = seq_read(&shm->seq);
+        if (before == after) {
+            return 0;
+        }
     }
 
-    if (done != 0) {
-        syslog(LOG_WARNING, "Failed to lock mmap file\n");
-        close(fd);
-        return -1;
-    }
+    syslog(LOG_WARNING, "Health segment kept changing while reading\n");
+    return -1;
+}
 
-    /* Get the size of the file. */
-    status = fstat (fd, &s);
-    size = s.st_size;
-    size += pagesize-(size%pagesize);
+int
+reset_psu_mmap_stats (int psu_num, status_info_t *status_info, int num_status)
+{
+    psu_info_t psu_info[MAX_PSU_NUM];
+    health_shm_t *shm;
 
-    map = mmap(0, size,  PROT_WRITE, MAP_SHARED, fd, 0);
-    if (map == MAP_FAILED) {
-        close(fd);
-        syslog(LOG_ERR, "mmap failed, errno: %d", errno);
+    if (psu_num < 0 || psu_num >= MAX_PSU_NUM) {
         return -1;
     }
 
-    offset = get_file_offset(FILE_PSU);
-
-    psu_info_t *psu_info = (psu_info_t*)(map+offset);
+    if (get_mmap_info((int*)psu_info, FILE_PSU, sizeof(psu_info)) != 0) {
+        return -1;
+    }
 
     for (int i = 0; i < num_status; i++) {
         printf("%s: %d\n", status_info[i].status_desc, psu_info[psu_num].status_cntr[status_info[i].status]);
     }
     printf("\n");
 
-    memset(psu_info[psu_num].status_cntr, 0, PSU_STATUS_MAX);
-
-    flock(fd, LOCK_UN);
-    if (munmap(map, size) == -1) {
-        syslog(LOG_WARNING, "Error un-mmapping the file");
+    /*
+     * healthmon is the only writer of the readings, ask it to clear
+     * the counters on its next poll
+     */
+    shm = health_shm_map(O_RDWR);
+    if (!shm) {
+        syslog(LOG_WARNING, "Failed to map health segment\n");
+        return -1;
     }
-
-    close(fd);
+    __sync_fetch_and_add(&shm->psu_clear_req[psu_num], 1);
+    munmap(shm, sizeof(health_shm_t));
     return 0;
 }
 
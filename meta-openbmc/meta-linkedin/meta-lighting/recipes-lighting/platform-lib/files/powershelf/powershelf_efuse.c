@@ -145,125 +145,39 @@ int efuse_install_driver(uint8_t i2c_bus, uint8_t i2c_addr)
 
 int efuse_device_file(uint8_t efuse, char* dev_file)
 {
-    char      eFuse_file[DEVICE_FILENAME_SIZE];
-    char      dir[DEVICE_FILENAME_SIZE];
-    char      eFuse_dir[DEVICE_FILENAME_SIZE];
-    char      hwmon[DEVICE_FILENAME_SIZE];
-    char      cmd[DEVICE_FILENAME_SIZE];
-    char      info_dir[DEVICE_FILENAME_SIZE];
     int       i2c_addrs[] = {EFUSE_ADDRS};
     int       i2c_bus, i2c_addr;
-    FILE*     in;
-    struct    stat sb;
-    int       ret, retry;
+    int       retry = 0;
 
     i2c_bus = efuse_to_i2cbus(efuse);
     i2c_addr = i2c_addrs[efuse-1];
 
-    /*
-     * device directory
-     */
-    snprintf(dir, DEVICE_FILENAME_SIZE,
-             "/sys/class/i2c-adapter/i2c-%d/%d-00%x", i2c_bus, i2c_bus, i2c_addr);
-
     /*
      * eFuse sysfs directory
      */
-    snprintf(eFuse_dir, DEVICE_FILENAME_SIZE, "%s/hwmon", dir);
-
-    ret = stat(eFuse_dir, &sb);
-    while ((retry < 10) && (ret != 0)) {
+    while (i2c_hwmon_dir(i2c_bus, i2c_addr, dev_file) != 0) {
+        if (retry >= 10) {
+            syslog(LOG_WARNING, "efuse%d failed to open hwmon/\n", efuse);
+            return -1;
+        }
         usleep(10000);
         syslog(LOG_WARNING, "efuse%d failed to open hwmon/ retry: %d", efuse, retry);
         efuse_install_driver(i2c_bus, i2c_addr);
-        ret = stat(eFuse_dir, &sb);
-        if (ret != 0)
-           retry++;
-        else
-            break;
-    }
-
-    if (ret == 0 && S_ISDIR(sb.st_mode))
-    {
-        snprintf(cmd, DEVICE_FILENAME_SIZE, "ls %s", eFuse_dir);
-    }
-    else
-    {
-        syslog(LOG_WARNING, "efuse%d failed to open hwmon/\n", efuse);
-        return -1;
+        retry++;
     }
 
-    in=popen(cmd, "r");
-
-    if (in == NULL) {
-        syslog(LOG_WARNING, "efuse%d failed to open hwmon/\n", efuse);
-        return -1;
-    }
-
-    fgets(hwmon, 255, in);
-    hwmon[strlen(hwmon) - 1] = 0;
-    pclose(in);
-
-    snprintf(dev_file, DEVICE_FILENAME_SIZE, "%s/hwmon/%s", dir, hwmon);
-
     return 0;
 }
 
 int board_sensor_device_file(uint8_t board, char* dev_file)
 {
-    char      dir[DEVICE_FILENAME_SIZE];
-    char      board_dir[DEVICE_FILENAME_SIZE];
-    char      hwmon[DEVICE_FILENAME_SIZE];
-    char      cmd[DEVICE_FILENAME_SIZE];
     int       i2c_addrs[] = {BOARD_ADDRS};
-    int       i2c_bus, i2c_addr;
-    FILE*     in;
-    struct    stat sb;
-    int       ret;
-
-    i2c_bus = TEMP_BUS;
-    i2c_addr = i2c_addrs[board];
-    /*
-     * device directory
-     */
-    snprintf(dir, DEVICE_FILENAME_SIZE,
-             "/sys/class/i2c-adapter/i2c-%d/%d-00%x", i2c_bus, i2c_bus, i2c_addr);
 
-    /*
-     * eFuse sysfs directory
-     */
-    snprintf(board_dir, DEVICE_FILENAME_SIZE, "%s/hwmon", dir);
-
-    ret = stat(board_dir, &sb);
-    if (ret != 0)
-    {
+    if (i2c_hwmon_dir(TEMP_BUS, i2c_addrs[board], dev_file) != 0) {
         syslog(LOG_WARNING, "board%d failed to open hwmon/", board);
         return -1;
     }
 
-    if (ret == 0 && S_ISDIR(sb.st_mode))
-    {
-        snprintf(cmd, DEVICE_FILENAME_SIZE, "ls %s", board_dir);
-    }
-    else
-    {
-        syslog(LOG_WARNING, "board%d failed to open hwmon/\n", board);
-        return -1;
-    }
-
-    in=popen(cmd, "r");
-
-    if (in == NULL) {
-        syslog(LOG_WARNING, "board%d failed to open hwmon/\n", board);
-        return -1;
-    }
-
-    fgets(hwmon, 255, in);
-    hwmon[strlen(hwmon) - 1] = 0;
-    pclose(in);
-
-    snprintf(dev_file, DEVICE_FILENAME_SIZE, "%s/hwmon/%s", dir, hwmon);
-
     return 0;
 }
 
@@ -282,7 +196,10 @@ int i2c_read_efuse_temp(int efuse_idx, int *value)
 
     i2c_bus = TEMP_BUS;
     selector_addr = TEMP_MUX_ADDR;
-    i2c_master_selector_access(i2c_bus, selector_addr);
+    if (i2c_master_selector_access(i2c_bus, selector_addr) != 0) {
+        syslog(LOG_WARNING, "board temp: failed to get the i2c bus");
+        return -1;
+    }
 
     status = board_sensor_device_file(board_num[efuse_idx], board_file);
     if(status)
@@ -332,7 +249,10 @@ efuse_poll_info (efuse_info_t *efuse_info)
     efuse_info->i2c_addr = i2c_addr;
 
     selector_addr = efuse_i2c_selector_addr(i2c_bus);
-    i2c_master_selector_access(i2c_bus, selector_addr);
+    if (i2c_master_selector_access(i2c_bus, selector_addr) != 0) {
+        syslog(LOG_WARNING, "efuse%d: failed to get the i2c bus", efuse_info->efuse_num);
+        return -1;
+    }
 
     /*
      * device directory
@@ -447,7 +367,7 @@ char* efuse_get_operation_state(efuse_operation_state_t state)
 
 int efuse_get_status(efuse_info_t *efuse_info)
 {
-    int    fd, val, retry, num_faults;
+    int    fd, val, num_faults;
     int    i2c_addrs[] = {EFUSE_ADDRS};
     int    efuse_idx;
     int    i2c_bus, i2c_addr;
@@ -475,16 +395,7 @@ int efuse_get_status(efuse_info_t *efuse_info)
     /*
      * read operation register
      */
-    val = i2c_smbus_read_byte_data(fd, OPERATION_REG);
-    while ((retry < MAX_RETRIES) && (val < 0)) {
-        usleep(10000);
-        val = i2c_smbus_read_byte_data(fd, OPERATION_REG);
-        if (val < 0)
-           retry++;
-        else
-            break;
-    }
-
+    val = i2c_read_byte_retry(fd, OPERATION_REG);
     if (val < 0) {
         syslog(LOG_WARNING, "efuse%d failed to read operation register", efuse_info->efuse_num);
         close(fd);
@@ -502,18 +413,23 @@ int efuse_get_status(efuse_info_t *efuse_info)
     }
 
     num_faults = sizeof(efuse_status_table) / sizeof(efuse_status_table[0]);
+    int regs[num_faults];
 
     for (int i = 0; i < num_faults; i++) {
-        val = i2c_smbus_read_byte_data(fd, efuse_status_table[i].status_i2c_addr);
-        retry = 0;
-        while ((retry < MAX_RETRIES) && (val < 0)) {
-            usleep(1000);
-            val = i2c_smbus_read_byte_data(fd, efuse_status_table[i].status_i2c_addr);
-            if (val < 0)
-                retry++;
-            else
+        /*
+         * several faults share a status register, read each one once
+         */
+        val = -2;
+        for (int j = 0; j < i; j++) {
+            if (efuse_status_table[j].status_i2c_addr == efuse_status_table[i].status_i2c_addr) {
+                val = regs[j];
                 break;
+            }
+        }
+        if (val == -2) {
+            val = i2c_read_byte_retry(fd, efuse_status_table[i].status_i2c_addr);
         }
+        regs[i] = val;
 
         if (val >= 0) {
            if (val & efuse_status_table[i].bitmask) {
@@ -562,7 +478,10 @@ int efuse_operation (uint8_t efuse_num, uint8_t op)
     i2c_addr = i2c_addrs[efuse_num - 1];
 
     selector_addr = efuse_i2c_selector_addr(i2c_bus);
-    i2c_master_selector_access(i2c_bus, selector_addr);
+    if (i2c_master_selector_access(i2c_bus, selector_addr) != 0) {
+        syslog(LOG_WARNING, "efuse%d: failed to get the i2c bus", efuse_num);
+        return -1;
+    }
 
     fd = i2c_open(i2c_bus, i2c_addr);
     if (fd < 0) {
@@ -96,59 +96,13 @@ void fan_show_status(fan_info_t *fan_info)
 
 int fan_device_file(uint8_t fan, char* dev_file)
 {
-    char      dir[DEVICE_FILENAME_SIZE];
-    char      fan_dir[DEVICE_FILENAME_SIZE];
-    char      hwmon[DEVICE_FILENAME_SIZE];
-    char      cmd[DEVICE_FILENAME_SIZE];
     int       i2c_addrs[] = {FAN_ADDR};
-    int       i2c_bus, i2c_addr;
-    FILE*     in;
-    struct    stat sb;
-    int       ret;
-
-    i2c_bus = 8;
-    i2c_addr = i2c_addrs[fan];
-    /*
-     * device directory
-     */
-    snprintf(dir, DEVICE_FILENAME_SIZE,
-             "/sys/class/i2c-adapter/i2c-%d/%d-00%x", i2c_bus, i2c_bus, i2c_addr);
-
-    /*
-     * eFuse sysfs directory
-     */
-    snprintf(fan_dir, DEVICE_FILENAME_SIZE, "%s/hwmon", dir);
-
-    ret = stat(fan_dir, &sb);
-    if (ret != 0)
-    {
-        syslog(LOG_WARNING, "fan%d failed to open hwmon/", fan);
-        return -1;
-    }
-
-    if (ret == 0 && S_ISDIR(sb.st_mode))
-    {
-        snprintf(cmd, DEVICE_FILENAME_SIZE, "ls %s", fan_dir);
-    }
-    else
-    {
-        syslog(LOG_WARNING, "fan%d failed to open hwmon/\n", fan);
-        return -1;
-    }
 
-    in=popen(cmd, "r");
-
-    if (in == NULL) {
-        syslog(LOG_WARNING, "fan%d failed to open hwmon/\n", fan);
+    if (i2c_hwmon_dir(FAN_BUS, i2c_addrs[fan], dev_file) != 0) {
+        syslog(LOG_WARNING, "fan%d failed to open hwmon/", fan);
         return -1;
     }
 
-    fgets(hwmon, 255, in);
-    hwmon[strlen(hwmon) - 1] = 0;
-    pclose(in);
-
-    snprintf(dev_file, DEVICE_FILENAME_SIZE, "%s/hwmon/%s", dir, hwmon);
-
     return 0;
 }
 
@@ -168,7 +122,10 @@ int fan_poll_info(fan_info_t *fan_info)
         return -1;
     }
 
-    i2c_master_selector_access(FAN_BUS, FAN_MUX_ADDR);
+    if (i2c_master_selector_access(FAN_BUS, FAN_MUX_ADDR) != 0) {
+        syslog(LOG_WARNING, "fan: failed to get the i2c bus");
+        return -1;
+    }
 
     for(int fan_num = 0 ; fan_num < 4 ; fan_num++)
     {
@@ -112,6 +112,19 @@ psu_info_t psu_info_cache[MAX_PSU_NUM];
 
 int psu_2_i2cbus[] = {3, 3, 3, 3, 3, 3};
 
+/*
+ * i2c-dev handles of the PSUs, kept open across polls
+ */
+static int psu_fds[MAX_PSU_NUM] = {[0 ... MAX_PSU_NUM - 1] = -1};
+
+static int psu_fd (int psu)
+{
+    if (psu_fds[psu] < 0) {
+        psu_fds[psu] = i2c_open(i2c_buses[psu], i2c_addrs[psu]);
+    }
+    return psu_fds[psu];
+}
+
 void psu_usage ()
 {
     fprintf(stderr, "Usage: psu-eeprom|psu-util [psu unit 1 - 6]\n");
@@ -311,18 +324,10 @@ float get_psu_vout(char* dir)
 
 int psu_poll_info(psu_info_t *psu_info)
 {
-    char      psu_file[DEVICE_FILENAME_SIZE];
-    char      dir[DEVICE_FILENAME_SIZE];
-    uint32_t  val;
-    int       status_vout;
-    int       status_iout;
-    int       status_vin;
+    int       val, vout_mode;
     int       i2c_bus, i2c_addr, selector_addr;
     int       read_status = -1;
-    int       psu;
-    int       i2c_buses[] = {PSU_BUSES};
-    int       i2c_addrs[] = {PSU_ADDRS};
-    float     vin,  iin, iout, vout, pin, pout;
+    int       psu, fd;
 
     if (!psu_info) {
         syslog(LOG_WARNING, "Invalid input:  NULL \n");
@@ -330,7 +335,7 @@ int psu_poll_info(psu_info_t *psu_info)
     }
 
     if (psu_info->psu_num < 1 || psu_info->psu_num > MAX_PSU_NUM) {
-        syslog(LOG_WARNING, "Invalid input: PSU number %d,  range: 1 - 6 %d \n", psu_info->psu_num);
+        syslog(LOG_WARNING, "Invalid input: PSU number %d,  range: 1 - 6 \n", psu_info->psu_num);
         return -1;
     }
 
@@ -340,11 +345,17 @@ int psu_poll_info(psu_info_t *psu_info)
     i2c_addr = i2c_addrs[psu];
     selector_addr = i2c_selector_addrs[psu];
 
-    i2c_master_selector_access(i2c_bus, selector_addr);
-    i2c_select_psu(psu_info->psu_num);
+    if (i2c_master_selector_access(i2c_bus, selector_addr) != 0 ||
+        i2c_select_psu(psu_info->psu_num) != 0) {
+        syslog(LOG_WARNING, "psu%d: failed to get the i2c bus", psu_info->psu_num);
+        return -1;
+    }
 
-    snprintf(dir, DEVICE_FILENAME_SIZE,
-             "/sys/class/i2c-adapter/i2c-%d/%d-00%x", i2c_bus, i2c_bus, i2c_addr);
+    fd = psu_fd(psu);
+    if (fd < 0) {
+        syslog(LOG_WARNING, "psu%d: failed to open i2c", psu_info->psu_num);
+        return -1;
+    }
 
     /*
      * PSU number: 1 - 6
@@ -352,33 +363,45 @@ int psu_poll_info(psu_info_t *psu_info)
     psu_info->i2c_bus = i2c_bus;
     psu_info->i2c_addr = i2c_addr;
 
-    if (read_value_linear(dir, "vin", &vin) == 0) {
-        psu_info->volt_input = vin;
+    /*
+     * Telemetry is read straight from the PMBus registers over the bus
+     * we hold, without going through sysfs for every value
+     */
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_VIN)) >= 0) {
+        psu_info->volt_input = psu_get_realvalue(val);
     }
 
-    if (read_value_linear(dir, "iin", &iin) == 0) {
-        psu_info->current_input = iin;
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_IIN)) >= 0) {
+        psu_info->current_input = psu_get_realvalue(val);
     }
 
-    if (read_value_linear(dir, "iout", &iout) == 0) {
-        psu_info->current_output = iout;
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_IOUT)) >= 0) {
+        psu_info->current_output = psu_get_realvalue(val);
     }
 
-    if (read_value_linear(dir, "pin", &pin) == 0) {
-        psu_info->power_input = pin;
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_PIN)) >= 0) {
+        psu_info->power_input = psu_get_realvalue(val);
     }
 
-    if (read_value_linear(dir, "pout", &pout) == 0) {
-        psu_info->power_output = pout;
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_POUT)) >= 0) {
+        psu_info->power_output = psu_get_realvalue(val);
     }
 
-    psu_info->volt_out = get_psu_vout(dir);
+    vout_mode = i2c_smbus_read_byte_data(fd, PMBUS_VOUT_MODE);
+    val = i2c_smbus_read_word_data(fd, PMBUS_READ_VOUT);
+    if (vout_mode >= 0 && val >= 0) {
+        psu_info->volt_out = psu_get_realvalue_vout(vout_mode, val);
+    }
+    else {
+        syslog(LOG_WARNING, "vout: failed");
+        psu_info->volt_out = -1;
+    }
 
     /*
      * PSU operation
      */
-    snprintf(psu_file, DEVICE_FILENAME_SIZE, "%s/operation", dir);
-    if (i2c_read_device(psu_file, &val) != 0) {
+    val = i2c_read_byte_retry(fd, OPERATION_REG);
+    if (val < 0) {
         return -1;
     }
 
@@ -397,8 +420,7 @@ int psu_poll_info(psu_info_t *psu_info)
     /*
      * PSU fan speed
      */
-    snprintf(psu_file, DEVICE_FILENAME_SIZE, "%s/fan1_speed", dir);
-    if (i2c_read_device(psu_file, &val) != 0) {
+    if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_FAN_SPEED_1)) < 0) {
         syslog(LOG_WARNING, "fan_speed: read failed\n");
     }
     else {
@@ -408,28 +430,13 @@ int psu_poll_info(psu_info_t *psu_info)
     /*
      * PSU temperatures
      */
-    snprintf(psu_file, DEVICE_FILENAME_SIZE, "%s/temperature1", dir);
-    if (i2c_read_device(psu_file, &val) != 0) {
-        syslog(LOG_WARNING, "temperature1: read failed\n");
-    }
-    else {
-        psu_info->temperature[0] = psu_get_realvalue(val);
-    }
-
-    snprintf(psu_file, DEVICE_FILENAME_SIZE, "%s/temperature2", dir);
-    if (i2c_read_device(psu_file, &val) != 0) {
-        syslog(LOG_WARNING, "temperature2: read failed\n");
-    }
-    else {
-        psu_info->temperature[1] = psu_get_realvalue(val);
-    }
-
-    snprintf(psu_file, DEVICE_FILENAME_SIZE, "%s/temperature3", dir);
-    if (i2c_read_device(psu_file, &val) != 0) {
-        syslog(LOG_WARNING, "temperature3: read failed\n", psu_file);
-    }
-    else {
-        psu_info->temperature[2] = psu_get_realvalue(val);
+    for (int i = 0; i < PSU_FAN_NUM; i++) {
+        if ((val = i2c_smbus_read_word_data(fd, PMBUS_READ_TEMPERATURE_1 + i)) < 0) {
+            syslog(LOG_WARNING, "temperature%d: read failed\n", i + 1);
+        }
+        else {
+            psu_info->temperature[i] = psu_get_realvalue(val);
+        }
     }
 
     /*
@@ -472,7 +479,7 @@ int psu_save_info(psu_info_t *psu_info)
 
 int psu_get_status(psu_info_t *psu_info)
 {
-    int val, fd, retry, num_faults;
+    int val, fd, num_faults;
     int status = -1;
 
     if (!psu_info) {
@@ -481,35 +488,39 @@ int psu_get_status(psu_info_t *psu_info)
     }
 
     num_faults = sizeof(psu_status_table) / sizeof(psu_status_table[0]);
+    int regs[num_faults];
 
-    fd = i2c_open(psu_info->i2c_bus, psu_info->i2c_addr);
+    fd = psu_fd(psu_info->psu_num - 1);
     if (fd < 0) {
         syslog(LOG_WARNING, "PSU%d failed to open i2c\n", psu_info->psu_num);
         return status;
     }
 
     for (int i = 0; i < num_faults; i++) {
-        val = i2c_smbus_read_byte_data(fd, psu_status_table[i].status_i2c_addr);
-        retry = 0;
-        while ((retry < MAX_RETRIES) && (val < 0)) {
-            usleep(1000);
-            val = i2c_smbus_read_byte_data(fd, psu_status_table[i].status_i2c_addr);
-            if (val < 0)
-                retry++;
-            else
+        /*
+         * several faults share a status register, read each one once
+         */
+        val = -2;
+        for (int j = 0; j < i; j++) {
+            if (psu_status_table[j].status_i2c_addr == psu_status_table[i].status_i2c_addr) {
+                val = regs[j];
                 break;
+            }
+        }
+        if (val == -2) {
+            val = i2c_read_byte_retry(fd, psu_status_table[i].status_i2c_addr);
         }
+        regs[i] = val;
 
-        if (val == -1) {
+        if (val < 0) {
             syslog(LOG_WARNING, "PSU%d %s read failed\n",
                    psu_info->psu_num, psu_status_table[i].status_desc);
 
             // even if one read fails, discard current read for psu
-            for (int fault = 0; i < num_faults ; fault++) {
-                psu_info->status_cntr[psu_status_table[i].status] = 0;
+            for (int fault = 0; fault < num_faults ; fault++) {
+                psu_info->status_cntr[psu_status_table[fault].status] = 0;
             }
 
-            close(fd);
             return status;
         }
         else {
@@ -521,7 +532,6 @@ int psu_get_status(psu_info_t *psu_info)
         }
     }
 
-    close(fd);
     return status;
 }
 
@@ -534,7 +544,7 @@ int psu_clear_status(psu_info_t *psu_info)
         return -1;
     }
 
-    fd = i2c_open(psu_info->i2c_bus, psu_info->i2c_addr);
+    fd = psu_fd(psu_info->psu_num - 1);
     if (fd < 0) {
         syslog(LOG_WARNING, "PSU%d failed to open for write i2c\n", psu_info->psu_num);
         return -1;
@@ -564,7 +574,6 @@ int psu_clear_status(psu_info_t *psu_info)
         syslog(LOG_WARNING, "PSU%d clear status success \n", psu_info->psu_num);
     }
 
-    close(fd);
     return 0;
 }
 
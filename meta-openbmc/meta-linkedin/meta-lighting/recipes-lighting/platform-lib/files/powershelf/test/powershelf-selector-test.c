@@ -0,0 +1,334 @@
+/*
+ * Copyright 2019-present Linkedin. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "powershelf.h"
+
+/*
+ * The master selector code against a model of the I2C buses: open(),
+ * ioctl() and close() on /dev/i2c-N are redirected (-Wl,--wrap) to a
+ * PCA9541A that another master can take over or ask for, and to the
+ * PSU channel mux. Every SMBus transfer is counted. A forked child
+ * stands in for another process using the buses; the model is its own
+ * copy, the selector state is shared.
+ */
+
+#define FD_BASE       1000
+#define MAX_FDS       64
+#define HOLD_MS       50
+
+typedef struct {
+  /*
+   * MYBUS and BUSON are ours to write, NMYBUS and NBUSON belong to the
+   * other master; the bus is ours if MYBUS == NMYBUS, on if
+   * BUSON != NBUSON
+   */
+  int mybus, buson;
+  int nmybus, nbuson;
+  int istat;
+} pca9541_model_t;
+
+static struct {
+  int used;
+  int bus;
+  int addr;
+} fds[MAX_FDS];
+
+static pca9541_model_t psu_sel;
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static int transfers;
+static int control_writes;
+static int mux_writes;
+static int mux_channel;
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_ioctl(int fd, unsigned long req, ...);
+
+int
+__wrap_open(const char *path, int flags, ...)
+{
+  va_list ap;
+  int mode, bus;
+
+  if (sscanf(path, "/dev/i2c-%d", &bus) == 1) {
+    for (int i = 0; i < MAX_FDS; i++) {
+      if (!fds[i].used) {
+        fds[i].used = 1;
+        fds[i].bus = bus;
+        fds[i].addr = -1;
+        return FD_BASE + i;
+      }
+    }
+    return -1;
+  }
+
+  va_start(ap, flags);
+  mode = va_arg(ap, int);
+  va_end(ap);
+  return __real_open(path, flags, mode);
+}
+
+int
+__wrap_close(int fd)
+{
+  if (fd >= FD_BASE && fd < FD_BASE + MAX_FDS) {
+    fds[fd - FD_BASE].used = 0;
+    return 0;
+  }
+  return __real_close(fd);
+}
+
+static int
+ctrl_value(pca9541_model_t *m)
+{
+  return m->mybus | m->nmybus << 1 | m->buson << 2 | m->nbuson << 3;
+}
+
+static int
+model_owned(pca9541_model_t *m)
+{
+  return m->mybus == m->nmybus && m->buson != m->nbuson;
+}
+
+static int
+model_bus_off(pca9541_model_t *m)
+{
+  return m->buson == m->nbuson;
+}
+
+static int
+smbus(int bus, int addr, struct i2c_smbus_ioctl_data *args)
+{
+  int read = args->read_write == I2C_SMBUS_READ;
+
+  transfers++;
+  if (bus == PSU_BUS && addr == 0x71) {
+    if (args->command == PCA9541_CONTROL) {
+      if (read) {
+        args->data->byte = ctrl_value(&psu_sel);
+      } else {
+        psu_sel.mybus = args->data->byte & 1;
+        psu_sel.buson = (args->data->byte >> 2) & 1;
+        control_writes++;
+      }
+      return 0;
+    }
+    if (args->command == PCA9541_ISTAT && read) {
+      args->data->byte = psu_sel.istat;
+      psu_sel.istat = 0;
+      return 0;
+    }
+    return -1;
+  }
+  if (bus == PSU_BUS && addr == PSU_MUX_ADDR && !read) {
+    mux_writes++;
+    mux_channel = args->data->byte;
+    return 0;
+  }
+  return -1;
+}
+
+int
+__wrap_ioctl(int fd, unsigned long req, ...)
+{
+  va_list ap;
+  void *arg;
+  int i = fd - FD_BASE, ret;
+
+  va_start(ap, req);
+  arg = va_arg(ap, void *);
+  va_end(ap);
+
+  if (i < 0 || i >= MAX_FDS) {
+    return __real_ioctl(fd, req, arg);
+  }
+  if (req == I2C_SLAVE_FORCE) {
+    fds[i].addr = (int)(intptr_t) arg;
+    return 0;
+  }
+  if (req == I2C_SMBUS) {
+    pthread_mutex_lock(&model_lock);
+    ret = smbus(fds[i].bus, fds[i].addr, arg);
+    pthread_mutex_unlock(&model_lock);
+    return ret;
+  }
+  return -1;
+}
+
+/*
+ * The other master takes the bus whatever state it is in
+ */
+static void
+peer_take_over(void)
+{
+  psu_sel.nmybus = !psu_sel.mybus;
+  psu_sel.nbuson = !psu_sel.buson;
+}
+
+static int
+access_psu_bus(int *xfers)
+{
+  int before = transfers, ret;
+
+  ret = i2c_master_selector_access(PSU_BUS, 0x71);
+  if (xfers) {
+    *xfers = transfers - before;
+  }
+  return ret;
+}
+
+static void *
+hammer(void *arg)
+{
+  for (int i = 0; i < 2000; i++) {
+    assert(access_psu_bus(NULL) == 0);
+  }
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  pthread_t tid[4];
+  unsigned int epoch;
+  int xfers, writes, status;
+  pid_t pid;
+
+  shm_unlink(SELECTOR_SHM_NAME);
+  i2c_master_selector_hold(HOLD_MS);
+
+  /*
+   * the other master owns the bus at first: it is taken over
+   */
+  psu_sel.nmybus = 1;
+  psu_sel.nbuson = 0;
+  psu_sel.buson = 1;
+  assert(access_psu_bus(&xfers) == 0);
+  assert(model_owned(&psu_sel));
+  assert(control_writes == 1);
+  printf("arbitration: %d transfers\n", xfers);
+  epoch = i2c_master_selector_epoch(PSU_BUS);
+
+  /*
+   * a batch of accesses within the hold time is free
+   */
+  for (int i = 0; i < 100; i++) {
+    assert(access_psu_bus(&xfers) == 0);
+    assert(xfers == 0);
+  }
+
+  /*
+   * after the hold time ownership is checked, not retaken
+   */
+  usleep((HOLD_MS + 10) * 1000);
+  assert(access_psu_bus(&xfers) == 0);
+  assert(xfers == 2);
+  assert(control_writes == 1);
+  assert(i2c_master_selector_epoch(PSU_BUS) == epoch);
+
+  /*
+   * a takeover by the other master is noticed once the hold time is
+   * over, and then the PSU mux has to be set again
+   */
+  assert(i2c_select_psu(2) == 0);
+  assert(mux_channel == 1 << 1);
+  writes = mux_writes;
+  assert(i2c_select_psu(2) == 0);
+  assert(mux_writes == writes);
+  assert(i2c_select_psu(6) == 0);
+  assert(mux_channel == 1 << 5 && mux_writes == writes + 1);
+
+  peer_take_over();
+  usleep((HOLD_MS + 10) * 1000);
+  assert(access_psu_bus(&xfers) == 0);
+  assert(model_owned(&psu_sel));
+  assert(control_writes == 2);
+  assert(i2c_master_selector_epoch(PSU_BUS) != epoch);
+  writes = mux_writes;
+  assert(i2c_select_psu(6) == 0);
+  assert(mux_writes == writes + 1);
+
+  /*
+   * the other master asks for the bus: it is handed over, and taken
+   * back on the next access
+   */
+  psu_sel.istat |= PCA9541_ISTAT_NMYTEST;
+  usleep((HOLD_MS + 10) * 1000);
+  assert(access_psu_bus(NULL) == -1);
+  assert(model_bus_off(&psu_sel));
+  assert(access_psu_bus(NULL) == 0);
+  assert(model_owned(&psu_sel));
+
+  /*
+   * idle buses are released, busy ones are kept
+   */
+  i2c_master_selector_release_idle();
+  assert(model_owned(&psu_sel));
+  usleep((HOLD_MS + 10) * 1000);
+  i2c_master_selector_release_idle();
+  assert(model_bus_off(&psu_sel));
+  assert(access_psu_bus(NULL) == 0);
+  assert(model_owned(&psu_sel));
+
+  /*
+   * another process trusts the bus this one took, and a mux channel it
+   * changed is set again here
+   */
+  assert(i2c_select_psu(6) == 0);
+  writes = mux_writes;
+  assert(access_psu_bus(NULL) == 0);
+  pid = fork();
+  if (pid == 0) {
+    _exit(access_psu_bus(&xfers) != 0 || xfers != 0 || i2c_select_psu(3) != 0);
+  }
+  assert(pid > 0 && waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(i2c_select_psu(6) == 0);
+  assert(mux_writes == writes + 1);
+
+  /*
+   * and it leaves the bus ours when it exits
+   */
+  assert(access_psu_bus(&xfers) == 0 && xfers == 0);
+
+  /*
+   * concurrent workers share the selector state
+   */
+  writes = control_writes;
+  for (int i = 0; i < 4; i++) {
+    assert(pthread_create(&tid[i], NULL, hammer, NULL) == 0);
+  }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  assert(control_writes == writes);
+  printf("8000 accesses from 4 threads: %d transfers in total\n", transfers);
+
+  shm_unlink(SELECTOR_SHM_NAME);
+  printf("All tests passed\n");
+  return 0;
+}
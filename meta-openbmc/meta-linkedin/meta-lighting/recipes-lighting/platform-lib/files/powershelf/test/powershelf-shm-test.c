@@ -0,0 +1,296 @@
+/*
+ * Copyright 2019-present Linkedin. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "powershelf.h"
+
+/*
+ * A simulated healthmon publishes readings as fast as it can while
+ * reader processes, like psu-util or the REST handlers, copy device
+ * tables out of the segment. Every field of a table is derived from the
+ * same generation number, so a snapshot mixing two updates is caught.
+ */
+
+#define NUM_READERS   4
+#define RUN_SECONDS   2
+
+typedef struct {
+    unsigned long reads;
+    unsigned long torn;
+    unsigned long failed;
+} reader_stats_t;
+
+static volatile int stop;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+on_alarm(int sig)
+{
+    stop = 1;
+}
+
+static void
+publish(health_shm_t *shm, int gen)
+{
+    health_shm_write_begin(shm);
+    for (int i = 0; i < MAX_FAN_NUM; i++) {
+        shm->fan_info.fan_speed[i] = gen + i;
+    }
+    shm->fan_info.i2c_addr = gen;
+    for (int i = 0; i < MAX_PSU_NUM; i++) {
+        shm->psu_info[i].psu_num = i + 1;
+        shm->psu_info[i].fan_speed = gen;
+        shm->psu_info[i].i2c_addr = gen + i;
+        for (int j = 0; j < PSU_FAN_NUM; j++) {
+            shm->psu_info[i].temperature[j] = gen - j;
+        }
+    }
+    for (int i = 0; i < MAX_EFUSE_NUM; i++) {
+        shm->efuse_info[i].efuse_num = i + 1;
+        shm->efuse_info[i].fan_speed = gen;
+        shm->efuse_info[i].temperature = gen + i;
+    }
+    health_shm_write_end(shm);
+}
+
+/*
+ * Generation of a snapshot, -1 if its fields disagree
+ */
+static int
+check_fan(const fan_info_t *fan)
+{
+    for (int i = 0; i < MAX_FAN_NUM; i++) {
+        if (fan->fan_speed[i] != fan->i2c_addr + i) {
+            return -1;
+        }
+    }
+    return fan->i2c_addr;
+}
+
+static int
+check_psu(const psu_info_t *psu)
+{
+    int gen = psu[0].fan_speed;
+
+    for (int i = 0; i < MAX_PSU_NUM; i++) {
+        if (psu[i].fan_speed != gen || psu[i].i2c_addr != gen + i) {
+            return -1;
+        }
+        for (int j = 0; j < PSU_FAN_NUM; j++) {
+            if (psu[i].temperature[j] != gen - j) {
+                return -1;
+            }
+        }
+    }
+    return gen;
+}
+
+static int
+check_efuse(const efuse_info_t *efuse)
+{
+    int gen = efuse[0].fan_speed;
+
+    for (int i = 0; i < MAX_EFUSE_NUM; i++) {
+        if (efuse[i].fan_speed != gen || efuse[i].temperature != gen + i) {
+            return -1;
+        }
+    }
+    return gen;
+}
+
+static const health_shm_t *
+map_raw(void)
+{
+    const health_shm_t *shm;
+    int fd = shm_open(HEALTH_SHM_NAME, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(health_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (shm == MAP_FAILED) ? NULL : shm;
+}
+
+/*
+ * Read through the library, or with a plain copy when unsafe is set to
+ * show that the test would notice torn data
+ */
+static void
+reader(reader_stats_t *stats, int unsafe)
+{
+    static fan_info_t fan;
+    static psu_info_t psu[MAX_PSU_NUM];
+    static efuse_info_t efuse[MAX_EFUSE_NUM];
+    const health_shm_t *shm = NULL;
+    int gens[3];
+
+    if (unsafe) {
+        while (!(shm = map_raw())) {
+            sched_yield();
+        }
+    }
+
+    while (!stop) {
+        if (unsafe) {
+            memcpy(&fan, &shm->fan_info, sizeof(fan));
+            memcpy(psu, shm->psu_info, sizeof(psu));
+            memcpy(efuse, shm->efuse_info, sizeof(efuse));
+        } else if (get_mmap_info((int*)&fan, FILE_FAN, sizeof(fan)) != 0 ||
+                   get_mmap_info((int*)psu, FILE_PSU, sizeof(psu)) != 0 ||
+                   get_mmap_info((int*)efuse, FILE_EFUSE, sizeof(efuse)) != 0) {
+            stats->failed++;
+            continue;
+        }
+        gens[0] = check_fan(&fan);
+        gens[1] = check_psu(psu);
+        gens[2] = check_efuse(efuse);
+        stats->reads++;
+        if (gens[0] < 0 || gens[1] < 0 || gens[2] < 0) {
+            stats->torn++;
+        }
+    }
+}
+
+static void
+run(const char *name, int unsafe, reader_stats_t *total, double *writes)
+{
+    reader_stats_t *stats;
+    health_shm_t *shm;
+    pid_t pids[NUM_READERS];
+    unsigned long gen = 0;
+    double start;
+
+    stats = mmap(NULL, NUM_READERS * sizeof(reader_stats_t),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(stats != MAP_FAILED);
+    memset(stats, 0, NUM_READERS * sizeof(reader_stats_t));
+
+    shm = health_shm_create();
+    assert(shm);
+    publish(shm, gen++);
+
+    stop = 0;
+    for (int i = 0; i < NUM_READERS; i++) {
+        pids[i] = fork();
+        assert(pids[i] >= 0);
+        if (pids[i] == 0) {
+            signal(SIGALRM, on_alarm);
+            alarm(RUN_SECONDS);
+            reader(&stats[i], unsafe);
+            _exit(0);
+        }
+    }
+
+    signal(SIGALRM, on_alarm);
+    alarm(RUN_SECONDS);
+    start = now();
+    while (!stop) {
+        publish(shm, gen++);
+    }
+    *writes = gen / (now() - start);
+
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < NUM_READERS; i++) {
+        assert(waitpid(pids[i], NULL, 0) == pids[i]);
+        total->reads += stats[i].reads;
+        total->torn += stats[i].torn;
+        total->failed += stats[i].failed;
+    }
+    printf("%-7s %9.0f updates/s, %9.0f snapshots/s, %lu torn, %lu failed\n",
+           name, *writes, total->reads / (double)RUN_SECONDS, total->torn,
+           total->failed);
+    munmap(shm, sizeof(health_shm_t));
+    munmap(stats, NUM_READERS * sizeof(reader_stats_t));
+}
+
+int
+main(int argc, char **argv)
+{
+    static psu_info_t psu[MAX_PSU_NUM];
+    static status_info_t status[] = {
+        {.status = PSU_POWER_NO_GOOD, .status_desc = "Power no good"},
+    };
+    reader_stats_t total;
+    health_shm_t *shm, *next;
+    double writes;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    /*
+     * readers never see a mix of two updates
+     */
+    run("seqlock", 0, &total, &writes);
+    assert(total.reads > 0);
+    assert(total.torn == 0 && total.failed == 0);
+
+    /*
+     * ... which they would without the sequence counter
+     */
+    run("plain", 1, &total, &writes);
+    printf("%lu torn snapshots/s without the sequence counter\n",
+           total.torn / RUN_SECONDS);
+
+    /*
+     * a reader's mapping follows a restarted healthmon
+     */
+    shm = health_shm_create();
+    assert(shm);
+    publish(shm, 100);
+    assert(get_mmap_info((int*)psu, FILE_PSU, sizeof(psu)) == 0);
+    assert(check_psu(psu) == 100);
+    next = health_shm_create();
+    assert(next);
+    assert(shm->magic == 0);
+    publish(next, 200);
+    assert(get_mmap_info((int*)psu, FILE_PSU, sizeof(psu)) == 0);
+    assert(check_psu(psu) == 200);
+
+    /*
+     * clearing counters is a request to the writer, not a write
+     */
+    next->psu_info[2].status_cntr[PSU_POWER_NO_GOOD] = 7;
+    assert(reset_psu_mmap_stats(2, status, 1) == 0);
+    assert(next->psu_clear_req[2] == 1);
+    assert(next->psu_clear_req[1] == 0);
+    assert(next->psu_info[2].status_cntr[PSU_POWER_NO_GOOD] == 7);
+
+    munmap(shm, sizeof(health_shm_t));
+    munmap(next, sizeof(health_shm_t));
+    shm_unlink(HEALTH_SHM_NAME);
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -592,43 +592,6 @@ _enable_bic_update(uint8_t slot_id) {
   return ret;
 }
 
-// Update firmware for various components
-static int
-_update_fw(uint8_t slot_id, uint8_t target, uint32_t offset, uint16_t len, uint8_t *buf) {
-  uint8_t tbuf[256] = {0x15, 0xA0, 0x00}; // IANA ID
-  uint8_t rbuf[16] = {0x00};
-  uint8_t tlen = 0;
-  uint8_t rlen = 0;
-  int ret;
-  int retries = 3;
-
-  // Fill the component for which firmware is requested
-  tbuf[3] = target;
-
-  tbuf[4] = (offset) & 0xFF;
-  tbuf[5] = (offset >> 8) & 0xFF;
-  tbuf[6] = (offset >> 16) & 0xFF;
-  tbuf[7] = (offset >> 24) & 0xFF;
-
-  tbuf[8] = len & 0xFF;
-  tbuf[9] = (len >> 8) & 0xFF;
-
-  memcpy(&tbuf[10], buf, len);
-
-  tlen = len + 10;
-
-bic_send:
-  ret = bic_ipmb_wrapper(slot_id, NETFN_OEM_1S_REQ, CMD_OEM_1S_UPDATE_FW, tbuf, tlen, rbuf, &rlen);
-  if ((ret) && (retries--)) {
-    sleep(1);
-    printf("_update_fw: slot: %d, target %d, offset: %d, len: %d retrying..\
-           \n",    slot_id, target, offset, len);
-    goto bic_send;
-  }
-
-  return ret;
-}
-
 static int
 _update_bic_main(uint8_t slot_id, char *path) {
   int fd;
@@ -1074,19 +1037,133 @@ check_bios_image(int fd, long size) {
   return 0;
 }
 
+// Image being streamed to the Bridge-IC by ipmb_xfer()
+typedef struct {
+  uint8_t slot_id;
+  uint8_t comp;
+  int fd;
+  uint32_t size;
+  uint32_t offset;
+  uint32_t cksum;
+  uint32_t dsize;
+  uint32_t last_offset;
+} fw_stream_t;
+
+#define BIC_UPDATE_WINDOW 4
+#define BIC_UPDATE_MIN_CHUNK 32
+// resends of a packet that is NAKed or times out
+#define BIC_UPDATE_PKT_RETRIES 3
+
+static double
+elapsed(struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Build the next CMD_OEM_1S_UPDATE_FW request of the image
+static int
+_update_fw_next(void *ctx, unsigned char *request, int chunk, int *flags) {
+  fw_stream_t *s = (fw_stream_t *)ctx;
+  ipmb_req_t *req = (ipmb_req_t *)request;
+  uint8_t *tbuf = req->data;
+  uint32_t count = chunk;
+  uint8_t target = s->comp;
+  int i;
+
+  if (s->offset >= s->size) {
+    return 0;
+  }
+
+  // For BIOS, send packets in blocks of 64K
+  if (s->comp == UPDATE_BIOS &&
+      (s->offset % BIOS_ERASE_PKT_SIZE) + count > BIOS_ERASE_PKT_SIZE) {
+    count = BIOS_ERASE_PKT_SIZE - (s->offset % BIOS_ERASE_PKT_SIZE);
+  }
+  if (count > s->size - s->offset) {
+    count = s->size - s->offset;
+  }
+
+  if (pread(s->fd, &tbuf[10], count, s->offset) != count) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    s->cksum += tbuf[10 + i];
+  }
+
+  // The Bridge-IC erases a 64K block when its first packet arrives, so
+  // nothing else of the block may overtake it. Other images are written
+  // by the Bridge-IC in the order they arrive, so none of their packets
+  // are pipelined; the last one has an extra flag.
+  if (s->comp == UPDATE_BIOS) {
+    if ((s->offset % BIOS_ERASE_PKT_SIZE) == 0) {
+      *flags |= IPMB_XFER_BARRIER;
+    }
+  } else {
+    if (s->offset + count == s->size) {
+      target |= 0x80;
+    }
+    *flags |= IPMB_XFER_BARRIER;
+  }
+
+  req->res_slave_addr = BRIDGE_SLAVE_ADDR << 1;
+  req->netfn_lun = NETFN_OEM_1S_REQ << LUN_OFFSET;
+  req->hdr_cksum = ZERO_CKSUM_CONST - (req->res_slave_addr + req->netfn_lun);
+  req->req_slave_addr = BMC_SLAVE_ADDR << 1;
+  req->seq_lun = 0x00;
+  req->cmd = CMD_OEM_1S_UPDATE_FW;
+
+  // IANA ID
+  tbuf[0] = 0x15;
+  tbuf[1] = 0xA0;
+  tbuf[2] = 0x00;
+
+  // Fill the component for which firmware is requested
+  tbuf[3] = target;
+
+  tbuf[4] = (s->offset) & 0xFF;
+  tbuf[5] = (s->offset >> 8) & 0xFF;
+  tbuf[6] = (s->offset >> 16) & 0xFF;
+  tbuf[7] = (s->offset >> 24) & 0xFF;
+
+  tbuf[8] = count & 0xFF;
+  tbuf[9] = (count >> 8) & 0xFF;
+
+  s->offset += count;
+  if (s->dsize && (s->last_offset + s->dsize) <= s->offset) {
+    switch(s->comp) {
+      case UPDATE_BIOS:
+        set_fw_update_ongoing(s->slot_id, 25);
+        printf("updated bios: %d %%\n", s->offset/s->dsize);
+        break;
+      case UPDATE_CPLD:
+        printf("updated cpld: %d %%\n", s->offset/s->dsize*5);
+        break;
+      default:
+        printf("updated bic boot loader: %d %%\n", s->offset/s->dsize*5);
+        break;
+    }
+    s->last_offset += s->dsize;
+  }
+
+  return IPMB_HDR_SIZE + IPMI_REQ_HDR_SIZE + 10 + count;
+}
+
 int
 bic_update_fw(uint8_t slot_id, uint8_t comp, char *path) {
   int ret = -1, rc;
   uint32_t offset;
-  volatile uint16_t count, read_count;
-  uint8_t buf[256] = {0};
+  volatile uint16_t count;
   char    cmd[100] = {0};
-  uint8_t target;
   int fd;
   int i;
   uint32_t tcksum;
   uint32_t gcksum;
   uint8_t *tbuf = NULL;
+  fw_stream_t stream;
+  ipmb_xfer_t xfer;
+  struct timespec start;
 
   printf("updating fw on slot %d:\n", slot_id);
   // Handle Bridge IC firmware separately as the process differs significantly from others
@@ -1095,7 +1172,7 @@ bic_update_fw(uint8_t slot_id, uint8_t comp, char *path) {
     return  _update_bic_main(slot_id, path);
   }
 
-  uint32_t dsize, last_offset;
+  uint32_t dsize;
   struct stat st;
   // Open the file exclusively for read
   fd = open(path, O_RDONLY, 0666);
@@ -1132,55 +1209,35 @@ bic_update_fw(uint8_t slot_id, uint8_t comp, char *path) {
     set_fw_update_ongoing(slot_id, 20);
     dsize = st.st_size/20;
   }
-  // Write chunks of binary data in a loop
-  offset = 0;
-  last_offset = 0;
-  i = 1;
-  while (1) {
-    // For BIOS, send packets in blocks of 64K
-    if (comp == UPDATE_BIOS && ((offset+IPMB_WRITE_COUNT_MAX) > (i * BIOS_ERASE_PKT_SIZE))) {
-      read_count = (i * BIOS_ERASE_PKT_SIZE) - offset;
-      i++;
-    } else {
-      read_count = IPMB_WRITE_COUNT_MAX;
-    }
-
-    // Read from file
-    count = read(fd, buf, read_count);
-    if (count <= 0) {
-      break;
-    }
-
-    // For non-BIOS update, the last packet is indicated by extra flag
-    if ((comp != UPDATE_BIOS) && (count < read_count)) {
-      target = comp | 0x80;
-    } else {
-      target = comp;
-    }
-
-    // Send data to Bridge-IC
-    rc = _update_fw(slot_id, target, offset, count, buf);
-    if (rc) {
-      goto error_exit;
-    }
+  // Write chunks of binary data, several of them in flight
+  memset(&stream, 0, sizeof(stream));
+  stream.slot_id = slot_id;
+  stream.comp = comp;
+  stream.fd = fd;
+  stream.size = st.st_size;
+  stream.dsize = dsize;
 
-    // Update counter
-    offset += count;
-    if((last_offset + dsize) <= offset) {
-       switch(comp) {
-         case UPDATE_BIOS:
-           set_fw_update_ongoing(slot_id, 25);
-           printf("updated bios: %d %%\n", offset/dsize);
-           break;
-         case UPDATE_CPLD:
-           printf("updated cpld: %d %%\n", offset/dsize*5);
-           break;
-         default:
-           printf("updated bic boot loader: %d %%\n", offset/dsize*5);
-           break;
-       }
-       last_offset += dsize;
-    }
+  memset(&xfer, 0, sizeof(xfer));
+  rc = get_ipmb_bus_id(slot_id);
+  if (rc < 0) {
+    goto error_exit;
+  }
+  xfer.bus_id = rc;
+  xfer.max_window = BIC_UPDATE_WINDOW;
+  xfer.max_chunk = IPMB_WRITE_COUNT_MAX;
+  xfer.min_chunk = BIC_UPDATE_MIN_CHUNK;
+  xfer.retries = BIC_UPDATE_PKT_RETRIES;
+  xfer.timeout_ms = (TIMEOUT_IPMB + 1) * 1000;
+  xfer.next = _update_fw_next;
+  xfer.ctx = &stream;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  rc = ipmb_xfer(&xfer);
+  printf("sent %u bytes in %.1f s (%lu requests, %lu retransmitted, "
+         "window %d, chunk %d)\n", stream.offset, elapsed(&start),
+         xfer.requests, xfer.retransmits, xfer.window, xfer.chunk);
+  if (rc) {
+    goto error_exit;
   }
 
   if (comp != UPDATE_BIOS) {
@@ -1188,7 +1245,19 @@ bic_update_fw(uint8_t slot_id, uint8_t comp, char *path) {
   }
   set_fw_update_ongoing(slot_id, 55);
 
-  // Checksum calculation for BIOS image
+  // One checksum over the whole image, summed up while it was sent
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  rc = bic_get_fw_cksum(slot_id, comp, 0, stream.size, (uint8_t*)&gcksum);
+  if (rc == 0) {
+    if (gcksum != stream.cksum) {
+      printf("checksum does not match, 0x%x:0x%x\n", stream.cksum, gcksum);
+      goto error_exit;
+    }
+    printf("verified bios in %.1f s\n", elapsed(&start));
+    goto update_done;
+  }
+
+  // Bridge-IC could not sum the image at once, check it piece by piece
   tbuf = malloc(BIOS_VERIFY_PKT_SIZE * sizeof(uint8_t));
   if (!tbuf) {
     goto error_exit;